@@ -0,0 +1,376 @@
+// bench.c - Benchmarks for the frac binary
+//
+// Builds a synthetic working tree and times the commands whose speed
+// matters, once per scan engine:
+//   snapshot_cold     first snapshot, empty object store
+//   snapshot_noop     nothing changed since
+//   snapshot_warm     after --change-rate percent of the files changed
+//   diff              first against last snapshot
+//   list              snapshot listing
+//   restore           back to the first snapshot
+//   snapshot_restored nothing changed since the restore
+// Each measurement is one JSON object per line on stdout; progress goes to
+// stderr. Run through `make bench`, with options in BENCH_ARGS.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_ENGINES 8
+#define BENCH_OUTPUT_MAX (64 * 1024)
+
+typedef struct {
+    const char *frac;           // frac binary to time
+    const char *root;           // Where trees are generated
+    long files;
+    int depth;                  // Directory levels below the root
+    int fanout;                 // Subdirectories per directory
+    long min_size;              // File sizes are log-uniform in [min_size, max_size]
+    long max_size;
+    int change_rate;            // Percent of files rewritten before snapshot_warm
+    int runs;
+    uint64_t seed;
+    const char *engines[BENCH_MAX_ENGINES];
+    int engine_count;
+    int keep;                   // Leave the trees behind
+} bench_options_t;
+
+typedef struct {
+    long files;
+    unsigned long long bytes;
+} tree_stats_t;
+
+// xorshift64*: fast, and the same tree for the same seed everywhere
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000.0 + (double)now.tv_nsec / 1e6;
+}
+
+// A size between min and max whose logarithm is uniform, so small files
+// are common and large ones present, as in source trees
+static long pick_size(const bench_options_t *opts, uint64_t *state) {
+    int low = 0, high = 0;
+    while ((2L << low) <= opts->min_size) low++;
+    while ((1L << high) < opts->max_size) high++;
+    int bits = low + (int)(next_random(state) % (uint64_t)(high - low + 1));
+    long size = (1L << bits) + (long)(next_random(state) % (uint64_t)(1L << bits));
+    if (size < opts->min_size) size = opts->min_size;
+    if (size > opts->max_size) size = opts->max_size;
+    return size;
+}
+
+// Path of file i: its index in base fanout picks the directory at each level
+static void file_path(const bench_options_t *opts, const char *tree, long i, char *out, size_t size) {
+    int len = snprintf(out, size, "%s", tree);
+    long rest = i;
+    for (int level = 0; level < opts->depth && len < (int)size; level++) {
+        len += snprintf(out + len, size - (size_t)len, "/d%ld", rest % opts->fanout);
+        rest /= opts->fanout;
+    }
+    snprintf(out + len, size - (size_t)len, "/f%ld.dat", i);
+}
+
+static int make_parents(char *path) {
+    for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        int result = mkdir(path, 0755);
+        *p = '/';
+        if (result != 0 && errno != EEXIST) return -1;
+    }
+    return 0;
+}
+
+static int write_random_file(const char *path, long size, uint64_t *state) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    unsigned char buffer[65536];
+    long left = size;
+    while (left > 0) {
+        size_t n = left < (long)sizeof(buffer) ? (size_t)left : sizeof(buffer);
+        for (size_t i = 0; i < n; i += 8) {
+            uint64_t r = next_random(state);
+            memcpy(buffer + i, &r, n - i < 8 ? n - i : 8);
+        }
+        if (write(fd, buffer, n) != (ssize_t)n) {
+            close(fd);
+            return -1;
+        }
+        left -= (long)n;
+    }
+    return close(fd);
+}
+
+static int generate_tree(const bench_options_t *opts, const char *tree, tree_stats_t *stats) {
+    uint64_t state = opts->seed;
+    char path[4096];
+    memset(stats, 0, sizeof(*stats));
+    if (mkdir(tree, 0755) != 0 && errno != EEXIST) return -1;
+    for (long i = 0; i < opts->files; i++) {
+        file_path(opts, tree, i, path, sizeof(path));
+        long size = pick_size(opts, &state);
+        if (make_parents(path) != 0 || write_random_file(path, size, &state) != 0) return -1;
+        stats->files++;
+        stats->bytes += (unsigned long long)size;
+    }
+    return 0;
+}
+
+// Rewrite change_rate percent of the files with new content of a new size
+static long change_tree(const bench_options_t *opts, const char *tree, uint64_t seed) {
+    uint64_t state = seed;
+    char path[4096];
+    long changed = 0;
+    for (long i = 0; i < opts->files; i++) {
+        if ((long)(next_random(&state) % 100) >= opts->change_rate) continue;
+        file_path(opts, tree, i, path, sizeof(path));
+        if (write_random_file(path, pick_size(opts, &state), &state) == 0) changed++;
+    }
+    return changed;
+}
+
+// Run frac with args in dir. Its output goes to out (NUL-terminated, cut
+// at out_size) when given, else nowhere. Returns the exit status, -1 if it
+// could not run.
+static int run_frac(const bench_options_t *opts, const char *dir, char *const args[], char *out,
+                    size_t out_size, double *elapsed_ms) {
+    int pipe_fds[2] = { -1, -1 };
+    if (out && pipe(pipe_fds) != 0) return -1;
+    
+    double started = now_ms();
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int sink = out ? pipe_fds[1] : open("/dev/null", O_WRONLY);
+        dup2(sink, STDOUT_FILENO);
+        dup2(sink, STDERR_FILENO);
+        if (out) close(pipe_fds[0]);
+        if (chdir(dir) != 0) _exit(127);
+        char *argv[16];
+        int argc = 0;
+        argv[argc++] = (char *)opts->frac;
+        for (int i = 0; args[i] && argc < 15; i++) argv[argc++] = args[i];
+        argv[argc] = NULL;
+        execv(opts->frac, argv);
+        _exit(127);
+    }
+    
+    size_t used = 0;
+    if (out) {
+        close(pipe_fds[1]);
+        ssize_t n;
+        char discard[4096];
+        while ((n = read(pipe_fds[0], used + 1 < out_size ? out + used : discard,
+                         used + 1 < out_size ? out_size - used - 1 : sizeof(discard))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (used + 1 < out_size) used += (size_t)n;
+        }
+        close(pipe_fds[0]);
+        out[used] = '\0';
+    }
+    
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) continue;
+    *elapsed_ms = now_ms() - started;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// The id in a snapshot's "Created snapshot <id>:" line
+static int created_id(const char *output, char *id, size_t size) {
+    const char *line = strstr(output, "Created snapshot ");
+    if (!line) return -1;
+    line += strlen("Created snapshot ");
+    size_t len = strcspn(line, ": \n");
+    if (len == 0 || len >= size) return -1;
+    memcpy(id, line, len);
+    id[len] = '\0';
+    return 0;
+}
+
+static void report(const char *engine, const char *op, int run, double ms, int status,
+                   const tree_stats_t *stats, long changed) {
+    printf("{\"engine\":\"%s\",\"op\":\"%s\",\"run\":%d,\"ms\":%.1f,\"exit\":%d,"
+           "\"files\":%ld,\"bytes\":%llu,\"changed\":%ld}\n",
+           engine, op, run, ms, status, stats->files, stats->bytes, changed);
+    fflush(stdout);
+    fprintf(stderr, "  %-10s %-18s %10.1f ms%s\n", engine, op, ms, status == 0 ? "" : "  (failed)");
+}
+
+// One pass over the operations for an engine, in a fresh tree
+static int bench_engine(const bench_options_t *opts, const char *engine, int run) {
+    char tree[4096];
+    snprintf(tree, sizeof(tree), "%s/%s-%d", opts->root, engine, run);
+    
+    fprintf(stderr, "Generating %ld files in %s...\n", opts->files, tree);
+    tree_stats_t stats;
+    if (generate_tree(opts, tree, &stats) != 0) {
+        fprintf(stderr, "Error: Failed to generate %s: %s\n", tree, strerror(errno));
+        return -1;
+    }
+    
+    static char output[BENCH_OUTPUT_MAX];
+    double ms;
+    char *init_args[] = { "init", NULL };
+    if (run_frac(opts, tree, init_args, NULL, 0, &ms) != 0) {
+        fprintf(stderr, "Error: frac init failed in %s\n", tree);
+        return -1;
+    }
+    
+    char first_id[128] = "", last_id[128] = "";
+    char *snapshot_args[] = { "snapshot", "-m", "bench", "--scan-engine", (char *)engine, NULL };
+    int status = run_frac(opts, tree, snapshot_args, output, sizeof(output), &ms);
+    report(engine, "snapshot_cold", run, ms, status, &stats, stats.files);
+    if (status != 0 || created_id(output, first_id, sizeof(first_id)) != 0) return -1;
+    
+    status = run_frac(opts, tree, snapshot_args, NULL, 0, &ms);
+    report(engine, "snapshot_noop", run, ms, status, &stats, 0);
+    
+    long changed = change_tree(opts, tree, opts->seed ^ (uint64_t)(run + 1) * 0x9E3779B97F4A7C15ULL);
+    status = run_frac(opts, tree, snapshot_args, output, sizeof(output), &ms);
+    report(engine, "snapshot_warm", run, ms, status, &stats, changed);
+    if (status == 0 && created_id(output, last_id, sizeof(last_id)) != 0) {
+        snprintf(last_id, sizeof(last_id), "%s", first_id); // Nothing seen as changed
+    }
+    
+    if (last_id[0]) {
+        char *diff_args[] = { "diff", first_id, last_id, NULL };
+        status = run_frac(opts, tree, diff_args, NULL, 0, &ms);
+        report(engine, "diff", run, ms, status, &stats, changed);
+    }
+    
+    char *list_args[] = { "list", NULL };
+    status = run_frac(opts, tree, list_args, NULL, 0, &ms);
+    report(engine, "list", run, ms, status, &stats, 0);
+    
+    char *restore_args[] = { "restore", first_id, NULL };
+    status = run_frac(opts, tree, restore_args, NULL, 0, &ms);
+    report(engine, "restore", run, ms, status, &stats, changed);
+    
+    status = run_frac(opts, tree, snapshot_args, NULL, 0, &ms);
+    report(engine, "snapshot_restored", run, ms, status, &stats, 0);
+    
+    if (!opts->keep) {
+        char command[4200];
+        snprintf(command, sizeof(command), "rm -rf '%s'", tree);
+        if (system(command) != 0) fprintf(stderr, "Warning: Could not remove %s\n", tree);
+    }
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: bench [options]\n"
+            "  --frac <path>          frac binary to time (default ./frac)\n"
+            "  --root <dir>           where trees are generated (default /tmp/fractyl-bench)\n"
+            "  --files <n>            files per tree (default 2000)\n"
+            "  --depth <n>            directory levels (default 3)\n"
+            "  --fanout <n>           subdirectories per directory (default 8)\n"
+            "  --min-size <bytes>     smallest file (default 64)\n"
+            "  --max-size <bytes>     largest file (default 65536)\n"
+            "  --change-rate <pct>    files changed before the warm snapshot (default 10)\n"
+            "  --engines <a,b,...>    scan engines (default parallel,cached,binary,stat-only)\n"
+            "  --runs <n>             passes per engine (default 1)\n"
+            "  --seed <n>             tree contents (default 1)\n"
+            "  --keep                 leave the trees behind\n");
+}
+
+int main(int argc, char **argv) {
+    bench_options_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.frac = "./frac";
+    opts.root = "/tmp/fractyl-bench";
+    opts.files = 2000;
+    opts.depth = 3;
+    opts.fanout = 8;
+    opts.min_size = 64;
+    opts.max_size = 64 * 1024;
+    opts.change_rate = 10;
+    opts.runs = 1;
+    opts.seed = 1;
+    char *engines = strdup("parallel,cached,binary,stat-only");
+    
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--keep") == 0) {
+            opts.keep = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--help") == 0 || !value) {
+            usage();
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+        if (strcmp(argv[i], "--frac") == 0) opts.frac = value;
+        else if (strcmp(argv[i], "--root") == 0) opts.root = value;
+        else if (strcmp(argv[i], "--files") == 0) opts.files = atol(value);
+        else if (strcmp(argv[i], "--depth") == 0) opts.depth = atoi(value);
+        else if (strcmp(argv[i], "--fanout") == 0) opts.fanout = atoi(value);
+        else if (strcmp(argv[i], "--min-size") == 0) opts.min_size = atol(value);
+        else if (strcmp(argv[i], "--max-size") == 0) opts.max_size = atol(value);
+        else if (strcmp(argv[i], "--change-rate") == 0) opts.change_rate = atoi(value);
+        else if (strcmp(argv[i], "--runs") == 0) opts.runs = atoi(value);
+        else if (strcmp(argv[i], "--seed") == 0) opts.seed = strtoull(value, NULL, 10);
+        else if (strcmp(argv[i], "--engines") == 0) {
+            free(engines);
+            engines = strdup(value);
+        } else {
+            usage();
+            return 1;
+        }
+        i++;
+    }
+    if (opts.files < 1 || opts.depth < 0 || opts.fanout < 1 || opts.min_size < 1 ||
+        opts.max_size < opts.min_size || opts.change_rate < 0 || opts.change_rate > 100 ||
+        opts.runs < 1 || !engines) {
+        fprintf(stderr, "Error: Invalid benchmark options\n");
+        usage();
+        return 1;
+    }
+    if (opts.seed == 0) opts.seed = 1; // xorshift never leaves zero
+    if (access(opts.frac, X_OK) != 0) {
+        fprintf(stderr, "Error: %s is not an executable frac binary\n", opts.frac);
+        return 1;
+    }
+    if (opts.frac[0] != '/') {
+        // Commands run inside the generated trees
+        char *resolved = realpath(opts.frac, NULL);
+        if (resolved) opts.frac = resolved;
+    }
+    
+    for (char *name = strtok(engines, ","); name && opts.engine_count < BENCH_MAX_ENGINES;
+         name = strtok(NULL, ",")) {
+        opts.engines[opts.engine_count++] = name;
+    }
+    if (mkdir(opts.root, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: Cannot create %s: %s\n", opts.root, strerror(errno));
+        return 1;
+    }
+    
+    int failed = 0;
+    for (int run = 1; run <= opts.runs; run++) {
+        for (int e = 0; e < opts.engine_count; e++) {
+            if (bench_engine(&opts, opts.engines[e], run) != 0) failed = 1;
+        }
+    }
+    free(engines);
+    return failed;
+}
@@ -0,0 +1,484 @@
+// micro.c - Microbenchmarks for the kernels behind snapshot, diff and scan
+//
+// Each benchmark is a Unity test, so a kernel that stops giving the right
+// answer fails the run instead of getting faster:
+//   hash_data        throughput per buffer size, for each hash algorithm
+//   hash_file        throughput per file size
+//   index_find       index_find_entry() hits and misses per index size
+//   binary_find      binary_index_find_entry() on a saved and loaded index
+//   ignore           the ignore engine and should_ignore_path() on a
+//                    realistic set of .gitignore files
+//   index_save_load  index_save() and index_load() per index size
+//   diff             fractyl_diff_unified() on typical and pathological input
+// Index sizes go from 10k entries up to --max-entries (default 1M; 10M
+// needs a few GB of memory). Every measurement is one JSON object per line
+// on stdout. Run through `make microbench`, with options in MICROBENCH_ARGS.
+
+#include "../test/unity/unity.h"
+#include "../src/core/hash.h"
+#include "../src/core/index.h"
+#include "../src/utils/binary_index.h"
+#include "../src/utils/gitignore.h"
+#include "../src/vendor/xdiff/fractyl-diff.h"
+#include "../src/include/fractyl.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MICRO_DIR "/tmp/fractyl-microbench"
+#define MICRO_LOOKUPS 1000000
+#define MICRO_HASH_BYTES (256ULL * 1024 * 1024)
+
+static long max_entries = 1000000;
+static const char *only;
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// xorshift64*, as in bench.c: the same inputs on every run
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static unsigned long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+// One result line; bytes is 0 where throughput means nothing
+static void report(const char *bench, const char *param, unsigned long long ops, unsigned long long ns,
+                   unsigned long long bytes) {
+    printf("{\"bench\":\"%s\",\"param\":\"%s\",\"ops\":%llu,\"ms\":%.3f,\"ns_per_op\":%.1f", bench, param,
+           ops, (double)ns / 1e6, ops ? (double)ns / (double)ops : 0.0);
+    if (bytes > 0 && ns > 0) {
+        printf(",\"mb_per_s\":%.1f", ((double)bytes / (1024.0 * 1024.0)) / ((double)ns / 1e9));
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void fill_random(unsigned char *buf, size_t size, uint64_t seed) {
+    uint64_t state = seed;
+    for (size_t i = 0; i < size; i += 8) {
+        uint64_t v = next_random(&state);
+        memcpy(buf + i, &v, size - i < 8 ? size - i : 8);
+    }
+}
+
+// Path of entry i of a synthetic tree: 100 files per directory, 100
+// directories per parent
+static void entry_path(long i, char *out, size_t size) {
+    snprintf(out, size, "src/module%03ld/part%03ld/file%07ld.c", (i / 10000) % 1000, (i / 100) % 100, i);
+}
+
+static void build_index(index_t *index, long count) {
+    index_init(index);
+    char path[256];
+    index_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    for (long i = 0; i < count; i++) {
+        entry_path(i, path, sizeof(path));
+        entry.path = path;
+        entry.size = (uint64_t)i;
+        entry.mtime = 1700000000 + i;
+        entry.mode = 0100644;
+        memcpy(entry.hash, &i, sizeof(i));
+        TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry_direct(index, &entry));
+    }
+}
+
+void bench_hash_data(void) {
+    static const size_t sizes[] = {64, 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024, 64 * 1024 * 1024};
+    unsigned char *buf = malloc(sizes[5]);
+    TEST_ASSERT_NOT_NULL(buf);
+    fill_random(buf, sizes[5], 1);
+    
+    hash_algorithm_t saved = hash_get_algorithm();
+    for (int algorithm = HASH_ALGORITHM_SHA256; algorithm <= HASH_ALGORITHM_BLAKE3; algorithm++) {
+        TEST_ASSERT_EQUAL(FRACTYL_OK, hash_set_algorithm((hash_algorithm_t)algorithm));
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            unsigned long long ops = MICRO_HASH_BYTES / sizes[s];
+            if (ops > 2000000) ops = 2000000;
+            if (ops < 4) ops = 4;
+            unsigned char hash[FRACTYL_HASH_SIZE];
+            unsigned long long start = now_ns();
+            for (unsigned long long i = 0; i < ops; i++) {
+                TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data(buf, sizes[s], hash));
+            }
+            char param[64];
+            snprintf(param, sizeof(param), "%s size=%zu", hash_algorithm_name((hash_algorithm_t)algorithm),
+                     sizes[s]);
+            report("hash_data", param, ops, now_ns() - start, ops * sizes[s]);
+        }
+    }
+    hash_set_algorithm(saved);
+    free(buf);
+}
+
+void bench_hash_file(void) {
+    static const size_t sizes[] = {4 * 1024, 1024 * 1024, 64 * 1024 * 1024};
+    unsigned char *buf = malloc(sizes[2]);
+    TEST_ASSERT_NOT_NULL(buf);
+    fill_random(buf, sizes[2], 2);
+    
+    hash_algorithm_t saved = hash_get_algorithm();
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/hash_%zu", MICRO_DIR, sizes[s]);
+        FILE *fp = fopen(path, "wb");
+        TEST_ASSERT_NOT_NULL(fp);
+        TEST_ASSERT_EQUAL(sizes[s], fwrite(buf, 1, sizes[s], fp));
+        fclose(fp);
+    
+        // The file hashes to what its content does
+        unsigned char expected[FRACTYL_HASH_SIZE], hash[FRACTYL_HASH_SIZE];
+        for (int algorithm = HASH_ALGORITHM_SHA256; algorithm <= HASH_ALGORITHM_BLAKE3; algorithm++) {
+            hash_set_algorithm((hash_algorithm_t)algorithm);
+            TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data(buf, sizes[s], expected));
+            unsigned long long ops = MICRO_HASH_BYTES / sizes[s];
+            if (ops > 20000) ops = 20000;
+            if (ops < 4) ops = 4;
+            unsigned long long start = now_ns();
+            for (unsigned long long i = 0; i < ops; i++) {
+                TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(path, hash));
+            }
+            unsigned long long elapsed = now_ns() - start;
+            TEST_ASSERT_EQUAL_MEMORY(expected, hash, FRACTYL_HASH_SIZE);
+            char param[64];
+            snprintf(param, sizeof(param), "%s size=%zu", hash_algorithm_name((hash_algorithm_t)algorithm),
+                     sizes[s]);
+            report("hash_file", param, ops, elapsed, ops * sizes[s]);
+        }
+        unlink(path);
+    }
+    hash_set_algorithm(saved);
+    free(buf);
+}
+
+void bench_index_find(void) {
+    for (long count = 10000; count <= max_entries; count *= 10) {
+        index_t index;
+        build_index(&index, count);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, index_prepare_lookup(&index));
+    
+        uint64_t state = (uint64_t)count;
+        char path[256];
+        unsigned long long start = now_ns();
+        for (long i = 0; i < MICRO_LOOKUPS; i++) {
+            long target = (long)(next_random(&state) % (uint64_t)count);
+            entry_path(target, path, sizeof(path));
+            const index_entry_t *entry = index_find_entry(&index, path);
+            TEST_ASSERT_NOT_NULL(entry);
+        }
+        char param[64];
+        snprintf(param, sizeof(param), "hit entries=%ld", count);
+        report("index_find", param, MICRO_LOOKUPS, now_ns() - start, 0);
+    
+        start = now_ns();
+        for (long i = 0; i < MICRO_LOOKUPS; i++) {
+            entry_path(count + i, path, sizeof(path));
+            TEST_ASSERT_NULL(index_find_entry(&index, path));
+        }
+        snprintf(param, sizeof(param), "miss entries=%ld", count);
+        report("index_find", param, MICRO_LOOKUPS, now_ns() - start, 0);
+        index_free(&index);
+    }
+}
+
+void bench_binary_find(void) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = 0100644;
+    unsigned char hash[FRACTYL_HASH_SIZE];
+    memset(hash, 0x5a, sizeof(hash));
+    char fractyl_dir[256];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", MICRO_DIR);
+    mkdir(fractyl_dir, 0755);
+    
+    for (long count = 10000; count <= max_entries; count *= 10) {
+        binary_index_t built;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, binary_index_init(&built, "master"));
+        char path[256];
+        for (long i = 0; i < count; i++) {
+            entry_path(i, path, sizeof(path));
+            st.st_size = i;
+            st.st_ino = (ino_t)i;
+            TEST_ASSERT_EQUAL(FRACTYL_OK, binary_index_update_entry(&built, path, &st, hash));
+        }
+        // Scans look entries up in an index mapped from disk
+        TEST_ASSERT_EQUAL(FRACTYL_OK, binary_index_save(&built, fractyl_dir));
+        binary_index_free(&built);
+        binary_index_t index;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, binary_index_load(&index, fractyl_dir, "master"));
+    
+        uint64_t state = (uint64_t)count;
+        unsigned long long start = now_ns();
+        for (long i = 0; i < MICRO_LOOKUPS; i++) {
+            long target = (long)(next_random(&state) % (uint64_t)count);
+            entry_path(target, path, sizeof(path));
+            const binary_index_entry_t *entry = binary_index_find_entry(&index, path, NULL);
+            TEST_ASSERT_NOT_NULL(entry);
+        }
+        char param[64];
+        snprintf(param, sizeof(param), "hit entries=%ld", count);
+        report("binary_find", param, MICRO_LOOKUPS, now_ns() - start, 0);
+    
+        start = now_ns();
+        for (long i = 0; i < MICRO_LOOKUPS; i++) {
+            entry_path(count + i, path, sizeof(path));
+            TEST_ASSERT_NULL(binary_index_find_entry(&index, path, NULL));
+        }
+        snprintf(param, sizeof(param), "miss entries=%ld", count);
+        report("binary_find", param, MICRO_LOOKUPS, now_ns() - start, 0);
+        binary_index_free(&index);
+    }
+}
+
+static void write_file(const char *path, const char *content) {
+    FILE *fp = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fputs(content, fp);
+    fclose(fp);
+}
+
+// Rules of the kind a mixed C, Python and JavaScript repository carries
+static const char *ROOT_GITIGNORE =
+    "# Build output\n*.o\n*.a\n*.so\n*.obj\n*.exe\nbuild/\ndist/\nout/\n/bin/\n"
+    "# Dependencies\nnode_modules/\nvendor/bundle/\n.venv/\n__pycache__/\n*.py[cod]\n"
+    "# Editors and tools\n.idea/\n.vscode/\n*.swp\n*~\n.DS_Store\n*.log\ncoverage/\n.cache/\n"
+    "# Generated\n*.min.js\n*.map\ndocs/_build/\nsrc/**/*.gen.c\n!src/**/keep.gen.c\n"
+    "tmp*\n/config.local.*\n*.tmp\n.env\n.env.*\n!.env.example\n";
+static const char *NESTED_GITIGNORE = "*.csv\n!fixtures/*.csv\n/local/\n*.snap\n";
+
+void bench_ignore(void) {
+    char root[256], path[512];
+    snprintf(root, sizeof(root), "%s/ignore", MICRO_DIR);
+    snprintf(path, sizeof(path), "mkdir -p %s/src/module001/part001 %s/test/data", root, root);
+    TEST_ASSERT_EQUAL(0, system(path));
+    snprintf(path, sizeof(path), "%s/.gitignore", root);
+    write_file(path, ROOT_GITIGNORE);
+    snprintf(path, sizeof(path), "%s/test/data/.gitignore", root);
+    write_file(path, NESTED_GITIGNORE);
+    snprintf(path, sizeof(path), "%s/.fractylignore", root);
+    write_file(path, "*.bak\nscratch/\n");
+    
+    // Ignored directories are pruned by the scan, so they are checked as
+    // directories rather than through a file below them
+    static const struct {
+        const char *path;
+        int is_directory;
+        int expected;
+    } paths[] = {
+        {"src/module001/part001/file0000001.c", 0, 0}, {"src/module001/part001/file0000001.o", 0, 1},
+        {"build", 1, 1}, {"node_modules", 1, 1}, {"app/static/bundle.min.js", 0, 1},
+        {"lib/__pycache__", 1, 1}, {"test/data/results.csv", 0, 1}, {"test/data/fixtures/a.csv", 0, 0},
+        {"docs/guide/intro.md", 0, 0}, {"src/gen/keep.gen.c", 0, 0}, {"src/gen/table.gen.c", 0, 1},
+        {"notes.txt.bak", 0, 1}, {"tmpfile", 0, 1}, {"README.md", 0, 0}, {".env", 0, 1},
+        {".env.example", 0, 0},
+    };
+    size_t path_count = sizeof(paths) / sizeof(paths[0]);
+    
+    ignore_engine_t *engine = ignore_engine_create(root);
+    TEST_ASSERT_NOT_NULL(engine);
+    const ignore_dir_t *data_rules = ignore_engine_enter_dir(engine, ignore_engine_root(engine), "test");
+    data_rules = ignore_engine_enter_dir(engine, data_rules, "test/data");
+    
+    unsigned long long ops = 0;
+    unsigned long long start = now_ns();
+    for (int round = 0; round < 200000; round++) {
+        for (size_t i = 0; i < path_count; i++) {
+            const ignore_dir_t *rules = strncmp(paths[i].path, "test/data/", 10) == 0
+                                            ? data_rules : ignore_engine_root(engine);
+            int ignored = ignore_engine_should_ignore(engine, rules, paths[i].path, paths[i].is_directory);
+            if (round == 0) TEST_ASSERT_EQUAL_MESSAGE(paths[i].expected, ignored, paths[i].path);
+            ops++;
+        }
+    }
+    report("ignore", "engine", ops, now_ns() - start, 0);
+    ignore_engine_free(engine);
+    
+    // The uncompiled path, which reads the ignore files on every call
+    ops = 0;
+    start = now_ns();
+    for (int round = 0; round < 200; round++) {
+        for (size_t i = 0; i < path_count; i++) {
+            char full_path[1024];
+            snprintf(full_path, sizeof(full_path), "%s/%s", root, paths[i].path);
+            should_ignore_path(root, full_path, paths[i].path);
+            ops++;
+        }
+    }
+    report("ignore", "should_ignore_path", ops, now_ns() - start, 0);
+}
+
+void bench_index_save_load(void) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/index", MICRO_DIR);
+    for (long count = 10000; count <= max_entries; count *= 10) {
+        index_t index;
+        build_index(&index, count);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, index_sort(&index, 1));
+        unlink(path);
+    
+        unsigned long long start = now_ns();
+        TEST_ASSERT_EQUAL(FRACTYL_OK, index_save(&index, path));
+        unsigned long long elapsed = now_ns() - start;
+        struct stat st;
+        TEST_ASSERT_EQUAL(0, stat(path, &st));
+        char param[64];
+        snprintf(param, sizeof(param), "save entries=%ld", count);
+        report("index_save_load", param, 1, elapsed, (unsigned long long)st.st_size);
+    
+        index_t loaded;
+        index_init(&loaded);
+        start = now_ns();
+        TEST_ASSERT_EQUAL(FRACTYL_OK, index_load(&loaded, path));
+        elapsed = now_ns() - start;
+        TEST_ASSERT_EQUAL(index.count, loaded.count);
+        snprintf(param, sizeof(param), "load entries=%ld", count);
+        report("index_save_load", param, 1, elapsed, (unsigned long long)st.st_size);
+    
+        index_free(&loaded);
+        index_free(&index);
+        unlink(path);
+    }
+}
+
+// Lines of source-like text: "line <n> of <seed>" with some variety
+static char *make_text(long lines, uint64_t seed, size_t *size_out) {
+    char *text = malloc((size_t)lines * 64 + 1);
+    TEST_ASSERT_NOT_NULL(text);
+    size_t size = 0;
+    uint64_t state = seed;
+    for (long i = 0; i < lines; i++) {
+        size += (size_t)sprintf(text + size, "    value_%ld = compute(%llu, %ld);\n", i,
+                                (unsigned long long)(next_random(&state) % 1000), i % 17);
+    }
+    *size_out = size;
+    return text;
+}
+
+static void time_diff(const char *param, const char *a, size_t size_a, const char *b, size_t size_b,
+                      int runs) {
+    FILE *out = fopen("/dev/null", "w");
+    TEST_ASSERT_NOT_NULL(out);
+    unsigned long long start = now_ns();
+    for (int i = 0; i < runs; i++) {
+        TEST_ASSERT_EQUAL(0, fractyl_diff_unified(out, "a", a, size_a, "b", b, size_b, 3));
+    }
+    report("diff", param, (unsigned long long)runs, now_ns() - start, (unsigned long long)(size_a + size_b) * runs);
+    fclose(out);
+}
+
+void bench_diff(void) {
+    // Typical: a 10k-line file with 1% of its lines edited here and there
+    size_t size_a, size_b;
+    char *a = make_text(10000, 3, &size_a);
+    char *b = malloc(size_a + 10000 * 8 + 1);
+    TEST_ASSERT_NOT_NULL(b);
+    size_b = 0;
+    uint64_t state = 4;
+    const char *line = a;
+    while (line < a + size_a) {
+        const char *end = memchr(line, '\n', (size_t)(a + size_a - line)) + 1;
+        if (next_random(&state) % 100 == 0) {
+            size_b += (size_t)sprintf(b + size_b, "    // edited\n");
+        } else {
+            memcpy(b + size_b, line, (size_t)(end - line));
+            size_b += (size_t)(end - line);
+        }
+        line = end;
+    }
+    time_diff("typical lines=10000 edits=1%", a, size_a, b, size_b, 50);
+    
+    // Completely different files of the same length
+    size_t size_c;
+    char *c = make_text(10000, 5, &size_c);
+    time_diff("rewritten lines=10000", a, size_a, c, size_c, 5);
+    
+    // Many identical lines, which defeat line matching heuristics
+    size_t rep_size = 20000 * 2;
+    char *same_a = malloc(rep_size + 1), *same_b = malloc(rep_size + 3);
+    TEST_ASSERT_NOT_NULL(same_a);
+    TEST_ASSERT_NOT_NULL(same_b);
+    for (size_t i = 0; i < rep_size; i += 2) {
+        same_a[i] = '}';
+        same_a[i + 1] = '\n';
+    }
+    memcpy(same_b, "x\n", 2);
+    memcpy(same_b + 2, same_a, rep_size);
+    time_diff("repeated lines=20000", same_a, rep_size, same_b, rep_size + 2, 5);
+    
+    // One long line that changes in the middle
+    size_t long_size = 4 * 1024 * 1024;
+    char *long_a = malloc(long_size), *long_b = malloc(long_size);
+    TEST_ASSERT_NOT_NULL(long_a);
+    TEST_ASSERT_NOT_NULL(long_b);
+    memset(long_a, 'a', long_size);
+    memcpy(long_b, long_a, long_size);
+    long_b[long_size / 2] = 'b';
+    time_diff("one line bytes=4194304", long_a, long_size, long_b, long_size, 5);
+    
+    free(long_a);
+    free(long_b);
+    free(same_a);
+    free(same_b);
+    free(a);
+    free(b);
+    free(c);
+}
+
+static void print_usage(void) {
+    printf("Usage: microbench [--max-entries <n>] [--only <bench>]\n");
+    printf("  --max-entries <n>  Largest index size (default 1000000)\n");
+    printf("  --only <bench>     hash_data, hash_file, index_find, binary_find, ignore,\n");
+    printf("                     index_save_load or diff\n");
+}
+
+#define RUN_BENCH(name) do { if (!only || strcmp(only, #name) == 0) RUN_TEST(bench_##name); } while (0)
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-entries") == 0 && i + 1 < argc) {
+            max_entries = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    if (system("rm -rf " MICRO_DIR " && mkdir -p " MICRO_DIR) != 0) {
+        printf("Error: Cannot create %s\n", MICRO_DIR);
+        return 1;
+    }
+    
+    UNITY_BEGIN();
+    RUN_BENCH(hash_data);
+    RUN_BENCH(hash_file);
+    RUN_BENCH(index_find);
+    RUN_BENCH(binary_find);
+    RUN_BENCH(ignore);
+    RUN_BENCH(index_save_load);
+    RUN_BENCH(diff);
+    int failures = UNITY_END();
+    
+    if (system("rm -rf " MICRO_DIR) != 0) {
+        printf("Warning: Could not remove %s\n", MICRO_DIR);
+    }
+    return failures;
+}
@@ -0,0 +1,70 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../core/alternates.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void print_alternates_usage(void) {
+    printf("Usage: frac alternates [list]\n");
+    printf("       frac alternates add <dir> [--write]\n");
+    printf("Find objects in shared object stores too, e.g. across checkouts of one project\n");
+    printf("\nA store is created if <dir> does not exist yet. Stores are not removed\n");
+    printf("from a repository: its snapshots may need their objects.\n");
+    printf("\nOptions:\n");
+    printf("  --write    Store new objects there rather than in the repository\n");
+    printf("\nCollect a store with 'frac gc --shared' from any repository using it.\n");
+}
+
+int cmd_alternates(int argc, char **argv) {
+    const char *action = argc > 2 ? argv[2] : "list";
+    int write = 0;
+    const char *store = NULL;
+    if (strcmp(action, "add") == 0) {
+        for (int i = 3; i < argc; i++) {
+            if (strcmp(argv[i], "--write") == 0) {
+                write = 1;
+            } else if (argv[i][0] != '-' && !store) {
+                store = argv[i];
+            } else {
+                store = NULL;
+                break;
+            }
+        }
+    }
+    if (strcmp(action, "add") == 0 ? !store : strcmp(action, "list") != 0 || argc > 3) {
+        print_alternates_usage();
+        return 1;
+    }
+    
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
+    }
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    free(repo_root);
+    
+    if (store) {
+        // Takes the store's lock itself; the repository's would hold it shared
+        char message[512] = "";
+        if (alternates_add(fractyl_dir, store, write, message, sizeof(message)) != FRACTYL_OK) {
+            printf("Error: Could not add %s: %s\n", store, message[0] ? message : "unknown error");
+            return 1;
+        }
+        printf("Added shared object store %s%s\n", store, write ? " (new objects go there)" : "");
+        return 0;
+    }
+    
+    const char *const *stores;
+    size_t count = alternates_list(fractyl_dir, &stores);
+    if (count == 0) {
+        printf("No shared object stores (add one with 'frac alternates add <dir>')\n");
+    }
+    const char *write_dir = alternates_write_dir(fractyl_dir);
+    for (size_t i = 0; i < count; i++) {
+        printf("%s%s\n", stores[i], stores[i] == write_dir ? "  (new objects go here)" : "");
+    }
+    return 0;
+}
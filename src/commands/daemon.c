@@ -14,12 +14,112 @@ static void print_daemon_usage(void) {
     printf("  status    Show daemon status\n");
     printf("  restart   Restart the daemon\n\n");
     printf("Options for 'start':\n");
-    printf("  -i, --interval SECONDS    Set snapshot interval in seconds (default: 180)\n\n");
+    printf("  -i, --interval SECONDS    Set snapshot interval in seconds (default: 180)\n");
+    printf("  -w, --watch               Only rescan paths reported by filesystem events\n\n");
+    printf("With --all, any command acts on one daemon for every repository listed in\n");
+    printf("$FRACTYL_DAEMON_HOME/repos (default ~/.config/fractyl/repos).\n\n");
     printf("Examples:\n");
     printf("  frac daemon start         # Start daemon with 3-minute intervals\n");
     printf("  frac daemon start -i 60   # Start daemon with 1-minute intervals\n");
+    printf("  frac daemon start -w      # Snapshot only what changed, using inotify\n");
     printf("  frac daemon stop          # Stop the daemon\n");
     printf("  frac daemon status        # Check if daemon is running\n");
+    printf("  frac daemon start --all   # One daemon for all listed repositories\n");
+}
+
+// Parse the options of start and restart, other than --all
+static int parse_start_options(int argc, char **argv, uint32_t *interval_seconds, int *watch_mode) {
+    *interval_seconds = 0;
+    *watch_mode = 0;
+    
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--all") == 0) {
+            continue;
+        } else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--watch") == 0) {
+            *watch_mode = 1;
+        } else if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--interval") == 0) {
+            if (i + 1 >= argc) {
+                printf("Error: --interval requires a value\n");
+                return -1;
+            }
+            *interval_seconds = (uint32_t)atoi(argv[++i]);
+            if (*interval_seconds == 0) {
+                printf("Error: Invalid interval value\n");
+                return -1;
+            }
+        } else {
+            printf("Error: Unknown option '%s'\n", argv[i]);
+            print_daemon_usage();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// frac daemon <command> --all: the daemon of every listed repository
+static int cmd_daemon_all(int argc, char **argv) {
+    const char *command = argv[2];
+    char *home = daemon_host_home();
+    if (!home) {
+        printf("Error: Set FRACTYL_DAEMON_HOME or HOME to find the repository list\n");
+        return 1;
+    }
+    
+    int result = 0;
+    if (strcmp(command, "start") == 0 || strcmp(command, "restart") == 0) {
+        uint32_t interval_seconds;
+        int watch_mode;
+        daemon_host_t host;
+        if (parse_start_options(argc, argv, &interval_seconds, &watch_mode) != 0) {
+            result = 1;
+        } else if (daemon_host_init(&host, home) != 0) {
+            daemon_host_cleanup(&host);
+            result = 1;
+        } else {
+            if (strcmp(command, "restart") == 0) {
+                printf("Restarting Fractyl daemon...\n");
+                daemon_stop(home);
+            } else {
+                printf("Starting Fractyl daemon...\n");
+            }
+            printf("Repository list: %s/repos\n", home);
+            result = daemon_host_start_background(&host, interval_seconds, watch_mode) == 0 ? 0 : 1;
+            daemon_host_cleanup(&host);
+        }
+        
+    } else if (strcmp(command, "stop") == 0) {
+        result = daemon_stop(home);
+        
+    } else if (strcmp(command, "status") == 0) {
+        pid_t daemon_pid;
+        if (daemon_status(home, &daemon_pid)) {
+            printf("Daemon is running (PID: %d)\n", daemon_pid);
+        } else {
+            printf("Daemon is not running\n");
+            daemon_pid = 0;
+        }
+        
+        daemon_host_t host;
+        if (daemon_host_init(&host, home) == 0) {
+            for (size_t i = 0; i < host.count; i++) {
+                pid_t repo_pid;
+                int running = daemon_status(host.repos[i].config.fractyl_dir, &repo_pid);
+                printf("  %s: %s", host.repos[i].config.repo_root,
+                       !running ? "not kept" : repo_pid == daemon_pid ? "kept" : "own daemon");
+                if (running && repo_pid != daemon_pid) printf(" (PID: %d)", repo_pid);
+                printf("\n");
+            }
+        }
+        daemon_host_cleanup(&host);
+        
+    } else {
+        printf("Error: Unknown daemon command '%s'\n", command);
+        print_daemon_usage();
+        result = 1;
+    }
+    
+    free(home);
+    return result;
 }
 
 int cmd_daemon(int argc, char **argv) {
@@ -28,6 +128,10 @@ int cmd_daemon(int argc, char **argv) {
         return 1;
     }
     
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--all") == 0) return cmd_daemon_all(argc, argv);
+    }
+    
     // Find repository root
     char *repo_root = fractyl_find_repo_root(NULL);
     if (!repo_root) {
@@ -43,9 +147,12 @@ int cmd_daemon(int argc, char **argv) {
     if (strcmp(command, "start") == 0) {
         // Parse start options
         uint32_t interval_seconds = 0;
+        int watch_mode = 0;
         
         for (int i = 3; i < argc; i++) {
-            if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--interval") == 0) {
+            if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--watch") == 0) {
+                watch_mode = 1;
+            } else if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--interval") == 0) {
                 if (i + 1 < argc) {
                     interval_seconds = (uint32_t)atoi(argv[++i]);
                     if (interval_seconds == 0) {
@@ -79,6 +186,7 @@ int cmd_daemon(int argc, char **argv) {
         if (interval_seconds > 0) {
             daemon_set_interval(&daemon, interval_seconds);
         }
+        daemon_set_watch_mode(&daemon, watch_mode);
         
         printf("Starting Fractyl daemon...\n");
         printf("Repository: %s\n", repo_root);
@@ -117,9 +225,12 @@ int cmd_daemon(int argc, char **argv) {
         
         // Parse restart options (same as start)
         uint32_t interval_seconds = 0;
+        int watch_mode = 0;
         
         for (int i = 3; i < argc; i++) {
-            if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--interval") == 0) {
+            if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--watch") == 0) {
+                watch_mode = 1;
+            } else if (strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "--interval") == 0) {
                 if (i + 1 < argc) {
                     interval_seconds = (uint32_t)atoi(argv[++i]);
                     if (interval_seconds == 0) {
@@ -148,6 +259,7 @@ int cmd_daemon(int argc, char **argv) {
         if (interval_seconds > 0) {
             daemon_set_interval(&daemon, interval_seconds);
         }
+        daemon_set_watch_mode(&daemon, watch_mode);
         
         printf("Repository: %s\n", repo_root);
         printf("Snapshot interval: %u seconds\n", daemon.config.snapshot_interval);
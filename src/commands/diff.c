@@ -4,18 +4,26 @@
 #include "../utils/paths.h"
 #include "../utils/git.h"
 #include "../utils/snapshots.h"
+#include "../utils/catalog.h"
+#include "../utils/diff_cache.h"
+#include "../utils/config.h"
+#include "../utils/lock.h"
+#include "../utils/simd.h"
+#include "../utils/parallel_scan.h"
 #include "../core/index.h"
 #include "../core/objects.h"
 #include "../core/hash.h"
+#include "../core/changes.h"
 #include "../vendor/xdiff/fractyl-diff.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <time.h>
 #include <strings.h>
+#include <limits.h>
+#include <pthread.h>
 
 
 static void print_hash(const unsigned char *hash) {
@@ -87,14 +95,14 @@ static int is_binary_magic(const void *data, size_t size) {
             if (memcmp(bytes, magic_patterns[i].magic, magic_patterns[i].len) == 0) {
                 return 1;
             }
-            
+    
             // Special case for TAR files (magic at offset 257)
             if (strcmp(magic_patterns[i].description, "TAR") == 0 && size > 262) {
                 if (memcmp(bytes + 257, magic_patterns[i].magic, magic_patterns[i].len) == 0) {
                     return 1;
                 }
             }
-            
+    
             // Special case for RIFF (check if it's WAV or AVI)
             if (strcmp(magic_patterns[i].description, "RIFF") == 0 && size >= 12) {
                 if (memcmp(bytes + 8, "WAVE", 4) == 0 || memcmp(bytes + 8, "AVI ", 4) == 0) {
@@ -118,28 +126,14 @@ static int is_binary_data(const void *data, size_t size) {
         return 1;
     }
     
-    const unsigned char *bytes = (const unsigned char *)data;
     size_t check_size = size < 8192 ? size : 8192; // Check first 8KB
-    size_t null_count = 0;
-    size_t non_printable_count = 0;
-    
-    for (size_t i = 0; i < check_size; i++) {
-        unsigned char byte = bytes[i];
-        
-        // Null bytes strongly indicate binary
-        if (byte == 0) {
-            null_count++;
-            if (null_count > 1) {
-                return 1; // Multiple null bytes = binary
-            }
-        }
-        
-        // Count non-printable characters (except common whitespace)
-        if (byte < 32 && byte != '\t' && byte != '\n' && byte != '\r') {
-            non_printable_count++;
-        } else if (byte > 126) {
-            non_printable_count++;
-        }
+    size_t null_count, non_printable_count;
+    
+    // Multiple null bytes = binary; otherwise count non-printable
+    // characters (except common whitespace)
+    simd_count_binary_bytes(data, check_size, &null_count, &non_printable_count);
+    if (null_count > 1) {
+        return 1;
     }
     
     // If more than 30% non-printable characters, consider binary
@@ -199,254 +193,809 @@ __attribute__((unused)) static char* find_latest_snapshot(const char *fractyl_di
         fclose(f);
     }
     
-    // Fallback to scanning timestamps
+    // Fallback to the newest snapshot
     char snapshots_dir[2048];
     snprintf(snapshots_dir, sizeof(snapshots_dir), "%s/snapshots", fractyl_dir);
     
-    DIR *d = opendir(snapshots_dir);
-    if (!d) {
+    catalog_t catalog;
+    if (catalog_load(snapshots_dir, &catalog) != FRACTYL_OK) {
         return NULL;
     }
-    
-    char *latest_id = NULL;
-    time_t latest_timestamp = 0;
-    
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL) {
-        if (entry->d_name[0] == '.' || !strstr(entry->d_name, ".json")) {
-            continue;
-        }
-        
-        char snapshot_path[2048];
-        snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", snapshots_dir, entry->d_name);
-        
-        snapshot_t snapshot;
-        if (json_load_snapshot(&snapshot, snapshot_path) == FRACTYL_OK) {
-            if (snapshot.timestamp > latest_timestamp) {
-                latest_timestamp = snapshot.timestamp;
-                free(latest_id);
-                latest_id = strdup(snapshot.id);
-            }
-            json_free_snapshot(&snapshot);
+    const catalog_entry_t *latest = NULL;
+    for (size_t i = 0; i < catalog.count; i++) {
+        if (!latest || catalog.entries[i].timestamp >= latest->timestamp) {
+            latest = &catalog.entries[i];
         }
     }
-    
-    closedir(d);
+    char *latest_id = latest ? strdup(latest->id) : NULL;
+    catalog_free(&catalog);
     return latest_id;
 }
 
 
 
-// Load index from snapshot's stored index hash
-static int load_snapshot_index(const unsigned char *index_hash, const char *fractyl_dir, index_t *index) {
-    void *index_data;
-    size_t index_size;
+// Files diffed at once, and how far workers may run ahead of the output
+#define DIFF_MAX_THREADS 16
+#define DIFF_OUTPUT_WINDOW 256
+// Widest +/- bar of --stat
+#define DIFF_STAT_BAR_WIDTH 40
+
+typedef enum {
+    DIFF_MODE_PATCH = 0,        // Unified diffs of the contents
+    DIFF_MODE_STAT,             // --stat: lines added and removed per file
+    DIFF_MODE_NAME_STATUS,      // --name-status: A, M or D and the path
+    DIFF_MODE_NAME_ONLY         // --name-only: the paths
+} diff_mode_t;
+
+// One side of a file diff. Only the first DIFF_HEAD_SIZE bytes are read
+// to tell binary files apart; text content is then read whole, mapped in
+// place where the object is stored as is.
+#define DIFF_HEAD_SIZE 8192
+
+typedef struct {
+    object_reader_t *reader;
+    size_t size;
+    unsigned char head[DIFF_HEAD_SIZE];
+    size_t head_size;
+    const void *data;           // Whole content once loaded
+    void *owned;
+} diff_side_t;
+
+// Open the entry's object, or its file under root when root is not NULL
+static int diff_side_open(diff_side_t *side, const index_entry_t *entry, const char *fractyl_dir,
+                          const char *root) {
+    memset(side, 0, sizeof(*side));
+    if (!entry) return FRACTYL_OK;
     
-    // Load the index data from object storage
-    int result = object_load(index_hash, fractyl_dir, &index_data, &index_size);
-    if (result != FRACTYL_OK) {
-        return result;
+    int result;
+    if (root) {
+        char path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s/%s", root, entry->path);
+        if (len < 0 || (size_t)len >= sizeof(path)) return FRACTYL_ERROR_PATH_TOO_LONG;
+        result = object_reader_open_file(path, &side->reader);
+    } else {
+        result = object_reader_open(entry->hash, fractyl_dir, &side->reader);
     }
+    if (result != FRACTYL_OK) return result;
+    if (object_reader_size(side->reader) > SIZE_MAX - 1) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    side->size = (size_t)object_reader_size(side->reader);
     
-    // Write to a temporary file to use index_load
-    char temp_path[] = "/tmp/fractyl_index_XXXXXX";
-    int temp_fd = mkstemp(temp_path);
-    if (temp_fd == -1) {
-        free(index_data);
-        return FRACTYL_ERROR_IO;
+    ssize_t n = object_reader_read(side->reader, side->head, sizeof(side->head));
+    if (n < 0) return (int)n;
+    side->head_size = (size_t)n;
+    return FRACTYL_OK;
+}
+
+static int diff_side_load(diff_side_t *side) {
+    if (!side->reader || side->head_size == side->size) {
+        side->data = side->head;
+        return FRACTYL_OK;
     }
+    side->data = object_reader_view(side->reader);
+    if (side->data) return FRACTYL_OK;
     
-    if (write(temp_fd, index_data, index_size) != (ssize_t)index_size) {
-        close(temp_fd);
-        unlink(temp_path);
-        free(index_data);
-        return FRACTYL_ERROR_IO;
+    unsigned char *data = malloc(side->size);
+    if (!data) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    memcpy(data, side->head, side->head_size);
+    ssize_t n = object_reader_read(side->reader, data + side->head_size, side->size - side->head_size);
+    if (n != (ssize_t)(side->size - side->head_size)) {
+        free(data);
+        return n < 0 ? (int)n : FRACTYL_ERROR_IO;
     }
-    close(temp_fd);
-    free(index_data);
+    side->owned = data;
+    side->data = data;
+    return FRACTYL_OK;
+}
+
+static void diff_side_close(diff_side_t *side) {
+    object_reader_close(side->reader);
+    free(side->owned);
+}
+
+// Context lines of patch output
+#define DIFF_CONTEXT_LINES 3
+
+// Guardrails: past this many bytes or lines on either side, or this much
+// time spent diffing it, a file's change is summed up instead of diffed
+// (diff.max_size, diff.max_lines and diff.timeout in .fractyl/config; 0
+// turns one off)
+#define DIFF_DEFAULT_MAX_SIZE (64L * 1024 * 1024)
+#define DIFF_DEFAULT_MAX_LINES 1000000L
+#define DIFF_DEFAULT_TIMEOUT_MS 5000L
+
+typedef struct {
+    fractyl_diff_options_t options;
+    long max_size;
+    long max_lines;
+} diff_policy_t;
+
+// The policy of .fractyl/config: diff.algorithm and the guardrails
+static void diff_policy_load(diff_policy_t *policy, const char *fractyl_dir) {
+    memset(policy, 0, sizeof(*policy));
+    policy->options.algorithm = FRACTYL_DIFF_MYERS;
+    policy->options.context_lines = DIFF_CONTEXT_LINES;
+    policy->options.timeout_ms = config_get_long(fractyl_dir, "diff.timeout", DIFF_DEFAULT_TIMEOUT_MS);
+    policy->max_size = config_get_long(fractyl_dir, "diff.max_size", DIFF_DEFAULT_MAX_SIZE);
+    policy->max_lines = config_get_long(fractyl_dir, "diff.max_lines", DIFF_DEFAULT_MAX_LINES);
     
-    // Load the index from temporary file
-    result = index_load(index, temp_path);
-    unlink(temp_path);
+    char name[32];
+    if (config_get(fractyl_dir, "diff.algorithm", name, sizeof(name)) == FRACTYL_OK &&
+        fractyl_diff_parse_algorithm(name, &policy->options.algorithm) != 0) {
+        printf("Warning: Unknown diff.algorithm '%s', using myers\n", name);
+    }
+}
+
+static void print_binary_change(FILE *out, const char *path_a, const char *path_b, const char *extended,
+                                int has_a, int has_b, uint64_t size_a, uint64_t size_b) {
+    fprintf(out, "diff --fractyl a/%s b/%s\n", path_a, path_b);
+    if (extended) fputs(extended, out);
     
-    return result;
+    if (!has_a && has_b) {
+        // File added
+        fprintf(out, "Binary file b/%s added\n", path_b);
+    } else if (has_a && !has_b) {
+        // File deleted
+        fprintf(out, "Binary file a/%s deleted\n", path_a);
+    } else if (has_a && has_b) {
+        fprintf(out, "Binary files a/%s and b/%s differ\n", path_a, path_b);
+        fprintf(out, "Size: %llu bytes -> %llu bytes\n", (unsigned long long)size_a,
+                (unsigned long long)size_b);
+    }
 }
 
-// Compare file contents between two snapshots with line-by-line diff
-static int compare_file_contents(const index_entry_t *entry_a, const index_entry_t *entry_b, 
-                                const char *path, const char *fractyl_dir) {
-    void *data_a = NULL, *data_b = NULL;
-    size_t size_a = 0, size_b = 0;
-    
-    // Load file content from first snapshot
-    if (entry_a) {
-        if (object_load(entry_a->hash, fractyl_dir, &data_a, &size_a) != FRACTYL_OK) {
-            printf("Warning: Could not load content for %s from first snapshot\n", path);
-            return FRACTYL_ERROR_IO;
-        }
+// A text change past a guardrail: how big both sides are, in unit
+// ("bytes" or "lines"), and which guardrail it hit
+static void print_skipped_change(FILE *out, const char *path_a, const char *path_b, const char *extended,
+                                 const char *unit, long count_a, long count_b, const char *reason) {
+    fprintf(out, "diff --fractyl a/%s b/%s\n", path_a, path_b);
+    if (extended) fputs(extended, out);
+    fprintf(out, "Files differ, %ld %s -> %ld %s (%s)\n", count_a, unit, count_b, unit, reason);
+}
+
+// Why a text change of these sizes is not diffed, or NULL if it is.
+// Sizes are checked before the sides are read, lines once they are.
+static const char* over_guardrail(const diff_policy_t *policy, uint64_t size_a, uint64_t size_b,
+                                  long lines_a, long lines_b) {
+    if (policy->max_size > 0 && (size_a > (uint64_t)policy->max_size || size_b > (uint64_t)policy->max_size)) {
+        return "over diff.max_size";
     }
+    if (policy->max_lines > 0 && (lines_a > policy->max_lines || lines_b > policy->max_lines)) {
+        return "over diff.max_lines";
+    }
+    return NULL;
+}
+
+// Compare file contents between two snapshots with line-by-line diff.
+// entry_a has another path than path when the file was renamed or copied;
+// extended holds the header lines saying so. entry_b is read from the
+// working tree at worktree when that is not NULL.
+static int compare_file_contents(FILE *out, const index_entry_t *entry_a, const index_entry_t *entry_b,
+                                 const char *path, const char *extended, const char *fractyl_dir,
+                                 const char *worktree, diff_cache_t *cache, const diff_policy_t *policy) {
+    const char *path_a = entry_a ? entry_a->path : path;
+    // Check if file is binary by extension first (faster)
+    int is_binary = is_binary_extension(path);
+    const unsigned char *hash_a = entry_a ? entry_a->hash : NULL;
+    const unsigned char *hash_b = entry_b ? entry_b->hash : NULL;
+    uint32_t algorithm = (uint32_t)policy->options.algorithm;
     
-    // Load file content from second snapshot
-    if (entry_b) {
-        if (object_load(entry_b->hash, fractyl_dir, &data_b, &size_b) != FRACTYL_OK) {
-            printf("Warning: Could not load content for %s from second snapshot\n", path);
-            free(data_a);
-            return FRACTYL_ERROR_IO;
+    // A diff of the same two objects made before needs neither of them
+    diff_cache_entry_t cached;
+    if (!is_binary && diff_cache_lookup(cache, hash_a, hash_b, algorithm, DIFF_CONTEXT_LINES, &cached)) {
+        if (cached.flags & DIFF_CACHE_BINARY) {
+            print_binary_change(out, path_a, path, extended, entry_a != NULL, entry_b != NULL,
+                                cached.size_a, cached.size_b);
+        } else {
+            fractyl_diff_header(out, path_a, path, extended, entry_a != NULL, entry_b != NULL);
+            fwrite(cached.hunks, 1, cached.hunks_size, out);
         }
+        diff_cache_entry_free(&cached);
+        return FRACTYL_OK;
     }
     
-    // Check if file is binary by extension first (faster)
-    int is_binary = is_binary_extension(path);
+    diff_side_t a, b;
     
-    // If not binary by extension, check content for both files
+    // Open file content from first snapshot
+    if (diff_side_open(&a, entry_a, fractyl_dir, NULL) != FRACTYL_OK) {
+        fprintf(out, "Warning: Could not load content for %s from first snapshot\n", path);
+        diff_side_close(&a);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    // Open file content from second snapshot
+    if (diff_side_open(&b, entry_b, fractyl_dir, worktree) != FRACTYL_OK) {
+        fprintf(out, "Warning: Could not load content for %s from %s\n", path,
+                worktree ? "the working tree" : "second snapshot");
+        diff_side_close(&a);
+        diff_side_close(&b);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    memset(&cached, 0, sizeof(cached));
+    cached.size_a = a.size;
+    cached.size_b = b.size;
+    
+    // If not binary by extension, check the start of both files
     if (!is_binary) {
-        if (data_a && is_binary_data(data_a, size_a)) {
-            is_binary = 1;
-        } else if (data_b && is_binary_data(data_b, size_b)) {
+        if ((entry_a && is_binary_data(a.head, a.head_size)) ||
+            (entry_b && is_binary_data(b.head, b.head_size))) {
             is_binary = 1;
+            // Only what the contents say is cached; extensions go with paths
+            cached.flags = DIFF_CACHE_BINARY;
+            diff_cache_store(cache, hash_a, hash_b, algorithm, DIFF_CONTEXT_LINES, &cached);
         }
     }
     
+    const char *skipped = NULL;
     if (is_binary) {
-        // Handle binary files
-        printf("diff --fractyl a/%s b/%s\n", path, path);
-        
-        if (!entry_a && entry_b) {
-            // File added
-            printf("Binary file b/%s added\n", path);
-        } else if (entry_a && !entry_b) {
-            // File deleted
-            printf("Binary file a/%s deleted\n", path);
-        } else if (entry_a && entry_b) {
-            // File changed - compare hashes to see if actually different
-            if (memcmp(entry_a->hash, entry_b->hash, 32) == 0) {
-                // Same content, no output needed
-            } else {
-                printf("Binary files a/%s and b/%s differ\n", path, path);
-                printf("Size: %zu bytes -> %zu bytes\n", size_a, size_b);
-            }
+        // Same content in both needs no output
+        if (!(entry_a && entry_b && memcmp(entry_a->hash, entry_b->hash, 32) == 0)) {
+            print_binary_change(out, path_a, path, extended, entry_a != NULL, entry_b != NULL, a.size, b.size);
         }
+    } else if ((skipped = over_guardrail(policy, a.size, b.size, 0, 0)) != NULL) {
+        // Too big to even read
+        print_skipped_change(out, path_a, path, extended, "bytes", (long)a.size, (long)b.size, skipped);
+    } else if (diff_side_load(&a) != FRACTYL_OK || diff_side_load(&b) != FRACTYL_OK) {
+        fprintf(out, "Warning: Could not load content for %s\n", path);
+        diff_side_close(&a);
+        diff_side_close(&b);
+        return FRACTYL_ERROR_IO;
     } else {
-        // Handle text files - perform the diff using xdiff
-        int result = fractyl_diff_unified(path, data_a, size_a, path, data_b, size_b, 3);
-        if (result != 0) {
-            // Diff failed or found differences
-            // Note: fractyl_diff_unified should handle its own output
+        long lines_a = entry_a ? fractyl_diff_line_count(a.data, a.size) : 0;
+        long lines_b = entry_b ? fractyl_diff_line_count(b.data, b.size) : 0;
+        skipped = over_guardrail(policy, 0, 0, lines_a, lines_b);
+    
+        // Handle text files - perform the diff using xdiff, keeping the
+        // hunks for the cache
+        FILE *hunks = NULL;
+        int result = 0;
+        if (!skipped) {
+            hunks = open_memstream(&cached.hunks, &cached.hunks_size);
+            // Without a buffer the hunks go straight out, after the header
+            if (!hunks) fractyl_diff_header(out, path_a, path, extended, entry_a != NULL, entry_b != NULL);
+            result = fractyl_diff_hunks(hunks ? hunks : out, entry_a ? a.data : NULL, a.size,
+                                        entry_b ? b.data : NULL, b.size, &policy->options);
+            if (result == FRACTYL_DIFF_TIMED_OUT) skipped = "diff.timeout reached";
+        }
+        if (skipped) {
+            print_skipped_change(out, path_a, path, extended, "lines", lines_a, lines_b, skipped);
+        } else if (hunks) {
+            fractyl_diff_header(out, path_a, path, extended, entry_a != NULL, entry_b != NULL);
+        }
+        if (hunks) {
+            fclose(hunks);
+            if (!skipped) fwrite(cached.hunks, 1, cached.hunks_size, out);
+            if (result == 0) {
+                diff_cache_store(cache, hash_a, hash_b, algorithm, DIFF_CONTEXT_LINES, &cached);
+            }
+            diff_cache_entry_free(&cached);
         }
     }
     
     // Cleanup
-    free(data_a);
-    free(data_b);
+    diff_side_close(&a);
+    diff_side_close(&b);
     
     return FRACTYL_OK;
 }
 
-// Compare file contents between two snapshots  
-static int compare_snapshot_contents(const snapshot_t *snap_a, const snapshot_t *snap_b, const char *fractyl_dir) {
-    printf("\nFile-by-file comparison:\n");
+// The changed files of a diff, in path order. Workers produce each file's
+// output into a buffer of its own while the calling thread writes the
+// finished ones out in order, so the output is the same as one thread's.
+typedef struct {
+    index_entry_t a, b;
+    int has_a, has_b;
+    int mode_only;              // Same content, another mode
+    char *path;
+    char *old_path;             // Renamed or copied from, else NULL
+    int similarity;             // Percent, for old_path
+    int copy;
+    char *output;
+    size_t output_size;
+    // --stat
+    int binary;
+    const char *skipped;        // Past a guardrail: the unit of added and removed
+    long added, removed;
+    int done;
+} diff_job_t;
+
+typedef struct {
+    diff_mode_t mode;
+    const char *fractyl_dir;
+    const char *worktree;       // The new side is the working tree here, else NULL
+    diff_cache_t *cache;        // NULL when turned off
+    diff_policy_t policy;
+    diff_job_t *jobs;
+    size_t count;
+    size_t capacity;
+    size_t next;                // Next job a worker takes
+    size_t flushed;             // Jobs written out so far
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} diff_queue_t;
+
+// Queue one job for each change; their entries are copied
+static int queue_changes(diff_queue_t *queue, const change_list_t *changes) {
+    for (size_t i = 0; i < changes->count; i++) {
+        const change_t *change = &changes->items[i];
+        // Only the mode changed: there is no content to compare
+        int mode_only = change->kind == CHANGE_MODE;
+        if (mode_only && queue->mode == DIFF_MODE_PATCH) continue;
+        if (queue->count == queue->capacity) {
+            size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+            diff_job_t *jobs = realloc(queue->jobs, capacity * sizeof(diff_job_t));
+            if (!jobs) return FRACTYL_ERROR_OUT_OF_MEMORY;
+            queue->jobs = jobs;
+            queue->capacity = capacity;
+        }
     
-    // Compare the index hashes to determine if there are differences
-    if (memcmp(snap_a->index_hash, snap_b->index_hash, 32) == 0) {
-        printf("No differences detected between snapshots\n");
-        return FRACTYL_OK;
+        diff_job_t *job = &queue->jobs[queue->count];
+        memset(job, 0, sizeof(*job));
+        int has_a = change->kind != CHANGE_ADDED;
+        int has_b = change->kind != CHANGE_DELETED;
+        job->path = strdup(has_b ? change->new_entry.path : change->old_entry.path);
+        if (!job->path) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        queue->count++;
+        if (change->kind == CHANGE_RENAMED || change->kind == CHANGE_COPIED) {
+            job->old_path = strdup(change->old_entry.path);
+            if (!job->old_path) return FRACTYL_ERROR_OUT_OF_MEMORY;
+            job->similarity = change->similarity;
+            job->copy = change->kind == CHANGE_COPIED;
+        }
+        job->mode_only = mode_only;
+        if (has_a) {
+            job->a = change->old_entry;
+            job->a.path = job->old_path ? job->old_path : job->path;
+            job->has_a = 1;
+        }
+        if (has_b) {
+            job->b = change->new_entry;
+            job->b.path = job->path;
+            job->has_b = 1;
+        }
     }
+    return FRACTYL_OK;
+}
+
+// Count the lines a file's change adds and removes for --stat. Binary
+// files are only read as far as it takes to tell them apart.
+static void count_changed_lines(diff_job_t *job, const char *fractyl_dir, const char *worktree,
+                                diff_cache_t *cache, const diff_policy_t *policy, FILE *out) {
+    if (job->mode_only) return;
+    if (job->has_a && job->has_b && memcmp(job->a.hash, job->b.hash, 32) == 0) return;
     
-    // Load indices from both snapshots
-    index_t index_a, index_b;
-    if (load_snapshot_index(snap_a->index_hash, fractyl_dir, &index_a) != FRACTYL_OK) {
-        printf("Could not load index from first snapshot\n");
-        return FRACTYL_ERROR_IO;
+    const unsigned char *hash_a = job->has_a ? job->a.hash : NULL;
+    const unsigned char *hash_b = job->has_b ? job->b.hash : NULL;
+    uint32_t algorithm = (uint32_t)policy->options.algorithm;
+    int binary_extension = is_binary_extension(job->path);
+    diff_cache_entry_t cached;
+    if (!binary_extension &&
+        diff_cache_lookup(cache, hash_a, hash_b, algorithm, DIFF_CACHE_NO_HUNKS, &cached)) {
+        job->binary = (cached.flags & DIFF_CACHE_BINARY) != 0;
+        job->added = job->binary ? (long)cached.size_b : (long)cached.added;
+        job->removed = job->binary ? (long)cached.size_a : (long)cached.removed;
+        diff_cache_entry_free(&cached);
+        return;
     }
     
-    if (load_snapshot_index(snap_b->index_hash, fractyl_dir, &index_b) != FRACTYL_OK) {
-        printf("Could not load index from second snapshot\n");
-        index_free(&index_a);
-        return FRACTYL_ERROR_IO;
+    diff_side_t a, b;
+    int result = diff_side_open(&a, job->has_a ? &job->a : NULL, fractyl_dir, NULL);
+    if (result == FRACTYL_OK) result = diff_side_open(&b, job->has_b ? &job->b : NULL, fractyl_dir, worktree);
+    else memset(&b, 0, sizeof(b));
+    if (result == FRACTYL_OK) {
+        job->binary = binary_extension ||
+                      (job->has_a && is_binary_data(a.head, a.head_size)) ||
+                      (job->has_b && is_binary_data(b.head, b.head_size));
+        job->added = (long)b.size;
+        job->removed = (long)a.size;
+        if (!job->binary && over_guardrail(policy, a.size, b.size, 0, 0)) job->skipped = "bytes";
+    }
+    if (result == FRACTYL_OK && !job->binary && !job->skipped) {
+        result = diff_side_load(&a);
+        if (result == FRACTYL_OK) result = diff_side_load(&b);
+    }
+    if (result == FRACTYL_OK && !job->binary && !job->skipped) {
+        long lines_a = job->has_a ? fractyl_diff_line_count(a.data, a.size) : 0;
+        long lines_b = job->has_b ? fractyl_diff_line_count(b.data, b.size) : 0;
+        int counted = FRACTYL_DIFF_TIMED_OUT;
+        if (!over_guardrail(policy, 0, 0, lines_a, lines_b)) {
+            counted = fractyl_diff_count_lines(job->has_a ? a.data : NULL, a.size, job->has_b ? b.data : NULL,
+                                               b.size, &policy->options, &job->added, &job->removed);
+        }
+        if (counted == FRACTYL_DIFF_TIMED_OUT) {
+            job->skipped = "lines";
+            job->added = lines_b;
+            job->removed = lines_a;
+        } else if (counted != 0) {
+            result = FRACTYL_ERROR_GENERIC;
+        }
+    }
+    if (result != FRACTYL_OK) {
+        fprintf(out, "Warning: Could not load content for %s\n", job->path);
+        job->added = job->removed = 0;
+    } else if (!binary_extension && !job->skipped) {
+        memset(&cached, 0, sizeof(cached));
+        cached.flags = job->binary ? DIFF_CACHE_BINARY : 0;
+        cached.size_a = a.size;
+        cached.size_b = b.size;
+        cached.added = job->binary ? 0 : job->added;
+        cached.removed = job->binary ? 0 : job->removed;
+        diff_cache_store(cache, hash_a, hash_b, algorithm, DIFF_CACHE_NO_HUNKS, &cached);
+    }
+    diff_side_close(&a);
+    diff_side_close(&b);
+}
+
+static void run_diff_job(diff_queue_t *queue, diff_job_t *job) {
+    char *output = NULL;
+    size_t output_size = 0;
+    FILE *out = open_memstream(&output, &output_size);
+    if (out) {
+        char extended[2 * PATH_MAX + 64];
+        if (job->old_path) {
+            const char *kind = job->copy ? "copy" : "rename";
+            snprintf(extended, sizeof(extended), "similarity index %d%%\n%s from %s\n%s to %s\n",
+                     job->similarity, kind, job->old_path, kind, job->path);
+        }
+        if (queue->mode == DIFF_MODE_STAT) {
+            count_changed_lines(job, queue->fractyl_dir, queue->worktree, queue->cache, &queue->policy, out);
+        } else if (job->old_path && memcmp(job->a.hash, job->b.hash, 32) == 0) {
+            // Moved as it was: nothing to compare
+            fprintf(out, "diff --git a/%s b/%s\n%s", job->old_path, job->path, extended);
+        } else {
+            compare_file_contents(out, job->has_a ? &job->a : NULL, job->has_b ? &job->b : NULL, job->path,
+                                  job->old_path ? extended : NULL, queue->fractyl_dir, queue->worktree,
+                                  queue->cache, &queue->policy);
+        }
+        fclose(out);
     }
     
-    // Create a unified list of all files from both indices
-    typedef struct {
-        char *path;
-        const index_entry_t *entry_a;
-        const index_entry_t *entry_b;
-    } file_comparison_t;
-    
-    file_comparison_t *comparisons = NULL;
-    size_t comparison_count = 0;
-    size_t comparison_capacity = 0;
+    pthread_mutex_lock(&queue->lock);
+    job->output = output;
+    job->output_size = out ? output_size : 0;
+    job->done = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void* diff_worker(void *arg) {
+    diff_queue_t *queue = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+        if (i >= queue->count) break;
     
-    // Add all files from index_a
-    for (size_t i = 0; i < index_a.count; i++) {
-        if (comparison_count >= comparison_capacity) {
-            comparison_capacity = comparison_capacity ? comparison_capacity * 2 : 16;
-            comparisons = realloc(comparisons, comparison_capacity * sizeof(file_comparison_t));
-        }
-        comparisons[comparison_count].path = strdup(index_a.entries[i].path);
-        comparisons[comparison_count].entry_a = &index_a.entries[i];
-        comparisons[comparison_count].entry_b = index_find_entry(&index_b, index_a.entries[i].path);
-        comparison_count++;
-    }
-    
-    // Add files that are only in index_b
-    for (size_t i = 0; i < index_b.count; i++) {
-        const index_entry_t *found_in_a = index_find_entry(&index_a, index_b.entries[i].path);
-        if (!found_in_a) {
-            if (comparison_count >= comparison_capacity) {
-                comparison_capacity = comparison_capacity ? comparison_capacity * 2 : 16;
-                comparisons = realloc(comparisons, comparison_capacity * sizeof(file_comparison_t));
-            }
-            comparisons[comparison_count].path = strdup(index_b.entries[i].path);
-            comparisons[comparison_count].entry_a = NULL;
-            comparisons[comparison_count].entry_b = &index_b.entries[i];
-            comparison_count++;
+        // Stay within a window of the output written so far, so buffers
+        // do not pile up behind one slow file
+        pthread_mutex_lock(&queue->lock);
+        while (i >= queue->flushed + DIFF_OUTPUT_WINDOW) {
+            pthread_cond_wait(&queue->cond, &queue->lock);
         }
+        pthread_mutex_unlock(&queue->lock);
+        run_diff_job(queue, &queue->jobs[i]);
+    }
+    return NULL;
+}
+
+static int diff_threads(size_t jobs) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus < 1 ? 1 : (size_t)cpus;
+    if (threads > DIFF_MAX_THREADS) threads = DIFF_MAX_THREADS;
+    return (int)(threads < jobs ? threads : jobs);
+}
+
+// Print the --stat table: one line per file with a bar scaled to the
+// largest change, then the totals
+static void print_diff_stat(const diff_job_t *jobs, size_t count) {
+    size_t path_width = 0;
+    long widest = 0, added = 0, removed = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(jobs[i].path);
+        if (jobs[i].old_path) len += strlen(jobs[i].old_path) + strlen(" => ");
+        if (len > path_width) path_width = len;
+        if (jobs[i].binary || jobs[i].skipped) continue;
+        if (jobs[i].added + jobs[i].removed > widest) widest = jobs[i].added + jobs[i].removed;
+        added += jobs[i].added;
+        removed += jobs[i].removed;
     }
+    int count_width = snprintf(NULL, 0, "%ld", widest);
     
-    // Compare each file
-    for (size_t i = 0; i < comparison_count; i++) {
-        const file_comparison_t *comp = &comparisons[i];
-        
-        // Skip if files are identical (same hash)
-        if (comp->entry_a && comp->entry_b && 
-            memcmp(comp->entry_a->hash, comp->entry_b->hash, 32) == 0) {
+    for (size_t i = 0; i < count; i++) {
+        const diff_job_t *job = &jobs[i];
+        if (job->old_path) {
+            int len = (int)(strlen(job->old_path) + strlen(" => "));
+            printf(" %s => %-*s | ", job->old_path, (int)path_width - len, job->path);
+        } else {
+            printf(" %-*s | ", (int)path_width, job->path);
+        }
+        if (job->binary) {
+            printf("Bin %ld -> %ld bytes\n", job->removed, job->added);
+            continue;
+        }
+        if (job->skipped) {
+            printf("Not diffed, %ld -> %ld %s\n", job->removed, job->added, job->skipped);
             continue;
         }
-        
-        // Perform the actual diff
-        compare_file_contents(comp->entry_a, comp->entry_b, comp->path, fractyl_dir);
+        long plus = job->added, minus = job->removed;
+        if (widest > DIFF_STAT_BAR_WIDTH) {
+            // Scaled, but every change keeps at least one mark
+            plus = plus ? 1 + (plus * (DIFF_STAT_BAR_WIDTH - 1)) / widest : 0;
+            minus = minus ? 1 + (minus * (DIFF_STAT_BAR_WIDTH - 1)) / widest : 0;
+        }
+        printf("%*ld%s", count_width, job->added + job->removed, plus + minus ? " " : "");
+        for (long n = 0; n < plus; n++) putchar('+');
+        for (long n = 0; n < minus; n++) putchar('-');
+        printf("\n");
+    }
+    printf(" %zu file%s changed, %ld insertion%s(+), %ld deletion%s(-)\n", count, count == 1 ? "" : "s",
+           added, added == 1 ? "" : "s", removed, removed == 1 ? "" : "s");
+}
+
+// --name-only and --name-status: the trees tell which files changed, so
+// no file content is read but to pair renames
+static void print_changed_paths(const diff_queue_t *queue) {
+    for (size_t i = 0; i < queue->count; i++) {
+        const diff_job_t *job = &queue->jobs[i];
+        if (queue->mode == DIFF_MODE_NAME_ONLY) {
+            printf("%s\n", job->path);
+        } else if (job->old_path) {
+            printf("%c%03d\t%s\t%s\n", job->copy ? 'C' : 'R', job->similarity, job->old_path, job->path);
+        } else {
+            printf("%c\t%s\n", !job->has_a ? 'A' : !job->has_b ? 'D' : 'M', job->path);
+        }
+    }
+}
+
+static void free_jobs(diff_queue_t *queue) {
+    for (size_t i = 0; i < queue->count; i++) {
+        free(queue->jobs[i].path);
+        free(queue->jobs[i].old_path);
+    }
+    free(queue->jobs);
+}
+
+// Queue the changes, paired into renames unless renames is 0, then print
+// them all in the queue's mode. Frees the queue and the changes.
+static int run_diff_queue(diff_queue_t *queue, change_list_t *changes, int renames) {
+    if (renames && change_list_pair_renames(changes, queue->fractyl_dir, queue->worktree) != FRACTYL_OK) {
+        printf("Warning: Could not detect renames\n");
+    }
+    int result = queue_changes(queue, changes);
+    change_list_free(changes);
+    if (result != FRACTYL_OK) {
+        printf("Error: Out of memory\n");
+        free_jobs(queue);
+        return result;
     }
+    if (queue->mode == DIFF_MODE_NAME_STATUS || queue->mode == DIFF_MODE_NAME_ONLY) {
+        print_changed_paths(queue);
+        free_jobs(queue);
+        return FRACTYL_OK;
+    }
+    // The working tree can change while it is read, so its diffs are
+    // not kept
+    if (!queue->worktree) diff_cache_open(queue->fractyl_dir, &queue->cache);
     
-    // Cleanup
-    for (size_t i = 0; i < comparison_count; i++) {
-        free(comparisons[i].path);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    int threads = diff_threads(queue->count);
+    pthread_t *tids = calloc(threads > 0 ? (size_t)threads : 1, sizeof(pthread_t));
+    int started = 0;
+    while (tids && started < threads && pthread_create(&tids[started], NULL, diff_worker, queue) == 0) {
+        started++;
+    }
+    
+    fflush(stdout);
+    for (size_t i = 0; i < queue->count; i++) {
+        diff_job_t *job = &queue->jobs[i];
+        if (started == 0) {
+            // No workers: do the work here
+            run_diff_job(queue, job);
+        }
+        pthread_mutex_lock(&queue->lock);
+        while (!job->done) {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        }
+        pthread_mutex_unlock(&queue->lock);
+    
+        fwrite(job->output, 1, job->output_size, stdout);
+        free(job->output);
+    
+        pthread_mutex_lock(&queue->lock);
+        queue->flushed = i + 1;
+        pthread_cond_broadcast(&queue->cond);
+        pthread_mutex_unlock(&queue->lock);
     }
-    free(comparisons);
-    index_free(&index_a);
-    index_free(&index_b);
     
+    for (int t = 0; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    if (queue->mode == DIFF_MODE_STAT) {
+        print_diff_stat(queue->jobs, queue->count);
+    }
+    free_jobs(queue);
+    diff_cache_close(queue->cache);
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->lock);
     return FRACTYL_OK;
 }
 
+// Compare file contents between two snapshots  
+static int compare_snapshot_contents(const snapshot_t *snap_a, const snapshot_t *snap_b, const char *fractyl_dir,
+                                     diff_mode_t mode, const diff_policy_t *policy, int renames) {
+    if (mode == DIFF_MODE_PATCH) {
+        printf("\nFile-by-file comparison:\n");
+    }
+    
+    // Compare the index hashes to determine if there are differences
+    if (memcmp(snap_a->index_hash, snap_b->index_hash, 32) == 0) {
+        if (mode == DIFF_MODE_PATCH) printf("No differences detected between snapshots\n");
+        return FRACTYL_OK;
+    }
+    
+    // Walks both trees at once; directories with equal hashes are skipped
+    change_list_t changes;
+    change_list_init(&changes);
+    if (change_list_from_trees(&changes, snap_a->index_hash, snap_b->index_hash, fractyl_dir) != FRACTYL_OK) {
+        change_list_free(&changes);
+        printf("%sCould not load the indexes of both snapshots\n", mode == DIFF_MODE_PATCH ? "" : "Error: ");
+        return FRACTYL_ERROR_IO;
+    }
+    
+    diff_queue_t queue;
+    memset(&queue, 0, sizeof(queue));
+    queue.mode = mode;
+    queue.policy = *policy;
+    queue.fractyl_dir = fractyl_dir;
+    return run_diff_queue(&queue, &changes, renames);
+}
+
+// Compare a snapshot with the working tree, without storing anything.
+// The index of the last scan is the stat cache: files whose stat data
+// still matches it are not read, the rest are hashed in place.
+static int compare_worktree_contents(const snapshot_t *snap, const char *repo_root, const char *fractyl_dir,
+                                     diff_mode_t mode, const diff_policy_t *policy, int renames) {
+    index_t base, current, worktree;
+    index_init(&worktree);
+    if (object_load_index(snap->index_hash, fractyl_dir, &base) != FRACTYL_OK) {
+        printf("Error: Could not load the index of snapshot '%s'\n", snap->id);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    char index_path[PATH_MAX];
+    snprintf(index_path, sizeof(index_path), "%s/index", fractyl_dir);
+    index_init(&current);
+    int have_current = index_load(&current, index_path) == FRACTYL_OK;
+    int result = scan_directory_hash_only(repo_root, &worktree, have_current ? &current : &base, fractyl_dir);
+    index_free(&current);
+    if (result == FRACTYL_OK && !index_is_sorted(&worktree)) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        result = index_sort(&worktree, cpus > 0 ? (int)cpus : 1);
+    }
+    if (result != FRACTYL_OK) {
+        printf("Error: Could not scan the working tree\n");
+        index_free(&base);
+        index_free(&worktree);
+        return result;
+    }
+    
+    change_list_t changes;
+    change_list_init(&changes);
+    result = change_list_from_indexes(&changes, &base, &worktree);
+    index_free(&base);
+    index_free(&worktree);
+    if (result != FRACTYL_OK) {
+        change_list_free(&changes);
+        printf("Error: Could not compare the working tree\n");
+        return result;
+    }
+    
+    diff_queue_t queue;
+    memset(&queue, 0, sizeof(queue));
+    queue.mode = mode;
+    queue.policy = *policy;
+    queue.fractyl_dir = fractyl_dir;
+    queue.worktree = repo_root;
+    result = run_diff_queue(&queue, &changes, renames);
+    if (result == FRACTYL_OK && mode == DIFF_MODE_PATCH && queue.count == 0) {
+        printf("No differences from the working tree\n");
+    }
+    return result;
+}
+
+// frac diff <snapshot>: the snapshot against the working tree
+static int diff_worktree(const char *snapshot_id, const char *repo_root, const char *fractyl_dir,
+                         const char *git_branch, diff_mode_t mode, const diff_policy_t *policy, int renames) {
+    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, git_branch);
+    if (!snapshots_dir) {
+        printf("Error: Failed to get snapshots directory\n");
+        return FRACTYL_ERROR_GENERIC;
+    }
+    snapshot_t snap;
+    int loaded = catalog_load_snapshot(snapshots_dir, snapshot_id, &snap);
+    free(snapshots_dir);
+    if (loaded != FRACTYL_OK) {
+        printf("Error: Cannot load snapshot '%s'\n", snapshot_id);
+        return FRACTYL_ERROR_IO;
+    }
+    if (mode == DIFF_MODE_PATCH) {
+        printf("diff %s..working tree\n", snapshot_id);
+        printf("--- %s (%s)\n", snapshot_id, snap.description ? snap.description : "");
+        printf("+++ working tree\n");
+        printf("\n");
+    }
+    int result = compare_worktree_contents(&snap, repo_root, fractyl_dir, mode, policy, renames);
+    json_free_snapshot(&snap);
+    return result;
+}
+
 int cmd_diff(int argc, char **argv) {
-    if (argc < 4) {
-        printf("Usage: frac diff <snapshot-a> <snapshot-b>\n");
-        printf("Compare files between two snapshots\n");
+    diff_mode_t mode = DIFF_MODE_PATCH;
+    int renames = 1;
+    int algorithm = -1;         // From the command line, else diff.algorithm
+    const char *snapshot_a_input = NULL;
+    const char *snapshot_b_input = NULL;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--stat") == 0) {
+            mode = DIFF_MODE_STAT;
+        } else if (strcmp(argv[i], "--name-status") == 0) {
+            mode = DIFF_MODE_NAME_STATUS;
+        } else if (strcmp(argv[i], "--name-only") == 0) {
+            mode = DIFF_MODE_NAME_ONLY;
+        } else if (strcmp(argv[i], "--no-renames") == 0) {
+            renames = 0;
+        } else if (strcmp(argv[i], "--minimal") == 0) {
+            algorithm = FRACTYL_DIFF_MINIMAL;
+        } else if (strcmp(argv[i], "--patience") == 0) {
+            algorithm = FRACTYL_DIFF_PATIENCE;
+        } else if (strcmp(argv[i], "--histogram") == 0) {
+            algorithm = FRACTYL_DIFF_HISTOGRAM;
+        } else if (argv[i][0] == '-' && argv[i][1] == '-') {
+            printf("Error: Unknown option '%s'\n", argv[i]);
+            return 1;
+        } else if (!snapshot_a_input) {
+            snapshot_a_input = argv[i];
+        } else if (!snapshot_b_input) {
+            snapshot_b_input = argv[i];
+        } else {
+            printf("Error: Unexpected argument '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    
+    if (!snapshot_a_input) {
+        printf("Usage: frac diff [--stat | --name-status | --name-only] [--no-renames]\n");
+        printf("                 [--minimal | --patience | --histogram] <snapshot-a> [<snapshot-b>]\n");
+        printf("Compare files between two snapshots, or a snapshot and the working tree\n");
         printf("\nSnapshot identifiers can be:\n");
         printf("  abc123                          # Hash prefix (minimum 4 chars)\n");
         printf("  abc123...                       # Full hash\n");
         printf("  -1                              # Previous snapshot\n");
         printf("  -2                              # Two snapshots back\n");
+        printf("\nOptions:\n");
+        printf("  --stat          Lines added and removed per file, instead of the diffs\n");
+        printf("  --name-status   Only the changed paths, with A, M, D, R (renamed) or C (copied)\n");
+        printf("  --name-only     Only the changed paths\n");
+        printf("  --no-renames    Show renamed files as deleted and added\n");
+        printf("  --minimal       Spend extra time to find the smallest diff\n");
+        printf("  --patience      Use the patience diff algorithm\n");
+        printf("  --histogram     Use the histogram diff algorithm\n");
+        printf("\nFiles moved or copied, as they were or with changes, are shown as such\n");
+        printf("(diff.renames = 0 in .fractyl/config turns this off).\n");
+        printf("\nThe default algorithm is diff.algorithm in .fractyl/config (myers). Files over\n");
+        printf("diff.max_size bytes or diff.max_lines lines, or taking over diff.timeout ms,\n");
+        printf("are summed up instead of diffed.\n");
         printf("\nExamples:\n");
         printf("  frac diff -2 -1                 # Compare last two snapshots\n");
         printf("  frac diff abc123 -1             # Compare prefix with latest\n");
+        printf("  frac diff --name-only -2 -1     # Which files changed\n");
+        printf("  frac diff --name-status -1      # Uncommitted changes since the latest\n");
+        printf("\nWithout <snapshot-b> the working tree is compared as it is: only files whose\n");
+        printf("stat data changed are read, and nothing is stored.\n");
         printf("\nUse 'frac list' to see available snapshots\n");
         return 1;
     }
     
-    const char *snapshot_a_input = argv[2];
-    const char *snapshot_b_input = argv[3];
-    
     // Find repository root
     char *repo_root = fractyl_find_repo_root(NULL);
     if (!repo_root) {
@@ -457,6 +1006,10 @@ int cmd_diff(int argc, char **argv) {
     char fractyl_dir[2048];
     snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
     
+    diff_policy_t policy;
+    diff_policy_load(&policy, fractyl_dir);
+    if (algorithm >= 0) policy.options.algorithm = (fractyl_diff_algorithm_t)algorithm;
+    
     // Get current git branch
     char *git_branch = paths_get_current_branch(repo_root);
     
@@ -473,20 +1026,46 @@ int cmd_diff(int argc, char **argv) {
         return 1;
     }
     
+    // Objects must not be collected while they are read; snapshots being
+    // taken hold the lock shared too
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire_shared(fractyl_dir, &lock, 30) != 0) {
+        printf("Error: Could not acquire lock to read snapshots\n");
+        free(repo_root);
+        free(git_branch);
+        return 1;
+    }
+    
+    if (!snapshot_b_input) {
+        result = diff_worktree(snapshot_a, repo_root, fractyl_dir, git_branch, mode, &policy, renames);
+        fractyl_lock_release(&lock);
+        free(repo_root);
+        free(git_branch);
+        return result == FRACTYL_OK ? 0 : 1;
+    }
+    
     // Resolve snapshot B
     result = resolve_snapshot_id(snapshot_b_input, fractyl_dir, git_branch, snapshot_b);
     if (result != FRACTYL_OK) {
         printf("Error: Snapshot '%s' not found\n", snapshot_b_input);
         printf("Use 'frac list' to see available snapshots\n");
+        fractyl_lock_release(&lock);
         free(repo_root);
         free(git_branch);
         return 1;
     }
     
     // Check if comparing snapshot with itself
+    if (strcmp(snapshot_a, snapshot_b) == 0 && mode != DIFF_MODE_PATCH) {
+        fractyl_lock_release(&lock);
+        free(repo_root);
+        free(git_branch);
+        return 0;
+    }
     if (strcmp(snapshot_a, snapshot_b) == 0) {
         printf("Warning: Comparing snapshot with itself\n");
         printf("Snapshot '%s' is identical to itself\n", snapshot_a);
+        fractyl_lock_release(&lock);
         free(repo_root);
         free(git_branch);
         return 0;
@@ -496,35 +1075,45 @@ int cmd_diff(int argc, char **argv) {
     char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, git_branch);
     if (!snapshots_dir) {
         printf("Error: Failed to get snapshots directory\n");
+        fractyl_lock_release(&lock);
         free(repo_root);
         free(git_branch);
         return 1;
     }
     
-    char snapshot_a_path[2048], snapshot_b_path[2048];
-    snprintf(snapshot_a_path, sizeof(snapshot_a_path), "%s/%s.json", snapshots_dir, snapshot_a);
-    snprintf(snapshot_b_path, sizeof(snapshot_b_path), "%s/%s.json", snapshots_dir, snapshot_b);
-    free(snapshots_dir);
-    
     // Load snapshot metadata for display
     snapshot_t snap_a, snap_b;
-    if (json_load_snapshot(&snap_a, snapshot_a_path) != FRACTYL_OK) {
+    if (catalog_load_snapshot(snapshots_dir, snapshot_a, &snap_a) != FRACTYL_OK) {
         printf("Error: Cannot load snapshot '%s'\n", snapshot_a);
+        free(snapshots_dir);
+        fractyl_lock_release(&lock);
         free(repo_root);
         free(git_branch);
         return 1;
     }
     
-    if (json_load_snapshot(&snap_b, snapshot_b_path) != FRACTYL_OK) {
+    int loaded = catalog_load_snapshot(snapshots_dir, snapshot_b, &snap_b);
+    free(snapshots_dir);
+    if (loaded != FRACTYL_OK) {
         printf("Error: Cannot load snapshot '%s'\n", snapshot_b);
         json_free_snapshot(&snap_a);
+        fractyl_lock_release(&lock);
         free(repo_root);
         free(git_branch);
         return 1;
     }
     
-    // Note: In a complete implementation, we would load the actual index
-    // from the snapshot's index_hash. For now, we'll use a simplified approach.
+    // The metadata modes print nothing but the changes
+    if (mode != DIFF_MODE_PATCH) {
+        result = compare_snapshot_contents(&snap_a, &snap_b, fractyl_dir, mode, &policy, renames);
+        json_free_snapshot(&snap_a);
+        json_free_snapshot(&snap_b);
+        fractyl_lock_release(&lock);
+        free(repo_root);
+        free(git_branch);
+        return result == FRACTYL_OK ? 0 : 1;
+    }
+    
     printf("diff %s..%s\n", snapshot_a, snapshot_b);
     printf("--- %s (%s)\n", snapshot_a, snap_a.description ? snap_a.description : "");
     printf("+++ %s (%s)\n", snapshot_b, snap_b.description ? snap_b.description : "");
@@ -543,7 +1132,7 @@ int cmd_diff(int argc, char **argv) {
         printf("  %s: ", snapshot_b);
         print_hash(snap_b.index_hash);
         printf("\n");
-        
+    
         // Show timestamps for context
         printf("\nTimeline:\n");
         if (snap_a.timestamp < snap_b.timestamp) {
@@ -553,9 +1142,9 @@ int cmd_diff(int argc, char **argv) {
         } else {
             printf("  Both snapshots created at same time\n");
         }
-        
+    
         // Load indices from snapshots to perform file-by-file comparison
-        if (compare_snapshot_contents(&snap_a, &snap_b, fractyl_dir) != FRACTYL_OK) {
+        if (compare_snapshot_contents(&snap_a, &snap_b, fractyl_dir, mode, &policy, renames) != FRACTYL_OK) {
             printf("\nWarning: Could not perform detailed file comparison\n");
             printf("To see which files changed, you can:\n");
             printf("  1. Use 'frac restore %s' to restore first snapshot\n", snapshot_a);
@@ -566,6 +1155,7 @@ int cmd_diff(int argc, char **argv) {
     
     json_free_snapshot(&snap_a);
     json_free_snapshot(&snap_b);
+    fractyl_lock_release(&lock);
     free(repo_root);
     free(git_branch);
     
@@ -0,0 +1,168 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../core/index.h"
+#include "../core/objects.h"
+#include "../utils/json.h"
+#include "../utils/fs.h"
+#include "../utils/paths.h"
+#include "../utils/snapshots.h"
+#include "../utils/parallel_restore.h"
+#include "../utils/lock.h"
+#include "../utils/catalog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+// Index of what the last export wrote, kept in the destination. Like the
+// working tree's index, its stat data tells which files are up to date.
+#define EXPORT_STATE_FILE ".fractyl-export"
+
+int cmd_export(int argc, char **argv) {
+    const char *snapshot_input = NULL;
+    const char *dest = NULL;
+    restore_options_t options;
+    memset(&options, 0, sizeof(options));
+    // Never write through a link an earlier --link export made
+    options.replace = 1;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--link") == 0) {
+            options.hardlink = 1;
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0' && !(argv[i][1] >= '0' && argv[i][1] <= '9')) {
+            printf("Error: Unknown option '%s'\n", argv[i]);
+            return 1;
+        } else if (!snapshot_input) {
+            snapshot_input = argv[i];
+        } else if (!dest) {
+            dest = argv[i];
+        } else {
+            printf("Error: Unexpected argument '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    if (!snapshot_input || !dest) {
+        printf("Usage: frac export <snapshot-id> <dir> [--link]\n");
+        printf("Write a snapshot's files into another directory\n");
+        printf("\nThe working tree is not touched. Exporting into the same directory\n");
+        printf("again only rewrites the files that differ and removes the ones the\n");
+        printf("snapshot does not have; other files there are left alone.\n");
+        printf("\nOptions:\n");
+        printf("  --link    Hard-link files to the object store where possible instead\n");
+        printf("            of copying; all files of the export are then read-only\n");
+        printf("\nWithout --link, files share extents with their objects where the\n");
+        printf("filesystem supports reflinks, and are copied otherwise.\n");
+        printf("\nExamples:\n");
+        printf("  frac export -1 ../build         # Export the latest snapshot\n");
+        printf("  frac export abc123 /tmp/b --link\n");
+        return 1;
+    }
+    
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
+    }
+    
+    char fractyl_dir[PATH_MAX];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    
+    // The destination is made if missing; the working tree and the
+    // repository itself are not valid destinations
+    if (!mkdir_p(dest)) {
+        printf("Error: Could not create directory '%s'\n", dest);
+        free(repo_root);
+        return 1;
+    }
+    char dest_root[PATH_MAX];
+    if (!realpath(dest, dest_root)) {
+        printf("Error: Could not resolve '%s'\n", dest);
+        free(repo_root);
+        return 1;
+    }
+    size_t fractyl_len = strlen(fractyl_dir);
+    if (strcmp(dest_root, repo_root) == 0 ||
+        (strncmp(dest_root, fractyl_dir, fractyl_len) == 0 &&
+         (dest_root[fractyl_len] == '\0' || dest_root[fractyl_len] == '/'))) {
+        printf("Error: Cannot export into the working tree or the repository (use 'frac restore')\n");
+        free(repo_root);
+        return 1;
+    }
+    
+    char *git_branch = paths_get_current_branch(repo_root);
+    free(repo_root);
+    
+    char snapshot_id[65];
+    if (resolve_snapshot_id(snapshot_input, fractyl_dir, git_branch, snapshot_id) != FRACTYL_OK) {
+        printf("Error: No snapshot found matching '%s'\n", snapshot_input);
+        printf("Use 'frac list' to see available snapshots\n");
+        free(git_branch);
+        return 1;
+    }
+    
+    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, git_branch);
+    free(git_branch);
+    if (!snapshots_dir) {
+        printf("Error: Failed to get snapshots directory\n");
+        return 1;
+    }
+    snapshot_t snapshot;
+    int loaded = catalog_load_snapshot(snapshots_dir, snapshot_id, &snapshot);
+    free(snapshots_dir);
+    if (loaded != FRACTYL_OK) {
+        printf("Error: Snapshot '%s' not found or invalid\n", snapshot_id);
+        return 1;
+    }
+    
+    // Objects must not be collected while they are read
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire_shared(fractyl_dir, &lock, 30) != 0) {
+        printf("Error: Could not acquire lock for export operation\n");
+        json_free_snapshot(&snapshot);
+        return 1;
+    }
+    
+    index_t index;
+    int result = object_load_index(snapshot.index_hash, fractyl_dir, &index);
+    json_free_snapshot(&snapshot);
+    if (result != FRACTYL_OK) {
+        printf("Error: Failed to load snapshot index: %d\n", result);
+        fractyl_lock_release(&lock);
+        return 1;
+    }
+    
+    char state_path[PATH_MAX];
+    snprintf(state_path, sizeof(state_path), "%s/%s", dest_root, EXPORT_STATE_FILE);
+    index_t state;
+    index_init(&state);
+    index_load(&state, state_path); // ignore errors, empty if none
+    
+    size_t unchanged = 0;
+    restore_stats_t exported;
+    result = restore_changed_files(&index, &state, dest_root, fractyl_dir, &options, &unchanged, &exported);
+    if (result != FRACTYL_OK) {
+        printf("Error: Failed to export files: %d\n", result);
+        index_free(&state);
+        index_free(&index);
+        fractyl_lock_release(&lock);
+        return 1;
+    }
+    
+    // Files the last export wrote that this snapshot does not have
+    restore_removal_t removal = { dest_root, "Removing", 1 };
+    index_diff(&state, &index, restore_remove_deleted, &removal, NULL);
+    index_free(&state);
+    
+    if (index_save(&index, state_path) != FRACTYL_OK) {
+        printf("Warning: Failed to record the export in %s\n", state_path);
+    }
+    printf("Exported %zu files from snapshot %s to %s (%zu already up to date", exported.written,
+           snapshot_id, dest_root, unchanged);
+    if (options.hardlink) printf(", %zu linked", exported.linked);
+    printf(")\n");
+    
+    index_free(&index);
+    fractyl_lock_release(&lock);
+    return exported.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,138 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../core/fsck.h"
+#include "../utils/governor.h"
+#include "../utils/lock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void print_bytes(uint64_t bytes) {
+    if (bytes >= 1024 * 1024) {
+        printf("%.1f MiB", (double)bytes / (1024 * 1024));
+    } else if (bytes >= 1024) {
+        printf("%.1f KiB", (double)bytes / 1024);
+    } else {
+        printf("%llu bytes", (unsigned long long)bytes);
+    }
+}
+
+static void print_problem(fsck_problem_t problem, const char *name, void *ctx) {
+    (void)ctx;
+    switch (problem) {
+    case FSCK_OBJECT_MISSING:
+        printf("missing object %s\n", name);
+        break;
+    case FSCK_OBJECT_CORRUPT:
+        printf("corrupt object %s\n", name);
+        break;
+    case FSCK_SNAPSHOTS_UNREADABLE:
+        printf("unreadable snapshot records in %s\n", name);
+        break;
+    case FSCK_SNAPSHOT_BROKEN:
+        printf("snapshot %s: its index cannot be read\n", name);
+        break;
+    case FSCK_INDEX_MALFORMED:
+        printf("malformed index %s\n", name);
+        break;
+    }
+}
+
+static long parse_number(const char *arg, const char *what) {
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*end != '\0' || value <= 0) {
+        printf("Error: %s must be a positive number\n", what);
+        return -1;
+    }
+    return value;
+}
+
+int cmd_fsck(int argc, char **argv) {
+    fsck_options_t options;
+    fsck_options_init(&options);
+    options.report = print_problem;
+    int scrub = 0;
+    long rate = 0;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--scrub") == 0) {
+            scrub = 1;
+        } else if (strcmp(argv[i], "--max-bytes") == 0 && i + 1 < argc) {
+            long bytes = parse_number(argv[++i], "--max-bytes");
+            if (bytes < 0) return 1;
+            options.scrub_bytes = (uint64_t)bytes;
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            if ((rate = parse_number(argv[++i], "--rate")) < 0) return 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            long threads = parse_number(argv[++i], "--threads");
+            if (threads < 0) return 1;
+            options.threads = (int)threads;
+        } else {
+            printf("Usage: frac fsck [--scrub [--max-bytes <n>]] [--rate <MB/s>] [--threads <n>]\n");
+            printf("Check that every stored object reads back as what it names\n");
+            printf("\nObjects reachable from any snapshot or the working index are read\n");
+            printf("and hashed; snapshot records and indexes must be readable.\n");
+            printf("\nOptions:\n");
+            printf("  --scrub             Check the next slice of objects only, carrying on\n");
+            printf("                      from where the last scrub stopped (.fractyl/%s)\n", FSCK_SCRUB_FILE);
+            printf("  --max-bytes <n>     Content a scrub reads (fsck.scrub_bytes, default %llu)\n",
+                   (unsigned long long)FSCK_DEFAULT_SCRUB_BYTES);
+            printf("  --rate <MB/s>       Read no faster than this\n");
+            printf("  --threads <n>       Objects read at once (default one per CPU)\n");
+            return 1;
+        }
+    }
+    
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
+    }
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    free(repo_root);
+    
+    if (rate > 0) {
+        governor_budget_t budget = { rate * 1000 * 1000, 0, 0, 0 };
+        governor_set(&budget);
+    }
+    
+    // Objects must not be collected while they are read
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire_shared(fractyl_dir, &lock, 30) != 0) {
+        printf("Error: Could not acquire lock for checking objects\n");
+        return 1;
+    }
+    fsck_stats_t stats;
+    int result = scrub ? fsck_scrub_step(fractyl_dir, NULL, &options, &stats)
+                       : fsck_check(fractyl_dir, &options, &stats);
+    fractyl_lock_release(&lock);
+    governor_set(NULL);
+    if (result != FRACTYL_OK) {
+        printf("Error: Check failed (%d)\n", result);
+        return 1;
+    }
+    
+    printf("Checked %zu objects (", stats.objects);
+    print_bytes(stats.bytes);
+    printf(") reachable from %zu snapshots\n", stats.snapshots);
+    if (scrub) {
+        if (stats.pass_complete) {
+            printf("Scrub pass complete: %zu objects, %zu problems\n", stats.total, stats.pass_problems);
+        } else {
+            printf("Scrub pass %zu%% done: %zu of %zu objects left, %zu problems so far\n",
+                   stats.total ? (stats.total - stats.remaining) * 100 / stats.total : 100,
+                   stats.remaining, stats.total, stats.pass_problems);
+        }
+    }
+    
+    size_t problems = fsck_problems(&stats);
+    if (problems > 0) {
+        printf("Error: %zu problems found (%zu missing, %zu corrupt objects, %zu in snapshots and indexes)\n",
+               problems, stats.missing, stats.corrupt, stats.metadata);
+        return 1;
+    }
+    printf("No problems found\n");
+    return 0;
+}
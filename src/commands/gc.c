@@ -0,0 +1,164 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../core/gc.h"
+#include "../core/alternates.h"
+#include "../utils/lock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void print_bytes(uint64_t bytes) {
+    if (bytes >= 1024 * 1024) {
+        printf("%.1f MiB", (double)bytes / (1024 * 1024));
+    } else if (bytes >= 1024) {
+        printf("%.1f KiB", (double)bytes / 1024);
+    } else {
+        printf("%llu bytes", (unsigned long long)bytes);
+    }
+}
+
+static void print_stats(const gc_stats_t *stats, const gc_options_t *options) {
+    printf("Marked %zu reachable objects from %zu snapshots\n", stats->reachable, stats->snapshots);
+    if (stats->missing > 0) {
+        printf("Warning: %zu reachable objects are missing from the store\n", stats->missing);
+    }
+    
+    const char *verb = options->dry_run ? "Would remove" : "Removed";
+    if (stats->loose_removed + stats->packed_removed + stats->temp_removed == 0) {
+        printf("Nothing to collect\n");
+    } else {
+        if (stats->loose_removed > 0) {
+            printf("%s %zu unreachable loose objects\n", verb, stats->loose_removed);
+        }
+        if (stats->packed_removed > 0) {
+            printf("%s %zu unreachable packed objects\n", verb, stats->packed_removed);
+        }
+        if (stats->temp_removed > 0) {
+            printf("%s %zu abandoned temporary files\n", verb, stats->temp_removed);
+        }
+        if (!options->dry_run || stats->bytes_freed > 0) {
+            printf("%s ", options->dry_run ? "Would free" : "Freed");
+            print_bytes(stats->bytes_freed);
+            printf("\n");
+        }
+    }
+    if (stats->loose_kept > 0) {
+        printf("Kept %zu unreachable loose objects inside the grace period\n", stats->loose_kept);
+    }
+}
+
+// Mark from every member of each store this repository uses, then collect
+// the store. Each store's lock is taken exclusively, which waits until no
+// member works; the repository's own lock is not needed.
+static int gc_shared(const char *fractyl_dir, const gc_options_t *options) {
+    const char *const *stores;
+    size_t count = alternates_list(fractyl_dir, &stores);
+    if (count == 0) {
+        printf("Error: This repository uses no shared object store\n");
+        return 1;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        fractyl_lock_t lock;
+        if (fractyl_lock_wait_acquire(stores[i], &lock, 30) != 0) {
+            printf("Error: Could not acquire lock of %s\n", stores[i]);
+            return 1;
+        }
+    
+        gc_stats_t stats;
+        int result = object_gc_shared(stores[i], options, &stats);
+        fractyl_lock_release(&lock);
+        if (result == FRACTYL_ERROR_NOT_FOUND) {
+            printf("Error: A repository using %s is missing\n", stores[i]);
+            char **members;
+            size_t member_count;
+            if (alternates_members(stores[i], &members, &member_count) == FRACTYL_OK) {
+                for (size_t m = 0; m < member_count; m++) {
+                    if (access(members[m], F_OK) != 0) printf("  %s\n", members[m]);
+                }
+                alternates_free_members(members, member_count);
+            }
+            printf("Remove its line from %s/%s once its snapshots are no longer needed\n",
+                   stores[i], ALTERNATES_MEMBERS_FILE);
+            return 1;
+        }
+        if (result != FRACTYL_OK) {
+            printf("Error: Garbage collection of %s failed (%d)\n", stores[i], result);
+            printf("Every snapshot of every member and its index must be readable before anything is deleted\n");
+            return 1;
+        }
+    
+        printf("%s (%zu repositories):\n", stores[i], stats.members);
+        print_stats(&stats, options);
+    }
+    return 0;
+}
+
+int cmd_gc(int argc, char **argv) {
+    gc_options_t options;
+    gc_options_init(&options);
+    int shared = 0;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--dry-run") == 0) {
+            options.dry_run = 1;
+        } else if (strcmp(argv[i], "--grace") == 0 && i + 1 < argc) {
+            char *end;
+            options.grace_seconds = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || options.grace_seconds < 0) {
+                printf("Error: Grace period must be a number of seconds\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--no-prune-packs") == 0) {
+            options.prune_packs = 0;
+        } else if (strcmp(argv[i], "--shared") == 0) {
+            shared = 1;
+        } else {
+            printf("Usage: frac gc [-n|--dry-run] [--grace <seconds>] [--no-prune-packs] [--shared]\n");
+            printf("Delete objects that no snapshot refers to any more\n");
+            printf("\nObjects of every branch's snapshots are kept. Loose objects younger\n");
+            printf("than the grace period are kept too (gc.grace_period, default %d).\n",
+                   GC_DEFAULT_GRACE_PERIOD);
+            printf("\nOptions:\n");
+            printf("  -n, --dry-run       Report what would be deleted\n");
+            printf("  --grace <seconds>   Grace period for loose objects\n");
+            printf("  --no-prune-packs    Leave packfiles as they are\n");
+            printf("  --shared            Collect the shared object stores this repository\n");
+            printf("                      uses, keeping what any of their repositories needs\n");
+            return 1;
+        }
+    }
+    
+    // Find repository root
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
+    }
+    
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    free(repo_root);
+    
+    if (shared) return gc_shared(fractyl_dir, &options);
+    
+    // No snapshot may write objects while they are being deleted
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire(fractyl_dir, &lock, 30) != 0) {
+        printf("Error: Could not acquire lock for garbage collection\n");
+        return 1;
+    }
+    
+    gc_stats_t stats;
+    int result = object_gc(fractyl_dir, &options, &stats);
+    fractyl_lock_release(&lock);
+    if (result != FRACTYL_OK) {
+        printf("Error: Garbage collection failed (%d)\n", result);
+        printf("Every snapshot and its index must be readable before anything is deleted\n");
+        return 1;
+    }
+    
+    print_stats(&stats, &options);
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include "../include/core.h"
 #include "../core/objects.h"
 #include "../core/index.h"
+#include "../core/hash.h"
 #include "../utils/fs.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,9 +10,40 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+// Record the hash algorithm of a new repository in its config
+static int write_hash_config(const char *cwd, hash_algorithm_t algorithm) {
+    char config_path[2048];
+    snprintf(config_path, sizeof(config_path), "%s/.fractyl/config", cwd);
+    
+    FILE *f = fopen(config_path, "a");
+    if (!f) {
+        return FRACTYL_ERROR_IO;
+    }
+    int ok = fprintf(f, "objects.hash = %s\n", hash_algorithm_name(algorithm)) > 0;
+    if (fclose(f) != 0) ok = 0;
+    return ok ? FRACTYL_OK : FRACTYL_ERROR_IO;
+}
+
 int cmd_init(int argc, char **argv) {
-    (void)argc; // Unused parameter
-    (void)argv; // Unused parameter
+    // The algorithm is fixed for the life of the repository: every object
+    // is named by it
+    hash_algorithm_t algorithm = HASH_ALGORITHM_SHA256;
+    int algorithm_given = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--hash") == 0 && i + 1 < argc) {
+            if (hash_algorithm_from_name(argv[++i], &algorithm) != FRACTYL_OK) {
+                printf("Error: Unknown hash algorithm '%s' (use sha256 or blake3)\n", argv[i]);
+                return 1;
+            }
+            algorithm_given = 1;
+        } else {
+            printf("Usage: frac init [--hash sha256|blake3]\n");
+            printf("Initialize a new repository in the current directory\n");
+            printf("\nOptions:\n");
+            printf("  --hash <name>    Hash algorithm naming the objects (default sha256)\n");
+            return 1;
+        }
+    }
     
     // Get current working directory
     char cwd[1024];
@@ -24,13 +56,21 @@ int cmd_init(int argc, char **argv) {
     char *existing_repo = fractyl_find_repo_root(cwd);
     if (existing_repo) {
         printf("Repository already exists at %s\n", existing_repo);
+        if (algorithm_given && algorithm != hash_get_algorithm()) {
+            printf("Its objects are named by %s, which cannot be changed\n",
+                   hash_algorithm_name(hash_get_algorithm()));
+        }
         free(existing_repo);
         return 0;
     }
     
     printf("Initializing fractyl repository in %s\n", cwd);
     
+    hash_set_algorithm(algorithm);
     int result = fractyl_init_repo(cwd);
+    if (result == FRACTYL_OK && algorithm_given) {
+        result = write_hash_config(cwd, algorithm);
+    }
     if (result != FRACTYL_OK) {
         printf("Error: Failed to initialize repository: %d\n", result);
         return 1;
@@ -1,14 +1,15 @@
+#define _GNU_SOURCE  // For strptime
 #include "../include/commands.h"
 #include "../include/core.h"
-#include "../utils/json.h"
 #include "../utils/paths.h"
+#include "../utils/catalog.h"
 #include "../utils/git.h"
+#include "../utils/snapshot_table.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <time.h>
 
 static void print_timestamp(time_t timestamp) {
@@ -18,15 +19,17 @@ static void print_timestamp(time_t timestamp) {
     printf("%s", time_str);
 }
 
-// Tree node for building snapshot hierarchy
+// Tree node for building snapshot hierarchy. The strings point into the
+// catalog, which outlives the tree.
 typedef struct tree_node {
-    char id[64];
-    char *parent_id;
-    char *description;
+    const char *id;
+    size_t id_length;           // Shortest unique prefix shown
+    const char *description;
     time_t timestamp;
-    char *git_branch;
-    char *git_commit;
+    const char *git_branch;
+    const char *git_commit;
     int git_dirty;
+    int has_parent;             // Its parent is shown too
     struct tree_node **children;
     size_t child_count;
     size_t child_capacity;
@@ -36,41 +39,26 @@ typedef struct tree_node {
 static void add_child(tree_node_t *parent, tree_node_t *child) {
     if (parent->child_count >= parent->child_capacity) {
         parent->child_capacity = parent->child_capacity ? parent->child_capacity * 2 : 4;
-        parent->children = realloc(parent->children, 
+        parent->children = realloc(parent->children,
                                  parent->child_capacity * sizeof(tree_node_t*));
     }
     parent->children[parent->child_count++] = child;
 }
 
-// Compare function for sorting children by timestamp
-static int compare_children(const void *a, const void *b) {
-    const tree_node_t *node_a = *(const tree_node_t **)a;
-    const tree_node_t *node_b = *(const tree_node_t **)b;
-    
-    if (node_a->timestamp < node_b->timestamp) return -1;
-    if (node_a->timestamp > node_b->timestamp) return 1;
-    return 0;
-}
-
-// Sort children of a node by timestamp
-static void sort_children(tree_node_t *node) {
-    if (node->child_count > 1) {
-        qsort(node->children, node->child_count, sizeof(tree_node_t*), compare_children);
-    }
-    
-    // Recursively sort children of children
-    for (size_t i = 0; i < node->child_count; i++) {
-        sort_children(node->children[i]);
-    }
+static void node_from_entry(tree_node_t *node, const catalog_t *catalog, const catalog_entry_t *entry) {
+    memset(node, 0, sizeof(*node));
+    node->id = entry->id;
+    node->id_length = catalog_abbrev_length(catalog, entry, 8);
+    node->description = catalog_description(catalog, entry);
+    node->timestamp = entry->timestamp;
+    node->git_branch = catalog_git_branch(catalog, entry);
+    node->git_commit = catalog_git_commit(catalog, entry);
+    node->git_dirty = (entry->flags & CATALOG_GIT_DIRTY) != 0;
 }
 
 // Print snapshot with formatting
-static void print_snapshot(tree_node_t *node, const char *prefix, const char *connector) {
-    char short_id[9];
-    strncpy(short_id, node->id, 8);
-    short_id[8] = '\0';
-    
-    printf("%s%s%s ", prefix, connector, short_id);
+static void print_snapshot(const tree_node_t *node, const char *prefix, const char *connector) {
+    printf("%s%s%.*s ", prefix, connector, (int)node->id_length, node->id);
     print_timestamp(node->timestamp);
     printf(" %s", node->description ? node->description : "");
     
@@ -118,7 +106,7 @@ static void print_tree_structure(tree_node_t *node, const char *prefix, int is_l
             in_linear_chain = 0;
             
             char child_prefix[512];
-            snprintf(child_prefix, sizeof(child_prefix), "%s%s", prefix, 
+            snprintf(child_prefix, sizeof(child_prefix), "%s%s", prefix,
                     (strlen(prefix) == 0) ? "" : (is_last ? "    " : "│   "));
             
             // Print each branch with indentation
@@ -129,183 +117,265 @@ static void print_tree_structure(tree_node_t *node, const char *prefix, int is_l
     }
 }
 
-// Free tree node and its children
-static void free_tree_node(tree_node_t *node) {
-    if (!node) return;
+// Print entries [first, end) of the catalog as a tree, oldest first, under
+// title. Snapshots whose parent is outside the window start a chain of their own.
+static int print_tree(const catalog_t *catalog, size_t first, size_t end, const char *title) {
+    size_t node_count = end - first;
+    tree_node_t *nodes = calloc(node_count, sizeof(tree_node_t));
+    if (!nodes) {
+        printf("Error: Out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < node_count; i++) {
+        node_from_entry(&nodes[i], catalog, &catalog->entries[first + i]);
+    }
+    
+    // Entries are oldest first, so children are added in the order they are
+    // printed in
+    for (size_t i = 0; i < node_count; i++) {
+        size_t position = catalog->entries[first + i].parent_pos;
+        if (position != CATALOG_NO_PARENT && position >= first && position < end) {
+            add_child(&nodes[position - first], &nodes[i]);
+            nodes[i].has_parent = 1;
+        }
+    }
     
-    for (size_t i = 0; i < node->child_count; i++) {
-        free_tree_node(node->children[i]);
+    // Print the snapshot history
+    printf("%s\n", title);
+    size_t last_root = 0;
+    for (size_t i = 0; i < node_count; i++) {
+        if (!nodes[i].has_parent) last_root = i;
+    }
+    int printed = 0;
+    for (size_t i = 0; i < node_count; i++) {
+        if (nodes[i].has_parent) continue;
+        if (printed++) printf("\n"); // Separate different root chains
+        print_tree_structure(&nodes[i], "", i == last_root);
     }
     
-    free(node->children);
-    free(node->parent_id);
-    free(node->description);
-    free(node->git_branch);
-    free(node->git_commit);
-    free(node);
+    for (size_t i = 0; i < node_count; i++) {
+        free(nodes[i].children);
+    }
+    free(nodes);
+    return 0;
 }
 
-int cmd_list(int argc, char **argv) {
-    (void)argc; (void)argv; // Suppress unused parameter warnings
-    
-    // Find repository root
-    char *repo_root = fractyl_find_repo_root(NULL);
-    if (!repo_root) {
-        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
-        return 1;
+// Print entries [first, end) of the catalog newest first, one per line,
+// without building anything
+static void print_flat(const catalog_t *catalog, size_t first, size_t end) {
+    printf("Snapshot History:\n");
+    for (size_t i = end; i > first; i--) {
+        tree_node_t node;
+        node_from_entry(&node, catalog, &catalog->entries[i - 1]);
+        print_snapshot(&node, "", "");
     }
-    
-    char fractyl_dir[2048];
-    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
-    
-    // Get current git branch
-    char *git_branch = paths_get_current_branch(repo_root);
-    
-    // Get branch-aware snapshots directory
-    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, git_branch);
-    if (!snapshots_dir) {
-        printf("Error: Failed to get snapshots directory\n");
-        free(repo_root);
-        free(git_branch);
+}
+
+// Which snapshots to list
+typedef struct {
+    size_t limit;               // Newest this many; 0 for all
+    time_t since, until;
+    int has_since, has_until;
+    int flat;
+} list_window_t;
+
+// The entries [*first, *end) of catalog that window selects
+static void select_window(const catalog_t *catalog, const list_window_t *window, size_t *first, size_t *end) {
+    // Entries are oldest first, so the window is one range of them
+    *first = window->has_since ? catalog_first_since(catalog, window->since) : 0;
+    *end = catalog->count;
+    if (window->has_until) *end = catalog_first_since(catalog, window->until + 1);
+    if (*end < *first) *end = *first;
+    if (window->limit > 0 && *end - *first > window->limit) *first = *end - window->limit;
+}
+
+// Snapshots of every branch, from the snapshot table: flat ones merged
+// newest first, otherwise one tree per branch
+static int list_all_branches(const char *fractyl_dir, const list_window_t *window) {
+    snapshot_table_t table;
+    catalog_t *catalogs = NULL;
+    if (snapshot_table_load(fractyl_dir, &table) != FRACTYL_OK) {
+        printf("Error: Failed to read snapshots\n");
         return 1;
     }
-    
-    DIR *d = opendir(snapshots_dir);
-    if (!d) {
-        printf("No snapshots found\n");
-        free(snapshots_dir);
-        free(git_branch);
-        free(repo_root);
-        return 0;
+    if (snapshot_table_load_catalogs(&table, &catalogs) != FRACTYL_OK) {
+        printf("Error: Failed to read snapshots\n");
+        snapshot_table_free(&table);
+        return 1;
     }
     
-    // First pass: collect all snapshots
-    tree_node_t **all_nodes = NULL;
-    size_t node_count = 0;
-    size_t node_capacity = 0;
-    
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL) {
-        // Skip . and .. and non-.json files
-        if (entry->d_name[0] == '.' || !strstr(entry->d_name, ".json")) {
-            continue;
+    int result = 0;
+    size_t shown = 0;
+    if (window->flat) {
+        size_t *remaining = calloc(table.count ? table.count : 1, sizeof(size_t));
+        if (!remaining) {
+            printf("Error: Out of memory\n");
+            result = 1;
         }
-        
-        char snapshot_path[2048];
-        snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", 
-                 snapshots_dir, entry->d_name);
-        
-        snapshot_t snapshot;
-        int result = json_load_snapshot(&snapshot, snapshot_path);
-        if (result != FRACTYL_OK) {
-            continue; // Skip invalid snapshots
+        for (size_t i = 0; remaining && i < table.count; i++) {
+            remaining[i] = catalogs[i].count;
         }
-        
-        // Extract snapshot ID from filename (remove .json)
-        char snapshot_id[256];
-        size_t name_len = strlen(entry->d_name);
-        if (name_len > sizeof(snapshot_id) - 1) {
-            json_free_snapshot(&snapshot);
-            continue; // Skip if filename is too long
+        const catalog_entry_t *entry;
+        size_t row;
+        while (remaining && (window->limit == 0 || shown < window->limit) &&
+               (entry = snapshot_table_next_newest(&table, catalogs, remaining, &row)) != NULL) {
+            if (window->has_until && entry->timestamp > window->until) continue;
+            if (window->has_since && entry->timestamp < window->since) break;
+            if (shown++ == 0) printf("Snapshot History (all branches):\n");
+            tree_node_t node;
+            node_from_entry(&node, &catalogs[row], entry);
+            print_snapshot(&node, "", "");
         }
-        strcpy(snapshot_id, entry->d_name);
-        char *dot = strrchr(snapshot_id, '.');
-        if (dot) *dot = '\0';
-        
-        // Create tree node
-        tree_node_t *node = malloc(sizeof(tree_node_t));
-        if (!node) {
-            json_free_snapshot(&snapshot);
-            continue;
+        free(remaining);
+    } else {
+        for (size_t i = 0; i < table.count && result == 0; i++) {
+            size_t first, end;
+            select_window(&catalogs[i], window, &first, &end);
+            if (first == end) continue;
+            char title[512];
+            snprintf(title, sizeof(title), "Snapshot History (%s):",
+                     table.rows[i].branch ? table.rows[i].branch : "no branch");
+            if (shown > 0) printf("\n");
+            result = print_tree(&catalogs[i], first, end, title);
+            shown += end - first;
         }
-        
-        strcpy(node->id, snapshot_id);
-        node->parent_id = snapshot.parent ? strdup(snapshot.parent) : NULL;
-        node->description = snapshot.description ? strdup(snapshot.description) : NULL;
-        node->timestamp = snapshot.timestamp;
-        node->git_branch = snapshot.git_branch ? strdup(snapshot.git_branch) : NULL;
-        node->git_commit = snapshot.git_commit ? strdup(snapshot.git_commit) : NULL;
-        node->git_dirty = snapshot.git_dirty;
-        node->children = NULL;
-        node->child_count = 0;
-        node->child_capacity = 0;
-        
-        // Add to collection
-        if (node_count >= node_capacity) {
-            node_capacity = node_capacity ? node_capacity * 2 : 16;
-            all_nodes = realloc(all_nodes, node_capacity * sizeof(tree_node_t*));
-        }
-        all_nodes[node_count++] = node;
-        
-        json_free_snapshot(&snapshot);
     }
-    closedir(d);
-    
-    if (node_count == 0) {
+    if (result == 0 && shown == 0) {
         printf("No snapshots found\n");
-        free(snapshots_dir);
-        free(git_branch);
-        free(repo_root);
-        return 0;
     }
     
-    // Second pass: build parent-child relationships
-    for (size_t i = 0; i < node_count; i++) {
-        tree_node_t *child = all_nodes[i];
-        if (child->parent_id) {
-            // Find parent
-            for (size_t j = 0; j < node_count; j++) {
-                tree_node_t *parent = all_nodes[j];
-                if (strcmp(parent->id, child->parent_id) == 0) {
-                    add_child(parent, child);
-                    break;
-                }
-            }
+    snapshot_table_free_catalogs(&table, catalogs);
+    snapshot_table_free(&table);
+    return result;
+}
+
+// Parse a time given as a date, a date and time, or an age like 2h or 3d
+static int parse_time(const char *text, time_t *out) {
+    char *end;
+    long amount = strtol(text, &end, 10);
+    if (end != text && amount >= 0 && end[0] != '\0' && end[1] == '\0') {
+        long unit = 0;
+        switch (end[0]) {
+            case 's': unit = 1; break;
+            case 'm': unit = 60; break;
+            case 'h': unit = 3600; break;
+            case 'd': unit = 86400; break;
+            case 'w': unit = 7 * 86400; break;
+        }
+        if (unit) {
+            *out = time(NULL) - (time_t)amount * unit;
+            return 0;
         }
     }
     
-    // Third pass: find root nodes (nodes with no parent) and sort them
-    tree_node_t **roots = NULL;
-    size_t root_count = 0;
-    size_t root_capacity = 0;
-    
-    for (size_t i = 0; i < node_count; i++) {
-        tree_node_t *node = all_nodes[i];
-        if (!node->parent_id) {
-            if (root_count >= root_capacity) {
-                root_capacity = root_capacity ? root_capacity * 2 : 4;
-                roots = realloc(roots, root_capacity * sizeof(tree_node_t*));
+    const char *formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d" };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        struct tm tm_info;
+        memset(&tm_info, 0, sizeof(tm_info));
+        const char *rest = strptime(text, formats[i], &tm_info);
+        if (rest && *rest == '\0') {
+            tm_info.tm_isdst = -1;
+            *out = mktime(&tm_info);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void print_list_usage(void) {
+    printf("Usage: frac list [-n|--limit <count>] [--since <time>] [--until <time>] [--flat]\n");
+    printf("                 [--all-branches]\n");
+    printf("List the snapshots of the current branch\n");
+    printf("\nOptions:\n");
+    printf("  -n, --limit <count>  Only the newest <count> snapshots\n");
+    printf("  --since <time>       Only snapshots taken at or after <time>\n");
+    printf("  --until <time>       Only snapshots taken at or before <time>\n");
+    printf("  --flat               One line per snapshot, newest first, without the tree\n");
+    printf("  --all-branches       Every branch: one tree each (--limit per branch), or\n");
+    printf("                       with --flat all snapshots merged newest first\n");
+    printf("\nTimes are 'YYYY-MM-DD', 'YYYY-MM-DD HH:MM[:SS]', or an age such as 30m, 2h, 3d, 1w\n");
+}
+
+int cmd_list(int argc, char **argv) {
+    list_window_t window;
+    memset(&window, 0, sizeof(window));
+    int all_branches = 0;
+    for (int i = 2; i < argc; i++) {
+        if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--limit") == 0) && i + 1 < argc) {
+            char *end;
+            long value = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || value <= 0) {
+                printf("Error: Limit must be a positive number\n");
+                return 1;
+            }
+            window.limit = (size_t)value;
+        } else if (strcmp(argv[i], "--since") == 0 && i + 1 < argc) {
+            if (parse_time(argv[++i], &window.since) != 0) {
+                printf("Error: Invalid time '%s'\n", argv[i]);
+                return 1;
             }
-            roots[root_count++] = node;
+            window.has_since = 1;
+        } else if (strcmp(argv[i], "--until") == 0 && i + 1 < argc) {
+            if (parse_time(argv[++i], &window.until) != 0) {
+                printf("Error: Invalid time '%s'\n", argv[i]);
+                return 1;
+            }
+            window.has_until = 1;
+        } else if (strcmp(argv[i], "--flat") == 0) {
+            window.flat = 1;
+        } else if (strcmp(argv[i], "--all-branches") == 0) {
+            all_branches = 1;
+        } else {
+            print_list_usage();
+            return 1;
         }
     }
     
-    // Sort root nodes by timestamp
-    if (root_count > 1) {
-        qsort(roots, root_count, sizeof(tree_node_t*), compare_children);
+    // Find repository root
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
     }
     
-    // Sort all children recursively
-    for (size_t i = 0; i < root_count; i++) {
-        sort_children(roots[i]);
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    if (all_branches) {
+        free(repo_root);
+        return list_all_branches(fractyl_dir, &window);
     }
     
-    // Print the snapshot history
-    printf("Snapshot History:\n");
-    for (size_t i = 0; i < root_count; i++) {
-        if (i > 0) printf("\n"); // Separate different root chains
-        print_tree_structure(roots[i], "", i == root_count - 1);
-    }
+    // Get current git branch
+    char *git_branch = paths_get_current_branch(repo_root);
     
-    // Cleanup - only free root nodes as they recursively free children
-    for (size_t i = 0; i < root_count; i++) {
-        free_tree_node(roots[i]);
-    }
-    free(all_nodes);
-    free(roots);
-    free(snapshots_dir);
+    // Get branch-aware snapshots directory
+    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, git_branch);
     free(git_branch);
     free(repo_root);
+    if (!snapshots_dir) {
+        printf("Error: Failed to get snapshots directory\n");
+        return 1;
+    }
     
-    return 0;
-}
\ No newline at end of file
+    catalog_t catalog;
+    int result = catalog_load(snapshots_dir, &catalog);
+    free(snapshots_dir);
+    if (result != FRACTYL_OK) {
+        printf("Error: Failed to read snapshots\n");
+        return 1;
+    }
+    
+    size_t first, end;
+    select_window(&catalog, &window, &first, &end);
+    
+    result = 0;
+    if (first == end) {
+        printf("No snapshots found\n");
+    } else if (window.flat) {
+        print_flat(&catalog, first, end);
+    } else {
+        result = print_tree(&catalog, first, end, "Snapshot History:");
+    }
+    catalog_free(&catalog);
+    return result;
+}
@@ -0,0 +1,115 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../utils/json.h"
+#include "../utils/paths.h"
+#include "../utils/snapshots.h"
+#include "../utils/snapshot_fs.h"
+#include "../utils/catalog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+int cmd_mount(int argc, char **argv) {
+    if (argc < 4) {
+        printf("Usage: frac mount <snapshot-id> <dir>\n");
+        printf("Mount a snapshot read-only at an existing directory\n");
+        printf("\nFiles are read straight from the object store; nothing in the\n");
+        printf("working tree changes. The mount lasts until Ctrl-C, or until the\n");
+        printf("directory is unmounted (umount, or fusermount -u).\n");
+        printf("\nExamples:\n");
+        printf("  frac mount -1 /tmp/snap         # Browse the latest snapshot\n");
+        printf("  frac mount abc123 ~/old         # Mount by prefix\n");
+        return 1;
+    }
+    
+    const char *snapshot_input = argv[2];
+    const char *mountpoint = argv[3];
+    
+    struct stat st;
+    if (stat(mountpoint, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        printf("Error: Mount point '%s' is not a directory\n", mountpoint);
+        return 1;
+    }
+    
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
+    }
+    
+    char fractyl_dir[PATH_MAX];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    char *git_branch = paths_get_current_branch(repo_root);
+    free(repo_root);
+    
+    char snapshot_id[65];
+    if (resolve_snapshot_id(snapshot_input, fractyl_dir, git_branch, snapshot_id) != FRACTYL_OK) {
+        printf("Error: No snapshot found matching '%s'\n", snapshot_input);
+        printf("Use 'frac list' to see available snapshots\n");
+        free(git_branch);
+        return 1;
+    }
+    
+    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, git_branch);
+    free(git_branch);
+    if (!snapshots_dir) {
+        printf("Error: Failed to get snapshots directory\n");
+        return 1;
+    }
+    snapshot_t snapshot;
+    int loaded = catalog_load_snapshot(snapshots_dir, snapshot_id, &snapshot);
+    free(snapshots_dir);
+    if (loaded != FRACTYL_OK) {
+        printf("Error: Snapshot '%s' not found or invalid\n", snapshot_id);
+        return 1;
+    }
+    
+    snapshot_fs_t *fs;
+    int result = snapshot_fs_open(&fs, fractyl_dir, snapshot.index_hash, snapshot.timestamp);
+    json_free_snapshot(&snapshot);
+    if (result != FRACTYL_OK) {
+        printf("Error: Failed to read snapshot %s: %d\n", snapshot_id, result);
+        return 1;
+    }
+    
+    result = snapshot_fs_mount(fs, mountpoint);
+    if (result != FRACTYL_OK) {
+        if (result == FRACTYL_ERROR_PERMISSION_DENIED) {
+            printf("Error: Not allowed to mount at '%s' (run as root, or install fusermount)\n", mountpoint);
+        } else {
+            printf("Error: Failed to mount at '%s': %d (FUSE is needed)\n", mountpoint, result);
+        }
+        snapshot_fs_close(fs);
+        return 1;
+    }
+    
+    // Without SA_RESTART, so the signal ends the wait for requests
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    
+    printf("Mounted snapshot %s at %s (read-only). Press Ctrl-C to unmount.\n", snapshot_id, mountpoint);
+    fflush(stdout);
+    
+    result = snapshot_fs_serve(fs, &stop_requested);
+    snapshot_fs_close(fs);
+    if (result != FRACTYL_OK) {
+        printf("Error: Filesystem stopped: %d\n", result);
+        return 1;
+    }
+    printf("Unmounted %s\n", mountpoint);
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../core/gc.h"
+#include "../core/retention.h"
+#include "../utils/paths.h"
+#include "../utils/lock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void print_prune_usage(void) {
+    printf("Usage: frac prune [-n|--dry-run] [--all <age>] [--hourly <age>] [--daily <age>]\n");
+    printf("                  [--weekly <age>] [--gc]\n");
+    printf("Thin out the snapshots of the current branch as they age\n");
+    printf("\nEvery snapshot younger than --all is kept; older ones are kept while\n");
+    printf("they are the newest of their hour, day or week and younger than\n");
+    printf("--hourly, --daily or --weekly. The rest are removed. Defaults come from\n");
+    printf("retention.all, retention.hourly, retention.daily and retention.weekly.\n");
+    printf("\nOptions:\n");
+    printf("  -n, --dry-run   Report what would be removed\n");
+    printf("  --gc            Delete the objects no snapshot uses afterwards\n");
+    printf("\nAges are seconds, or a number followed by s, m, h, d or w\n");
+}
+
+int cmd_prune(int argc, char **argv) {
+    long ages[4] = { -1, -1, -1, -1 };
+    const char *age_options[4] = { "--all", "--hourly", "--daily", "--weekly" };
+    int dry_run = 0, run_gc = 0;
+    for (int i = 2; i < argc; i++) {
+        int age_option = -1;
+        for (int a = 0; a < 4; a++) {
+            if (strcmp(argv[i], age_options[a]) == 0 && i + 1 < argc) age_option = a;
+        }
+        if (age_option >= 0) {
+            if (retention_parse_age(argv[++i], &ages[age_option]) != FRACTYL_OK) {
+                printf("Error: Invalid age '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--dry-run") == 0) {
+            dry_run = 1;
+        } else if (strcmp(argv[i], "--gc") == 0) {
+            run_gc = 1;
+        } else {
+            print_prune_usage();
+            return 1;
+        }
+    }
+    
+    // Find repository root
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
+    }
+    
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    char *git_branch = paths_get_current_branch(repo_root);
+    free(repo_root);
+    
+    retention_policy_t policy;
+    retention_policy_load(fractyl_dir, &policy);
+    if (ages[0] >= 0) policy.keep_all = ages[0];
+    if (ages[1] >= 0) policy.keep_hourly = ages[1];
+    if (ages[2] >= 0) policy.keep_daily = ages[2];
+    if (ages[3] >= 0) policy.keep_weekly = ages[3];
+    policy.dry_run = dry_run;
+    if (dry_run) policy.batch = 0;
+    if (!retention_policy_enabled(&policy)) {
+        printf("No retention configured; set retention.* or pass an age\n");
+        free(git_branch);
+        return 1;
+    }
+    
+    // One batch per lock, so snapshots are not held up for the whole run
+    size_t examined = 0, removed = 0, reparented = 0;
+    int result = FRACTYL_OK;
+    retention_stats_t stats;
+    do {
+        fractyl_lock_t lock;
+        if (fractyl_lock_wait_acquire(fractyl_dir, &lock, 30) != 0) {
+            printf("Error: Could not acquire lock to prune snapshots\n");
+            free(git_branch);
+            return 1;
+        }
+        result = retention_prune(fractyl_dir, git_branch, &policy, &stats);
+        fractyl_lock_release(&lock);
+        if (examined == 0) examined = stats.examined;
+        removed += stats.removed;
+        reparented += stats.reparented;
+    } while (result == FRACTYL_OK && stats.removed > 0 && stats.remaining > 0);
+    free(git_branch);
+    
+    if (result != FRACTYL_OK) {
+        printf("Error: Failed to prune snapshots (%d)\n", result);
+        return 1;
+    }
+    
+    if (removed == 0) {
+        printf("Nothing to prune: keeping all %zu snapshots\n", examined);
+        return 0;
+    }
+    if (dry_run) {
+        printf("Would remove %zu of %zu snapshots\n", removed, examined);
+        return 0;
+    }
+    printf("Removed %zu of %zu snapshots", removed, examined);
+    if (reparented > 0) {
+        printf(", reparented %zu", reparented);
+    }
+    printf("\n");
+    
+    if (!run_gc) {
+        printf("Run 'frac gc' to delete the objects no other snapshot uses\n");
+        return 0;
+    }
+    
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire(fractyl_dir, &lock, 30) != 0) {
+        printf("Error: Could not acquire lock for garbage collection\n");
+        return 1;
+    }
+    gc_options_t options;
+    gc_options_init(&options);
+    gc_stats_t gc_stats;
+    result = object_gc(fractyl_dir, &options, &gc_stats);
+    fractyl_lock_release(&lock);
+    if (result != FRACTYL_OK) {
+        printf("Error: Garbage collection failed (%d)\n", result);
+        return 1;
+    }
+    printf("Removed %zu unreachable objects (%llu bytes)\n",
+           gc_stats.loose_removed + gc_stats.packed_removed + gc_stats.temp_removed,
+           (unsigned long long)gc_stats.bytes_freed);
+    return 0;
+}
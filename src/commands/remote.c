@@ -0,0 +1,358 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../core/remote.h"
+#include "../utils/config.h"
+#include "../utils/lock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+// Remotes are kept in .fractyl/config as remote.<name>.url,
+// remote.<name>.auto_push and remote.<name>.serve_command
+
+typedef struct {
+    char name[64];
+    char url[2048];
+    int auto_push;
+} remote_entry_t;
+
+typedef struct {
+    const char *fractyl_dir;
+    remote_entry_t *items;
+    size_t count;
+} remote_table_t;
+
+static int valid_remote_name(const char *name) {
+    size_t len = strlen(name);
+    if (len == 0 || len >= sizeof(((remote_entry_t *)0)->name)) return 0;
+    for (const char *p = name; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '-' && *p != '_') return 0;
+    }
+    return 1;
+}
+
+static int add_remote_entry(const char *key, const char *value, void *ctx) {
+    remote_table_t *table = ctx;
+    size_t len = strlen(key);
+    if (strncmp(key, "remote.", 7) != 0 || len <= 11 || strcmp(key + len - 4, ".url") != 0) return 0;
+    
+    char name[64];
+    snprintf(name, sizeof(name), "%.*s", (int)(len - 11), key + 7);
+    if (!valid_remote_name(name)) return 0;
+    for (size_t i = 0; i < table->count; i++) {
+        if (strcmp(table->items[i].name, name) == 0) {
+            snprintf(table->items[i].url, sizeof(table->items[i].url), "%s", value);
+            return 0;
+        }
+    }
+    
+    remote_entry_t *items = realloc(table->items, (table->count + 1) * sizeof(remote_entry_t));
+    if (!items) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    table->items = items;
+    remote_entry_t *entry = &items[table->count++];
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+    snprintf(entry->url, sizeof(entry->url), "%s", value);
+    return 0;
+}
+
+// The configured remotes, in the order they were added
+static int load_remotes(const char *fractyl_dir, remote_table_t *table) {
+    memset(table, 0, sizeof(*table));
+    table->fractyl_dir = fractyl_dir;
+    int result = config_for_each(fractyl_dir, add_remote_entry, table);
+    for (size_t i = 0; result == FRACTYL_OK && i < table->count; i++) {
+        char key[128];
+        snprintf(key, sizeof(key), "remote.%s.auto_push", table->items[i].name);
+        table->items[i].auto_push = config_get_long(fractyl_dir, key, 0) != 0;
+    }
+    return result;
+}
+
+static const remote_entry_t* find_remote(const remote_table_t *table, const char *name) {
+    for (size_t i = 0; i < table->count; i++) {
+        if (strcmp(table->items[i].name, name) == 0) return &table->items[i];
+    }
+    return NULL;
+}
+
+static int push_one(const char *fractyl_dir, const remote_entry_t *entry) {
+    char key[128], serve_command[1024];
+    snprintf(key, sizeof(key), "remote.%s.serve_command", entry->name);
+    int has_serve = config_get(fractyl_dir, key, serve_command, sizeof(serve_command)) == FRACTYL_OK;
+    long pack_objects = config_get_long(fractyl_dir, "push.pack_objects", REMOTE_DEFAULT_PACK_OBJECTS);
+    if (pack_objects < 1) pack_objects = REMOTE_DEFAULT_PACK_OBJECTS;
+    
+    // Objects must stay put while they are sent; snapshots may go on
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire_shared(fractyl_dir, &lock, 30) != 0) {
+        printf("Error: Could not acquire lock for push operation\n");
+        return 1;
+    }
+    
+    char message[512] = "";
+    remote_t *remote;
+    int result = remote_open(entry->url, has_serve ? serve_command : NULL, &remote, message, sizeof(message));
+    remote_push_stats_t stats;
+    if (result == FRACTYL_OK) {
+        result = remote_push(fractyl_dir, remote, (size_t)pack_objects, &stats, message, sizeof(message));
+        remote_close(remote);
+    }
+    fractyl_lock_release(&lock);
+    
+    if (result != FRACTYL_OK) {
+        printf("Error: Push to %s failed: %s\n", entry->name, message[0] ? message : "unknown error");
+        return 1;
+    }
+    if (stats.snapshots == 0 && stats.objects == 0 && stats.branches == 0 && stats.dictionaries == 0) {
+        printf("%s is up to date (%zu objects there)\n", entry->name, stats.remote_objects);
+        return 0;
+    }
+    printf("Pushed %zu snapshots to %s: %zu objects in %zu packs, %.1f MB\n", stats.snapshots, entry->name,
+           stats.objects, stats.packs, stats.bytes / (1024.0 * 1024.0));
+    if (stats.dictionaries > 0) {
+        printf("Also sent %zu compression dictionaries\n", stats.dictionaries);
+    }
+    if (stats.branches > 0) {
+        printf("Moved %zu branches\n", stats.branches);
+    }
+    return 0;
+}
+
+int push_remotes(const char *fractyl_dir, int auto_only, size_t *pushed_out) {
+    remote_table_t table;
+    if (pushed_out) *pushed_out = 0;
+    if (load_remotes(fractyl_dir, &table) != FRACTYL_OK) {
+        free(table.items);
+        return 1;
+    }
+    
+    int status = 0;
+    for (size_t i = 0; i < table.count; i++) {
+        if (auto_only && !table.items[i].auto_push) continue;
+        if (push_one(fractyl_dir, &table.items[i]) != 0) status = 1;
+        if (pushed_out) (*pushed_out)++;
+    }
+    free(table.items);
+    return status;
+}
+
+int remotes_auto_push_count(const char *fractyl_dir) {
+    remote_table_t table;
+    int count = 0;
+    if (load_remotes(fractyl_dir, &table) == FRACTYL_OK) {
+        for (size_t i = 0; i < table.count; i++) {
+            count += table.items[i].auto_push;
+        }
+    }
+    free(table.items);
+    return count;
+}
+
+static void print_remote_usage(void) {
+    printf("Usage: frac remote [list]\n");
+    printf("       frac remote add <name> <url> [--auto-push] [--serve-command <cmd>]\n");
+    printf("       frac remote remove <name>\n");
+    printf("Manage the stores snapshots are pushed to (see 'frac push')\n");
+    printf("\nURLs:\n");
+    printf("  <dir>, file://<dir>              A directory, local or mounted\n");
+    printf("  ssh://[user@]host[:port]/<path>  A directory on a host, through 'frac remote-serve'\n");
+    printf("  [user@]host:<path>\n");
+    printf("\nOptions:\n");
+    printf("  --auto-push              The daemon pushes to it after taking snapshots\n");
+    printf("  --serve-command <cmd>    What to run on the SSH host (default 'frac remote-serve')\n");
+}
+
+static int find_fractyl_dir(char *fractyl_dir, size_t size) {
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return -1;
+    }
+    snprintf(fractyl_dir, size, "%s/.fractyl", repo_root);
+    free(repo_root);
+    return 0;
+}
+
+static int remote_add(const char *fractyl_dir, int argc, char **argv) {
+    const char *name = NULL, *url = NULL, *serve_command = NULL;
+    int auto_push = 0;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--auto-push") == 0) {
+            auto_push = 1;
+        } else if (strcmp(argv[i], "--serve-command") == 0 && i + 1 < argc) {
+            serve_command = argv[++i];
+        } else if (!name) {
+            name = argv[i];
+        } else if (!url) {
+            url = argv[i];
+        } else {
+            print_remote_usage();
+            return 1;
+        }
+    }
+    if (!name || !url) {
+        print_remote_usage();
+        return 1;
+    }
+    if (!valid_remote_name(name)) {
+        printf("Error: Remote names are letters, digits, '-' and '_'\n");
+        return 1;
+    }
+    char message[512];
+    if (!remote_url_supported(url, message, sizeof(message))) {
+        printf("Error: %s\n", message);
+        return 1;
+    }
+    
+    remote_table_t table;
+    load_remotes(fractyl_dir, &table);
+    int exists = find_remote(&table, name) != NULL;
+    free(table.items);
+    if (exists) {
+        printf("Error: Remote %s already exists\n", name);
+        return 1;
+    }
+    
+    // Relative directories are taken from here, as the daemon runs elsewhere
+    char absolute[4096];
+    if (url[0] != '/' && !strchr(url, ':')) {
+        char cwd[2048];
+        if (!getcwd(cwd, sizeof(cwd))) {
+            printf("Error: Cannot get current directory\n");
+            return 1;
+        }
+        snprintf(absolute, sizeof(absolute), "%s/%s", cwd, url);
+        url = absolute;
+    }
+    
+    char key[128];
+    snprintf(key, sizeof(key), "remote.%s.url", name);
+    int result = config_set(fractyl_dir, key, url);
+    snprintf(key, sizeof(key), "remote.%s.auto_push", name);
+    if (result == FRACTYL_OK) result = config_set(fractyl_dir, key, auto_push ? "1" : NULL);
+    snprintf(key, sizeof(key), "remote.%s.serve_command", name);
+    if (result == FRACTYL_OK) result = config_set(fractyl_dir, key, serve_command);
+    if (result != FRACTYL_OK) {
+        printf("Error: Could not write %s/config\n", fractyl_dir);
+        return 1;
+    }
+    printf("Added remote %s: %s%s\n", name, url, auto_push ? " (pushed to by the daemon)" : "");
+    return 0;
+}
+
+static int remote_remove(const char *fractyl_dir, const char *name) {
+    remote_table_t table;
+    load_remotes(fractyl_dir, &table);
+    int exists = find_remote(&table, name) != NULL;
+    free(table.items);
+    if (!exists) {
+        printf("Error: No remote named %s\n", name);
+        return 1;
+    }
+    
+    static const char *const settings[] = { "url", "auto_push", "serve_command" };
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        char key[128];
+        snprintf(key, sizeof(key), "remote.%s.%s", name, settings[i]);
+        if (config_set(fractyl_dir, key, NULL) != FRACTYL_OK) {
+            printf("Error: Could not write %s/config\n", fractyl_dir);
+            return 1;
+        }
+    }
+    printf("Removed remote %s; what was pushed there stays\n", name);
+    return 0;
+}
+
+int cmd_remote(int argc, char **argv) {
+    const char *action = argc > 2 ? argv[2] : "list";
+    int known = strcmp(action, "list") == 0 || strcmp(action, "add") == 0 || strcmp(action, "remove") == 0;
+    if (!known || (strcmp(action, "remove") == 0 && argc != 4) || (strcmp(action, "list") == 0 && argc > 3)) {
+        print_remote_usage();
+        return 1;
+    }
+    
+    char fractyl_dir[2048];
+    if (find_fractyl_dir(fractyl_dir, sizeof(fractyl_dir)) != 0) return 1;
+    if (strcmp(action, "add") == 0) return remote_add(fractyl_dir, argc, argv);
+    if (strcmp(action, "remove") == 0) return remote_remove(fractyl_dir, argv[3]);
+    
+    remote_table_t table;
+    load_remotes(fractyl_dir, &table);
+    if (table.count == 0) {
+        printf("No remotes (add one with 'frac remote add <name> <url>')\n");
+    }
+    for (size_t i = 0; i < table.count; i++) {
+        printf("%-12s %s%s\n", table.items[i].name, table.items[i].url,
+               table.items[i].auto_push ? "  (auto-push)" : "");
+    }
+    free(table.items);
+    return 0;
+}
+
+int cmd_push(int argc, char **argv) {
+    int auto_only = 0;
+    int first_name = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--auto") == 0) {
+            auto_only = 1;
+        } else if (argv[i][0] == '-') {
+            printf("Usage: frac push [<remote>...] [--auto]\n");
+            printf("Send the remotes every snapshot they lack, with its objects\n");
+            printf("\nWithout names, every remote is pushed to.\n");
+            printf("\nOptions:\n");
+            printf("  --auto    Only the remotes added with --auto-push\n");
+            return 1;
+        } else if (!first_name) {
+            first_name = i;
+        }
+    }
+    
+    char fractyl_dir[2048];
+    if (find_fractyl_dir(fractyl_dir, sizeof(fractyl_dir)) != 0) return 1;
+    if (!first_name) {
+        size_t pushed;
+        int status = push_remotes(fractyl_dir, auto_only, &pushed);
+        if (pushed == 0 && status == 0) {
+            printf("No remotes to push to (add one with 'frac remote add <name> <url>')\n");
+        }
+        return status;
+    }
+    
+    remote_table_t table;
+    load_remotes(fractyl_dir, &table);
+    int status = 0;
+    for (int i = first_name; i < argc; i++) {
+        if (argv[i][0] == '-') continue;
+        const remote_entry_t *entry = find_remote(&table, argv[i]);
+        if (!entry) {
+            printf("Error: No remote named %s\n", argv[i]);
+            status = 1;
+        } else if (push_one(fractyl_dir, entry) != 0) {
+            status = 1;
+        }
+    }
+    free(table.items);
+    return status;
+}
+
+int cmd_remote_serve(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: frac remote-serve <path>\n");
+        fprintf(stderr, "Serve a push into the store at <path> over standard input and output\n");
+        return 1;
+    }
+    
+    // Standard output carries the replies; anything else printed goes to
+    // standard error instead
+    int out_fd = dup(STDOUT_FILENO);
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+    if (!out || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "Error: Cannot set up the reply stream\n");
+        return 1;
+    }
+    int result = remote_serve(argv[2], stdin, out);
+    fclose(out);
+    return result == FRACTYL_OK ? 0 : 1;
+}
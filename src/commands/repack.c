@@ -0,0 +1,243 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../utils/catalog.h"
+#include "../utils/lock.h"
+#include "../utils/paths.h"
+#include "../core/index.h"
+#include "../core/objects.h"
+#include "../core/pack.h"
+#include "../core/tree.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+
+// Longest chain of delta bases a restore has to follow
+#define DEFAULT_DELTA_DEPTH 10
+
+typedef struct {
+    time_t timestamp;
+    unsigned char index_hash[32];
+} history_point_t;
+
+// A delta candidate and when its base version was snapshotted
+typedef struct {
+    time_t timestamp;
+    pack_delta_pair_t pair;
+} dated_pair_t;
+
+typedef struct {
+    dated_pair_t *items;
+    size_t count;
+    size_t capacity;
+} pair_list_t;
+
+static int compare_points(const void *a, const void *b) {
+    time_t ta = ((const history_point_t *)a)->timestamp;
+    time_t tb = ((const history_point_t *)b)->timestamp;
+    return (ta > tb) - (ta < tb);
+}
+
+static int compare_pairs_newest_first(const void *a, const void *b) {
+    time_t ta = ((const dated_pair_t *)a)->timestamp;
+    time_t tb = ((const dated_pair_t *)b)->timestamp;
+    return (ta < tb) - (ta > tb);
+}
+
+static int add_pair(pair_list_t *pairs, time_t timestamp, const unsigned char *target, const unsigned char *base) {
+    if (pairs->count >= pairs->capacity) {
+        size_t new_capacity = pairs->capacity ? pairs->capacity * 2 : 256;
+        dated_pair_t *grown = realloc(pairs->items, new_capacity * sizeof(dated_pair_t));
+        if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        pairs->items = grown;
+        pairs->capacity = new_capacity;
+    }
+    dated_pair_t *item = &pairs->items[pairs->count++];
+    item->timestamp = timestamp;
+    memcpy(item->pair.target, target, sizeof(item->pair.target));
+    memcpy(item->pair.base, base, sizeof(item->pair.base));
+    return FRACTYL_OK;
+}
+
+// One step of a timeline: the pairs of files changed in it
+typedef struct {
+    pair_list_t *pairs;
+    time_t timestamp;
+    int result;
+} timeline_step_t;
+
+static int add_modified_pair(index_change_t change, const index_entry_t *old_entry,
+                             const index_entry_t *new_entry, void *ctx) {
+    timeline_step_t *step = ctx;
+    if (change != INDEX_CHANGE_MODIFIED || !S_ISREG(old_entry->mode) || !S_ISREG(new_entry->mode) ||
+        memcmp(old_entry->hash, new_entry->hash, 32) == 0) {
+        return 0;
+    }
+    step->result = add_pair(step->pairs, step->timestamp, old_entry->hash, new_entry->hash);
+    return step->result;
+}
+
+// Walk one snapshot directory in time order. Every file that changed
+// between consecutive snapshots gives a pair: the older version stored
+// against the newer one, so the latest versions stay whole.
+static int add_timeline_pairs(const char *fractyl_dir, const char *snapshots_dir, pair_list_t *pairs) {
+    catalog_t catalog;
+    if (catalog_load(snapshots_dir, &catalog) != FRACTYL_OK) return FRACTYL_OK;
+    
+    history_point_t *points = malloc(sizeof(history_point_t) * (catalog.count ? catalog.count : 1));
+    size_t count = 0;
+    int result = points ? FRACTYL_OK : FRACTYL_ERROR_OUT_OF_MEMORY;
+    for (size_t i = 0; points && i < catalog.count; i++) {
+        points[count].timestamp = catalog.entries[i].timestamp;
+        memcpy(points[count].index_hash, catalog.entries[i].index_hash, sizeof(points[count].index_hash));
+        count++;
+    }
+    catalog_free(&catalog);
+    
+    if (result == FRACTYL_OK && count > 1) {
+        qsort(points, count, sizeof(history_point_t), compare_points);
+    }
+    
+    // Consecutive snapshots are compared tree against tree, so only the
+    // directories that changed between them are read. A snapshot whose
+    // trees cannot be read is left out of the timeline.
+    const history_point_t *older = NULL;
+    for (size_t i = 0; result == FRACTYL_OK && i < count; i++) {
+        if (older && memcmp(points[i].index_hash, older->index_hash, 32) == 0) continue;
+        if (!older) {
+            if (object_exists(points[i].index_hash, fractyl_dir)) older = &points[i];
+            continue;
+        }
+    
+        timeline_step_t step = { pairs, points[i].timestamp, FRACTYL_OK };
+        int walked = tree_diff(older->index_hash, points[i].index_hash, fractyl_dir, add_modified_pair,
+                               &step, NULL);
+        if (step.result != FRACTYL_OK) {
+            result = step.result;
+        } else if (walked == FRACTYL_OK) {
+            older = &points[i];
+        }
+    }
+    free(points);
+    return result;
+}
+
+typedef struct {
+    const char *fractyl_dir;
+    pair_list_t *pairs;
+} pair_walk_t;
+
+static int add_branch_pairs(const char *branch, const char *snapshots_dir, void *ctx) {
+    (void)branch;
+    pair_walk_t *walk = ctx;
+    return add_timeline_pairs(walk->fractyl_dir, snapshots_dir, walk->pairs);
+}
+
+// Delta candidates from the history of every branch, newest first
+static int collect_delta_pairs(const char *fractyl_dir, pair_list_t *pairs) {
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/snapshots", fractyl_dir);
+    int result = add_timeline_pairs(fractyl_dir, path, pairs);
+    
+    pair_walk_t walk = { fractyl_dir, pairs };
+    if (result == FRACTYL_OK) result = paths_for_each_branch(fractyl_dir, add_branch_pairs, &walk);
+    
+    if (result == FRACTYL_OK && pairs->count > 1) {
+        qsort(pairs->items, pairs->count, sizeof(dated_pair_t), compare_pairs_newest_first);
+    }
+    return result;
+}
+
+int cmd_repack(int argc, char **argv) {
+    int all = 0;
+    long depth = DEFAULT_DELTA_DEPTH;
+    
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--all") == 0) {
+            all = 1;
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            char *end;
+            depth = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || depth < 0 || depth > 50) {
+                printf("Error: Delta depth must be between 0 and 50\n");
+                return 1;
+            }
+        } else {
+            printf("Usage: frac repack [-a|--all] [--depth <n>]\n");
+            printf("Move loose objects into a new packfile\n");
+            printf("\nFiles that changed between snapshots are stored as deltas\n");
+            printf("against their next version.\n");
+            printf("\nOptions:\n");
+            printf("  -a, --all      Also fold the existing packs into the new one\n");
+            printf("  --depth <n>    Longest chain of deltas (default %d, 0 for none)\n",
+                   DEFAULT_DELTA_DEPTH);
+            return 1;
+        }
+    }
+    
+    // Find repository root
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
+    }
+    
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    free(repo_root);
+    
+    // Loose objects and folded packs are removed once packed
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire(fractyl_dir, &lock, 30) != 0) {
+        printf("Error: Could not acquire lock for repack operation\n");
+        return 1;
+    }
+    
+    pair_list_t pairs = {0};
+    if (depth > 0 && collect_delta_pairs(fractyl_dir, &pairs) != FRACTYL_OK) {
+        printf("Warning: Could not read snapshot history; packing without deltas\n");
+        pairs.count = 0;
+    }
+    
+    pack_delta_pair_t *candidates = pairs.count ? malloc(pairs.count * sizeof(pack_delta_pair_t)) : NULL;
+    size_t candidate_count = candidates ? pairs.count : 0;
+    for (size_t i = 0; i < candidate_count; i++) {
+        candidates[i] = pairs.items[i].pair;
+    }
+    free(pairs.items);
+    
+    pack_repack_options_t options = { all, (int)depth, candidates, candidate_count, NULL, 0, 0 };
+    pack_repack_stats_t stats;
+    int result = pack_repack_with_options(fractyl_dir, &options, &stats);
+    free(candidates);
+    fractyl_lock_release(&lock);
+    if (result != FRACTYL_OK) {
+        printf("Error: Repack failed (%d)\n", result);
+        return 1;
+    }
+    
+    if (stats.objects == 0 && stats.loose_removed == 0) {
+        printf("Nothing to repack\n");
+        return 0;
+    }
+    
+    if (stats.objects > 0 && stats.loose_packed > 0) {
+        printf("Packed %zu loose objects into a pack of %zu objects\n",
+               stats.loose_packed, stats.objects);
+    } else if (stats.objects > 0) {
+        printf("Wrote a pack of %zu objects\n", stats.objects);
+    }
+    if (stats.deltas > 0) {
+        printf("Stored %zu of them as deltas\n", stats.deltas);
+    }
+    if (stats.packs_removed > 0) {
+        printf("Folded %zu old packs into it\n", stats.packs_removed);
+    }
+    if (stats.loose_removed > stats.loose_packed) {
+        printf("Removed %zu loose objects that were already packed\n",
+               stats.loose_removed - stats.loose_packed);
+    }
+    return 0;
+}
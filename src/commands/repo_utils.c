@@ -2,6 +2,7 @@
 #include "../include/core.h"
 #include "../core/index.h"
 #include "../core/objects.h"
+#include "../core/hash.h"
 #include "../utils/fs.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,7 +11,21 @@
 #include <unistd.h>
 #include <limits.h>
 
+// Hash with the repository's algorithm from here on; NULL (after freeing
+// root) if it names one this build does not know
+static char* use_repo(char *root) {
+    char fractyl_dir[PATH_MAX];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", root);
+    if (hash_use_repository(fractyl_dir) != FRACTYL_OK) {
+        fprintf(stderr, "Error: %s/config sets an unknown objects.hash\n", fractyl_dir);
+        free(root);
+        return NULL;
+    }
+    return root;
+}
+
 // Find the root of a fractyl repository by searching up the directory tree
+// and switch to its hash algorithm
 char* fractyl_find_repo_root(const char *start_path) {
     char current_path[PATH_MAX];
     char fractyl_dir[PATH_MAX];
@@ -34,13 +49,13 @@ char* fractyl_find_repo_root(const char *start_path) {
     
     while (strlen(path_copy) > 1) { // Stop at root directory "/"
         snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", path_copy);
-        
+    
         struct stat st;
         if (stat(fractyl_dir, &st) == 0 && S_ISDIR(st.st_mode)) {
             // Found .fractyl directory, return this path as repo root
-            return path_copy; // Caller must free
+            return use_repo(path_copy); // Caller must free
         }
-        
+    
         // Move to parent directory
         char *last_slash = strrchr(path_copy, '/');
         if (last_slash == path_copy) {
@@ -58,7 +73,7 @@ char* fractyl_find_repo_root(const char *start_path) {
     snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", path_copy);
     struct stat st;
     if (stat(fractyl_dir, &st) == 0 && S_ISDIR(st.st_mode)) {
-        return path_copy;
+        return use_repo(path_copy);
     }
     
     free(path_copy);
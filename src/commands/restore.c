@@ -5,8 +5,15 @@
 #include "../utils/json.h"
 #include "../utils/fs.h"
 #include "../utils/paths.h"
+#include "../utils/snapshots.h"
 #include "../utils/git.h"
 #include "../utils/parallel_scan.h"
+#include "../utils/parallel_restore.h"
+#include "../utils/lock.h"
+#include "../utils/binary_index.h"
+#include "../utils/pathspec.h"
+#include "../utils/catalog.h"
+#include "../core/tree.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,204 +21,123 @@
 #include <unistd.h>
 #include <limits.h>
 #include <fcntl.h>
-#include <dirent.h>
 #include <time.h>
 #include <errno.h>
 
-// Get chronologically ordered snapshots (newest first)
-static char** get_chronological_snapshots_for_branch(const char *fractyl_dir, const char *branch, size_t *count) {
-    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, branch);
-    if (!snapshots_dir) {
-        *count = 0;
-        return NULL;
-    }
-    
-    DIR *d = opendir(snapshots_dir);
-    if (!d) {
-        *count = 0;
-        free(snapshots_dir);
-        return NULL;
-    }
-    
-    // First pass: collect all snapshots with timestamps
-    typedef struct {
-        char *id;
-        time_t timestamp;
-    } snapshot_info_t;
-    
-    snapshot_info_t *snapshots = NULL;
-    size_t capacity = 0;
-    *count = 0;
-    
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL) {
-        if (entry->d_name[0] == '.' || !strstr(entry->d_name, ".json")) {
+// Bring the scan engines' binary index of branch in line with the
+// restored tree, so the next snapshot trusts the files restore wrote
+// rather than hashing them again. Nothing is done if there is none yet.
+static void refresh_binary_index(const char *fractyl_dir, const char *branch, const index_t *index) {
+    if (!branch) return;
+    binary_index_t cache;
+    if (binary_index_load(&cache, fractyl_dir, branch) != FRACTYL_OK) return;
+    if (cache.header.entry_count == 0) {
+        binary_index_free(&cache);
+        return;
+    }
+    
+    // Files the restored snapshot does not have are gone
+    binary_index_iterator_t iter;
+    binary_index_iterator_init(&iter, &cache);
+    const char *path;
+    const binary_index_entry_t *cached;
+    while (binary_index_iterator_next(&iter, &path, &cached)) {
+        if (!index_find_entry(index, path)) binary_index_remove_entry(&cache, path);
+    }
+    
+    for (size_t i = 0; i < index->count; i++) {
+        const index_entry_t *entry = &index->entries[i];
+        if (entry->flags & INDEX_ENTRY_RACY) {
+            // Hashed again by the next scan
+            binary_index_remove_entry(&cache, entry->path);
             continue;
         }
-        
-        char snapshot_path[2048];
-        snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", snapshots_dir, entry->d_name);
-        
-        snapshot_t snapshot;
-        if (json_load_snapshot(&snapshot, snapshot_path) == FRACTYL_OK) {
-            if (*count >= capacity) {
-                capacity = capacity ? capacity * 2 : 16;
-                snapshots = realloc(snapshots, capacity * sizeof(snapshot_info_t));
-            }
-            
-            snapshots[*count].id = strdup(snapshot.id);
-            snapshots[*count].timestamp = snapshot.timestamp;
-            (*count)++;
-            
-            json_free_snapshot(&snapshot);
-        }
-    }
-    closedir(d);
-    free(snapshots_dir);
-    
-    if (*count == 0) {
-        free(snapshots);
-        return NULL;
-    }
-    
-    // Sort by timestamp (newest first)
-    for (size_t i = 0; i < *count - 1; i++) {
-        for (size_t j = i + 1; j < *count; j++) {
-            if (snapshots[i].timestamp < snapshots[j].timestamp) {
-                snapshot_info_t temp = snapshots[i];
-                snapshots[i] = snapshots[j];
-                snapshots[j] = temp;
-            }
-        }
-    }
-    
-    // Extract just the IDs
-    char **result = malloc(*count * sizeof(char*));
-    for (size_t i = 0; i < *count; i++) {
-        result[i] = snapshots[i].id;
-    }
-    free(snapshots);
-    
-    return result;
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        st.st_mode = entry->mode;
+        st.st_size = entry->size;
+        st.st_mtim.tv_sec = entry->mtime;
+        st.st_mtim.tv_nsec = entry->mtime_nsec;
+        st.st_ctim.tv_sec = entry->ctime;
+        st.st_ctim.tv_nsec = entry->ctime_nsec;
+        st.st_ino = (ino_t)entry->ino;
+        st.st_dev = (dev_t)entry->dev;
+        st.st_uid = entry->uid;
+        st.st_gid = entry->gid;
+        binary_index_update_entry(&cache, entry->path, &st, entry->hash);
+    }
+    
+    if (binary_index_save(&cache, fractyl_dir) != FRACTYL_OK) {
+        printf("Warning: Failed to update binary index\n");
+    }
+    binary_index_free(&cache);
 }
 
-// Resolve a hash prefix to a full snapshot ID
-// Returns 0 on success, negative on error
-// result_id must be at least 65 chars (64 + null terminator)
-static int resolve_snapshot_prefix(const char *prefix, const char *fractyl_dir, const char *branch, char *result_id) {
-    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, branch);
-    if (!snapshots_dir) {
-        return FRACTYL_ERROR_IO;
-    }
-    
-    DIR *d = opendir(snapshots_dir);
-    if (!d) {
-        free(snapshots_dir);
-        return FRACTYL_ERROR_IO;
-    }
-    
-    size_t prefix_len = strlen(prefix);
-    if (prefix_len < 4) {
-        closedir(d);
-        free(snapshots_dir);
-        return FRACTYL_ERROR_GENERIC; // Prefix too short
-    }
-    
-    char *matches[64]; // Store up to 64 matches
-    int match_count = 0;
-    
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL && match_count < 64) {
-        // Skip . and .. and non-.json files
-        if (entry->d_name[0] == '.' || !strstr(entry->d_name, ".json")) {
-            continue;
-        }
-        
-        // Remove .json extension for comparison
-        char snapshot_id[256];
-        size_t name_len = strlen(entry->d_name);
-        if (name_len > sizeof(snapshot_id) - 1) {
-            continue;
-        }
-        strcpy(snapshot_id, entry->d_name);
-        char *dot = strrchr(snapshot_id, '.');
-        if (dot) *dot = '\0';
-        
-        // Check if this snapshot ID starts with the prefix
-        if (strncmp(snapshot_id, prefix, prefix_len) == 0) {
-            matches[match_count] = strdup(snapshot_id);
-            match_count++;
-        }
-    }
-    
-    closedir(d);
-    free(snapshots_dir);
-    
-    if (match_count == 0) {
-        return FRACTYL_ERROR_SNAPSHOT_NOT_FOUND;
-    } else if (match_count == 1) {
-        // Unique match found
-        strcpy(result_id, matches[0]);
-        free(matches[0]);
-        return FRACTYL_OK;
-    } else {
-        // Ambiguous prefix
-        printf("Error: Prefix '%s' is ambiguous, matches %d snapshots:\n", prefix, match_count);
-        for (int i = 0; i < match_count; i++) {
-            printf("  %s\n", matches[i]);
-            free(matches[i]);
-        }
-        printf("Use a longer prefix to disambiguate\n");
-        return FRACTYL_ERROR_GENERIC;
-    }
+typedef struct {
+    const char *const *pathspecs;
+    size_t count;
+    index_t *selected;
+} select_context_t;
+
+// tree_for_each_file() callback: keep the files a pathspec matches
+static int select_file(const index_entry_t *entry, void *ctx) {
+    select_context_t *select = ctx;
+    if (!pathspec_match_any(select->pathspecs, select->count, entry->path)) return 0;
+    return index_add_entry(select->selected, entry);
 }
 
-// Resolve relative notation like -1, -2 to snapshot IDs
-// Returns 0 on success, negative on error
-static int resolve_relative_snapshot(const char *relative_spec, const char *fractyl_dir, const char *branch, char *result_id) {
-    if (relative_spec[0] != '-' || strlen(relative_spec) < 2) {
-        return FRACTYL_ERROR_GENERIC; // Not a relative spec
-    }
-    
-    // Parse the number after the dash
-    int steps_back = atoi(relative_spec + 1);
-    if (steps_back <= 0) {
-        return FRACTYL_ERROR_GENERIC; // Invalid number
-    }
-    
-    // Get chronologically ordered snapshots
-    size_t count;
-    char **snapshots = get_chronological_snapshots_for_branch(fractyl_dir, branch, &count);
-    if (!snapshots || count == 0) {
-        return FRACTYL_ERROR_SNAPSHOT_NOT_FOUND;
+// Restore only the snapshot's files that match pathspecs, like
+// "git checkout <commit> -- <paths>": they are looked up under their
+// common prefix rather than loading the whole snapshot, and nothing else
+// in the tree is removed or recorded as restored.
+static int restore_paths(const snapshot_t *snapshot, const char *snapshot_id, const char *repo_root,
+                         const char *fractyl_dir, const char *const *pathspecs, size_t count) {
+    char *prefix = pathspec_prefix(pathspecs, count);
+    if (!prefix) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    index_t selected;
+    index_init(&selected);
+    select_context_t select = { pathspecs, count, &selected };
+    int result = tree_for_each_file(snapshot->index_hash, fractyl_dir, prefix, select_file, &select);
+    free(prefix);
+    if (result != FRACTYL_OK) {
+        printf("Error: Failed to read snapshot index: %d\n", result);
+        index_free(&selected);
+        return result;
     }
-    
-    // -1 means latest (index 0), -2 means second latest (index 1), etc.
-    size_t index = (size_t)(steps_back - 1);
-    if (index >= count) {
-        // Free the snapshots array
-        for (size_t i = 0; i < count; i++) {
-            free(snapshots[i]);
-        }
-        free(snapshots);
-        return FRACTYL_ERROR_SNAPSHOT_NOT_FOUND; // Not enough snapshots
+    if (selected.count == 0) {
+        printf("Error: No files in snapshot %s match the given paths\n", snapshot_id);
+        index_free(&selected);
+        return FRACTYL_ERROR_NOT_FOUND;
     }
     
-    strcpy(result_id, snapshots[index]);
+    // The current index tells which of them are already up to date
+    index_t current_index;
+    index_init(&current_index);
+    char current_index_path[PATH_MAX];
+    snprintf(current_index_path, sizeof(current_index_path), "%s/index", fractyl_dir);
+    index_load(&current_index, current_index_path); // ignore errors, empty if none
     
-    // Free the snapshots array
-    for (size_t i = 0; i < count; i++) {
-        free(snapshots[i]);
+    size_t unchanged = 0;
+    restore_stats_t restored;
+    result = restore_changed_files(&selected, &current_index, repo_root, fractyl_dir, NULL, &unchanged, &restored);
+    if (result == FRACTYL_OK) {
+        printf("Restored %zu of %zu matching files from snapshot %s (%zu already up to date)\n",
+               restored.written, selected.count, snapshot_id, unchanged);
+    } else {
+        printf("Error: Failed to restore files: %d\n", result);
     }
-    free(snapshots);
-    
-    return FRACTYL_OK;
+    index_free(&current_index);
+    index_free(&selected);
+    return result;
 }
 
 int cmd_restore(int argc, char **argv) {
     if (argc < 3) {
-        printf("Usage: frac restore <snapshot-id>\n");
+        printf("Usage: frac restore <snapshot-id> [-- <path>...]\n");
         printf("Restore files from a snapshot\n");
+        printf("\nWith paths, only the files they match are restored (a path names a file\n");
+        printf("or a directory; *, ? and [ make it a glob) and nothing else is touched.\n");
         printf("\nSnapshot identifiers can be:\n");
         printf("  abc123                          # Hash prefix (minimum 4 chars)\n");
         printf("  abc123...                       # Full hash\n");
@@ -220,12 +146,31 @@ int cmd_restore(int argc, char **argv) {
         printf("\nExamples:\n");
         printf("  frac restore -1                 # Restore latest snapshot\n");
         printf("  frac restore abc123             # Restore by prefix\n");
+        printf("  frac restore -1 -- src/main.c   # Restore one file\n");
+        printf("  frac restore -1 -- 'docs/*.md'  # Restore files matching a glob\n");
         printf("\nUse 'frac list' to see available snapshots\n");
         return 1;
     }
     
     const char *snapshot_input = argv[2];
     
+    // Pathspecs follow "--"
+    int first_path = 3;
+    if (argc > 3 && strcmp(argv[3], "--") == 0) first_path = 4;
+    size_t pathspec_count = argc > first_path ? (size_t)(argc - first_path) : 0;
+    if (first_path == 3 && pathspec_count > 0) {
+        printf("Error: Unexpected argument '%s' (put paths after '--')\n", argv[3]);
+        return 1;
+    }
+    if (first_path == 4 && pathspec_count == 0) {
+        printf("Error: No paths given after '--'\n");
+        return 1;
+    }
+    for (int i = first_path; i < argc; i++) {
+        argv[i] = (char *)pathspec_normalize(argv[i]);
+    }
+    const char *const *pathspecs = (const char *const *)&argv[first_path];
+    
     // Find repository root
     char *repo_root = fractyl_find_repo_root(NULL);
     if (!repo_root) {
@@ -242,21 +187,17 @@ int cmd_restore(int argc, char **argv) {
     // Resolve snapshot identifier (prefix or relative notation) to full ID
     char snapshot_id[65];
     
-    // Try relative notation first, then prefix resolution
-    int result = resolve_relative_snapshot(snapshot_input, fractyl_dir, git_branch, snapshot_id);
+    int result = resolve_snapshot_id(snapshot_input, fractyl_dir, git_branch, snapshot_id);
     if (result != FRACTYL_OK) {
-        result = resolve_snapshot_prefix(snapshot_input, fractyl_dir, git_branch, snapshot_id);
-        if (result != FRACTYL_OK) {
-            if (result == FRACTYL_ERROR_SNAPSHOT_NOT_FOUND) {
-                printf("Error: No snapshot found matching '%s'\n", snapshot_input);
-                printf("Use 'frac list' to see available snapshots\n");
-            } else if (result == FRACTYL_ERROR_GENERIC && strlen(snapshot_input) < 4) {
-                printf("Error: Snapshot identifier '%s' is too short (minimum 4 characters for prefixes)\n", snapshot_input);
-            }
-            free(repo_root);
-            free(git_branch);
-            return 1;
+        if (result == FRACTYL_ERROR_SNAPSHOT_NOT_FOUND) {
+            printf("Error: No snapshot found matching '%s'\n", snapshot_input);
+            printf("Use 'frac list' to see available snapshots\n");
+        } else if (result == FRACTYL_ERROR_GENERIC && strlen(snapshot_input) < 4) {
+            printf("Error: Snapshot identifier '%s' is too short (minimum 4 characters for prefixes)\n", snapshot_input);
         }
+        free(repo_root);
+        free(git_branch);
+        return 1;
     }
     
     // Build path to snapshot file using branch-aware directory
@@ -268,12 +209,9 @@ int cmd_restore(int argc, char **argv) {
         return 1;
     }
     
-    char snapshot_path[PATH_MAX];
-    snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s.json", snapshots_dir, snapshot_id);
-    free(snapshots_dir);
-    
     snapshot_t snapshot;
-    result = json_load_snapshot(&snapshot, snapshot_path);
+    result = catalog_load_snapshot(snapshots_dir, snapshot_id, &snapshot);
+    free(snapshots_dir);
     if (result != FRACTYL_OK) {
         printf("Error: Snapshot '%s' not found or invalid\n", snapshot_id);
         free(repo_root);
@@ -281,13 +219,39 @@ int cmd_restore(int argc, char **argv) {
         return 1;
     }
     
-    // Check if current state differs from last snapshot and auto-snapshot if needed
+    // One lock over the safety snapshot and every change to the tree
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire(fractyl_dir, &lock, 30) != 0) {
+        printf("Error: Could not acquire lock for restore operation\n");
+        free(repo_root);
+        free(git_branch);
+        json_free_snapshot(&snapshot);
+        return 1;
+    }
+    
+    // Only the matching files: no safety snapshot, removals or new CURRENT
+    if (pathspec_count > 0) {
+        result = restore_paths(&snapshot, snapshot_id, repo_root, fractyl_dir, pathspecs, pathspec_count);
+        free(repo_root);
+        free(git_branch);
+        json_free_snapshot(&snapshot);
+        fractyl_lock_release(&lock);
+        return result == FRACTYL_OK ? 0 : 1;
+    }
+    
+    // Check if current state differs from last snapshot and auto-snapshot if needed.
+    // The safety snapshot's scan of the tree is then the current index.
+    index_t current_index;
+    index_init(&current_index);
+    int scanned = 0;
+    
     char *current_path = paths_get_current_file(fractyl_dir, git_branch);
     if (!current_path) {
         printf("Error: Failed to get current file path\n");
         free(repo_root);
         free(git_branch);
         json_free_snapshot(&snapshot);
+        fractyl_lock_release(&lock);
         return 1;
     }
     
@@ -301,18 +265,22 @@ int cmd_restore(int argc, char **argv) {
             if (len > 0 && current_snapshot_id[len-1] == '\n') {
                 current_snapshot_id[len-1] = '\0';
             }
-            
+    
             // Check if we're restoring to a different snapshot than current
             if (strcmp(current_snapshot_id, snapshot_id) != 0) {
                 printf("Current state differs from target snapshot. Creating safety snapshot...\n");
-                
+    
                 // Create auto-snapshot of current state
-                char *snapshot_args[] = {"frac", "snapshot", NULL};
-                int snapshot_result = cmd_snapshot(2, snapshot_args);
+                snapshot_options_t safety;
+                memset(&safety, 0, sizeof(safety));
+                safety.lock_held = 1;
+                safety.index_out = &current_index;
+                int snapshot_result = snapshot_create(&safety);
                 if (snapshot_result != 0) {
                     printf("Warning: Failed to create safety snapshot. Proceeding with restore...\n");
                 } else {
                     printf("Safety snapshot created.\n");
+                    scanned = 1;
                 }
             }
         } else {
@@ -326,151 +294,69 @@ int cmd_restore(int argc, char **argv) {
     
     // Load the index from the snapshot's stored index hash
     index_t index;
-    void *index_data;
-    size_t index_size;
-    
-    // Load the index data from object storage
-    result = object_load(snapshot.index_hash, fractyl_dir, &index_data, &index_size);
+    result = object_load_index(snapshot.index_hash, fractyl_dir, &index);
     if (result != FRACTYL_OK) {
         printf("Error: Failed to load snapshot index: %d\n", result);
         free(repo_root);
+        free(git_branch);
         json_free_snapshot(&snapshot);
+        index_free(&current_index);
+        fractyl_lock_release(&lock);
         return 1;
     }
     
-    // Write to a temporary file to use index_load
-    char temp_path[] = "/tmp/fractyl_restore_index_XXXXXX";
-    int temp_fd = mkstemp(temp_path);
-    if (temp_fd == -1) {
-        printf("Error: Failed to create temporary file\n");
-        free(index_data);
-        free(repo_root);
-        json_free_snapshot(&snapshot);
-        return 1;
-    }
-    
-    if (write(temp_fd, index_data, index_size) != (ssize_t)index_size) {
-        close(temp_fd);
-        unlink(temp_path);
-        free(index_data);
-        free(repo_root);
-        json_free_snapshot(&snapshot);
-        return 1;
+    // Without a fresh scan, the current index on disk: its stat data tells
+    // which files are already up to date, and files only it has are removed
+    if (!scanned) {
+        char current_index_path[PATH_MAX];
+        snprintf(current_index_path, sizeof(current_index_path), "%s/index", fractyl_dir);
+        index_load(&current_index, current_index_path); // ignore errors, empty if none
     }
-    close(temp_fd);
-    free(index_data);
-    
-    // Load the index from temporary file
-    result = index_load(&index, temp_path);
-    unlink(temp_path);
     
+    // Rewrite only the files whose content differs from the snapshot
+    size_t unchanged = 0;
+    restore_stats_t restored;
+    result = restore_changed_files(&index, &current_index, repo_root, fractyl_dir, NULL, &unchanged, &restored);
     if (result != FRACTYL_OK) {
-        printf("Error: Failed to parse snapshot index: %d\n", result);
+        printf("Error: Failed to restore files: %d\n", result);
+        index_free(&current_index);
+        index_free(&index);
         free(repo_root);
+        free(git_branch);
         json_free_snapshot(&snapshot);
+        fractyl_lock_release(&lock);
         return 1;
     }
     
-    // Load the current index so we can remove files that do not exist
-    // in the snapshot being restored
-    index_t current_index;
-    index_init(&current_index);
-
-    char current_index_path[PATH_MAX];
-    snprintf(current_index_path, sizeof(current_index_path), "%s/index", fractyl_dir);
-    index_load(&current_index, current_index_path); // ignore errors, empty if none
-
-    // Restore each file from object storage
-    for (size_t i = 0; i < index.count; i++) {
-        const index_entry_t *entry = &index.entries[i];
-        if (!entry->path) continue;
-
-        char dest_path[PATH_MAX];
-        snprintf(dest_path, sizeof(dest_path), "%s/%s", repo_root, entry->path);
-
-        // Ensure parent directory exists
-        char *parent_dir = strdup(dest_path);
-        char *slash = strrchr(parent_dir, '/');
-        if (slash) {
-            *slash = '\0';
-            paths_ensure_directory(parent_dir);
-        }
-        free(parent_dir);
-
-        printf("Restoring %s...\n", entry->path);
-
-        result = object_restore_file(entry->hash, fractyl_dir, dest_path);
-        if (result != FRACTYL_OK) {
-            printf("Warning: Failed to restore %s: %d\n", entry->path, result);
-            continue;
-        }
-
-        // Set file permissions
-        if (chmod(dest_path, entry->mode) != 0) {
-            printf("Warning: Failed to set permissions for %s\n", dest_path);
-        }
-    }
-
     // Remove files that existed in the current index but not in the
     // restored snapshot
-    for (size_t i = 0; i < current_index.count; i++) {
-        const index_entry_t *cur = &current_index.entries[i];
-        if (!cur->path) continue;
-        if (index_find_entry(&index, cur->path)) {
-            continue; // still exists
-        }
-
-        char remove_path[PATH_MAX];
-        snprintf(remove_path, sizeof(remove_path), "%s/%s", repo_root, cur->path);
-
-        printf("Removing %s...\n", cur->path);
-        if (unlink(remove_path) != 0 && errno != ENOENT) {
-            printf("Warning: Failed to remove %s\n", remove_path);
-        }
-
-        // Attempt to remove empty parent directories up to repo root
-        char temp[PATH_MAX];
-        strncpy(temp, remove_path, sizeof(temp));
-        char *p = strrchr(temp, '/');
-        while (p && (size_t)(p - temp) > strlen(repo_root)) {
-            *p = '\0';
-            if (rmdir(temp) != 0) {
-                break; // stop if directory not empty or error
-            }
-            p = strrchr(temp, '/');
-        }
-    }
-
-    // Scan current directory and remove any files not in the restored snapshot
-    // This catches files that were created after the last snapshot and never indexed
-    index_t current_state;
-    index_init(&current_state);
+    restore_removal_t removal = { repo_root, "Removing", 1 };
+    index_diff(&current_index, &index, restore_remove_deleted, &removal, NULL);
+    index_free(&current_index);
     
-    // Build current state index (scan current directory)
-    result = scan_directory_parallel(repo_root, &current_state, NULL, fractyl_dir);
-    if (result == FRACTYL_OK) {
-        for (size_t i = 0; i < current_state.count; i++) {
-            const index_entry_t *cur = &current_state.entries[i];
-            if (!cur->path) continue;
-            
-            // If this file is not in the restored snapshot, remove it
-            if (!index_find_entry(&index, cur->path)) {
-                char remove_path[PATH_MAX];
-                snprintf(remove_path, sizeof(remove_path), "%s/%s", repo_root, cur->path);
-                
-                printf("Removing untracked file %s...\n", cur->path);
-                if (unlink(remove_path) != 0 && errno != ENOENT) {
-                    printf("Warning: Failed to remove %s\n", remove_path);
-                }
-            }
+    // A fresh scan saw every file; otherwise scan for files that were
+    // created after the last snapshot and never indexed
+    if (!scanned) {
+        index_t current_state;
+        index_init(&current_state);
+    
+        // Build current state index; the restored entries carry current stat
+        // data, so only untracked files are hashed
+        result = scan_directory_parallel(repo_root, &current_state, &index, fractyl_dir);
+        if (result == FRACTYL_OK && index_sort(&current_state, 1) == FRACTYL_OK) {
+            removal.verb = "Removing untracked file";
+            removal.prune_dirs = 0;
+            index_diff(&current_state, &index, restore_remove_deleted, &removal, NULL);
         }
+        index_free(&current_state);
     }
     
-    index_free(&current_state);
-
-    index_free(&current_index);
+    printf("Restored %zu files from snapshot %s (%zu already up to date)\n", restored.written, snapshot_id,
+           unchanged);
     
-    printf("Restored %zu files from snapshot %s\n", index.count, snapshot_id);
+    // Both stat caches now describe the restored files, so the next
+    // snapshot finds nothing to hash
+    refresh_binary_index(fractyl_dir, git_branch, &index);
     
     // Save the restored index as the current index
     char index_path[PATH_MAX];
@@ -481,21 +367,14 @@ int cmd_restore(int argc, char **argv) {
     }
     
     // Update CURRENT file to reflect the restored snapshot
-    char *update_current_path = paths_get_current_file(fractyl_dir, git_branch);
-    if (update_current_path) {
-        FILE *update_current_file = fopen(update_current_path, "w");
-        if (update_current_file) {
-            fprintf(update_current_file, "%s\n", snapshot_id);
-            fclose(update_current_file);
-        }
-        free(update_current_path);
-    }
+    paths_set_current(fractyl_dir, git_branch, snapshot_id);
     
     // Cleanup
     free(repo_root);
     free(git_branch);
     json_free_snapshot(&snapshot);
     index_free(&index);
+    fractyl_lock_release(&lock);
     
     return 0;
 }
\ No newline at end of file
@@ -4,9 +4,13 @@
 #include "../utils/paths.h"
 #include "../utils/git.h"
 #include "../utils/snapshots.h"
+#include "../utils/pathspec.h"
+#include "../utils/lock.h"
+#include "../utils/catalog.h"
 #include "../core/hash.h"
 #include "../core/objects.h"
 #include "../core/index.h"
+#include "../core/tree.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -55,51 +59,231 @@ static void print_snapshot_header(const snapshot_t *snapshot) {
         printf("Git: (not a git repository)\n");
     }
     
+    // What taking it cost, for snapshots that recorded it
+    const snapshot_stats_t *stats = &snapshot->stats;
+    if (stats->recorded) {
+        printf("Changed: %llu of %llu files, %llu bytes\n", stats->files_changed, stats->files,
+               stats->bytes_changed);
+        printf("Stored: %llu new objects, %llu bytes written, %llu bytes already stored\n",
+               stats->objects_written, stats->bytes_written, stats->bytes_deduplicated);
+        printf("Time: %llu ms (scan %llu, hash %llu, store %llu, trees %llu)\n", stats->total_ms,
+               stats->scan_ms, stats->hash_ms, stats->store_ms, stats->tree_ms);
+        for (size_t i = 0; i < stats->path_count; i++) {
+            printf("%s %-10llu %s\n", i == 0 ? "Largest changes:" : "                ",
+                   stats->path_sizes[i], stats->paths[i]);
+        }
+    }
+    
     printf("\n");
 }
 
-static int show_snapshot_files(const char *fractyl_dir, const snapshot_t *snapshot) {
+// How many of the largest files --summary lists
+#define SHOW_LARGEST_FILES 10
+
+typedef struct {
+    const char **pathspecs;     // Files shown match one of these; none: all
+    size_t pathspec_count;
+    size_t limit;               // Most files listed; 0 for no limit
+    int summary;                // Totals and the largest files instead of a listing
+    int json;                   // One JSON object per line
+    int metadata;               // The snapshot's metadata as a JSON document, no files
+    // Totals of the files shown
+    size_t files;
+    unsigned long long bytes;
+    struct {
+        char *path;
+        off_t size;
+    } largest[SHOW_LARGEST_FILES];
+    size_t largest_count;
+} show_files_t;
+
+static void print_json_string(const char *text) {
+    putchar('"');
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            printf("\\%c", *p);
+        } else if (*p < 0x20) {
+            printf("\\u%04x", *p);
+        } else {
+            putchar(*p);
+        }
+    }
+    putchar('"');
+}
+
+static void track_largest(show_files_t *show, const index_entry_t *entry) {
+    size_t count = show->largest_count;
+    if (count == SHOW_LARGEST_FILES && entry->size <= show->largest[count - 1].size) return;
+    
+    char *path = strdup(entry->path);
+    if (!path) return;
+    if (count == SHOW_LARGEST_FILES) {
+        free(show->largest[--count].path);
+    }
+    size_t i = count;
+    while (i > 0 && show->largest[i - 1].size < entry->size) {
+        show->largest[i] = show->largest[i - 1];
+        i--;
+    }
+    show->largest[i].path = path;
+    show->largest[i].size = entry->size;
+    show->largest_count = count + 1;
+}
+
+static int show_file(const index_entry_t *entry, void *ctx) {
+    show_files_t *show = ctx;
+    if (!pathspec_match_any(show->pathspecs, show->pathspec_count, entry->path)) return FRACTYL_OK;
+    
+    show->files++;
+    show->bytes += (unsigned long long)entry->size;
+    if (show->summary) {
+        track_largest(show, entry);
+        return FRACTYL_OK;
+    }
+    
+    char hex[FRACTYL_HASH_HEX_SIZE];
+    hash_to_string(entry->hash, hex);
+    if (show->json) {
+        printf("{\"path\":");
+        print_json_string(entry->path);
+        printf(",\"mode\":%u,\"size\":%lld,\"hash\":\"%s\"}\n", (unsigned int)entry->mode,
+               (long long)entry->size, hex);
+    } else {
+        printf("%-8o %-10lld %-12.12s %s\n", (unsigned int)entry->mode, (long long)entry->size, hex,
+               entry->path);
+    }
+    return show->limit > 0 && show->files >= show->limit ? TREE_FILES_STOP : FRACTYL_OK;
+}
+
+static void print_summary(const show_files_t *show) {
+    if (show->json) {
+        printf("{\"files\":%zu,\"bytes\":%llu,\"largest\":[", show->files, show->bytes);
+        for (size_t i = 0; i < show->largest_count; i++) {
+            printf("%s{\"path\":", i ? "," : "");
+            print_json_string(show->largest[i].path);
+            printf(",\"size\":%lld}", (long long)show->largest[i].size);
+        }
+        printf("]}\n");
+        return;
+    }
+    
+    printf("Files: %zu\n", show->files);
+    printf("Total size: %llu bytes\n", show->bytes);
+    if (show->largest_count > 0) {
+        printf("Largest files:\n");
+        for (size_t i = 0; i < show->largest_count; i++) {
+            printf("  %-10lld %s\n", (long long)show->largest[i].size, show->largest[i].path);
+        }
+    }
+}
+
+// List (or sum up) the snapshot's files, streaming them from its trees:
+// nothing is loaded beyond the directories the pathspecs lead into
+static int show_snapshot_files(const char *fractyl_dir, const snapshot_t *snapshot, show_files_t *show) {
     // Check if index object exists
     if (!object_exists(snapshot->index_hash, fractyl_dir)) {
         printf("Warning: Index object not found\n");
         return -1;
     }
     
-    // Load the index data
-    void *index_data;
-    size_t index_size;
-    int result = object_load(snapshot->index_hash, fractyl_dir, &index_data, &index_size);
-    if (result != 0) {
-        printf("Error: Could not load index for snapshot\n");
+    char *prefix = pathspec_prefix(show->pathspecs, show->pathspec_count);
+    if (!prefix) {
+        printf("Error: Out of memory\n");
         return -1;
     }
     
-    printf("Files in snapshot:\n");
-    printf("%-8s %-10s %-12s %s\n", "Mode", "Size", "Hash", "Path");
-    printf("%-8s %-10s %-12s %s\n", "--------", "----------", "------------", "----");
+    if (!show->summary && !show->json) {
+        printf("Files in snapshot:\n");
+        printf("%-8s %-10s %-12s %s\n", "Mode", "Size", "Hash", "Path");
+        printf("%-8s %-10s %-12s %s\n", "--------", "----------", "------------", "----");
+    }
     
-    // For a more complete implementation, we would parse the index format
-    // For now, just show summary information
-    printf("(Index contains %zu bytes of file metadata)\n", index_size);
-    printf("Total files tracked in this snapshot's index\n");
+    int result = tree_for_each_file(snapshot->index_hash, fractyl_dir, prefix, show_file, show);
+    free(prefix);
+    if (result != FRACTYL_OK) {
+        printf("Error: Could not load index for snapshot\n");
+    } else if (show->summary) {
+        print_summary(show);
+    } else if (!show->json) {
+        if (show->limit > 0 && show->files >= show->limit) {
+            printf("\nFirst %zu files shown (--limit)\n", show->files);
+        } else {
+            printf("\n%zu files, %llu bytes\n", show->files, show->bytes);
+        }
+    }
     
-    free(index_data);
-    return 0;
+    for (size_t i = 0; i < show->largest_count; i++) {
+        free(show->largest[i].path);
+    }
+    return result == FRACTYL_OK ? 0 : -1;
+}
+
+static void print_show_usage(void) {
+    printf("Usage: frac show <snapshot-id> [-n|--limit <count>] [--summary] [--json] [--metadata]\n");
+    printf("                 [--all-branches] [<pathspec>...]\n");
+    printf("Show detailed information about a snapshot\n");
+    printf("\nOptions:\n");
+    printf("  --all-branches       Look the snapshot up on every branch; -1 is the newest anywhere\n");
+    printf("  -n, --limit <count>  List at most <count> files\n");
+    printf("  --summary            File count, total size and the largest files\n");
+    printf("  --json               Files (or the summary) as one JSON object per line\n");
+    printf("  --metadata           The snapshot's metadata as a JSON document\n");
+    printf("\nPathspecs name files or directories, or are globs such as 'src/*.c'\n");
 }
 
 int cmd_show(int argc, char **argv) {
     if (argc < 3) {
-        printf("Usage: frac show <snapshot-id>\n");
-        printf("Show detailed information about a snapshot\n");
+        print_show_usage();
         return 1;
     }
     
-    const char *snapshot_id = argv[2];
+    // --all-branches may come first, as in 'frac show --all-branches -1'
+    int all_branches = strcmp(argv[2], "--all-branches") == 0;
+    if (all_branches && argc < 4) {
+        print_show_usage();
+        return 1;
+    }
+    const char *snapshot_id = argv[all_branches ? 3 : 2];
+    show_files_t show;
+    memset(&show, 0, sizeof(show));
+    const char **pathspecs = malloc(sizeof(char *) * (size_t)argc);
+    if (!pathspecs) {
+        printf("Error: Out of memory\n");
+        return 1;
+    }
+    show.pathspecs = pathspecs;
+    for (int i = all_branches ? 4 : 3; i < argc; i++) {
+        if ((strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--limit") == 0) && i + 1 < argc) {
+            char *end;
+            long value = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || value <= 0) {
+                printf("Error: Limit must be a positive number\n");
+                free(pathspecs);
+                return 1;
+            }
+            show.limit = (size_t)value;
+        } else if (strcmp(argv[i], "--summary") == 0) {
+            show.summary = 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            show.json = 1;
+        } else if (strcmp(argv[i], "--metadata") == 0) {
+            show.metadata = 1;
+        } else if (strcmp(argv[i], "--all-branches") == 0) {
+            all_branches = 1;
+        } else if (argv[i][0] == '-') {
+            print_show_usage();
+            free(pathspecs);
+            return 1;
+        } else {
+            pathspecs[show.pathspec_count++] = pathspec_normalize(argv[i]);
+        }
+    }
     
     // Find repository root
     char *repo_root = fractyl_find_repo_root(NULL);
     if (!repo_root) {
         printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        free(pathspecs);
         return 1;
     }
     
@@ -110,12 +294,20 @@ int cmd_show(int argc, char **argv) {
     char *current_branch = git_is_repository(repo_root) ? git_get_current_branch(repo_root) : NULL;
     
     // Resolve snapshot ID (supports short IDs, relative IDs like -1, etc.)
+    // With --all-branches, the snapshot's own branch is where it is read from
     char resolved_id[65];
-    int resolve_result = resolve_snapshot_id(snapshot_id, fractyl_dir, current_branch, resolved_id);
+    int resolve_result;
+    if (all_branches) {
+        free(current_branch);
+        resolve_result = resolve_snapshot_id_all_branches(snapshot_id, fractyl_dir, resolved_id, &current_branch);
+    } else {
+        resolve_result = resolve_snapshot_id(snapshot_id, fractyl_dir, current_branch, resolved_id);
+    }
     if (resolve_result != FRACTYL_OK) {
         printf("Error: Snapshot '%s' not found\n", snapshot_id);
         free(repo_root);
         free(current_branch);
+        free(pathspecs);
         return 1;
     }
     
@@ -125,44 +317,65 @@ int cmd_show(int argc, char **argv) {
         printf("Error: Could not determine snapshots directory\n");
         free(repo_root);
         free(current_branch);
+        free(pathspecs);
         return 1;
     }
     
-    // Build snapshot file path using resolved ID
-    char snapshot_path[2048];
-    snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s.json", snapshots_dir, resolved_id);
-    
-    // Check if snapshot exists
-    struct stat st;
-    if (stat(snapshot_path, &st) != 0) {
+    snapshot_t snapshot = {0};
+    int loaded = catalog_load_snapshot(snapshots_dir, resolved_id, &snapshot);
+    if (loaded == FRACTYL_ERROR_NOT_FOUND) {
         printf("Error: Snapshot '%s' not found\n", snapshot_id);
         free(repo_root);
         free(current_branch);
         free(snapshots_dir);
+        free(pathspecs);
         return 1;
     }
-    
-    // Load snapshot metadata using existing utility
-    snapshot_t snapshot = {0};
-    if (json_load_snapshot(&snapshot, snapshot_path) != 0) {
+    if (loaded != FRACTYL_OK) {
         printf("Error: Could not load snapshot metadata\n");
         free(repo_root);
         free(current_branch);
         free(snapshots_dir);
+        free(pathspecs);
         return 1;
     }
     
-    // Print snapshot information
-    print_snapshot_header(&snapshot);
+    // Snapshots are stored as records; JSON is made only when asked for
+    if (show.metadata) {
+        char *json = json_serialize_snapshot(&snapshot);
+        int ok = json != NULL;
+        if (ok) printf("%s\n", json);
+        else printf("Error: Could not format snapshot metadata\n");
+        free(json);
+        json_free_snapshot(&snapshot);
+        free(repo_root);
+        free(current_branch);
+        free(snapshots_dir);
+        free(pathspecs);
+        return ok ? 0 : 1;
+    }
+    
+    // Print snapshot information; JSON output is the files alone
+    if (!show.json) {
+        print_snapshot_header(&snapshot);
+    }
     
-    // Show files in snapshot
-    show_snapshot_files(fractyl_dir, &snapshot);
+    // Show files in snapshot; its objects must not be collected meanwhile
+    fractyl_lock_t lock;
+    int result = fractyl_lock_wait_acquire_shared(fractyl_dir, &lock, 30);
+    if (result != 0) {
+        printf("Error: Could not acquire lock to read the snapshot\n");
+    } else {
+        result = show_snapshot_files(fractyl_dir, &snapshot, &show);
+        fractyl_lock_release(&lock);
+    }
     
     // Cleanup
     json_free_snapshot(&snapshot);
     free(repo_root);
     free(current_branch);
     free(snapshots_dir);
+    free(pathspecs);
     
-    return 0;
+    return result == 0 ? 0 : 1;
 }
\ No newline at end of file
@@ -1,21 +1,28 @@
 #include "../include/commands.h"
 #include "../include/core.h"
 #include "../core/index.h"
+#include "../core/tree.h"
 #include "../core/objects.h"
 #include "../core/hash.h"
+#include "../core/changes.h"
 #include "../utils/json.h"
 #include "../utils/fs.h"
 #include "../utils/git.h"
 #include "../utils/paths.h"
+#include "../utils/catalog.h"
+#include "../utils/snapshot_table.h"
 #include "../utils/gitignore.h"
 #include "../utils/lock.h"
 #include "../utils/parallel_scan.h"
+#include "../utils/config.h"
+#include "../utils/profile.h"
+#include "../utils/counters.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <time.h>
 #ifdef HAVE_UUID
 #include <uuid/uuid.h>
@@ -32,39 +39,16 @@ static char* find_latest_snapshot(const char *fractyl_dir, const char *branch) {
         return NULL;
     }
     
-    DIR *d = opendir(snapshots_dir);
-    if (!d) {
-        free(snapshots_dir);
-        return NULL; // No snapshots directory or can't open
-    }
-    
-    char *latest_id = NULL;
-    time_t latest_timestamp = 0;
-    
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL) {
-        // Skip . and .. and non-.json files
-        if (entry->d_name[0] == '.' || !strstr(entry->d_name, ".json")) {
-            continue;
-        }
-        
-        // Load snapshot to get timestamp
-        char snapshot_path[2048];
-        snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", snapshots_dir, entry->d_name);
-        
-        snapshot_t snapshot;
-        if (json_load_snapshot(&snapshot, snapshot_path) == FRACTYL_OK) {
-            if (snapshot.timestamp > latest_timestamp) {
-                latest_timestamp = snapshot.timestamp;
-                free(latest_id); // Free previous candidate
-                latest_id = strdup(snapshot.id);
-            }
-            json_free_snapshot(&snapshot);
-        }
+    catalog_t catalog;
+    int result = catalog_load(snapshots_dir, &catalog);
+    free(snapshots_dir);
+    if (result != FRACTYL_OK) {
+        return NULL;
     }
     
-    closedir(d);
-    free(snapshots_dir);
+    const catalog_entry_t *latest = catalog_nth_newest(&catalog, 0);
+    char *latest_id = latest ? strdup(latest->id) : NULL;
+    catalog_free(&catalog);
     return latest_id; // Caller must free
 }
 
@@ -99,7 +83,8 @@ static char* get_current_snapshot_id(const char *fractyl_dir, const char *branch
     return strdup(current_id);
 }
 
-// Generate short hash from snapshot ID (first 6 characters)
+// Generate short hash from snapshot ID (last 6 characters: IDs start with
+// the time they were taken, so their ends are what tells them apart)
 static void generate_short_hash(const char *snapshot_id, char *short_hash, size_t max_len) {
     if (max_len == 0) return;
     
@@ -107,88 +92,74 @@ static void generate_short_hash(const char *snapshot_id, char *short_hash, size_
     if (copy_len >= max_len) {
         copy_len = max_len - 1;
     }
+    size_t id_len = strlen(snapshot_id);
+    if (copy_len > id_len) {
+        copy_len = id_len;
+    }
     
     // Use snprintf to safely copy and null-terminate
-    snprintf(short_hash, max_len, "%.*s", (int)copy_len, snapshot_id);
+    snprintf(short_hash, max_len, "%.*s", (int)copy_len, snapshot_id + id_len - copy_len);
 }
 
 // Check if we're creating a divergent branch
-static int is_divergent_branch(const char *fractyl_dir, const char *branch, const char *current_id, const char *latest_id) {
-    if (!current_id || !latest_id) {
-        return 0; // Not divergent if we don't have both IDs
+static int is_divergent_branch(const catalog_t *catalog, const catalog_entry_t *current,
+                               const catalog_entry_t *latest) {
+    if (!current || !latest) {
+        return 0; // Not divergent if we don't have both
     }
     
-    if (strcmp(current_id, latest_id) == 0) {
+    if (current == latest) {
         return 0; // Current is latest, not divergent
     }
     
-    // Load latest snapshot to check its parent
+    // Current is direct parent of latest, not divergent
+    return catalog_parent(catalog, latest) != current;
+}
+
+// Generate auto-description based on parent description +n format, with divergence detection
+static char* generate_auto_description(const char *fractyl_dir, const char *branch) {
     char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, branch);
     if (!snapshots_dir) {
-        return 0;
+        return strdup("working +1");
     }
     
-    char latest_path[2048];
-    snprintf(latest_path, sizeof(latest_path), "%s/%s.json", snapshots_dir, latest_id);
+    catalog_t catalog;
+    int load_result = catalog_load(snapshots_dir, &catalog);
     free(snapshots_dir);
-    
-    snapshot_t latest_snapshot;
-    if (json_load_snapshot(&latest_snapshot, latest_path) != FRACTYL_OK) {
-        return 0; // Can't determine, assume not divergent
-    }
-    
-    int is_divergent = 1;
-    if (latest_snapshot.parent && strcmp(latest_snapshot.parent, current_id) == 0) {
-        is_divergent = 0; // Current is direct parent of latest, not divergent
+    if (load_result != FRACTYL_OK) {
+        return strdup("working +1");
     }
     
-    json_free_snapshot(&latest_snapshot);
-    return is_divergent;
-}
-
-// Generate auto-description based on parent description +n format, with divergence detection
-static char* generate_auto_description(const char *fractyl_dir, const char *branch) {
-    char *latest_id = find_latest_snapshot(fractyl_dir, branch);
-    char *current_id = get_current_snapshot_id(fractyl_dir, branch);
-    
-    if (!latest_id) {
+    const catalog_entry_t *latest = catalog_nth_newest(&catalog, 0);
+    if (!latest) {
         // First snapshot
-        free(current_id);
+        catalog_free(&catalog);
         return strdup("working");
     }
     
-    // Check if this is a divergent branch
-    int divergent = is_divergent_branch(fractyl_dir, branch, current_id, latest_id);
-    
-    // Load the snapshot we're building from (current, not latest)
-    char *parent_id = current_id ? current_id : latest_id;
-    
-    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, branch);
-    if (!snapshots_dir) {
-        free(latest_id);
-        free(current_id);
-        return strdup("working +1");
-    }
+    char *current_id = get_current_snapshot_id(fractyl_dir, branch);
+    const catalog_entry_t *current = current_id ? catalog_find(&catalog, current_id) : NULL;
     
-    char parent_path[2048];
-    snprintf(parent_path, sizeof(parent_path), "%s/%s.json", snapshots_dir, parent_id);
-    free(snapshots_dir);
+    // Check if this is a divergent branch
+    int divergent = is_divergent_branch(&catalog, current, latest);
     
-    snapshot_t parent_snapshot;
-    if (json_load_snapshot(&parent_snapshot, parent_path) != FRACTYL_OK) {
-        free(latest_id);
+    // The snapshot we're building from (current, not latest)
+    const catalog_entry_t *parent = current_id ? current : latest;
+    if (!parent) {
         free(current_id);
+        catalog_free(&catalog);
         return strdup("working +1");
     }
     
-    const char *parent_desc = parent_snapshot.description ? parent_snapshot.description : "working";
+    const char *parent_desc = catalog_description(&catalog, parent);
+    if (!parent_desc) parent_desc = "working";
     char *result = NULL;
     
-    if (divergent && current_id) {
+    if (divergent) {
         // This is a divergent branch - use short hash suffix
         char short_hash[8];
         generate_short_hash(current_id, short_hash, sizeof(short_hash));
-        
+    
         // Extract base description (remove any existing +n suffix)
         char base_desc[256];
         char *plus_pos = strrchr(parent_desc, '+');
@@ -207,7 +178,7 @@ static char* generate_auto_description(const char *fractyl_dir, const char *bran
             strncpy(base_desc, parent_desc, sizeof(base_desc) - 1);
             base_desc[sizeof(base_desc) - 1] = '\0';
         }
-        
+    
         // Create divergent branch name: "base-hash"
         result = malloc(strlen(base_desc) + strlen(short_hash) + 2);
         snprintf(result, strlen(base_desc) + strlen(short_hash) + 2, "%s-%s", base_desc, short_hash);
@@ -223,19 +194,19 @@ static char* generate_auto_description(const char *fractyl_dir, const char *bran
             }
             strncpy(base_desc, parent_desc, base_len);
             base_desc[base_len] = '\0';
-            
+    
             // Trim trailing whitespace
             while (base_len > 0 && base_desc[base_len - 1] == ' ') {
                 base_desc[--base_len] = '\0';
             }
-            
+    
             int current_num = atoi(plus_pos + 1);
             if (current_num > 0) {
                 result = malloc(strlen(base_desc) + 20);
                 snprintf(result, strlen(base_desc) + 20, "%s +%d", base_desc, current_num + 1);
             }
         }
-        
+    
         if (!result) {
             // Parent doesn't follow +n pattern, so start with +1
             result = malloc(strlen(parent_desc) + 5);
@@ -243,79 +214,355 @@ static char* generate_auto_description(const char *fractyl_dir, const char *bran
         }
     }
     
-    free(latest_id);
     free(current_id);
-    json_free_snapshot(&parent_snapshot);
+    catalog_free(&catalog);
     return result;
 }
 
+// New snapshot IDs are UUIDv7: 48 bits of Unix time in milliseconds, then
+// a 12-bit sequence and random bits. Their text sorts in the order they were
+// taken, so id order and time order agree. Older, fully random IDs still
+// work everywhere; nothing relies on the order of an ID.
 static char* generate_snapshot_id(void) {
-#ifdef HAVE_UUID
-    uuid_t uuid;
-    uuid_generate(uuid);
+    static uint64_t last_ms = 0;
+    static uint16_t sequence = 0;
     
-    char *uuid_str = malloc(37); // 36 chars + null terminator
-    if (!uuid_str) return NULL;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t ms = (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
     
-    uuid_unparse(uuid, uuid_str);
-    return uuid_str;
+    unsigned char bytes[16];
+#ifdef HAVE_UUID
+    uuid_generate_random(bytes);
 #else
-    // Fallback: use timestamp + random number
-    char *id_str = malloc(64);
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0 || read(fd, bytes, sizeof(bytes)) != (ssize_t)sizeof(bytes)) {
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = (unsigned char)rand();
+        }
+    }
+    if (fd >= 0) close(fd);
+#endif
+    
+    // Within a millisecond, or if the clock went back, count up from the
+    // last ID so IDs from this process keep their order
+    if (ms <= last_ms) {
+        if (sequence < 0xfff) {
+            sequence++;
+        } else {
+            last_ms++;
+            sequence = 0;
+        }
+        ms = last_ms;
+    } else {
+        last_ms = ms;
+        sequence = (uint16_t)(((bytes[6] << 8) | bytes[7]) & 0x7ff); // Room to count up
+    }
+    
+    for (int i = 0; i < 6; i++) {
+        bytes[i] = (unsigned char)(ms >> (40 - 8 * i));
+    }
+    bytes[6] = (unsigned char)(0x70 | (sequence >> 8));
+    bytes[7] = (unsigned char)sequence;
+    bytes[8] = (unsigned char)(0x80 | (bytes[8] & 0x3f));
+    
+    char *id_str = malloc(37); // 36 chars + null terminator
     if (!id_str) return NULL;
     
-    snprintf(id_str, 64, "%ld-%d", time(NULL), rand() % 10000);
+    snprintf(id_str, 37, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+             bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5], bytes[6], bytes[7],
+             bytes[8], bytes[9], bytes[10], bytes[11], bytes[12], bytes[13], bytes[14], bytes[15]);
     return id_str;
-#endif
 }
 
-// Load index from snapshot's stored index hash
-static int load_snapshot_index(const unsigned char *index_hash, const char *fractyl_dir, index_t *index) {
-    void *index_data;
-    size_t index_size;
-    
-    // Load the index data from object storage
-    int result = object_load(index_hash, fractyl_dir, &index_data, &index_size);
-    if (result != FRACTYL_OK) {
-        return result;
+// Count an added or modified file into stats, keeping the largest ones.
+// Their paths are borrowed from entry until the snapshot copies them.
+static void tally_change(snapshot_stats_t *stats, const index_entry_t *entry) {
+    unsigned long long size = entry->size > 0 ? (unsigned long long)entry->size : 0;
+    stats->files_changed++;
+    stats->bytes_changed += size;
+    
+    size_t i = stats->path_count;
+    if (i == SNAPSHOT_STATS_PATHS) {
+        if (size <= stats->path_sizes[i - 1]) return;
+        i--;
+    } else {
+        stats->path_count++;
     }
-    
-    // Write to a temporary file to use index_load
-    char temp_path[] = "/tmp/fractyl_index_XXXXXX";
-    int temp_fd = mkstemp(temp_path);
-    if (temp_fd == -1) {
-        free(index_data);
-        return FRACTYL_ERROR_IO;
+    for (; i > 0 && stats->path_sizes[i - 1] < size; i--) {
+        stats->paths[i] = stats->paths[i - 1];
+        stats->path_sizes[i] = stats->path_sizes[i - 1];
     }
-    
-    if (write(temp_fd, index_data, index_size) != (ssize_t)index_size) {
-        close(temp_fd);
-        unlink(temp_path);
-        free(index_data);
-        return FRACTYL_ERROR_IO;
+    stats->paths[i] = entry->path;
+    stats->path_sizes[i] = size;
+}
+
+static unsigned long long elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)((now.tv_sec - since->tv_sec) * 1000LL +
+                                (now.tv_nsec - since->tv_nsec) / 1000000);
+}
+
+// Print a change; with stats for ctx, also count it into them
+static int print_change(index_change_t change, const index_entry_t *old_entry,
+                        const index_entry_t *new_entry, void *ctx) {
+    if (new_entry && ctx) {
+        tally_change(ctx, new_entry);
+    }
+    const char *tag = change == INDEX_CHANGE_ADDED ? "A" : change == INDEX_CHANGE_MODIFIED ? "M" : "D";
+    printf("%s %s\n", tag, new_entry ? new_entry->path : old_entry->path);
+    return 0;
+}
+
+// Point the paths of cost, borrowed from a change list, at the same paths
+// in index, which outlives the list
+static void borrow_index_paths(snapshot_stats_t *cost, const index_t *index) {
+    size_t kept = 0;
+    for (size_t i = 0; i < cost->path_count; i++) {
+        const index_entry_t *entry = index_find_entry(index, cost->paths[i]);
+        if (!entry) continue;
+        cost->paths[kept] = entry->path;
+        cost->path_sizes[kept++] = cost->path_sizes[i];
+    }
+    cost->path_count = kept;
+}
+
+// Print the changes since the last snapshot, moved files as one line,
+// and count them into cost and changes
+static void print_changes(const change_list_t *list, snapshot_stats_t *cost, index_diff_stats_t *changes) {
+    for (size_t i = 0; i < list->count; i++) {
+        const change_t *item = &list->items[i];
+        switch (item->kind) {
+            case CHANGE_ADDED: changes->added++; break;
+            case CHANGE_MODIFIED:
+            case CHANGE_MODE: changes->modified++; break;
+            case CHANGE_DELETED: changes->deleted++; break;
+            default: break;
+        }
+        if (item->kind != CHANGE_DELETED) {
+            tally_change(cost, &item->new_entry);
+        }
+        if (item->kind == CHANGE_RENAMED || item->kind == CHANGE_COPIED) {
+            printf("%s %s -> %s\n", change_kind_tag(item->kind), item->old_entry.path, item->new_entry.path);
+        } else {
+            printf("%s %s\n", change_kind_tag(item->kind),
+                   item->kind == CHANGE_DELETED ? item->old_entry.path : item->new_entry.path);
+        }
+    }
+}
+
+// Take the stat data of the current index (.fractyl/index) for entries
+// of index with the same content
+static void adopt_current_stat(const char *fractyl_dir, index_t *index) {
+    char index_path[2048];
+    snprintf(index_path, sizeof(index_path), "%s/index", fractyl_dir);
+    index_t current;
+    index_init(&current);
+    if (index_load(&current, index_path) == FRACTYL_OK) {
+        index_adopt_stat(index, &current);
+    }
+    index_free(&current);
+}
+
+// Nonzero if an entry of index has other stat data than in prev, or is
+// racily clean there and no longer is. Both are sorted by path.
+static int stat_data_changed(const index_t *prev, const index_t *index) {
+    if (!prev) return 0;
+    size_t j = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        const index_entry_t *entry = &index->entries[i];
+        while (j < prev->count && strcmp(prev->entries[j].path, entry->path) < 0) j++;
+        if (j >= prev->count || strcmp(prev->entries[j].path, entry->path) != 0) return 1;
+        const index_entry_t *old = &prev->entries[j];
+        if (old->size != entry->size || old->mtime != entry->mtime ||
+            old->mtime_nsec != entry->mtime_nsec || old->ctime != entry->ctime ||
+            old->ctime_nsec != entry->ctime_nsec || old->ino != entry->ino || old->dev != entry->dev ||
+            old->uid != entry->uid || old->gid != entry->gid || old->mode != entry->mode ||
+            (old->flags & INDEX_ENTRY_RACY) != (entry->flags & INDEX_ENTRY_RACY)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Give the scanned index to a caller that asked for it, else free it.
+// A warm caller keeps it as the contents of snapshot_id, whose tree is
+// root.
+static void hand_over_index(const snapshot_options_t *opts, index_t *index, const char *snapshot_id,
+                            const unsigned char *root) {
+    snapshot_warm_t *warm = opts ? opts->warm : NULL;
+    if (warm && snapshot_id) {
+        if (warm->valid) index_free(&warm->index);
+        warm->index = *index;
+        snprintf(warm->snapshot_id, sizeof(warm->snapshot_id), "%s", snapshot_id);
+        memcpy(warm->root, root, sizeof(warm->root));
+        warm->valid = 1;
+    } else if (opts && opts->index_out) {
+        *opts->index_out = *index;
+    } else {
+        index_free(index);
+    }
+}
+
+// Rules compiled before may be stale once an ignore file, or a directory
+// that may hold one, changed
+static int ignore_rules_may_change(const char *repo_root, const char *const *paths, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const char *name = strrchr(paths[i], '/');
+        name = name ? name + 1 : paths[i];
+        if (strcmp(name, ".gitignore") == 0 || strcmp(name, ".fractylignore") == 0) return 1;
+    
+        char full_path[2048];
+        struct stat st;
+        snprintf(full_path, sizeof(full_path), "%s/%s", repo_root, paths[i]);
+        if (lstat(full_path, &st) == 0 && S_ISDIR(st.st_mode)) return 1;
+    }
+    return 0;
+}
+
+static snapshot_warm_t *command_warm;
+
+void snapshot_command_warm(snapshot_warm_t *warm) {
+    command_warm = warm;
+}
+
+void snapshot_warm_free(snapshot_warm_t *warm) {
+    if (!warm) return;
+    if (warm->valid) index_free(&warm->index);
+    ignore_engine_free(warm->ignore);
+    memset(warm, 0, sizeof(*warm));
+}
+
+// Turn a path given after "--", absolute or relative to the current
+// directory (cwd_prefix inside the repository), into the repo-relative
+// form index paths have, "" for the root. NULL when it is outside the
+// repository or a glob; the caller frees the result.
+static char* scoped_path(const char *repo_root, const char *cwd_prefix, const char *arg) {
+    if (strpbrk(arg, "*?[")) return NULL;
+    char joined[PATH_MAX];
+    size_t root_len = strlen(repo_root);
+    if (arg[0] == '/') {
+        if (strncmp(arg, repo_root, root_len) != 0 || (arg[root_len] != '\0' && arg[root_len] != '/')) {
+            return NULL;
+        }
+        snprintf(joined, sizeof(joined), "%s", arg + root_len);
+    } else if (snprintf(joined, sizeof(joined), "%s/%s", cwd_prefix, arg) >= (int)sizeof(joined)) {
+        return NULL;
     }
-    close(temp_fd);
-    free(index_data);
-    
-    // Load the index from temporary file
-    result = index_load(index, temp_path);
-    unlink(temp_path);
     
-    return result;
+    // Resolve ".", ".." and repeated slashes one component at a time
+    char *path = malloc(strlen(joined) + 1);
+    if (!path) return NULL;
+    size_t len = 0;
+    char *save = NULL;
+    for (char *part = strtok_r(joined, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        if (strcmp(part, ".") == 0) continue;
+        if (strcmp(part, "..") == 0) {
+            if (len == 0) {
+                free(path);
+                return NULL;
+            }
+            while (len > 0 && path[len - 1] != '/') len--;
+            if (len > 0) len--;
+            continue;
+        }
+        if (len > 0) path[len++] = '/';
+        size_t part_len = strlen(part);
+        memcpy(path + len, part, part_len);
+        len += part_len;
+    }
+    path[len] = '\0';
+    return path;
+}
+
+// Nonzero if index has a file at path or below it
+static int index_knows_path(const index_t *index, const char *path) {
+    if (index_find_entry(index, path)) return 1;
+    size_t len = strlen(path);
+    for (size_t i = 0; i < index->count; i++) {
+        const char *entry_path = index->entries[i].path;
+        if (strncmp(entry_path, path, len) == 0 && entry_path[len] == '/') return 1;
+    }
+    return 0;
+}
+
+static void free_paths(char **paths, size_t count) {
+    for (size_t i = 0; paths && i < count; i++) free(paths[i]);
+    free(paths);
 }
 
 int cmd_snapshot(int argc, char **argv) {
-    const char *message = NULL;
-    char *auto_message = NULL;
+    snapshot_options_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.warm = command_warm;
+    char **paths = NULL;
+    size_t path_count = 0;
     
     // Parse arguments
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
-            message = argv[i + 1];
+            opts.message = argv[i + 1];
             i++; // Skip next argument
+        } else if (strcmp(argv[i], "--scan-engine") == 0 && i + 1 < argc) {
+            opts.scan_engine = argv[i + 1];
+            i++;
+        } else if (strncmp(argv[i], "--scan-engine=", 14) == 0) {
+            opts.scan_engine = argv[i] + 14;
+        } else if (strcmp(argv[i], "--") == 0) {
+            // Only these paths are rescanned; the repository root is the whole tree
+            size_t count = (size_t)(argc - i - 1);
+            if (count == 0) {
+                printf("Error: No paths given after '--'\n");
+                return 1;
+            }
+            char *repo_root = fractyl_find_repo_root(NULL);
+            char cwd[PATH_MAX];
+            if (!repo_root || !getcwd(cwd, sizeof(cwd))) {
+                printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+                free(repo_root);
+                return 1;
+            }
+            size_t root_len = strlen(repo_root);
+            const char *cwd_prefix = strncmp(cwd, repo_root, root_len) == 0 && cwd[root_len] == '/'
+                                     ? cwd + root_len + 1 : "";
+            paths = calloc(count, sizeof(char *));
+            int whole_tree = 0;
+            for (size_t k = 0; paths && k < count; k++, path_count++) {
+                const char *arg = argv[i + 1 + k];
+                if (!(paths[k] = scoped_path(repo_root, cwd_prefix, arg))) {
+                    printf("Error: '%s' is not a file or directory path inside the repository\n", arg);
+                    free(repo_root);
+                    free_paths(paths, path_count);
+                    return 1;
+                }
+                if (paths[k][0] == '\0') whole_tree = 1;
+            }
+            free(repo_root);
+            if (!paths) {
+                printf("Error: Out of memory\n");
+                return 1;
+            }
+            if (!whole_tree) {
+                opts.changed_paths = (const char *const *)paths;
+                opts.changed_count = count;
+                opts.strict_paths = 1;
+            }
+            break;
         }
     }
     
+    int result = snapshot_create(&opts);
+    free_paths(paths, path_count);
+    return result;
+}
+
+int snapshot_create(const snapshot_options_t *opts) {
+    const char *message = opts ? opts->message : NULL;
+    char *auto_message = NULL;
+    snapshot_warm_t *warm = opts ? opts->warm : NULL;
+    if (opts && opts->index_out) index_init(opts->index_out);
+    
     // Find repository root
     char *repo_root = fractyl_find_repo_root(NULL);
     if (!repo_root) {
@@ -326,14 +573,40 @@ int cmd_snapshot(int argc, char **argv) {
     char fractyl_dir[2048];
     snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
     
-    // Acquire exclusive lock for snapshot operation
-    fractyl_lock_t lock;
-    if (fractyl_lock_wait_acquire(fractyl_dir, &lock, 30) != 0) {
+    // Pick the scan engine: command line, then config, then the parallel default
+    char engine_name[64];
+    const char *requested_engine = opts ? opts->scan_engine : NULL;
+    if (!requested_engine &&
+        config_get(fractyl_dir, "scan.engine", engine_name, sizeof(engine_name)) == FRACTYL_OK) {
+        requested_engine = engine_name;
+    }
+    scan_engine_t engine = SCAN_ENGINE_PARALLEL;
+    if (requested_engine && scan_engine_parse(requested_engine, &engine) != FRACTYL_OK) {
+        printf("Error: Unknown scan engine '%s' (expected auto, parallel, cached, binary or stat-only)\n",
+               requested_engine);
+        free(repo_root);
+        return 1;
+    }
+    long full_interval = config_get_long(fractyl_dir, "scan.full_interval", SCAN_AUTO_FULL_INTERVAL);
+    
+    // Scanning and storing objects is shared with readers and other
+    // snapshots; gc, delete and prune wait. Moving the branch takes the
+    // publish lock below.
+    fractyl_lock_t lock, publish;
+    int take_lock = !(opts && opts->lock_held);
+    if (take_lock && fractyl_lock_wait_acquire_shared(fractyl_dir, &lock, 30) != 0) {
         printf("Error: Could not acquire lock for snapshot operation\n");
         free(repo_root);
         return 1;
     }
     
+    // What this snapshot costs is measured from here
+    struct timespec started, phase_start;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    object_stats_reset();
+    snapshot_stats_t cost;
+    memset(&cost, 0, sizeof(cost));
+    
     // Get current git branch
     char *git_branch = paths_get_current_branch(repo_root);
     
@@ -355,21 +628,35 @@ int cmd_snapshot(int argc, char **argv) {
     char *current_snapshot_id = get_current_snapshot_id(fractyl_dir, git_branch);
     index_t prev_index;
     index_t *prev_index_ptr = NULL;
-    
-    if (current_snapshot_id) {
+    unsigned char prev_root[32];
+    char prev_id[64] = "";
+    
+    if (current_snapshot_id && warm && warm->valid && strcmp(warm->snapshot_id, current_snapshot_id) == 0) {
+        // Still the snapshot the caller's last one left: its index, with
+        // current stat data, is at hand
+        prev_index = warm->index;
+        prev_index_ptr = &prev_index;
+        memcpy(prev_root, warm->root, sizeof(prev_root));
+        snprintf(prev_id, sizeof(prev_id), "%s", current_snapshot_id);
+        warm->valid = 0;
+        free(current_snapshot_id);
+    } else if (current_snapshot_id) {
         // Load the current snapshot to get its index hash
         char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, git_branch);
         if (snapshots_dir) {
-            char current_snapshot_path[2048];
-            snprintf(current_snapshot_path, sizeof(current_snapshot_path), "%s/%s.json", snapshots_dir, current_snapshot_id);
-            free(snapshots_dir);
-            
             snapshot_t current_snapshot;
-            if (json_load_snapshot(&current_snapshot, current_snapshot_path) == FRACTYL_OK) {
+            int loaded = catalog_load_snapshot(snapshots_dir, current_snapshot_id, &current_snapshot);
+            free(snapshots_dir);
+            if (loaded == FRACTYL_OK) {
                 // Load the index from the snapshot's index hash
-                if (load_snapshot_index(current_snapshot.index_hash, fractyl_dir, &prev_index) == FRACTYL_OK) {
+                if (object_load_index(current_snapshot.index_hash, fractyl_dir, &prev_index) == FRACTYL_OK) {
                     prev_index_ptr = &prev_index;
-                    // Comparing against snapshot for changes
+                    memcpy(prev_root, current_snapshot.index_hash, sizeof(prev_root));
+                    snprintf(prev_id, sizeof(prev_id), "%s", current_snapshot_id);
+                    // Comparing against snapshot for changes, with the stat
+                    // data of the current index where it knows the same
+                    // content (a restore rewrote the files since)
+                    adopt_current_stat(fractyl_dir, &prev_index);
                 }
                 json_free_snapshot(&current_snapshot);
             }
@@ -377,14 +664,114 @@ int cmd_snapshot(int argc, char **argv) {
         free(current_snapshot_id);
     }
     
+    // A path given on the command line that matches nothing is a mistake,
+    // not a change: it would be left out without a word
+    for (size_t i = 0; opts && opts->strict_paths && i < opts->changed_count; i++) {
+        char full_path[2048];
+        struct stat st;
+        snprintf(full_path, sizeof(full_path), "%s/%s", repo_root, opts->changed_paths[i]);
+        if (lstat(full_path, &st) == 0 ||
+            (prev_index_ptr && index_knows_path(prev_index_ptr, opts->changed_paths[i]))) {
+            continue;
+        }
+        printf("Error: '%s' is neither in the working tree nor in the last snapshot\n", opts->changed_paths[i]);
+        if (auto_message) free(auto_message);
+        free(repo_root);
+        free(git_branch);
+        if (prev_index_ptr) index_free(&prev_index);
+        if (take_lock) fractyl_lock_release(&lock);
+        return 1;
+    }
+    
+    // Nothing changed is the common case, above all for the daemon. A walk
+    // that only compares stat data with the previous index settles it
+    // before a new index is built or any tree stored and compared.
+    if (prev_index_ptr && !(opts && opts->changed_paths) && !scan_journal_exists(fractyl_dir)) {
+        unsigned long long check_started = profile_begin();
+        int unchanged = scan_tree_unchanged(repo_root, prev_index_ptr);
+        profile_end(PROFILE_SNAPSHOT_SCAN, check_started);
+        if (unchanged) {
+            counters_add(COUNTER_SCANS, 1);
+            printf("No changes detected since last snapshot\n");
+            if (auto_message) free(auto_message);
+            free(repo_root);
+            free(git_branch);
+            // Its stat data was just found current
+            hand_over_index(opts, &prev_index, prev_id, prev_root);
+            if (take_lock) fractyl_lock_release(&lock);
+            return 0;
+        }
+    }
+    
     // Scan current directory and build new index
     index_t new_index;
     index_init(&new_index);
     
     // Scanning directory for changes
     
-    // Use parallel scanning for reliable change detection
-    int result = scan_directory_parallel(repo_root, &new_index, prev_index_ptr, fractyl_dir);
+    int result;
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
+    unsigned long long profile_started = profile_begin();
+    if (opts && opts->changed_paths && !prev_index_ptr) {
+        printf("No snapshot on this branch to carry other files over from: scanning everything\n");
+    }
+    if (opts && opts->changed_paths && prev_index_ptr) {
+        // The caller knows exactly what changed; carry the rest over
+        if (warm && warm->ignore && ignore_rules_may_change(repo_root, opts->changed_paths, opts->changed_count)) {
+            ignore_engine_free(warm->ignore);
+            warm->ignore = NULL;
+        }
+        if (warm && !warm->ignore) warm->ignore = ignore_engine_create(repo_root);
+        result = scan_paths_incremental(repo_root, &new_index, prev_index_ptr, fractyl_dir,
+                                        opts->changed_paths, opts->changed_count, warm ? warm->ignore : NULL);
+    } else {
+        // Files an interrupted snapshot already stored count as known, so
+        // only what it did not get to is read again; the comparison below
+        // still runs against the previous snapshot
+        index_t resume_index;
+        index_init(&resume_index);
+        size_t resumed = scan_journal_load(fractyl_dir, &resume_index);
+        const index_t *scan_prev = prev_index_ptr;
+    
+        // A branch without snapshots, as after a checkout, verifies files
+        // by stat against the last snapshot of any branch (.fractyl/index):
+        // most of the content is the same and already stored
+        index_t branch_cache;
+        index_init(&branch_cache);
+        if (!scan_prev) {
+            char index_path[2048];
+            snprintf(index_path, sizeof(index_path), "%s/index", fractyl_dir);
+            if (index_load(&branch_cache, index_path) == FRACTYL_OK && branch_cache.count > 0) {
+                scan_prev = &branch_cache;
+                printf("First snapshot on this branch: checking %zu files against the last snapshot's stat data\n",
+                       branch_cache.count);
+            }
+        }
+    
+        if (resumed > 0) {
+            for (size_t i = 0; scan_prev && i < scan_prev->count; i++) {
+                if (!index_find_entry(&resume_index, scan_prev->entries[i].path)) {
+                    index_add_entry(&resume_index, &scan_prev->entries[i]);
+                }
+            }
+            scan_prev = &resume_index;
+            // Only the parallel engine walks everything the journal skips
+            if (engine == SCAN_ENGINE_AUTO) engine = SCAN_ENGINE_PARALLEL;
+            printf("Resuming an interrupted snapshot: %zu files already stored\n", resumed);
+        }
+    
+        scan_journal_t *journal = scan_journal_open(fractyl_dir);
+        scan_set_journal(journal);
+        result = scan_directory_engine(engine, repo_root, &new_index, scan_prev, fractyl_dir,
+                                       git_branch, full_interval);
+        scan_set_journal(NULL);
+        scan_journal_close(journal);
+        index_free(&resume_index);
+        index_free(&branch_cache);
+    }
+    cost.scan_ms = elapsed_ms(&phase_start);
+    profile_end(PROFILE_SNAPSHOT_SCAN, profile_started);
+    counters_add(COUNTER_SCANS, 1);
     if (result != FRACTYL_OK) {
         printf("Error: Failed to scan directory: %d\n", result);
         if (auto_message) free(auto_message);
@@ -392,143 +779,153 @@ int cmd_snapshot(int argc, char **argv) {
         free(git_branch);
         if (prev_index_ptr) index_free(&prev_index);
         index_free(&new_index);
-        fractyl_lock_release(&lock);
+        if (take_lock) fractyl_lock_release(&lock);
         return 1;
     }
     
-    // Found files, checking for changes
-    
-    // Check if there are any actual changes
-    // Use optimized change detection to avoid O(n²) complexity
-    int changes_detected = 0;
+    // Snapshot indexes are kept in path order, which makes comparing them
+    // a single merge pass
+    if (!index_is_sorted(&new_index)) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        index_sort(&new_index, cpus > 0 ? (int)cpus : 1);
+    }
     
-    if (!prev_index_ptr) {
-        // No previous index - all files are new
-        changes_detected = new_index.count;
-    } else if (new_index.count != prev_index.count) {
-        // Different file counts - definitely changes
-        changes_detected = 1;
-        // File count changed
+    // Store the index as one tree per directory; unchanged directories are
+    // the trees the parent snapshot already stored
+    unsigned char root[32];
+    clock_gettime(CLOCK_MONOTONIC, &phase_start);
+    profile_started = profile_begin();
+    if (opts && opts->changed_paths && prev_index_ptr) {
+        // Directories away from the rescanned paths are the parent's trees
+        result = tree_store_index_scoped(&new_index, fractyl_dir, prev_root, opts->changed_paths,
+                                         opts->changed_count, root);
     } else {
-        // Same file count - do optimized comparison
-        // Since both indexes should be sorted the same way from scanning,
-        // we can do a direct comparison without expensive lookups
-        // Comparing files for changes
-        
-        for (size_t i = 0; i < new_index.count && changes_detected < 10; i++) {
-            const index_entry_t *new_entry = &new_index.entries[i];
-            const index_entry_t *prev_entry = &prev_index.entries[i];
-            
-            // Check if path changed (files reordered) or content changed
-            if (strcmp(new_entry->path, prev_entry->path) != 0 || 
-                memcmp(new_entry->hash, prev_entry->hash, 32) != 0) {
-                changes_detected++;
-                if (strcmp(new_entry->path, prev_entry->path) != 0) {
-                    // Files reordered
-                    // If files are reordered, fall back to careful comparison
-                    changes_detected = -1; // Signal to use fallback method
-                    break;
-                } else {
-                    // Modified file detected
-                }
-            }
+        result = tree_store_index(&new_index, fractyl_dir, root);
+    }
+    cost.tree_ms = elapsed_ms(&phase_start);
+    profile_end(PROFILE_SNAPSHOT_TREE, profile_started);
+    if (result != FRACTYL_OK) {
+        printf("Error: Failed to store index in object storage: %d\n", result);
+        if (auto_message) free(auto_message);
+        free(repo_root);
+        free(git_branch);
+        if (prev_index_ptr) index_free(&prev_index);
+        index_free(&new_index);
+        if (take_lock) fractyl_lock_release(&lock);
+        return 1;
+    }
+    
+    index_diff_stats_t changes;
+    memset(&changes, 0, sizeof(changes));
+    size_t renamed = 0, copied = 0;
+    if (prev_index_ptr) {
+        // Show clean summary of changes, with moved files as one line.
+        // Walking the trees skips every directory nothing changed in; the
+        // indexes are merged instead if that fails.
+        change_list_t list;
+        change_list_init(&list);
+        int diffed = change_list_from_trees(&list, prev_root, root, fractyl_dir);
+        if (diffed != FRACTYL_OK) {
+            change_list_free(&list);
+            diffed = change_list_from_indexes(&list, prev_index_ptr, &new_index);
         }
-        
-        // Fallback method if files are reordered or for verification
-        if (changes_detected == -1) {
-            // Files reordered - using smart sampling
-            changes_detected = 0;
-            
-            // Smart sampling approach: check every Nth file to detect if there are changes
-            // If we find no changes in a good sample, assume no changes exist
-            size_t sample_size = (new_index.count < 1000) ? new_index.count : 1000;
-            size_t step = new_index.count / sample_size;
-            if (step < 1) step = 1;
-            
-            // Sampling files for changes
-            
-            for (size_t i = 0; i < new_index.count && changes_detected < 10; i += step) {
-                const index_entry_t *new_entry = &new_index.entries[i];
-                const index_entry_t *prev_entry = index_find_entry(prev_index_ptr, new_entry->path);
-                
-                if (!prev_entry || memcmp(new_entry->hash, prev_entry->hash, 32) != 0) {
-                    changes_detected++;
-                    if (!prev_entry) {
-                        // Added file detected
-                    } else {
-                        // Modified file detected
-                    }
-                }
-            }
-            
-            // Sampling complete
+        if (diffed == FRACTYL_OK) {
+            change_list_pair_renames(&list, fractyl_dir, NULL);
+            print_changes(&list, &cost, &changes);
+            borrow_index_paths(&cost, &new_index);
+            renamed = list.renamed;
+            copied = list.copied;
+        } else {
+            index_diff(prev_index_ptr, &new_index, print_change, &cost, &changes);
+        }
+        change_list_free(&list);
+    } else {
+        // No previous index - all files are new
+        changes.added = new_index.count;
+        for (size_t i = 0; i < new_index.count; i++) {
+            tally_change(&cost, &new_index.entries[i]);
         }
     }
+    size_t changed = changes.added + changes.modified + changes.deleted + renamed + copied;
     
-    if (changes_detected == 0) {
+    if (changed == 0) {
         printf("No changes detected since last snapshot\n");
+        // Nothing names the trees stored for the comparison, but they are
+        // not left half-written either
+        object_sync(fractyl_dir);
+        scan_journal_remove(fractyl_dir);
+        // Files were read again because their stat data changed with their
+        // content the same (touched, or racily clean until now). Record
+        // it, or every later snapshot reads them again and never finds
+        // the tree unchanged.
+        if (stat_data_changed(prev_index_ptr, &new_index) &&
+            (!take_lock || fractyl_lock_wait_publish(fractyl_dir, &publish, 30) == 0)) {
+            char index_path[2048];
+            snprintf(index_path, sizeof(index_path), "%s/index", fractyl_dir);
+            index_save_journaled(&new_index, index_path);
+            if (take_lock) fractyl_lock_release(&publish);
+        }
         if (auto_message) free(auto_message);
         free(repo_root);
         free(git_branch);
         if (prev_index_ptr) index_free(&prev_index);
-        index_free(&new_index);
-        fractyl_lock_release(&lock);
+        // Same contents as the current snapshot, with newer stat data
+        hand_over_index(opts, &new_index, prev_index_ptr ? prev_id : NULL, prev_root);
+        if (take_lock) fractyl_lock_release(&lock);
         return 0;
     }
     
-    // Show clean summary of changes
+    // Summary line
     if (prev_index_ptr) {
-        // Compare old and new indexes to show changes
-        int added = 0, modified = 0, deleted = 0;
-        
-        // Check for added and modified files
-        for (size_t i = 0; i < new_index.count; i++) {
-            const index_entry_t *new_entry = &new_index.entries[i];
-            if (!new_entry->path) continue;
-            
-            const index_entry_t *prev_entry = index_find_entry(prev_index_ptr, new_entry->path);
-            if (!prev_entry) {
-                printf("A %s\n", new_entry->path);
-                added++;
-            } else if (memcmp(new_entry->hash, prev_entry->hash, 32) != 0) {
-                printf("M %s\n", new_entry->path);
-                modified++;
-            }
-        }
-        
-        // Check for deleted files
-        for (size_t i = 0; i < prev_index.count; i++) {
-            const index_entry_t *prev_entry = &prev_index.entries[i];
-            if (!prev_entry->path) continue;
-            
-            const index_entry_t *new_entry = index_find_entry(&new_index, prev_entry->path);
-            if (!new_entry) {
-                printf("D %s\n", prev_entry->path);
-                deleted++;
-            }
-        }
-        
-        // Summary line
-        if (added + modified + deleted > 0) {
-            printf("%d files changed", added + modified + deleted);
-            if (added > 0) printf(", %d added", added);
-            if (modified > 0) printf(", %d modified", modified);
-            if (deleted > 0) printf(", %d deleted", deleted);
-            printf("\n");
-        }
+        printf("%zu files changed", changed);
+        if (changes.added > 0) printf(", %zu added", changes.added);
+        if (changes.modified > 0) printf(", %zu modified", changes.modified);
+        if (changes.deleted > 0) printf(", %zu deleted", changes.deleted);
+        if (renamed > 0) printf(", %zu renamed", renamed);
+        if (copied > 0) printf(", %zu copied", copied);
+        printf("\n");
+    }
+    
+    // The index and the trees name the objects just stored; they must be
+    // durable first
+    result = object_sync(fractyl_dir);
+    if (result != FRACTYL_OK) {
+        printf("Error: Failed to sync object storage: %d\n", result);
+        if (auto_message) free(auto_message);
+        free(repo_root);
+        if (prev_index_ptr) index_free(&prev_index);
+        index_free(&new_index);
+        if (take_lock) fractyl_lock_release(&lock);
+        return 1;
     }
     
-    // Save new index
+    // From here on this snapshot becomes the branch's, one writer at a time
+    if (take_lock && fractyl_lock_wait_publish(fractyl_dir, &publish, 30) != 0) {
+        printf("Error: Could not acquire lock to publish the snapshot\n");
+        if (auto_message) free(auto_message);
+        free(repo_root);
+        free(git_branch);
+        if (prev_index_ptr) index_free(&prev_index);
+        index_free(&new_index);
+        fractyl_lock_release(&lock);
+        return 1;
+    }
+    
+    // Save new index; usually only its changes, appended to the journal
     char index_path[2048];
     snprintf(index_path, sizeof(index_path), "%s/index", fractyl_dir);
-    result = index_save(&new_index, index_path);
+    profile_started = profile_begin();
+    result = index_save_journaled(&new_index, index_path);
     if (result != FRACTYL_OK) {
         printf("Error: Failed to save index: %d\n", result);
         if (auto_message) free(auto_message);
         free(repo_root);
         if (prev_index_ptr) index_free(&prev_index);
         index_free(&new_index);
-        fractyl_lock_release(&lock);
+        if (take_lock) {
+            fractyl_lock_release(&publish);
+            fractyl_lock_release(&lock);
+        }
         return 1;
     }
     
@@ -544,7 +941,10 @@ int cmd_snapshot(int argc, char **argv) {
         free(git_branch);
         if (prev_index_ptr) index_free(&prev_index);
         index_free(&new_index);
-        fractyl_lock_release(&lock);
+        if (take_lock) {
+            fractyl_lock_release(&publish);
+            fractyl_lock_release(&lock);
+        }
         return 1;
     }
     
@@ -556,70 +956,38 @@ int cmd_snapshot(int argc, char **argv) {
     if (git_branch) {
         snapshot.git_branch = strdup(git_branch);
         snapshot.git_commit = git_get_current_commit(repo_root);
-        snapshot.git_dirty = git_has_uncommitted_changes(repo_root);
         
+        // git.dirty "fast" (the default) compares the scan with the git
+        // index instead of running git status; "exact" runs it, "off" skips it
+        char dirty_mode[32] = "fast";
+        config_get(fractyl_dir, "git.dirty", dirty_mode, sizeof(dirty_mode));
+        if (strcmp(dirty_mode, "exact") == 0) {
+            snapshot.git_dirty = git_has_uncommitted_changes(repo_root);
+        } else if (strcmp(dirty_mode, "off") != 0) {
+            time_t newest_mtime = 0;
+            for (size_t i = 0; i < new_index.count; i++) {
+                if (new_index.entries[i].mtime > newest_mtime) {
+                    newest_mtime = new_index.entries[i].mtime;
+                }
+            }
+            snapshot.git_dirty = git_has_changes_since_index(repo_root, newest_mtime);
+        }
+    
         if (snapshot.git_commit) {
             printf("Git branch: %s (commit: %.7s%s)\n", git_branch, snapshot.git_commit,
                    snapshot.git_dirty ? ", uncommitted changes" : "");
         }
     }
     
-    // Find parent snapshot (most recent one)
+    // Find parent snapshot (most recent one); another snapshot may have
+    // been published since the comparison above
     char *parent_id = find_latest_snapshot(fractyl_dir, git_branch);
     if (parent_id) {
         snapshot.parent = parent_id; // Transfer ownership to snapshot
     }
     
-    // Store the index in object storage and get its hash
-    // First, serialize the index to get its data
-    char temp_index_path[] = "/tmp/fractyl_snapshot_index_XXXXXX";
-    int temp_fd = mkstemp(temp_index_path);
-    if (temp_fd == -1) {
-        printf("Error: Failed to create temporary index file\n");
-        free(snapshot_id);
-        if (auto_message) free(auto_message);
-        free(repo_root);
-        free(git_branch);
-        json_free_snapshot(&snapshot);
-        if (prev_index_ptr) index_free(&prev_index);
-        index_free(&new_index);
-        fractyl_lock_release(&lock);
-        return 1;
-    }
-    close(temp_fd);
-    
-    // Save index to temporary file
-    result = index_save(&new_index, temp_index_path);
-    if (result != FRACTYL_OK) {
-        printf("Error: Failed to save temporary index: %d\n", result);
-        unlink(temp_index_path);
-        free(snapshot_id);
-        if (auto_message) free(auto_message);
-        free(repo_root);
-        free(git_branch);
-        json_free_snapshot(&snapshot);
-        if (prev_index_ptr) index_free(&prev_index);
-        index_free(&new_index);
-        fractyl_lock_release(&lock);
-        return 1;
-    }
-    
-    // Store the index file in object storage
-    result = object_store_file(temp_index_path, fractyl_dir, snapshot.index_hash);
-    unlink(temp_index_path); // Clean up temp file
-    
-    if (result != FRACTYL_OK) {
-        printf("Error: Failed to store index in object storage: %d\n", result);
-        free(snapshot_id);
-        if (auto_message) free(auto_message);
-        free(repo_root);
-        free(git_branch);
-        json_free_snapshot(&snapshot);
-        if (prev_index_ptr) index_free(&prev_index);
-        index_free(&new_index);
-        fractyl_lock_release(&lock);
-        return 1;
-    }
+    // The trees were stored, and synced with the objects, above
+    memcpy(snapshot.index_hash, root, sizeof(root));
     
     // Save snapshot metadata
     char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, git_branch);
@@ -632,18 +1000,45 @@ int cmd_snapshot(int argc, char **argv) {
         json_free_snapshot(&snapshot);
         if (prev_index_ptr) index_free(&prev_index);
         index_free(&new_index);
-        fractyl_lock_release(&lock);
+        if (take_lock) {
+            fractyl_lock_release(&publish);
+            fractyl_lock_release(&lock);
+        }
         return 1;
     }
     
+    // Record what the snapshot cost, now that all its objects are stored
+    object_stats_t object_stats;
+    object_stats_get(&object_stats);
+    cost.recorded = 1;
+    cost.files = new_index.count;
+    cost.objects_written = object_stats.objects_written;
+    cost.bytes_written = object_stats.bytes_written;
+    cost.bytes_deduplicated = object_stats.bytes_deduplicated;
+    cost.hash_ms = object_stats.hash_ns / 1000000;
+    cost.store_ms = object_stats.store_ns / 1000000;
+    cost.total_ms = elapsed_ms(&started);
+    snapshot.stats = cost;
+    for (size_t i = 0; i < cost.path_count; i++) {
+        snapshot.stats.paths[i] = strdup(cost.paths[i]);
+        if (!snapshot.stats.paths[i]) {
+            snapshot.stats.path_count = i;
+            break;
+        }
+    }
+    
     // Ensure snapshots directory exists
     paths_ensure_directory(snapshots_dir);
     
     char snapshot_path[2048];
-    snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s.json", snapshots_dir, snapshot_id);
+    catalog_snapshot_path(snapshots_dir, snapshot_id, snapshot_path, sizeof(snapshot_path));
     
-    result = json_save_snapshot(&snapshot, snapshot_path);
+    result = catalog_store_snapshot(snapshots_dir, &snapshot);
     free(snapshots_dir);
+    if (result == FRACTYL_OK && object_durability(fractyl_dir) != OBJECT_DURABILITY_NONE &&
+        (!fsync_path(snapshot_path) || !fsync_parent_dir(snapshot_path))) {
+        result = FRACTYL_ERROR_IO;
+    }
     if (result != FRACTYL_OK) {
         printf("Error: Failed to save snapshot: %d\n", result);
         free(snapshot_id);
@@ -653,32 +1048,26 @@ int cmd_snapshot(int argc, char **argv) {
         json_free_snapshot(&snapshot);
         if (prev_index_ptr) index_free(&prev_index);
         index_free(&new_index);
-        fractyl_lock_release(&lock);
+        if (take_lock) {
+            fractyl_lock_release(&publish);
+            fractyl_lock_release(&lock);
+        }
         return 1;
     }
     
+    // A first snapshot on a branch gives it a row in the snapshot table
+    snapshot_table_add_branch(fractyl_dir, git_branch);
+    
     // Update CURRENT file
-    char *current_path = paths_get_current_file(fractyl_dir, git_branch);
-    if (current_path) {
-        // Ensure parent directory exists
-        char *parent_dir = strdup(current_path);
-        char *last_slash = strrchr(parent_dir, '/');
-        if (last_slash) {
-            *last_slash = '\0';
-            paths_ensure_directory(parent_dir);
-        }
-        free(parent_dir);
-        
-        FILE *current_file = fopen(current_path, "w");
-        if (current_file) {
-            fprintf(current_file, "%s\n", snapshot_id);
-            fclose(current_file);
-        }
-        free(current_path);
-    }
+    paths_set_current(fractyl_dir, git_branch, snapshot_id);
+    scan_journal_remove(fractyl_dir);
+    profile_end(PROFILE_SNAPSHOT_SAVE, profile_started);
+    counters_add(COUNTER_SNAPSHOTS, 1);
     
     printf("Created snapshot %s: \"%s\"\n", snapshot_id, message);
     printf("Stored %zu files in object storage\n", new_index.count);
+    printf("Wrote %llu new objects (%llu bytes), %llu bytes already stored, in %llu ms\n",
+           cost.objects_written, cost.bytes_written, cost.bytes_deduplicated, cost.total_ms);
     
     // Cleanup
     free(snapshot_id);
@@ -687,10 +1076,13 @@ int cmd_snapshot(int argc, char **argv) {
     }
     free(repo_root);
     free(git_branch);
-    json_free_snapshot(&snapshot);
     if (prev_index_ptr) index_free(&prev_index);
-    index_free(&new_index);
-    fractyl_lock_release(&lock);
+    hand_over_index(opts, &new_index, snapshot.id, snapshot.index_hash);
+    json_free_snapshot(&snapshot);
+    if (take_lock) {
+        fractyl_lock_release(&publish);
+        fractyl_lock_release(&lock);
+    }
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,269 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../utils/paths.h"
+#include "../utils/catalog.h"
+#include "../utils/json.h"
+#include "../utils/counters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define STATS_DEFAULT_COUNT 20
+
+typedef enum {
+    STATS_SORT_NEWEST = 0,
+    STATS_SORT_WRITTEN,
+    STATS_SORT_TIME
+} stats_sort_t;
+
+// A snapshot and the stats loaded from its JSON
+typedef struct {
+    const catalog_entry_t *entry;
+    size_t id_length;
+    snapshot_t snapshot;
+} stats_row_t;
+
+static stats_sort_t sort_order;
+
+static int compare_rows(const void *a, const void *b) {
+    const snapshot_stats_t *x = &((const stats_row_t *)a)->snapshot.stats;
+    const snapshot_stats_t *y = &((const stats_row_t *)b)->snapshot.stats;
+    unsigned long long vx = sort_order == STATS_SORT_TIME ? x->total_ms : x->bytes_written;
+    unsigned long long vy = sort_order == STATS_SORT_TIME ? y->total_ms : y->bytes_written;
+    return vx < vy ? 1 : vx > vy ? -1 : 0;
+}
+
+static void print_json_row(const stats_row_t *row) {
+    const snapshot_stats_t *stats = &row->snapshot.stats;
+    printf("{\"id\":\"%s\",\"timestamp\":%lld", row->entry->id, (long long)row->entry->timestamp);
+    if (stats->recorded) {
+        printf(",\"files\":%llu,\"files_changed\":%llu,\"bytes_changed\":%llu,\"objects_written\":%llu,"
+               "\"bytes_written\":%llu,\"bytes_deduplicated\":%llu,\"scan_ms\":%llu,\"hash_ms\":%llu,"
+               "\"store_ms\":%llu,\"tree_ms\":%llu,\"total_ms\":%llu",
+               stats->files, stats->files_changed, stats->bytes_changed, stats->objects_written,
+               stats->bytes_written, stats->bytes_deduplicated, stats->scan_ms, stats->hash_ms,
+               stats->store_ms, stats->tree_ms, stats->total_ms);
+        if (stats->path_count > 0) {
+            printf(",\"largest_change\":\"");
+            for (const char *p = stats->paths[0]; *p; p++) {
+                if (*p == '"' || *p == '\\') {
+                    printf("\\%c", *p);
+                } else if ((unsigned char)*p < 0x20) {
+                    printf("\\u%04x", (unsigned char)*p);
+                } else {
+                    putchar(*p);
+                }
+            }
+            printf("\"");
+        }
+    }
+    printf("}\n");
+}
+
+static void print_row(const stats_row_t *row) {
+    const snapshot_stats_t *stats = &row->snapshot.stats;
+    char time_str[32];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", localtime(&row->entry->timestamp));
+    printf("%-13.*s %s ", (int)row->id_length, row->entry->id, time_str);
+    if (!stats->recorded) {
+        printf("(no stats recorded)\n");
+        return;
+    }
+    printf("%8llu %8llu %8llu %12llu %12llu %8llu  %s\n", stats->files, stats->files_changed,
+           stats->objects_written, stats->bytes_written, stats->bytes_deduplicated, stats->total_ms,
+           stats->path_count > 0 ? stats->paths[0] : "");
+}
+
+// The repository's cumulative counters, with the rates worked out
+static void print_counters(const counters_t *counters, int json) {
+    const unsigned long long *v = counters->values;
+    if (json) {
+        printf("{\"since\":%lld", counters->since);
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            printf(",\"%s\":%llu", counter_name((counter_t)i), v[i]);
+        }
+        printf(",\"stat_hit_rate\":%.2f,\"binary_hit_rate\":%.2f}\n",
+               counters_percent(v[COUNTER_STAT_HITS], v[COUNTER_FILES_SCANNED]),
+               counters_percent(v[COUNTER_BINARY_HITS], v[COUNTER_BINARY_LOOKUPS]));
+        return;
+    }
+    
+    if (counters->since == 0) {
+        printf("No counters recorded yet\n");
+        return;
+    }
+    time_t since = (time_t)counters->since;
+    char time_str[32];
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", localtime(&since));
+    printf("Counters since %s\n\n", time_str);
+    printf("Scans                %12llu   (%llu snapshots taken)\n", v[COUNTER_SCANS], v[COUNTER_SNAPSHOTS]);
+    printf("Files scanned        %12llu\n", v[COUNTER_FILES_SCANNED]);
+    printf("  stat hits          %12llu   %5.1f%%\n", v[COUNTER_STAT_HITS],
+           counters_percent(v[COUNTER_STAT_HITS], v[COUNTER_FILES_SCANNED]));
+    printf("  rehashed           %12llu   %5.1f%%   (stat data differed)\n", v[COUNTER_REHASHED],
+           counters_percent(v[COUNTER_REHASHED], v[COUNTER_FILES_SCANNED]));
+    printf("  new                %12llu   %5.1f%%\n", v[COUNTER_NEW_FILES],
+           counters_percent(v[COUNTER_NEW_FILES], v[COUNTER_FILES_SCANNED]));
+    printf("Binary index lookups %12llu   %5.1f%% hits\n", v[COUNTER_BINARY_LOOKUPS],
+           counters_percent(v[COUNTER_BINARY_HITS], v[COUNTER_BINARY_LOOKUPS]));
+    printf("Files read           %12llu   %llu bytes hashed\n", v[COUNTER_FILES_READ], v[COUNTER_BYTES_HASHED]);
+    printf("Objects written      %12llu   %llu bytes\n", v[COUNTER_OBJECTS_WRITTEN], v[COUNTER_BYTES_WRITTEN]);
+    printf("Objects reused       %12llu   %llu bytes\n", v[COUNTER_OBJECTS_DEDUPLICATED],
+           v[COUNTER_BYTES_DEDUPLICATED]);
+    printf("stat calls           %12llu\n", v[COUNTER_STAT_CALLS]);
+    printf("Directories read     %12llu\n", v[COUNTER_DIR_READS]);
+    printf("Restores             %12llu   %llu files written (%llu bytes), %llu up to date\n",
+           v[COUNTER_RESTORES], v[COUNTER_RESTORE_FILES_WRITTEN], v[COUNTER_RESTORE_BYTES_WRITTEN],
+           v[COUNTER_RESTORE_FILES_SKIPPED]);
+}
+
+static void print_stats_usage(void) {
+    printf("Usage: frac stats [-n <count>] [--sort newest|written|time] [--json]\n");
+    printf("       frac stats --counters [--json] | --reset-counters\n");
+    printf("Show what recent snapshots of the current branch cost to take\n");
+    printf("\nOptions:\n");
+    printf("  -n <count>        Snapshots shown, newest first (default %d, 0 for all)\n", STATS_DEFAULT_COUNT);
+    printf("  --sort <key>      Order them by bytes written or time taken instead\n");
+    printf("  --json            One JSON object per snapshot\n");
+    printf("  --counters        The repository's cache and I/O counters, summed over\n");
+    printf("                    every command and daemon cycle\n");
+    printf("  --reset-counters  Start the counters again from zero\n");
+}
+
+int cmd_stats(int argc, char **argv) {
+    long count = STATS_DEFAULT_COUNT;
+    int json = 0;
+    int show_counters = 0;
+    int reset_counters = 0;
+    sort_order = STATS_SORT_NEWEST;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            char *end;
+            count = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || count < 0) {
+                printf("Error: Count must be a number\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--sort") == 0 && i + 1 < argc) {
+            const char *key = argv[++i];
+            if (strcmp(key, "newest") == 0) {
+                sort_order = STATS_SORT_NEWEST;
+            } else if (strcmp(key, "written") == 0) {
+                sort_order = STATS_SORT_WRITTEN;
+            } else if (strcmp(key, "time") == 0) {
+                sort_order = STATS_SORT_TIME;
+            } else {
+                printf("Error: Unknown sort key '%s' (expected newest, written or time)\n", key);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else if (strcmp(argv[i], "--counters") == 0) {
+            show_counters = 1;
+        } else if (strcmp(argv[i], "--reset-counters") == 0) {
+            reset_counters = 1;
+        } else {
+            print_stats_usage();
+            return 1;
+        }
+    }
+    
+    // Find repository root
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
+    }
+    
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    
+    if (reset_counters) {
+        free(repo_root);
+        if (counters_reset_file(fractyl_dir) != FRACTYL_OK) {
+            printf("Error: Could not remove the counters\n");
+            return 1;
+        }
+        printf("Counters reset\n");
+        return 0;
+    }
+    if (show_counters) {
+        free(repo_root);
+        counters_t counters;
+        if (counters_load(fractyl_dir, &counters) != FRACTYL_OK) {
+            printf("Error: Could not read the counters\n");
+            return 1;
+        }
+        print_counters(&counters, json);
+        return 0;
+    }
+    
+    char *git_branch = paths_get_current_branch(repo_root);
+    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, git_branch);
+    free(git_branch);
+    free(repo_root);
+    if (!snapshots_dir) {
+        printf("Error: Could not determine snapshots directory\n");
+        return 1;
+    }
+    
+    catalog_t catalog;
+    if (catalog_load(snapshots_dir, &catalog) != FRACTYL_OK) {
+        printf("Error: Could not read snapshots\n");
+        free(snapshots_dir);
+        return 1;
+    }
+    
+    // Only the snapshots shown have their files read
+    size_t shown = count == 0 || (size_t)count > catalog.count ? catalog.count : (size_t)count;
+    stats_row_t *rows = calloc(shown ? shown : 1, sizeof(stats_row_t));
+    if (!rows) {
+        printf("Error: Out of memory\n");
+        catalog_free(&catalog);
+        free(snapshots_dir);
+        return 1;
+    }
+    for (size_t i = 0; i < shown; i++) {
+        rows[i].entry = catalog_nth_newest(&catalog, i);
+        rows[i].id_length = catalog_abbrev_length(&catalog, rows[i].entry, 8);
+        if (catalog_load_snapshot(snapshots_dir, rows[i].entry->id, &rows[i].snapshot) != FRACTYL_OK) {
+            memset(&rows[i].snapshot, 0, sizeof(snapshot_t));
+        }
+    }
+    free(snapshots_dir);
+    if (sort_order != STATS_SORT_NEWEST) {
+        qsort(rows, shown, sizeof(stats_row_t), compare_rows);
+    }
+    
+    unsigned long long written = 0, deduplicated = 0, total_ms = 0;
+    if (!json) {
+        printf("%-13s %-16s %8s %8s %8s %12s %12s %8s  %s\n", "Snapshot", "Date", "Files", "Changed",
+               "Objects", "Written", "Reused", "Time ms", "Largest change");
+    }
+    for (size_t i = 0; i < shown; i++) {
+        if (json) {
+            print_json_row(&rows[i]);
+        } else {
+            print_row(&rows[i]);
+        }
+        written += rows[i].snapshot.stats.bytes_written;
+        deduplicated += rows[i].snapshot.stats.bytes_deduplicated;
+        total_ms += rows[i].snapshot.stats.total_ms;
+        json_free_snapshot(&rows[i].snapshot);
+    }
+    if (!json) {
+        printf("\n%zu of %zu snapshots: %llu bytes written, %llu bytes reused, %llu ms\n", shown,
+               catalog.count, written, deduplicated, total_ms);
+        counters_t counters;
+        if (counters_load(fractyl_dir, &counters) == FRACTYL_OK && counters.since != 0) {
+            char line[1024];
+            counters_describe(&counters, line, sizeof(line));
+            printf("All scans: %s (frac stats --counters)\n", line);
+        }
+    }
+    
+    free(rows);
+    catalog_free(&catalog);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "../include/commands.h"
+#include "../include/core.h"
+#include "../core/compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// zstd's own default dictionary size
+#define DEFAULT_DICT_KIB 110
+
+int cmd_train_dict(int argc, char **argv) {
+    long dict_kib = DEFAULT_DICT_KIB;
+    
+    for (int i = 2; i < argc; i++) {
+        if ((strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--size") == 0) && i + 1 < argc) {
+            char *end;
+            dict_kib = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || dict_kib < 1 || dict_kib > 1024) {
+                printf("Error: Dictionary size must be between 1 and 1024 KiB\n");
+                return 1;
+            }
+        } else {
+            printf("Usage: frac train-dict [-s|--size <KiB>]\n");
+            printf("Train a zstd dictionary from the small loose objects\n");
+            printf("\nNew objects below 128 KiB are compressed with it once\n");
+            printf("objects.compression = zstd is set in .fractyl/config.\n");
+            printf("\nOptions:\n");
+            printf("  -s, --size <KiB>    Dictionary size (default %d)\n", DEFAULT_DICT_KIB);
+            return 1;
+        }
+    }
+    
+    if (!compress_available()) {
+        printf("Error: This build of frac has no zstd support\n");
+        return 1;
+    }
+    
+    // Find repository root
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) {
+        printf("Error: Not in a fractyl repository. Use 'frac init' to initialize.\n");
+        return 1;
+    }
+    
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    free(repo_root);
+    
+    compress_train_stats_t stats;
+    int result = compress_train_dictionary(fractyl_dir, (size_t)dict_kib * 1024, &stats);
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        printf("Error: Not enough small loose objects to train a dictionary\n");
+        return 1;
+    }
+    if (result != FRACTYL_OK) {
+        printf("Error: Dictionary training failed (%d)\n", result);
+        return 1;
+    }
+    
+    printf("Trained dictionary %08x (%zu bytes) from %zu objects (%zu bytes)\n",
+           stats.dict_id, stats.dict_size, stats.samples, stats.sample_bytes);
+    if (!compress_enabled(fractyl_dir)) {
+        printf("Set objects.compression = zstd in .fractyl/config to use it\n");
+    }
+    return 0;
+}
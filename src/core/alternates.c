@@ -0,0 +1,307 @@
+#include "alternates.h"
+#include "hash.h"
+#include "pack.h"
+#include "../utils/config.h"
+#include "../utils/lock.h"
+#include "../utils/paths.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define LOCK_TIMEOUT 30
+
+// The stores of one repository, as read from its alternates file
+typedef struct alternates_entry {
+    char *fractyl_dir;
+    char *stores[ALTERNATES_MAX];
+    size_t count;
+    const char *write_dir;      // The first store, with objects.shared_write set
+    struct alternates_entry *next;
+} alternates_entry_t;
+
+static pthread_mutex_t alternates_lock = PTHREAD_MUTEX_INITIALIZER;
+static alternates_entry_t *entries;
+
+static void set_message(char *message, size_t size, const char *text, const char *arg) {
+    if (message && size > 0) snprintf(message, size, text, arg);
+}
+
+static void free_lines(char **lines, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(lines[i]);
+    }
+    free(lines);
+}
+
+// The non-empty lines of path that are not comments, trimmed; none if it
+// does not exist
+static int read_lines(const char *path, char ***lines_out, size_t *count_out) {
+    *lines_out = NULL;
+    *count_out = 0;
+    FILE *f = fopen(path, "r");
+    if (!f) return FRACTYL_OK;
+    
+    char **lines = NULL;
+    size_t count = 0, capacity = 0;
+    int result = FRACTYL_OK;
+    char line[PATH_MAX + 2];
+    while (result == FRACTYL_OK && fgets(line, sizeof(line), f)) {
+        char *s = line;
+        while (isspace((unsigned char)*s)) s++;
+        size_t len = strlen(s);
+        while (len > 0 && isspace((unsigned char)s[len - 1])) s[--len] = '\0';
+        if (len == 0 || *s == '#') continue;
+    
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            char **grown = realloc(lines, capacity * sizeof(char*));
+            if (!grown) {
+                result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            lines = grown;
+        }
+        if (!(lines[count] = strdup(s))) result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        else count++;
+    }
+    fclose(f);
+    if (result != FRACTYL_OK) {
+        free_lines(lines, count);
+        return result;
+    }
+    *lines_out = lines;
+    *count_out = count;
+    return FRACTYL_OK;
+}
+
+// Replace path with lines, through a temporary file renamed into place
+static int write_lines(const char *path, char *const *lines, size_t count) {
+    char temp_path[PATH_MAX + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *f = fopen(temp_path, "w");
+    if (!f) return FRACTYL_ERROR_IO;
+    
+    int ok = 1;
+    for (size_t i = 0; ok && i < count; i++) {
+        ok = fprintf(f, "%s\n", lines[i]) > 0;
+    }
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0) ok = 0;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return FRACTYL_ERROR_IO;
+    }
+    return FRACTYL_OK;
+}
+
+static int contains_line(char *const *lines, size_t count, const char *line) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(lines[i], line) == 0) return 1;
+    }
+    return 0;
+}
+
+// Read fractyl_dir's alternates file. Caller holds alternates_lock.
+static alternates_entry_t* load_entry(const char *fractyl_dir) {
+    alternates_entry_t *entry = calloc(1, sizeof(*entry));
+    if (!entry || !(entry->fractyl_dir = strdup(fractyl_dir))) {
+        free(entry);
+        return NULL;
+    }
+    
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", fractyl_dir, ALTERNATES_FILE);
+    char **lines;
+    size_t count;
+    if (read_lines(path, &lines, &count) != FRACTYL_OK) {
+        lines = NULL;
+        count = 0;
+    }
+    for (size_t i = 0; i < count && entry->count < ALTERNATES_MAX; i++) {
+        // Objects there can only be reported missing
+        struct stat st;
+        if (stat(lines[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "Warning: shared object store %s (in %s) does not exist\n", lines[i], path);
+            continue;
+        }
+        entry->stores[entry->count++] = lines[i];
+        lines[i] = NULL;
+    }
+    free_lines(lines, count);
+    
+    entry->write_dir = entry->count > 0 && config_get_long(fractyl_dir, "objects.shared_write", 0) == 1
+        ? entry->stores[0] : NULL;
+    entry->next = entries;
+    entries = entry;
+    return entry;
+}
+
+// Caller holds alternates_lock
+static const alternates_entry_t* find_entry(const char *fractyl_dir) {
+    for (alternates_entry_t *entry = entries; entry; entry = entry->next) {
+        if (strcmp(entry->fractyl_dir, fractyl_dir) == 0) return entry;
+    }
+    return load_entry(fractyl_dir);
+}
+
+size_t alternates_list(const char *fractyl_dir, const char *const **stores_out) {
+    static const char *const none[1] = { NULL };
+    *stores_out = none;
+    if (!fractyl_dir) return 0;
+    
+    pthread_mutex_lock(&alternates_lock);
+    const alternates_entry_t *entry = find_entry(fractyl_dir);
+    size_t count = entry ? entry->count : 0;
+    if (count > 0) *stores_out = (const char *const *)entry->stores;
+    pthread_mutex_unlock(&alternates_lock);
+    return count;
+}
+
+const char* alternates_write_dir(const char *fractyl_dir) {
+    if (!fractyl_dir) return fractyl_dir;
+    
+    pthread_mutex_lock(&alternates_lock);
+    const alternates_entry_t *entry = find_entry(fractyl_dir);
+    const char *dir = entry && entry->write_dir ? entry->write_dir : fractyl_dir;
+    pthread_mutex_unlock(&alternates_lock);
+    return dir;
+}
+
+void alternates_invalidate(void) {
+    pthread_mutex_lock(&alternates_lock);
+    while (entries) {
+        alternates_entry_t *next = entries->next;
+        for (size_t i = 0; i < entries->count; i++) {
+            free(entries->stores[i]);
+        }
+        free(entries->fractyl_dir);
+        free(entries);
+        entries = next;
+    }
+    pthread_mutex_unlock(&alternates_lock);
+}
+
+int alternates_members(const char *store, char ***members_out, size_t *count_out) {
+    if (!store || !members_out || !count_out) return FRACTYL_ERROR_INVALID_ARGS;
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", store, ALTERNATES_MEMBERS_FILE);
+    return read_lines(path, members_out, count_out);
+}
+
+void alternates_free_members(char **members, size_t count) {
+    free_lines(members, count);
+}
+
+// Create the store if needed and check it names objects as we do
+static int prepare_store(const char *store_path, char *store, char *message, size_t message_size) {
+    char pack_dir[PATH_MAX];
+    snprintf(pack_dir, sizeof(pack_dir), "%s/objects/pack", store_path);
+    if (paths_ensure_directory(pack_dir) != 0 || !realpath(store_path, store)) {
+        set_message(message, message_size, "cannot create %s", pack_dir);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    const char *algorithm = hash_algorithm_name(hash_get_algorithm());
+    char name[32];
+    if (config_get(store, "objects.hash", name, sizeof(name)) == FRACTYL_OK) {
+        if (strcmp(name, algorithm) != 0) {
+            set_message(message, message_size, "%s names objects by another hash", store);
+            return FRACTYL_ERROR_INVALID_STATE;
+        }
+    } else if (config_set(store, "objects.hash", algorithm) != FRACTYL_OK) {
+        set_message(message, message_size, "cannot write %s/config", store);
+        return FRACTYL_ERROR_IO;
+    }
+    return FRACTYL_OK;
+}
+
+// Record member in the store's members file, under the store's lock
+static int register_member(const char *store, const char *member, char *message, size_t message_size) {
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire(store, &lock, LOCK_TIMEOUT) != 0) {
+        set_message(message, message_size, "%s is busy", store);
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    
+    char **members;
+    size_t count;
+    int result = alternates_members(store, &members, &count);
+    if (result == FRACTYL_OK && !contains_line(members, count, member)) {
+        char **grown = realloc(members, (count + 1) * sizeof(char*));
+        if (grown) {
+            members = grown;
+            members[count] = (char *)member;
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", store, ALTERNATES_MEMBERS_FILE);
+            result = write_lines(path, members, count + 1);
+        } else {
+            result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+        if (result != FRACTYL_OK) set_message(message, message_size, "cannot write %s/members", store);
+    }
+    alternates_free_members(members, count);
+    fractyl_lock_release(&lock);
+    return result;
+}
+
+int alternates_add(const char *fractyl_dir, const char *store_path, int write, char *message,
+                   size_t message_size) {
+    if (!fractyl_dir || !store_path) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    char member[PATH_MAX], store[PATH_MAX];
+    if (!realpath(fractyl_dir, member)) {
+        set_message(message, message_size, "cannot resolve %s", fractyl_dir);
+        return FRACTYL_ERROR_IO;
+    }
+    int result = prepare_store(store_path, store, message, message_size);
+    if (result != FRACTYL_OK) return result;
+    if (strcmp(store, member) == 0) {
+        set_message(message, message_size, "%s is the repository's own store", store);
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", member, ALTERNATES_FILE);
+    char **stores;
+    size_t count;
+    result = read_lines(path, &stores, &count);
+    if (result != FRACTYL_OK) return result;
+    int listed = contains_line(stores, count, store);
+    if (!listed && count >= ALTERNATES_MAX) {
+        alternates_free_members(stores, count);
+        set_message(message, message_size, "%s already uses as many shared stores as it can", member);
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    
+    // Members register first: a store never misses a repository using it
+    result = register_member(store, member, message, message_size);
+    
+    // New objects go to the first store, so a written one moves to the front
+    char **updated = result == FRACTYL_OK ? malloc((count + 1) * sizeof(char*)) : NULL;
+    if (result == FRACTYL_OK && !updated) result = FRACTYL_ERROR_OUT_OF_MEMORY;
+    if (result == FRACTYL_OK) {
+        size_t n = 0;
+        if (write) updated[n++] = store;
+        for (size_t i = 0; i < count; i++) {
+            if (!write || strcmp(stores[i], store) != 0) updated[n++] = stores[i];
+        }
+        if (!write && !listed) updated[n++] = store;
+        result = write_lines(path, updated, n);
+        if (result != FRACTYL_OK) set_message(message, message_size, "cannot write %s", path);
+    }
+    free(updated);
+    alternates_free_members(stores, count);
+    
+    if (result == FRACTYL_OK && write && config_set(member, "objects.shared_write", "1") != FRACTYL_OK) {
+        set_message(message, message_size, "cannot write %s/config", member);
+        result = FRACTYL_ERROR_IO;
+    }
+    alternates_invalidate();
+    pack_cache_invalidate();
+    return result;
+}
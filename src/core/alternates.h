@@ -0,0 +1,63 @@
+#ifndef ALTERNATES_H
+#define ALTERNATES_H
+
+#include "../include/fractyl.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Shared object stores (alternates), for several checkouts of one project
+// on a host. .fractyl/alternates lists the stores a repository also finds
+// objects in, one absolute path per line ('#' starts a comment). A store
+// is laid out like a .fractyl directory without snapshots: config with
+// its objects.hash, objects/ with its packs, dicts/, and a members file
+// naming the .fractyl directory of every repository that uses it.
+//
+// Lookups search the repository's own objects first, then each store in
+// turn. New objects are stored in the repository, or with
+// objects.shared_write = 1 in its first store, whose own objects.*
+// settings then decide how; either way nothing found in any of them is
+// written again. The chunks of a chunk list written to a store are only
+// looked for in that store, so its chunk lists are complete for every
+// member.
+//
+// Writers need no coordination: objects get their names by rename and a
+// name always holds the same content. A repository's lock, shared or
+// exclusive, also holds the lock of each of its stores shared
+// (utils/lock.h), so collecting a store, under its own lock exclusively,
+// waits until no member reads or writes. 'frac gc --shared' marks from the
+// snapshots of every member and refuses while one of them is missing.
+
+#define ALTERNATES_FILE "alternates"
+#define ALTERNATES_MEMBERS_FILE "members"
+#define ALTERNATES_MAX 8
+
+// The stores of fractyl_dir that exist, in order, read once per process.
+// *stores_out stays valid until alternates_invalidate().
+size_t alternates_list(const char *fractyl_dir, const char *const **stores_out);
+
+// Where fractyl_dir's new objects go: its first store with
+// objects.shared_write = 1, else fractyl_dir itself (the same pointer)
+const char* alternates_write_dir(const char *fractyl_dir);
+
+// Create the store at store_path if needed and make fractyl_dir a member
+// of it; message receives why not. With write set, new objects of
+// fractyl_dir go there (objects.shared_write).
+int alternates_add(const char *fractyl_dir, const char *store_path, int write, char *message,
+                   size_t message_size);
+
+// The .fractyl directories of the store's members (caller frees with
+// alternates_free_members())
+int alternates_members(const char *store, char ***members_out, size_t *count_out);
+void alternates_free_members(char **members, size_t count);
+
+// Forget the lists read so far
+void alternates_invalidate(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ALTERNATES_H
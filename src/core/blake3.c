@@ -0,0 +1,453 @@
+#include "blake3.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Whole chunks are compressed eight at a time on x86-64 CPUs with AVX2,
+// chosen at run time
+#if defined(__x86_64__) && defined(__GNUC__)
+#define BLAKE3_AVX2 1
+#include <immintrin.h>
+#endif
+
+#define CHUNK_START 1
+#define CHUNK_END 2
+#define PARENT 4
+#define ROOT 8
+
+// Below this the threads cost more than they save
+#define PARALLEL_MIN_SIZE (1024 * 1024)
+#define PARALLEL_MAX_THREADS 64
+
+static const uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+// Message word order of each of the seven rounds
+static const uint8_t SCHEDULE[7][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+typedef struct {
+    uint32_t input_cv[8];
+    uint32_t block[16];
+    uint64_t counter;
+    uint32_t block_len;
+    uint32_t flags;
+} output_t;
+
+static inline uint32_t rotr(uint32_t w, int c) {
+    return (w >> c) | (w << (32 - c));
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void load_block(const uint8_t *bytes, uint32_t *words) {
+    for (int i = 0; i < 16; i++) {
+        words[i] = load32(bytes + 4 * i);
+    }
+}
+
+#define G(a, b, c, d, x, y) do { \
+    s[a] += s[b] + (x); s[d] = rotr(s[d] ^ s[a], 16); \
+    s[c] += s[d];       s[b] = rotr(s[b] ^ s[c], 12); \
+    s[a] += s[b] + (y); s[d] = rotr(s[d] ^ s[a], 8);  \
+    s[c] += s[d];       s[b] = rotr(s[b] ^ s[c], 7);  \
+} while (0)
+
+static void compress(const uint32_t cv[8], const uint32_t m[16], uint64_t counter,
+                     uint32_t block_len, uint32_t flags, uint32_t out[16]) {
+    uint32_t s[16] = {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        IV[0], IV[1], IV[2], IV[3],
+        (uint32_t)counter, (uint32_t)(counter >> 32), block_len, flags
+    };
+    for (int r = 0; r < 7; r++) {
+        const uint8_t *o = SCHEDULE[r];
+        G(0, 4, 8, 12, m[o[0]], m[o[1]]);
+        G(1, 5, 9, 13, m[o[2]], m[o[3]]);
+        G(2, 6, 10, 14, m[o[4]], m[o[5]]);
+        G(3, 7, 11, 15, m[o[6]], m[o[7]]);
+        G(0, 5, 10, 15, m[o[8]], m[o[9]]);
+        G(1, 6, 11, 12, m[o[10]], m[o[11]]);
+        G(2, 7, 8, 13, m[o[12]], m[o[13]]);
+        G(3, 4, 9, 14, m[o[14]], m[o[15]]);
+    }
+    for (int i = 0; i < 8; i++) {
+        out[i] = s[i] ^ s[i + 8];
+        out[i + 8] = s[i + 8] ^ cv[i];
+    }
+}
+
+static void compress_cv(uint32_t cv[8], const uint32_t m[16], uint64_t counter,
+                        uint32_t block_len, uint32_t flags) {
+    uint32_t out[16];
+    compress(cv, m, counter, block_len, flags, out);
+    memcpy(cv, out, 8 * sizeof(uint32_t));
+}
+
+static void output_cv(const output_t *output, uint32_t cv[8]) {
+    memcpy(cv, output->input_cv, 8 * sizeof(uint32_t));
+    compress_cv(cv, output->block, output->counter, output->block_len, output->flags);
+}
+
+static void parent_output(const uint32_t left[8], const uint32_t right[8], output_t *output) {
+    memcpy(output->input_cv, IV, sizeof(IV));
+    memcpy(output->block, left, 8 * sizeof(uint32_t));
+    memcpy(output->block + 8, right, 8 * sizeof(uint32_t));
+    output->counter = 0;
+    output->block_len = BLAKE3_BLOCK_LEN;
+    output->flags = PARENT;
+}
+
+static void parent_cv(const uint32_t left[8], const uint32_t right[8], uint32_t cv[8]) {
+    output_t output;
+    parent_output(left, right, &output);
+    output_cv(&output, cv);
+}
+
+// --- Chunks ---
+
+static void chunk_init(blake3_chunk_state_t *chunk, uint64_t chunk_counter) {
+    memset(chunk, 0, sizeof(*chunk));
+    memcpy(chunk->cv, IV, sizeof(IV));
+    chunk->chunk_counter = chunk_counter;
+}
+
+static size_t chunk_len(const blake3_chunk_state_t *chunk) {
+    return (size_t)chunk->blocks_compressed * BLAKE3_BLOCK_LEN + chunk->buf_len;
+}
+
+static uint32_t chunk_start_flag(const blake3_chunk_state_t *chunk) {
+    return chunk->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+// The last block of a chunk is kept in buf until the chunk is finished,
+// since it is compressed with different flags
+static void chunk_update(blake3_chunk_state_t *chunk, const uint8_t *data, size_t size) {
+    uint32_t words[16];
+    while (size > 0) {
+        if (chunk->buf_len == BLAKE3_BLOCK_LEN) {
+            load_block(chunk->buf, words);
+            compress_cv(chunk->cv, words, chunk->chunk_counter, BLAKE3_BLOCK_LEN, chunk_start_flag(chunk));
+            chunk->blocks_compressed++;
+            chunk->buf_len = 0;
+            memset(chunk->buf, 0, sizeof(chunk->buf));
+        }
+        if (chunk->buf_len == 0) {
+            while (size > BLAKE3_BLOCK_LEN) {
+                load_block(data, words);
+                compress_cv(chunk->cv, words, chunk->chunk_counter, BLAKE3_BLOCK_LEN, chunk_start_flag(chunk));
+                chunk->blocks_compressed++;
+                data += BLAKE3_BLOCK_LEN;
+                size -= BLAKE3_BLOCK_LEN;
+            }
+        }
+    
+        size_t take = BLAKE3_BLOCK_LEN - chunk->buf_len;
+        if (take > size) take = size;
+        memcpy(chunk->buf + chunk->buf_len, data, take);
+        chunk->buf_len += (uint8_t)take;
+        data += take;
+        size -= take;
+    }
+}
+
+static void chunk_output(const blake3_chunk_state_t *chunk, output_t *output) {
+    memcpy(output->input_cv, chunk->cv, sizeof(chunk->cv));
+    load_block(chunk->buf, output->block);
+    output->counter = chunk->chunk_counter;
+    output->block_len = chunk->buf_len;
+    output->flags = chunk_start_flag(chunk) | CHUNK_END;
+}
+
+// --- Eight chunks at once ---
+
+#define SIMD_CHUNKS 8
+
+#ifdef BLAKE3_AVX2
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256i rotr8x(__m256i x, int c) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, c), _mm256_slli_epi32(x, 32 - c));
+}
+
+#define G8(a, b, c, d, x, y) do { \
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x); v[d] = rotr8x(_mm256_xor_si256(v[d], v[a]), 16); \
+    v[c] = _mm256_add_epi32(v[c], v[d]);                       v[b] = rotr8x(_mm256_xor_si256(v[b], v[c]), 12); \
+    v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y); v[d] = rotr8x(_mm256_xor_si256(v[d], v[a]), 8);  \
+    v[c] = _mm256_add_epi32(v[c], v[d]);                       v[b] = rotr8x(_mm256_xor_si256(v[b], v[c]), 7);  \
+} while (0)
+
+// Rows of eight words become columns
+AVX2 static inline void transpose8(__m256i r[8]) {
+    __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+    __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+    r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+// Each lane follows one chunk through its sixteen blocks
+AVX2 static void chunks8_avx2(const uint8_t *data, uint64_t chunk_counter, uint32_t cvs[SIMD_CHUNKS][8]) {
+    uint32_t counter_lo[SIMD_CHUNKS], counter_hi[SIMD_CHUNKS];
+    for (int j = 0; j < SIMD_CHUNKS; j++) {
+        counter_lo[j] = (uint32_t)(chunk_counter + j);
+        counter_hi[j] = (uint32_t)((chunk_counter + j) >> 32);
+    }
+    __m256i lo = _mm256_loadu_si256((const __m256i *)counter_lo);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)counter_hi);
+    __m256i h[8];
+    for (int i = 0; i < 8; i++) h[i] = _mm256_set1_epi32((int)IV[i]);
+    
+    for (int b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++) {
+        __m256i m[16];
+        for (int j = 0; j < SIMD_CHUNKS; j++) {
+            const uint8_t *block = data + j * BLAKE3_CHUNK_LEN + b * BLAKE3_BLOCK_LEN;
+            m[j] = _mm256_loadu_si256((const __m256i *)block);
+            m[j + 8] = _mm256_loadu_si256((const __m256i *)(block + 32));
+        }
+        transpose8(m);
+        transpose8(m + 8);
+    
+        uint32_t flags = (b == 0 ? CHUNK_START : 0) | (b == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1 ? CHUNK_END : 0);
+        __m256i v[16] = {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            _mm256_set1_epi32((int)IV[0]), _mm256_set1_epi32((int)IV[1]),
+            _mm256_set1_epi32((int)IV[2]), _mm256_set1_epi32((int)IV[3]),
+            lo, hi, _mm256_set1_epi32(BLAKE3_BLOCK_LEN), _mm256_set1_epi32((int)flags)
+        };
+        for (int r = 0; r < 7; r++) {
+            const uint8_t *o = SCHEDULE[r];
+            G8(0, 4, 8, 12, m[o[0]], m[o[1]]);
+            G8(1, 5, 9, 13, m[o[2]], m[o[3]]);
+            G8(2, 6, 10, 14, m[o[4]], m[o[5]]);
+            G8(3, 7, 11, 15, m[o[6]], m[o[7]]);
+            G8(0, 5, 10, 15, m[o[8]], m[o[9]]);
+            G8(1, 6, 11, 12, m[o[10]], m[o[11]]);
+            G8(2, 7, 8, 13, m[o[12]], m[o[13]]);
+            G8(3, 4, 9, 14, m[o[14]], m[o[15]]);
+        }
+        for (int i = 0; i < 8; i++) h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+    }
+    
+    transpose8(h);
+    for (int j = 0; j < SIMD_CHUNKS; j++) {
+        _mm256_storeu_si256((__m256i *)cvs[j], h[j]);
+    }
+}
+#endif
+
+// Chaining values of SIMD_CHUNKS complete chunks that are not the root.
+// Returns 0 if this CPU cannot do them together.
+static int chunks8(const uint8_t *data, uint64_t chunk_counter, uint32_t cvs[SIMD_CHUNKS][8]) {
+#ifdef BLAKE3_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        chunks8_avx2(data, chunk_counter, cvs);
+        return 1;
+    }
+#endif
+    (void)data;
+    (void)chunk_counter;
+    (void)cvs;
+    return 0;
+}
+
+// --- Tree ---
+
+// Add the chaining value of a complete subtree of 2^level chunks that ends
+// after chunks_after chunks. Finished pairs are merged right away; that is
+// safe because callers only add subtrees that more input follows.
+static void push_cv(blake3_hasher_t *hasher, const uint32_t cv[8], uint64_t chunks_after, int level) {
+    uint32_t merged[8];
+    memcpy(merged, cv, sizeof(merged));
+    uint64_t total = chunks_after >> level;
+    while ((total & 1) == 0 && hasher->cv_stack_len > 0) {
+        hasher->cv_stack_len--;
+        parent_cv(hasher->cv_stack[hasher->cv_stack_len], merged, merged);
+        total >>= 1;
+    }
+    memcpy(hasher->cv_stack[hasher->cv_stack_len++], merged, sizeof(merged));
+}
+
+void blake3_hasher_init(blake3_hasher_t *hasher) {
+    chunk_init(&hasher->chunk, 0);
+    hasher->cv_stack_len = 0;
+}
+
+void blake3_hasher_update(blake3_hasher_t *hasher, const void *data, size_t size) {
+    const uint8_t *p = data;
+    while (size > 0) {
+        if (chunk_len(&hasher->chunk) == BLAKE3_CHUNK_LEN) {
+            output_t output;
+            uint32_t cv[8];
+            chunk_output(&hasher->chunk, &output);
+            output_cv(&output, cv);
+            uint64_t total_chunks = hasher->chunk.chunk_counter + 1;
+            push_cv(hasher, cv, total_chunks, 0);
+            chunk_init(&hasher->chunk, total_chunks);
+        }
+    
+        // Runs of whole chunks with more input after them
+        uint32_t cvs[SIMD_CHUNKS][8];
+        while (chunk_len(&hasher->chunk) == 0 && size > SIMD_CHUNKS * BLAKE3_CHUNK_LEN &&
+               chunks8(p, hasher->chunk.chunk_counter, cvs)) {
+            uint64_t counter = hasher->chunk.chunk_counter;
+            for (int j = 0; j < SIMD_CHUNKS; j++) {
+                push_cv(hasher, cvs[j], counter + j + 1, 0);
+            }
+            chunk_init(&hasher->chunk, counter + SIMD_CHUNKS);
+            p += SIMD_CHUNKS * BLAKE3_CHUNK_LEN;
+            size -= SIMD_CHUNKS * BLAKE3_CHUNK_LEN;
+        }
+    
+        size_t take = BLAKE3_CHUNK_LEN - chunk_len(&hasher->chunk);
+        if (take > size) take = size;
+        chunk_update(&hasher->chunk, p, take);
+        p += take;
+        size -= take;
+    }
+}
+
+void blake3_hasher_finalize(const blake3_hasher_t *hasher, uint8_t *out) {
+    output_t output;
+    chunk_output(&hasher->chunk, &output);
+    for (int i = hasher->cv_stack_len - 1; i >= 0; i--) {
+        uint32_t right[8];
+        output_cv(&output, right);
+        parent_output(hasher->cv_stack[i], right, &output);
+    }
+    
+    // The root is compressed once more with the ROOT flag and counter 0
+    uint32_t words[16];
+    compress(output.input_cv, output.block, 0, output.block_len, output.flags | ROOT, words);
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = (uint8_t)words[i];
+        out[4 * i + 1] = (uint8_t)(words[i] >> 8);
+        out[4 * i + 2] = (uint8_t)(words[i] >> 16);
+        out[4 * i + 3] = (uint8_t)(words[i] >> 24);
+    }
+}
+
+// --- Parallel hashing ---
+
+// Chaining value of the complete subtree of size bytes (a power of two
+// number of chunks) starting at chunk chunk_counter
+static void subtree_cv(const uint8_t *data, size_t size, uint64_t chunk_counter, uint32_t cv[8]) {
+    uint32_t cvs[SIMD_CHUNKS][8];
+    if (size == SIMD_CHUNKS * BLAKE3_CHUNK_LEN && chunks8(data, chunk_counter, cvs)) {
+        for (int width = SIMD_CHUNKS; width > 1; width /= 2) {
+            for (int j = 0; j < width / 2; j++) {
+                parent_cv(cvs[2 * j], cvs[2 * j + 1], cvs[j]);
+            }
+        }
+        memcpy(cv, cvs[0], sizeof(cvs[0]));
+        return;
+    }
+    if (size == BLAKE3_CHUNK_LEN) {
+        blake3_chunk_state_t chunk;
+        output_t output;
+        chunk_init(&chunk, chunk_counter);
+        chunk_update(&chunk, data, size);
+        chunk_output(&chunk, &output);
+        output_cv(&output, cv);
+        return;
+    }
+    
+    size_t half = size / 2;
+    uint32_t left[8], right[8];
+    subtree_cv(data, half, chunk_counter, left);
+    subtree_cv(data + half, half, chunk_counter + half / BLAKE3_CHUNK_LEN, right);
+    parent_cv(left, right, cv);
+}
+
+typedef struct {
+    const uint8_t *data;
+    size_t subtree_size;
+    size_t first;
+    size_t stride;
+    size_t count;
+    uint32_t (*cvs)[8];
+} subtree_job_t;
+
+static void *subtree_worker(void *arg) {
+    subtree_job_t *job = arg;
+    uint64_t chunks_per_subtree = job->subtree_size / BLAKE3_CHUNK_LEN;
+    for (size_t i = job->first; i < job->count; i += job->stride) {
+        subtree_cv(job->data + i * job->subtree_size, job->subtree_size, i * chunks_per_subtree, job->cvs[i]);
+    }
+    return NULL;
+}
+
+void blake3_hash_parallel(const void *data, size_t size, int max_threads, uint8_t *out) {
+    blake3_hasher_t hasher;
+    blake3_hasher_init(&hasher);
+    if (max_threads > PARALLEL_MAX_THREADS) max_threads = PARALLEL_MAX_THREADS;
+    if (max_threads < 2 || size < PARALLEL_MIN_SIZE) {
+        blake3_hasher_update(&hasher, data, size);
+        blake3_hasher_finalize(&hasher, out);
+        return;
+    }
+    
+    // About four subtrees per thread keeps them evenly loaded. The last
+    // bytes (at least one) go through the hasher, which finishes the root.
+    size_t subtree_size = BLAKE3_CHUNK_LEN;
+    int level = 0;
+    while (subtree_size * 2 * 4 * (size_t)max_threads <= size) {
+        subtree_size *= 2;
+        level++;
+    }
+    size_t count = (size - 1) / subtree_size;
+    uint32_t (*cvs)[8] = malloc(count * sizeof(*cvs));
+    if (!cvs) {
+        blake3_hasher_update(&hasher, data, size);
+        blake3_hasher_finalize(&hasher, out);
+        return;
+    }
+    
+    subtree_job_t jobs[PARALLEL_MAX_THREADS];
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    int started[PARALLEL_MAX_THREADS] = {0};
+    for (int t = 0; t < max_threads; t++) {
+        jobs[t] = (subtree_job_t){ data, subtree_size, (size_t)t, (size_t)max_threads, count, cvs };
+        if (t > 0) started[t] = pthread_create(&threads[t], NULL, subtree_worker, &jobs[t]) == 0;
+    }
+    subtree_worker(&jobs[0]);
+    for (int t = 1; t < max_threads; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            subtree_worker(&jobs[t]);
+        }
+    }
+    
+    uint64_t chunks_per_subtree = subtree_size / BLAKE3_CHUNK_LEN;
+    for (size_t i = 0; i < count; i++) {
+        push_cv(&hasher, cvs[i], (i + 1) * chunks_per_subtree, level);
+    }
+    free(cvs);
+    
+    chunk_init(&hasher.chunk, count * chunks_per_subtree);
+    blake3_hasher_update(&hasher, (const uint8_t *)data + count * subtree_size, size - count * subtree_size);
+    blake3_hasher_finalize(&hasher, out);
+}
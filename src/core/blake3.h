@@ -0,0 +1,45 @@
+#ifndef BLAKE3_H
+#define BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// BLAKE3 with 32-byte output, written from the specification. Input is
+// split into 1 KiB chunks that form a binary tree, so independent subtrees
+// of a large buffer can be hashed on several threads.
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_MAX_DEPTH 54
+
+typedef struct {
+    uint32_t cv[8];
+    uint64_t chunk_counter;
+    uint8_t buf[BLAKE3_BLOCK_LEN];
+    uint8_t buf_len;
+    uint8_t blocks_compressed;
+} blake3_chunk_state_t;
+
+typedef struct {
+    blake3_chunk_state_t chunk;
+    uint32_t cv_stack[BLAKE3_MAX_DEPTH][8];
+    uint8_t cv_stack_len;
+} blake3_hasher_t;
+
+void blake3_hasher_init(blake3_hasher_t *hasher);
+void blake3_hasher_update(blake3_hasher_t *hasher, const void *data, size_t size);
+void blake3_hasher_finalize(const blake3_hasher_t *hasher, uint8_t *out);
+
+// Hash a whole buffer, spreading subtrees over up to max_threads threads
+void blake3_hash_parallel(const void *data, size_t size, int max_threads, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLAKE3_H
@@ -0,0 +1,146 @@
+#include "changes.h"
+#include "rename.h"
+#include "tree.h"
+#include "../include/fractyl.h"
+#include <stdlib.h>
+#include <string.h>
+
+void change_list_init(change_list_t *list) {
+    memset(list, 0, sizeof(*list));
+}
+
+void change_list_free(change_list_t *list) {
+    if (!list) return;
+    free(list->items);
+    arena_free(&list->arena);
+    memset(list, 0, sizeof(*list));
+}
+
+// index_change_fn: copy a change into the list, entries being valid
+// during the call only
+static int add_change(index_change_t change, const index_entry_t *old_entry, const index_entry_t *new_entry,
+                      void *ctx) {
+    change_list_t *list = ctx;
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        change_t *items = realloc(list->items, capacity * sizeof(change_t));
+        if (!items) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    
+    change_t *item = &list->items[list->count];
+    memset(item, 0, sizeof(*item));
+    char *path = arena_strdup(&list->arena, new_entry ? new_entry->path : old_entry->path);
+    if (!path) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    if (old_entry) {
+        item->old_entry = *old_entry;
+        item->old_entry.path = path;
+    }
+    if (new_entry) {
+        item->new_entry = *new_entry;
+        item->new_entry.path = path;
+    }
+    
+    if (change == INDEX_CHANGE_ADDED) {
+        item->kind = CHANGE_ADDED;
+    } else if (change == INDEX_CHANGE_DELETED) {
+        item->kind = CHANGE_DELETED;
+    } else {
+        item->kind = memcmp(old_entry->hash, new_entry->hash, 32) == 0 ? CHANGE_MODE : CHANGE_MODIFIED;
+    }
+    list->count++;
+    return 0;
+}
+
+int change_list_from_trees(change_list_t *list, const unsigned char *old_root, const unsigned char *new_root,
+                           const char *fractyl_dir) {
+    if (!list || !old_root || !new_root || !fractyl_dir) return FRACTYL_ERROR_INVALID_ARGS;
+    return tree_diff(old_root, new_root, fractyl_dir, add_change, list, NULL);
+}
+
+int change_list_from_indexes(change_list_t *list, const index_t *old_index, const index_t *new_index) {
+    if (!list || !old_index || !new_index) return FRACTYL_ERROR_INVALID_ARGS;
+    return index_diff(old_index, new_index, add_change, list, NULL);
+}
+
+int change_list_pair_renames(change_list_t *list, const char *fractyl_dir, const char *target_root) {
+    if (!list || !fractyl_dir) return FRACTYL_ERROR_INVALID_ARGS;
+    size_t limit;
+    if (!rename_enabled(fractyl_dir, &limit)) return FRACTYL_OK;
+    
+    size_t source_count = 0, target_count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        change_kind_t kind = list->items[i].kind;
+        if (kind == CHANGE_ADDED) target_count++;
+        else if (kind == CHANGE_MODIFIED || kind == CHANGE_MODE || kind == CHANGE_DELETED) source_count++;
+    }
+    if (source_count == 0 || target_count == 0) return FRACTYL_OK;
+    
+    rename_source_t *sources = malloc(source_count * sizeof(rename_source_t));
+    const index_entry_t **targets = malloc(target_count * sizeof(index_entry_t *));
+    size_t *source_item = malloc(source_count * sizeof(size_t));
+    size_t *target_item = malloc(target_count * sizeof(size_t));
+    int *dropped = calloc(list->count, sizeof(int));
+    rename_pair_t *pairs = NULL;
+    size_t pair_count = 0;
+    int result = FRACTYL_ERROR_OUT_OF_MEMORY;
+    if (sources && targets && source_item && target_item && dropped) {
+        source_count = target_count = 0;
+        for (size_t i = 0; i < list->count; i++) {
+            const change_t *item = &list->items[i];
+            if (item->kind == CHANGE_ADDED) {
+                targets[target_count] = &item->new_entry;
+                target_item[target_count++] = i;
+            } else if (item->kind != CHANGE_RENAMED && item->kind != CHANGE_COPIED) {
+                sources[source_count].entry = &item->old_entry;
+                sources[source_count].kept = item->kind != CHANGE_DELETED;
+                source_item[source_count++] = i;
+            }
+        }
+        result = rename_detect(sources, source_count, targets, target_count, fractyl_dir, target_root, limit,
+                               &pairs, &pair_count);
+    }
+    
+    if (result == FRACTYL_OK) {
+        for (size_t p = 0; p < pair_count; p++) {
+            change_t *target = &list->items[target_item[pairs[p].target]];
+            const change_t *source = &list->items[source_item[pairs[p].source]];
+            target->kind = pairs[p].copy ? CHANGE_COPIED : CHANGE_RENAMED;
+            target->old_entry = source->old_entry;
+            target->similarity = pairs[p].similarity;
+            if (pairs[p].copy) {
+                list->copied++;
+            } else {
+                dropped[source_item[pairs[p].source]] = 1;
+                list->renamed++;
+            }
+        }
+        // A renamed file's deletion is part of its rename
+        size_t kept = 0;
+        for (size_t i = 0; i < list->count; i++) {
+            if (!dropped[i]) list->items[kept++] = list->items[i];
+        }
+        list->count = kept;
+    }
+    
+    free(sources);
+    free(targets);
+    free(source_item);
+    free(target_item);
+    free(dropped);
+    free(pairs);
+    return result;
+}
+
+const char* change_kind_tag(change_kind_t kind) {
+    switch (kind) {
+        case CHANGE_ADDED: return "A";
+        case CHANGE_MODIFIED: return "M";
+        case CHANGE_MODE: return "M";
+        case CHANGE_DELETED: return "D";
+        case CHANGE_RENAMED: return "R";
+        case CHANGE_COPIED: return "C";
+    }
+    return "?";
+}
@@ -0,0 +1,71 @@
+#ifndef CHANGES_H
+#define CHANGES_H
+
+#include "../include/core.h"
+#include "../utils/arena.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The changes between two sets of files as one typed list, which snapshot
+// summaries and frac diff both read, so both pair renames and tell mode
+// changes apart the same way.
+//
+// Two snapshots are compared by walking their trees, which skips every
+// directory with the same hash on both sides; two indexes in memory by
+// merge-joining them, or through a lookup table when either is not in
+// path order (index_diff()). Renames and copies are then paired by
+// rename_detect(). The list is in path order, by the new path or the old
+// one for deleted files, unless it came from indexes that are not.
+
+typedef enum {
+    CHANGE_ADDED,
+    CHANGE_MODIFIED,            // Other content, and maybe another mode
+    CHANGE_MODE,                // Same content, another mode
+    CHANGE_DELETED,
+    CHANGE_RENAMED,             // old_entry moved to new_entry's path
+    CHANGE_COPIED               // new_entry came from old_entry, which stays
+} change_kind_t;
+
+typedef struct {
+    change_kind_t kind;
+    index_entry_t old_entry;    // All but CHANGE_ADDED
+    index_entry_t new_entry;    // All but CHANGE_DELETED
+    int similarity;             // Percent, for renames and copies
+} change_t;
+
+typedef struct {
+    change_t *items;
+    size_t count;
+    size_t capacity;
+    size_t renamed;             // Counts made by change_list_pair_renames()
+    size_t copied;
+    arena_t arena;              // The entries' paths
+} change_list_t;
+
+void change_list_init(change_list_t *list);
+void change_list_free(change_list_t *list);
+
+// Add the changes from old_root to new_root, snapshot index hashes: trees
+// or flat index objects
+int change_list_from_trees(change_list_t *list, const unsigned char *old_root, const unsigned char *new_root,
+                           const char *fractyl_dir);
+// Add the changes from old_index to new_index
+int change_list_from_indexes(change_list_t *list, const index_t *old_index, const index_t *new_index);
+
+// Turn added files that came from a deleted or changed one into renames
+// and copies of it, as configured in .fractyl/config (rename_enabled()).
+// Added files are read from target_root when it is not NULL (the working
+// tree), else from the object store.
+int change_list_pair_renames(change_list_t *list, const char *fractyl_dir, const char *target_root);
+
+// "A", "M", "D", "R" or "C"
+const char* change_kind_tag(change_kind_t kind);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHANGES_H
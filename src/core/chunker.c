@@ -0,0 +1,45 @@
+#include "chunker.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// Normalized chunking: a stricter mask before the average size and a
+// looser one after it pull chunk sizes towards CHUNK_AVG_SIZE (2^16).
+// The gear hash shifts left, so the high bits depend on the most bytes.
+#define MASK_BITS(n) (~0ULL << (64 - (n)))
+#define MASK_SMALL MASK_BITS(18)
+#define MASK_LARGE MASK_BITS(14)
+
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+// Fixed pseudo-random table (splitmix64); changing it would move every
+// cut point and defeat deduplication against existing chunks
+static void gear_init(void) {
+    uint64_t state = 0x6672616374796c00ULL;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+size_t chunker_cut(const unsigned char *data, size_t size) {
+    if (size <= CHUNK_MIN_SIZE) return size;
+    if (size > CHUNK_MAX_SIZE) size = CHUNK_MAX_SIZE;
+
+    pthread_once(&gear_once, gear_init);
+
+    size_t normal = size < CHUNK_AVG_SIZE ? size : CHUNK_AVG_SIZE;
+    uint64_t fp = 0;
+    size_t i = CHUNK_MIN_SIZE;
+    for (; i < normal; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & MASK_SMALL)) return i + 1;
+    }
+    for (; i < size; i++) {
+        fp = (fp << 1) + gear[data[i]];
+        if (!(fp & MASK_LARGE)) return i + 1;
+    }
+    return size;
+}
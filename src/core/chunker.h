@@ -0,0 +1,26 @@
+#ifndef CHUNKER_H
+#define CHUNKER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Content-defined chunking (FastCDC). Cut points depend only on the bytes
+// around them, so an edit in a large file changes the chunks it touches
+// and leaves the others - and their hashes - as they were.
+
+#define CHUNK_MIN_SIZE (16 * 1024)
+#define CHUNK_AVG_SIZE (64 * 1024)
+#define CHUNK_MAX_SIZE (256 * 1024)
+
+// Length of the chunk starting at data. Unless data holds the end of the
+// input, size must be at least CHUNK_MAX_SIZE.
+size_t chunker_cut(const unsigned char *data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHUNKER_H
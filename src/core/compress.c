@@ -0,0 +1,823 @@
+#include "compress.h"
+#include "hash.h"
+#include "alternates.h"
+#include "../utils/config.h"
+#include "../utils/governor.h"
+#include "../include/fractyl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#define COMPRESS_DEFAULT_LEVEL 3
+// Objects up to this size use the trained dictionary. Larger ones compress
+// well on their own and stay readable without the dictionary file.
+#define DICT_MAX_OBJECT_SIZE (128 * 1024)
+// Training looks at small objects only, within a bounded total
+#define TRAIN_MAX_SAMPLE_SIZE (16 * 1024)
+#define TRAIN_MAX_SAMPLES 100000
+#define TRAIN_MAX_TOTAL (64 * 1024 * 1024)
+#define TRAIN_MIN_SAMPLES 8
+// Decoded dictionaries kept in memory
+#define MAX_LOADED_DICTS 64
+#define COPY_BUFFER_SIZE (256 * 1024)
+
+static const unsigned char object_magic[4] = { 0x89, 'F', 'Z', 'O' };
+
+// Settings and dictionaries of the repository used last
+static pthread_mutex_t codec_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    int loaded;
+    char fractyl_dir[2048];
+    uint32_t codec;           // Codec for new objects
+    int level;
+    uint32_t dict_id;         // Dictionary for new small objects, 0 for none
+#ifdef HAVE_ZSTD
+    ZSTD_CDict *cdict;
+    ZSTD_DDict *ddicts[MAX_LOADED_DICTS];
+    uint32_t ddict_ids[MAX_LOADED_DICTS];
+    size_t ddict_count;
+#endif
+} codec_state;
+
+struct object_encoder {
+    int fd;
+    uint32_t codec;
+    uint32_t dict_id;
+    uint64_t total;           // Content bytes written so far
+    int started;              // The first chunk has been seen
+    int bare;                 // Stored as plain content, without a header
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *cctx;
+    void *out_buf;
+    size_t out_size;
+#endif
+};
+
+struct object_decoder {
+    uint32_t codec;
+    uint64_t size;            // Content size from the header
+    uint64_t total;           // Content bytes produced so far
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *dctx;
+#endif
+};
+
+int compress_available(void) {
+#ifdef HAVE_ZSTD
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int object_header_parse(const void *data, size_t size, object_header_t *header) {
+    if (!data || size < OBJECT_HEADER_SIZE || memcmp(data, object_magic, sizeof(object_magic)) != 0) {
+        return 0;
+    }
+    
+    const unsigned char *p = data;
+    if (header) {
+        memcpy(&header->codec, p + 4, sizeof(uint32_t));
+        memcpy(&header->dict_id, p + 8, sizeof(uint32_t));
+        memcpy(&header->hash_algorithm, p + 12, sizeof(uint32_t));
+        memcpy(&header->size, p + 16, sizeof(uint64_t));
+    }
+    return 1;
+}
+
+void object_header_encode(unsigned char *out, const object_header_t *header) {
+    memset(out, 0, OBJECT_HEADER_SIZE);
+    memcpy(out, object_magic, sizeof(object_magic));
+    memcpy(out + 4, &header->codec, sizeof(uint32_t));
+    memcpy(out + 8, &header->dict_id, sizeof(uint32_t));
+    uint32_t algorithm = hash_get_algorithm();
+    memcpy(out + 12, &algorithm, sizeof(uint32_t));
+    memcpy(out + 16, &header->size, sizeof(uint64_t));
+}
+
+static void header_encode(unsigned char *out, uint32_t codec, uint32_t dict_id, uint64_t size) {
+    object_header_t header = { codec, dict_id, size, 0 };
+    object_header_encode(out, &header);
+}
+
+static int write_all(int fd, const void *data, size_t size) {
+    const unsigned char *p = data;
+    governor_write(size);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return FRACTYL_ERROR_IO;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return FRACTYL_OK;
+}
+
+#ifdef HAVE_ZSTD
+static int read_whole_file(const char *path, size_t max_size, void **data_out, size_t *size_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return FRACTYL_ERROR_IO;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size > max_size) {
+        close(fd);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    unsigned char *data = malloc(size ? size : 1);
+    if (!data) {
+        close(fd);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, data + done, size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    close(fd);
+    if (done != size) {
+        free(data);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    *data_out = data;
+    *size_out = size;
+    return FRACTYL_OK;
+}
+#endif
+
+// --- Settings and dictionaries ---
+
+#ifdef HAVE_ZSTD
+static ZSTD_DDict* add_ddict(uint32_t id, const void *dict, size_t size) {
+    if (codec_state.ddict_count >= MAX_LOADED_DICTS) return NULL;
+    ZSTD_DDict *ddict = ZSTD_createDDict(dict, size);
+    if (ddict) {
+        codec_state.ddicts[codec_state.ddict_count] = ddict;
+        codec_state.ddict_ids[codec_state.ddict_count] = id;
+        codec_state.ddict_count++;
+    }
+    return ddict;
+}
+#endif
+
+static void state_clear(void) {
+#ifdef HAVE_ZSTD
+    ZSTD_freeCDict(codec_state.cdict);
+    for (size_t i = 0; i < codec_state.ddict_count; i++) {
+        ZSTD_freeDDict(codec_state.ddicts[i]);
+    }
+#endif
+    memset(&codec_state, 0, sizeof(codec_state));
+}
+
+// Load the current dictionary for compression. Called with codec_lock held.
+static void state_load_dictionary(const char *fractyl_dir) {
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/dicts/current", fractyl_dir);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return;
+    
+    unsigned int id = 0;
+    int parsed = fscanf(fp, "%8x", &id) == 1;
+    fclose(fp);
+    if (!parsed || id == 0) return;
+    
+#ifdef HAVE_ZSTD
+    void *dict;
+    size_t size;
+    snprintf(path, sizeof(path), "%s/dicts/%08x.dict", fractyl_dir, id);
+    if (read_whole_file(path, SIZE_MAX, &dict, &size) != FRACTYL_OK) return;
+    
+    codec_state.cdict = ZSTD_createCDict(dict, size, codec_state.level);
+    if (codec_state.cdict) {
+        codec_state.dict_id = id;
+        add_ddict(id, dict, size);
+    }
+    free(dict);
+#endif
+}
+
+// Make codec_state describe fractyl_dir. Called with codec_lock held.
+static void state_ensure(const char *fractyl_dir) {
+    if (codec_state.loaded && strcmp(codec_state.fractyl_dir, fractyl_dir) == 0) return;
+    
+    state_clear();
+    codec_state.loaded = 1;
+    snprintf(codec_state.fractyl_dir, sizeof(codec_state.fractyl_dir), "%s", fractyl_dir);
+    codec_state.codec = OBJECT_CODEC_RAW;
+    codec_state.level = (int)config_get_long(fractyl_dir, "objects.compression_level", COMPRESS_DEFAULT_LEVEL);
+    
+    char name[32];
+    if (config_get(fractyl_dir, "objects.compression", name, sizeof(name)) == FRACTYL_OK &&
+        strcmp(name, "zstd") == 0) {
+        if (compress_available()) {
+            codec_state.codec = OBJECT_CODEC_ZSTD;
+            state_load_dictionary(fractyl_dir);
+        } else {
+            fprintf(stderr, "Warning: objects.compression = zstd ignored, built without zstd\n");
+        }
+    }
+}
+
+int compress_enabled(const char *fractyl_dir) {
+    if (!fractyl_dir) return 0;
+    
+    pthread_mutex_lock(&codec_lock);
+    state_ensure(fractyl_dir);
+    int enabled = codec_state.codec != OBJECT_CODEC_RAW;
+    pthread_mutex_unlock(&codec_lock);
+    return enabled;
+}
+
+void compress_cache_invalidate(void) {
+    pthread_mutex_lock(&codec_lock);
+    state_clear();
+    pthread_mutex_unlock(&codec_lock);
+}
+
+#ifdef HAVE_ZSTD
+// Dictionary id for decompression, loaded on first use
+static ZSTD_DDict* get_ddict(const char *fractyl_dir, uint32_t id) {
+    pthread_mutex_lock(&codec_lock);
+    state_ensure(fractyl_dir);
+    
+    ZSTD_DDict *ddict = NULL;
+    for (size_t i = 0; i < codec_state.ddict_count && !ddict; i++) {
+        if (codec_state.ddict_ids[i] == id) ddict = codec_state.ddicts[i];
+    }
+    if (!ddict) {
+        char path[2048];
+        void *dict;
+        size_t size;
+        snprintf(path, sizeof(path), "%s/dicts/%08x.dict", fractyl_dir, id);
+        int found = read_whole_file(path, SIZE_MAX, &dict, &size) == FRACTYL_OK;
+    
+        // Objects found in a shared store were encoded with its dictionaries
+        const char *const *stores;
+        size_t count = found ? 0 : alternates_list(fractyl_dir, &stores);
+        for (size_t i = 0; i < count && !found; i++) {
+            snprintf(path, sizeof(path), "%s/dicts/%08x.dict", stores[i], id);
+            found = read_whole_file(path, SIZE_MAX, &dict, &size) == FRACTYL_OK;
+        }
+        if (found) {
+            ddict = add_ddict(id, dict, size);
+            free(dict);
+        }
+    }
+    
+    pthread_mutex_unlock(&codec_lock);
+    return ddict;
+}
+#endif
+
+// --- Encoding ---
+
+int object_encoder_new(const char *fractyl_dir, int out_fd, uint64_t size_hint,
+                       object_encoder_t **encoder_out) {
+    if (!fractyl_dir || out_fd < 0 || !encoder_out) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    object_encoder_t *encoder = calloc(1, sizeof(*encoder));
+    if (!encoder) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    encoder->fd = out_fd;
+    
+    pthread_mutex_lock(&codec_lock);
+    state_ensure(fractyl_dir);
+    encoder->codec = codec_state.codec;
+    int level = codec_state.level;
+#ifdef HAVE_ZSTD
+    ZSTD_CDict *cdict = size_hint <= DICT_MAX_OBJECT_SIZE ? codec_state.cdict : NULL;
+    if (cdict) encoder->dict_id = codec_state.dict_id;
+#else
+    (void)size_hint;
+    (void)level;
+#endif
+    pthread_mutex_unlock(&codec_lock);
+    
+#ifdef HAVE_ZSTD
+    if (encoder->codec == OBJECT_CODEC_ZSTD) {
+        encoder->cctx = ZSTD_createCCtx();
+        encoder->out_size = ZSTD_CStreamOutSize();
+        encoder->out_buf = malloc(encoder->out_size);
+        if (!encoder->cctx || !encoder->out_buf) {
+            object_encoder_free(encoder);
+            return FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+        if (cdict) {
+            ZSTD_CCtx_refCDict(encoder->cctx, cdict);
+        } else {
+            ZSTD_CCtx_setParameter(encoder->cctx, ZSTD_c_compressionLevel, level);
+        }
+    }
+#endif
+    
+    // Placeholder until the final size is known
+    unsigned char header[OBJECT_HEADER_SIZE];
+    header_encode(header, encoder->codec, encoder->dict_id, 0);
+    int result = write_all(out_fd, header, sizeof(header));
+    if (result != FRACTYL_OK) {
+        object_encoder_free(encoder);
+        return result;
+    }
+    
+    *encoder_out = encoder;
+    return FRACTYL_OK;
+}
+
+#ifdef HAVE_ZSTD
+static int compress_stream(object_encoder_t *encoder, const void *data, size_t size, ZSTD_EndDirective mode) {
+    ZSTD_inBuffer in = { data, size, 0 };
+    int finished;
+    do {
+        ZSTD_outBuffer out = { encoder->out_buf, encoder->out_size, 0 };
+        size_t remaining = ZSTD_compressStream2(encoder->cctx, &out, &in, mode);
+        if (ZSTD_isError(remaining)) return FRACTYL_ERROR_GENERIC;
+        if (write_all(encoder->fd, encoder->out_buf, out.pos) != FRACTYL_OK) return FRACTYL_ERROR_IO;
+        finished = mode == ZSTD_e_continue ? in.pos == in.size : remaining == 0;
+    } while (!finished);
+    return FRACTYL_OK;
+}
+
+// Compress the first chunk on its own to see whether compression pays.
+// Content that barely shrinks (already compressed media, archives, tiny
+// files) is stored raw instead, without a header where possible.
+static int compress_first_chunk(object_encoder_t *encoder, const void *data, size_t size) {
+    size_t bound = ZSTD_compressBound(size);
+    void *scratch = malloc(bound);
+    if (!scratch) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    ZSTD_inBuffer in = { data, size, 0 };
+    ZSTD_outBuffer out = { scratch, bound, 0 };
+    size_t remaining = ZSTD_compressStream2(encoder->cctx, &out, &in, ZSTD_e_flush);
+    
+    int result;
+    if (ZSTD_isError(remaining) || remaining != 0 || out.pos + OBJECT_HEADER_SIZE >= size - size / 32) {
+        ZSTD_freeCCtx(encoder->cctx);
+        encoder->cctx = NULL;
+        encoder->codec = OBJECT_CODEC_RAW;
+        encoder->dict_id = 0;
+        // Only the placeholder header has been written so far
+        if (!object_header_parse(data, size, NULL) && ftruncate(encoder->fd, 0) == 0 &&
+            lseek(encoder->fd, 0, SEEK_SET) == 0) {
+            encoder->bare = 1;
+        }
+        result = write_all(encoder->fd, data, size);
+    } else {
+        result = write_all(encoder->fd, scratch, out.pos);
+    }
+    free(scratch);
+    return result;
+}
+#endif
+
+int object_encoder_write(object_encoder_t *encoder, const void *data, size_t size) {
+    if (!encoder || (!data && size > 0)) return FRACTYL_ERROR_INVALID_ARGS;
+    if (size == 0) return FRACTYL_OK;
+    
+    int first = !encoder->started;
+    encoder->started = 1;
+    encoder->total += size;
+    
+#ifdef HAVE_ZSTD
+    if (encoder->codec == OBJECT_CODEC_ZSTD) {
+        return first ? compress_first_chunk(encoder, data, size)
+                     : compress_stream(encoder, data, size, ZSTD_e_continue);
+    }
+#else
+    (void)first;
+#endif
+    return write_all(encoder->fd, data, size);
+}
+
+int object_encoder_finish(object_encoder_t *encoder) {
+    if (!encoder) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    int result = FRACTYL_OK;
+#ifdef HAVE_ZSTD
+    if (encoder->codec == OBJECT_CODEC_ZSTD) {
+        if (encoder->started) {
+            result = compress_stream(encoder, NULL, 0, ZSTD_e_end);
+        } else {
+            // Empty content is stored as an empty file
+            encoder->codec = OBJECT_CODEC_RAW;
+            encoder->dict_id = 0;
+            encoder->bare = ftruncate(encoder->fd, 0) == 0;
+        }
+    }
+#endif
+    
+    if (result == FRACTYL_OK && !encoder->bare) {
+        unsigned char header[OBJECT_HEADER_SIZE];
+        header_encode(header, encoder->codec, encoder->dict_id, encoder->total);
+        if (pwrite(encoder->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+            result = FRACTYL_ERROR_IO;
+        }
+    }
+    
+    object_encoder_free(encoder);
+    return result;
+}
+
+void object_encoder_free(object_encoder_t *encoder) {
+    if (!encoder) return;
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(encoder->cctx);
+    free(encoder->out_buf);
+#endif
+    free(encoder);
+}
+
+// --- Decoding ---
+
+int object_decode_buffer(const char *fractyl_dir, const void *data, size_t size,
+                         void **data_out, size_t *size_out) {
+    object_header_t header;
+    if (!fractyl_dir || !data_out || !size_out || !object_header_parse(data, size, &header)) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    if (header.size > SIZE_MAX - 1) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    const unsigned char *payload = (const unsigned char *)data + OBJECT_HEADER_SIZE;
+    size_t payload_size = size - OBJECT_HEADER_SIZE;
+    if (header.codec != OBJECT_CODEC_RAW && header.codec != OBJECT_CODEC_ZSTD) {
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    if (header.codec == OBJECT_CODEC_RAW && payload_size != header.size) {
+        return FRACTYL_ERROR_IO;
+    }
+#ifndef HAVE_ZSTD
+    if (header.codec == OBJECT_CODEC_ZSTD) return FRACTYL_ERROR_INVALID_STATE;
+#endif
+    
+    void *out = malloc(header.size ? (size_t)header.size : 1);
+    if (!out) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    int result = FRACTYL_OK;
+    if (header.codec == OBJECT_CODEC_RAW) {
+        memcpy(out, payload, payload_size);
+    }
+#ifdef HAVE_ZSTD
+    else {
+        ZSTD_DDict *ddict = header.dict_id ? get_ddict(fractyl_dir, header.dict_id) : NULL;
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+        if (header.dict_id && !ddict) {
+            result = FRACTYL_ERROR_NOT_FOUND;
+        } else if (!dctx) {
+            result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        } else {
+            size_t n = ddict
+                ? ZSTD_decompress_usingDDict(dctx, out, (size_t)header.size, payload, payload_size, ddict)
+                : ZSTD_decompressDCtx(dctx, out, (size_t)header.size, payload, payload_size);
+            if (ZSTD_isError(n) || n != header.size) result = FRACTYL_ERROR_IO;
+        }
+        ZSTD_freeDCtx(dctx);
+    }
+#endif
+    
+    if (result != FRACTYL_OK) {
+        free(out);
+        return result;
+    }
+    *data_out = out;
+    *size_out = (size_t)header.size;
+    return FRACTYL_OK;
+}
+
+static int copy_raw_fd(int in_fd, int out_fd, uint64_t *total) {
+    unsigned char *buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    int result = FRACTYL_OK;
+    while (result == FRACTYL_OK) {
+        ssize_t n = read(in_fd, buffer, COPY_BUFFER_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = FRACTYL_ERROR_IO;
+            break;
+        }
+        if (n == 0) break;
+        *total += (uint64_t)n;
+        result = write_all(out_fd, buffer, (size_t)n);
+    }
+    free(buffer);
+    return result;
+}
+
+#ifdef HAVE_ZSTD
+static int decompress_fd(const char *fractyl_dir, const object_header_t *header, int in_fd, int out_fd,
+                         uint64_t *total) {
+    ZSTD_DDict *ddict = header->dict_id ? get_ddict(fractyl_dir, header->dict_id) : NULL;
+    if (header->dict_id && !ddict) return FRACTYL_ERROR_NOT_FOUND;
+    
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    size_t in_size = ZSTD_DStreamInSize();
+    size_t out_size = ZSTD_DStreamOutSize();
+    void *in_buf = malloc(in_size);
+    void *out_buf = malloc(out_size);
+    int result = dctx && in_buf && out_buf ? FRACTYL_OK : FRACTYL_ERROR_OUT_OF_MEMORY;
+    if (result == FRACTYL_OK && ddict) {
+        ZSTD_DCtx_refDDict(dctx, ddict);
+    }
+    
+    size_t pending = 1;    // Nonzero until a frame has been completed
+    while (result == FRACTYL_OK) {
+        ssize_t n = read(in_fd, in_buf, in_size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = FRACTYL_ERROR_IO;
+            break;
+        }
+        if (n == 0) break;
+    
+        ZSTD_inBuffer in = { in_buf, (size_t)n, 0 };
+        while (in.pos < in.size && result == FRACTYL_OK) {
+            ZSTD_outBuffer out = { out_buf, out_size, 0 };
+            pending = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(pending)) {
+                result = FRACTYL_ERROR_IO;
+                break;
+            }
+            *total += out.pos;
+            result = write_all(out_fd, out_buf, out.pos);
+        }
+    }
+    if (result == FRACTYL_OK && pending != 0) {
+        result = FRACTYL_ERROR_IO; // Truncated frame
+    }
+    
+    ZSTD_freeDCtx(dctx);
+    free(in_buf);
+    free(out_buf);
+    return result;
+}
+#endif
+
+int object_decode_fd(const char *fractyl_dir, const object_header_t *header, int in_fd, int out_fd) {
+    if (!fractyl_dir || !header) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    uint64_t total = 0;
+    int result;
+    if (header->codec == OBJECT_CODEC_RAW) {
+        result = copy_raw_fd(in_fd, out_fd, &total);
+    }
+#ifdef HAVE_ZSTD
+    else if (header->codec == OBJECT_CODEC_ZSTD) {
+        result = decompress_fd(fractyl_dir, header, in_fd, out_fd, &total);
+    }
+#endif
+    else {
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    
+    if (result == FRACTYL_OK && total != header->size) {
+        result = FRACTYL_ERROR_IO;
+    }
+    return result;
+}
+
+int object_decoder_new(const char *fractyl_dir, const object_header_t *header,
+                       object_decoder_t **decoder_out) {
+    if (!fractyl_dir || !header || !decoder_out) return FRACTYL_ERROR_INVALID_ARGS;
+    if (header->codec != OBJECT_CODEC_RAW && header->codec != OBJECT_CODEC_ZSTD) {
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+#ifndef HAVE_ZSTD
+    if (header->codec == OBJECT_CODEC_ZSTD) return FRACTYL_ERROR_INVALID_STATE;
+#endif
+    
+    object_decoder_t *decoder = calloc(1, sizeof(*decoder));
+    if (!decoder) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    decoder->codec = header->codec;
+    decoder->size = header->size;
+#ifdef HAVE_ZSTD
+    if (header->codec == OBJECT_CODEC_ZSTD) {
+        ZSTD_DDict *ddict = header->dict_id ? get_ddict(fractyl_dir, header->dict_id) : NULL;
+        if (header->dict_id && !ddict) {
+            free(decoder);
+            return FRACTYL_ERROR_NOT_FOUND;
+        }
+        decoder->dctx = ZSTD_createDCtx();
+        if (!decoder->dctx) {
+            free(decoder);
+            return FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+        if (ddict) ZSTD_DCtx_refDDict(decoder->dctx, ddict);
+    }
+#endif
+    *decoder_out = decoder;
+    return FRACTYL_OK;
+}
+
+int object_decoder_decode(object_decoder_t *decoder, const void *in, size_t in_size, size_t *consumed_out,
+                          void *out, size_t out_size, size_t *produced_out) {
+    if (!decoder || (!in && in_size) || !consumed_out || (!out && out_size) || !produced_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    size_t consumed = 0, produced = 0;
+    if (decoder->codec == OBJECT_CODEC_RAW) {
+        consumed = produced = in_size < out_size ? in_size : out_size;
+        memcpy(out, in, produced);
+    }
+#ifdef HAVE_ZSTD
+    else {
+        ZSTD_inBuffer in_buf = { in, in_size, 0 };
+        ZSTD_outBuffer out_buf = { out, out_size, 0 };
+        size_t pending = ZSTD_decompressStream(decoder->dctx, &out_buf, &in_buf);
+        if (ZSTD_isError(pending)) return FRACTYL_ERROR_IO;
+        consumed = in_buf.pos;
+        produced = out_buf.pos;
+    }
+#endif
+    
+    decoder->total += produced;
+    if (decoder->total > decoder->size) return FRACTYL_ERROR_IO;
+    *consumed_out = consumed;
+    *produced_out = produced;
+    return FRACTYL_OK;
+}
+
+void object_decoder_free(object_decoder_t *decoder) {
+    if (!decoder) return;
+#ifdef HAVE_ZSTD
+    ZSTD_freeDCtx(decoder->dctx);
+#endif
+    free(decoder);
+}
+
+// --- Dictionary training ---
+
+#ifdef HAVE_ZSTD
+typedef struct {
+    unsigned char *data;
+    size_t used;
+    size_t capacity;
+    size_t *sizes;
+    size_t count;
+} sample_set_t;
+
+static int sample_set_add(sample_set_t *set, const void *data, size_t size) {
+    if (set->used + size > set->capacity) {
+        size_t capacity = set->capacity ? set->capacity : 1024 * 1024;
+        while (capacity < set->used + size) capacity *= 2;
+        unsigned char *grown = realloc(set->data, capacity);
+        if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        set->data = grown;
+        set->capacity = capacity;
+    }
+    if (set->count % 1024 == 0) {
+        size_t *grown = realloc(set->sizes, (set->count + 1024) * sizeof(size_t));
+        if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        set->sizes = grown;
+    }
+    memcpy(set->data + set->used, data, size);
+    set->used += size;
+    set->sizes[set->count++] = size;
+    return FRACTYL_OK;
+}
+
+// Add the small loose objects below objects_dir/<fanout>/ to the samples
+static int collect_samples(const char *fractyl_dir, const char *fanout_path, sample_set_t *set) {
+    DIR *d = opendir(fanout_path);
+    if (!d) return FRACTYL_OK;
+    
+    int result = FRACTYL_OK;
+    struct dirent *entry;
+    while (result == FRACTYL_OK && (entry = readdir(d)) != NULL &&
+           set->count < TRAIN_MAX_SAMPLES && set->used < TRAIN_MAX_TOTAL) {
+        if (entry->d_name[0] == '.' || strncmp(entry->d_name, "tmp_", 4) == 0) continue;
+    
+        char path[2048];
+        snprintf(path, sizeof(path), "%s/%s", fanout_path, entry->d_name);
+        void *data;
+        size_t size;
+        if (read_whole_file(path, TRAIN_MAX_SAMPLE_SIZE + OBJECT_HEADER_SIZE, &data, &size) != FRACTYL_OK) {
+            continue;
+        }
+    
+        void *content = data;
+        size_t content_size = size;
+        if (object_header_parse(data, size, NULL) &&
+            object_decode_buffer(fractyl_dir, data, size, &content, &content_size) != FRACTYL_OK) {
+            content = NULL;
+        }
+        if (content && content_size > 0 && content_size <= TRAIN_MAX_SAMPLE_SIZE) {
+            result = sample_set_add(set, content, content_size);
+        }
+        if (content != data) free(content);
+        free(data);
+    }
+    closedir(d);
+    return result;
+}
+
+// Write data to path through a temporary file
+static int write_file_atomic(const char *path, const void *data, size_t size) {
+    char temp_path[2100];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return FRACTYL_ERROR_IO;
+    
+    int result = write_all(fd, data, size);
+    if (close(fd) != 0 && result == FRACTYL_OK) result = FRACTYL_ERROR_IO;
+    if (result == FRACTYL_OK && rename(temp_path, path) != 0) result = FRACTYL_ERROR_IO;
+    if (result != FRACTYL_OK) unlink(temp_path);
+    return result;
+}
+#endif
+
+int compress_train_dictionary(const char *fractyl_dir, size_t dict_size,
+                              compress_train_stats_t *stats) {
+    if (!fractyl_dir || dict_size == 0) return FRACTYL_ERROR_INVALID_ARGS;
+    if (stats) memset(stats, 0, sizeof(*stats));
+    
+#ifndef HAVE_ZSTD
+    return FRACTYL_ERROR_INVALID_STATE;
+#else
+    char objects_dir[2048];
+    snprintf(objects_dir, sizeof(objects_dir), "%s/objects", fractyl_dir);
+    DIR *d = opendir(objects_dir);
+    if (!d) return FRACTYL_ERROR_NOT_FOUND;
+    
+    sample_set_t set;
+    memset(&set, 0, sizeof(set));
+    int result = FRACTYL_OK;
+    struct dirent *fanout;
+    while (result == FRACTYL_OK && (fanout = readdir(d)) != NULL) {
+        if (strlen(fanout->d_name) != 2 || fanout->d_name[0] == '.') continue;
+        char fanout_path[2048];
+        snprintf(fanout_path, sizeof(fanout_path), "%s/%s", objects_dir, fanout->d_name);
+        result = collect_samples(fractyl_dir, fanout_path, &set);
+    }
+    closedir(d);
+    
+    void *dict = NULL;
+    size_t trained = 0;
+    if (result == FRACTYL_OK && set.count < TRAIN_MIN_SAMPLES) {
+        result = FRACTYL_ERROR_NOT_FOUND;
+    }
+    if (result == FRACTYL_OK) {
+        dict = malloc(dict_size);
+        if (!dict) {
+            result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        } else {
+            trained = ZDICT_trainFromBuffer(dict, dict_size, set.data, set.sizes, (unsigned)set.count);
+            // Training fails when the samples are too few or too uniform
+            if (ZDICT_isError(trained)) result = FRACTYL_ERROR_NOT_FOUND;
+        }
+    }
+    
+    uint32_t id = result == FRACTYL_OK ? ZDICT_getDictID(dict, trained) : 0;
+    if (result == FRACTYL_OK && id == 0) result = FRACTYL_ERROR_GENERIC;
+    
+    if (result == FRACTYL_OK) {
+        char path[2048];
+        snprintf(path, sizeof(path), "%s/dicts", fractyl_dir);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            result = FRACTYL_ERROR_IO;
+        }
+    
+        // The dictionary itself first; only then point new objects at it
+        if (result == FRACTYL_OK) {
+            snprintf(path, sizeof(path), "%s/dicts/%08x.dict", fractyl_dir, id);
+            result = write_file_atomic(path, dict, trained);
+        }
+        if (result == FRACTYL_OK) {
+            char current[16];
+            int len = snprintf(current, sizeof(current), "%08x\n", id);
+            snprintf(path, sizeof(path), "%s/dicts/current", fractyl_dir);
+            result = write_file_atomic(path, current, (size_t)len);
+        }
+    }
+    
+    if (result == FRACTYL_OK && stats) {
+        stats->samples = set.count;
+        stats->sample_bytes = set.used;
+        stats->dict_size = trained;
+        stats->dict_id = id;
+    }
+    
+    free(dict);
+    free(set.data);
+    free(set.sizes);
+    compress_cache_invalidate();
+    return result;
+#endif
+}
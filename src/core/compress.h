@@ -0,0 +1,112 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "../include/fractyl.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Stored objects (loose files and pack entries) may start with a 24-byte header describing how the rest
+// of the file is encoded:
+//
+//   "\x89FZO", u32 codec, u32 dictionary id (0 = none), u32 hash
+//   algorithm of the object's name (see hash.h), u64 size of the decoded
+//   content
+//
+// Objects without the header are raw content, as written by older
+// versions. Raw content that happens to begin with the magic is stored
+// behind a header with OBJECT_CODEC_RAW so it cannot be misread.
+//
+// Compression is chosen in .fractyl/config:
+//   objects.compression = zstd|none   (default none)
+//   objects.compression_level = N     (default 3)
+// Small objects are compressed with the dictionary named in
+// .fractyl/dicts/current, if one was trained with 'frac train-dict'.
+
+#define OBJECT_HEADER_SIZE 24
+
+typedef enum {
+    OBJECT_CODEC_RAW = 0,
+    OBJECT_CODEC_ZSTD = 1,
+    OBJECT_CODEC_CHUNKED = 2,     // Chunk list of a large file, see objects.h
+    OBJECT_CODEC_DELTA = 3        // Delta against another object, see objects.h
+} object_codec_t;
+
+typedef struct {
+    uint32_t codec;
+    uint32_t dict_id;
+    uint64_t size;
+    uint32_t hash_algorithm;  // Filled in by parsing; encoding records the current one
+} object_header_t;
+
+typedef struct {
+    size_t samples;           // Objects used as training samples
+    size_t sample_bytes;      // Their total size
+    size_t dict_size;         // Size of the trained dictionary
+    uint32_t dict_id;
+} compress_train_stats_t;
+
+// Nonzero if this build can read and write zstd objects
+int compress_available(void);
+
+// Parse the header at the start of a stored object
+// Returns 1 if data starts with a header, 0 for raw content
+int object_header_parse(const void *data, size_t size, object_header_t *header);
+
+// Fill out (OBJECT_HEADER_SIZE bytes) with the header for header
+void object_header_encode(unsigned char *out, const object_header_t *header);
+
+// Nonzero if new objects are to be compressed
+int compress_enabled(const char *fractyl_dir);
+
+// Encoder writing one object to out_fd, which must be an empty regular
+// file: the header is rewritten in place once the content is complete.
+// size_hint is the expected content size (selects the dictionary).
+typedef struct object_encoder object_encoder_t;
+
+int object_encoder_new(const char *fractyl_dir, int out_fd, uint64_t size_hint,
+                       object_encoder_t **encoder_out);
+int object_encoder_write(object_encoder_t *encoder, const void *data, size_t size);
+// Flush, write the final header and free the encoder
+int object_encoder_finish(object_encoder_t *encoder);
+void object_encoder_free(object_encoder_t *encoder);
+
+// Decode a stored object that starts with a header into a new buffer (caller frees)
+// Returns FRACTYL_ERROR_INVALID_STATE for zstd objects in builds without
+// zstd and for chunked and delta objects, which objects.c assembles itself
+int object_decode_buffer(const char *fractyl_dir, const void *data, size_t size,
+                         void **data_out, size_t *size_out);
+
+// Stream the content following header from in_fd (positioned just past
+// the header) to out_fd
+int object_decode_fd(const char *fractyl_dir, const object_header_t *header, int in_fd, int out_fd);
+
+// Decoder for the payload of a stored object (what follows its header),
+// fed as it is read: each call consumes some of in and produces some
+// content, so neither needs to be in memory whole. Only raw and zstd
+// payloads; chunked and delta objects are assembled by objects.c.
+typedef struct object_decoder object_decoder_t;
+
+int object_decoder_new(const char *fractyl_dir, const object_header_t *header,
+                       object_decoder_t **decoder_out);
+int object_decoder_decode(object_decoder_t *decoder, const void *in, size_t in_size, size_t *consumed_out,
+                          void *out, size_t out_size, size_t *produced_out);
+void object_decoder_free(object_decoder_t *decoder);
+
+// Train a dictionary of about dict_size bytes from the small loose objects
+// and make it the one new objects are compressed with
+// Returns FRACTYL_ERROR_NOT_FOUND when there are too few samples
+int compress_train_dictionary(const char *fractyl_dir, size_t dict_size,
+                              compress_train_stats_t *stats);
+
+// Forget cached settings and dictionaries
+void compress_cache_invalidate(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COMPRESS_H
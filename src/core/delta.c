@@ -0,0 +1,188 @@
+#include "delta.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Matches are found through a table of the base's aligned 16-byte blocks;
+// the target is scanned with a rolling hash over the same window size
+#define DELTA_BLOCK 16
+#define DELTA_MULT 0x01000193u
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+    size_t limit;
+} delta_buf_t;
+
+static int buf_reserve(delta_buf_t *buf, size_t extra) {
+    if (extra > buf->limit || buf->size > buf->limit - extra) return FRACTYL_ERROR_NOT_FOUND;
+    if (buf->size + extra <= buf->capacity) return FRACTYL_OK;
+    
+    size_t capacity = buf->capacity ? buf->capacity : 256;
+    while (capacity < buf->size + extra) capacity *= 2;
+    unsigned char *grown = realloc(buf->data, capacity);
+    if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    buf->data = grown;
+    buf->capacity = capacity;
+    return FRACTYL_OK;
+}
+
+static int put_varint(delta_buf_t *buf, uint64_t value) {
+    int result = buf_reserve(buf, 10);
+    if (result != FRACTYL_OK) return result;
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        buf->data[buf->size++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return FRACTYL_OK;
+}
+
+static int get_varint(const unsigned char **pos, const unsigned char *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pos >= end) return 0;
+        unsigned char byte = *(*pos)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int put_insert(delta_buf_t *buf, const unsigned char *data, size_t size) {
+    if (size == 0) return FRACTYL_OK;
+    int result = buf_reserve(buf, 1);
+    if (result == FRACTYL_OK) {
+        buf->data[buf->size++] = DELTA_OP_INSERT;
+        result = put_varint(buf, size);
+    }
+    if (result == FRACTYL_OK) result = buf_reserve(buf, size);
+    if (result == FRACTYL_OK) {
+        memcpy(buf->data + buf->size, data, size);
+        buf->size += size;
+    }
+    return result;
+}
+
+static int put_copy(delta_buf_t *buf, size_t offset, size_t size) {
+    int result = buf_reserve(buf, 1);
+    if (result == FRACTYL_OK) {
+        buf->data[buf->size++] = DELTA_OP_COPY;
+        result = put_varint(buf, offset);
+    }
+    if (result == FRACTYL_OK) result = put_varint(buf, size);
+    return result;
+}
+
+static uint32_t block_hash(const unsigned char *data) {
+    uint32_t h = 0;
+    for (int i = 0; i < DELTA_BLOCK; i++) {
+        h = h * DELTA_MULT + data[i];
+    }
+    return h;
+}
+
+int delta_create(const unsigned char *base, size_t base_size,
+                 const unsigned char *target, size_t target_size, size_t max_size,
+                 unsigned char **delta_out, size_t *delta_size_out) {
+    if ((!base && base_size) || (!target && target_size) || !delta_out || !delta_size_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    // Table slots hold block offset + 1; the first block of a hash wins
+    size_t blocks = base_size <= UINT32_MAX - DELTA_BLOCK ? base_size / DELTA_BLOCK : 0;
+    size_t slots = 16;
+    while (slots < blocks * 2) slots *= 2;
+    uint32_t *table = calloc(slots, sizeof(uint32_t));
+    if (!table) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    for (size_t b = 0; b < blocks; b++) {
+        uint32_t slot = block_hash(base + b * DELTA_BLOCK) & (uint32_t)(slots - 1);
+        if (!table[slot]) table[slot] = (uint32_t)(b * DELTA_BLOCK) + 1;
+    }
+    
+    // Weight of the byte leaving the window
+    uint32_t out_weight = 1;
+    for (int i = 1; i < DELTA_BLOCK; i++) out_weight *= DELTA_MULT;
+    
+    delta_buf_t buf = { NULL, 0, 0, max_size };
+    int result = put_varint(&buf, base_size);
+    if (result == FRACTYL_OK) result = put_varint(&buf, target_size);
+    
+    size_t literal = 0, i = 0;
+    uint32_t h = target_size >= DELTA_BLOCK ? block_hash(target) : 0;
+    while (result == FRACTYL_OK && blocks > 0 && i + DELTA_BLOCK <= target_size) {
+        uint32_t slot = table[h & (uint32_t)(slots - 1)];
+        size_t b = slot ? slot - 1 : 0;
+        if (slot && memcmp(base + b, target + i, DELTA_BLOCK) == 0) {
+            size_t start = i, len = DELTA_BLOCK;
+            while (start + len < target_size && b + len < base_size && target[start + len] == base[b + len]) {
+                len++;
+            }
+            // Grow backwards into the pending literal
+            while (start > literal && b > 0 && target[start - 1] == base[b - 1]) {
+                start--;
+                b--;
+                len++;
+            }
+            result = put_insert(&buf, target + literal, start - literal);
+            if (result == FRACTYL_OK) result = put_copy(&buf, b, len);
+            i = literal = start + len;
+            if (i + DELTA_BLOCK <= target_size) h = block_hash(target + i);
+            continue;
+        }
+        if (i + DELTA_BLOCK < target_size) {
+            h = (h - target[i] * out_weight) * DELTA_MULT + target[i + DELTA_BLOCK];
+        }
+        i++;
+    }
+    free(table);
+    if (result == FRACTYL_OK) result = put_insert(&buf, target + literal, target_size - literal);
+    
+    if (result != FRACTYL_OK) {
+        free(buf.data);
+        return result;
+    }
+    *delta_out = buf.data;
+    *delta_size_out = buf.size;
+    return FRACTYL_OK;
+}
+
+int delta_apply(const unsigned char *base, size_t base_size,
+                const unsigned char *delta, size_t delta_size,
+                unsigned char *out, size_t out_size) {
+    if ((!base && base_size) || !delta || (!out && out_size)) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    const unsigned char *pos = delta, *end = delta + delta_size;
+    uint64_t expect_base, expect_target;
+    if (!get_varint(&pos, end, &expect_base) || !get_varint(&pos, end, &expect_target) ||
+        expect_base != base_size || expect_target != out_size) {
+        return FRACTYL_ERROR_IO;
+    }
+    
+    size_t written = 0;
+    while (pos < end) {
+        unsigned char op = *pos++;
+        uint64_t offset = 0, len;
+        if (op == DELTA_OP_COPY) {
+            if (!get_varint(&pos, end, &offset) || !get_varint(&pos, end, &len) ||
+                offset > base_size || len > base_size - offset || len > out_size - written) {
+                return FRACTYL_ERROR_IO;
+            }
+            memcpy(out + written, base + offset, (size_t)len);
+        } else if (op == DELTA_OP_INSERT) {
+            if (!get_varint(&pos, end, &len) || len > (uint64_t)(end - pos) || len > out_size - written) {
+                return FRACTYL_ERROR_IO;
+            }
+            memcpy(out + written, pos, (size_t)len);
+            pos += len;
+        } else {
+            return FRACTYL_ERROR_IO;
+        }
+        written += (size_t)len;
+    }
+    return written == out_size ? FRACTYL_OK : FRACTYL_ERROR_IO;
+}
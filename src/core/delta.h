@@ -0,0 +1,39 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "../include/fractyl.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Binary deltas: a target buffer described as copies from a base buffer
+// and literal inserts.
+//
+//   varint base size, varint target size, then instructions:
+//     0x01 varint offset, varint length    copy length bytes of the base
+//     0x02 varint length, bytes            insert the bytes
+//
+// Varints are little endian base-128, seven bits per byte.
+
+#define DELTA_OP_COPY 0x01
+#define DELTA_OP_INSERT 0x02
+
+// Describe target in terms of base in a new buffer (caller frees)
+// Returns FRACTYL_ERROR_NOT_FOUND if the delta would exceed max_size
+int delta_create(const unsigned char *base, size_t base_size,
+                 const unsigned char *target, size_t target_size, size_t max_size,
+                 unsigned char **delta_out, size_t *delta_size_out);
+
+// Rebuild the target into out, which holds exactly out_size bytes
+// Returns FRACTYL_ERROR_IO if the delta does not fit base and out_size
+int delta_apply(const unsigned char *base, size_t base_size,
+                const unsigned char *delta, size_t delta_size,
+                unsigned char *out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DELTA_H
@@ -0,0 +1,480 @@
+#include "fsck.h"
+#include "gc.h"
+#include "hash.h"
+#include "index.h"
+#include "objects.h"
+#include "../include/core.h"
+#include "../utils/catalog.h"
+#include "../utils/config.h"
+#include "../utils/governor.h"
+#include "../utils/paths.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FSCK_MAX_THREADS 16
+#define FSCK_BUFFER_SIZE (256 * 1024)
+
+struct fsck_scrub {
+    char fractyl_dir[2048];
+    int marked;                 // reachable holds the objects of the pass in progress
+    gc_reachable_t reachable;
+};
+
+// Hashes of objects found missing or corrupt
+typedef struct {
+    unsigned char *items;
+    size_t count;
+    size_t capacity;
+} problem_list_t;
+
+static int problem_add(problem_list_t *list, const unsigned char *hash) {
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 16;
+        unsigned char *grown = realloc(list->items, new_capacity * FRACTYL_HASH_SIZE);
+        if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        list->items = grown;
+        list->capacity = new_capacity;
+    }
+    memcpy(list->items + list->count++ * FRACTYL_HASH_SIZE, hash, FRACTYL_HASH_SIZE);
+    return FRACTYL_OK;
+}
+
+static int compare_hashes(const void *a, const void *b) {
+    return memcmp(a, b, FRACTYL_HASH_SIZE);
+}
+
+static void report(const fsck_options_t *options, fsck_problem_t problem, const char *name) {
+    if (options->report) options->report(problem, name, options->report_ctx);
+}
+
+static void report_hash(const fsck_options_t *options, fsck_problem_t problem, const unsigned char *hash) {
+    char hex[FRACTYL_HASH_HEX_SIZE];
+    hash_to_string(hash, hex);
+    report(options, problem, hex);
+}
+
+// --- Reading objects back ---
+
+typedef struct {
+    const char *fractyl_dir;
+    const unsigned char *hashes;
+    size_t end;                 // Check the hashes before it
+    size_t next;                // Next to claim, atomically
+    uint64_t max_bytes;         // Claim nothing more once this much was read; 0 for no limit
+    uint64_t bytes;             // Read so far, atomically
+    size_t checked;             // Atomically
+    pthread_mutex_t lock;       // Over the problem lists
+    problem_list_t missing;
+    problem_list_t corrupt;
+    int result;
+} check_job_t;
+
+// FRACTYL_OK if hash reads back as content hashing to it, NOT_FOUND if it
+// is stored nowhere, HASH_MISMATCH otherwise
+static int check_object(const char *fractyl_dir, const unsigned char *hash, unsigned char *buffer,
+                        uint64_t *bytes) {
+    object_reader_t *reader;
+    int result = object_reader_open(hash, fractyl_dir, &reader);
+    if (result == FRACTYL_ERROR_OUT_OF_MEMORY) return result;
+    if (result != FRACTYL_OK) {
+        return object_exists(hash, fractyl_dir) ? FRACTYL_ERROR_HASH_MISMATCH : FRACTYL_ERROR_NOT_FOUND;
+    }
+    
+    hash_ctx_t *ctx = hash_ctx_new();
+    if (!ctx) {
+        object_reader_close(reader);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    ssize_t n;
+    while ((n = object_reader_read(reader, buffer, FSCK_BUFFER_SIZE)) > 0) {
+        governor_read((size_t)n);
+        *bytes += (uint64_t)n;
+        hash_ctx_update(ctx, buffer, (size_t)n);
+    }
+    object_reader_close(reader);
+    if (n < 0) {
+        hash_ctx_free(ctx);
+        return n == FRACTYL_ERROR_OUT_OF_MEMORY ? FRACTYL_ERROR_OUT_OF_MEMORY : FRACTYL_ERROR_HASH_MISMATCH;
+    }
+    
+    unsigned char actual[FRACTYL_HASH_SIZE];
+    result = hash_ctx_final(ctx, actual);
+    if (result != FRACTYL_OK) return result;
+    return memcmp(actual, hash, FRACTYL_HASH_SIZE) == 0 ? FRACTYL_OK : FRACTYL_ERROR_HASH_MISMATCH;
+}
+
+static void* check_worker(void *arg) {
+    check_job_t *job = arg;
+    unsigned char *buffer = malloc(FSCK_BUFFER_SIZE);
+    if (!buffer) {
+        pthread_mutex_lock(&job->lock);
+        job->result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        pthread_mutex_unlock(&job->lock);
+        return NULL;
+    }
+    
+    while (1) {
+        if (job->max_bytes > 0 && __atomic_load_n(&job->bytes, __ATOMIC_RELAXED) >= job->max_bytes) break;
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->end) break;
+        const unsigned char *hash = job->hashes + i * FRACTYL_HASH_SIZE;
+    
+        uint64_t bytes = 0;
+        int result = check_object(job->fractyl_dir, hash, buffer, &bytes);
+        __atomic_add_fetch(&job->bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&job->checked, 1, __ATOMIC_RELAXED);
+        if (result == FRACTYL_OK) continue;
+    
+        pthread_mutex_lock(&job->lock);
+        if (result == FRACTYL_ERROR_NOT_FOUND) result = problem_add(&job->missing, hash);
+        else if (result == FRACTYL_ERROR_HASH_MISMATCH) result = problem_add(&job->corrupt, hash);
+        if (result != FRACTYL_OK) job->result = result;
+        pthread_mutex_unlock(&job->lock);
+    }
+    free(buffer);
+    return NULL;
+}
+
+static int check_threads(const fsck_options_t *options) {
+    if (options->threads > 0) {
+        return options->threads > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : options->threads;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) return 1;
+    return cpus > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : (int)cpus;
+}
+
+// Check hashes[start, end) on up to threads threads, stopping early once
+// max_bytes were read. Everything before job->next (at most end) is checked
+// when it returns; the problem lists come back sorted.
+static int run_check_job(check_job_t *job, int threads) {
+    size_t work = job->end - job->next;
+    if (work == 0) return FRACTYL_OK;
+    if ((size_t)threads > work) threads = (int)work;
+    
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (!tids) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    // Too few threads is not an error: the calling thread reads as well
+    int started = 0;
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&tids[t], NULL, check_worker, job) != 0) break;
+        started = t;
+    }
+    check_worker(job);
+    for (int t = 1; t <= started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    
+    if (job->next > job->end) job->next = job->end;
+    if (job->missing.count > 1) qsort(job->missing.items, job->missing.count, FRACTYL_HASH_SIZE, compare_hashes);
+    if (job->corrupt.count > 1) qsort(job->corrupt.items, job->corrupt.count, FRACTYL_HASH_SIZE, compare_hashes);
+    return job->result;
+}
+
+static void check_job_init(check_job_t *job, const char *fractyl_dir, const gc_reachable_t *reachable,
+                           size_t start, uint64_t max_bytes) {
+    memset(job, 0, sizeof(*job));
+    job->fractyl_dir = fractyl_dir;
+    job->hashes = reachable->hashes;
+    job->next = start;
+    job->end = reachable->count;
+    job->max_bytes = max_bytes;
+    pthread_mutex_init(&job->lock, NULL);
+}
+
+static void check_job_destroy(check_job_t *job) {
+    free(job->missing.items);
+    free(job->corrupt.items);
+    pthread_mutex_destroy(&job->lock);
+}
+
+// Report the job's problems and count them in stats
+static void report_objects(const check_job_t *job, const fsck_options_t *options, fsck_stats_t *stats) {
+    for (size_t i = 0; i < job->missing.count; i++) {
+        report_hash(options, FSCK_OBJECT_MISSING, job->missing.items + i * FRACTYL_HASH_SIZE);
+    }
+    for (size_t i = 0; i < job->corrupt.count; i++) {
+        report_hash(options, FSCK_OBJECT_CORRUPT, job->corrupt.items + i * FRACTYL_HASH_SIZE);
+    }
+    stats->objects += job->checked;
+    stats->bytes += job->bytes;
+    stats->missing += job->missing.count;
+    stats->corrupt += job->corrupt.count;
+}
+
+// --- Snapshots and indexes ---
+
+// Entries strictly in path order: sorted, without duplicates
+static int index_well_formed(const index_t *index) {
+    for (size_t i = 0; i < index->count; i++) {
+        if (!index->entries[i].path || !index->entries[i].path[0]) return 0;
+        if (i > 0 && strcmp(index->entries[i - 1].path, index->entries[i].path) >= 0) return 0;
+    }
+    return 1;
+}
+
+// The records of one snapshots directory; with load_indexes, also whether
+// each snapshot's index can be read
+static int check_snapshots_dir(const char *snapshots_dir, int load_indexes, const char *fractyl_dir,
+                               const fsck_options_t *options, fsck_stats_t *stats) {
+    catalog_t catalog;
+    int result = catalog_load(snapshots_dir, &catalog);
+    if (result != FRACTYL_OK) return result;
+    
+    if (catalog.unreadable > 0) {
+        report(options, FSCK_SNAPSHOTS_UNREADABLE, snapshots_dir);
+        stats->metadata++;
+    }
+    for (size_t i = 0; load_indexes && i < catalog.count; i++) {
+        index_t index;
+        index_init(&index);
+        if (object_load_index(catalog.entries[i].index_hash, fractyl_dir, &index) != FRACTYL_OK ||
+            !index_well_formed(&index)) {
+            report(options, FSCK_SNAPSHOT_BROKEN, catalog.entries[i].id);
+            stats->metadata++;
+        }
+        index_free(&index);
+    }
+    catalog_free(&catalog);
+    return FRACTYL_OK;
+}
+
+typedef struct {
+    int load_indexes;
+    const char *fractyl_dir;
+    const fsck_options_t *options;
+    fsck_stats_t *stats;
+} metadata_check_t;
+
+static int check_branch_snapshots(const char *branch, const char *snapshots_dir, void *ctx) {
+    (void)branch;
+    metadata_check_t *check = ctx;
+    return check_snapshots_dir(snapshots_dir, check->load_indexes, check->fractyl_dir, check->options,
+                               check->stats);
+}
+
+// Snapshot records of every branch and the working index. Snapshot
+// indexes are only loaded when marking could not read one of them.
+static int check_metadata(const char *fractyl_dir, int load_indexes, const fsck_options_t *options,
+                          fsck_stats_t *stats) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/snapshots", fractyl_dir);
+    int result = check_snapshots_dir(path, load_indexes, fractyl_dir, options, stats);
+    metadata_check_t check = { load_indexes, fractyl_dir, options, stats };
+    if (result == FRACTYL_OK) result = paths_for_each_branch(fractyl_dir, check_branch_snapshots, &check);
+    if (result != FRACTYL_OK) return result;
+    
+    snprintf(path, sizeof(path), "%s/index", fractyl_dir);
+    if (access(path, F_OK) != 0) return FRACTYL_OK;
+    index_t index;
+    index_init(&index);
+    if (index_load(&index, path) != FRACTYL_OK || !index_well_formed(&index)) {
+        report(options, FSCK_INDEX_MALFORMED, path);
+        stats->metadata++;
+    }
+    index_free(&index);
+    return FRACTYL_OK;
+}
+
+// --- Scrub cursor ---
+
+typedef struct {
+    int have_cursor;
+    unsigned char cursor[FRACTYL_HASH_SIZE];    // Last object checked in this pass
+    size_t problems;                            // Found in this pass
+    long long completed;                        // When the last pass ended, 0 if none did
+} scrub_record_t;
+
+static void scrub_path(const char *fractyl_dir, char *path, size_t size) {
+    snprintf(path, size, "%s/%s", fractyl_dir, FSCK_SCRUB_FILE);
+}
+
+// A missing or damaged file starts a new pass
+static void scrub_record_load(const char *fractyl_dir, scrub_record_t *record) {
+    memset(record, 0, sizeof(*record));
+    char path[4096];
+    scrub_path(fractyl_dir, path, sizeof(path));
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    
+    char line[256], value[FRACTYL_HASH_HEX_SIZE + 1];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long number;
+        if (sscanf(line, "cursor %64s", value) == 1) {
+            record->have_cursor = string_to_hash(value, record->cursor) == FRACTYL_OK;
+        } else if (sscanf(line, "problems %llu", &number) == 1) {
+            record->problems = (size_t)number;
+        } else if (sscanf(line, "completed %llu", &number) == 1) {
+            record->completed = (long long)number;
+        }
+    }
+    fclose(f);
+}
+
+static int scrub_record_save(const char *fractyl_dir, const scrub_record_t *record) {
+    char path[4096], temp_path[4200];
+    scrub_path(fractyl_dir, path, sizeof(path));
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *f = fopen(temp_path, "w");
+    if (!f) return FRACTYL_ERROR_IO;
+    
+    if (record->have_cursor) {
+        char hex[FRACTYL_HASH_HEX_SIZE];
+        hash_to_string(record->cursor, hex);
+        fprintf(f, "cursor %s\n", hex);
+    }
+    fprintf(f, "problems %zu\n", record->problems);
+    fprintf(f, "completed %lld\n", record->completed);
+    int ok = fflush(f) == 0;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return FRACTYL_ERROR_IO;
+    }
+    return FRACTYL_OK;
+}
+
+// First hash of the sorted set after cursor
+static size_t position_after(const gc_reachable_t *reachable, const unsigned char *cursor) {
+    size_t lo = 0, hi = reachable->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (memcmp(reachable->hashes + mid * FRACTYL_HASH_SIZE, cursor, FRACTYL_HASH_SIZE) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Drop the missing objects that are no longer reachable: gc may have
+// collected them since the pass was marked
+static int drop_collected(const char *fractyl_dir, int threads, problem_list_t *missing) {
+    gc_reachable_t now;
+    int result = object_reachable(fractyl_dir, threads, &now);
+    if (result != FRACTYL_OK) return result;
+    
+    size_t kept = 0;
+    for (size_t i = 0; i < missing->count; i++) {
+        const unsigned char *hash = missing->items + i * FRACTYL_HASH_SIZE;
+        if (now.count > 0 && bsearch(hash, now.hashes, now.count, FRACTYL_HASH_SIZE, compare_hashes)) {
+            memmove(missing->items + kept++ * FRACTYL_HASH_SIZE, hash, FRACTYL_HASH_SIZE);
+        }
+    }
+    missing->count = kept;
+    gc_reachable_free(&now);
+    return FRACTYL_OK;
+}
+
+// --- Public API ---
+
+void fsck_options_init(fsck_options_t *options) {
+    if (!options) return;
+    memset(options, 0, sizeof(*options));
+}
+
+size_t fsck_problems(const fsck_stats_t *stats) {
+    return stats ? stats->missing + stats->corrupt + stats->metadata : 0;
+}
+
+int fsck_check(const char *fractyl_dir, const fsck_options_t *options, fsck_stats_t *stats) {
+    if (!fractyl_dir || !options || !stats) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(stats, 0, sizeof(*stats));
+    
+    int threads = check_threads(options);
+    gc_reachable_t reachable;
+    int result = object_reachable(fractyl_dir, threads, &reachable);
+    if (result != FRACTYL_OK) return result;
+    stats->snapshots = reachable.snapshots;
+    
+    result = check_metadata(fractyl_dir, reachable.unreadable > 0, options, stats);
+    if (result == FRACTYL_OK) {
+        check_job_t job;
+        check_job_init(&job, fractyl_dir, &reachable, 0, 0);
+        result = run_check_job(&job, threads);
+        if (result == FRACTYL_OK) report_objects(&job, options, stats);
+        check_job_destroy(&job);
+    }
+    stats->total = reachable.count;
+    gc_reachable_free(&reachable);
+    return result;
+}
+
+fsck_scrub_t* fsck_scrub_new(void) {
+    return calloc(1, sizeof(fsck_scrub_t));
+}
+
+void fsck_scrub_free(fsck_scrub_t *scrub) {
+    if (!scrub) return;
+    gc_reachable_free(&scrub->reachable);
+    free(scrub);
+}
+
+int fsck_scrub_step(const char *fractyl_dir, fsck_scrub_t *scrub, const fsck_options_t *options,
+                    fsck_stats_t *stats) {
+    if (!fractyl_dir || !options || !stats) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(stats, 0, sizeof(*stats));
+    
+    fsck_scrub_t local = {0};
+    fsck_scrub_t *state = scrub ? scrub : &local;
+    if (state->marked && strcmp(state->fractyl_dir, fractyl_dir) != 0) {
+        gc_reachable_free(&state->reachable);
+        state->marked = 0;
+    }
+    
+    int threads = check_threads(options);
+    int result = FRACTYL_OK;
+    if (!state->marked) {
+        result = object_reachable(fractyl_dir, threads, &state->reachable);
+        if (result != FRACTYL_OK) return result;
+        snprintf(state->fractyl_dir, sizeof(state->fractyl_dir), "%s", fractyl_dir);
+        state->marked = 1;
+    }
+    const gc_reachable_t *reachable = &state->reachable;
+    stats->snapshots = reachable->snapshots;
+    stats->total = reachable->count;
+    
+    uint64_t slice = options->scrub_bytes;
+    if (slice == 0) {
+        long configured = config_get_long(fractyl_dir, "fsck.scrub_bytes", 0);
+        slice = configured > 0 ? (uint64_t)configured : FSCK_DEFAULT_SCRUB_BYTES;
+    }
+    
+    scrub_record_t record;
+    scrub_record_load(fractyl_dir, &record);
+    size_t start = record.have_cursor ? position_after(reachable, record.cursor) : 0;
+    
+    check_job_t job;
+    check_job_init(&job, fractyl_dir, reachable, start, slice);
+    result = run_check_job(&job, threads);
+    if (result == FRACTYL_OK && job.missing.count > 0) {
+        result = drop_collected(fractyl_dir, threads, &job.missing);
+    }
+    if (result == FRACTYL_OK) {
+        report_objects(&job, options, stats);
+        record.problems += job.missing.count + job.corrupt.count;
+        stats->pass_problems = record.problems;
+        stats->remaining = reachable->count - job.next;
+    
+        if (job.next >= reachable->count) {
+            // The next slice marks again and starts over
+            record.have_cursor = 0;
+            record.problems = 0;
+            record.completed = (long long)time(NULL);
+            stats->pass_complete = 1;
+            gc_reachable_free(&state->reachable);
+            state->marked = 0;
+        } else if (job.next > start) {
+            record.have_cursor = 1;
+            memcpy(record.cursor, reachable->hashes + (job.next - 1) * FRACTYL_HASH_SIZE, FRACTYL_HASH_SIZE);
+        }
+        result = scrub_record_save(fractyl_dir, &record);
+    }
+    check_job_destroy(&job);
+    if (!scrub) gc_reachable_free(&local.reachable);
+    return result;
+}
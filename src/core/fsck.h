@@ -0,0 +1,95 @@
+#ifndef FSCK_H
+#define FSCK_H
+
+#include "../include/fractyl.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Checking that what is stored can still be read back.
+//
+// A check marks the objects reachable from every snapshot and the working
+// index as gc does (gc.h), going on past whatever cannot be read, then
+// reads each of them back through an object reader (objects.h) and hashes
+// its content on several threads: an object whose content does not hash
+// to its name, or cannot be decoded, is corrupt. Chunk lists and deltas
+// are checked as the content they assemble, and their chunks and bases as
+// objects of their own. The snapshot records of every branch must be
+// readable and the working index in path order without duplicates; when
+// marking ran into an index it could not read, the snapshots naming it
+// are found and reported too.
+//
+// A scrub checks the same objects in hash order a slice at a time, so a
+// daemon can spread a pass over many cycles. The cursor of the pass is
+// kept in .fractyl/scrub and survives restarts; a slice ends once it has
+// read fsck.scrub_bytes of content (default 16 MiB). Reads are charged to
+// the process's read budget (governor.h), so a daemon's scrub stays within
+// daemon.max_read_mbps.
+//
+// The caller holds the repository lock, shared: gc must not delete
+// objects while they are read.
+
+#define FSCK_DEFAULT_SCRUB_BYTES (16ULL * 1024 * 1024)
+#define FSCK_SCRUB_FILE "scrub"
+
+typedef enum {
+    FSCK_OBJECT_MISSING,        // name: an object's hash, stored nowhere
+    FSCK_OBJECT_CORRUPT,        // name: an object's hash, not read back as what it names
+    FSCK_SNAPSHOTS_UNREADABLE,  // name: a snapshots directory with records that cannot be read
+    FSCK_SNAPSHOT_BROKEN,       // name: a snapshot whose index cannot be read
+    FSCK_INDEX_MALFORMED        // name: an index file unreadable, out of order or with duplicates
+} fsck_problem_t;
+
+// Called once per problem, from the thread that called the check
+typedef void (*fsck_report_fn)(fsck_problem_t problem, const char *name, void *ctx);
+
+typedef struct {
+    int threads;                // Reading threads; 0 picks one per CPU
+    uint64_t scrub_bytes;       // Content per scrub slice; 0 reads fsck.scrub_bytes
+    fsck_report_fn report;      // NULL: problems are only counted
+    void *report_ctx;
+} fsck_options_t;
+
+typedef struct {
+    size_t snapshots;           // Snapshot roots marked
+    size_t objects;             // Objects read back
+    uint64_t bytes;             // Content read
+    size_t missing;
+    size_t corrupt;
+    size_t metadata;            // Snapshot and index problems
+    size_t total;               // Scrub: reachable objects in the pass
+    size_t remaining;           // Scrub: still to check in the pass
+    size_t pass_problems;       // Scrub: problems found in the pass so far
+    int pass_complete;          // Scrub: this slice finished the pass
+} fsck_stats_t;
+
+void fsck_options_init(fsck_options_t *options);
+
+// Problems found, the sum of the stats' counts
+size_t fsck_problems(const fsck_stats_t *stats);
+
+// Check everything. Returns FRACTYL_OK when the check ran, whatever it found.
+int fsck_check(const char *fractyl_dir, const fsck_options_t *options, fsck_stats_t *stats);
+
+// Scrub state a caller keeps between slices: the objects of the pass in
+// progress, marked when it starts. Without it (NULL) each slice marks anew.
+typedef struct fsck_scrub fsck_scrub_t;
+
+fsck_scrub_t* fsck_scrub_new(void);
+void fsck_scrub_free(fsck_scrub_t *scrub);
+
+// Check the next slice of objects after the persisted cursor and move the
+// cursor past them; after the last one the pass is complete and the next
+// slice starts another from the beginning. Objects reported missing are
+// those still reachable once the slice is done.
+int fsck_scrub_step(const char *fractyl_dir, fsck_scrub_t *scrub, const fsck_options_t *options,
+                    fsck_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FSCK_H
@@ -0,0 +1,717 @@
+#include "gc.h"
+#include "hash.h"
+#include "index.h"
+#include "objects.h"
+#include "tree.h"
+#include "pack.h"
+#include "loose_cache.h"
+#include "alternates.h"
+#include "../include/core.h"
+#include "../utils/config.h"
+#include "../utils/catalog.h"
+#include "../utils/paths.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define GC_MAX_THREADS 16
+
+// A set of hashes: appended to, then sorted and deduplicated
+typedef struct {
+    unsigned char *items;
+    size_t count;
+    size_t capacity;
+} hash_list_t;
+
+struct gc_state {
+    char fractyl_dir[2048];
+    int marked;                 // reachable and roots describe the pass in progress
+    int tolerant;               // Count what cannot be read in unreadable instead of failing
+    size_t unreadable;
+    hash_list_t reachable;      // Sorted
+    hash_list_t roots;          // Sorted snapshot index hashes marked so far
+    struct stat index_stat;     // .fractyl/index when it was marked
+    struct stat journal_stat;   // and its journal
+    int next_fanout;
+};
+
+static int compare_hashes(const void *a, const void *b) {
+    return memcmp(a, b, FRACTYL_HASH_SIZE);
+}
+
+static int list_add(hash_list_t *list, const unsigned char *hash) {
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 1024;
+        unsigned char *grown = realloc(list->items, new_capacity * FRACTYL_HASH_SIZE);
+        if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        list->items = grown;
+        list->capacity = new_capacity;
+    }
+    memcpy(list->items + list->count++ * FRACTYL_HASH_SIZE, hash, FRACTYL_HASH_SIZE);
+    return FRACTYL_OK;
+}
+
+static void list_free(hash_list_t *list) {
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+static void list_sort_unique(hash_list_t *list) {
+    if (list->count < 2) return;
+    qsort(list->items, list->count, FRACTYL_HASH_SIZE, compare_hashes);
+    size_t kept = 1;
+    for (size_t i = 1; i < list->count; i++) {
+        const unsigned char *hash = list->items + i * FRACTYL_HASH_SIZE;
+        if (memcmp(hash, list->items + (kept - 1) * FRACTYL_HASH_SIZE, FRACTYL_HASH_SIZE) != 0) {
+            memmove(list->items + kept++ * FRACTYL_HASH_SIZE, hash, FRACTYL_HASH_SIZE);
+        }
+    }
+    list->count = kept;
+}
+
+// The list is sorted
+static int list_contains(const hash_list_t *list, const unsigned char *hash) {
+    return list->count > 0 &&
+           bsearch(hash, list->items, list->count, FRACTYL_HASH_SIZE, compare_hashes) != NULL;
+}
+
+// Drop the hashes of list that set holds; both are sorted
+static void list_subtract(hash_list_t *list, const hash_list_t *set) {
+    size_t kept = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        const unsigned char *hash = list->items + i * FRACTYL_HASH_SIZE;
+        if (!list_contains(set, hash)) {
+            memmove(list->items + kept++ * FRACTYL_HASH_SIZE, hash, FRACTYL_HASH_SIZE);
+        }
+    }
+    list->count = kept;
+}
+
+// Merge the sorted list add, which shares no hash with dest, into dest
+static int list_merge(hash_list_t *dest, const hash_list_t *add) {
+    if (add->count == 0) return FRACTYL_OK;
+    size_t total = dest->count + add->count;
+    unsigned char *merged = malloc(total * FRACTYL_HASH_SIZE);
+    if (!merged) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    size_t a = 0, b = 0, n = 0;
+    while (a < dest->count || b < add->count) {
+        const unsigned char *from;
+        if (b >= add->count || (a < dest->count &&
+            memcmp(dest->items + a * FRACTYL_HASH_SIZE, add->items + b * FRACTYL_HASH_SIZE,
+                   FRACTYL_HASH_SIZE) < 0)) {
+            from = dest->items + a++ * FRACTYL_HASH_SIZE;
+        } else {
+            from = add->items + b++ * FRACTYL_HASH_SIZE;
+        }
+        memcpy(merged + n++ * FRACTYL_HASH_SIZE, from, FRACTYL_HASH_SIZE);
+    }
+    free(dest->items);
+    dest->items = merged;
+    dest->count = dest->capacity = total;
+    return FRACTYL_OK;
+}
+
+// --- Roots ---
+
+// The index hash of every snapshot in snapshots_dir. Snapshot files that
+// cannot be read are counted in unreadable, or without it fail.
+static int add_snapshot_roots(const char *snapshots_dir, hash_list_t *roots, size_t *snapshot_count,
+                              size_t *unreadable) {
+    catalog_t catalog;
+    int result = catalog_load(snapshots_dir, &catalog);
+    if (result != FRACTYL_OK) return result;
+    
+    // A snapshot that cannot be read still owns its objects
+    if (unreadable) *unreadable += catalog.unreadable;
+    else if (catalog.unreadable > 0) result = FRACTYL_ERROR_GENERIC;
+    for (size_t i = 0; result == FRACTYL_OK && i < catalog.count; i++) {
+        result = list_add(roots, catalog.entries[i].index_hash);
+        (*snapshot_count)++;
+    }
+    catalog_free(&catalog);
+    return result;
+}
+
+typedef struct {
+    hash_list_t *roots;
+    size_t *snapshot_count;
+    size_t *unreadable;
+} root_walk_t;
+
+static int add_branch_roots(const char *branch, const char *snapshots_dir, void *ctx) {
+    (void)branch;
+    root_walk_t *walk = ctx;
+    return add_snapshot_roots(snapshots_dir, walk->roots, walk->snapshot_count, walk->unreadable);
+}
+
+static int collect_roots(const char *fractyl_dir, hash_list_t *roots, size_t *snapshot_count,
+                         size_t *unreadable) {
+    char path[4096];
+    *snapshot_count = 0;
+    snprintf(path, sizeof(path), "%s/snapshots", fractyl_dir);
+    int result = add_snapshot_roots(path, roots, snapshot_count, unreadable);
+    
+    root_walk_t walk = { roots, snapshot_count, unreadable };
+    if (result == FRACTYL_OK) result = paths_for_each_branch(fractyl_dir, add_branch_roots, &walk);
+    if (result == FRACTYL_OK) list_sort_unique(roots);
+    return result;
+}
+
+// --- Marking ---
+
+typedef enum {
+    MARK_INDEXES,               // Work items are index objects: collect their entries
+    MARK_REFERENCES             // Work items are objects: collect what they depend on
+} mark_mode_t;
+
+typedef struct {
+    const char *fractyl_dir;
+    mark_mode_t mode;
+    const hash_list_t *work;
+    const hash_list_t *known;   // Already reachable: trees in it are not walked again
+    size_t next;                // Next work item, taken atomically
+    int failed;
+    int tolerant;               // Count items that cannot be read instead of failing
+    size_t unreadable;
+} mark_job_t;
+
+typedef struct {
+    mark_job_t *job;
+    hash_list_t found;
+    size_t missing;
+    size_t unreadable;
+    int result;
+} mark_worker_t;
+
+typedef struct {
+    hash_list_t *found;
+    const hash_list_t *known;
+} tree_mark_t;
+
+// Subtrees already reachable were expanded when they were marked
+static int mark_tree_object(const unsigned char *hash, int is_tree, void *ctx) {
+    tree_mark_t *mark = ctx;
+    if (is_tree && mark->known && list_contains(mark->known, hash)) return TREE_WALK_SKIP;
+    return hash_is_zero(hash) ? FRACTYL_OK : list_add(mark->found, hash);
+}
+
+static int mark_index(const char *fractyl_dir, const unsigned char *hash, const hash_list_t *known,
+                      hash_list_t *found) {
+    void *data;
+    size_t size;
+    int result = object_load(hash, fractyl_dir, &data, &size);
+    if (result != FRACTYL_OK) return result;
+    
+    if (tree_is_tree(data, size)) {
+        free(data);
+        tree_mark_t mark = { found, known };
+        return tree_walk(hash, fractyl_dir, mark_tree_object, &mark);
+    }
+    
+    // Only the hashes are needed: read them in place
+    index_view_t view;
+    result = index_view_open_owned(&view, data, size);
+    if (result != FRACTYL_OK) return result;
+    
+    for (size_t i = 0; i < view.count && result == FRACTYL_OK; i++) {
+        const unsigned char *entry_hash = index_view_hash(&view, i);
+        if (!hash_is_zero(entry_hash)) result = list_add(found, entry_hash);
+    }
+    index_view_close(&view);
+    return result;
+}
+
+static void* mark_worker(void *arg) {
+    mark_worker_t *worker = arg;
+    mark_job_t *job = worker->job;
+    
+    while (!__atomic_load_n(&job->failed, __ATOMIC_RELAXED)) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->work->count) break;
+        const unsigned char *hash = job->work->items + i * FRACTYL_HASH_SIZE;
+    
+        int result;
+        if (job->mode == MARK_INDEXES) {
+            result = mark_index(job->fractyl_dir, hash, job->known, &worker->found);
+        } else {
+            unsigned char *refs = NULL;
+            size_t count = 0;
+            result = object_references(job->fractyl_dir, hash, &refs, &count);
+            for (size_t r = 0; result == FRACTYL_OK && r < count; r++) {
+                result = list_add(&worker->found, refs + r * FRACTYL_HASH_SIZE);
+            }
+            free(refs);
+            if (result == FRACTYL_ERROR_NOT_FOUND) {
+                // Already lost; nothing of it can be kept
+                worker->missing++;
+                result = FRACTYL_OK;
+            }
+        }
+        if (result != FRACTYL_OK && result != FRACTYL_ERROR_OUT_OF_MEMORY && job->tolerant) {
+            worker->unreadable++;
+            result = FRACTYL_OK;
+        }
+        if (result != FRACTYL_OK) {
+            worker->result = result;
+            __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+static int mark_threads(const gc_options_t *options) {
+    if (options->threads > 0) {
+        return options->threads > GC_MAX_THREADS ? GC_MAX_THREADS : options->threads;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) return 1;
+    return cpus > GC_MAX_THREADS ? GC_MAX_THREADS : (int)cpus;
+}
+
+// Run job over its work list on up to threads threads. The hashes the
+// workers found are added to found, sorted and deduplicated.
+static int run_mark_job(mark_job_t *job, int threads, hash_list_t *found, size_t *missing) {
+    if (job->work->count == 0) return FRACTYL_OK;
+    if ((size_t)threads > job->work->count) threads = (int)job->work->count;
+    
+    mark_worker_t *workers = calloc((size_t)threads, sizeof(mark_worker_t));
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (!workers || !tids) {
+        free(workers);
+        free(tids);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    // Too few threads is not an error: the calling thread works as well
+    int started = 0;
+    workers[0].job = job;
+    for (int t = 1; t < threads; t++) {
+        workers[t].job = job;
+        if (pthread_create(&tids[t], NULL, mark_worker, &workers[t]) != 0) break;
+        started = t;
+    }
+    mark_worker(&workers[0]);
+    for (int t = 1; t <= started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    
+    int result = FRACTYL_OK;
+    for (int t = 0; t < threads; t++) {
+        if (result == FRACTYL_OK && workers[t].result != FRACTYL_OK) result = workers[t].result;
+        *missing += workers[t].missing;
+        job->unreadable += workers[t].unreadable;
+        for (size_t i = 0; result == FRACTYL_OK && i < workers[t].found.count; i++) {
+            result = list_add(found, workers[t].found.items + i * FRACTYL_HASH_SIZE);
+        }
+        list_free(&workers[t].found);
+    }
+    free(workers);
+    free(tids);
+    if (result == FRACTYL_OK) list_sort_unique(found);
+    return result;
+}
+
+// Add to state->reachable the sorted new roots, everything their indexes
+// name and, when working is set, the entries of the working index; then
+// follow chunk lists and deltas until nothing new turns up
+static int mark_from(const char *fractyl_dir, gc_state_t *state, const hash_list_t *roots,
+                     const index_t *working, int threads, size_t *missing) {
+    hash_list_t frontier = {0};
+    mark_job_t job = { fractyl_dir, MARK_INDEXES, roots, &state->reachable, 0, 0, state->tolerant, 0 };
+    int result = run_mark_job(&job, threads, &frontier, missing);
+    state->unreadable += job.unreadable;
+    
+    for (size_t i = 0; result == FRACTYL_OK && i < roots->count; i++) {
+        result = list_add(&frontier, roots->items + i * FRACTYL_HASH_SIZE);
+    }
+    for (size_t i = 0; result == FRACTYL_OK && working && i < working->count; i++) {
+        if (!hash_is_zero(working->entries[i].hash)) result = list_add(&frontier, working->entries[i].hash);
+    }
+    if (result == FRACTYL_OK) list_sort_unique(&frontier);
+    
+    while (result == FRACTYL_OK) {
+        list_subtract(&frontier, &state->reachable);
+        if (frontier.count == 0) break;
+        result = list_merge(&state->reachable, &frontier);
+    
+        hash_list_t refs = {0};
+        mark_job_t ref_job = { fractyl_dir, MARK_REFERENCES, &frontier, NULL, 0, 0, state->tolerant, 0 };
+        if (result == FRACTYL_OK) result = run_mark_job(&ref_job, threads, &refs, missing);
+        state->unreadable += ref_job.unreadable;
+        list_free(&frontier);
+        frontier = refs;
+    }
+    list_free(&frontier);
+    return result;
+}
+
+static int same_file_state(const struct stat *a, const struct stat *b) {
+    return a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// Bring state->reachable up to date with the snapshots that exist now
+static int mark_new_roots(const char *fractyl_dir, gc_state_t *state, const gc_options_t *options,
+                          gc_stats_t *stats) {
+    if (!state->marked || strcmp(state->fractyl_dir, fractyl_dir) != 0) {
+        list_free(&state->reachable);
+        list_free(&state->roots);
+        memset(&state->index_stat, 0, sizeof(state->index_stat));
+        memset(&state->journal_stat, 0, sizeof(state->journal_stat));
+        snprintf(state->fractyl_dir, sizeof(state->fractyl_dir), "%s", fractyl_dir);
+        state->next_fanout = 0;
+    }
+    
+    hash_list_t roots = {0};
+    int result = collect_roots(fractyl_dir, &roots, &stats->snapshots,
+                               state->tolerant ? &state->unreadable : NULL);
+    if (result == FRACTYL_OK) list_subtract(&roots, &state->roots);
+    
+    // The working index names the objects of the current snapshot, and of
+    // one being written right now
+    char index_path[4096];
+    snprintf(index_path, sizeof(index_path), "%s/index", fractyl_dir);
+    char journal_path[4096];
+    snprintf(journal_path, sizeof(journal_path), "%s%s", index_path, INDEX_JOURNAL_SUFFIX);
+    struct stat st, journal_st;
+    memset(&st, 0, sizeof(st));
+    memset(&journal_st, 0, sizeof(journal_st));
+    int have_index = stat(index_path, &st) == 0;
+    stat(journal_path, &journal_st);
+    index_t working = {0};
+    int load_working = have_index && (!state->marked || !same_file_state(&st, &state->index_stat) ||
+                                      !same_file_state(&journal_st, &state->journal_stat));
+    if (result == FRACTYL_OK && load_working) {
+        result = index_load(&working, index_path);
+        if (result != FRACTYL_OK && state->tolerant) {
+            state->unreadable++;
+            load_working = 0;
+            result = FRACTYL_OK;
+        }
+    }
+    
+    if (result == FRACTYL_OK) {
+        result = mark_from(fractyl_dir, state, &roots, load_working ? &working : NULL,
+                           mark_threads(options), &stats->missing);
+    }
+    if (load_working && result == FRACTYL_OK) index_free(&working);
+    if (result == FRACTYL_OK) result = list_merge(&state->roots, &roots);
+    list_free(&roots);
+    
+    if (result != FRACTYL_OK) {
+        // Never sweep with a set that may be missing something
+        state->marked = 0;
+        return result;
+    }
+    state->marked = 1;
+    state->index_stat = st;
+    state->journal_stat = journal_st;
+    stats->reachable = state->reachable.count;
+    return FRACTYL_OK;
+}
+
+// --- Sweeping ---
+
+typedef struct {
+    const gc_options_t *options;
+    long grace;
+    time_t now;
+    gc_stats_t *stats;
+    int removed;                // Anything unlinked from a fanout directory
+} sweep_t;
+
+static long grace_period(const char *fractyl_dir, const gc_options_t *options) {
+    if (options->grace_seconds >= 0) return options->grace_seconds;
+    long grace = config_get_long(fractyl_dir, "gc.grace_period", GC_DEFAULT_GRACE_PERIOD);
+    return grace < 0 ? GC_DEFAULT_GRACE_PERIOD : grace;
+}
+
+// Delete path if it is older than the grace period, counting it in removed,
+// else in kept (if set). Returns 1 if it went (or would go, in a dry run).
+static int remove_if_old(sweep_t *sweep, const char *path, size_t *removed, size_t *kept) {
+    struct stat st;
+    if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+    if (st.st_mtime > sweep->now - sweep->grace) {
+        if (kept) (*kept)++;
+        return 0;
+    }
+    if (!sweep->options->dry_run && unlink(path) != 0) return 0;
+    (*removed)++;
+    sweep->stats->bytes_freed += (uint64_t)st.st_size;
+    return 1;
+}
+
+static int is_hex_name(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return 0;
+    }
+    return s[len] == '\0';
+}
+
+// Unreachable objects and temporary files in objects/<fanout>/
+static void sweep_fanout(const char *fractyl_dir, int fanout, const hash_list_t *reachable, sweep_t *sweep) {
+    char dir_path[4096];
+    snprintf(dir_path, sizeof(dir_path), "%s/objects/%02x", fractyl_dir, fanout);
+    DIR *d = opendir(dir_path);
+    if (!d) return;
+    
+    int removed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (strncmp(entry->d_name, "tmp_obj_", 8) == 0) {
+            removed |= remove_if_old(sweep, path, &sweep->stats->temp_removed, NULL);
+            continue;
+        }
+        if (!is_hex_name(entry->d_name, FRACTYL_HASH_HEX_SIZE - 3)) continue;
+    
+        char hex[FRACTYL_HASH_HEX_SIZE];
+        unsigned char hash[FRACTYL_HASH_SIZE];
+        snprintf(hex, sizeof(hex), "%02x%s", fanout, entry->d_name);
+        if (string_to_hash(hex, hash) != FRACTYL_OK || list_contains(reachable, hash)) continue;
+        removed |= remove_if_old(sweep, path, &sweep->stats->loose_removed, &sweep->stats->loose_kept);
+    }
+    closedir(d);
+    
+    if (removed && !sweep->options->dry_run) {
+        rmdir(dir_path);    // Only succeeds once empty
+        sweep->removed = 1;
+    }
+}
+
+// Temporary files of interrupted stores and repacks outside the fanouts
+static void sweep_temp_files(const char *fractyl_dir, sweep_t *sweep) {
+    static const char *const dirs[] = { "objects", "objects/pack" };
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        char dir_path[4096];
+        snprintf(dir_path, sizeof(dir_path), "%s/%s", fractyl_dir, dirs[i]);
+        DIR *d = opendir(dir_path);
+        if (!d) continue;
+    
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (strncmp(entry->d_name, "tmp_obj_", 8) != 0 && strncmp(entry->d_name, "tmp-pack-", 9) != 0 &&
+                strncmp(entry->d_name, "tmp-idx-", 8) != 0) {
+                continue;
+            }
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+            remove_if_old(sweep, path, &sweep->stats->temp_removed, NULL);
+        }
+        closedir(d);
+    }
+}
+
+// Loose caches, this process's and others', must not keep deleted objects
+static void sweep_finish(const char *fractyl_dir, const sweep_t *sweep) {
+    if (!sweep->removed) return;
+    loose_cache_invalidate();
+    char objects_dir[4096];
+    snprintf(objects_dir, sizeof(objects_dir), "%s/objects", fractyl_dir);
+    utimensat(AT_FDCWD, objects_dir, NULL, 0);
+}
+
+// Total size of the pack directory's packs and indexes
+static uint64_t pack_dir_bytes(const char *fractyl_dir) {
+    char dir_path[4096];
+    snprintf(dir_path, sizeof(dir_path), "%s/objects/pack", fractyl_dir);
+    DIR *d = opendir(dir_path);
+    if (!d) return 0;
+    
+    uint64_t total = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strncmp(entry->d_name, "pack-", 5) != 0) continue;
+        char path[4096];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (stat(path, &st) == 0) total += (uint64_t)st.st_size;
+    }
+    closedir(d);
+    return total;
+}
+
+static int prune_packs(const char *fractyl_dir, const gc_state_t *state, const gc_options_t *options,
+                       gc_stats_t *stats) {
+    // keep must be set even when nothing is reachable
+    const unsigned char *keep = state->reachable.items ? state->reachable.items : (const unsigned char *)"";
+    uint64_t before = pack_dir_bytes(fractyl_dir);
+    pack_repack_options_t repack = { 1, 0, NULL, 0, keep, state->reachable.count, options->dry_run };
+    pack_repack_stats_t repack_stats;
+    int result = pack_repack_with_options(fractyl_dir, &repack, &repack_stats);
+    if (result != FRACTYL_OK) return result;
+    
+    stats->packed_removed = repack_stats.pruned;
+    uint64_t after = pack_dir_bytes(fractyl_dir);
+    if (!options->dry_run && after < before) stats->bytes_freed += before - after;
+    return FRACTYL_OK;
+}
+
+// --- Public API ---
+
+void gc_options_init(gc_options_t *options) {
+    if (!options) return;
+    memset(options, 0, sizeof(*options));
+    options->grace_seconds = -1;
+    options->prune_packs = 1;
+}
+
+gc_state_t* gc_state_new(void) {
+    return calloc(1, sizeof(gc_state_t));
+}
+
+void gc_state_free(gc_state_t *state) {
+    if (!state) return;
+    list_free(&state->reachable);
+    list_free(&state->roots);
+    free(state);
+}
+
+int object_gc(const char *fractyl_dir, const gc_options_t *options, gc_stats_t *stats) {
+    if (!fractyl_dir || !options || !stats) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(stats, 0, sizeof(*stats));
+    int result = object_sync(fractyl_dir);
+    if (result != FRACTYL_OK) return result;
+    
+    gc_state_t *state = gc_state_new();
+    if (!state) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    result = mark_new_roots(fractyl_dir, state, options, stats);
+    
+    if (result == FRACTYL_OK) {
+        sweep_t sweep = { options, grace_period(fractyl_dir, options), time(NULL), stats, 0 };
+        for (int fanout = 0; fanout < 256; fanout++) {
+            sweep_fanout(fractyl_dir, fanout, &state->reachable, &sweep);
+        }
+        sweep_temp_files(fractyl_dir, &sweep);
+        sweep_finish(fractyl_dir, &sweep);
+        stats->pass_complete = 1;
+    }
+    if (result == FRACTYL_OK && options->prune_packs) {
+        result = prune_packs(fractyl_dir, state, options, stats);
+    }
+    gc_state_free(state);
+    return result;
+}
+
+int object_gc_step(const char *fractyl_dir, gc_state_t *state, const gc_options_t *options,
+                   gc_stats_t *stats) {
+    if (!fractyl_dir || !state || !options || !stats) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(stats, 0, sizeof(*stats));
+    
+    int result = object_sync(fractyl_dir);
+    if (result == FRACTYL_OK) result = mark_new_roots(fractyl_dir, state, options, stats);
+    if (result != FRACTYL_OK) return result;
+    
+    int count = options->step_fanouts > 0 ? options->step_fanouts : GC_DEFAULT_STEP_FANOUTS;
+    sweep_t sweep = { options, grace_period(fractyl_dir, options), time(NULL), stats, 0 };
+    for (int i = 0; i < count && state->next_fanout < 256; i++) {
+        sweep_fanout(fractyl_dir, state->next_fanout++, &state->reachable, &sweep);
+    }
+    
+    // End of a pass: start over with a fresh set
+    if (state->next_fanout >= 256) {
+        sweep_temp_files(fractyl_dir, &sweep);
+        state->next_fanout = 0;
+        state->marked = 0;
+        stats->pass_complete = 1;
+    }
+    sweep_finish(fractyl_dir, &sweep);
+    return FRACTYL_OK;
+}
+
+int object_gc_shared(const char *store, const gc_options_t *options, gc_stats_t *stats) {
+    if (!store || !options || !stats) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(stats, 0, sizeof(*stats));
+    
+    char **members;
+    size_t count;
+    int result = alternates_members(store, &members, &count);
+    if (result != FRACTYL_OK) return result;
+    
+    // Whatever a missing member refers to could only be guessed at
+    for (size_t i = 0; i < count && result == FRACTYL_OK; i++) {
+        struct stat st;
+        if (stat(members[i], &st) != 0 || !S_ISDIR(st.st_mode)) result = FRACTYL_ERROR_NOT_FOUND;
+    }
+    
+    gc_state_t *state = result == FRACTYL_OK ? gc_state_new() : NULL;
+    if (result == FRACTYL_OK && !state) result = FRACTYL_ERROR_OUT_OF_MEMORY;
+    for (size_t i = 0; i < count && result == FRACTYL_OK; i++) {
+        // Each member's snapshots and working index, read through its own
+        // view of the objects
+        hash_list_t roots = {0};
+        size_t snapshots = 0;
+        result = collect_roots(members[i], &roots, &snapshots, NULL);
+        stats->snapshots += snapshots;
+    
+        char index_path[4096];
+        snprintf(index_path, sizeof(index_path), "%s/index", members[i]);
+        index_t working = {0};
+        int have_index = result == FRACTYL_OK && access(index_path, F_OK) == 0;
+        if (have_index) result = index_load(&working, index_path);
+        if (result == FRACTYL_OK) {
+            result = mark_from(members[i], state, &roots, have_index ? &working : NULL,
+                               mark_threads(options), &stats->missing);
+        }
+        if (have_index && result == FRACTYL_OK) index_free(&working);
+        list_free(&roots);
+        stats->members++;
+    }
+    alternates_free_members(members, count);
+    
+    if (result == FRACTYL_OK) {
+        stats->reachable = state->reachable.count;
+        sweep_t sweep = { options, grace_period(store, options), time(NULL), stats, 0 };
+        for (int fanout = 0; fanout < 256; fanout++) {
+            sweep_fanout(store, fanout, &state->reachable, &sweep);
+        }
+        sweep_temp_files(store, &sweep);
+        sweep_finish(store, &sweep);
+        stats->pass_complete = 1;
+    }
+    if (result == FRACTYL_OK && options->prune_packs) {
+        result = prune_packs(store, state, options, stats);
+    }
+    gc_state_free(state);
+    return result;
+}
+
+int object_reachable(const char *fractyl_dir, int threads, gc_reachable_t *reachable) {
+    if (!fractyl_dir || !reachable) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(reachable, 0, sizeof(*reachable));
+    
+    gc_state_t *state = gc_state_new();
+    if (!state) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    state->tolerant = 1;
+    gc_options_t options;
+    gc_options_init(&options);
+    options.threads = threads;
+    gc_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    int result = mark_new_roots(fractyl_dir, state, &options, &stats);
+    
+    if (result == FRACTYL_OK) {
+        reachable->hashes = state->reachable.items;
+        reachable->count = state->reachable.count;
+        reachable->snapshots = stats.snapshots;
+        reachable->unreadable = state->unreadable;
+        memset(&state->reachable, 0, sizeof(state->reachable));
+    }
+    gc_state_free(state);
+    return result;
+}
+
+void gc_reachable_free(gc_reachable_t *reachable) {
+    if (!reachable) return;
+    free(reachable->hashes);
+    memset(reachable, 0, sizeof(*reachable));
+}
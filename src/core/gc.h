@@ -0,0 +1,101 @@
+#ifndef GC_H
+#define GC_H
+
+#include "../include/fractyl.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Garbage collection of objects no snapshot refers to.
+//
+// The roots are the index objects of every snapshot on every branch
+// (.fractyl/snapshots and refs/heads/<branch>/snapshots) and the working
+// index .fractyl/index. Reachable are the roots, the trees under them
+// (tree.h), every object their entries name, the chunks of reachable chunk
+// lists and the bases of reachable deltas. Subtrees already marked are not
+// walked again. The indexes are loaded and the objects followed on
+// several threads.
+//
+// Unreachable loose objects are deleted once their file is older than the
+// grace period, which leaves alone whatever a snapshot that has not
+// finished yet may have written. Abandoned temporary files age out the same
+// way. Unreachable pack entries are dropped by rewriting the packs, in full
+// runs only.
+//
+// The caller holds the repository lock (utils/lock.h), so no snapshot of
+// this repository is running while objects are deleted.
+//
+// Config: gc.grace_period = seconds   (default 3600)
+
+#define GC_DEFAULT_GRACE_PERIOD 3600
+// Loose fanout directories object_gc_step() sweeps by default
+#define GC_DEFAULT_STEP_FANOUTS 16
+
+typedef struct {
+    long grace_seconds;       // Keep loose files younger than this; < 0 reads gc.grace_period
+    int prune_packs;          // Rewrite the packs without unreachable objects (object_gc only)
+    int dry_run;              // Count what would be deleted, delete nothing
+    int threads;              // Mark threads; 0 picks one per CPU
+    int step_fanouts;         // Fanout directories per object_gc_step(); 0 for the default
+} gc_options_t;
+
+typedef struct {
+    size_t snapshots;         // Snapshot roots marked
+    size_t reachable;         // Distinct reachable objects
+    size_t missing;           // Reachable but stored nowhere
+    size_t loose_removed;     // Unreachable loose objects deleted
+    size_t loose_kept;        // Unreachable but inside the grace period
+    size_t packed_removed;    // Unreachable pack entries dropped
+    size_t temp_removed;      // Abandoned temporary files deleted
+    uint64_t bytes_freed;
+    int pass_complete;        // object_gc_step(): every fanout has been swept since the last pass
+    size_t members;           // object_gc_shared(): repositories marked from
+} gc_stats_t;
+
+// Defaults: grace period from the config, packs pruned, threads per CPU
+void gc_options_init(gc_options_t *options);
+
+// Mark everything reachable, then sweep all loose objects and, with
+// options->prune_packs, the packs. Nothing is deleted if a snapshot or
+// its index cannot be read (its objects could not be told apart).
+int object_gc(const char *fractyl_dir, const gc_options_t *options, gc_stats_t *stats);
+
+// Incremental collection, e.g. one step per daemon cycle. The state keeps
+// the reachable set between steps; each step marks only snapshots that
+// were not marked yet, then sweeps the next options->step_fanouts loose
+// fanout directories. Once all 256 are swept the set is dropped, so objects
+// of snapshots deleted in the meantime are found by the next pass.
+typedef struct gc_state gc_state_t;
+
+gc_state_t* gc_state_new(void);
+void gc_state_free(gc_state_t *state);
+int object_gc_step(const char *fractyl_dir, gc_state_t *state, const gc_options_t *options,
+                   gc_stats_t *stats);
+
+// Collect a shared object store (alternates.h): everything reachable from
+// any of its members stays. FRACTYL_ERROR_NOT_FOUND, with nothing deleted,
+// while a member is missing. The caller holds the store's lock exclusively.
+int object_gc_shared(const char *store, const gc_options_t *options, gc_stats_t *stats);
+
+// What object_reachable() marked
+typedef struct {
+    unsigned char *hashes;    // Sorted and distinct, FRACTYL_HASH_SIZE bytes each
+    size_t count;
+    size_t snapshots;         // Snapshot roots marked
+    size_t unreadable;        // Snapshot files, indexes and objects that could not be read
+} gc_reachable_t;
+
+// Mark from fractyl_dir's snapshots and working index as object_gc() does,
+// but go on past whatever cannot be read, counting it instead; for
+// checking the store (fsck.h). Free the result with gc_reachable_free().
+int object_reachable(const char *fractyl_dir, int threads, gc_reachable_t *reachable);
+void gc_reachable_free(gc_reachable_t *reachable);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GC_H
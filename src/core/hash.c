@@ -1,8 +1,18 @@
 #include "hash.h"
+#include "blake3.h"
 #include "../include/fractyl.h"
+#include "../utils/config.h"
+#include "../utils/governor.h"
+#include "../utils/profile.h"
+#include "../utils/counters.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_OPENSSL
 #include <openssl/sha.h>
@@ -10,86 +20,278 @@
 #error "OpenSSL is required for hashing functionality"
 #endif
 
-int hash_file(const char *file_path, unsigned char *hash_out) {
-    if (!file_path || !hash_out) {
-        return FRACTYL_ERROR_GENERIC;
+// Files are read in pieces of this size; smaller files in a single read
+#define HASH_READ_SIZE (256 * 1024)
+// BLAKE3 files at least this large are mapped and hashed on several threads
+#define HASH_PARALLEL_MIN_SIZE (8 * 1024 * 1024)
+#define HASH_MAX_THREADS 8
+
+// Set before any threads start, read by all of them
+static hash_algorithm_t current_algorithm = HASH_ALGORITHM_SHA256;
+
+struct hash_ctx {
+    hash_algorithm_t algorithm;
+    union {
+        SHA256_CTX sha256;
+        blake3_hasher_t blake3;
+    } state;
+};
+
+const char* hash_algorithm_name(hash_algorithm_t algorithm) {
+    switch (algorithm) {
+        case HASH_ALGORITHM_SHA256: return "sha256";
+        case HASH_ALGORITHM_BLAKE3: return "blake3";
     }
+    return "unknown";
+}
 
-    FILE *fp = fopen(file_path, "rb");
-    if (!fp) {
-        return FRACTYL_ERROR_IO;
+int hash_algorithm_from_name(const char *name, hash_algorithm_t *algorithm_out) {
+    if (!name || !algorithm_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
     }
+    
+    if (strcmp(name, "sha256") == 0 || strcmp(name, "sha-256") == 0) {
+        *algorithm_out = HASH_ALGORITHM_SHA256;
+    } else if (strcmp(name, "blake3") == 0) {
+        *algorithm_out = HASH_ALGORITHM_BLAKE3;
+    } else {
+        return FRACTYL_ERROR_NOT_FOUND;
+    }
+    return FRACTYL_OK;
+}
 
-    SHA256_CTX sha256;
-    if (!SHA256_Init(&sha256)) {
-        fclose(fp);
-        return FRACTYL_ERROR_GENERIC;
+int hash_algorithm_valid(uint32_t id) {
+    return id == HASH_ALGORITHM_SHA256 || id == HASH_ALGORITHM_BLAKE3;
+}
+
+hash_algorithm_t hash_get_algorithm(void) {
+    return current_algorithm;
+}
+
+int hash_set_algorithm(hash_algorithm_t algorithm) {
+    if (!hash_algorithm_valid(algorithm)) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    current_algorithm = algorithm;
+    return FRACTYL_OK;
+}
+
+int hash_use_repository(const char *fractyl_dir) {
+    if (!fractyl_dir) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    // Repositories from before the setting existed are SHA-256
+    char name[32];
+    hash_algorithm_t algorithm = HASH_ALGORITHM_SHA256;
+    if (config_get(fractyl_dir, "objects.hash", name, sizeof(name)) == FRACTYL_OK &&
+        hash_algorithm_from_name(name, &algorithm) != FRACTYL_OK) {
+        return FRACTYL_ERROR_INVALID_STATE;
     }
+    return hash_set_algorithm(algorithm);
+}
+
+static int hash_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) return 1;
+    return governor_hash_threads(cpus > HASH_MAX_THREADS ? HASH_MAX_THREADS : (int)cpus);
+}
 
-    unsigned char buffer[8192];
-    size_t bytes_read;
+hash_ctx_t* hash_ctx_new(void) {
+    hash_ctx_t *ctx = malloc(sizeof(hash_ctx_t));
+    if (!ctx) {
+        return NULL;
+    }
     
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-        if (!SHA256_Update(&sha256, buffer, bytes_read)) {
-            fclose(fp);
-            return FRACTYL_ERROR_GENERIC;
-        }
+    ctx->algorithm = current_algorithm;
+    if (ctx->algorithm == HASH_ALGORITHM_BLAKE3) {
+        blake3_hasher_init(&ctx->state.blake3);
+    } else if (!SHA256_Init(&ctx->state.sha256)) {
+        free(ctx);
+        return NULL;
     }
     
-    fclose(fp);
+    return ctx;
+}
 
-    if (!SHA256_Final(hash_out, &sha256)) {
+int hash_ctx_update(hash_ctx_t *ctx, const void *data, size_t size) {
+    if (!ctx || (!data && size > 0)) {
         return FRACTYL_ERROR_GENERIC;
     }
+    
+    if (ctx->algorithm == HASH_ALGORITHM_BLAKE3) {
+        blake3_hasher_update(&ctx->state.blake3, data, size);
+        return FRACTYL_OK;
+    }
+    // OpenSSL picks the SHA extensions (SHA-NI) when the CPU has them
+    return SHA256_Update(&ctx->state.sha256, data, size) ? FRACTYL_OK : FRACTYL_ERROR_GENERIC;
+}
 
-    return FRACTYL_OK;
+int hash_ctx_final(hash_ctx_t *ctx, unsigned char *hash_out) {
+    if (!ctx || !hash_out) {
+        free(ctx);
+        return FRACTYL_ERROR_GENERIC;
+    }
+    
+    int ok = 1;
+    if (ctx->algorithm == HASH_ALGORITHM_BLAKE3) {
+        blake3_hasher_finalize(&ctx->state.blake3, hash_out);
+    } else {
+        ok = SHA256_Final(hash_out, &ctx->state.sha256);
+    }
+    free(ctx);
+    return ok ? FRACTYL_OK : FRACTYL_ERROR_GENERIC;
+}
+
+void hash_ctx_free(hash_ctx_t *ctx) {
+    free(ctx);
 }
 
 int hash_data(const void *data, size_t size, unsigned char *hash_out) {
     if (!data || !hash_out) {
         return FRACTYL_ERROR_GENERIC;
     }
-
+    
+    if (current_algorithm == HASH_ALGORITHM_BLAKE3) {
+        blake3_hash_parallel(data, size, size >= HASH_PARALLEL_MIN_SIZE ? hash_threads() : 1, hash_out);
+        return FRACTYL_OK;
+    }
+    
     SHA256_CTX sha256;
-    if (!SHA256_Init(&sha256)) {
+    if (!SHA256_Init(&sha256) ||
+        !SHA256_Update(&sha256, data, size) ||
+        !SHA256_Final(hash_out, &sha256)) {
         return FRACTYL_ERROR_GENERIC;
     }
+    return FRACTYL_OK;
+}
 
-    if (!SHA256_Update(&sha256, data, size)) {
-        return FRACTYL_ERROR_GENERIC;
+// Large BLAKE3 files: map them so the tree can be split across threads.
+// Returns FRACTYL_ERROR_INVALID_STATE if the file cannot be mapped.
+static int hash_mapped(int fd, size_t size, unsigned char *hash_out) {
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return FRACTYL_ERROR_INVALID_STATE;
     }
+    madvise(map, size, MADV_SEQUENTIAL);
+    governor_read(size);
+    blake3_hash_parallel(map, size, hash_threads(), hash_out);
+    munmap(map, size);
+    return FRACTYL_OK;
+}
 
-    if (!SHA256_Final(hash_out, &sha256)) {
-        return FRACTYL_ERROR_GENERIC;
+static int hash_open_file(const char *file_path, unsigned char *hash_out, off_t *size_out) {
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return FRACTYL_ERROR_IO;
     }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return FRACTYL_ERROR_IO;
+    }
+    *size_out = st.st_size;
+    
+    if (current_algorithm == HASH_ALGORITHM_BLAKE3 && S_ISREG(st.st_mode) &&
+        st.st_size >= HASH_PARALLEL_MIN_SIZE &&
+        hash_mapped(fd, (size_t)st.st_size, hash_out) == FRACTYL_OK) {
+        close(fd);
+        return FRACTYL_OK;
+    }
+    
+    // Most files fit in one read; only larger ones get the full buffer
+    size_t buffer_size = HASH_READ_SIZE;
+    if (S_ISREG(st.st_mode) && st.st_size >= 0 && (size_t)st.st_size < buffer_size) {
+        buffer_size = (size_t)st.st_size + 1;    // One extra byte sees EOF
+    }
+    unsigned char *buffer = malloc(buffer_size);
+    hash_ctx_t *ctx = buffer ? hash_ctx_new() : NULL;
+    if (!ctx) {
+        free(buffer);
+        close(fd);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    if (buffer_size == HASH_READ_SIZE) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    
+    int result = FRACTYL_OK;
+    for (;;) {
+        ssize_t n = read(fd, buffer, buffer_size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = FRACTYL_ERROR_IO;
+            break;
+        }
+        if (n == 0) break;
+        governor_read((size_t)n);
+        result = hash_ctx_update(ctx, buffer, (size_t)n);
+        if (result != FRACTYL_OK) break;
+    }
+    free(buffer);
+    close(fd);
+    
+    if (result != FRACTYL_OK) {
+        hash_ctx_free(ctx);
+        return result;
+    }
+    return hash_ctx_final(ctx, hash_out);
+}
 
-    return FRACTYL_OK;
+int hash_file(const char *file_path, unsigned char *hash_out) {
+    if (!file_path || !hash_out) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    
+    unsigned long long started = profile_begin();
+    off_t size = 0;
+    int result = hash_open_file(file_path, hash_out, &size);
+    profile_end(PROFILE_HASH, started);
+    counters_add(COUNTER_FILES_READ, 1);
+    if (result == FRACTYL_OK && size > 0) {
+        profile_add_bytes(PROFILE_HASH, (unsigned long long)size);
+        counters_add(COUNTER_BYTES_HASHED, (unsigned long long)size);
+    }
+    return result;
 }
 
 void hash_to_string(const unsigned char *hash, char *hex_out) {
     if (!hash || !hex_out) return;
     
+    static const char digits[] = "0123456789abcdef";
     for (int i = 0; i < FRACTYL_HASH_SIZE; i++) {
-        sprintf(hex_out + (i * 2), "%02x", hash[i]);
+        hex_out[i * 2] = digits[hash[i] >> 4];
+        hex_out[i * 2 + 1] = digits[hash[i] & 0x0f];
     }
     hex_out[FRACTYL_HASH_HEX_SIZE - 1] = '\0';
 }
 
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
 int string_to_hash(const char *hex, unsigned char *hash_out) {
     if (!hex || !hash_out) {
         return FRACTYL_ERROR_GENERIC;
     }
-
+    
     if (strlen(hex) != FRACTYL_HASH_HEX_SIZE - 1) {
         return FRACTYL_ERROR_GENERIC;
     }
-
+    
     for (int i = 0; i < FRACTYL_HASH_SIZE; i++) {
-        if (sscanf(hex + (i * 2), "%2hhx", &hash_out[i]) != 1) {
+        int high = hex_value(hex[i * 2]);
+        int low = hex_value(hex[i * 2 + 1]);
+        if (high < 0 || low < 0) {
             return FRACTYL_ERROR_GENERIC;
         }
+        hash_out[i] = (unsigned char)(high << 4 | low);
     }
-
+    
     return FRACTYL_OK;
 }
 
@@ -105,4 +307,4 @@ int hash_is_zero(const unsigned char *hash) {
         if (hash[i] != 0) return 0;
     }
     return 1;
-}
\ No newline at end of file
+}
@@ -3,20 +3,63 @@
 
 #include "../include/fractyl.h"
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-#define FRACTYL_HASH_SIZE 32  // SHA-256 hash size in bytes
+#define FRACTYL_HASH_SIZE 32  // Hash size in bytes, the same for every algorithm
 #define FRACTYL_HASH_HEX_SIZE (FRACTYL_HASH_SIZE * 2 + 1)  // Hex string size
 
+// Content hash algorithms. A repository uses one for all object names,
+// chosen when it is created:
+//   objects.hash = sha256|blake3   (.fractyl/config, default sha256)
+// The id is recorded in index, pack and object headers, where the zero of
+// older formats reads as SHA-256.
+typedef enum {
+    HASH_ALGORITHM_SHA256 = 0,
+    HASH_ALGORITHM_BLAKE3 = 1
+} hash_algorithm_t;
+
+// Name used in the configuration
+const char* hash_algorithm_name(hash_algorithm_t algorithm);
+
+// Parse a configured name; FRACTYL_ERROR_NOT_FOUND if it is unknown
+int hash_algorithm_from_name(const char *name, hash_algorithm_t *algorithm_out);
+
+// Nonzero if id names an algorithm this build knows
+int hash_algorithm_valid(uint32_t id);
+
+// Algorithm of every hash computed in this process (SHA-256 until set)
+hash_algorithm_t hash_get_algorithm(void);
+int hash_set_algorithm(hash_algorithm_t algorithm);
+
+// Switch to the algorithm configured for the repository at fractyl_dir
+// Returns FRACTYL_ERROR_INVALID_STATE if objects.hash names no algorithm
+int hash_use_repository(const char *fractyl_dir);
+
 // Hash a file by path
 int hash_file(const char *file_path, unsigned char *hash_out);
 
 // Hash a data buffer
 int hash_data(const void *data, size_t size, unsigned char *hash_out);
 
+// Incremental hashing for content that arrives in pieces
+typedef struct hash_ctx hash_ctx_t;
+
+// Start a new hash; NULL when out of memory
+hash_ctx_t* hash_ctx_new(void);
+
+// Add the next piece of content
+int hash_ctx_update(hash_ctx_t *ctx, const void *data, size_t size);
+
+// Write the hash of everything added so far and free the context
+int hash_ctx_final(hash_ctx_t *ctx, unsigned char *hash_out);
+
+// Free a context without finishing it
+void hash_ctx_free(hash_ctx_t *ctx);
+
 // Convert hash bytes to hex string
 void hash_to_string(const unsigned char *hash, char *hex_out);
 
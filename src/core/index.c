@@ -1,125 +1,1374 @@
 #include "index.h"
+#include "hash.h"
 #include "../include/fractyl.h"
+#include "../utils/arena.h"
+#include "../utils/profile.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 
+// --- Path lookup table ---
+//
+// Open addressing with linear probing over entry positions. The table is a
+// cache: it is created on the first lookup in an index with at least
+// INDEX_LOOKUP_MIN_ENTRIES entries, kept current by the add/remove APIs, and
+// dropped whenever entries are reordered. Entries appended behind the API's
+// back (count grew past lookup_count) are picked up on the next lookup.
+
+#define INDEX_LOOKUP_MIN_ENTRIES 64
+
+struct index_lookup_slot {
+    uint32_t hash;
+    uint32_t entry;     // Entry position + 1; 0 marks an empty slot
+};
+
+static uint32_t path_hash(const char *path) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char*)path; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void lookup_drop(index_t *index) {
+    free(index->lookup);
+    index->lookup = NULL;
+    index->lookup_capacity = 0;
+    index->lookup_count = 0;
+}
+
+static void lookup_place(index_t *index, size_t pos) {
+    size_t mask = index->lookup_capacity - 1;
+    uint32_t hash = path_hash(index->entries[pos].path);
+    size_t slot = hash & mask;
+    
+    while (index->lookup[slot].entry != 0) {
+        slot = (slot + 1) & mask;
+    }
+    index->lookup[slot].hash = hash;
+    index->lookup[slot].entry = (uint32_t)(pos + 1);
+}
+
+// (Re)build the table for the first count entries, sized for at most 50% load
+static int lookup_rebuild(index_t *index, size_t min_entries) {
+    size_t capacity = 16;
+    while (capacity < min_entries * 2) {
+        capacity *= 2;
+    }
+    
+    struct index_lookup_slot *slots = calloc(capacity, sizeof(struct index_lookup_slot));
+    if (!slots) {
+        lookup_drop(index);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    free(index->lookup);
+    index->lookup = slots;
+    index->lookup_capacity = capacity;
+    for (size_t i = 0; i < index->count; i++) {
+        lookup_place(index, i);
+    }
+    index->lookup_count = index->count;
+    return FRACTYL_OK;
+}
+
+// Bring an existing table in line with the entry array
+static int lookup_sync(index_t *index) {
+    if (!index->lookup) return FRACTYL_OK;
+    
+    if (index->lookup_count > index->count) {
+        return lookup_rebuild(index, index->count);
+    }
+    if (index->count * 2 > index->lookup_capacity) {
+        return lookup_rebuild(index, index->count * 2);
+    }
+    while (index->lookup_count < index->count) {
+        lookup_place(index, index->lookup_count++);
+    }
+    return FRACTYL_OK;
+}
+
+// Returns the slot holding path, or -1. The table must be in sync.
+static long lookup_find_slot(const index_t *index, const char *path) {
+    size_t mask = index->lookup_capacity - 1;
+    uint32_t hash = path_hash(path);
+    size_t slot = hash & mask;
+    
+    while (index->lookup[slot].entry != 0) {
+        const struct index_lookup_slot *s = &index->lookup[slot];
+        if (s->hash == hash && strcmp(index->entries[s->entry - 1].path, path) == 0) {
+            return (long)slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+// Backward-shift deletion keeps probe sequences intact without tombstones
+static void lookup_delete_slot(index_t *index, size_t slot) {
+    size_t mask = index->lookup_capacity - 1;
+    size_t hole = slot;
+    size_t next = (slot + 1) & mask;
+    
+    while (index->lookup[next].entry != 0) {
+        size_t home = index->lookup[next].hash & mask;
+        // Move next into the hole unless its home lies cyclically in (hole, next]
+        int stays = (hole <= next) ? (hole < home && home <= next)
+                                    : (hole < home || home <= next);
+        if (!stays) {
+            index->lookup[hole] = index->lookup[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    index->lookup[hole].hash = 0;
+    index->lookup[hole].entry = 0;
+}
+
+// Position of path in the entry array, or -1. Builds the table when worthwhile.
+static long index_find_position(const index_t *index, const char *path) {
+    // The lookup table is a cache, so maintaining it on a const index is fine
+    index_t *mutable_index = (index_t*)index;
+    
+    if (!index->lookup && index->count >= INDEX_LOOKUP_MIN_ENTRIES) {
+        lookup_rebuild(mutable_index, index->count);
+    }
+    
+    if (index->lookup && lookup_sync(mutable_index) == FRACTYL_OK && index->lookup) {
+        long slot = lookup_find_slot(index, path);
+        return slot < 0 ? -1 : (long)index->lookup[slot].entry - 1;
+    }
+    
+    for (size_t i = 0; i < index->count; ++i) {
+        if (index->entries[i].path && strcmp(index->entries[i].path, path) == 0) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+int index_prepare_lookup(const index_t *index) {
+    if (!index) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    index_t *mutable_index = (index_t*)index;
+    if (!index->lookup) {
+        return lookup_rebuild(mutable_index, index->count);
+    }
+    return lookup_sync(mutable_index);
+}
+
 // --- Index management implementation ---
 
+// Version 1 entries carry mode, size and mtime; version 2 appends the
+// fields below and version 3 records the hash algorithm in the header.
+// Those are a stream of variable-length records in host byte order.
+// Versions 4 and 5 are an entry table and a path pool (see index.h);
+// version 5 is the only one written. All are read, 1-3 as SHA-256.
+#define INDEX_FORMAT_VERSION 5
+#define INDEX_STREAM_VERSION 3      // Newest stream format
+#define INDEX_TABLE_VERSION 4       // Oldest table format: paths stored whole
+
+// Table layout
+#define INDEX_TABLE_HEADER_SIZE 32
+#define INDEX_TABLE_SORTED 0x1      // Header flag: entries in strcmp() order of their paths
+// Version 5 stores every path but each INDEX_RESTART_INTERVAL'th as the
+// length it shares with the previous path and the rest
+#define INDEX_RESTART_INTERVAL 16
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+// Entry record, all fields little-endian:
+//   0  hash[32]
+//  32  u32 path offset into the pool     36  u32 mode
+//  40  u32 flags     44  u32 uid     48  u32 gid     52  u32 reserved
+//  56  u32 mtime_nsec                    60  u32 ctime_nsec
+//  64  i64 size      72  i64 mtime   80  i64 ctime
+//  88  u64 ino       96  u64 dev
+void index_record_encode(unsigned char *rec, const index_entry_t *entry, uint32_t path_offset) {
+    memcpy(rec, entry->hash, 32);
+    put_u32(rec + 32, path_offset);
+    put_u32(rec + 36, (uint32_t)entry->mode);
+    put_u32(rec + 40, entry->flags);
+    put_u32(rec + 44, entry->uid);
+    put_u32(rec + 48, entry->gid);
+    put_u32(rec + 52, 0);
+    put_u32(rec + 56, entry->mtime_nsec);
+    put_u32(rec + 60, entry->ctime_nsec);
+    put_u64(rec + 64, (uint64_t)(int64_t)entry->size);
+    put_u64(rec + 72, (uint64_t)(int64_t)entry->mtime);
+    put_u64(rec + 80, (uint64_t)(int64_t)entry->ctime);
+    put_u64(rec + 88, entry->ino);
+    put_u64(rec + 96, entry->dev);
+}
+
+// Everything but the path
+static void decode_fields(const unsigned char *rec, index_entry_t *entry) {
+    memcpy(entry->hash, rec, 32);
+    entry->mode = (mode_t)get_u32(rec + 36);
+    entry->flags = get_u32(rec + 40);
+    entry->uid = get_u32(rec + 44);
+    entry->gid = get_u32(rec + 48);
+    entry->mtime_nsec = get_u32(rec + 56);
+    entry->ctime_nsec = get_u32(rec + 60);
+    entry->size = (off_t)(int64_t)get_u64(rec + 64);
+    entry->mtime = (time_t)(int64_t)get_u64(rec + 72);
+    entry->ctime = (time_t)(int64_t)get_u64(rec + 80);
+    entry->ino = get_u64(rec + 88);
+    entry->dev = get_u64(rec + 96);
+}
+
+int index_record_decode(const unsigned char *rec, const char *pool, size_t pool_size,
+                        index_entry_t *entry) {
+    uint32_t path_offset = get_u32(rec + 32);
+    // The pool ends in a NUL, so any offset inside it is a terminated string
+    if (path_offset >= pool_size || pool[path_offset] == '\0') {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    decode_fields(rec, entry);
+    entry->path = (char *)pool + path_offset;
+    return FRACTYL_OK;
+}
+
+// --- Prefix-compressed paths (version 5) ---
+//
+// A path is stored as a LEB128 varint, the number of leading bytes it
+// shares with the previous path in the table, followed by the rest of it
+// and a NUL. Each INDEX_RESTART_INTERVAL'th path shares nothing, so any
+// path is rebuilt from at most that many records.
+
+// Bytes shared by a and b
+static size_t common_prefix(const char *a, const char *b) {
+    size_t n = 0;
+    while (a[n] && a[n] == b[n]) n++;
+    return n;
+}
+
+static size_t varint_size(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static size_t put_varint(unsigned char *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+// Split the encoded path at offset into its shared length and suffix
+static int read_prefixed(const char *pool, size_t pool_size, uint32_t offset, size_t *shared_out,
+                         const char **suffix_out) {
+    uint64_t shared = 0;
+    for (int shift = 0; ; shift += 7) {
+        if (offset >= pool_size || shift > 28) return FRACTYL_ERROR_GENERIC;
+        unsigned char byte = (unsigned char)pool[offset++];
+        shared |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    // The pool ends in a NUL, so the suffix is terminated
+    if (offset >= pool_size) return FRACTYL_ERROR_GENERIC;
+    *shared_out = (size_t)shared;
+    *suffix_out = pool + offset;
+    return FRACTYL_OK;
+}
+
+// Rebuild path i in *buf, which holds path i - 1 (of *len bytes) unless
+// i is a restart point. The buffer grows as needed.
+static int expand_path(const unsigned char *table, size_t entry_size, const char *pool,
+                       size_t pool_size, size_t i, char **buf, size_t *capacity, size_t *len) {
+    size_t shared;
+    const char *suffix;
+    int result = read_prefixed(pool, pool_size, get_u32(table + i * entry_size + 32), &shared, &suffix);
+    if (result != FRACTYL_OK) return result;
+    if (i % INDEX_RESTART_INTERVAL == 0 ? shared != 0 : shared > *len) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    
+    size_t suffix_len = strlen(suffix);
+    if (shared + suffix_len == 0) return FRACTYL_ERROR_GENERIC;
+    if (shared + suffix_len + 1 > *capacity) {
+        size_t new_capacity = *capacity ? *capacity : 256;
+        while (new_capacity < shared + suffix_len + 1) new_capacity *= 2;
+        char *grown = realloc(*buf, new_capacity);
+        if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        *buf = grown;
+        *capacity = new_capacity;
+    }
+    memcpy(*buf + shared, suffix, suffix_len + 1);
+    *len = shared + suffix_len;
+    return FRACTYL_OK;
+}
+
+typedef struct {
+    size_t count;
+    size_t entry_size;
+    const unsigned char *table;
+    const char *pool;
+    size_t pool_size;
+    int sorted;
+    int prefixed;               // Version 5: paths are prefix-compressed
+} table_layout_t;
+
+// Header: "FIDX", u32 version, u32 count, u32 hash algorithm, u32 entry
+// size, u32 flags, u64 pool size; then the entry table, then the pool of
+// paths. Returns FRACTYL_ERROR_NOT_FOUND for the stream versions.
+static int parse_table(const unsigned char *data, size_t size, table_layout_t *layout) {
+    if (size < 4) return FRACTYL_ERROR_IO;
+    if (memcmp(data, "FIDX", 4) != 0) return FRACTYL_ERROR_GENERIC; // Not a valid index file
+    if (size < 8) return FRACTYL_ERROR_IO;
+    uint32_t version = get_u32(data + 4);
+    if (version < INDEX_TABLE_VERSION || version > INDEX_FORMAT_VERSION) {
+        return version >= 1 && version <= INDEX_STREAM_VERSION ? FRACTYL_ERROR_NOT_FOUND
+                                                               : FRACTYL_ERROR_GENERIC;
+    }
+    layout->prefixed = version >= 5;
+    if (size < INDEX_TABLE_HEADER_SIZE) return FRACTYL_ERROR_IO;
+    
+    // An index naming its files by another algorithm is of no use here
+    if (get_u32(data + 12) != (uint32_t)hash_get_algorithm()) {
+        return FRACTYL_ERROR_HASH_MISMATCH;
+    }
+    
+    // Entries may grow fields at their end; readers skip what they don't know
+    layout->count = get_u32(data + 8);
+    layout->entry_size = get_u32(data + 16);
+    layout->sorted = (get_u32(data + 20) & INDEX_TABLE_SORTED) != 0;
+    uint64_t pool_size = get_u64(data + 24);
+    if (layout->entry_size < INDEX_RECORD_SIZE) return FRACTYL_ERROR_GENERIC;
+    
+    uint64_t table_size = (uint64_t)layout->count * layout->entry_size;
+    uint64_t available = size - INDEX_TABLE_HEADER_SIZE;
+    if (table_size > available || pool_size != available - table_size) {
+        return FRACTYL_ERROR_IO;
+    }
+    layout->table = data + INDEX_TABLE_HEADER_SIZE;
+    layout->pool = (const char *)layout->table + table_size;
+    layout->pool_size = (size_t)pool_size;
+    if (layout->count > 0 && (pool_size == 0 || layout->pool[pool_size - 1] != '\0')) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    return FRACTYL_OK;
+}
+
+static void release_storage(void *storage, size_t size, int mapped) {
+    if (!storage) return;
+    if (mapped) {
+        munmap(storage, size);
+    } else {
+        free(storage);
+    }
+}
+
+// Rebuild the prefix-compressed paths of layout into one pool, which
+// becomes the index's storage in place of the serialized index
+static int load_prefixed_paths(index_t *index, const table_layout_t *layout) {
+    // First the size, so the pool is allocated once and never moves
+    size_t total = 0, len = 0;
+    for (size_t i = 0; i < layout->count; i++) {
+        size_t shared;
+        const char *suffix;
+        if (read_prefixed(layout->pool, layout->pool_size,
+                          get_u32(layout->table + i * layout->entry_size + 32), &shared,
+                          &suffix) != FRACTYL_OK ||
+            (i % INDEX_RESTART_INTERVAL == 0 ? shared != 0 : shared > len)) {
+            return FRACTYL_ERROR_GENERIC;
+        }
+        len = shared + strlen(suffix);
+        if (len == 0) return FRACTYL_ERROR_GENERIC;
+        total += len + 1;
+    }
+    
+    char *pool = malloc(total ? total : 1);
+    if (!pool) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    char *prev = pool;
+    size_t offset = 0;
+    for (size_t i = 0; i < layout->count; i++) {
+        size_t shared;
+        const char *suffix;
+        if (read_prefixed(layout->pool, layout->pool_size,
+                          get_u32(layout->table + i * layout->entry_size + 32), &shared,
+                          &suffix) != FRACTYL_OK) {
+            free(pool);
+            return FRACTYL_ERROR_GENERIC;
+        }
+        char *path = pool + offset;
+        memmove(path, prev, shared);
+        size_t suffix_len = strlen(suffix);
+        memcpy(path + shared, suffix, suffix_len + 1);
+        index->entries[i].path = path;
+        prev = path;
+        offset += shared + suffix_len + 1;
+    }
+    index->storage = pool;
+    index->storage_size = total ? total : 1;
+    index->storage_mapped = 0;
+    return FRACTYL_OK;
+}
+
+// Load a table index from storage, which the index takes over on success.
+// Version 4 paths point into it; version 5 ones are rebuilt and storage is
+// released.
+static int load_table(index_t *index, void *storage, size_t size, int mapped) {
+    table_layout_t layout;
+    int result = parse_table(storage, size, &layout);
+    if (result != FRACTYL_OK) return result;
+    
+    if (layout.count > 0) {
+        index->entries = malloc(sizeof(index_entry_t) * layout.count);
+        if (!index->entries) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        index->capacity = layout.count;
+    }
+    for (size_t i = 0; i < layout.count; i++) {
+        index_entry_t *entry = &index->entries[i];
+        const unsigned char *rec = layout.table + i * layout.entry_size;
+        memset(entry, 0, sizeof(*entry));
+        if (layout.prefixed) {
+            decode_fields(rec, entry);
+        } else if (index_record_decode(rec, layout.pool, layout.pool_size, entry) != FRACTYL_OK) {
+            result = FRACTYL_ERROR_GENERIC;
+            break;
+        }
+    }
+    if (result == FRACTYL_OK && layout.prefixed) {
+        result = load_prefixed_paths(index, &layout);
+    }
+    if (result != FRACTYL_OK) {
+        free(index->entries);
+        memset(index, 0, sizeof(index_t));
+        return result;
+    }
+    
+    index->count = layout.count;
+    if (layout.prefixed) {
+        release_storage(storage, size, mapped);
+    } else {
+        index->storage = storage;
+        index->storage_size = size;
+        index->storage_mapped = mapped;
+    }
+    return FRACTYL_OK;
+}
+
+// Copy everything but the path
+static void copy_entry_data(index_entry_t *dest, const index_entry_t *src) {
+    char *path = dest->path;
+    *dest = *src;
+    dest->path = path;
+}
+
+static int read_stat_fields(FILE *fp, index_entry_t *entry) {
+    int64_t ctime_sec;
+    if (fread(&entry->mtime_nsec, sizeof(uint32_t), 1, fp) != 1 ||
+        fread(&ctime_sec, sizeof(int64_t), 1, fp) != 1 ||
+        fread(&entry->ctime_nsec, sizeof(uint32_t), 1, fp) != 1 ||
+        fread(&entry->ino, sizeof(uint64_t), 1, fp) != 1 ||
+        fread(&entry->dev, sizeof(uint64_t), 1, fp) != 1 ||
+        fread(&entry->uid, sizeof(uint32_t), 1, fp) != 1 ||
+        fread(&entry->gid, sizeof(uint32_t), 1, fp) != 1 ||
+        fread(&entry->flags, sizeof(uint32_t), 1, fp) != 1) {
+        return FRACTYL_ERROR_IO;
+    }
+    entry->ctime = (time_t)ctime_sec;
+    return FRACTYL_OK;
+}
+
+void index_entry_set_stat(index_entry_t *entry, const struct stat *st, time_t scan_start) {
+    entry->mode = st->st_mode;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim.tv_sec;
+    entry->mtime_nsec = (uint32_t)st->st_mtim.tv_nsec;
+    entry->ctime = st->st_ctim.tv_sec;
+    entry->ctime_nsec = (uint32_t)st->st_ctim.tv_nsec;
+    entry->ino = (uint64_t)st->st_ino;
+    entry->dev = (uint64_t)st->st_dev;
+    entry->uid = (uint32_t)st->st_uid;
+    entry->gid = (uint32_t)st->st_gid;
+    
+    index_entry_update_racy(entry, scan_start);
+}
+
+void index_entry_update_racy(index_entry_t *entry, time_t since) {
+    // Git's racily clean problem: a write later in the same timestamp tick
+    // would leave mtime unchanged. Compare whole seconds so filesystems with
+    // coarse timestamps are covered as well.
+    entry->flags &= ~INDEX_ENTRY_RACY;
+    if (entry->mtime >= since || entry->ctime >= since) {
+        entry->flags |= INDEX_ENTRY_RACY;
+    }
+}
+
+size_t index_adopt_stat(index_t *index, const index_t *cache) {
+    if (!index || !cache || !index_is_sorted(index) || !index_is_sorted(cache)) return 0;
+    
+    size_t adopted = 0, j = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        index_entry_t *entry = &index->entries[i];
+        while (j < cache->count && strcmp(cache->entries[j].path, entry->path) < 0) j++;
+        if (j >= cache->count) break;
+    
+        const index_entry_t *cached = &cache->entries[j];
+        if (strcmp(cached->path, entry->path) != 0 || memcmp(cached->hash, entry->hash, 32) != 0 ||
+            cached->mode != entry->mode) {
+            continue;
+        }
+        entry->size = cached->size;
+        entry->mtime = cached->mtime;
+        entry->mtime_nsec = cached->mtime_nsec;
+        entry->ctime = cached->ctime;
+        entry->ctime_nsec = cached->ctime_nsec;
+        entry->ino = cached->ino;
+        entry->dev = cached->dev;
+        entry->uid = cached->uid;
+        entry->gid = cached->gid;
+        entry->flags = (entry->flags & ~INDEX_ENTRY_RACY) | (cached->flags & INDEX_ENTRY_RACY);
+        adopted++;
+    }
+    return adopted;
+}
+
+int index_entry_stat_matches(const index_entry_t *entry, const struct stat *st) {
+    if (!entry || !st) return 0;
+    if (entry->flags & INDEX_ENTRY_RACY) return 0;
+    if (entry->size != st->st_size || entry->mtime != st->st_mtim.tv_sec) return 0;
+    
+    // Entries from version 1 indexes only know size and mtime seconds
+    if (entry->ctime == 0 && entry->ino == 0) return 1;
+    
+    return entry->mtime_nsec == (uint32_t)st->st_mtim.tv_nsec &&
+           entry->ctime == st->st_ctim.tv_sec &&
+           entry->ctime_nsec == (uint32_t)st->st_ctim.tv_nsec &&
+           entry->ino == (uint64_t)st->st_ino &&
+           entry->dev == (uint64_t)st->st_dev &&
+           entry->uid == (uint32_t)st->st_uid &&
+           entry->gid == (uint32_t)st->st_gid &&
+           entry->mode == st->st_mode;
+}
+
+// Read a version 1-3 index from fp into the zeroed index; closes fp
+static int load_stream(index_t *index, FILE *fp) {
+    // Read binary format:
+    // Header: "FIDX" (4 bytes) + version (4 bytes) + entry count (4 bytes)
+    // + hash algorithm (4 bytes, version 3)
+    char magic[5];
+    uint32_t version, count;
+    
+    if (fread(magic, 1, 4, fp) != 4) {
+        fclose(fp);
+        return FRACTYL_ERROR_IO;
+    }
+    magic[4] = '\0';
+    
+    if (strcmp(magic, "FIDX") != 0) {
+        fclose(fp);
+        return FRACTYL_ERROR_GENERIC; // Not a valid index file
+    }
+    
+    if (fread(&version, sizeof(uint32_t), 1, fp) != 1 ||
+        fread(&count, sizeof(uint32_t), 1, fp) != 1) {
+        fclose(fp);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    if (version < 1 || version > INDEX_STREAM_VERSION) {
+        fclose(fp);
+        return FRACTYL_ERROR_GENERIC; // Unsupported version
+    }
+    
+    // An index naming its files by another algorithm is of no use here
+    uint32_t algorithm = HASH_ALGORITHM_SHA256;
+    if (version >= 3 && fread(&algorithm, sizeof(uint32_t), 1, fp) != 1) {
+        fclose(fp);
+        return FRACTYL_ERROR_IO;
+    }
+    if (algorithm != (uint32_t)hash_get_algorithm()) {
+        fclose(fp);
+        return FRACTYL_ERROR_HASH_MISMATCH;
+    }
+    
+    if (count == 0) {
+        fclose(fp);
+        return FRACTYL_OK; // Empty index
+    }
+    
+    // Allocate entries
+    index->entries = malloc(sizeof(index_entry_t) * count);
+    if (!index->entries) {
+        fclose(fp);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    index->capacity = count;
+    index->count = 0;
+    
+    // Read each entry
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t path_len;
+        if (fread(&path_len, sizeof(uint16_t), 1, fp) != 1) {
+            index_free(index);
+            fclose(fp);
+            return FRACTYL_ERROR_IO;
+        }
+    
+        if (path_len == 0 || path_len > 4096) { // Sanity check
+            index_free(index);
+            fclose(fp);
+            return FRACTYL_ERROR_GENERIC;
+        }
+    
+        // Read path straight into the arena
+        char *path_buf = arena_alloc_string(&index->arena, path_len);
+        if (!path_buf) {
+            index_free(index);
+            fclose(fp);
+            return FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+    
+        if (fread(path_buf, 1, path_len, fp) != path_len) {
+            index_free(index);
+            fclose(fp);
+            return FRACTYL_ERROR_IO;
+        }
+        path_buf[path_len] = '\0';
+    
+        // Read hash, mode, size, mtime
+        index_entry_t *entry = &index->entries[index->count];
+        memset(entry, 0, sizeof(*entry));
+        entry->path = path_buf;
+    
+        if (fread(entry->hash, 1, 32, fp) != 32 ||
+            fread(&entry->mode, sizeof(mode_t), 1, fp) != 1 ||
+            fread(&entry->size, sizeof(off_t), 1, fp) != 1 ||
+            fread(&entry->mtime, sizeof(time_t), 1, fp) != 1) {
+            index_free(index);
+            fclose(fp);
+            return FRACTYL_ERROR_IO;
+        }
+    
+        // Version 2 adds the rest of the stat data
+        if (version >= 2 && read_stat_fields(fp, entry) != FRACTYL_OK) {
+            index_free(index);
+            fclose(fp);
+            return FRACTYL_ERROR_IO;
+        }
+    
+        index->count++;
+    }
+    
+    fclose(fp);
+    // Older writers kept scan order; loaded indexes are always in path order
+    if (!index_is_sorted(index)) {
+        index_sort(index, 1);
+    }
+    return FRACTYL_OK;
+}
+
+// Load an older index from memory
+static int load_stream_buffer(index_t *index, const void *data, size_t size) {
+    FILE *fp = fmemopen((void *)data, size, "rb");
+    if (!fp) {
+        return FRACTYL_ERROR_IO;
+    }
+    return load_stream(index, fp);
+}
+
+// Map the file at path; an empty file yields a NULL mapping. st_out, if
+// not NULL, receives the file's stat data.
+static int map_file(const char *path, void **map_out, size_t *size_out, struct stat *st_out) {
+    *map_out = NULL;
+    *size_out = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? FRACTYL_ERROR_NOT_FOUND : FRACTYL_ERROR_IO;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return FRACTYL_ERROR_IO;
+    }
+    if (st_out) *st_out = st;
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return FRACTYL_ERROR_IO;
+        }
+        *map_out = map;
+        *size_out = (size_t)st.st_size;
+    }
+    close(fd);
+    return FRACTYL_OK;
+}
+
+// --- Journal ---
+//
+// Changes saved by index_save_journaled() since the base was last written.
+// Layout, little-endian:
+//   header  "FJNL", u32 version, u32 hash algorithm, u32 record size, then
+//           the base it applies to: u64 inode, u64 size, i64 mtime,
+//           u32 mtime nsec, u32 entry count
+//   batch   u32 payload size, u32 change count, the payload, u32 FNV-1a of
+//           the payload; one per save
+//   change  u8 op, the path and a NUL, and for JOURNAL_UPSERT an entry record
+// A batch cut short by a crash ends the journal; the next save overwrites it.
+
+#define INDEX_JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 48
+#define JOURNAL_BATCH_HEADER_SIZE 8
+#define JOURNAL_UPSERT 'U'
+#define JOURNAL_DELETE 'D'
+
+typedef struct {
+    const char *path;             // Into the journal's data
+    const unsigned char *rec;     // Entry record; NULL for a deletion
+    size_t seq;                   // Position in the journal: the last change of a path wins
+} journal_change_t;
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t valid_size;            // End of the last complete batch; 0 if there is no journal for the base
+    journal_change_t *changes;
+    size_t count;
+} journal_t;
+
+static uint32_t journal_checksum(const unsigned char *data, size_t size) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int journal_path(const char *path, char *out, size_t out_size) {
+    if (snprintf(out, out_size, "%s%s", path, INDEX_JOURNAL_SUFFIX) >= (int)out_size) {
+        return FRACTYL_ERROR_PATH_TOO_LONG;
+    }
+    return FRACTYL_OK;
+}
+
+// The header of a journal for the base described by base_st and base_count
+static void journal_header(unsigned char *header, const struct stat *base_st, size_t base_count) {
+    memcpy(header, "FJNL", 4);
+    put_u32(header + 4, INDEX_JOURNAL_VERSION);
+    put_u32(header + 8, (uint32_t)hash_get_algorithm());
+    put_u32(header + 12, INDEX_RECORD_SIZE);
+    put_u64(header + 16, (uint64_t)base_st->st_ino);
+    put_u64(header + 24, (uint64_t)base_st->st_size);
+    put_u64(header + 32, (uint64_t)(int64_t)base_st->st_mtim.tv_sec);
+    put_u32(header + 40, (uint32_t)base_st->st_mtim.tv_nsec);
+    put_u32(header + 44, (uint32_t)base_count);
+}
+
+static void journal_free(journal_t *journal) {
+    free(journal->data);
+    free(journal->changes);
+    memset(journal, 0, sizeof(*journal));
+}
+
+// Parse one batch's payload, appending its changes to the journal
+static int journal_parse_batch(journal_t *journal, const unsigned char *payload, size_t size,
+                               size_t count) {
+    journal_change_t *changes = realloc(journal->changes,
+                                        sizeof(journal_change_t) * (journal->count + count + 1));
+    if (!changes) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    journal->changes = changes;
+    
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (offset >= size) return FRACTYL_ERROR_GENERIC;
+        unsigned char op = payload[offset++];
+        const char *path = (const char *)payload + offset;
+        const unsigned char *end = memchr(path, '\0', size - offset);
+        if ((op != JOURNAL_UPSERT && op != JOURNAL_DELETE) || !end || path[0] == '\0') {
+            return FRACTYL_ERROR_GENERIC;
+        }
+        offset = (size_t)(end - payload) + 1;
+        const unsigned char *rec = NULL;
+        if (op == JOURNAL_UPSERT) {
+            if (size - offset < INDEX_RECORD_SIZE) return FRACTYL_ERROR_GENERIC;
+            rec = payload + offset;
+            offset += INDEX_RECORD_SIZE;
+        }
+        journal_change_t *change = &changes[journal->count + i];
+        change->path = path;
+        change->rec = rec;
+        change->seq = journal->count + i;
+    }
+    if (offset != size) return FRACTYL_ERROR_GENERIC;
+    journal->count += count;
+    return FRACTYL_OK;
+}
+
+// Read the journal of the index at path. A missing journal, or one written
+// for another base, reads as empty with valid_size 0.
+static int journal_read(const char *path, const struct stat *base_st, size_t base_count,
+                        journal_t *journal) {
+    memset(journal, 0, sizeof(*journal));
+    char jpath[4096];
+    int result = journal_path(path, jpath, sizeof(jpath));
+    if (result != FRACTYL_OK) return result;
+    
+    FILE *fp = fopen(jpath, "rb");
+    if (!fp) {
+        return errno == ENOENT ? FRACTYL_OK : FRACTYL_ERROR_IO;
+    }
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0) {
+        fclose(fp);
+        return FRACTYL_ERROR_IO;
+    }
+    journal->size = (size_t)st.st_size;
+    journal->data = malloc(journal->size ? journal->size : 1);
+    if (!journal->data) {
+        fclose(fp);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    size_t got = fread(journal->data, 1, journal->size, fp);
+    fclose(fp);
+    if (got != journal->size) {
+        journal_free(journal);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    unsigned char header[JOURNAL_HEADER_SIZE];
+    journal_header(header, base_st, base_count);
+    if (journal->size < JOURNAL_HEADER_SIZE || memcmp(journal->data, header, sizeof(header)) != 0) {
+        // Stale: the base was rewritten without removing it
+        return FRACTYL_OK;
+    }
+    
+    size_t offset = JOURNAL_HEADER_SIZE;
+    while (journal->size - offset >= JOURNAL_BATCH_HEADER_SIZE) {
+        const unsigned char *batch = journal->data + offset;
+        size_t payload_size = get_u32(batch);
+        size_t count = get_u32(batch + 4);
+        if (journal->size - offset - JOURNAL_BATCH_HEADER_SIZE < (uint64_t)payload_size + 4) break;
+        const unsigned char *payload = batch + JOURNAL_BATCH_HEADER_SIZE;
+        if (get_u32(payload + payload_size) != journal_checksum(payload, payload_size)) break;
+    
+        // A batch that does not parse is dropped whole
+        result = journal_parse_batch(journal, payload, payload_size, count);
+        if (result == FRACTYL_ERROR_OUT_OF_MEMORY) {
+            journal_free(journal);
+            return result;
+        }
+        if (result != FRACTYL_OK) break;
+        offset += JOURNAL_BATCH_HEADER_SIZE + payload_size + 4;
+    }
+    journal->valid_size = offset;
+    return FRACTYL_OK;
+}
+
+static int journal_change_compare(const void *a, const void *b) {
+    const journal_change_t *ca = a;
+    const journal_change_t *cb = b;
+    int cmp = strcmp(ca->path, cb->path);
+    if (cmp != 0) return cmp;
+    return ca->seq < cb->seq ? -1 : ca->seq > cb->seq;
+}
+
+// Apply the journal's changes to index, a loaded base. The entries are
+// merged into a new array in path order; journal paths are copied to the
+// arena, so the journal can be freed afterwards.
+static int journal_apply(index_t *index, journal_t *journal) {
+    if (journal->count == 0) return FRACTYL_OK;
+    if (!index_is_sorted(index)) {
+        int result = index_sort(index, 1);
+        if (result != FRACTYL_OK) return result;
+    }
+    qsort(journal->changes, journal->count, sizeof(journal_change_t), journal_change_compare);
+    
+    size_t capacity = index->count + journal->count;
+    index_entry_t *merged = malloc(sizeof(index_entry_t) * capacity);
+    if (!merged) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    size_t count = 0, i = 0, j = 0;
+    while (i < index->count || j < journal->count) {
+        if (j >= journal->count) {
+            merged[count++] = index->entries[i++];
+            continue;
+        }
+        // Only the last change to a path counts
+        const journal_change_t *change = &journal->changes[j];
+        while (j + 1 < journal->count && strcmp(journal->changes[j + 1].path, change->path) == 0) {
+            change = &journal->changes[++j];
+        }
+        int cmp = i < index->count ? strcmp(index->entries[i].path, change->path) : 1;
+        if (cmp < 0) {
+            merged[count++] = index->entries[i++];
+            continue;
+        }
+    
+        const char *path = cmp == 0 ? index->entries[i].path : NULL;
+        if (cmp == 0) i++;
+        j++;
+        if (!change->rec) continue;
+        if (!path) {
+            path = arena_strdup(&index->arena, change->path);
+            if (!path) {
+                free(merged);
+                return FRACTYL_ERROR_OUT_OF_MEMORY;
+            }
+        }
+        index_entry_t *entry = &merged[count++];
+        memset(entry, 0, sizeof(*entry));
+        decode_fields(change->rec, entry);
+        entry->path = (char *)path;
+    }
+    
+    free(index->entries);
+    index->entries = merged;
+    index->count = count;
+    index->capacity = capacity;
+    lookup_drop(index);
+    return FRACTYL_OK;
+}
+
+// Load the base index at path, without its journal; FRACTYL_ERROR_NOT_FOUND
+// if there is none
+static int load_base(index_t *index, const char *path, struct stat *st_out) {
+    memset(index, 0, sizeof(index_t));
+    
+    void *map;
+    size_t size;
+    int result = map_file(path, &map, &size, st_out);
+    if (result != FRACTYL_OK) return result;
+    if (!map) return FRACTYL_ERROR_IO;
+    
+    // The index keeps the mapping if its entries point into it
+    result = load_table(index, map, size, 1);
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        result = load_stream_buffer(index, map, size);
+    }
+    if (result != FRACTYL_OK || !index->storage) {
+        munmap(map, size);
+    }
+    return result;
+}
+
+static int load_index(index_t *index, const char *path) {
+    
+    struct stat base_st;
+    int result = load_base(index, path, &base_st);
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        // If file doesn't exist, that's ok - start with empty index
+        memset(index, 0, sizeof(index_t));
+        return FRACTYL_OK;
+    }
+    if (result != FRACTYL_OK) return result;
+    
+    journal_t journal;
+    result = journal_read(path, &base_st, index->count, &journal);
+    if (result == FRACTYL_OK) result = journal_apply(index, &journal);
+    journal_free(&journal);
+    if (result != FRACTYL_OK) index_free(index);
+    return result;
+}
+
 int index_load(index_t *index, const char *path) {
     if (!index || !path) {
         return FRACTYL_ERROR_GENERIC;
     }
     
-    // Initialize index structure
+    unsigned long long started = profile_begin();
+    int result = load_index(index, path);
+    profile_end(PROFILE_INDEX_LOAD, started);
+    return result;
+}
+
+int index_load_owned(index_t *index, void *data, size_t size) {
+    if (!index || !data) {
+        free(data);
+        return FRACTYL_ERROR_GENERIC;
+    }
+    
     memset(index, 0, sizeof(index_t));
+    int result = size == 0 ? FRACTYL_ERROR_IO : load_table(index, data, size, 0);
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        result = load_stream_buffer(index, data, size);
+    }
+    if (result != FRACTYL_OK || !index->storage) {
+        free(data);
+    }
+    return result;
+}
+
+int index_load_buffer(index_t *index, const void *data, size_t size) {
+    if (!index || !data) {
+        return FRACTYL_ERROR_GENERIC;
+    }
     
-    FILE *fp = fopen(path, "rb");
+    memset(index, 0, sizeof(index_t));
+    if (size == 0) {
+        return FRACTYL_ERROR_IO;
+    }
+    
+    // Older indexes are parsed straight from data. Table ones are loaded
+    // from a copy the index can keep.
+    table_layout_t layout;
+    int result = parse_table(data, size, &layout);
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        return load_stream_buffer(index, data, size);
+    }
+    if (result != FRACTYL_OK) return result;
+    
+    void *copy = malloc(size);
+    if (!copy) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    memcpy(copy, data, size);
+    return index_load_owned(index, copy, size);
+}
+
+static int entry_pointer_compare(const void *a, const void *b) {
+    const index_entry_t *ea = *(const index_entry_t * const *)a;
+    const index_entry_t *eb = *(const index_entry_t * const *)b;
+    return strcmp(ea->path, eb->path);
+}
+
+// Bytes the prefix-compressed path of order[i] takes in the pool
+static size_t prefixed_size(const index_entry_t **order, size_t i, size_t *shared_out) {
+    size_t shared = i % INDEX_RESTART_INTERVAL == 0 ? 0 : common_prefix(order[i - 1]->path, order[i]->path);
+    *shared_out = shared;
+    return varint_size(shared) + strlen(order[i]->path + shared) + 1;
+}
+
+// Write the header, the entry table and the pool for the given entries
+static int write_table(FILE *fp, const index_entry_t **order, size_t count, uint64_t pool_size) {
+    unsigned char header[INDEX_TABLE_HEADER_SIZE];
+    memcpy(header, "FIDX", 4);
+    put_u32(header + 4, INDEX_FORMAT_VERSION);
+    put_u32(header + 8, (uint32_t)count);
+    put_u32(header + 12, (uint32_t)hash_get_algorithm());
+    put_u32(header + 16, INDEX_RECORD_SIZE);
+    put_u32(header + 20, INDEX_TABLE_SORTED);
+    put_u64(header + 24, pool_size);
+    if (fwrite(header, 1, sizeof(header), fp) != sizeof(header)) {
+        return FRACTYL_ERROR_IO;
+    }
+    
+    uint64_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        unsigned char rec[INDEX_RECORD_SIZE];
+        size_t shared;
+        index_record_encode(rec, order[i], (uint32_t)offset);
+        if (fwrite(rec, 1, sizeof(rec), fp) != sizeof(rec)) {
+            return FRACTYL_ERROR_IO;
+        }
+        offset += prefixed_size(order, i, &shared);
+    }
+    for (size_t i = 0; i < count; i++) {
+        unsigned char prefix[10];
+        size_t shared;
+        prefixed_size(order, i, &shared);
+        size_t prefix_len = put_varint(prefix, shared);
+        const char *suffix = order[i]->path + shared;
+        size_t suffix_len = strlen(suffix) + 1;
+        if (fwrite(prefix, 1, prefix_len, fp) != prefix_len ||
+            fwrite(suffix, 1, suffix_len, fp) != suffix_len) {
+            return FRACTYL_ERROR_IO;
+        }
+    }
+    return FRACTYL_OK;
+}
+
+// Pointers to the entries to write, in path order; *order_out is freed by the caller
+static int prepare_order(const index_t *index, const index_entry_t ***order_out, size_t *count_out,
+                         uint64_t *pool_size_out) {
+    // Entries are written in path order, sorting pointers only if needed
+    const index_entry_t **order = malloc(sizeof(index_entry_t *) * (index->count ? index->count : 1));
+    if (!order) {
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    size_t count = 0;
+    int sorted = 1;
+    for (size_t i = 0; i < index->count; i++) {
+        const index_entry_t *entry = &index->entries[i];
+        if (!entry->path || !entry->path[0]) continue;
+        if (count > 0 && strcmp(order[count - 1]->path, entry->path) > 0) sorted = 0;
+        order[count++] = entry;
+    }
+    if (!sorted) {
+        qsort(order, count, sizeof(index_entry_t *), entry_pointer_compare);
+    }
+    
+    // Paths are compressed against their neighbours in the final order
+    uint64_t pool_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t shared;
+        pool_size += prefixed_size(order, i, &shared);
+    }
+    if (pool_size > UINT32_MAX || count > UINT32_MAX) {
+        free(order);
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    *order_out = order;
+    *count_out = count;
+    *pool_size_out = pool_size;
+    return FRACTYL_OK;
+}
+
+int index_serialize(const index_t *index, void **data_out, size_t *size_out) {
+    if (!index || !data_out || !size_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    *data_out = NULL;
+    *size_out = 0;
+    
+    const index_entry_t **order;
+    size_t count;
+    uint64_t pool_size;
+    int result = prepare_order(index, &order, &count, &pool_size);
+    if (result != FRACTYL_OK) return result;
+    
+    char *data = NULL;
+    size_t size = 0;
+    FILE *fp = open_memstream(&data, &size);
+    if (!fp) {
+        free(order);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    result = write_table(fp, order, count, pool_size);
+    free(order);
+    if (fclose(fp) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    if (result != FRACTYL_OK) {
+        free(data);
+        return result;
+    }
+    *data_out = data;
+    *size_out = size;
+    return FRACTYL_OK;
+}
+
+static int save_base(const index_t *index, const char *path) {
+    const index_entry_t **order;
+    size_t count;
+    uint64_t pool_size;
+    int result = prepare_order(index, &order, &count, &pool_size);
+    if (result != FRACTYL_OK) return result;
+    
+    // Written beside the target and renamed over it, so a mapping of the
+    // old file stays valid and a crash never leaves half an index
+    char temp_path[4096];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmpXXXXXX", path) >= (int)sizeof(temp_path)) {
+        free(order);
+        return FRACTYL_ERROR_PATH_TOO_LONG;
+    }
+    int fd = mkstemp(temp_path);
+    FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
     if (!fp) {
-        // If file doesn't exist, that's ok - start with empty index
-        if (errno == ENOENT) {
-            return FRACTYL_OK;
+        if (fd >= 0) {
+            close(fd);
+            unlink(temp_path);
         }
+        free(order);
         return FRACTYL_ERROR_IO;
     }
+    fchmod(fd, 0644);
     
-    // Read binary format:
-    // Header: "FIDX" (4 bytes) + version (4 bytes) + entry count (4 bytes)
-    char magic[5];
-    uint32_t version, count;
+    result = write_table(fp, order, count, pool_size);
+    free(order);
+    if (fclose(fp) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_IO;
+    }
+    if (result == FRACTYL_OK && rename(temp_path, path) != 0) {
+        result = FRACTYL_ERROR_IO;
+    }
+    if (result != FRACTYL_OK) {
+        unlink(temp_path);
+        return result;
+    }
     
-    if (fread(magic, 1, 4, fp) != 4) {
-        fclose(fp);
-        return FRACTYL_ERROR_IO;
+    // The new base holds everything the journal did. Should this fail, the
+    // journal no longer matches the base and is ignored.
+    char jpath[4096];
+    if (journal_path(path, jpath, sizeof(jpath)) == FRACTYL_OK) {
+        unlink(jpath);
     }
-    magic[4] = '\0';
+    return FRACTYL_OK;
+}
+
+// Append the changes that turn current into the entries of order to payload
+static int journal_diff(const index_t *current, const index_entry_t **order, size_t count,
+                        FILE *payload, size_t *changes_out) {
+    size_t changes = 0, i = 0, j = 0;
+    while (i < current->count || j < count) {
+        const index_entry_t *old_entry = i < current->count ? &current->entries[i] : NULL;
+        const index_entry_t *new_entry = j < count ? order[j] : NULL;
+        int cmp = !old_entry ? 1 : !new_entry ? -1 : strcmp(old_entry->path, new_entry->path);
+        unsigned char rec[INDEX_RECORD_SIZE];
+        if (cmp == 0) {
+            // Stat data counts too: it is what lets the next scan skip a file
+            unsigned char old_rec[INDEX_RECORD_SIZE];
+            index_record_encode(old_rec, old_entry, 0);
+            index_record_encode(rec, new_entry, 0);
+            i++;
+            j++;
+            if (memcmp(old_rec, rec, sizeof(rec)) == 0) continue;
+        } else if (cmp > 0) {
+            index_record_encode(rec, new_entry, 0);
+            j++;
+        } else {
+            i++;
+        }
     
-    if (strcmp(magic, "FIDX") != 0) {
-        fclose(fp);
-        return FRACTYL_ERROR_GENERIC; // Not a valid index file
+        const char *path = cmp < 0 ? old_entry->path : new_entry->path;
+        if (fputc(cmp < 0 ? JOURNAL_DELETE : JOURNAL_UPSERT, payload) == EOF ||
+            fwrite(path, 1, strlen(path) + 1, payload) != strlen(path) + 1 ||
+            (cmp >= 0 && fwrite(rec, 1, sizeof(rec), payload) != sizeof(rec))) {
+            return FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+        changes++;
+    }
+    *changes_out = changes;
+    return FRACTYL_OK;
+}
+
+// Write one batch at offset of the journal at jpath; with header, start a
+// new journal instead, replacing any stale one by rename
+static int journal_append(const char *jpath, const unsigned char *header, size_t offset,
+                          const unsigned char *payload, size_t payload_size, size_t count) {
+    size_t size = (header ? JOURNAL_HEADER_SIZE : 0) + JOURNAL_BATCH_HEADER_SIZE + payload_size + 4;
+    unsigned char *data = malloc(size);
+    if (!data) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    unsigned char *batch = data;
+    if (header) {
+        memcpy(data, header, JOURNAL_HEADER_SIZE);
+        batch += JOURNAL_HEADER_SIZE;
     }
+    put_u32(batch, (uint32_t)payload_size);
+    put_u32(batch + 4, (uint32_t)count);
+    memcpy(batch + JOURNAL_BATCH_HEADER_SIZE, payload, payload_size);
+    put_u32(batch + JOURNAL_BATCH_HEADER_SIZE + payload_size, journal_checksum(payload, payload_size));
     
-    if (fread(&version, sizeof(uint32_t), 1, fp) != 1 ||
-        fread(&count, sizeof(uint32_t), 1, fp) != 1) {
-        fclose(fp);
+    char temp_path[4096];
+    int fd;
+    if (header) {
+        if (snprintf(temp_path, sizeof(temp_path), "%s.tmpXXXXXX", jpath) >= (int)sizeof(temp_path)) {
+            free(data);
+            return FRACTYL_ERROR_PATH_TOO_LONG;
+        }
+        fd = mkstemp(temp_path);
+        if (fd >= 0) fchmod(fd, 0644);
+        offset = 0;
+    } else {
+        fd = open(jpath, O_WRONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        free(data);
         return FRACTYL_ERROR_IO;
     }
     
-    if (version != 1) {
-        fclose(fp);
-        return FRACTYL_ERROR_GENERIC; // Unsupported version
+    // Anything past the last complete batch is a torn write to replace
+    int result = FRACTYL_OK;
+    if (ftruncate(fd, (off_t)offset) != 0 || pwrite(fd, data, size, (off_t)offset) != (ssize_t)size) {
+        result = FRACTYL_ERROR_IO;
     }
-    
-    if (count == 0) {
-        fclose(fp);
-        return FRACTYL_OK; // Empty index
+    free(data);
+    if (close(fd) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_IO;
     }
+    if (header) {
+        if (result == FRACTYL_OK && rename(temp_path, jpath) != 0) {
+            result = FRACTYL_ERROR_IO;
+        }
+        if (result != FRACTYL_OK) unlink(temp_path);
+    }
+    return result;
+}
+
+static int save_journaled(const index_t *index, const char *path) {
+    char jpath[4096];
+    int result = journal_path(path, jpath, sizeof(jpath));
+    if (result != FRACTYL_OK) return result;
     
-    // Allocate entries
-    index->entries = malloc(sizeof(index_entry_t) * count);
-    if (!index->entries) {
-        fclose(fp);
-        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    // What the files say now: the base and the journal written for it.
+    // Without a readable base there is nothing to append to.
+    index_t current;
+    struct stat base_st;
+    if (load_base(&current, path, &base_st) != FRACTYL_OK) {
+        index_free(&current);
+        return save_base(index, path);
+    }
+    size_t base_count = current.count;
+    journal_t journal;
+    result = journal_read(path, &base_st, base_count, &journal);
+    if (result == FRACTYL_OK) result = journal_apply(&current, &journal);
+    if (result == FRACTYL_OK && !index_is_sorted(&current)) {
+        result = index_sort(&current, 1);
     }
     
-    index->capacity = count;
-    index->count = 0;
+    const index_entry_t **order = NULL;
+    size_t count = 0;
+    uint64_t pool_size;
+    if (result == FRACTYL_OK) result = prepare_order(index, &order, &count, &pool_size);
     
-    // Read each entry
-    for (uint32_t i = 0; i < count; i++) {
-        uint16_t path_len;
-        if (fread(&path_len, sizeof(uint16_t), 1, fp) != 1) {
-            index_free(index);
-            fclose(fp);
-            return FRACTYL_ERROR_IO;
-        }
-        
-        if (path_len == 0 || path_len > 4096) { // Sanity check
-            index_free(index);
-            fclose(fp);
-            return FRACTYL_ERROR_GENERIC;
-        }
-        
-        // Read path
-        char *path_buf = malloc(path_len + 1);
-        if (!path_buf) {
-            index_free(index);
-            fclose(fp);
-            return FRACTYL_ERROR_OUT_OF_MEMORY;
-        }
-        
-        if (fread(path_buf, 1, path_len, fp) != path_len) {
-            free(path_buf);
-            index_free(index);
-            fclose(fp);
-            return FRACTYL_ERROR_IO;
-        }
-        path_buf[path_len] = '\0';
-        
-        // Read hash, mode, size, mtime
-        index_entry_t *entry = &index->entries[index->count];
-        entry->path = path_buf;
-        
-        if (fread(entry->hash, 1, 32, fp) != 32 ||
-            fread(&entry->mode, sizeof(mode_t), 1, fp) != 1 ||
-            fread(&entry->size, sizeof(off_t), 1, fp) != 1 ||
-            fread(&entry->mtime, sizeof(time_t), 1, fp) != 1) {
-            index_free(index);
-            fclose(fp);
-            return FRACTYL_ERROR_IO;
-        }
-        
-        index->count++;
+    char *payload = NULL;
+    size_t payload_size = 0, changes = 0;
+    FILE *fp = NULL;
+    if (result == FRACTYL_OK) {
+        fp = open_memstream(&payload, &payload_size);
+        if (!fp) result = FRACTYL_ERROR_OUT_OF_MEMORY;
     }
+    if (result == FRACTYL_OK) result = journal_diff(&current, order, count, fp, &changes);
+    if (fp && fclose(fp) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    free(order);
+    index_free(&current);
     
-    fclose(fp);
-    return FRACTYL_OK;
+    size_t pending = journal.count + changes;
+    size_t limit = base_count * INDEX_JOURNAL_MAX_PERCENT / 100;
+    if (result != FRACTYL_OK || payload_size > UINT32_MAX ||
+        (pending > INDEX_JOURNAL_MIN_CHANGES && pending > limit)) {
+        // Fold the journal into a new base
+        result = save_base(index, path);
+    } else if (changes > 0) {
+        unsigned char header[JOURNAL_HEADER_SIZE];
+        journal_header(header, &base_st, base_count);
+        result = journal_append(jpath, journal.valid_size ? NULL : header, journal.valid_size,
+                                (const unsigned char *)payload, payload_size, changes);
+    }
+    free(payload);
+    journal_free(&journal);
+    return result;
 }
 
 int index_save(const index_t *index, const char *path) {
@@ -127,65 +1376,234 @@ int index_save(const index_t *index, const char *path) {
         return FRACTYL_ERROR_GENERIC;
     }
     
-    FILE *fp = fopen(path, "wb");
-    if (!fp) {
+    unsigned long long started = profile_begin();
+    int result = save_base(index, path);
+    profile_end(PROFILE_INDEX_SAVE, started);
+    return result;
+}
+
+int index_save_journaled(const index_t *index, const char *path) {
+    if (!index || !path) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    
+    unsigned long long started = profile_begin();
+    int result = save_journaled(index, path);
+    profile_end(PROFILE_INDEX_SAVE, started);
+    return result;
+}
+
+// --- Read-only views ---
+
+int index_view_open_owned(index_view_t *view, void *data, size_t size) {
+    if (!view) {
+        free(data);
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    memset(view, 0, sizeof(*view));
+    if (!data || size == 0) {
+        free(data);
         return FRACTYL_ERROR_IO;
     }
     
-    // Write header
-    const char magic[] = "FIDX";
-    uint32_t version = 1;
-    uint32_t count = (uint32_t)index->count;
+    table_layout_t layout;
+    int result = parse_table(data, size, &layout);
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        // Older formats are loaded in full behind the same interface
+        view->legacy = 1;
+        result = index_load_owned(&view->index, data, size);
+        view->count = view->index.count;
+        return result;
+    }
+    if (result != FRACTYL_OK) {
+        free(data);
+        return result;
+    }
     
-    if (fwrite(magic, 1, 4, fp) != 4 ||
-        fwrite(&version, sizeof(uint32_t), 1, fp) != 1 ||
-        fwrite(&count, sizeof(uint32_t), 1, fp) != 1) {
-        fclose(fp);
-        return FRACTYL_ERROR_IO;
+    view->table = layout.table;
+    view->pool = layout.pool;
+    view->pool_size = layout.pool_size;
+    view->count = layout.count;
+    view->entry_size = layout.entry_size;
+    view->sorted = layout.sorted;
+    view->prefixed = layout.prefixed;
+    view->storage = data;
+    view->storage_size = size;
+    return FRACTYL_OK;
+}
+
+int index_view_open(index_view_t *view, const char *path) {
+    if (!view || !path) {
+        return FRACTYL_ERROR_INVALID_ARGS;
     }
+    memset(view, 0, sizeof(*view));
     
-    // Write entries
-    for (size_t i = 0; i < index->count; i++) {
-        const index_entry_t *entry = &index->entries[i];
-        if (!entry->path) continue;
-        
-        uint16_t path_len = (uint16_t)strlen(entry->path);
-        
-        if (fwrite(&path_len, sizeof(uint16_t), 1, fp) != 1 ||
-            fwrite(entry->path, 1, path_len, fp) != path_len ||
-            fwrite(entry->hash, 1, 32, fp) != 32 ||
-            fwrite(&entry->mode, sizeof(mode_t), 1, fp) != 1 ||
-            fwrite(&entry->size, sizeof(off_t), 1, fp) != 1 ||
-            fwrite(&entry->mtime, sizeof(time_t), 1, fp) != 1) {
-            fclose(fp);
-            return FRACTYL_ERROR_IO;
-        }
+    void *map;
+    size_t size;
+    int result = map_file(path, &map, &size, NULL);
+    if (result != FRACTYL_OK) return result;
+    if (!map) return FRACTYL_ERROR_IO;
+    
+    table_layout_t layout;
+    result = parse_table(map, size, &layout);
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        view->legacy = 1;
+        result = index_load_buffer(&view->index, map, size);
+        view->count = view->index.count;
+        munmap(map, size);
+        return result;
+    }
+    if (result != FRACTYL_OK) {
+        munmap(map, size);
+        return result;
     }
     
-    fclose(fp);
+    view->table = layout.table;
+    view->pool = layout.pool;
+    view->pool_size = layout.pool_size;
+    view->count = layout.count;
+    view->entry_size = layout.entry_size;
+    view->sorted = layout.sorted;
+    view->prefixed = layout.prefixed;
+    view->storage = map;
+    view->storage_size = size;
+    view->storage_mapped = 1;
     return FRACTYL_OK;
 }
 
+// Rebuild path i of a version 5 view in its path buffer, continuing from
+// the path already there when it is earlier in the same restart interval
+static const char* view_expand(index_view_t *view, size_t i) {
+    size_t from = i - i % INDEX_RESTART_INTERVAL;
+    if (view->path_entry > 0) {
+        size_t current = view->path_entry - 1;
+        if (current == i) return view->path;
+        if (current >= from && current < i) from = current + 1;
+    }
+    
+    view->path_entry = 0;
+    for (size_t j = from; j <= i; j++) {
+        if (expand_path(view->table, view->entry_size, view->pool, view->pool_size, j, &view->path,
+                        &view->path_capacity, &view->path_len) != FRACTYL_OK) {
+            return NULL;
+        }
+    }
+    view->path_entry = i + 1;
+    return view->path;
+}
+
+int index_view_get(index_view_t *view, size_t i, index_entry_t *entry_out) {
+    if (!view || !entry_out || i >= view->count) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    if (view->legacy) {
+        *entry_out = view->index.entries[i];
+        return FRACTYL_OK;
+    }
+    memset(entry_out, 0, sizeof(*entry_out));
+    if (view->prefixed) {
+        decode_fields(view->table + i * view->entry_size, entry_out);
+        entry_out->path = (char *)view_expand(view, i);
+        return entry_out->path ? FRACTYL_OK : FRACTYL_ERROR_GENERIC;
+    }
+    return index_record_decode(view->table + i * view->entry_size, view->pool, view->pool_size,
+                               entry_out);
+}
+
+const unsigned char* index_view_hash(const index_view_t *view, size_t i) {
+    if (!view || i >= view->count) return NULL;
+    return view->legacy ? view->index.entries[i].hash : view->table + i * view->entry_size;
+}
+
+// Path of entry i, or NULL if its record is damaged. Version 5 paths are
+// only stored whole at restart points; others come from view_expand().
+static const char* view_path(index_view_t *view, size_t i) {
+    uint32_t offset = get_u32(view->table + i * view->entry_size + 32);
+    if (!view->prefixed) {
+        return offset < view->pool_size ? view->pool + offset : NULL;
+    }
+    if (i % INDEX_RESTART_INTERVAL != 0) return view_expand(view, i);
+    
+    size_t shared;
+    const char *suffix;
+    if (read_prefixed(view->pool, view->pool_size, offset, &shared, &suffix) != FRACTYL_OK || shared) {
+        return NULL;
+    }
+    return suffix;
+}
+
+long index_view_find(index_view_t *view, const char *path) {
+    if (!view || !path) return -1;
+    if (view->legacy) {
+        const index_entry_t *entry = index_find_entry(&view->index, path);
+        return entry ? (long)(entry - view->index.entries) : -1;
+    }
+    
+    if (!view->sorted) {
+        for (size_t i = 0; i < view->count; i++) {
+            const char *p = view_path(view, i);
+            if (p && strcmp(p, path) == 0) return (long)i;
+        }
+        return -1;
+    }
+    
+    size_t i = index_view_lower_bound(view, path);
+    if (i >= view->count) return -1;
+    const char *p = view_path(view, i);
+    return p && strcmp(p, path) == 0 ? (long)i : -1;
+}
+
+size_t index_view_lower_bound(index_view_t *view, const char *path) {
+    if (!view || !path || view->legacy || !view->sorted) return 0;
+    
+    // Binary search over the whole paths: every entry's in version 4, the
+    // restart points' in version 5
+    size_t step = view->prefixed ? INDEX_RESTART_INTERVAL : 1;
+    size_t lo = 0, hi = (view->count + step - 1) / step;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const char *p = view_path(view, mid * step);
+        if (!p) return 0;
+        if (strcmp(p, path) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t end = lo * step < view->count ? lo * step : view->count;
+    if (step == 1 || lo == 0) return end;
+    
+    // Then a scan of the interval before the first restart point not below path
+    for (size_t i = (lo - 1) * step + 1; i < end; i++) {
+        const char *p = view_expand(view, i);
+        if (!p) return 0;
+        if (strcmp(p, path) >= 0) return i;
+    }
+    return end;
+}
+
+void index_view_close(index_view_t *view) {
+    if (!view) return;
+    if (view->legacy) {
+        index_free(&view->index);
+    }
+    free(view->path);
+    release_storage(view->storage, view->storage_size, view->storage_mapped);
+    memset(view, 0, sizeof(*view));
+}
+
 int index_add_entry(index_t *index, const index_entry_t *entry) {
     if (!index || !entry || !entry->path) {
         return FRACTYL_ERROR_GENERIC;
     }
     
     // Search for existing entry with same path
-    for (size_t i = 0; i < index->count; ++i) {
-        if (strcmp(index->entries[i].path, entry->path) == 0) {
-            // Replace existing entry contents
-            free(index->entries[i].path);
-            index->entries[i].path = strdup(entry->path);
-            if (!index->entries[i].path) {
-                return FRACTYL_ERROR_OUT_OF_MEMORY;
-            }
-            memcpy(index->entries[i].hash, entry->hash, sizeof(entry->hash));
-            index->entries[i].mode = entry->mode;
-            index->entries[i].size = entry->size;
-            index->entries[i].mtime = entry->mtime;
-            return FRACTYL_OK;
-        }
+    long existing = index_find_position(index, entry->path);
+    if (existing >= 0) {
+        // Replace existing entry contents; the path is unchanged, so the
+        // lookup table stays valid
+        copy_entry_data(&index->entries[existing], entry);
+        return FRACTYL_OK;
     }
     
     // Expand if needed
@@ -199,18 +1617,16 @@ int index_add_entry(index_t *index, const index_entry_t *entry) {
         index->capacity = newcap;
     }
     
-    // Deep copy entry
+    // Deep copy entry; the path goes into the index's arena
     index_entry_t *dest = &index->entries[index->count];
-    dest->path = strdup(entry->path);
+    dest->path = arena_strdup(&index->arena, entry->path);
     if (!dest->path) {
         return FRACTYL_ERROR_OUT_OF_MEMORY;
     }
-    memcpy(dest->hash, entry->hash, sizeof(entry->hash));
-    dest->mode = entry->mode;
-    dest->size = entry->size;
-    dest->mtime = entry->mtime;
+    copy_entry_data(dest, entry);
     
     index->count++;
+    lookup_sync(index);
     return FRACTYL_OK;
 }
 
@@ -232,18 +1648,216 @@ int index_add_entry_direct(index_t *index, const index_entry_t *entry) {
         index->capacity = newcap;
     }
     
-    // Deep copy entry
+    // Deep copy entry; the path goes into the index's arena
     index_entry_t *dest = &index->entries[index->count];
-    dest->path = strdup(entry->path);
+    dest->path = arena_strdup(&index->arena, entry->path);
     if (!dest->path) {
         return FRACTYL_ERROR_OUT_OF_MEMORY;
     }
-    memcpy(dest->hash, entry->hash, sizeof(entry->hash));
-    dest->mode = entry->mode;
-    dest->size = entry->size;
-    dest->mtime = entry->mtime;
+    copy_entry_data(dest, entry);
     
     index->count++;
+    lookup_sync(index);
+    return FRACTYL_OK;
+}
+
+// Below this many entries a single qsort beats spinning up threads
+#define INDEX_PARALLEL_SORT_MIN 16384
+#define INDEX_SORT_MAX_THREADS 64
+
+static int entry_path_compare(const void *a, const void *b) {
+    const index_entry_t *ea = (const index_entry_t*)a;
+    const index_entry_t *eb = (const index_entry_t*)b;
+    return strcmp(ea->path, eb->path);
+}
+
+typedef struct {
+    index_entry_t *base;
+    size_t count;
+} sort_run_t;
+
+typedef struct {
+    const index_entry_t *left;
+    size_t left_count;
+    const index_entry_t *right;
+    size_t right_count;
+    index_entry_t *out;
+} merge_job_t;
+
+static void* sort_run_worker(void *arg) {
+    sort_run_t *run = (sort_run_t*)arg;
+    qsort(run->base, run->count, sizeof(index_entry_t), entry_path_compare);
+    return NULL;
+}
+
+static void* merge_run_worker(void *arg) {
+    merge_job_t *job = (merge_job_t*)arg;
+    size_t i = 0, j = 0, k = 0;
+    
+    while (i < job->left_count && j < job->right_count) {
+        if (strcmp(job->left[i].path, job->right[j].path) <= 0) {
+            job->out[k++] = job->left[i++];
+        } else {
+            job->out[k++] = job->right[j++];
+        }
+    }
+    while (i < job->left_count) job->out[k++] = job->left[i++];
+    while (j < job->right_count) job->out[k++] = job->right[j++];
+    return NULL;
+}
+
+// Run fn over every job, one thread each; falls back to the calling thread
+// for any job whose thread could not be started
+static void run_jobs(void *(*fn)(void *), void *jobs, size_t job_size, size_t job_count) {
+    pthread_t threads[INDEX_SORT_MAX_THREADS];
+    int started[INDEX_SORT_MAX_THREADS];
+    
+    for (size_t i = 0; i < job_count; i++) {
+        void *job = (char*)jobs + i * job_size;
+        started[i] = pthread_create(&threads[i], NULL, fn, job) == 0;
+        if (!started[i]) {
+            fn(job);
+        }
+    }
+    for (size_t i = 0; i < job_count; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+}
+
+// Merge neighbouring sorted runs of index's entries pairwise, each pass in
+// parallel, ping-ponging between the entry array and scratch (as large)
+static void merge_runs(index_t *index, sort_run_t *runs, size_t run_count, index_entry_t *scratch) {
+    index_entry_t *src = index->entries;
+    index_entry_t *dst = scratch;
+    while (run_count > 1) {
+        merge_job_t jobs[INDEX_SORT_MAX_THREADS];
+        size_t job_count = 0;
+        size_t next_count = 0;
+    
+        for (size_t i = 0; i < run_count; i += 2) {
+            size_t out_offset = (size_t)(runs[i].base - src);
+            merge_job_t *job = &jobs[job_count++];
+            job->left = runs[i].base;
+            job->left_count = runs[i].count;
+            job->right = i + 1 < run_count ? runs[i + 1].base : NULL;
+            job->right_count = i + 1 < run_count ? runs[i + 1].count : 0;
+            job->out = dst + out_offset;
+    
+            runs[next_count].base = dst + out_offset;
+            runs[next_count].count = job->left_count + job->right_count;
+            next_count++;
+        }
+    
+        run_jobs(merge_run_worker, jobs, sizeof(merge_job_t), job_count);
+        run_count = next_count;
+    
+        index_entry_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    
+    if (src != index->entries) {
+        memcpy(index->entries, src, sizeof(index_entry_t) * index->count);
+    }
+}
+
+int index_sort(index_t *index, int num_threads) {
+    if (!index) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    if (index->count < 2) {
+        return FRACTYL_OK;
+    }
+    
+    // Positions are about to change; the table is rebuilt on the next lookup
+    lookup_drop(index);
+    
+    if (num_threads > INDEX_SORT_MAX_THREADS) num_threads = INDEX_SORT_MAX_THREADS;
+    if (num_threads < 2 || index->count < INDEX_PARALLEL_SORT_MIN) {
+        qsort(index->entries, index->count, sizeof(index_entry_t), entry_path_compare);
+        return FRACTYL_OK;
+    }
+    
+    index_entry_t *scratch = malloc(sizeof(index_entry_t) * index->count);
+    if (!scratch) {
+        // Not fatal: sort in place on this thread instead
+        qsort(index->entries, index->count, sizeof(index_entry_t), entry_path_compare);
+        return FRACTYL_OK;
+    }
+    
+    // Phase 1: sort num_threads contiguous runs concurrently
+    sort_run_t runs[INDEX_SORT_MAX_THREADS];
+    size_t run_count = (size_t)num_threads;
+    size_t per_run = (index->count + run_count - 1) / run_count;
+    size_t offset = 0;
+    for (size_t i = 0; i < run_count; i++) {
+        size_t n = index->count - offset < per_run ? index->count - offset : per_run;
+        runs[i].base = index->entries + offset;
+        runs[i].count = n;
+        offset += n;
+    }
+    run_jobs(sort_run_worker, runs, sizeof(sort_run_t), run_count);
+    
+    // Phase 2: merge the runs
+    merge_runs(index, runs, run_count, scratch);
+    free(scratch);
+    return FRACTYL_OK;
+}
+
+int index_merge_shards(index_t *dest, index_t *shards, size_t shard_count, int num_threads) {
+    if (!dest || (!shards && shard_count > 0)) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    size_t total = dest->count;
+    int sorted = shard_count < INDEX_SORT_MAX_THREADS && index_is_sorted(dest);
+    for (size_t i = 0; i < shard_count; i++) {
+        total += shards[i].count;
+        sorted = sorted && index_is_sorted(&shards[i]);
+    }
+    
+    if (total > dest->capacity) {
+        index_entry_t *new_entries = realloc(dest->entries, sizeof(index_entry_t) * total);
+        if (!new_entries) {
+            return FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+        dest->entries = new_entries;
+        dest->capacity = total;
+    }
+    
+    // Parts already in path order only need merging
+    sort_run_t runs[INDEX_SORT_MAX_THREADS];
+    size_t run_count = 0;
+    index_entry_t *scratch = sorted ? malloc(sizeof(index_entry_t) * (total ? total : 1)) : NULL;
+    if (scratch) {
+        runs[run_count++].count = dest->count;
+    }
+    
+    // Entries are moved, not copied: dest takes over the arenas their paths are in
+    for (size_t i = 0; i < shard_count; i++) {
+        if (shards[i].count > 0) {
+            memcpy(dest->entries + dest->count, shards[i].entries,
+                   sizeof(index_entry_t) * shards[i].count);
+            dest->count += shards[i].count;
+            if (scratch) runs[run_count++].count = shards[i].count;
+        }
+        arena_take(&dest->arena, &shards[i].arena);
+        free(shards[i].entries);
+        lookup_drop(&shards[i]);
+        memset(&shards[i], 0, sizeof(index_t));
+    }
+    
+    if (!scratch) return index_sort(dest, num_threads);
+    lookup_drop(dest);
+    size_t offset = 0;
+    for (size_t i = 0; i < run_count; i++) {
+        runs[i].base = dest->entries + offset;
+        offset += runs[i].count;
+    }
+    merge_runs(dest, runs, run_count, scratch);
+    free(scratch);
     return FRACTYL_OK;
 }
 
@@ -252,20 +1866,118 @@ int index_remove_entry(index_t *index, const char *path) {
         return FRACTYL_ERROR_GENERIC;
     }
     
-    for (size_t i = 0; i < index->count; ++i) {
-        if (strcmp(index->entries[i].path, path) == 0) {
-            free(index->entries[i].path);
-            
-            // Move the last entry to this position to avoid shifting everything
-            if (i != index->count - 1) {
-                index->entries[i] = index->entries[index->count - 1];
+    long pos = index_find_position(index, path);
+    if (pos < 0) {
+        return FRACTYL_ERROR_INDEX_NOT_FOUND;
+    }
+    
+    size_t i = (size_t)pos;
+    size_t last = index->count - 1;
+    
+    if (index->lookup) {
+        lookup_delete_slot(index, (size_t)lookup_find_slot(index, path));
+        if (i != last) {
+            // The last entry is about to move into position i
+            long moved = lookup_find_slot(index, index->entries[last].path);
+            index->lookup[moved].entry = (uint32_t)(i + 1);
+        }
+        index->lookup_count--;
+    }
+    
+    // Move the last entry to this position to avoid shifting everything;
+    // the removed path stays in the arena until the index is freed
+    if (i != last) {
+        index->entries[i] = index->entries[last];
+    }
+    
+    index->count--;
+    return FRACTYL_OK;
+}
+
+int index_is_sorted(const index_t *index) {
+    if (!index) return 0;
+    for (size_t i = 1; i < index->count; i++) {
+        if (strcmp(index->entries[i - 1].path, index->entries[i].path) > 0) return 0;
+    }
+    return 1;
+}
+
+static int report_change(index_change_t change, const index_entry_t *old_entry, const index_entry_t *new_entry,
+                         index_change_fn fn, void *ctx, index_diff_stats_t *stats) {
+    if (stats) {
+        if (change == INDEX_CHANGE_ADDED) stats->added++;
+        else if (change == INDEX_CHANGE_MODIFIED) stats->modified++;
+        else stats->deleted++;
+    }
+    return fn ? fn(change, old_entry, new_entry, ctx) : 0;
+}
+
+// Either side out of path order: each entry is looked up in the other
+// side's table instead. New entries come in the new index's order, then
+// the deleted ones in the old index's.
+static int index_diff_lookup(const index_t *old_index, const index_t *new_index, index_change_fn fn,
+                             void *ctx, index_diff_stats_t *stats) {
+    if (index_prepare_lookup(old_index) != FRACTYL_OK || index_prepare_lookup(new_index) != FRACTYL_OK) {
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    for (size_t j = 0; j < new_index->count; j++) {
+        const index_entry_t *new_entry = &new_index->entries[j];
+        const index_entry_t *old_entry = index_find_entry(old_index, new_entry->path);
+        if (old_entry && memcmp(old_entry->hash, new_entry->hash, 32) == 0 && old_entry->mode == new_entry->mode) {
+            continue;
+        }
+        int stop = report_change(old_entry ? INDEX_CHANGE_MODIFIED : INDEX_CHANGE_ADDED, old_entry, new_entry,
+                                 fn, ctx, stats);
+        if (stop != 0) return stop;
+    }
+    for (size_t i = 0; i < old_index->count; i++) {
+        const index_entry_t *old_entry = &old_index->entries[i];
+        if (index_find_entry(new_index, old_entry->path)) continue;
+        int stop = report_change(INDEX_CHANGE_DELETED, old_entry, NULL, fn, ctx, stats);
+        if (stop != 0) return stop;
+    }
+    return FRACTYL_OK;
+}
+
+int index_diff(const index_t *old_index, const index_t *new_index, index_change_fn fn, void *ctx,
+               index_diff_stats_t *stats) {
+    if (!old_index || !new_index) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    if (stats) memset(stats, 0, sizeof(*stats));
+    if (!index_is_sorted(old_index) || !index_is_sorted(new_index)) {
+        return index_diff_lookup(old_index, new_index, fn, ctx, stats);
+    }
+    
+    // Both sides in path order: one step of either or both per comparison
+    size_t i = 0, j = 0;
+    while (i < old_index->count || j < new_index->count) {
+        const index_entry_t *old_entry = i < old_index->count ? &old_index->entries[i] : NULL;
+        const index_entry_t *new_entry = j < new_index->count ? &new_index->entries[j] : NULL;
+        int cmp = !old_entry ? 1 : !new_entry ? -1 : strcmp(old_entry->path, new_entry->path);
+    
+        index_change_t change;
+        if (cmp < 0) {
+            change = INDEX_CHANGE_DELETED;
+            new_entry = NULL;
+            i++;
+        } else if (cmp > 0) {
+            change = INDEX_CHANGE_ADDED;
+            old_entry = NULL;
+            j++;
+        } else {
+            i++;
+            j++;
+            if (memcmp(old_entry->hash, new_entry->hash, 32) == 0 && old_entry->mode == new_entry->mode) {
+                continue;
             }
-            
-            index->count--;
-            return FRACTYL_OK;
+            change = INDEX_CHANGE_MODIFIED;
         }
+    
+        int stop = report_change(change, old_entry, new_entry, fn, ctx, stats);
+        if (stop != 0) return stop;
     }
-    return FRACTYL_ERROR_INDEX_NOT_FOUND;
+    return FRACTYL_OK;
 }
 
 int index_has_changes(const index_t *index, const char *workdir, int *has_changes) {
@@ -281,15 +1993,17 @@ int index_has_changes(const index_t *index, const char *workdir, int *has_change
 void index_free(index_t *index) {
     if (!index) return;
     
-    for (size_t i = 0; i < index->count; ++i) {
-        free(index->entries[i].path);
-        index->entries[i].path = NULL;
-    }
-    
+    // Paths are in the arena or the storage: nothing to free per entry
     free(index->entries);
     index->entries = NULL;
     index->count = 0;
     index->capacity = 0;
+    lookup_drop(index);
+    arena_free(&index->arena);
+    release_storage(index->storage, index->storage_size, index->storage_mapped);
+    index->storage = NULL;
+    index->storage_size = 0;
+    index->storage_mapped = 0;
 }
 
 void index_print(const index_t *index) {
@@ -314,12 +2028,8 @@ void index_print(const index_t *index) {
 const index_entry_t* index_find_entry(const index_t *index, const char *path) {
     if (!index || !path) return NULL;
     
-    for (size_t i = 0; i < index->count; ++i) {
-        if (index->entries[i].path && strcmp(index->entries[i].path, path) == 0) {
-            return &index->entries[i];
-        }
-    }
-    return NULL;
+    long pos = index_find_position(index, path);
+    return pos < 0 ? NULL : &index->entries[pos];
 }
 
 // Initialize empty index
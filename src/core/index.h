@@ -3,34 +3,179 @@
 
 #include "../include/core.h"
 #include <stddef.h>
+#include <sys/stat.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
-
+    
 // --- Index management API ---
-
+//
+// On disk an index is format version 5: a 32-byte header, a table of
+// fixed-size little-endian entry records sorted by path, and a pool of the
+// paths the records point to by offset. Each path is stored as the number
+// of bytes it shares with the one before plus the rest, except at restart
+// points every 16 entries, where it is whole; deep trees repeat long
+// directory prefixes, which this leaves out. An index can be mapped and
+// queried in place (index_view_t below); loading one allocates the entry
+// array and one buffer for all paths. Version 4, the same with every path
+// whole, and versions 1-3 are still read.
+    
+// Entry records of the table formats, also used by tree objects
+// (tree.h). Encoding puts path_offset where the path is; decoding points
+// entry->path into pool, which must end in a NUL.
+#define INDEX_RECORD_SIZE 104
+void index_record_encode(unsigned char *rec, const index_entry_t *entry, uint32_t path_offset);
+int index_record_decode(const unsigned char *rec, const char *pool, size_t pool_size,
+                        index_entry_t *entry);
+    
+// --- Journal ---
+//
+// The working index is kept as a base file plus a journal beside it (path
+// with INDEX_JOURNAL_SUFFIX): index_save_journaled() appends only the
+// entries that changed since the last save, and rewrites the base once the
+// journal would hold more than INDEX_JOURNAL_MAX_PERCENT of the base's
+// entry count, and more than INDEX_JOURNAL_MIN_CHANGES. The journal names
+// the base it was written for, so one left behind by a rewrite is ignored.
+#define INDEX_JOURNAL_SUFFIX ".journal"
+#define INDEX_JOURNAL_MAX_PERCENT 20
+#define INDEX_JOURNAL_MIN_CHANGES 64
+    
 // Initialize empty index
 int index_init(index_t *index);
-// Load index from disk
+// Load index from disk, with its journal's changes applied. A version 4
+// file stays mapped until index_free().
 int index_load(index_t *index, const char *path);
-// Save index to disk
+// Load an index from its serialized form, e.g. a snapshot's index object
+int index_load_buffer(index_t *index, const void *data, size_t size);
+// Same, taking over data (from malloc) instead of copying it; data is
+// freed by index_free(), or right away if the index does not need it
+int index_load_owned(index_t *index, void *data, size_t size);
+// Save index to disk, sorted by path, and remove its journal. The file is
+// replaced by rename, so indexes loaded from it stay valid.
 int index_save(const index_t *index, const char *path);
+// Save index to disk as changes appended to the journal of the index
+// already at path, or all of it when the base is due for a rewrite
+int index_save_journaled(const index_t *index, const char *path);
+// Serialize into a malloc'd buffer, in the same format index_save() writes
+int index_serialize(const index_t *index, void **data_out, size_t *size_out);
 // Add/update index entry
 int index_add_entry(index_t *index, const index_entry_t *entry);
 // Fast direct append - assumes caller has verified no duplicates exist
 int index_add_entry_direct(index_t *index, const index_entry_t *entry);
+// Sort entries by path, using up to num_threads threads for large indexes
+int index_sort(index_t *index, int num_threads);
+// Move every entry of the shards into dest and sort the result by path
+// (a merge when dest and the shards are each sorted already).
+// Paths must be unique across dest and all shards; the shards are left empty.
+int index_merge_shards(index_t *dest, index_t *shards, size_t shard_count, int num_threads);
 // Remove index entry
 int index_remove_entry(index_t *index, const char *path);
-// Find entry by path
+// Find entry by path. Uses the lookup table once the index is large enough.
 const index_entry_t* index_find_entry(const index_t *index, const char *path);
+// Build the lookup table now. Call before sharing an index between threads:
+// concurrent index_find_entry() calls are only safe on a prepared, unmodified index.
+int index_prepare_lookup(const index_t *index);
+// Fill an entry's stat fields from st. Entries modified in or after the
+// second the scan started are flagged INDEX_ENTRY_RACY.
+void index_entry_set_stat(index_entry_t *entry, const struct stat *st, time_t scan_start);
+// Recompute INDEX_ENTRY_RACY from the entry's own mtime and ctime, as
+// index_entry_set_stat() does with since as scan_start
+void index_entry_update_racy(index_entry_t *entry, time_t since);
+// Nonzero if st still describes the file recorded in entry, so its hash
+// can be reused without reading the file
+int index_entry_stat_matches(const index_entry_t *entry, const struct stat *st);
+// Give entries of index the stat data cache has for the same path, hash
+// and mode, e.g. the current index after a restore wrote the files anew.
+// Both must be sorted. Returns the number of entries updated.
+size_t index_adopt_stat(index_t *index, const index_t *cache);
+// Nonzero if the entries are in path (strcmp) order. Indexes
+// loaded from disk always are; sort scan results with index_sort().
+int index_is_sorted(const index_t *index);
+    
+// --- Comparing indexes ---
+    
+typedef enum {
+    INDEX_CHANGE_ADDED,       // Only in the new index
+    INDEX_CHANGE_MODIFIED,    // In both, with another hash or mode
+    INDEX_CHANGE_DELETED      // Only in the old index
+} index_change_t;
+    
+typedef struct {
+    size_t added;
+    size_t modified;
+    size_t deleted;
+} index_diff_stats_t;
+    
+// Called for each change in path order; old_entry is NULL for added
+// files and new_entry for deleted ones. A nonzero return stops the walk
+// and is returned by index_diff().
+typedef int (*index_change_fn)(index_change_t change, const index_entry_t *old_entry,
+                               const index_entry_t *new_entry, void *ctx);
+    
+// Compare two indexes: sorted ones are merge-joined in one linear pass,
+// in path order; otherwise every entry is looked up in the other side's
+// table, and changes come in index order, deleted files last. fn and
+// stats may be NULL.
+int index_diff(const index_t *old_index, const index_t *new_index, index_change_fn fn, void *ctx,
+               index_diff_stats_t *stats);
+    
 // Check if working dir differs from index
 int index_has_changes(const index_t *index, const char *workdir, int *has_changes);
 // Free index struct
 void index_free(index_t *index);
 // Print index for debugging
 void index_print(const index_t *index);
-
+    
+// --- Read-only views ---
+//
+// A view answers queries straight from the serialized index without
+// building an index_t, so opening one costs the same for ten entries or a
+// million. Entries filled in by index_view_get() point into the view; a
+// version 5 path is rebuilt from its restart point in a buffer of the view
+// and valid until the next index_view_get() or index_view_find(), so a
+// view is used by one thread at a time. Reading entries in order rebuilds
+// each path from the one before. Older formats are loaded in full behind
+// the same interface.
+    
+typedef struct {
+    size_t count;
+    // Table layout
+    const unsigned char *table;
+    size_t entry_size;
+    const char *pool;
+    size_t pool_size;
+    int sorted;
+    int prefixed;               // Version 5: paths are rebuilt into path
+    char *path;
+    size_t path_capacity;
+    size_t path_len;
+    size_t path_entry;          // Entry whose path is in path, + 1; 0 for none
+    void *storage;
+    size_t storage_size;
+    int storage_mapped;
+    // Versions 1-3
+    int legacy;
+    index_t index;
+} index_view_t;
+    
+// Map the index file at path
+int index_view_open(index_view_t *view, const char *path);
+// View an index in data (from malloc), which the view takes over
+int index_view_open_owned(index_view_t *view, void *data, size_t size);
+// Entry i in path order (file order for older formats)
+int index_view_get(index_view_t *view, size_t i, index_entry_t *entry_out);
+// Hash of entry i without decoding the rest
+const unsigned char* index_view_hash(const index_view_t *view, size_t i);
+// Position of path, or -1. A binary search over the restart points of the
+// sorted table, then a scan of at most one interval.
+long index_view_find(index_view_t *view, const char *path);
+// Position of the first entry whose path is not below path, count if
+// there is none; 0 for views that are not sorted (or on a damaged record),
+// which have to be read from the start
+size_t index_view_lower_bound(index_view_t *view, const char *path);
+void index_view_close(index_view_t *view);
+    
 #ifdef __cplusplus
 }
 #endif
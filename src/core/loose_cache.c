@@ -0,0 +1,236 @@
+#include "loose_cache.h"
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// Keys are the first 16 bytes of the hash; an all-zero slot is empty
+#define KEY_SIZE 16
+#define INITIAL_SLOTS 4096
+// Longest a deletion by another process can go unnoticed
+#define VALIDATE_INTERVAL_NS 1000000000LL
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define CACHE_CLOCK CLOCK_MONOTONIC_COARSE   // Read without entering the kernel
+#else
+#define CACHE_CLOCK CLOCK_MONOTONIC
+#endif
+
+// Object stores whose sets are kept at once: a repository and the shared
+// stores it reads from (see alternates.h)
+#define CACHE_STORES 10
+
+typedef struct {
+    int loaded;
+    char fractyl_dir[2048];
+    unsigned char *slots;
+    size_t capacity;
+    size_t count;
+    unsigned char fanout_read[256];
+    unsigned char fanout_exists[256];
+    struct timespec objects_mtime;
+    long long checked_ns;
+} loose_set_t;
+
+static pthread_rwlock_t cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static loose_set_t sets[CACHE_STORES];
+static size_t next_victim;
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CACHE_CLOCK, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int key_is_empty(const unsigned char *key) {
+    for (int i = 0; i < KEY_SIZE; i++) {
+        if (key[i]) return 0;
+    }
+    return 1;
+}
+
+static size_t key_slot(const unsigned char *hash, size_t capacity) {
+    uint64_t h;
+    memcpy(&h, hash + 1, sizeof(h));    // Byte 0 is shared by a whole fanout
+    return (size_t)h & (capacity - 1);
+}
+
+// Caller holds either lock
+static int set_find(const loose_set_t *set, const unsigned char *hash) {
+    if (!set->slots || key_is_empty(hash)) return 0;
+    for (size_t i = key_slot(hash, set->capacity);; i = (i + 1) & (set->capacity - 1)) {
+        const unsigned char *key = set->slots + i * KEY_SIZE;
+        if (key_is_empty(key)) return 0;
+        if (memcmp(key, hash, KEY_SIZE) == 0) return 1;
+    }
+}
+
+static void set_insert_slot(unsigned char *slots, size_t capacity, const unsigned char *hash) {
+    for (size_t i = key_slot(hash, capacity);; i = (i + 1) & (capacity - 1)) {
+        unsigned char *key = slots + i * KEY_SIZE;
+        if (key_is_empty(key)) {
+            memcpy(key, hash, KEY_SIZE);
+            return;
+        }
+        if (memcmp(key, hash, KEY_SIZE) == 0) return;
+    }
+}
+
+// Caller holds the write lock. Nothing is recorded if memory runs out;
+// the object is then looked up on disk as before.
+static void set_add(loose_set_t *set, const unsigned char *hash) {
+    if (key_is_empty(hash) || set_find(set, hash)) return;
+    
+    if ((set->count + 1) * 10 > set->capacity * 7) {
+        size_t capacity = set->capacity ? set->capacity * 2 : INITIAL_SLOTS;
+        unsigned char *slots = calloc(capacity, KEY_SIZE);
+        if (!slots) return;
+        for (size_t i = 0; i < set->capacity; i++) {
+            const unsigned char *key = set->slots + i * KEY_SIZE;
+            if (!key_is_empty(key)) set_insert_slot(slots, capacity, key);
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->capacity = capacity;
+    }
+    set_insert_slot(set->slots, set->capacity, hash);
+    set->count++;
+}
+
+static int objects_mtime(const char *fractyl_dir, struct timespec *mtime) {
+    char path[2048];
+    snprintf(path, sizeof(path), "%s/objects", fractyl_dir);
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        memset(mtime, 0, sizeof(*mtime));
+        return 0;
+    }
+    *mtime = st.st_mtim;
+    return 1;
+}
+
+// Caller holds the write lock
+static void set_reset(loose_set_t *set, const char *fractyl_dir) {
+    free(set->slots);
+    memset(set, 0, sizeof(*set));
+    set->loaded = 1;
+    snprintf(set->fractyl_dir, sizeof(set->fractyl_dir), "%s", fractyl_dir);
+    objects_mtime(fractyl_dir, &set->objects_mtime);
+    set->checked_ns = now_ns();
+}
+
+// The set of fractyl_dir, if one is kept. Caller holds either lock.
+static loose_set_t* set_lookup(const char *fractyl_dir) {
+    for (size_t i = 0; i < CACHE_STORES; i++) {
+        if (sets[i].loaded && strcmp(sets[i].fractyl_dir, fractyl_dir) == 0) return &sets[i];
+    }
+    return NULL;
+}
+
+static int set_current(const loose_set_t *set) {
+    return set && now_ns() - set->checked_ns < VALIDATE_INTERVAL_NS;
+}
+
+// The set of fractyl_dir as of now, taking over the longest kept one if
+// there is none yet. Caller holds the write lock.
+static loose_set_t* set_refresh(const char *fractyl_dir) {
+    loose_set_t *set = set_lookup(fractyl_dir);
+    if (!set) {
+        set = &sets[next_victim];
+        next_victim = (next_victim + 1) % CACHE_STORES;
+        set_reset(set, fractyl_dir);
+        return set;
+    }
+    if (now_ns() - set->checked_ns < VALIDATE_INTERVAL_NS) return set;
+    
+    struct timespec mtime;
+    objects_mtime(fractyl_dir, &mtime);
+    if (mtime.tv_sec != set->objects_mtime.tv_sec || mtime.tv_nsec != set->objects_mtime.tv_nsec) {
+        set_reset(set, fractyl_dir);
+    } else {
+        set->checked_ns = now_ns();
+    }
+    return set;
+}
+
+// Read every object name in objects/<fanout>/. Caller holds the write lock.
+static void read_fanout(loose_set_t *set, unsigned char fanout) {
+    char dir_path[2048];
+    snprintf(dir_path, sizeof(dir_path), "%s/objects/%02x", set->fractyl_dir, fanout);
+    set->fanout_read[fanout] = 1;
+    
+    DIR *d = opendir(dir_path);
+    if (!d) return;
+    set->fanout_exists[fanout] = 1;
+    
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strlen(entry->d_name) != FRACTYL_HASH_HEX_SIZE - 3) continue;
+        char hex[FRACTYL_HASH_HEX_SIZE];
+        unsigned char hash[FRACTYL_HASH_SIZE];
+        snprintf(hex, sizeof(hex), "%02x%s", fanout, entry->d_name);
+        if (string_to_hash(hex, hash) == FRACTYL_OK) set_add(set, hash);
+    }
+    closedir(d);
+}
+
+int loose_cache_contains(const char *fractyl_dir, const unsigned char *hash) {
+    if (!fractyl_dir || !hash) return 0;
+    
+    pthread_rwlock_rdlock(&cache_lock);
+    const loose_set_t *set = set_lookup(fractyl_dir);
+    int ready = set_current(set) && set->fanout_read[hash[0]];
+    int found = ready && set_find(set, hash);
+    pthread_rwlock_unlock(&cache_lock);
+    if (ready) return found;
+    
+    pthread_rwlock_wrlock(&cache_lock);
+    loose_set_t *current = set_refresh(fractyl_dir);
+    if (!current->fanout_read[hash[0]]) read_fanout(current, hash[0]);
+    found = set_find(current, hash);
+    pthread_rwlock_unlock(&cache_lock);
+    return found;
+}
+
+void loose_cache_add(const char *fractyl_dir, const unsigned char *hash) {
+    if (!fractyl_dir || !hash) return;
+    
+    pthread_rwlock_wrlock(&cache_lock);
+    loose_set_t *set = set_refresh(fractyl_dir);
+    set_add(set, hash);
+    set->fanout_exists[hash[0]] = 1;
+    pthread_rwlock_unlock(&cache_lock);
+}
+
+int loose_cache_dir_exists(const char *fractyl_dir, unsigned char fanout) {
+    if (!fractyl_dir) return 0;
+    
+    pthread_rwlock_rdlock(&cache_lock);
+    const loose_set_t *set = set_lookup(fractyl_dir);
+    int exists = set_current(set) && set->fanout_exists[fanout];
+    pthread_rwlock_unlock(&cache_lock);
+    return exists;
+}
+
+void loose_cache_dir_created(const char *fractyl_dir, unsigned char fanout) {
+    if (!fractyl_dir) return;
+    
+    pthread_rwlock_wrlock(&cache_lock);
+    set_refresh(fractyl_dir)->fanout_exists[fanout] = 1;
+    pthread_rwlock_unlock(&cache_lock);
+}
+
+void loose_cache_invalidate(void) {
+    pthread_rwlock_wrlock(&cache_lock);
+    for (size_t i = 0; i < CACHE_STORES; i++) {
+        free(sets[i].slots);
+    }
+    memset(sets, 0, sizeof(sets));
+    next_victim = 0;
+    pthread_rwlock_unlock(&cache_lock);
+}
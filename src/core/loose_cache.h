@@ -0,0 +1,40 @@
+#ifndef LOOSE_CACHE_H
+#define LOOSE_CACHE_H
+
+#include "../include/fractyl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Process-wide set of the loose objects known to exist, shared by all
+// threads, one per object store (a repository and the shared stores it
+// reads, see alternates.h). A fanout directory's entries are read in full
+// the first time one of its objects is asked for; objects stored or found
+// later are added. A hit costs no system call, a miss means "look on disk".
+//
+// Loose objects are only ever deleted by repack (which packs them first)
+// and gc. The set is dropped when the mtime of .fractyl/objects changes,
+// checked at most once a second, so whatever deletes loose objects
+// without packing them must touch that directory afterwards.
+
+// Nonzero if the loose object is known to exist
+int loose_cache_contains(const char *fractyl_dir, const unsigned char *hash);
+
+// Record a loose object that exists now
+void loose_cache_add(const char *fractyl_dir, const unsigned char *hash);
+
+// Nonzero if objects/<fanout>/ is known to exist
+int loose_cache_dir_exists(const char *fractyl_dir, unsigned char fanout);
+
+// Record that objects/<fanout>/ exists now
+void loose_cache_dir_created(const char *fractyl_dir, unsigned char fanout);
+
+// Forget everything, e.g. after deleting loose objects
+void loose_cache_invalidate(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LOOSE_CACHE_H
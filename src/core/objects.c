@@ -1,13 +1,105 @@
+#define _GNU_SOURCE
 #include "objects.h"
 #include "hash.h"
+#include "pack.h"
+#include "compress.h"
+#include "chunker.h"
+#include "delta.h"
+#include "loose_cache.h"
+#include "alternates.h"
+#include "index.h"
+#include "tree.h"
 #include "../utils/fs.h"
+#include "../utils/config.h"
+#include "../utils/governor.h"
+#include "../utils/bounded_queue.h"
+#include "../utils/profile.h"
+#include "../utils/counters.h"
 #include "../include/fractyl.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <limits.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#ifdef __APPLE__
+#include <sys/clonefile.h>
+#endif
+
+// Files are copied into the store in large, page aligned chunks
+#define OBJECT_IO_BUFFER_SIZE (1024 * 1024)
+#define OBJECT_IO_ALIGNMENT 4096
+// Upper bound for a single copy_file_range() call
+#define OBJECT_COPY_RANGE_CHUNK (1L << 30)
+// Files from this size on are stored as content-defined chunks
+#define CHUNKED_DEFAULT_THRESHOLD (16L * 1024 * 1024)
+// Files from this size on have their chunks stored by several threads
+#define LARGE_FILE_DEFAULT_THRESHOLD (256L * 1024 * 1024)
+// Chunk list entry: chunk hash, u64 chunk size
+#define CHUNK_ENTRY_SIZE (FRACTYL_HASH_SIZE + sizeof(uint64_t))
+// Longest chain of delta bases a load follows, well above what repack writes
+#define DELTA_MAX_CHAIN 64
+
+// Once the filesystem refuses reflinks or in-kernel copies they are not
+// tried again for the rest of the process
+static int clone_unsupported = 0;
+static int copy_range_unsupported = 0;
+
+// Settings from .fractyl/config, read once per process and repository
+typedef struct {
+    int kernel_copy;          // objects.copy_mode is not "copy"
+    long chunk_threshold;     // objects.chunk_threshold, 0 disables chunking
+    long large_file_threshold; // objects.large_file_threshold, 0 stores chunks in order
+    object_durability_t durability;
+} object_settings_t;
+
+static pthread_mutex_t settings_lock = PTHREAD_MUTEX_INITIALIZER;
+static char settings_dir[2048];
+static object_settings_t settings;
+
+static object_stats_t stats;
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+void object_stats_reset(void) {
+    __atomic_store_n(&stats.objects_written, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.bytes_written, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.bytes_deduplicated, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.hash_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.store_ns, 0, __ATOMIC_RELAXED);
+}
+
+void object_stats_get(object_stats_t *out) {
+    if (!out) return;
+    out->objects_written = __atomic_load_n(&stats.objects_written, __ATOMIC_RELAXED);
+    out->bytes_written = __atomic_load_n(&stats.bytes_written, __ATOMIC_RELAXED);
+    out->bytes_deduplicated = __atomic_load_n(&stats.bytes_deduplicated, __ATOMIC_RELAXED);
+    out->hash_ns = __atomic_load_n(&stats.hash_ns, __ATOMIC_RELAXED);
+    out->store_ns = __atomic_load_n(&stats.store_ns, __ATOMIC_RELAXED);
+}
+
+void object_stats_add_deduplicated(unsigned long long bytes) {
+    __atomic_add_fetch(&stats.bytes_deduplicated, bytes, __ATOMIC_RELAXED);
+    counters_add(COUNTER_OBJECTS_DEDUPLICATED, 1);
+    counters_add(COUNTER_BYTES_DEDUPLICATED, bytes);
+}
+
+void object_stats_add_hash_time(unsigned long long ns) {
+    __atomic_add_fetch(&stats.hash_ns, ns, __ATOMIC_RELAXED);
+}
 
 static char* hash_to_object_path(const unsigned char *hash, const char *fractyl_dir) {
     if (!hash || !fractyl_dir) return NULL;
@@ -27,6 +119,7 @@ static char* hash_to_object_path(const unsigned char *hash, const char *fractyl_
 
 static int ensure_object_dir(const unsigned char *hash, const char *fractyl_dir) {
     if (!hash || !fractyl_dir) return FRACTYL_ERROR_GENERIC;
+    if (loose_cache_dir_exists(fractyl_dir, hash[0])) return FRACTYL_OK;
     
     char hash_hex[FRACTYL_HASH_HEX_SIZE];
     hash_to_string(hash, hash_hex);
@@ -37,86 +130,982 @@ static int ensure_object_dir(const unsigned char *hash, const char *fractyl_dir)
     // Create directory recursively
     struct stat st;
     if (stat(dir_path, &st) == 0) {
-        return S_ISDIR(st.st_mode) ? FRACTYL_OK : FRACTYL_ERROR_IO;
+        if (!S_ISDIR(st.st_mode)) return FRACTYL_ERROR_IO;
+        loose_cache_dir_created(fractyl_dir, hash[0]);
+        return FRACTYL_OK;
     }
     
     // Create objects directory first
     char objects_dir[512];
     snprintf(objects_dir, sizeof(objects_dir), "%s/objects", fractyl_dir);
     if (stat(objects_dir, &st) != 0) {
-        if (mkdir(objects_dir, 0755) != 0) {
+        if (mkdir(objects_dir, 0755) != 0 && errno != EEXIST) {
             return FRACTYL_ERROR_IO;
         }
     }
     
-    // Create subdirectory
-    if (mkdir(dir_path, 0755) != 0) {
+    // Create subdirectory; another store thread may have just done so
+    if (mkdir(dir_path, 0755) != 0 && errno != EEXIST) {
         return FRACTYL_ERROR_IO;
     }
     
+    loose_cache_dir_created(fractyl_dir, hash[0]);
     return FRACTYL_OK;
 }
 
-int object_store_file(const char *file_path, const char *fractyl_dir, unsigned char *hash_out) {
-    if (!file_path || !fractyl_dir || !hash_out) {
-        return FRACTYL_ERROR_GENERIC;
+static int write_all(int fd, const unsigned char *data, size_t size) {
+    governor_write(size);
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return FRACTYL_ERROR_IO;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+    return FRACTYL_OK;
+}
+
+static object_settings_t object_settings(const char *fractyl_dir) {
+    pthread_mutex_lock(&settings_lock);
+    if (strcmp(settings_dir, fractyl_dir) != 0) {
+        // objects.copy_mode "auto" (the default) lets the filesystem share
+        // or copy the data itself; "copy" always copies it through user
+        // space, e.g. to keep the store physically separate from the tree
+        char mode[32];
+        settings.kernel_copy = config_get(fractyl_dir, "objects.copy_mode", mode, sizeof(mode)) != FRACTYL_OK ||
+                               strcmp(mode, "copy") != 0;
+        settings.chunk_threshold = config_get_long(fractyl_dir, "objects.chunk_threshold",
+                                                   CHUNKED_DEFAULT_THRESHOLD);
+        settings.large_file_threshold = config_get_long(fractyl_dir, "objects.large_file_threshold",
+                                                        LARGE_FILE_DEFAULT_THRESHOLD);
+        settings.durability = OBJECT_DURABILITY_BATCH;
+        if (config_get(fractyl_dir, "objects.durability", mode, sizeof(mode)) == FRACTYL_OK) {
+            if (strcmp(mode, "none") == 0) settings.durability = OBJECT_DURABILITY_NONE;
+            else if (strcmp(mode, "full") == 0) settings.durability = OBJECT_DURABILITY_FULL;
+        }
+        snprintf(settings_dir, sizeof(settings_dir), "%s", fractyl_dir);
+    }
+    object_settings_t current = settings;
+    pthread_mutex_unlock(&settings_lock);
+    return current;
+}
+
+static int kernel_copy_allowed(const char *fractyl_dir) {
+    return object_settings(fractyl_dir).kernel_copy;
+}
+
+object_durability_t object_durability(const char *fractyl_dir) {
+    return fractyl_dir ? object_settings(alternates_write_dir(fractyl_dir)).durability : OBJECT_DURABILITY_BATCH;
+}
+
+static int read_full_at(int fd, void *buffer, size_t size, off_t offset) {
+    unsigned char *p = buffer;
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FRACTYL_ERROR_IO;
+        p += n;
+        size -= (size_t)n;
+        offset += n;
+    }
+    return FRACTYL_OK;
+}
+
+// errno values meaning "not on this filesystem" rather than a real failure
+static int copy_refused(int err) {
+    return err == EOPNOTSUPP || err == ENOTTY || err == EXDEV || err == EINVAL || err == ENOSYS;
+}
+
+// Make the empty out_fd a reflink of in_fd, sharing its extents (btrfs,
+// XFS, ...). Returns FRACTYL_ERROR_INVALID_STATE when not supported.
+static int clone_fd(int in_fd, int out_fd) {
+#if defined(__linux__) && defined(FICLONE)
+    if (!__atomic_load_n(&clone_unsupported, __ATOMIC_RELAXED)) {
+        if (ioctl(out_fd, FICLONE, in_fd) == 0) {
+            return FRACTYL_OK;
+        }
+        if (copy_refused(errno)) {
+            __atomic_store_n(&clone_unsupported, 1, __ATOMIC_RELAXED);
+        }
+    }
+#else
+    (void)in_fd;
+    (void)out_fd;
+#endif
+    return FRACTYL_ERROR_INVALID_STATE;
+}
+
+// Copy in_fd into the empty out_fd without the data passing through user
+// space. Returns FRACTYL_ERROR_INVALID_STATE, with nothing written, when
+// the kernel cannot do it.
+static int copy_range_fd(int in_fd, int out_fd) {
+#ifdef __linux__
+    if (__atomic_load_n(&copy_range_unsupported, __ATOMIC_RELAXED)) {
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    
+    struct stat st;
+    if (fstat(in_fd, &st) != 0) {
+        return FRACTYL_ERROR_IO;
+    }
+    
+    off_t copied = 0;
+    while (1) {
+        ssize_t n = copy_file_range(in_fd, NULL, out_fd, NULL, OBJECT_COPY_RANGE_CHUNK, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (copied == 0 && copy_refused(errno)) {
+                __atomic_store_n(&copy_range_unsupported, 1, __ATOMIC_RELAXED);
+                return FRACTYL_ERROR_INVALID_STATE;
+            }
+            return FRACTYL_ERROR_IO;
+        }
+        if (n == 0) break;
+        copied += n;
+        governor_read((size_t)n);
+        governor_write((size_t)n);
+    }
+    
+    // Some filesystems report success without copying anything
+    return copied == 0 && st.st_size > 0 ? FRACTYL_ERROR_INVALID_STATE : FRACTYL_OK;
+#else
+    (void)in_fd;
+    (void)out_fd;
+    return FRACTYL_ERROR_INVALID_STATE;
+#endif
+}
+
+// Copy in_fd to out_fd through an aligned buffer, hashing on the way when
+// ctx is set and writing through encoder when that is set
+static int copy_fd_buffered(int in_fd, int out_fd, hash_ctx_t *ctx, object_encoder_t *encoder) {
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, OBJECT_IO_ALIGNMENT, OBJECT_IO_BUFFER_SIZE) != 0) {
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    int result = FRACTYL_OK;
+    while (result == FRACTYL_OK) {
+        ssize_t n = read(in_fd, buffer, OBJECT_IO_BUFFER_SIZE);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = FRACTYL_ERROR_IO;
+            break;
+        }
+        if (n == 0) break;
+        governor_read((size_t)n);
+        if (ctx) {
+            result = hash_ctx_update(ctx, buffer, (size_t)n);
+        }
+        if (result == FRACTYL_OK) {
+            result = encoder ? object_encoder_write(encoder, buffer, (size_t)n)
+                             : write_all(out_fd, buffer, (size_t)n);
+        }
+    }
+    
+    free(buffer);
+    return result;
+}
+
+// Nonzero if the content of fd has to be written through an object
+// encoder: compression is on, or the raw bytes would read as a header
+static int needs_encoding(const char *fractyl_dir, int fd) {
+    if (compress_enabled(fractyl_dir)) return 1;
+    
+    unsigned char head[OBJECT_HEADER_SIZE];
+    ssize_t n = pread(fd, head, sizeof(head), 0);
+    return n == (ssize_t)sizeof(head) && object_header_parse(head, sizeof(head), NULL);
+}
+
+// mkstemp() a tmp_obj_ file in dir. A fanout directory may have been
+// removed by a repack in another process since the loose cache saw it.
+static int open_temp(const char *dir, char *temp_path, size_t temp_size) {
+    snprintf(temp_path, temp_size, "%s/tmp_obj_XXXXXX", dir);
+    int fd = mkstemp(temp_path);
+    if (fd < 0 && errno == ENOENT && (mkdir(dir, 0755) == 0 || errno == EEXIST)) {
+        snprintf(temp_path, temp_size, "%s/tmp_obj_XXXXXX", dir);
+        fd = mkstemp(temp_path);
+    }
+    return fd;
+}
+
+// Create a temporary file in dir that is a reflink of file_path (open as in_fd)
+// Returns FRACTYL_ERROR_INVALID_STATE when the filesystem cannot clone
+static int clone_to_temp(const char *file_path, int in_fd, const char *dir, char *temp_path, size_t temp_size) {
+#ifdef __APPLE__
+    // clonefile() creates the destination itself, so only reserve a name
+    (void)in_fd;
+    int name_fd = open_temp(dir, temp_path, temp_size);
+    if (name_fd < 0) {
+        return FRACTYL_ERROR_IO;
+    }
+    close(name_fd);
+    unlink(temp_path);
+    if (__atomic_load_n(&clone_unsupported, __ATOMIC_RELAXED) || clonefile(file_path, temp_path, 0) != 0) {
+        if (errno == ENOTSUP || errno == EXDEV) {
+            __atomic_store_n(&clone_unsupported, 1, __ATOMIC_RELAXED);
+        }
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    chmod(temp_path, 0644);
+    return FRACTYL_OK;
+#else
+    (void)file_path;
+    if (__atomic_load_n(&clone_unsupported, __ATOMIC_RELAXED)) {
+        return FRACTYL_ERROR_INVALID_STATE;
     }
     
-    // First compute the hash
-    int result = hash_file(file_path, hash_out);
+    int temp_fd = open_temp(dir, temp_path, temp_size);
+    if (temp_fd < 0) {
+        return FRACTYL_ERROR_IO;
+    }
+    fchmod(temp_fd, 0644);
+    
+    int result = clone_fd(in_fd, temp_fd);
+    if (close(temp_fd) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_IO;
+    }
     if (result != FRACTYL_OK) {
-        return result;
+        unlink(temp_path);
     }
+    return result;
+#endif
+}
+
+// Copy in_fd into a new temporary file in dir, hashing the content on the
+// way when ctx is set. The file is read exactly once. With encode set the
+// content goes through an object encoder (see compress.h); otherwise,
+// without a hash to compute, kernel_copy lets the kernel do the copy.
+static int stream_to_temp(int in_fd, const char *fractyl_dir, const char *dir, char *temp_path,
+                          size_t temp_size, hash_ctx_t *ctx, int encode, int kernel_copy) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
     
-    // Check if object already exists
-    if (object_exists(hash_out, fractyl_dir)) {
-        return FRACTYL_OK; // Already stored
+    // Write to a private temporary name and rename it into place, so two
+    // threads storing the same content never interleave in one file
+    int temp_fd = open_temp(dir, temp_path, temp_size);
+    if (temp_fd < 0) {
+        return FRACTYL_ERROR_IO;
     }
+    fchmod(temp_fd, 0644);
     
-    // Ensure object directory exists
-    result = ensure_object_dir(hash_out, fractyl_dir);
+    object_encoder_t *encoder = NULL;
+    int result = FRACTYL_ERROR_INVALID_STATE;
+    if (encode) {
+        struct stat st;
+        uint64_t size_hint = fstat(in_fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+        result = object_encoder_new(fractyl_dir, temp_fd, size_hint, &encoder);
+        if (result == FRACTYL_OK) {
+            result = copy_fd_buffered(in_fd, temp_fd, ctx, encoder);
+            if (result == FRACTYL_OK) {
+                result = object_encoder_finish(encoder);
+            } else {
+                object_encoder_free(encoder);
+            }
+        }
+    } else {
+        if (!ctx && kernel_copy) {
+            result = copy_range_fd(in_fd, temp_fd);
+        }
+        if (result == FRACTYL_ERROR_INVALID_STATE) {
+            result = copy_fd_buffered(in_fd, temp_fd, ctx, NULL);
+        }
+    }
+    
+    if (close(temp_fd) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_IO;
+    }
     if (result != FRACTYL_OK) {
+        unlink(temp_path); // Clean up partial file
+    }
+    return result;
+}
+
+static void fanout_dir_path(const char *fractyl_dir, unsigned char fanout, char *path, size_t size) {
+    snprintf(path, size, "%s/objects/%02x", fractyl_dir, fanout);
+}
+
+// Rename a finished temporary file to the object's name
+static int publish_temp_object(const char *temp_path, const unsigned char *hash, const char *fractyl_dir) {
+    int result = ensure_object_dir(hash, fractyl_dir);
+    char *dest_path = result == FRACTYL_OK ? hash_to_object_path(hash, fractyl_dir) : NULL;
+    if (!dest_path) {
+        unlink(temp_path);
+        return result != FRACTYL_OK ? result : FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    int renamed = rename(temp_path, dest_path) == 0;
+    if (!renamed && errno == ENOENT) {
+        // The fanout directory went away after the cache saw it
+        loose_cache_invalidate();
+        renamed = ensure_object_dir(hash, fractyl_dir) == FRACTYL_OK && rename(temp_path, dest_path) == 0;
+    }
+    if (!renamed) {
+        unlink(temp_path);
+        free(dest_path);
+        return FRACTYL_ERROR_IO;
+    }
+    free(dest_path);
+    loose_cache_add(fractyl_dir, hash);
+    return FRACTYL_OK;
+}
+
+// --- Batch durability ---
+//
+// Objects keep their temporary names until a group of them has been
+// synced with one syncfs() (one fsync per file elsewhere), so a crash
+// never leaves a truncated file under an object's name. The fanout
+// directories they were renamed into are synced by object_sync().
+
+// Objects per group
+#define DURABLE_BATCH_OBJECTS 1024
+
+typedef struct {
+    char *temp_path;
+    unsigned char hash[FRACTYL_HASH_SIZE];
+} pending_object_t;
+
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    char fractyl_dir[2048];
+    pending_object_t *items;
+    size_t count;               // Read without the lock only to skip it when zero
+    size_t capacity;
+    unsigned char dirty_fanouts[256];
+    int dirty;
+    int exit_hook;
+} pending;
+
+// Caller holds pending_lock
+static int pending_find(const unsigned char *hash) {
+    for (size_t i = 0; i < pending.count; i++) {
+        if (pending.items[i].hash[0] == hash[0] &&
+            memcmp(pending.items[i].hash, hash, FRACTYL_HASH_SIZE) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int pending_contains(const char *fractyl_dir, const unsigned char *hash) {
+    if (__atomic_load_n(&pending.count, __ATOMIC_ACQUIRE) == 0) return 0;
+    pthread_mutex_lock(&pending_lock);
+    int found = strcmp(pending.fractyl_dir, fractyl_dir) == 0 && pending_find(hash);
+    pthread_mutex_unlock(&pending_lock);
+    return found;
+}
+
+// Sync the waiting objects' data, then give them their names. Caller
+// holds pending_lock.
+static int flush_pending_locked(void) {
+    if (pending.count == 0) return FRACTYL_OK;
+    const char *fractyl_dir = pending.fractyl_dir;
+    
+    int result = FRACTYL_OK;
+#ifdef __linux__
+    char objects_dir[2048];
+    snprintf(objects_dir, sizeof(objects_dir), "%s/objects", fractyl_dir);
+    int dir_fd = open(objects_dir, O_RDONLY | O_CLOEXEC);
+    if (dir_fd < 0 || syncfs(dir_fd) != 0) result = FRACTYL_ERROR_IO;
+    if (dir_fd >= 0) close(dir_fd);
+#else
+    for (size_t i = 0; i < pending.count && result == FRACTYL_OK; i++) {
+        result = fsync_path(pending.items[i].temp_path) ? FRACTYL_OK : FRACTYL_ERROR_IO;
+    }
+#endif
+    
+    for (size_t i = 0; i < pending.count; i++) {
+        pending_object_t *item = &pending.items[i];
+        if (result == FRACTYL_OK) {
+            int published = publish_temp_object(item->temp_path, item->hash, fractyl_dir);
+            if (published == FRACTYL_OK) {
+                pending.dirty_fanouts[item->hash[0]] = 1;
+                pending.dirty = 1;
+            }
+            result = published;
+        } else {
+            unlink(item->temp_path);
+        }
+        free(item->temp_path);
+    }
+    __atomic_store_n(&pending.count, 0, __ATOMIC_RELEASE);
+    return result;
+}
+
+static void flush_pending_at_exit(void) {
+    pthread_mutex_lock(&pending_lock);
+    flush_pending_locked();
+    pthread_mutex_unlock(&pending_lock);
+}
+
+// Queue a finished temporary file for the next group
+static int defer_temp_object(const char *temp_path, const unsigned char *hash, const char *fractyl_dir) {
+    pthread_mutex_lock(&pending_lock);
+    int result = FRACTYL_OK;
+    if (strcmp(pending.fractyl_dir, fractyl_dir) != 0) {
+        // Another repository: finish the first one's group
+        flush_pending_locked();
+        memset(pending.dirty_fanouts, 0, sizeof(pending.dirty_fanouts));
+        pending.dirty = 0;
+        snprintf(pending.fractyl_dir, sizeof(pending.fractyl_dir), "%s", fractyl_dir);
+    }
+    if (pending_find(hash)) {
+        // Another writer stored the same content first
+        pthread_mutex_unlock(&pending_lock);
+        unlink(temp_path);
         return result;
     }
     
-    // Get destination path
-    char *dest_path = hash_to_object_path(hash_out, fractyl_dir);
-    if (!dest_path) {
+    if (pending.count >= pending.capacity) {
+        size_t capacity = pending.capacity ? pending.capacity * 2 : 64;
+        pending_object_t *grown = realloc(pending.items, capacity * sizeof(pending_object_t));
+        if (!grown) {
+            pthread_mutex_unlock(&pending_lock);
+            unlink(temp_path);
+            return FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+        pending.items = grown;
+        pending.capacity = capacity;
+    }
+    pending_object_t *item = &pending.items[pending.count];
+    if (!(item->temp_path = strdup(temp_path))) {
+        pthread_mutex_unlock(&pending_lock);
+        unlink(temp_path);
         return FRACTYL_ERROR_OUT_OF_MEMORY;
     }
+    memcpy(item->hash, hash, FRACTYL_HASH_SIZE);
+    __atomic_store_n(&pending.count, pending.count + 1, __ATOMIC_RELEASE);
     
-    // Copy file to object store
-    FILE *src = fopen(file_path, "rb");
-    if (!src) {
-        free(dest_path);
+    if (!pending.exit_hook) {
+        // Objects still waiting at exit are published rather than lost
+        atexit(flush_pending_at_exit);
+        pending.exit_hook = 1;
+    }
+    if (pending.count >= DURABLE_BATCH_OBJECTS && result == FRACTYL_OK) {
+        result = flush_pending_locked();
+    }
+    pthread_mutex_unlock(&pending_lock);
+    return result;
+}
+
+// Reads of an object still waiting for its group publish the group first
+static void publish_if_pending(const unsigned char *hash, const char *fractyl_dir) {
+    if (__atomic_load_n(&pending.count, __ATOMIC_ACQUIRE) == 0) return;
+    if (!pending_contains(alternates_write_dir(fractyl_dir), hash)) return;
+    pthread_mutex_lock(&pending_lock);
+    flush_pending_locked();
+    pthread_mutex_unlock(&pending_lock);
+}
+
+// Nonzero if store holds the object loose, or is about to
+static int loose_exists(const unsigned char *hash, const char *store) {
+    if (loose_cache_contains(store, hash) || pending_contains(store, hash)) return 1;
+    
+    char *obj_path = hash_to_object_path(hash, store);
+    if (!obj_path) return 0;
+    
+    struct stat st;
+    int exists = (stat(obj_path, &st) == 0 && S_ISREG(st.st_mode));
+    
+    free(obj_path);
+    if (exists) loose_cache_add(store, hash);
+    return exists;
+}
+
+// Path of the loose object in the first of fractyl_dir's stores that has
+// it, else in fractyl_dir itself (caller frees)
+static char* find_loose_object(const unsigned char *hash, const char *fractyl_dir) {
+    const char *const *stores;
+    size_t count = alternates_list(fractyl_dir, &stores);
+    if (count == 0 || loose_exists(hash, fractyl_dir)) return hash_to_object_path(hash, fractyl_dir);
+    for (size_t i = 0; i < count; i++) {
+        if (loose_exists(hash, stores[i])) return hash_to_object_path(hash, stores[i]);
+    }
+    return hash_to_object_path(hash, fractyl_dir);
+}
+
+int object_sync(const char *fractyl_dir) {
+    if (!fractyl_dir) return FRACTYL_ERROR_INVALID_ARGS;
+    fractyl_dir = alternates_write_dir(fractyl_dir);
+    
+    pthread_mutex_lock(&pending_lock);
+    if (strcmp(pending.fractyl_dir, fractyl_dir) != 0) {
+        pthread_mutex_unlock(&pending_lock);
+        return FRACTYL_OK;          // Nothing stored into it in batches
+    }
+    int result = flush_pending_locked();
+    for (int b = 0; b < 256 && pending.dirty; b++) {
+        if (!pending.dirty_fanouts[b]) continue;
+        char dir_path[2048];
+        fanout_dir_path(fractyl_dir, (unsigned char)b, dir_path, sizeof(dir_path));
+        if (!fsync_path(dir_path) && result == FRACTYL_OK) result = FRACTYL_ERROR_IO;
+    }
+    if (pending.dirty) {
+        // New fanout directories are entries of objects/
+        char objects_dir[2048];
+        snprintf(objects_dir, sizeof(objects_dir), "%s/objects", fractyl_dir);
+        if (!fsync_path(objects_dir) && result == FRACTYL_OK) result = FRACTYL_ERROR_IO;
+    }
+    memset(pending.dirty_fanouts, 0, sizeof(pending.dirty_fanouts));
+    pending.dirty = 0;
+    pthread_mutex_unlock(&pending_lock);
+    return result;
+}
+
+// Move a finished temporary file to the object's name in fractyl_dir, or
+// drop it if another writer stored the same content first where
+// lookup_dir finds objects. content_size is what the object holds,
+// counted as deduplicated in that case.
+static int install_temp_object(const char *temp_path, const unsigned char *hash, const char *fractyl_dir,
+                               const char *lookup_dir, unsigned long long content_size) {
+    if (object_exists(hash, lookup_dir)) {
+        unlink(temp_path);
+        object_stats_add_deduplicated(content_size);
+        return FRACTYL_OK;
+    }
+    
+    struct stat st;
+    unsigned long long stored_size = stat(temp_path, &st) == 0 ? (unsigned long long)st.st_size : 0;
+    int result;
+    object_durability_t durability = object_durability(fractyl_dir);
+    if (durability == OBJECT_DURABILITY_BATCH) {
+        result = defer_temp_object(temp_path, hash, fractyl_dir);
+    } else if (durability == OBJECT_DURABILITY_FULL && !fsync_path(temp_path)) {
+        unlink(temp_path);
+        result = FRACTYL_ERROR_IO;
+    } else {
+        result = publish_temp_object(temp_path, hash, fractyl_dir);
+        if (result == FRACTYL_OK && durability == OBJECT_DURABILITY_FULL) {
+            char dir_path[2048];
+            fanout_dir_path(fractyl_dir, hash[0], dir_path, sizeof(dir_path));
+            result = fsync_path(dir_path) ? FRACTYL_OK : FRACTYL_ERROR_IO;
+        }
+    }
+    if (result == FRACTYL_OK) {
+        __atomic_add_fetch(&stats.objects_written, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats.bytes_written, stored_size, __ATOMIC_RELAXED);
+        profile_add_bytes(PROFILE_OBJECT_WRITE, stored_size);
+        counters_add(COUNTER_OBJECTS_WRITTEN, 1);
+        counters_add(COUNTER_BYTES_WRITTEN, stored_size);
+    }
+    return result;
+}
+
+// Write the chunk list of a chunked object under hash
+static int write_chunk_list(const char *fractyl_dir, const unsigned char *hash,
+                            const unsigned char *entries, size_t entries_size, uint64_t total) {
+    if (object_exists(hash, fractyl_dir)) {
+        return FRACTYL_OK;
+    }
+    
+    char temp_path[2048];
+    snprintf(temp_path, sizeof(temp_path), "%s/objects/tmp_obj_XXXXXX", fractyl_dir);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
         return FRACTYL_ERROR_IO;
     }
+    fchmod(fd, 0644);
     
-    FILE *dest = fopen(dest_path, "wb");
-    if (!dest) {
-        fclose(src);
-        free(dest_path);
+    unsigned char header_bytes[OBJECT_HEADER_SIZE];
+    object_header_t header = { OBJECT_CODEC_CHUNKED, 0, total, 0 };
+    object_header_encode(header_bytes, &header);
+    int result = write_all(fd, header_bytes, sizeof(header_bytes));
+    if (result == FRACTYL_OK) {
+        result = write_all(fd, entries, entries_size);
+    }
+    if (close(fd) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_IO;
+    }
+    if (result != FRACTYL_OK) {
+        unlink(temp_path);
+        return result;
+    }
+    return install_temp_object(temp_path, hash, fractyl_dir, fractyl_dir, 0); // Its chunks count for the content
+}
+
+// Chunks travel to the store threads in segments of about this many bytes
+#define CHUNK_SEGMENT_SIZE (4 * 1024 * 1024)
+#define LARGE_FILE_MAX_THREADS 8
+// Seconds between progress lines for a large file
+#define LARGE_FILE_PROGRESS_INTERVAL 2
+
+// Consecutive chunks of a file, cut by the reading thread and stored by
+// whichever thread takes the segment
+typedef struct chunk_segment {
+    unsigned char *data;        // Chunk contents back to back, freed once stored
+    size_t size;
+    unsigned char *entries;     // Chunk list entries: sizes set when cut, hashes when stored
+    size_t count;
+    size_t entries_capacity;
+    int result;
+    struct chunk_segment *next;
+} chunk_segment_t;
+
+typedef struct {
+    bounded_queue_t queue;
+    const char *fractyl_dir;
+    int failed;
+} chunk_store_pool_t;
+
+static void store_segment(chunk_segment_t *segment, const char *fractyl_dir) {
+    size_t offset = 0;
+    for (size_t i = 0; i < segment->count && segment->result == FRACTYL_OK; i++) {
+        unsigned char *entry = segment->entries + i * CHUNK_ENTRY_SIZE;
+        uint64_t size64;
+        memcpy(&size64, entry + FRACTYL_HASH_SIZE, sizeof(size64));
+        segment->result = object_store_data(segment->data + offset, (size_t)size64, fractyl_dir, entry);
+        offset += (size_t)size64;
+    }
+    free(segment->data);
+    segment->data = NULL;
+}
+
+static void* chunk_store_thread(void *arg) {
+    chunk_store_pool_t *pool = arg;
+    chunk_segment_t *segment;
+    while ((segment = bounded_queue_pop(&pool->queue)) != NULL) {
+        store_segment(segment, pool->fractyl_dir);
+        if (segment->result != FRACTYL_OK) __atomic_store_n(&pool->failed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+// Threads storing the chunks of one large file: one per core, or
+// FRACTYL_LARGE_FILE_THREADS, within the hashing budget
+static int large_file_threads(void) {
+    const char *forced = getenv("FRACTYL_LARGE_FILE_THREADS");
+    long cpus = forced && *forced ? atol(forced) : sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 1 ? (int)cpus : 1;
+    if (threads > LARGE_FILE_MAX_THREADS) threads = LARGE_FILE_MAX_THREADS;
+    return governor_hash_threads(threads);
+}
+
+// Store the content of in_fd as content-defined chunks, each an object of
+// its own, plus a chunk list named after the hash of the whole content.
+// With expected set, the content must still hash to it. The whole content
+// is hashed in order as it is read; from objects.large_file_threshold on,
+// the chunks are hashed and written by a pool of threads meanwhile and
+// progress is shown for label.
+static int store_chunked(int in_fd, const char *fractyl_dir, const char *label,
+                         const unsigned char *expected, unsigned char *hash_out) {
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    
+    struct stat st;
+    uint64_t file_size = fstat(in_fd, &st) == 0 && st.st_size > 0 ? (uint64_t)st.st_size : 0;
+    long large_threshold = object_settings(fractyl_dir).large_file_threshold;
+    int large = large_threshold > 0 && file_size >= (uint64_t)large_threshold;
+    
+    size_t capacity = 2 * CHUNK_MAX_SIZE;
+    unsigned char *buffer = malloc(capacity);
+    hash_ctx_t *ctx = hash_ctx_new();
+    int result = buffer && ctx ? FRACTYL_OK : FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    chunk_store_pool_t pool;
+    pool.fractyl_dir = fractyl_dir;
+    pool.failed = 0;
+    pthread_t threads[LARGE_FILE_MAX_THREADS];
+    int thread_count = 0;
+    if (large && result == FRACTYL_OK) {
+        int wanted = large_file_threads();
+        if (wanted > 1 && bounded_queue_init(&pool.queue, (size_t)wanted * 2) == FRACTYL_OK) {
+            while (thread_count < wanted &&
+                   pthread_create(&threads[thread_count], NULL, chunk_store_thread, &pool) == 0) {
+                thread_count++;
+            }
+            if (thread_count == 0) bounded_queue_destroy(&pool.queue);
+        }
+    }
+    
+    chunk_segment_t *first = NULL, *last = NULL, *segment = NULL;
+    uint64_t total = 0;
+    size_t avail = 0;
+    int eof = 0;
+    unsigned long long started = monotonic_ns(), reported = started;
+    int progress_shown = 0;
+    while (result == FRACTYL_OK) {
+        // Cut points need CHUNK_MAX_SIZE bytes of lookahead
+        while (result == FRACTYL_OK && !eof && avail < CHUNK_MAX_SIZE) {
+            ssize_t n = read(in_fd, buffer + avail, capacity - avail);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                result = FRACTYL_ERROR_IO;
+            } else if (n == 0) {
+                eof = 1;
+            } else {
+                governor_read((size_t)n);
+                result = hash_ctx_update(ctx, buffer + avail, (size_t)n);
+                avail += (size_t)n;
+            }
+        }
+        if (result != FRACTYL_OK || avail == 0) break;
+    
+        if (!segment) {
+            segment = calloc(1, sizeof(chunk_segment_t));
+            if (segment) segment->data = malloc(CHUNK_SEGMENT_SIZE + CHUNK_MAX_SIZE);
+            if (!segment || !segment->data) {
+                free(segment);
+                segment = NULL;
+                result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            if (last) last->next = segment;
+            else first = segment;
+            last = segment;
+        }
+        if (segment->count == segment->entries_capacity) {
+            size_t new_capacity = segment->entries_capacity ? segment->entries_capacity * 2 : 128;
+            unsigned char *grown = realloc(segment->entries, new_capacity * CHUNK_ENTRY_SIZE);
+            if (!grown) {
+                result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            segment->entries = grown;
+            segment->entries_capacity = new_capacity;
+        }
+    
+        size_t cut = chunker_cut(buffer, avail);
+        memcpy(segment->data + segment->size, buffer, cut);
+        uint64_t size64 = cut;
+        memcpy(segment->entries + segment->count * CHUNK_ENTRY_SIZE + FRACTYL_HASH_SIZE, &size64, sizeof(size64));
+        segment->size += cut;
+        segment->count++;
+        total += cut;
+    
+        memmove(buffer, buffer + cut, avail - cut);
+        avail -= cut;
+    
+        // Hand over a full segment, or the last one
+        if (segment->size >= CHUNK_SEGMENT_SIZE || (eof && avail == 0)) {
+            if (thread_count > 0) {
+                bounded_queue_push(&pool.queue, segment);
+                if (__atomic_load_n(&pool.failed, __ATOMIC_RELAXED)) result = FRACTYL_ERROR_IO;
+            } else {
+                store_segment(segment, fractyl_dir);
+                result = segment->result;
+            }
+            segment = NULL;
+        }
+    
+        if (large && label) {
+            unsigned long long now = monotonic_ns();
+            if (now - reported >= LARGE_FILE_PROGRESS_INTERVAL * 1000000000ULL) {
+                reported = now;
+                progress_shown = 1;
+                printf("\r  Storing %s: %llu of %llu MB (%llu%%)", label,
+                       (unsigned long long)(total >> 20), (unsigned long long)(file_size >> 20),
+                       file_size ? (unsigned long long)(total * 100 / file_size) : 100ULL);
+                fflush(stdout);
+            }
+        }
+    }
+    free(buffer);
+    
+    if (thread_count > 0) {
+        bounded_queue_close(&pool.queue);
+        for (int i = 0; i < thread_count; i++) pthread_join(threads[i], NULL);
+        bounded_queue_destroy(&pool.queue);
+    }
+    
+    // Join the chunk lists of the segments, in file order
+    unsigned char *entries = NULL;
+    size_t entries_size = 0, chunk_count = 0;
+    for (chunk_segment_t *s = first; s; s = s->next) chunk_count += s->count;
+    if (result == FRACTYL_OK && chunk_count > 0) {
+        entries = malloc(chunk_count * CHUNK_ENTRY_SIZE);
+        if (!entries) result = FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    while (first) {
+        chunk_segment_t *next = first->next;
+        if (result == FRACTYL_OK && first->data) store_segment(first, fractyl_dir); // Never handed over
+        if (result == FRACTYL_OK) result = first->result;
+        if (result == FRACTYL_OK) {
+            memcpy(entries + entries_size, first->entries, first->count * CHUNK_ENTRY_SIZE);
+            entries_size += first->count * CHUNK_ENTRY_SIZE;
+        }
+        free(first->data);
+        free(first->entries);
+        free(first);
+        first = next;
+    }
+    
+    if (progress_shown) {
+        printf("\r  Stored %s: %llu MB in %.1f s\n", label, (unsigned long long)(total >> 20),
+               (double)(monotonic_ns() - started) / 1e9);
+        fflush(stdout);
+    }
+    
+    if (result == FRACTYL_OK) {
+        result = hash_ctx_final(ctx, hash_out);
+    } else {
+        hash_ctx_free(ctx);
+    }
+    if (result == FRACTYL_OK && expected && memcmp(expected, hash_out, FRACTYL_HASH_SIZE) != 0) {
+        result = FRACTYL_ERROR_HASH_MISMATCH; // Changed since it was hashed
+    }
+    if (result == FRACTYL_OK) {
+        result = write_chunk_list(fractyl_dir, hash_out, entries, entries_size, total);
+    }
+    free(entries);
+    return result;
+}
+
+static int should_chunk(const char *fractyl_dir, int fd) {
+    long threshold = object_settings(fractyl_dir).chunk_threshold;
+    struct stat st;
+    return threshold > 0 && fstat(fd, &st) == 0 && st.st_size >= threshold;
+}
+
+// Store a file into fractyl_dir, unless lookup_dir already finds it
+static int store_file(const char *file_path, const char *fractyl_dir, const char *lookup_dir,
+                      unsigned char *hash_out) {
+    if (!file_path || !fractyl_dir || !hash_out) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    
+    // The hash is only known at the end, so the copy starts out in the
+    // objects directory itself and is renamed once the content is hashed
+    char objects_dir[2048];
+    snprintf(objects_dir, sizeof(objects_dir), "%s/objects", fractyl_dir);
+    if (mkdir(objects_dir, 0755) != 0 && errno != EEXIST) {
         return FRACTYL_ERROR_IO;
     }
     
-    char buffer[8192];
-    size_t bytes_read;
+    int in_fd = open(file_path, O_RDONLY);
+    if (in_fd < 0) {
+        return FRACTYL_ERROR_IO;
+    }
+    counters_add(COUNTER_FILES_READ, 1);
+    struct stat st;
+    unsigned long long content_size = fstat(in_fd, &st) == 0 ? (unsigned long long)st.st_size : 0;
     
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), src)) > 0) {
-        if (fwrite(buffer, 1, bytes_read, dest) != bytes_read) {
-            fclose(src);
-            fclose(dest);
-            unlink(dest_path); // Clean up partial file
-            free(dest_path);
-            return FRACTYL_ERROR_IO;
+    if (should_chunk(fractyl_dir, in_fd)) {
+        counters_add(COUNTER_BYTES_HASHED, content_size);
+        int result = store_chunked(in_fd, fractyl_dir, file_path, NULL, hash_out);
+        close(in_fd);
+        return result;
+    }
+    
+    char temp_path[2048];
+    int encode = needs_encoding(fractyl_dir, in_fd);
+    int kernel_copy = !encode && kernel_copy_allowed(fractyl_dir);
+    if (kernel_copy) {
+        // A reflink costs no data I/O; hashing the clone rather than the
+        // source also guarantees the name matches what was stored
+        int result = clone_to_temp(file_path, in_fd, objects_dir, temp_path, sizeof(temp_path));
+        if (result == FRACTYL_OK) {
+            close(in_fd);
+            result = hash_file(temp_path, hash_out);
+            if (result != FRACTYL_OK) {
+                unlink(temp_path);
+                return result;
+            }
+            return install_temp_object(temp_path, hash_out, fractyl_dir, lookup_dir, content_size);
         }
+        if (result != FRACTYL_ERROR_INVALID_STATE) {
+            close(in_fd);
+            return result;
+        }
+    }
+    
+    hash_ctx_t *ctx = hash_ctx_new();
+    if (!ctx) {
+        close(in_fd);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    counters_add(COUNTER_BYTES_HASHED, content_size);
+    int result = stream_to_temp(in_fd, fractyl_dir, objects_dir, temp_path, sizeof(temp_path),
+                                ctx, encode, kernel_copy);
+    close(in_fd);
+    if (result != FRACTYL_OK) {
+        hash_ctx_free(ctx);
+        return result;
+    }
+    
+    result = hash_ctx_final(ctx, hash_out);
+    if (result != FRACTYL_OK) {
+        unlink(temp_path);
+        return result;
+    }
+    
+    return install_temp_object(temp_path, hash_out, fractyl_dir, lookup_dir, content_size);
+}
+
+static int write_file(const char *file_path, const char *fractyl_dir, const unsigned char *hash) {
+    if (!file_path || !fractyl_dir || !hash) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    
+    // Check if object already exists
+    if (object_exists(hash, fractyl_dir)) {
+        return FRACTYL_OK; // Already stored
+    }
+    fractyl_dir = alternates_write_dir(fractyl_dir);
+    
+    // Ensure object directory exists
+    int result = ensure_object_dir(hash, fractyl_dir);
+    if (result != FRACTYL_OK) {
+        return result;
+    }
+    
+    char hash_hex[FRACTYL_HASH_HEX_SIZE];
+    hash_to_string(hash, hash_hex);
+    char dir_path[2048];
+    snprintf(dir_path, sizeof(dir_path), "%s/objects/%.2s", fractyl_dir, hash_hex);
+    
+    int in_fd = open(file_path, O_RDONLY);
+    if (in_fd < 0) {
+        return FRACTYL_ERROR_IO;
+    }
+    counters_add(COUNTER_FILES_READ, 1);
+    struct stat st;
+    unsigned long long content_size = fstat(in_fd, &st) == 0 ? (unsigned long long)st.st_size : 0;
+    
+    if (should_chunk(fractyl_dir, in_fd)) {
+        unsigned char actual[FRACTYL_HASH_SIZE];
+        result = store_chunked(in_fd, fractyl_dir, file_path, hash, actual);
+        close(in_fd);
+        return result;
     }
     
-    fclose(src);
-    fclose(dest);
-    free(dest_path);
+    char temp_path[2048];
+    int encode = needs_encoding(fractyl_dir, in_fd);
+    int kernel_copy = !encode && kernel_copy_allowed(fractyl_dir);
+    result = kernel_copy ? clone_to_temp(file_path, in_fd, dir_path, temp_path, sizeof(temp_path))
+                         : FRACTYL_ERROR_INVALID_STATE;
+    if (result == FRACTYL_ERROR_INVALID_STATE) {
+        result = stream_to_temp(in_fd, fractyl_dir, dir_path, temp_path, sizeof(temp_path),
+                                NULL, encode, kernel_copy);
+    }
+    close(in_fd);
+    if (result != FRACTYL_OK) {
+        return result;
+    }
     
-    return FRACTYL_OK;
+    return install_temp_object(temp_path, hash, fractyl_dir, fractyl_dir, content_size);
+}
+
+int object_store_file(const char *file_path, const char *fractyl_dir, unsigned char *hash_out) {
+    unsigned long long start = monotonic_ns();
+    unsigned long long profile_started = profile_begin();
+    int result = store_file(file_path, fractyl_dir ? alternates_write_dir(fractyl_dir) : NULL, fractyl_dir,
+                            hash_out);
+    profile_end(PROFILE_OBJECT_WRITE, profile_started);
+    __atomic_add_fetch(&stats.store_ns, monotonic_ns() - start, __ATOMIC_RELAXED);
+    return result;
+}
+
+int object_write_file(const char *file_path, const char *fractyl_dir, const unsigned char *hash) {
+    unsigned long long start = monotonic_ns();
+    unsigned long long profile_started = profile_begin();
+    int result = write_file(file_path, fractyl_dir, hash);
+    profile_end(PROFILE_OBJECT_WRITE, profile_started);
+    __atomic_add_fetch(&stats.store_ns, monotonic_ns() - start, __ATOMIC_RELAXED);
+    return result;
 }
 
 int object_store_data(const void *data, size_t size, const char *fractyl_dir, unsigned char *hash_out) {
@@ -132,8 +1121,10 @@ int object_store_data(const void *data, size_t size, const char *fractyl_dir, un
     
     // Check if object already exists
     if (object_exists(hash_out, fractyl_dir)) {
+        object_stats_add_deduplicated(size);
         return FRACTYL_OK; // Already stored
     }
+    fractyl_dir = alternates_write_dir(fractyl_dir);
     
     // Ensure object directory exists
     result = ensure_object_dir(hash_out, fractyl_dir);
@@ -141,38 +1132,167 @@ int object_store_data(const void *data, size_t size, const char *fractyl_dir, un
         return result;
     }
     
-    // Get destination path
-    char *dest_path = hash_to_object_path(hash_out, fractyl_dir);
-    if (!dest_path) {
-        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    // Write to a temporary name next to the object; chunks of different
+    // files may be stored by several threads at once
+    char hash_hex[FRACTYL_HASH_HEX_SIZE];
+    hash_to_string(hash_out, hash_hex);
+    char dir_path[2048], temp_path[2048];
+    snprintf(dir_path, sizeof(dir_path), "%s/objects/%.2s", fractyl_dir, hash_hex);
+    int fd = open_temp(dir_path, temp_path, sizeof(temp_path));
+    if (fd < 0) {
+        return FRACTYL_ERROR_IO;
     }
+    fchmod(fd, 0644);
     
-    // Write data to object store
-    FILE *dest = fopen(dest_path, "wb");
-    if (!dest) {
-        free(dest_path);
-        return FRACTYL_ERROR_IO;
+    int encode = compress_enabled(fractyl_dir) || object_header_parse(data, size, NULL);
+    if (encode) {
+        object_encoder_t *encoder;
+        result = object_encoder_new(fractyl_dir, fd, size, &encoder);
+        if (result == FRACTYL_OK) {
+            result = object_encoder_write(encoder, data, size);
+            if (result == FRACTYL_OK) {
+                result = object_encoder_finish(encoder);
+            } else {
+                object_encoder_free(encoder);
+            }
+        }
+    } else {
+        result = write_all(fd, data, size);
     }
     
-    if (fwrite(data, 1, size, dest) != size) {
-        fclose(dest);
-        unlink(dest_path); // Clean up partial file
-        free(dest_path);
-        return FRACTYL_ERROR_IO;
+    if (close(fd) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_IO;
+    }
+    if (result != FRACTYL_OK) {
+        unlink(temp_path); // Clean up partial file
+        return result;
     }
     
-    fclose(dest);
-    free(dest_path);
+    return install_temp_object(temp_path, hash_out, fractyl_dir, fractyl_dir, size);
+}
+
+// Assemble a chunked object from its chunk list into a new buffer
+static int load_chunked(const char *fractyl_dir, const object_header_t *header,
+                        const unsigned char *entries, size_t entries_size,
+                        void **data_out, size_t *size_out) {
+    if (entries_size % CHUNK_ENTRY_SIZE != 0) return FRACTYL_ERROR_IO;
+    if (header->size > SIZE_MAX - 1) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    unsigned char *out = malloc(header->size ? (size_t)header->size : 1);
+    if (!out) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    int result = FRACTYL_OK;
+    uint64_t offset = 0;
+    for (size_t pos = 0; pos < entries_size && result == FRACTYL_OK; pos += CHUNK_ENTRY_SIZE) {
+        uint64_t size;
+        memcpy(&size, entries + pos + FRACTYL_HASH_SIZE, sizeof(size));
+        void *chunk;
+        size_t chunk_size;
+        result = object_load(entries + pos, fractyl_dir, &chunk, &chunk_size);
+        if (result != FRACTYL_OK) break;
+        if (chunk_size != size || offset + size > header->size) {
+            result = FRACTYL_ERROR_IO;
+        } else {
+            memcpy(out + offset, chunk, chunk_size);
+            offset += size;
+        }
+        free(chunk);
+    }
+    if (result == FRACTYL_OK && offset != header->size) {
+        result = FRACTYL_ERROR_IO;
+    }
     
+    if (result != FRACTYL_OK) {
+        free(out);
+        return result;
+    }
+    *data_out = out;
+    *size_out = (size_t)header->size;
     return FRACTYL_OK;
 }
 
-int object_load(const unsigned char *hash, const char *fractyl_dir, void **data_out, size_t *size_out) {
-    if (!hash || !fractyl_dir || !data_out || !size_out) {
-        return FRACTYL_ERROR_GENERIC;
+static int load_at_depth(const unsigned char *hash, const char *fractyl_dir, int depth,
+                         void **data_out, size_t *size_out);
+
+// Apply a delta object to its base, loaded at the next chain depth
+static int load_delta(const char *fractyl_dir, const object_header_t *header,
+                      const unsigned char *payload, size_t payload_size, int depth,
+                      void **data_out, size_t *size_out) {
+    if (payload_size < FRACTYL_HASH_SIZE || depth >= DELTA_MAX_CHAIN) return FRACTYL_ERROR_IO;
+    if (header->size > SIZE_MAX - 1) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    void *base;
+    size_t base_size;
+    int result = load_at_depth(payload, fractyl_dir, depth + 1, &base, &base_size);
+    if (result != FRACTYL_OK) return result;
+    
+    unsigned char *out = malloc(header->size ? (size_t)header->size : 1);
+    if (!out) {
+        free(base);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    result = delta_apply(base, base_size, payload + FRACTYL_HASH_SIZE, payload_size - FRACTYL_HASH_SIZE,
+                         out, (size_t)header->size);
+    free(base);
+    if (result != FRACTYL_OK) {
+        free(out);
+        return result;
+    }
+    *data_out = out;
+    *size_out = (size_t)header->size;
+    return FRACTYL_OK;
+}
+
+// Turn a stored object into its content. Takes ownership of stored.
+static int decode_stored(const char *fractyl_dir, void *stored, size_t size, int depth,
+                         void **data_out, size_t *size_out) {
+    object_header_t header;
+    if (!object_header_parse(stored, size, &header)) {
+        *data_out = stored;
+        *size_out = size;
+        return FRACTYL_OK;
+    }
+    // Named by another hash algorithm than the repository's: its content
+    // cannot be checked against the name
+    if (header.hash_algorithm != (uint32_t)hash_get_algorithm()) {
+        free(stored);
+        return FRACTYL_ERROR_HASH_MISMATCH;
+    }
+    
+    const unsigned char *payload = (const unsigned char *)stored + OBJECT_HEADER_SIZE;
+    size_t payload_size = size - OBJECT_HEADER_SIZE;
+    int result;
+    if (header.codec == OBJECT_CODEC_CHUNKED) {
+        result = load_chunked(fractyl_dir, &header, payload, payload_size, data_out, size_out);
+    } else if (header.codec == OBJECT_CODEC_DELTA) {
+        result = load_delta(fractyl_dir, &header, payload, payload_size, depth, data_out, size_out);
+    } else if (header.codec == OBJECT_CODEC_RAW && payload_size == header.size) {
+        // Raw content is already in the buffer: drop the header in place
+        memmove(stored, payload, payload_size);
+        *data_out = stored;
+        *size_out = payload_size;
+        return FRACTYL_OK;
+    } else {
+        result = object_decode_buffer(fractyl_dir, stored, size, data_out, size_out);
+    }
+    free(stored);
+    return result;
+}
+
+static int load_at_depth(const unsigned char *hash, const char *fractyl_dir, int depth,
+                         void **data_out, size_t *size_out) {
+    // Packs first, then the loose object
+    void *stored;
+    size_t stored_size;
+    int result = pack_load_object(fractyl_dir, hash, &stored, &stored_size);
+    if (result == FRACTYL_OK) {
+        return decode_stored(fractyl_dir, stored, stored_size, depth, data_out, size_out);
+    }
+    if (result != FRACTYL_ERROR_NOT_FOUND) {
+        return result;
     }
     
-    char *obj_path = hash_to_object_path(hash, fractyl_dir);
+    char *obj_path = find_loose_object(hash, fractyl_dir);
     if (!obj_path) {
         return FRACTYL_ERROR_OUT_OF_MEMORY;
     }
@@ -180,7 +1300,14 @@ int object_load(const unsigned char *hash, const char *fractyl_dir, void **data_
     FILE *fp = fopen(obj_path, "rb");
     if (!fp) {
         free(obj_path);
-        return FRACTYL_ERROR_IO;
+        // A repack may have just moved it into a pack we have not seen yet
+        if (!pack_has_object(fractyl_dir, hash, 1)) {
+            return FRACTYL_ERROR_IO;
+        }
+        result = pack_load_object(fractyl_dir, hash, &stored, &stored_size);
+        return result == FRACTYL_OK
+            ? decode_stored(fractyl_dir, stored, stored_size, depth, data_out, size_out)
+            : result;
     }
     
     // Get file size
@@ -195,7 +1322,7 @@ int object_load(const unsigned char *hash, const char *fractyl_dir, void **data_
     }
     
     // Allocate buffer
-    void *data = malloc(file_size);
+    void *data = malloc(file_size ? (size_t)file_size : 1);
     if (!data) {
         fclose(fp);
         free(obj_path);
@@ -212,27 +1339,480 @@ int object_load(const unsigned char *hash, const char *fractyl_dir, void **data_
         return FRACTYL_ERROR_IO;
     }
     
-    *data_out = data;
-    *size_out = file_size;
+    return decode_stored(fractyl_dir, data, (size_t)file_size, depth, data_out, size_out);
+}
+
+int object_load(const unsigned char *hash, const char *fractyl_dir, void **data_out, size_t *size_out) {
+    if (!hash || !fractyl_dir || !data_out || !size_out) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    publish_if_pending(hash, fractyl_dir);
+    return load_at_depth(hash, fractyl_dir, 0, data_out, size_out);
+}
+
+int object_load_index(const unsigned char *hash, const char *fractyl_dir, index_t *index) {
+    if (!hash || !fractyl_dir || !index) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    void *data;
+    size_t size;
+    int result = object_load(hash, fractyl_dir, &data, &size);
+    if (result != FRACTYL_OK) {
+        return result;
+    }
+    if (tree_is_tree(data, size)) {
+        free(data);
+        return tree_load_index(hash, fractyl_dir, index);
+    }
+    // The index takes over the buffer; its paths point into it
+    return index_load_owned(index, data, size);
+}
+
+int object_store_index(const index_t *index, const char *fractyl_dir, unsigned char *hash_out) {
+    if (!index || !fractyl_dir || !hash_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    void *data;
+    size_t size;
+    int result = index_serialize(index, &data, &size);
+    if (result != FRACTYL_OK) {
+        return result;
+    }
+    result = object_store_data(data, size, fractyl_dir, hash_out);
+    free(data);
+    return result;
+}
+
+int object_decode_stored(const char *fractyl_dir, const void *stored, size_t size,
+                         void **data_out, size_t *size_out) {
+    if (!fractyl_dir || (!stored && size) || !data_out || !size_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
     
+    void *copy = malloc(size ? size : 1);
+    if (!copy) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    if (size) memcpy(copy, stored, size);
+    return decode_stored(fractyl_dir, copy, size, 0, data_out, size_out);
+}
+
+int object_encode_delta(const unsigned char *base_hash, const void *base, size_t base_size,
+                        const void *target, size_t target_size, size_t max_size,
+                        void **stored_out, size_t *stored_size_out) {
+    if (!base_hash || !stored_out || !stored_size_out) return FRACTYL_ERROR_INVALID_ARGS;
+    size_t prefix = OBJECT_HEADER_SIZE + FRACTYL_HASH_SIZE;
+    if (max_size <= prefix) return FRACTYL_ERROR_NOT_FOUND;
+    
+    unsigned char *delta;
+    size_t delta_size;
+    int result = delta_create(base, base_size, target, target_size, max_size - prefix, &delta, &delta_size);
+    if (result != FRACTYL_OK) return result;
+    
+    unsigned char *stored = malloc(prefix + delta_size);
+    if (!stored) {
+        free(delta);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    object_header_t header = { OBJECT_CODEC_DELTA, 0, target_size, 0 };
+    object_header_encode(stored, &header);
+    memcpy(stored + OBJECT_HEADER_SIZE, base_hash, FRACTYL_HASH_SIZE);
+    memcpy(stored + prefix, delta, delta_size);
+    free(delta);
+    
+    *stored_out = stored;
+    *stored_size_out = prefix + delta_size;
     return FRACTYL_OK;
 }
 
 int object_exists(const unsigned char *hash, const char *fractyl_dir) {
     if (!hash || !fractyl_dir) return 0;
     
-    char *obj_path = hash_to_object_path(hash, fractyl_dir);
-    if (!obj_path) return 0;
+    // Packed objects, the shared stores' too, and loose ones seen before
+    // are found in memory, without a stat
+    if (pack_has_object(fractyl_dir, hash, 0) || loose_exists(hash, fractyl_dir)) return 1;
+    
+    const char *const *stores;
+    size_t count = alternates_list(fractyl_dir, &stores);
+    for (size_t i = 0; i < count; i++) {
+        if (loose_exists(hash, stores[i])) return 1;
+    }
+    return pack_has_object(fractyl_dir, hash, 1);
+}
+
+char* object_path(const unsigned char *hash, const char *fractyl_dir) {
+    return hash && fractyl_dir ? find_loose_object(hash, fractyl_dir) : NULL;
+}
+
+// --- Object readers ---
+
+typedef enum {
+    READER_PLAIN,       // Content stored as is at start in fd
+    READER_DECODE,      // Encoded payload at start in fd, decoded as read
+    READER_CHUNKS,      // Chunk list in buffer, each chunk read in turn
+    READER_MEMORY       // Content assembled in buffer (deltas)
+} reader_kind_t;
+
+struct object_reader {
+    reader_kind_t kind;
+    char *fractyl_dir;
+    uint64_t size;              // Content size
+    uint64_t pos;               // Content read so far
+    int fd;                     // Loose object or pack file
+    uint64_t start;             // Where the stored bytes to read begin in fd
+    uint64_t length;            // How many there are
+    uint64_t consumed;          // Of those, fed to the decoder
+    object_decoder_t *decoder;
+    unsigned char *buffer;      // Payload read ahead, chunk list or content
+    size_t buffer_used;
+    size_t buffer_pos;
+    object_reader_t *chunk;     // Reader of the current chunk
+    size_t chunk_index;
+    void *map;                  // Mapping behind object_reader_view()
+    size_t map_size;
+};
+
+// Find an object's stored form: a pack entry or a loose file
+static int reader_locate(object_reader_t *reader, const unsigned char *hash, int *decoded) {
+    size_t size;
+    int result = pack_open_object(reader->fractyl_dir, hash, &reader->fd, &reader->start, &size, decoded);
+    if (result == FRACTYL_OK) {
+        reader->length = size;
+        return FRACTYL_OK;
+    }
+    if (result != FRACTYL_ERROR_NOT_FOUND) return result;
+    
+    char *obj_path = find_loose_object(hash, reader->fractyl_dir);
+    if (!obj_path) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    reader->fd = open(obj_path, O_RDONLY);
+    free(obj_path);
+    if (reader->fd < 0) {
+        // A repack may have just moved it into a pack we have not seen yet
+        if (!pack_has_object(reader->fractyl_dir, hash, 1)) return FRACTYL_ERROR_IO;
+        result = pack_open_object(reader->fractyl_dir, hash, &reader->fd, &reader->start, &size, decoded);
+        reader->length = size;
+        return result;
+    }
     
     struct stat st;
-    int exists = (stat(obj_path, &st) == 0 && S_ISREG(st.st_mode));
+    if (fstat(reader->fd, &st) != 0) return FRACTYL_ERROR_IO;
+    reader->start = 0;
+    reader->length = (uint64_t)st.st_size;
+    *decoded = 0;
+    return FRACTYL_OK;
+}
+
+// Set the reader up for the stored form reader_locate() found
+static int reader_prepare(object_reader_t *reader, const unsigned char *hash, int decoded) {
+    object_header_t header;
+    unsigned char head[OBJECT_HEADER_SIZE];
+    if (decoded || reader->length < OBJECT_HEADER_SIZE ||
+        read_full_at(reader->fd, head, sizeof(head), (off_t)reader->start) != FRACTYL_OK ||
+        !object_header_parse(head, sizeof(head), &header)) {
+        reader->kind = READER_PLAIN;
+        reader->size = reader->length;
+        return FRACTYL_OK;
+    }
+    if (header.hash_algorithm != (uint32_t)hash_get_algorithm()) {
+        return FRACTYL_ERROR_HASH_MISMATCH;
+    }
+    
+    uint64_t payload_size = reader->length - OBJECT_HEADER_SIZE;
+    reader->size = header.size;
+    if (header.codec == OBJECT_CODEC_RAW) {
+        if (payload_size != header.size) return FRACTYL_ERROR_IO;
+        reader->kind = READER_PLAIN;
+        reader->start += OBJECT_HEADER_SIZE;
+        reader->length = payload_size;
+        return FRACTYL_OK;
+    }
+    if (header.codec == OBJECT_CODEC_ZSTD) {
+        reader->kind = READER_DECODE;
+        reader->start += OBJECT_HEADER_SIZE;
+        reader->length = payload_size;
+        reader->buffer = malloc(OBJECT_IO_BUFFER_SIZE);
+        if (!reader->buffer) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        return object_decoder_new(reader->fractyl_dir, &header, &reader->decoder);
+    }
+    if (header.codec == OBJECT_CODEC_CHUNKED) {
+        // The list is small next to the chunks: read it whole
+        if (payload_size % CHUNK_ENTRY_SIZE != 0 || payload_size > SIZE_MAX - 1) return FRACTYL_ERROR_IO;
+        reader->kind = READER_CHUNKS;
+        reader->buffer = malloc(payload_size ? (size_t)payload_size : 1);
+        if (!reader->buffer) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        reader->buffer_used = (size_t)payload_size;
+        return read_full_at(reader->fd, reader->buffer, (size_t)payload_size,
+                            (off_t)(reader->start + OBJECT_HEADER_SIZE));
+    }
+    if (header.codec == OBJECT_CODEC_DELTA) {
+        // Applying a delta needs its base whole anyway
+        void *data;
+        size_t size;
+        int result = load_at_depth(hash, reader->fractyl_dir, 0, &data, &size);
+        if (result != FRACTYL_OK) return result;
+        reader->kind = READER_MEMORY;
+        reader->buffer = data;
+        reader->size = size;
+        return FRACTYL_OK;
+    }
+    return FRACTYL_ERROR_INVALID_STATE;
+}
+
+int object_reader_open(const unsigned char *hash, const char *fractyl_dir, object_reader_t **reader_out) {
+    if (!hash || !fractyl_dir || !reader_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    object_reader_t *reader = calloc(1, sizeof(*reader));
+    if (!reader) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    reader->fd = -1;
+    reader->fractyl_dir = strdup(fractyl_dir);
+    if (!reader->fractyl_dir) {
+        free(reader);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
     
+    publish_if_pending(hash, fractyl_dir);
+    int decoded = 0;
+    int result = reader_locate(reader, hash, &decoded);
+    if (result == FRACTYL_OK) {
+        result = reader_prepare(reader, hash, decoded);
+    }
+    if (result != FRACTYL_OK) {
+        object_reader_close(reader);
+        return result;
+    }
+    *reader_out = reader;
+    return FRACTYL_OK;
+}
+
+int object_reader_open_file(const char *path, object_reader_t **reader_out) {
+    if (!path || !reader_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    object_reader_t *reader = calloc(1, sizeof(*reader));
+    if (!reader) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    reader->kind = READER_PLAIN;
+    reader->fd = open(path, O_RDONLY);
+    struct stat st;
+    if (reader->fd < 0 || fstat(reader->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        object_reader_close(reader);
+        return FRACTYL_ERROR_IO;
+    }
+    reader->size = reader->length = (uint64_t)st.st_size;
+    *reader_out = reader;
+    return FRACTYL_OK;
+}
+
+uint64_t object_reader_size(const object_reader_t *reader) {
+    return reader ? reader->size : 0;
+}
+
+// Decode into buffer until it is full, feeding the payload in buffer-sized reads
+static int reader_decode(object_reader_t *reader, unsigned char *buffer, size_t size) {
+    size_t filled = 0;
+    while (filled < size) {
+        if (reader->buffer_pos == reader->buffer_used) {
+            uint64_t left = reader->length - reader->consumed;
+            if (left == 0) return FRACTYL_ERROR_IO; // Truncated
+            size_t n = left < OBJECT_IO_BUFFER_SIZE ? (size_t)left : OBJECT_IO_BUFFER_SIZE;
+            if (read_full_at(reader->fd, reader->buffer, n, (off_t)(reader->start + reader->consumed)) != FRACTYL_OK) {
+                return FRACTYL_ERROR_IO;
+            }
+            reader->consumed += n;
+            reader->buffer_pos = 0;
+            reader->buffer_used = n;
+        }
+        size_t used, produced;
+        int result = object_decoder_decode(reader->decoder, reader->buffer + reader->buffer_pos,
+                                           reader->buffer_used - reader->buffer_pos, &used,
+                                           buffer + filled, size - filled, &produced);
+        if (result != FRACTYL_OK) return result;
+        reader->buffer_pos += used;
+        filled += produced;
+    }
+    return FRACTYL_OK;
+}
+
+// Read the chunks in order into buffer until it is full
+static int reader_read_chunks(object_reader_t *reader, unsigned char *buffer, size_t size) {
+    size_t filled = 0;
+    while (filled < size) {
+        if (!reader->chunk) {
+            const unsigned char *entry = reader->buffer + reader->chunk_index * CHUNK_ENTRY_SIZE;
+            if ((size_t)(entry - reader->buffer) >= reader->buffer_used) return FRACTYL_ERROR_IO;
+            uint64_t chunk_size;
+            memcpy(&chunk_size, entry + FRACTYL_HASH_SIZE, sizeof(chunk_size));
+            int result = object_reader_open(entry, reader->fractyl_dir, &reader->chunk);
+            if (result != FRACTYL_OK) return result;
+            if (reader->chunk->size != chunk_size) return FRACTYL_ERROR_IO;
+        }
+        ssize_t n = object_reader_read(reader->chunk, buffer + filled, size - filled);
+        if (n < 0) return (int)n;
+        if (n == 0) {
+            object_reader_close(reader->chunk);
+            reader->chunk = NULL;
+            reader->chunk_index++;
+        }
+        filled += (size_t)n;
+    }
+    return FRACTYL_OK;
+}
+
+ssize_t object_reader_read(object_reader_t *reader, void *buffer, size_t size) {
+    if (!reader || (!buffer && size)) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    uint64_t left = reader->size - reader->pos;
+    if (size > left) size = (size_t)left;
+    if (size > SSIZE_MAX) size = SSIZE_MAX;
+    if (size == 0) return 0;
+    
+    int result = FRACTYL_OK;
+    if (reader->kind == READER_MEMORY) {
+        memcpy(buffer, reader->buffer + reader->pos, size);
+    } else if (reader->kind == READER_PLAIN && reader->map) {
+        memcpy(buffer, (const unsigned char *)object_reader_view(reader) + reader->pos, size);
+    } else if (reader->kind == READER_PLAIN) {
+        result = read_full_at(reader->fd, buffer, size, (off_t)(reader->start + reader->pos));
+    } else if (reader->kind == READER_DECODE) {
+        result = reader_decode(reader, buffer, size);
+    } else {
+        result = reader_read_chunks(reader, buffer, size);
+    }
+    if (result != FRACTYL_OK) return result;
+    reader->pos += size;
+    return (ssize_t)size;
+}
+
+const void* object_reader_view(object_reader_t *reader) {
+    if (!reader) return NULL;
+    if (reader->kind == READER_MEMORY) return reader->buffer;
+    if (reader->kind != READER_PLAIN) return NULL;
+    if (reader->size == 0) return "";
+    
+    // mmap() wants a page-aligned offset
+    size_t skew = (size_t)(reader->start % (uint64_t)sysconf(_SC_PAGESIZE));
+    if (!reader->map) {
+        if (reader->length > SIZE_MAX - skew) return NULL;
+        void *map = mmap(NULL, (size_t)reader->length + skew, PROT_READ, MAP_PRIVATE, reader->fd,
+                         (off_t)(reader->start - skew));
+        if (map == MAP_FAILED) return NULL;
+        reader->map = map;
+        reader->map_size = (size_t)reader->length + skew;
+    }
+    return (const unsigned char *)reader->map + skew;
+}
+
+void object_reader_close(object_reader_t *reader) {
+    if (!reader) return;
+    if (reader->map) munmap(reader->map, reader->map_size);
+    if (reader->fd >= 0) close(reader->fd);
+    object_reader_close(reader->chunk);
+    object_decoder_free(reader->decoder);
+    free(reader->buffer);
+    free(reader->fractyl_dir);
+    free(reader);
+}
+
+// Restore through an object reader: packed objects, chunk lists and
+// deltas. Content stored as is is written from its mapping; the rest is
+// decoded a buffer at a time.
+static int restore_from_reader(const unsigned char *hash, const char *fractyl_dir, const char *dest_path) {
+    object_reader_t *reader;
+    int result = object_reader_open(hash, fractyl_dir, &reader);
+    if (result != FRACTYL_OK) {
+        return result;
+    }
+    
+    int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dest_fd < 0) {
+        object_reader_close(reader);
+        return FRACTYL_ERROR_IO;
+    }
+    const void *view = object_reader_view(reader);
+    if (view) {
+        result = write_all(dest_fd, view, (size_t)object_reader_size(reader));
+    } else {
+        unsigned char *buffer = malloc(OBJECT_IO_BUFFER_SIZE);
+        result = buffer ? FRACTYL_OK : FRACTYL_ERROR_OUT_OF_MEMORY;
+        while (result == FRACTYL_OK) {
+            ssize_t n = object_reader_read(reader, buffer, OBJECT_IO_BUFFER_SIZE);
+            if (n <= 0) {
+                result = n < 0 ? (int)n : FRACTYL_OK;
+                break;
+            }
+            result = write_all(dest_fd, buffer, (size_t)n);
+        }
+        free(buffer);
+    }
+    object_reader_close(reader);
+    if (close(dest_fd) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_IO;
+    }
+    if (result != FRACTYL_OK) {
+        unlink(dest_path); // Clean up partial file
+    }
+    return result;
+}
+
+int object_open_raw(const unsigned char *hash, const char *fractyl_dir) {
+    if (!hash || !fractyl_dir) return -1;
+    
+    publish_if_pending(hash, fractyl_dir);
+    if (pack_has_object(fractyl_dir, hash, 0)) return -1;
+    char *obj_path = find_loose_object(hash, fractyl_dir);
+    if (!obj_path) return -1;
+    int fd = open(obj_path, O_RDONLY);
     free(obj_path);
-    return exists;
+    if (fd < 0) return -1;
+    
+    unsigned char head[OBJECT_HEADER_SIZE];
+    if (pread(fd, head, sizeof(head), 0) == (ssize_t)sizeof(head) &&
+        object_header_parse(head, sizeof(head), NULL)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
-char* object_path(const unsigned char *hash, const char *fractyl_dir) {
-    return hash_to_object_path(hash, fractyl_dir);
+int object_link_file(const unsigned char *hash, const char *fractyl_dir, const char *dest_path) {
+    if (!hash || !fractyl_dir || !dest_path) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    int fd = object_open_raw(hash, fractyl_dir);
+    if (fd < 0) return FRACTYL_ERROR_INVALID_STATE;
+    struct stat st;
+    int result = fstat(fd, &st) == 0 && ((st.st_mode & 07777) == 0444 || fchmod(fd, 0444) == 0)
+        ? FRACTYL_OK : FRACTYL_ERROR_IO;
+    close(fd);
+    if (result != FRACTYL_OK) return result;
+    
+    char *obj_path = find_loose_object(hash, fractyl_dir);
+    if (!obj_path) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    if (unlink(dest_path) != 0 && errno != ENOENT) {
+        free(obj_path);
+        return FRACTYL_ERROR_IO;
+    }
+    if (link(obj_path, dest_path) != 0) {
+        result = errno == EXDEV || errno == EPERM || errno == EMLINK || errno == ENOTSUP
+            ? FRACTYL_ERROR_INVALID_STATE : FRACTYL_ERROR_IO;
+    }
+    free(obj_path);
+    return result;
+}
+
+void object_prefetch(const unsigned char *hash, const char *fractyl_dir) {
+    if (!hash || !fractyl_dir || pack_prefetch_object(fractyl_dir, hash)) return;
+    
+    char *obj_path = find_loose_object(hash, fractyl_dir);
+    if (!obj_path) return;
+    int fd = open(obj_path, O_RDONLY);
+    free(obj_path);
+    if (fd < 0) return;
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    close(fd);
 }
 
 int object_restore_file(const unsigned char *hash, const char *fractyl_dir, const char *dest_path) {
@@ -240,47 +1820,92 @@ int object_restore_file(const unsigned char *hash, const char *fractyl_dir, cons
         return FRACTYL_ERROR_GENERIC;
     }
     
-    char *obj_path = hash_to_object_path(hash, fractyl_dir);
+    publish_if_pending(hash, fractyl_dir);
+    if (pack_has_object(fractyl_dir, hash, 0)) {
+        return restore_from_reader(hash, fractyl_dir, dest_path);
+    }
+    
+    char *obj_path = find_loose_object(hash, fractyl_dir);
     if (!obj_path) {
         return FRACTYL_ERROR_OUT_OF_MEMORY;
     }
     
-    FILE *src = fopen(obj_path, "rb");
-    if (!src) {
+    int src_fd = open(obj_path, O_RDONLY);
+    if (src_fd < 0) {
         free(obj_path);
+        if (pack_has_object(fractyl_dir, hash, 1)) {
+            return restore_from_reader(hash, fractyl_dir, dest_path);
+        }
         return FRACTYL_ERROR_IO;
     }
     
-    FILE *dest = fopen(dest_path, "wb");
-    if (!dest) {
-        fclose(src);
+    // Encoded objects are decoded as a stream; raw ones can be shared or
+    // copied by the kernel
+    object_header_t header;
+    unsigned char head[OBJECT_HEADER_SIZE];
+    int encoded = pread(src_fd, head, sizeof(head), 0) == (ssize_t)sizeof(head) &&
+                  object_header_parse(head, sizeof(head), &header);
+    if (encoded && (header.codec == OBJECT_CODEC_DELTA || header.codec == OBJECT_CODEC_CHUNKED)) {
+        close(src_fd);
         free(obj_path);
-        return FRACTYL_ERROR_IO;
+        return restore_from_reader(hash, fractyl_dir, dest_path);
     }
-    
-    char buffer[8192];
-    size_t bytes_read;
-    
-    while ((bytes_read = fread(buffer, 1, sizeof(buffer), src)) > 0) {
-        if (fwrite(buffer, 1, bytes_read, dest) != bytes_read) {
-            fclose(src);
-            fclose(dest);
-            unlink(dest_path); // Clean up partial file
+    int kernel_copy = !encoded && kernel_copy_allowed(fractyl_dir);
+#ifdef __APPLE__
+    if (kernel_copy && !__atomic_load_n(&clone_unsupported, __ATOMIC_RELAXED) &&
+        (unlink(dest_path) == 0 || errno == ENOENT)) {
+        if (clonefile(obj_path, dest_path, 0) == 0) {
+            chmod(dest_path, 0644);
+            close(src_fd);
             free(obj_path);
-            return FRACTYL_ERROR_IO;
+            return FRACTYL_OK;
+        }
+        if (errno == ENOTSUP || errno == EXDEV) {
+            __atomic_store_n(&clone_unsupported, 1, __ATOMIC_RELAXED);
         }
     }
-    
-    fclose(src);
-    fclose(dest);
+#endif
     free(obj_path);
     
-    return FRACTYL_OK;
+    int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dest_fd < 0) {
+        close(src_fd);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    // Share the object's extents with the restored file where the
+    // filesystem allows it, else let the kernel copy, else copy by hand
+    int result = FRACTYL_ERROR_INVALID_STATE;
+    if (encoded) {
+        result = lseek(src_fd, OBJECT_HEADER_SIZE, SEEK_SET) == OBJECT_HEADER_SIZE
+            ? object_decode_fd(fractyl_dir, &header, src_fd, dest_fd)
+            : FRACTYL_ERROR_IO;
+    } else if (kernel_copy) {
+        result = clone_fd(src_fd, dest_fd);
+        if (result == FRACTYL_ERROR_INVALID_STATE) {
+            result = copy_range_fd(src_fd, dest_fd);
+        }
+    }
+    if (result == FRACTYL_ERROR_INVALID_STATE) {
+        result = copy_fd_buffered(src_fd, dest_fd, NULL, NULL);
+    }
+    
+    close(src_fd);
+    if (close(dest_fd) != 0 && result == FRACTYL_OK) {
+        result = FRACTYL_ERROR_IO;
+    }
+    if (result != FRACTYL_OK) {
+        unlink(dest_path); // Clean up partial file
+    }
+    return result;
 }
 
 int object_storage_init(const char *fractyl_dir) {
     if (!fractyl_dir) return FRACTYL_ERROR_GENERIC;
     
+    // A store created where another was deleted starts out empty
+    loose_cache_invalidate();
+    
     char objects_dir[512];
     snprintf(objects_dir, sizeof(objects_dir), "%s/objects", fractyl_dir);
     
@@ -304,11 +1929,118 @@ int object_storage_init(const char *fractyl_dir) {
     return FRACTYL_OK;
 }
 
-int object_gc(const char *fractyl_dir, const char **keep_hashes, size_t keep_count) {
-    // TODO: Implement garbage collection
-    // For now, just return success
-    (void)fractyl_dir;
-    (void)keep_hashes;
-    (void)keep_count;
+// Whole stored form of hash: from fd when it is the open loose file, else from a pack
+static int read_stored(const char *fractyl_dir, const unsigned char *hash, int fd,
+                       void **data_out, size_t *size_out) {
+    if (fd < 0) {
+        return pack_load_object(fractyl_dir, hash, data_out, size_out);
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 0) return FRACTYL_ERROR_IO;
+    void *data = malloc(st.st_size ? (size_t)st.st_size : 1);
+    if (!data) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    if (read_full_at(fd, data, (size_t)st.st_size, 0) != FRACTYL_OK) {
+        free(data);
+        return FRACTYL_ERROR_IO;
+    }
+    *data_out = data;
+    *size_out = (size_t)st.st_size;
+    return FRACTYL_OK;
+}
+
+int object_references(const char *fractyl_dir, const unsigned char *hash,
+                      unsigned char **refs_out, size_t *count_out) {
+    if (!fractyl_dir || !hash || !refs_out || !count_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    *refs_out = NULL;
+    *count_out = 0;
+    publish_if_pending(hash, fractyl_dir);
+    
+    // The header and a delta's base hash are enough for everything but chunk lists
+    unsigned char head[OBJECT_HEADER_SIZE + FRACTYL_HASH_SIZE];
+    size_t n = 0;
+    int fd = -1;
+    int result = pack_read_object_head(fractyl_dir, hash, head, sizeof(head), &n);
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        char *obj_path = find_loose_object(hash, fractyl_dir);
+        if (!obj_path) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        fd = open(obj_path, O_RDONLY | O_CLOEXEC);
+        free(obj_path);
+        if (fd >= 0) {
+            ssize_t got = pread(fd, head, sizeof(head), 0);
+            result = got < 0 ? FRACTYL_ERROR_IO : FRACTYL_OK;
+            n = got > 0 ? (size_t)got : 0;
+        } else if (pack_has_object(fractyl_dir, hash, 1)) {
+            // A repack may have just moved it into a pack we have not seen yet
+            result = pack_read_object_head(fractyl_dir, hash, head, sizeof(head), &n);
+        }
+    }
+    if (result != FRACTYL_OK) {
+        if (fd >= 0) close(fd);
+        return result;
+    }
+    
+    object_header_t header;
+    if (!object_header_parse(head, n, &header) ||
+        (header.codec != OBJECT_CODEC_CHUNKED && header.codec != OBJECT_CODEC_DELTA)) {
+        if (fd >= 0) close(fd);
+        return FRACTYL_OK;
+    }
+    
+    unsigned char *refs;
+    if (header.codec == OBJECT_CODEC_DELTA) {
+        if (fd >= 0) close(fd);
+        if (n < sizeof(head)) return FRACTYL_ERROR_IO;
+        if (!(refs = malloc(FRACTYL_HASH_SIZE))) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        memcpy(refs, head + OBJECT_HEADER_SIZE, FRACTYL_HASH_SIZE);
+        *refs_out = refs;
+        *count_out = 1;
+        return FRACTYL_OK;
+    }
+    
+    void *stored;
+    size_t stored_size;
+    result = read_stored(fractyl_dir, hash, fd, &stored, &stored_size);
+    if (fd >= 0) close(fd);
+    if (result != FRACTYL_OK) return result;
+    
+    const unsigned char *entries = (const unsigned char *)stored + OBJECT_HEADER_SIZE;
+    size_t entries_size = stored_size - OBJECT_HEADER_SIZE;
+    size_t count = entries_size / CHUNK_ENTRY_SIZE;
+    if (entries_size % CHUNK_ENTRY_SIZE != 0) {
+        free(stored);
+        return FRACTYL_ERROR_IO;
+    }
+    refs = malloc(count ? count * FRACTYL_HASH_SIZE : 1);
+    if (!refs) {
+        free(stored);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < count; i++) {
+        memcpy(refs + i * FRACTYL_HASH_SIZE, entries + i * CHUNK_ENTRY_SIZE, FRACTYL_HASH_SIZE);
+    }
+    free(stored);
+    *refs_out = refs;
+    *count_out = count;
     return FRACTYL_OK;
-}
\ No newline at end of file
+}
+
+int object_is_chunk_list(const char *fractyl_dir, const unsigned char *hash) {
+    if (!fractyl_dir || !hash) return 0;
+    // Chunk lists stay loose
+    if (pack_has_object(fractyl_dir, hash, 0)) return 0;
+    publish_if_pending(hash, fractyl_dir);
+    
+    char *obj_path = find_loose_object(hash, fractyl_dir);
+    int fd = obj_path ? open(obj_path, O_RDONLY | O_CLOEXEC) : -1;
+    free(obj_path);
+    if (fd < 0) return 0;
+    
+    unsigned char head[OBJECT_HEADER_SIZE];
+    ssize_t got = pread(fd, head, sizeof(head), 0);
+    close(fd);
+    object_header_t header;
+    return got > 0 && object_header_parse(head, (size_t)got, &header) && header.codec == OBJECT_CODEC_CHUNKED;
+}
@@ -2,35 +2,149 @@
 #define OBJECTS_H
 
 #include "../include/fractyl.h"
+#include "../include/core.h"
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Objects are stored loose, one file each under .fractyl/objects/XX/, until
+// 'frac repack' moves them into packfiles (see pack.h). Lookups search the
+// packs first and fall back to loose objects; loose objects already seen
+// are remembered for the whole process (see loose_cache.h).
+//
+// Files from objects.chunk_threshold bytes on (16 MiB by default) are cut
+// into content-defined chunks (see chunker.h), each stored as an object.
+// The object under the file's hash is then a chunk list: an
+// OBJECT_CODEC_CHUNKED header (see compress.h) followed by the 32-byte
+// hash and u64 size of every chunk in order. Chunk lists stay loose.
+//
+// 'frac repack' may store an object as a delta against an earlier or later
+// version of the same path: an OBJECT_CODEC_DELTA header, the 32-byte hash
+// of the base object and a binary delta (see delta.h). Loading follows the
+// chain of bases, which repack keeps at most --depth objects long.
+//
+// Storing and restoring loose objects first try a reflink (FICLONE,
+// clonefile) and then copy_file_range(), falling back to a buffered copy
+// when the filesystem supports neither. Setting objects.copy_mode = copy
+// in .fractyl/config always uses the buffered copy.
+
 // Store file content by hash in .fractyl/objects/
 int object_store_file(const char *file_path, const char *fractyl_dir, unsigned char *hash_out);
 
+// Store file content under an already computed hash (no-op if it exists)
+int object_write_file(const char *file_path, const char *fractyl_dir, const unsigned char *hash);
+
 // Store data buffer by hash in .fractyl/objects/
 int object_store_data(const void *data, size_t size, const char *fractyl_dir, unsigned char *hash_out);
 
 // Load object content by hash (caller must free returned buffer)
 int object_load(const unsigned char *hash, const char *fractyl_dir, void **data_out, size_t *size_out);
 
+// Reads an object's content without holding all of it in memory: content
+// stored as is, loose or packed, is read in place and can be mapped whole;
+// compressed objects are decoded and chunk lists followed as they are read.
+// Only deltas are assembled in memory first. A reader is used from one
+// thread.
+typedef struct object_reader object_reader_t;
+
+int object_reader_open(const unsigned char *hash, const char *fractyl_dir, object_reader_t **reader_out);
+// A reader over a plain file, for comparing objects with the working tree
+int object_reader_open_file(const char *path, object_reader_t **reader_out);
+uint64_t object_reader_size(const object_reader_t *reader);
+// Fill buffer with the next bytes of content, short only at the end;
+// returns the bytes read, 0 at the end, or a negative FRACTYL_ERROR_* code
+ssize_t object_reader_read(object_reader_t *reader, void *buffer, size_t size);
+// The whole content, mapped read-only until the reader is closed, or NULL
+// if it has to be decoded (read it with object_reader_read() instead)
+const void* object_reader_view(object_reader_t *reader);
+void object_reader_close(object_reader_t *reader);
+
+// Load a snapshot's index into index: a root tree (tree.h) or, for older
+// snapshots, a flat index object read straight from storage
+int object_load_index(const unsigned char *hash, const char *fractyl_dir, index_t *index);
+
+// Serialize index in memory and store it as an object
+int object_store_index(const index_t *index, const char *fractyl_dir, unsigned char *hash_out);
+
+// Decode a stored object (the bytes of a loose file or pack entry) into
+// its content in a new buffer (caller frees)
+int object_decode_stored(const char *fractyl_dir, const void *stored, size_t size,
+                         void **data_out, size_t *size_out);
+
+// Encode target as a delta object against base, whose hash is base_hash
+// Returns FRACTYL_ERROR_NOT_FOUND if the result would exceed max_size
+int object_encode_delta(const unsigned char *base_hash, const void *base, size_t base_size,
+                        const void *target, size_t target_size, size_t max_size,
+                        void **stored_out, size_t *stored_size_out);
+
+// How stored objects survive a crash, objects.durability in .fractyl/config
+typedef enum {
+    OBJECT_DURABILITY_NONE = 0,   // "none": named at once, written back whenever the OS gets to it
+    OBJECT_DURABILITY_BATCH,      // "batch" (default): synced in groups before they are named
+    OBJECT_DURABILITY_FULL        // "full": each object and its directory synced as it is stored
+} object_durability_t;
+
+object_durability_t object_durability(const char *fractyl_dir);
+
+// Make every object stored so far durable under its name. Call before
+// publishing what refers to them, such as a snapshot.
+int object_sync(const char *fractyl_dir);
+
 // Check if object exists by hash
 int object_exists(const unsigned char *hash, const char *fractyl_dir);
 
-// Get full path for hash (caller must free)
+// Get full loose object path for hash (caller must free)
 char* object_path(const unsigned char *hash, const char *fractyl_dir);
 
 // Restore file from object storage
 int object_restore_file(const unsigned char *hash, const char *fractyl_dir, const char *dest_path);
 
+// Open an object stored as a loose file of raw content, whose bytes are
+// the file's, to read it in place; -1 if it is packed, encoded or missing
+int object_open_raw(const unsigned char *hash, const char *fractyl_dir);
+
+// Hard-link dest_path (replacing it) to an object stored as a loose file
+// of raw content. Since both names share the inode, the object is made
+// read-only (0444) first. FRACTYL_ERROR_INVALID_STATE if the object is
+// packed or encoded or the filesystem cannot link it there.
+int object_link_file(const unsigned char *hash, const char *fractyl_dir, const char *dest_path);
+
+// Have the kernel start reading an object that will be restored soon,
+// packed or loose; a hint only, so errors are ignored
+void object_prefetch(const unsigned char *hash, const char *fractyl_dir);
+
 // Initialize object storage directory structure
 int object_storage_init(const char *fractyl_dir);
 
-// Garbage collect unreferenced objects (future enhancement)
-int object_gc(const char *fractyl_dir, const char **keep_hashes, size_t keep_count);
+// What storing objects cost since object_stats_reset(), summed over every
+// thread of the process; snapshots record it (see snapshot_stats_t)
+typedef struct {
+    unsigned long long objects_written;     // New objects: files, chunks, chunk lists, trees
+    unsigned long long bytes_written;       // Their size in the store
+    unsigned long long bytes_deduplicated;  // Content that was stored already
+    unsigned long long hash_ns;             // Hashing files to look them up first
+    unsigned long long store_ns;            // In object_store_file() and object_write_file()
+} object_stats_t;
+
+void object_stats_reset(void);
+void object_stats_get(object_stats_t *stats);
+
+// For callers that find content already stored, or hash files, themselves
+void object_stats_add_deduplicated(unsigned long long bytes);
+void object_stats_add_hash_time(unsigned long long ns);
+
+// Objects that hash's stored form depends on: the chunks of a chunk list
+// or the base of a delta, FRACTYL_HASH_SIZE bytes each (caller frees
+// *refs_out). Returns FRACTYL_ERROR_NOT_FOUND if the object is missing.
+int object_references(const char *fractyl_dir, const unsigned char *hash,
+                      unsigned char **refs_out, size_t *count_out);
+
+// Nonzero if hash is stored as a chunk list
+int object_is_chunk_list(const char *fractyl_dir, const unsigned char *hash);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,1181 @@
+#include "pack.h"
+#include "hash.h"
+#include "compress.h"
+#include "objects.h"
+#include "loose_cache.h"
+#include "alternates.h"
+#include "../include/fractyl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PACK_FANOUT_ENTRIES 256
+#define PACK_IDX_MIN_SIZE (PACK_HEADER_SIZE + PACK_FANOUT_ENTRIES * sizeof(uint32_t))
+#define PACK_ENTRY_HEADER_SIZE (FRACTYL_HASH_SIZE + sizeof(uint64_t))
+// Version 1 packs hold decoded content rather than stored objects
+#define PACK_VERSION_DECODED 1
+// Objects outside this range are not worth a delta
+#define DELTA_MIN_OBJECT_SIZE 256
+#define DELTA_MAX_OBJECT_SIZE (16 * 1024 * 1024)
+// Chain lengths are only followed this far when planning deltas
+#define DELTA_WALK_LIMIT 64
+
+// One mapped pack and its index
+typedef struct {
+    char *pack_path;
+    uint32_t version;
+    const unsigned char *idx_map;
+    size_t idx_size;
+    const unsigned char *pack_map;
+    size_t pack_size;
+    uint32_t count;
+    const uint32_t *fanout;
+    const unsigned char *hashes;
+    const uint64_t *offsets;
+    const uint64_t *sizes;
+    int shared;                 // In one of the repository's shared stores
+} packfile_t;
+
+// Pack directories of a repository: its own, then its shared stores'
+#define PACK_DIRS (1 + ALTERNATES_MAX)
+
+// Packs of the repository used last, its own first. Lookups hold the read
+// lock while they touch the mappings; reloading takes the write lock.
+static pthread_rwlock_t pack_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct {
+    int loaded;
+    char fractyl_dir[2048];
+    size_t dir_count;
+    int dir_exists[PACK_DIRS];
+    struct timespec dir_mtime[PACK_DIRS];
+    packfile_t *packs;
+    size_t count;
+    size_t capacity;
+} pack_cache;
+
+static void pack_dir_path(const char *fractyl_dir, char *path, size_t size) {
+    snprintf(path, size, "%s/objects/pack", fractyl_dir);
+}
+
+static int map_file(const char *path, const unsigned char **map_out, size_t *size_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return FRACTYL_ERROR_IO;
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return FRACTYL_ERROR_IO;
+    
+    *map_out = map;
+    *size_out = (size_t)st.st_size;
+    return FRACTYL_OK;
+}
+
+static void packfile_close(packfile_t *pack) {
+    if (pack->idx_map) munmap((void *)pack->idx_map, pack->idx_size);
+    if (pack->pack_map) munmap((void *)pack->pack_map, pack->pack_size);
+    free(pack->pack_path);
+    memset(pack, 0, sizeof(*pack));
+}
+
+static int packfile_open(packfile_t *pack, const char *idx_path, const char *pack_path) {
+    memset(pack, 0, sizeof(*pack));
+    
+    if (map_file(idx_path, &pack->idx_map, &pack->idx_size) != FRACTYL_OK) {
+        return FRACTYL_ERROR_IO;
+    }
+    if (map_file(pack_path, &pack->pack_map, &pack->pack_size) != FRACTYL_OK) {
+        packfile_close(pack);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    uint32_t idx_header[4], pack_header[4];
+    if (pack->idx_size < PACK_IDX_MIN_SIZE || pack->pack_size < PACK_HEADER_SIZE) {
+        packfile_close(pack);
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    memcpy(idx_header, pack->idx_map, sizeof(idx_header));
+    memcpy(pack_header, pack->pack_map, sizeof(pack_header));
+    
+    pack->version = pack_header[1];
+    pack->count = idx_header[2];
+    size_t expected = PACK_IDX_MIN_SIZE + (size_t)pack->count * (FRACTYL_HASH_SIZE + 2 * sizeof(uint64_t));
+    pack->fanout = (const uint32_t *)(pack->idx_map + PACK_HEADER_SIZE);
+    if (memcmp(pack->idx_map, "FPIX", 4) != 0 || idx_header[1] != pack->version ||
+        memcmp(pack->pack_map, "FPAK", 4) != 0 ||
+        (pack->version != PACK_VERSION && pack->version != PACK_VERSION_DECODED) ||
+        pack_header[2] != pack->count || pack_header[3] != (uint32_t)hash_get_algorithm() ||
+        idx_header[3] != pack_header[3] || pack->idx_size != expected ||
+        pack->fanout[PACK_FANOUT_ENTRIES - 1] != pack->count) {
+        packfile_close(pack);
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    
+    pack->hashes = pack->idx_map + PACK_IDX_MIN_SIZE;
+    pack->offsets = (const uint64_t *)(pack->hashes + (size_t)pack->count * FRACTYL_HASH_SIZE);
+    pack->sizes = pack->offsets + pack->count;
+    pack->pack_path = strdup(pack_path);
+    if (!pack->pack_path) {
+        packfile_close(pack);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    return FRACTYL_OK;
+}
+
+// Position of hash in the pack, or -1. The fanout narrows the binary
+// search to the objects sharing the first byte.
+static long packfile_find(const packfile_t *pack, const unsigned char *hash) {
+    uint32_t lo = hash[0] ? pack->fanout[hash[0] - 1] : 0;
+    uint32_t hi = pack->fanout[hash[0]];
+    
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(pack->hashes + (size_t)mid * FRACTYL_HASH_SIZE, hash, FRACTYL_HASH_SIZE);
+        if (cmp == 0) return (long)mid;
+        if (cmp < 0) lo = mid + 1; else hi = mid;
+    }
+    return -1;
+}
+
+// Stored bytes of entry pos, or NULL if the index points outside the pack
+static const unsigned char* packfile_data(const packfile_t *pack, long pos, size_t *size_out) {
+    uint64_t offset = pack->offsets[pos];
+    uint64_t size = pack->sizes[pos];
+    if (offset < PACK_HEADER_SIZE + PACK_ENTRY_HEADER_SIZE || offset > pack->pack_size ||
+        size > pack->pack_size - offset) {
+        return NULL;
+    }
+    *size_out = (size_t)size;
+    return pack->pack_map + offset;
+}
+
+static void cache_clear(void) {
+    for (size_t i = 0; i < pack_cache.count; i++) {
+        packfile_close(&pack_cache.packs[i]);
+    }
+    free(pack_cache.packs);
+    pack_cache.packs = NULL;
+    pack_cache.count = 0;
+    pack_cache.capacity = 0;
+    pack_cache.loaded = 0;
+}
+
+static int pack_dir_stat(const char *fractyl_dir, struct timespec *mtime) {
+    char dir_path[2048];
+    pack_dir_path(fractyl_dir, dir_path, sizeof(dir_path));
+    
+    struct stat st;
+    if (stat(dir_path, &st) != 0) return 0;
+    *mtime = st.st_mtim;
+    return 1;
+}
+
+// The pack directories of fractyl_dir's object stores, its own first
+static size_t store_dirs(const char *fractyl_dir, const char *dirs[PACK_DIRS]) {
+    const char *const *stores;
+    size_t count = alternates_list(fractyl_dir, &stores);
+    dirs[0] = fractyl_dir;
+    for (size_t i = 0; i < count; i++) {
+        dirs[i + 1] = stores[i];
+    }
+    return count + 1;
+}
+
+// Open the packs of one store. Caller holds the write lock.
+static void cache_load_dir(const char *store, int shared) {
+    char dir_path[2048];
+    pack_dir_path(store, dir_path, sizeof(dir_path));
+    DIR *d = opendir(dir_path);
+    if (!d) return;
+    
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (strncmp(entry->d_name, "pack-", 5) != 0 || len < 9 ||
+            strcmp(entry->d_name + len - 4, ".idx") != 0) {
+            continue;
+        }
+    
+        char idx_path[2048], pack_path[2048];
+        snprintf(idx_path, sizeof(idx_path), "%s/%s", dir_path, entry->d_name);
+        snprintf(pack_path, sizeof(pack_path), "%s/%.*s.pack", dir_path, (int)(len - 4), entry->d_name);
+    
+        if (pack_cache.count >= pack_cache.capacity) {
+            size_t new_capacity = pack_cache.capacity ? pack_cache.capacity * 2 : 8;
+            packfile_t *grown = realloc(pack_cache.packs, new_capacity * sizeof(packfile_t));
+            if (!grown) break;
+            pack_cache.packs = grown;
+            pack_cache.capacity = new_capacity;
+        }
+        if (packfile_open(&pack_cache.packs[pack_cache.count], idx_path, pack_path) == FRACTYL_OK) {
+            pack_cache.packs[pack_cache.count++].shared = shared;
+        }
+    }
+    closedir(d);
+}
+
+// Caller holds the write lock
+static void cache_load(const char *fractyl_dir) {
+    cache_clear();
+    snprintf(pack_cache.fractyl_dir, sizeof(pack_cache.fractyl_dir), "%s", fractyl_dir);
+    pack_cache.loaded = 1;
+    
+    const char *dirs[PACK_DIRS];
+    pack_cache.dir_count = store_dirs(fractyl_dir, dirs);
+    for (size_t i = 0; i < pack_cache.dir_count; i++) {
+        pack_cache.dir_exists[i] = pack_dir_stat(dirs[i], &pack_cache.dir_mtime[i]);
+        if (pack_cache.dir_exists[i]) cache_load_dir(dirs[i], i > 0);
+    }
+}
+
+static int cache_matches(const char *fractyl_dir, int check_dir) {
+    if (!pack_cache.loaded || strcmp(pack_cache.fractyl_dir, fractyl_dir) != 0) return 0;
+    if (!check_dir) return 1;
+    
+    const char *dirs[PACK_DIRS];
+    if (store_dirs(fractyl_dir, dirs) != pack_cache.dir_count) return 0;
+    for (size_t i = 0; i < pack_cache.dir_count; i++) {
+        struct timespec mtime;
+        int exists = pack_dir_stat(dirs[i], &mtime);
+        if (exists != pack_cache.dir_exists[i]) return 0;
+        if (exists && (mtime.tv_sec != pack_cache.dir_mtime[i].tv_sec ||
+                       mtime.tv_nsec != pack_cache.dir_mtime[i].tv_nsec)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Set while this thread holds the read lock for a repack, whose object
+// loads must not try to take the write lock underneath it
+static __thread int lock_held;
+
+// Take the read lock with the cache describing fractyl_dir. With rescan
+// set, a pack directory changed since it was listed is listed again.
+static void cache_acquire(const char *fractyl_dir, int rescan) {
+    pthread_rwlock_rdlock(&pack_lock);
+    if (lock_held) return;
+    for (int attempt = 0; attempt < 3 && !cache_matches(fractyl_dir, rescan); attempt++) {
+        pthread_rwlock_unlock(&pack_lock);
+        pthread_rwlock_wrlock(&pack_lock);
+        if (!cache_matches(fractyl_dir, rescan)) {
+            cache_load(fractyl_dir);
+        }
+        pthread_rwlock_unlock(&pack_lock);
+        pthread_rwlock_rdlock(&pack_lock);
+    }
+}
+
+// Caller holds the read lock. Packs of shared stores are searched too
+// unless own_only is set.
+static const packfile_t* cache_find_in(const unsigned char *hash, int own_only, long *pos_out) {
+    for (size_t i = 0; i < pack_cache.count; i++) {
+        if (own_only && pack_cache.packs[i].shared) continue;
+        long pos = packfile_find(&pack_cache.packs[i], hash);
+        if (pos >= 0) {
+            *pos_out = pos;
+            return &pack_cache.packs[i];
+        }
+    }
+    return NULL;
+}
+
+static const packfile_t* cache_find(const unsigned char *hash, long *pos_out) {
+    return cache_find_in(hash, 0, pos_out);
+}
+
+// Repacking works on the repository's own packs only
+static const packfile_t* cache_find_own(const unsigned char *hash, long *pos_out) {
+    return cache_find_in(hash, 1, pos_out);
+}
+
+int pack_has_object(const char *fractyl_dir, const unsigned char *hash, int rescan) {
+    if (!fractyl_dir || !hash) return 0;
+    
+    long pos;
+    cache_acquire(fractyl_dir, 0);
+    int found = cache_find(hash, &pos) != NULL;
+    pthread_rwlock_unlock(&pack_lock);
+    
+    if (!found && rescan) {
+        cache_acquire(fractyl_dir, 1);
+        found = cache_find(hash, &pos) != NULL;
+        pthread_rwlock_unlock(&pack_lock);
+    }
+    return found;
+}
+
+int pack_load_object(const char *fractyl_dir, const unsigned char *hash,
+                     void **data_out, size_t *size_out) {
+    if (!fractyl_dir || !hash || !data_out || !size_out) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    cache_acquire(fractyl_dir, 0);
+    long pos;
+    const packfile_t *pack = cache_find(hash, &pos);
+    size_t size = 0;
+    const unsigned char *content = pack ? packfile_data(pack, pos, &size) : NULL;
+    if (!content) {
+        pthread_rwlock_unlock(&pack_lock);
+        return FRACTYL_ERROR_NOT_FOUND;
+    }
+    
+    // Decoded content that could pass for a header gets a raw one
+    size_t prefix = 0;
+    if (pack->version == PACK_VERSION_DECODED && object_header_parse(content, size, NULL)) {
+        prefix = OBJECT_HEADER_SIZE;
+    }
+    unsigned char *data = malloc(prefix + size ? prefix + size : 1);
+    if (data) {
+        if (prefix) {
+            object_header_t header = { OBJECT_CODEC_RAW, 0, size, 0 };
+            object_header_encode(data, &header);
+        }
+        memcpy(data + prefix, content, size);
+    }
+    pthread_rwlock_unlock(&pack_lock);
+    if (!data) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    *data_out = data;
+    *size_out = prefix + size;
+    return FRACTYL_OK;
+}
+
+int pack_read_object_head(const char *fractyl_dir, const unsigned char *hash,
+                          void *buffer, size_t size, size_t *read_out) {
+    if (!fractyl_dir || !hash || (!buffer && size) || !read_out) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    cache_acquire(fractyl_dir, 0);
+    long pos;
+    const packfile_t *pack = cache_find(hash, &pos);
+    size_t stored_size = 0;
+    const unsigned char *content = pack ? packfile_data(pack, pos, &stored_size) : NULL;
+    if (!content) {
+        pthread_rwlock_unlock(&pack_lock);
+        return FRACTYL_ERROR_NOT_FOUND;
+    }
+    
+    // As pack_load_object() would return it
+    size_t n;
+    if (pack->version == PACK_VERSION_DECODED && object_header_parse(content, stored_size, NULL)) {
+        unsigned char header_bytes[OBJECT_HEADER_SIZE];
+        object_header_t header = { OBJECT_CODEC_RAW, 0, stored_size, 0 };
+        object_header_encode(header_bytes, &header);
+        n = size < OBJECT_HEADER_SIZE ? size : OBJECT_HEADER_SIZE;
+        memcpy(buffer, header_bytes, n);
+        size_t rest = size - n < stored_size ? size - n : stored_size;
+        memcpy((unsigned char *)buffer + n, content, rest);
+        n += rest;
+    } else {
+        n = size < stored_size ? size : stored_size;
+        memcpy(buffer, content, n);
+    }
+    pthread_rwlock_unlock(&pack_lock);
+    
+    *read_out = n;
+    return FRACTYL_OK;
+}
+
+int pack_locate_object(const char *fractyl_dir, const unsigned char *hash,
+                       uint32_t *pack_out, uint64_t *offset_out) {
+    if (!fractyl_dir || !hash || !pack_out || !offset_out) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    cache_acquire(fractyl_dir, 0);
+    long pos;
+    const packfile_t *pack = cache_find(hash, &pos);
+    if (pack) {
+        *pack_out = (uint32_t)(pack - pack_cache.packs);
+        *offset_out = pack->offsets[pos];
+    }
+    pthread_rwlock_unlock(&pack_lock);
+    return pack ? FRACTYL_OK : FRACTYL_ERROR_NOT_FOUND;
+}
+
+int pack_open_object(const char *fractyl_dir, const unsigned char *hash, int *fd_out,
+                     uint64_t *offset_out, size_t *size_out, int *decoded_out) {
+    if (!fractyl_dir || !hash || !fd_out || !offset_out || !size_out || !decoded_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    cache_acquire(fractyl_dir, 0);
+    long pos;
+    const packfile_t *pack = cache_find(hash, &pos);
+    size_t size = 0;
+    const unsigned char *content = pack ? packfile_data(pack, pos, &size) : NULL;
+    if (!content) {
+        pthread_rwlock_unlock(&pack_lock);
+        return FRACTYL_ERROR_NOT_FOUND;
+    }
+    // A descriptor of its own outlives the cache's mapping
+    int fd = open(pack->pack_path, O_RDONLY);
+    *offset_out = (uint64_t)(content - pack->pack_map);
+    *size_out = size;
+    *decoded_out = pack->version == PACK_VERSION_DECODED;
+    pthread_rwlock_unlock(&pack_lock);
+    if (fd < 0) return FRACTYL_ERROR_IO;
+    
+    *fd_out = fd;
+    return FRACTYL_OK;
+}
+
+int pack_prefetch_object(const char *fractyl_dir, const unsigned char *hash) {
+    if (!fractyl_dir || !hash) return 0;
+    
+    cache_acquire(fractyl_dir, 0);
+    long pos;
+    const packfile_t *pack = cache_find(hash, &pos);
+    size_t size = 0;
+    const unsigned char *content = pack ? packfile_data(pack, pos, &size) : NULL;
+    if (content && size > 0) {
+        // madvise() wants a page-aligned start
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t skew = (size_t)(content - pack->pack_map) % page;
+        madvise((void *)(content - skew), size + skew, MADV_WILLNEED);
+    }
+    pthread_rwlock_unlock(&pack_lock);
+    return pack != NULL;
+}
+
+void pack_cache_invalidate(void) {
+    pthread_rwlock_wrlock(&pack_lock);
+    cache_clear();
+    pthread_rwlock_unlock(&pack_lock);
+}
+
+// --- Repacking ---
+
+// How an entry goes into the new pack
+typedef enum {
+    ENTRY_KEEP = 0,                 // Its stored form, unchanged
+    ENTRY_DELTA,                    // A new delta against base
+    ENTRY_DECODED                   // Its content, so it no longer depends on a base
+} entry_mode_t;
+
+// An object headed for the new pack
+typedef struct {
+    unsigned char hash[FRACTYL_HASH_SIZE];
+    char *loose_path;               // Loose source, NULL for packed content
+    const unsigned char *data;      // Packed source, valid under the read lock
+    uint64_t size;                  // Stored size
+    uint64_t offset;                // Content offset in the new pack
+    int decoded;                    // Packed source is a version 1 pack
+    int skipped;                    // Unreadable, corrupt or a chunk list; left loose
+    int chunk_list;
+    int mode;                       // entry_mode_t
+    int has_old_base;               // Stored as a delta against old_base
+    int wrote_delta;
+    unsigned char old_base[FRACTYL_HASH_SIZE];
+    unsigned char base[FRACTYL_HASH_SIZE];
+} repack_entry_t;
+
+typedef struct {
+    repack_entry_t *items;
+    size_t count;
+    size_t capacity;
+} repack_list_t;
+
+static repack_entry_t* repack_list_add(repack_list_t *list) {
+    if (list->count >= list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 256;
+        repack_entry_t *grown = realloc(list->items, new_capacity * sizeof(repack_entry_t));
+        if (!grown) return NULL;
+        list->items = grown;
+        list->capacity = new_capacity;
+    }
+    repack_entry_t *entry = &list->items[list->count++];
+    memset(entry, 0, sizeof(*entry));
+    return entry;
+}
+
+static int compare_repack_entries(const void *a, const void *b) {
+    return memcmp(((const repack_entry_t *)a)->hash, ((const repack_entry_t *)b)->hash,
+                  FRACTYL_HASH_SIZE);
+}
+
+static int compare_hashes(const void *a, const void *b) {
+    return memcmp(a, b, FRACTYL_HASH_SIZE);
+}
+
+static int is_hex_string(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = s[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) return 0;
+    }
+    return s[len] == '\0';
+}
+
+// Add every loose object to list; ones a pack already holds (and all is
+// unset) go to redundant instead, to be deleted without repacking
+static int collect_loose_objects(const char *fractyl_dir, int all, repack_list_t *list,
+                                 repack_list_t *redundant) {
+    char objects_dir[2048];
+    snprintf(objects_dir, sizeof(objects_dir), "%s/objects", fractyl_dir);
+    DIR *d = opendir(objects_dir);
+    if (!d) return FRACTYL_OK;
+    
+    struct dirent *fanout;
+    while ((fanout = readdir(d)) != NULL) {
+        if (!is_hex_string(fanout->d_name, 2)) continue;
+    
+        char sub_path[2048];
+        snprintf(sub_path, sizeof(sub_path), "%s/%s", objects_dir, fanout->d_name);
+        DIR *sub = opendir(sub_path);
+        if (!sub) continue;
+    
+        struct dirent *entry;
+        while ((entry = readdir(sub)) != NULL) {
+            if (!is_hex_string(entry->d_name, FRACTYL_HASH_HEX_SIZE - 3)) continue;
+    
+            char hex[FRACTYL_HASH_HEX_SIZE];
+            snprintf(hex, sizeof(hex), "%s%s", fanout->d_name, entry->d_name);
+            unsigned char hash[FRACTYL_HASH_SIZE];
+            if (string_to_hash(hex, hash) != FRACTYL_OK) continue;
+    
+            long pos;
+            repack_list_t *target = !all && cache_find_own(hash, &pos) ? redundant : list;
+            repack_entry_t *item = repack_list_add(target);
+            char path[2048];
+            snprintf(path, sizeof(path), "%s/%s", sub_path, entry->d_name);
+            if (!item || !(item->loose_path = strdup(path))) {
+                if (item) target->count--;
+                closedir(sub);
+                closedir(d);
+                return FRACTYL_ERROR_OUT_OF_MEMORY;
+            }
+            memcpy(item->hash, hash, FRACTYL_HASH_SIZE);
+        }
+        closedir(sub);
+    }
+    closedir(d);
+    return FRACTYL_OK;
+}
+
+// Note chunk lists and the bases of existing deltas from the start of
+// every stored object, and the size of loose ones
+static void read_stored_heads(repack_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        repack_entry_t *entry = &list->items[i];
+        unsigned char head[OBJECT_HEADER_SIZE + FRACTYL_HASH_SIZE];
+        size_t n = 0;
+    
+        if (entry->loose_path) {
+            int fd = open(entry->loose_path, O_RDONLY);
+            struct stat st;
+            if (fd < 0) continue;
+            if (fstat(fd, &st) == 0) entry->size = (uint64_t)st.st_size;
+            ssize_t got = pread(fd, head, sizeof(head), 0);
+            close(fd);
+            n = got > 0 ? (size_t)got : 0;
+        } else if (!entry->decoded) {
+            n = entry->size < sizeof(head) ? (size_t)entry->size : sizeof(head);
+            memcpy(head, entry->data, n);
+        }
+    
+        object_header_t header;
+        if (!object_header_parse(head, n, &header)) continue;
+        if (header.codec == OBJECT_CODEC_CHUNKED) {
+            entry->chunk_list = 1;
+        } else if (header.codec == OBJECT_CODEC_DELTA && n == sizeof(head)) {
+            entry->has_old_base = 1;
+            memcpy(entry->old_base, head + OBJECT_HEADER_SIZE, FRACTYL_HASH_SIZE);
+        }
+    }
+}
+
+// The list is sorted by hash
+static repack_entry_t* find_entry(const repack_list_t *list, const unsigned char *hash) {
+    size_t lo = 0, hi = list->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(list->items[mid].hash, hash, FRACTYL_HASH_SIZE);
+        if (cmp == 0) return &list->items[mid];
+        if (cmp < 0) lo = mid + 1; else hi = mid;
+    }
+    return NULL;
+}
+
+// Base an object will depend on once the new pack is written, if any.
+// Caller holds the read lock.
+static const unsigned char* planned_base(const repack_list_t *list, const unsigned char *hash) {
+    const repack_entry_t *entry = find_entry(list, hash);
+    if (entry) {
+        if (entry->mode == ENTRY_DELTA) return entry->base;
+        if (entry->mode == ENTRY_KEEP && entry->has_old_base) return entry->old_base;
+        return NULL;
+    }
+    
+    // Objects outside the list stay in their packs as they are
+    long pos;
+    size_t size;
+    object_header_t header;
+    const packfile_t *pack = cache_find_own(hash, &pos);
+    const unsigned char *data = pack && pack->version != PACK_VERSION_DECODED
+        ? packfile_data(pack, pos, &size) : NULL;
+    if (data && size >= OBJECT_HEADER_SIZE + FRACTYL_HASH_SIZE &&
+        object_header_parse(data, size, &header) && header.codec == OBJECT_CODEC_DELTA) {
+        return data + OBJECT_HEADER_SIZE;
+    }
+    return NULL;
+}
+
+// Number of bases below hash, or -1 if the chain reaches avoid
+static int chain_depth(const repack_list_t *list, const unsigned char *hash, const unsigned char *avoid) {
+    int depth = 0;
+    const unsigned char *base;
+    while (depth < DELTA_WALK_LIMIT && (base = planned_base(list, hash)) != NULL) {
+        if (avoid && memcmp(base, avoid, FRACTYL_HASH_SIZE) == 0) return -1;
+        hash = base;
+        depth++;
+    }
+    return depth;
+}
+
+// An entry that will not get its new delta; one that was a delta before is
+// written out in full, since its old chain was not checked against the plan
+static void drop_delta(repack_entry_t *entry) {
+    entry->mode = entry->has_old_base ? ENTRY_DECODED : ENTRY_KEEP;
+}
+
+// Choose delta bases from the candidate pairs, first pair first. A base
+// is taken only if it exists, does not lead back to the target and keeps
+// the chain within max_depth.
+static void plan_deltas(repack_list_t *list, const pack_repack_options_t *options) {
+    for (size_t i = 0; i < options->pair_count; i++) {
+        const pack_delta_pair_t *pair = &options->pairs[i];
+        repack_entry_t *target = find_entry(list, pair->target);
+        if (!target || target->mode == ENTRY_DELTA || target->chunk_list || target->size < DELTA_MIN_OBJECT_SIZE ||
+            target->size > DELTA_MAX_OBJECT_SIZE || memcmp(pair->target, pair->base, FRACTYL_HASH_SIZE) == 0) {
+            continue;
+        }
+    
+        long pos;
+        const repack_entry_t *base = find_entry(list, pair->base);
+        if (base ? base->chunk_list : !cache_find_own(pair->base, &pos)) continue;
+    
+        int depth = chain_depth(list, pair->base, pair->target);
+        if (depth < 0 || depth + 1 > options->max_depth) continue;
+        memcpy(target->base, pair->base, FRACTYL_HASH_SIZE);
+        target->mode = ENTRY_DELTA;
+    }
+    
+    // Bases chosen later may have lengthened chains checked earlier.
+    // Dropping a delta only shortens chains, so one pass settles it.
+    for (size_t i = 0; i < list->count; i++) {
+        repack_entry_t *entry = &list->items[i];
+        int planned = entry->mode == ENTRY_DELTA || (entry->mode == ENTRY_KEEP && entry->has_old_base);
+        if (planned && chain_depth(list, entry->hash, NULL) > options->max_depth) {
+            if (entry->mode == ENTRY_DELTA) drop_delta(entry);
+            else entry->mode = ENTRY_DECODED;
+        }
+        if (entry->mode == ENTRY_DELTA && entry->has_old_base &&
+            memcmp(entry->base, entry->old_base, FRACTYL_HASH_SIZE) == 0) {
+            entry->mode = ENTRY_KEEP;
+        }
+    }
+}
+
+// Append one object to the pack being written, checking that loose
+// content still matches its name. Entries hold stored forms, as loose
+// files do, unless the plan says otherwise.
+static int write_pack_entry(const char *fractyl_dir, FILE *fp, repack_entry_t *entry, uint64_t *offset) {
+    const unsigned char *data = entry->data;
+    size_t size = (size_t)entry->size;
+    const unsigned char *map = NULL;
+    size_t map_size = 0;
+    const unsigned char *plain = NULL;
+    size_t plain_size = 0;
+    void *decoded = NULL;
+    void *delta = NULL;
+    size_t delta_size = 0;
+    int result = FRACTYL_OK;
+    
+    if (entry->loose_path) {
+        int fd = open(entry->loose_path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) close(fd);
+            return FRACTYL_ERROR_IO;
+        }
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (m == MAP_FAILED) {
+                close(fd);
+                return FRACTYL_ERROR_IO;
+            }
+            map = m;
+            map_size = size;
+        }
+        close(fd);
+        data = map;
+    }
+    
+    if (entry->decoded) {
+        plain = data;
+        plain_size = size;
+    } else if (entry->loose_path || entry->mode != ENTRY_KEEP) {
+        result = object_decode_stored(fractyl_dir, data, size, &decoded, &plain_size);
+        if (result != FRACTYL_OK && result != FRACTYL_ERROR_OUT_OF_MEMORY) {
+            result = FRACTYL_ERROR_INVALID_STATE;
+        }
+        plain = decoded;
+        // A packed object that cannot be decoded is carried over as it is
+        if (result != FRACTYL_OK && !entry->loose_path) {
+            entry->mode = ENTRY_KEEP;
+            result = FRACTYL_OK;
+        }
+    }
+    
+    if (result == FRACTYL_OK && entry->loose_path) {
+        unsigned char actual[FRACTYL_HASH_SIZE];
+        static const unsigned char empty = 0;
+        if (hash_data(plain_size ? plain : &empty, plain_size, actual) != FRACTYL_OK ||
+            memcmp(actual, entry->hash, FRACTYL_HASH_SIZE) != 0) {
+            result = FRACTYL_ERROR_INVALID_STATE;
+        }
+    }
+    
+    // A delta has to save at least half of what it replaces
+    if (result == FRACTYL_OK && entry->mode == ENTRY_DELTA) {
+        void *base;
+        size_t base_size;
+        size_t limit = (entry->has_old_base ? plain_size : size) / 2;
+        if (object_load(entry->base, fractyl_dir, &base, &base_size) == FRACTYL_OK) {
+            if (base_size <= DELTA_MAX_OBJECT_SIZE) {
+                object_encode_delta(entry->base, base, base_size, plain, plain_size, limit, &delta, &delta_size);
+            }
+            free(base);
+        }
+        if (!delta) drop_delta(entry);
+    }
+    
+    // Re-encoded and version 1 content gets a raw header if it could be
+    // mistaken for one
+    const unsigned char *out = data;
+    size_t out_size = size;
+    if (delta) {
+        out = delta;
+        out_size = delta_size;
+    } else if (entry->mode == ENTRY_DECODED || entry->decoded) {
+        out = plain;
+        out_size = plain_size;
+    }
+    unsigned char raw_header[OBJECT_HEADER_SIZE];
+    size_t prefix = 0;
+    if (!delta && (entry->mode == ENTRY_DECODED || entry->decoded) && object_header_parse(out, out_size, NULL)) {
+        object_header_t header = { OBJECT_CODEC_RAW, 0, out_size, 0 };
+        object_header_encode(raw_header, &header);
+        prefix = OBJECT_HEADER_SIZE;
+    }
+    
+    uint64_t size64 = prefix + out_size;
+    if (result == FRACTYL_OK &&
+        (fwrite(entry->hash, 1, FRACTYL_HASH_SIZE, fp) != FRACTYL_HASH_SIZE ||
+         fwrite(&size64, sizeof(size64), 1, fp) != 1 ||
+         (prefix > 0 && fwrite(raw_header, 1, prefix, fp) != prefix) ||
+         (out_size > 0 && fwrite(out, 1, out_size, fp) != out_size))) {
+        result = FRACTYL_ERROR_IO;
+    }
+    if (map) munmap((void *)map, map_size);
+    free(decoded);
+    free(delta);
+    if (result != FRACTYL_OK) return result;
+    
+    entry->wrote_delta = delta != NULL || (entry->mode == ENTRY_KEEP && entry->has_old_base);
+    entry->size = size64;
+    entry->offset = *offset + PACK_ENTRY_HEADER_SIZE;
+    *offset = entry->offset + size64;
+    return FRACTYL_OK;
+}
+
+static int write_pack_header(FILE *fp, const char *magic, uint32_t count) {
+    uint32_t header[4] = { 0, PACK_VERSION, count, (uint32_t)hash_get_algorithm() };
+    memcpy(header, magic, 4);
+    return fwrite(header, sizeof(header), 1, fp) == 1 ? FRACTYL_OK : FRACTYL_ERROR_IO;
+}
+
+// Flush, sync and close a stream opened on a temporary file
+static int finish_temp_file(FILE *fp) {
+    int ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0) ok = 0;
+    return ok ? FRACTYL_OK : FRACTYL_ERROR_IO;
+}
+
+static int write_pack_index(const char *path, const repack_entry_t *items, size_t count, uint32_t written) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) return FRACTYL_ERROR_IO;
+    
+    uint32_t fanout[PACK_FANOUT_ENTRIES] = {0};
+    for (size_t i = 0; i < count; i++) {
+        if (!items[i].skipped) fanout[items[i].hash[0]]++;
+    }
+    for (int i = 1; i < PACK_FANOUT_ENTRIES; i++) {
+        fanout[i] += fanout[i - 1];
+    }
+    
+    int ok = write_pack_header(fp, "FPIX", written) == FRACTYL_OK &&
+             fwrite(fanout, sizeof(fanout), 1, fp) == 1;
+    for (size_t i = 0; ok && i < count; i++) {
+        if (!items[i].skipped) ok = fwrite(items[i].hash, 1, FRACTYL_HASH_SIZE, fp) == FRACTYL_HASH_SIZE;
+    }
+    for (size_t i = 0; ok && i < count; i++) {
+        if (!items[i].skipped) ok = fwrite(&items[i].offset, sizeof(uint64_t), 1, fp) == 1;
+    }
+    for (size_t i = 0; ok && i < count; i++) {
+        if (!items[i].skipped) ok = fwrite(&items[i].size, sizeof(uint64_t), 1, fp) == 1;
+    }
+    
+    if (finish_temp_file(fp) != FRACTYL_OK) ok = 0;
+    return ok ? FRACTYL_OK : FRACTYL_ERROR_IO;
+}
+
+// Name for a pack: the hash of its sorted object hashes
+static int pack_name(const repack_entry_t *items, size_t count, uint32_t written, char *hex_out) {
+    unsigned char *ids = malloc((size_t)written * FRACTYL_HASH_SIZE + 1);
+    if (!ids) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!items[i].skipped) memcpy(ids + n++ * FRACTYL_HASH_SIZE, items[i].hash, FRACTYL_HASH_SIZE);
+    }
+    unsigned char name[FRACTYL_HASH_SIZE];
+    int result = hash_data(ids, n * FRACTYL_HASH_SIZE, name);
+    free(ids);
+    if (result == FRACTYL_OK) hash_to_string(name, hex_out);
+    return result;
+}
+
+static void free_repack_list(repack_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i].loose_path);
+    }
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+// Write the pack and its index under dir_path/pack-<name>. On success the
+// objects are reachable through the new pack; name_out receives <name>.
+static int write_new_pack(const char *fractyl_dir, const char *dir_path, repack_list_t *list, char *name_out,
+                          size_t *written_out) {
+    char tmp_pack[2048], tmp_idx[2048];
+    if (mkdir(dir_path, 0755) != 0 && errno != EEXIST) return FRACTYL_ERROR_IO;
+    
+    snprintf(tmp_pack, sizeof(tmp_pack), "%s/tmp-pack-XXXXXX", dir_path);
+    int fd = mkstemp(tmp_pack);
+    FILE *fp = fd >= 0 ? fdopen(fd, "w+b") : NULL;
+    if (!fp) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp_pack);
+        }
+        return FRACTYL_ERROR_IO;
+    }
+    fchmod(fd, 0444);
+    
+    int result = write_pack_header(fp, "FPAK", 0);
+    uint64_t offset = PACK_HEADER_SIZE;
+    uint32_t written = 0;
+    for (size_t i = 0; result == FRACTYL_OK && i < list->count; i++) {
+        repack_entry_t *entry = &list->items[i];
+        // Chunk lists are named after their assembled content, which a
+        // pack entry could not be checked against; they stay loose
+        if (entry->chunk_list) {
+            entry->skipped = 1;
+            continue;
+        }
+        int entry_result = write_pack_entry(fractyl_dir, fp, entry, &offset);
+        if (ferror(fp)) {
+            result = FRACTYL_ERROR_IO;
+        } else if (entry_result != FRACTYL_OK) {
+            // Nothing was written for it; leave the object loose
+            char hex[FRACTYL_HASH_HEX_SIZE];
+            hash_to_string(entry->hash, hex);
+            printf("Warning: Skipping unreadable or corrupt object %s\n", hex);
+            entry->skipped = 1;
+        } else {
+            written++;
+        }
+    }
+    
+    // The count is only known now
+    if (result == FRACTYL_OK && (fflush(fp) != 0 || fseek(fp, 0, SEEK_SET) != 0 ||
+                                 write_pack_header(fp, "FPAK", written) != FRACTYL_OK)) {
+        result = FRACTYL_ERROR_IO;
+    }
+    if (finish_temp_file(fp) != FRACTYL_OK) result = FRACTYL_ERROR_IO;
+    
+    char name[FRACTYL_HASH_HEX_SIZE];
+    if (result == FRACTYL_OK && written > 0) {
+        result = pack_name(list->items, list->count, written, name);
+    }
+    if (result != FRACTYL_OK || written == 0) {
+        unlink(tmp_pack);
+        *written_out = 0;
+        return result;
+    }
+    
+    char final_pack[2048], final_idx[2048];
+    snprintf(final_pack, sizeof(final_pack), "%s/pack-%s.pack", dir_path, name);
+    snprintf(final_idx, sizeof(final_idx), "%s/pack-%s.idx", dir_path, name);
+    snprintf(tmp_idx, sizeof(tmp_idx), "%s/tmp-idx-%s", dir_path, name);
+    
+    // The pack goes into place first: an index is never visible without it
+    result = write_pack_index(tmp_idx, list->items, list->count, written);
+    if (result == FRACTYL_OK && (rename(tmp_pack, final_pack) != 0 || rename(tmp_idx, final_idx) != 0)) {
+        result = FRACTYL_ERROR_IO;
+    }
+    if (result != FRACTYL_OK) {
+        unlink(tmp_pack);
+        unlink(tmp_idx);
+        return result;
+    }
+    
+    int dir_fd = open(dir_path, O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+    
+    snprintf(name_out, FRACTYL_HASH_HEX_SIZE, "%s", name);
+    *written_out = written;
+    return FRACTYL_OK;
+}
+
+int pack_repack(const char *fractyl_dir, int all, pack_repack_stats_t *stats) {
+    pack_repack_options_t options = { all, 0, NULL, 0, NULL, 0, 0 };
+    return pack_repack_with_options(fractyl_dir, &options, stats);
+}
+
+int pack_repack_with_options(const char *fractyl_dir, const pack_repack_options_t *options,
+                             pack_repack_stats_t *stats) {
+    if (!fractyl_dir || !options || !stats) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(stats, 0, sizeof(*stats));
+    int pruning = options->keep != NULL;
+    
+    // Objects this process has not published yet would be missed
+    int synced = object_sync(fractyl_dir);
+    if (synced != FRACTYL_OK) return synced;
+    int all = options->all || pruning;
+    
+    repack_list_t list = {0}, redundant = {0};
+    char **old_packs = NULL;
+    size_t old_count = 0;
+    
+    // Hold the read lock throughout: packed sources are read from the mappings
+    cache_acquire(fractyl_dir, 1);
+    lock_held = 1;
+    int result = pruning ? FRACTYL_OK : collect_loose_objects(fractyl_dir, all, &list, &redundant);
+    size_t loose_count = list.count;
+    
+    if (result == FRACTYL_OK && all && pack_cache.count > 0) {
+        old_packs = calloc(pack_cache.count, sizeof(char*));
+        if (!old_packs) result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        for (size_t p = 0; result == FRACTYL_OK && p < pack_cache.count; p++) {
+            const packfile_t *pack = &pack_cache.packs[p];
+            if (pack->shared) continue;
+            if (!(old_packs[old_count++] = strdup(pack->pack_path))) {
+                result = FRACTYL_ERROR_OUT_OF_MEMORY;
+            }
+            for (uint32_t i = 0; result == FRACTYL_OK && i < pack->count; i++) {
+                const unsigned char *hash = pack->hashes + (size_t)i * FRACTYL_HASH_SIZE;
+                if (pruning && !bsearch(hash, options->keep, options->keep_count, FRACTYL_HASH_SIZE,
+                                        compare_hashes)) {
+                    stats->pruned++;
+                    continue;
+                }
+                size_t size;
+                const unsigned char *data = packfile_data(pack, i, &size);
+                repack_entry_t *item = data ? repack_list_add(&list) : NULL;
+                if (!data) continue;
+                if (!item) {
+                    result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                    break;
+                }
+                memcpy(item->hash, hash, FRACTYL_HASH_SIZE);
+                item->data = data;
+                item->size = size;
+                item->decoded = pack->version == PACK_VERSION_DECODED;
+            }
+        }
+    }
+    
+    // Sort by hash and drop duplicates; a duplicate loose copy is deleted
+    // once the surviving copy is packed
+    if (result == FRACTYL_OK && list.count > 1) {
+        qsort(list.items, list.count, sizeof(repack_entry_t), compare_repack_entries);
+        size_t kept = 0;
+        for (size_t i = 0; i < list.count && result == FRACTYL_OK; i++) {
+            repack_entry_t cur = list.items[i];
+            if (kept == 0 || memcmp(list.items[kept - 1].hash, cur.hash, FRACTYL_HASH_SIZE) != 0) {
+                list.items[kept++] = cur;
+                continue;
+            }
+    
+            // Keep the packed copy, if there is one
+            repack_entry_t *prev = &list.items[kept - 1];
+            repack_entry_t loose = cur;
+            if (!cur.loose_path) {
+                if (!prev->loose_path) continue;
+                loose = *prev;
+                *prev = cur;
+            }
+            repack_entry_t *item = repack_list_add(&redundant);
+            if (!item) {
+                free(loose.loose_path);
+                result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            *item = loose;
+        }
+        if (result == FRACTYL_OK) list.count = kept;
+    }
+    
+    int replanned = 0;
+    if (result == FRACTYL_OK) {
+        read_stored_heads(&list);
+        if (options->max_depth > 0 && options->pair_count > 0) {
+            plan_deltas(&list, options);
+        }
+        for (size_t i = 0; i < list.count && !replanned; i++) {
+            replanned = list.items[i].mode != ENTRY_KEEP;
+        }
+    }
+    
+    // Folding a single pack with no loose objects would rewrite it
+    // unchanged, unless its deltas are to change or objects were pruned
+    char name[FRACTYL_HASH_HEX_SIZE] = "";
+    size_t written = 0;
+    int rewrite = !options->dry_run && (loose_count > 0 || old_count > 1 || replanned || stats->pruned > 0);
+    if (result == FRACTYL_OK && list.count > 0 && rewrite) {
+        char dir_path[2048];
+        pack_dir_path(fractyl_dir, dir_path, sizeof(dir_path));
+        result = write_new_pack(fractyl_dir, dir_path, &list, name, &written);
+    }
+    lock_held = 0;
+    pthread_rwlock_unlock(&pack_lock);
+    
+    if (result == FRACTYL_OK && !options->dry_run) {
+        stats->objects = written;
+        for (size_t i = 0; written > 0 && i < list.count; i++) {
+            if (list.items[i].wrote_delta && !list.items[i].skipped) stats->deltas++;
+        }
+    
+        // Old packs go once everything they kept is in the new one
+        int replaced = written > 0 || (pruning && list.count == 0);
+        for (size_t i = 0; rewrite && replaced && i < old_count; i++) {
+            char idx_path[2048];
+            size_t len = strlen(old_packs[i]);
+            snprintf(idx_path, sizeof(idx_path), "%.*s.idx", (int)(len - 5), old_packs[i]);
+            if (name[0] && strstr(old_packs[i], name)) continue;  // Same objects, same pack
+            if (unlink(idx_path) == 0 && unlink(old_packs[i]) == 0) stats->packs_removed++;
+        }
+    
+        for (size_t i = 0; i < list.count; i++) {
+            if (list.items[i].loose_path && !list.items[i].skipped && written > 0) {
+                stats->loose_packed++;
+                if (unlink(list.items[i].loose_path) == 0) stats->loose_removed++;
+            }
+        }
+        for (size_t i = 0; i < redundant.count; i++) {
+            if (unlink(redundant.items[i].loose_path) == 0) stats->loose_removed++;
+        }
+    
+        // Drop fanout directories left empty
+        if (stats->loose_removed > 0) {
+            loose_cache_invalidate();
+            char objects_dir[2048];
+            snprintf(objects_dir, sizeof(objects_dir), "%s/objects", fractyl_dir);
+            for (int b = 0; b < 256; b++) {
+                char sub_path[2048];
+                snprintf(sub_path, sizeof(sub_path), "%s/%02x", objects_dir, b);
+                rmdir(sub_path);
+            }
+        }
+    }
+    
+    for (size_t i = 0; i < old_count; i++) {
+        free(old_packs[i]);
+    }
+    free(old_packs);
+    free_repack_list(&list);
+    free_repack_list(&redundant);
+    pack_cache_invalidate();
+    return result;
+}
+
+int pack_write_objects(const char *fractyl_dir, const unsigned char *hashes, size_t count, const char *dest_dir,
+                       char *name_out, size_t *written_out, unsigned char **left_out, size_t *left_count) {
+    if (!fractyl_dir || (!hashes && count > 0) || !dest_dir || !name_out || !written_out || !left_out ||
+        !left_count) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    *written_out = 0;
+    *left_out = NULL;
+    *left_count = 0;
+    name_out[0] = '\0';
+    
+    repack_list_t list = {0};
+    int result = FRACTYL_OK;
+    cache_acquire(fractyl_dir, 1);
+    lock_held = 1;
+    for (size_t i = 0; result == FRACTYL_OK && i < count; i++) {
+        const unsigned char *hash = hashes + i * FRACTYL_HASH_SIZE;
+        repack_entry_t *item = repack_list_add(&list);
+        if (!item) {
+            result = FRACTYL_ERROR_OUT_OF_MEMORY;
+            break;
+        }
+        memcpy(item->hash, hash, FRACTYL_HASH_SIZE);
+    
+        // The packed copy is read in place; a loose one is the fallback
+        long pos;
+        const packfile_t *pack = cache_find(hash, &pos);
+        size_t size = 0;
+        const unsigned char *data = pack ? packfile_data(pack, pos, &size) : NULL;
+        if (data) {
+            item->data = data;
+            item->size = size;
+            item->decoded = pack->version == PACK_VERSION_DECODED;
+        } else if (!(item->loose_path = object_path(hash, fractyl_dir))) {
+            result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    
+    if (result == FRACTYL_OK && list.count > 1) {
+        qsort(list.items, list.count, sizeof(repack_entry_t), compare_repack_entries);
+    }
+    if (result == FRACTYL_OK && list.count > 0) {
+        read_stored_heads(&list);
+        result = write_new_pack(fractyl_dir, dest_dir, &list, name_out, written_out);
+    }
+    lock_held = 0;
+    pthread_rwlock_unlock(&pack_lock);
+    
+    // Chunk lists and whatever could not be read are left to the caller
+    size_t left = 0;
+    for (size_t i = 0; result == FRACTYL_OK && i < list.count; i++) {
+        if (list.items[i].skipped || *written_out == 0) left++;
+    }
+    if (result == FRACTYL_OK && left > 0) {
+        *left_out = malloc(left * FRACTYL_HASH_SIZE);
+        if (!*left_out) result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        for (size_t i = 0; result == FRACTYL_OK && i < list.count; i++) {
+            if (!list.items[i].skipped && *written_out > 0) continue;
+            memcpy(*left_out + *left_count * FRACTYL_HASH_SIZE, list.items[i].hash, FRACTYL_HASH_SIZE);
+            (*left_count)++;
+        }
+    }
+    free_repack_list(&list);
+    return result;
+}
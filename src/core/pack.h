@@ -0,0 +1,120 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include "../include/fractyl.h"
+#include "hash.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Packfiles keep many objects in one file under .fractyl/objects/pack/.
+//
+// pack-<name>.pack: "FPAK", u32 version, u32 count, u32 hash algorithm
+//                   of the object names (see hash.h), then per
+//                   object its 32-byte hash, u64 size and the stored object,
+//                   exactly as a loose file would hold it (see compress.h).
+//                   Version 1 packs hold decoded content instead.
+// pack-<name>.idx:  "FPIX", u32 version, u32 count, u32 hash algorithm,
+//                   u32 fanout[256] (objects whose first hash byte is <= i),
+//                   the sorted hashes, then u64 content offsets and u64
+//                   sizes in the same order. The index is read through mmap.
+//
+// <name> is the hex hash of the pack's sorted object hashes. A pack is only
+// used once its .idx exists, and packs are never modified after that.
+// Packs written under another hash algorithm are not opened.
+// The packs of a repository's shared stores (alternates.h) are listed
+// after its own; repacking only ever rewrites its own.
+
+#define PACK_VERSION 2
+#define PACK_HEADER_SIZE 16
+
+typedef struct {
+    size_t loose_packed;      // Loose objects written into the new pack
+    size_t loose_removed;     // Loose files deleted (packed now or before)
+    size_t packs_removed;     // Old packs folded into the new one
+    size_t objects;           // Objects in the new pack
+    size_t deltas;            // Of those, stored as deltas
+    size_t pruned;            // Packed objects dropped as not in keep
+} pack_repack_stats_t;
+
+// Two versions of one path: target may be stored as a delta against base
+typedef struct {
+    unsigned char target[FRACTYL_HASH_SIZE];
+    unsigned char base[FRACTYL_HASH_SIZE];
+} pack_delta_pair_t;
+
+typedef struct {
+    int all;                          // Fold the existing packs in too
+    int max_depth;                    // Longest chain of delta bases; 0 writes no deltas
+    const pack_delta_pair_t *pairs;   // Candidates, most preferred first
+    size_t pair_count;
+    // When non-NULL, the packs are folded together keeping only these
+    // objects (sorted hashes, FRACTYL_HASH_SIZE bytes each) and loose
+    // objects are left alone. Deltas must not lose their bases.
+    const unsigned char *keep;
+    size_t keep_count;
+    int dry_run;                      // Only fill in the stats
+} pack_repack_options_t;
+
+// Nonzero if a pack holds the object. With rescan set, a miss first looks
+// for packs written since this process last listed the pack directory.
+int pack_has_object(const char *fractyl_dir, const unsigned char *hash, int rescan);
+
+// Copy a packed object's stored form into a new buffer (caller frees);
+// object_decode_stored() turns it into content
+// Returns FRACTYL_OK, FRACTYL_ERROR_NOT_FOUND or an allocation error
+int pack_load_object(const char *fractyl_dir, const unsigned char *hash,
+                     void **data_out, size_t *size_out);
+
+// Copy up to size bytes from the start of a packed object's stored form,
+// enough to read its header without copying the whole object
+// Returns FRACTYL_OK or FRACTYL_ERROR_NOT_FOUND
+int pack_read_object_head(const char *fractyl_dir, const unsigned char *hash,
+                          void *buffer, size_t size, size_t *read_out);
+
+// Where a packed object is stored, to order many reads by: the pack's
+// number in this process's pack list and the object's offset in it
+// Returns FRACTYL_OK or FRACTYL_ERROR_NOT_FOUND
+int pack_locate_object(const char *fractyl_dir, const unsigned char *hash,
+                       uint32_t *pack_out, uint64_t *offset_out);
+
+// Open the pack holding an object to read its stored form in place, at
+// *offset_out for *size_out bytes (caller closes *fd_out). *decoded_out is
+// set for version 1 packs, whose entries are content without a header.
+// Returns FRACTYL_OK, FRACTYL_ERROR_NOT_FOUND or FRACTYL_ERROR_IO
+int pack_open_object(const char *fractyl_dir, const unsigned char *hash, int *fd_out,
+                     uint64_t *offset_out, size_t *size_out, int *decoded_out);
+
+// Have the kernel start reading a packed object's bytes; nonzero if the
+// object is packed
+int pack_prefetch_object(const char *fractyl_dir, const unsigned char *hash);
+
+// Move every loose object into a new pack and delete the loose copies.
+// With all set, the existing packs are folded into the new pack too.
+int pack_repack(const char *fractyl_dir, int all, pack_repack_stats_t *stats);
+
+// pack_repack() that may also store objects of the new pack as deltas,
+// choosing bases among options->pairs
+int pack_repack_with_options(const char *fractyl_dir, const pack_repack_options_t *options,
+                             pack_repack_stats_t *stats);
+
+// Write objects of fractyl_dir (FRACTYL_HASH_SIZE bytes each, no
+// duplicates) into a new pack in dest_dir, as pack-<name>.pack and .idx;
+// name_out (FRACTYL_HASH_HEX_SIZE bytes) receives <name>, empty when
+// nothing was written. Objects keep their stored form, so the bases of
+// deltas must be there too. Chunk lists, which stay loose, and objects that
+// could not be read are not written: *left_out (caller frees) lists them.
+int pack_write_objects(const char *fractyl_dir, const unsigned char *hashes, size_t count, const char *dest_dir,
+                       char *name_out, size_t *written_out, unsigned char **left_out, size_t *left_count);
+
+// Forget the cached pack list, e.g. after packs were added or removed
+void pack_cache_invalidate(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PACK_H
@@ -0,0 +1,1072 @@
+#include "remote.h"
+#include "hash.h"
+#include "index.h"
+#include "objects.h"
+#include "pack.h"
+#include "tree.h"
+#include "../utils/catalog.h"
+#include "../utils/config.h"
+#include "../utils/lock.h"
+#include "../utils/paths.h"
+#include "../utils/snapshot_record.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define DEFAULT_SERVE_COMMAND "frac remote-serve"
+// Files read back from a remote (CURRENT) are small
+#define REMOTE_MAX_READ (64 * 1024)
+#define LOCK_TIMEOUT 30
+
+struct remote {
+    char *path;                 // The store's directory, here or on the SSH host
+    fractyl_lock_t lock;        // Directory remotes: held while open
+    int locked;
+    pid_t pid;                  // SSH: the transport, 0 for a directory
+    FILE *to;
+    FILE *from;
+};
+
+static void set_message(char *message, size_t size, const char *format, ...) {
+    if (!message || size == 0) return;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, size, format, args);
+    va_end(args);
+}
+
+// --- Hash sets and lists ---
+
+// Open addressing on the leading bytes of the hashes, which are uniform.
+// The zero hash marks an empty slot; it never names an object to send.
+typedef struct {
+    unsigned char *slots;
+    size_t capacity;            // Power of two
+    size_t count;
+} hash_set_t;
+
+static size_t set_slot(const hash_set_t *set, const unsigned char *hash) {
+    uint64_t key;
+    memcpy(&key, hash, sizeof(key));
+    size_t i = (size_t)key & (set->capacity - 1);
+    while (!hash_is_zero(set->slots + i * FRACTYL_HASH_SIZE) &&
+           memcmp(set->slots + i * FRACTYL_HASH_SIZE, hash, FRACTYL_HASH_SIZE) != 0) {
+        i = (i + 1) & (set->capacity - 1);
+    }
+    return i;
+}
+
+static int set_contains(const hash_set_t *set, const unsigned char *hash) {
+    if (set->capacity == 0) return 0;
+    return !hash_is_zero(set->slots + set_slot(set, hash) * FRACTYL_HASH_SIZE);
+}
+
+// Returns 1 if hash was added, 0 if it was there, or an error
+static int set_add(hash_set_t *set, const unsigned char *hash) {
+    if (hash_is_zero(hash)) return 0;
+    if ((set->count + 1) * 2 > set->capacity) {
+        hash_set_t grown = { NULL, set->capacity ? set->capacity * 2 : 1024, 0 };
+        grown.slots = calloc(grown.capacity, FRACTYL_HASH_SIZE);
+        if (!grown.slots) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        for (size_t i = 0; i < set->capacity; i++) {
+            const unsigned char *old = set->slots + i * FRACTYL_HASH_SIZE;
+            if (hash_is_zero(old)) continue;
+            memcpy(grown.slots + set_slot(&grown, old) * FRACTYL_HASH_SIZE, old, FRACTYL_HASH_SIZE);
+            grown.count++;
+        }
+        free(set->slots);
+        *set = grown;
+    }
+    unsigned char *slot = set->slots + set_slot(set, hash) * FRACTYL_HASH_SIZE;
+    if (!hash_is_zero(slot)) return 0;
+    memcpy(slot, hash, FRACTYL_HASH_SIZE);
+    set->count++;
+    return 1;
+}
+
+typedef struct {
+    unsigned char *items;
+    size_t count;
+    size_t capacity;
+} hash_vec_t;
+
+static int vec_add(hash_vec_t *vec, const unsigned char *hash) {
+    if (vec->count == vec->capacity) {
+        size_t capacity = vec->capacity ? vec->capacity * 2 : 256;
+        unsigned char *items = realloc(vec->items, capacity * FRACTYL_HASH_SIZE);
+        if (!items) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        vec->items = items;
+        vec->capacity = capacity;
+    }
+    memcpy(vec->items + vec->count++ * FRACTYL_HASH_SIZE, hash, FRACTYL_HASH_SIZE);
+    return FRACTYL_OK;
+}
+
+typedef struct {
+    char **items;
+    size_t count;
+    size_t capacity;
+} name_list_t;
+
+static int names_add(name_list_t *list, const char *name) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        char **items = realloc(list->items, capacity * sizeof(char *));
+        if (!items) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        list->items = items;
+        list->capacity = capacity;
+    }
+    if (!(list->items[list->count] = strdup(name))) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    list->count++;
+    return FRACTYL_OK;
+}
+
+static void names_free(name_list_t *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->items[i]);
+    }
+    free(list->items);
+    memset(list, 0, sizeof(*list));
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// The list is sorted
+static int names_contain(const name_list_t *list, const char *name) {
+    return list->count > 0 && bsearch(&name, list->items, list->count, sizeof(char *), compare_names) != NULL;
+}
+
+// --- The store ---
+
+// What a remote may be asked to write: files of the store, by paths that
+// stay inside it and name no temporary file
+static int valid_store_path(const char *rel) {
+    static const char *const roots[] = { "objects/", "dicts/", "refs/heads/", "snapshots/" };
+    int under_root = strcmp(rel, "CURRENT") == 0;
+    for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+        if (strncmp(rel, roots[i], strlen(roots[i])) == 0) under_root = 1;
+    }
+    if (!under_root || strlen(rel) >= 1024) return 0;
+    
+    // Every component is a plain name
+    for (const char *p = rel; *p; ) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 0 || p[0] == '.') return 0;
+        if (!end) break;
+        p = end + 1;
+        if (!*p) return 0;
+    }
+    return strchr(rel, '\n') == NULL;
+}
+
+// Create the store at path if needed and check it names objects as we do
+static int store_open(const char *path, const char *algorithm, fractyl_lock_t *lock, char *message,
+                      size_t message_size) {
+    char pack_dir[2048];
+    snprintf(pack_dir, sizeof(pack_dir), "%s/objects/pack", path);
+    if (paths_ensure_directory(pack_dir) != 0) {
+        set_message(message, message_size, "cannot create %s", pack_dir);
+        return FRACTYL_ERROR_IO;
+    }
+    if (fractyl_lock_wait_acquire(path, lock, LOCK_TIMEOUT) != 0) {
+        set_message(message, message_size, "%s is locked by another push", path);
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    
+    char name[32];
+    int result = FRACTYL_OK;
+    if (config_get(path, "objects.hash", name, sizeof(name)) == FRACTYL_OK) {
+        if (strcmp(name, algorithm) != 0) {
+            set_message(message, message_size, "%s names objects by %s, not %s", path, name, algorithm);
+            result = FRACTYL_ERROR_INVALID_STATE;
+        }
+    } else if (config_set(path, "objects.hash", algorithm) != FRACTYL_OK) {
+        set_message(message, message_size, "cannot write %s/config", path);
+        result = FRACTYL_ERROR_IO;
+    }
+    if (result != FRACTYL_OK) fractyl_lock_release(lock);
+    return result;
+}
+
+static int is_hex(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!((s[i] >= '0' && s[i] <= '9') || (s[i] >= 'a' && s[i] <= 'f'))) return 0;
+    }
+    return s[len] == '\0';
+}
+
+// Add the hashes of one pack index, if its pack is there
+static int list_pack_index(const char *idx_path, hash_vec_t *objects) {
+    char pack_path[2048];
+    size_t len = strlen(idx_path);
+    snprintf(pack_path, sizeof(pack_path), "%.*s.pack", (int)(len - 4), idx_path);
+    if (access(pack_path, F_OK) != 0) return FRACTYL_OK;
+    
+    FILE *fp = fopen(idx_path, "rb");
+    if (!fp) return FRACTYL_OK;
+    uint32_t header[4];
+    int result = FRACTYL_OK;
+    if (fread(header, sizeof(header), 1, fp) == 1 && memcmp(header, "FPIX", 4) == 0 &&
+        fseek(fp, 256 * sizeof(uint32_t), SEEK_CUR) == 0) {
+        unsigned char hash[FRACTYL_HASH_SIZE];
+        for (uint32_t i = 0; i < header[2] && result == FRACTYL_OK; i++) {
+            if (fread(hash, 1, sizeof(hash), fp) != sizeof(hash)) break;
+            result = vec_add(objects, hash);
+        }
+    }
+    fclose(fp);
+    return result;
+}
+
+static int list_objects(const char *path, hash_vec_t *objects) {
+    char dir_path[2048];
+    snprintf(dir_path, sizeof(dir_path), "%s/objects/pack", path);
+    DIR *d = opendir(dir_path);
+    struct dirent *entry;
+    int result = FRACTYL_OK;
+    while (d && result == FRACTYL_OK && (entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 5 || strcmp(entry->d_name + len - 4, ".idx") != 0 || entry->d_name[0] == '.') continue;
+        char idx_path[2048];
+        snprintf(idx_path, sizeof(idx_path), "%s/%s", dir_path, entry->d_name);
+        result = list_pack_index(idx_path, objects);
+    }
+    if (d) closedir(d);
+    
+    // Loose objects: chunk lists, or what something else put there
+    snprintf(dir_path, sizeof(dir_path), "%s/objects", path);
+    d = opendir(dir_path);
+    while (d && result == FRACTYL_OK && (entry = readdir(d)) != NULL) {
+        if (!is_hex(entry->d_name, 2)) continue;
+        char sub_path[2048];
+        snprintf(sub_path, sizeof(sub_path), "%s/%s", dir_path, entry->d_name);
+        DIR *sub = opendir(sub_path);
+        struct dirent *object;
+        while (sub && result == FRACTYL_OK && (object = readdir(sub)) != NULL) {
+            if (!is_hex(object->d_name, FRACTYL_HASH_HEX_SIZE - 3)) continue;
+            char hex[FRACTYL_HASH_HEX_SIZE];
+            unsigned char hash[FRACTYL_HASH_SIZE];
+            snprintf(hex, sizeof(hex), "%s%s", entry->d_name, object->d_name);
+            if (string_to_hash(hex, hash) == FRACTYL_OK) result = vec_add(objects, hash);
+        }
+        if (sub) closedir(sub);
+    }
+    if (d) closedir(d);
+    return result;
+}
+
+// Files below rel (a directory of the store), by their paths in it
+static int list_files_under(const char *path, const char *rel, name_list_t *files) {
+    char dir_path[2048];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s", path, rel);
+    DIR *d = opendir(dir_path);
+    if (!d) return FRACTYL_OK;
+    
+    int result = FRACTYL_OK;
+    struct dirent *entry;
+    while (result == FRACTYL_OK && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char child[1024], child_path[3072];
+        snprintf(child, sizeof(child), "%s/%s", rel, entry->d_name);
+        snprintf(child_path, sizeof(child_path), "%s/%s", path, child);
+        struct stat st;
+        if (stat(child_path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            result = list_files_under(path, child, files);
+        } else if (S_ISREG(st.st_mode)) {
+            result = names_add(files, child);
+        }
+    }
+    closedir(d);
+    return result;
+}
+
+static int list_files(const char *path, name_list_t *files) {
+    int result = list_files_under(path, "snapshots", files);
+    if (result == FRACTYL_OK) result = list_files_under(path, "refs", files);
+    if (result == FRACTYL_OK) result = list_files_under(path, "dicts", files);
+    if (result == FRACTYL_OK) {
+        char current[2048];
+        snprintf(current, sizeof(current), "%s/CURRENT", path);
+        if (access(current, F_OK) == 0) result = names_add(files, "CURRENT");
+    }
+    return result;
+}
+
+static int store_read(const char *path, const char *rel, char *buffer, size_t size, size_t *read_out) {
+    char file_path[3072];
+    snprintf(file_path, sizeof(file_path), "%s/%s", path, rel);
+    FILE *fp = fopen(file_path, "rb");
+    if (!fp) return FRACTYL_ERROR_NOT_FOUND;
+    *read_out = fread(buffer, 1, size, fp);
+    int result = ferror(fp) ? FRACTYL_ERROR_IO : FRACTYL_OK;
+    fclose(fp);
+    return result;
+}
+
+static int sync_directory(const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return FRACTYL_ERROR_IO;
+    int ok = fsync(fd) == 0;
+    close(fd);
+    return ok ? FRACTYL_OK : FRACTYL_ERROR_IO;
+}
+
+// Write size bytes from in to rel under a hidden name, make them durable
+// and rename them into place
+static int store_put(const char *path, const char *rel, FILE *in, uint64_t size) {
+    char file_path[3072], temp_path[3200];
+    snprintf(file_path, sizeof(file_path), "%s/%s", path, rel);
+    char *slash = strrchr(file_path, '/');
+    *slash = '\0';
+    int result = paths_ensure_directory(file_path) == 0 ? FRACTYL_OK : FRACTYL_ERROR_IO;
+    snprintf(temp_path, sizeof(temp_path), "%s/.%s.tmp-XXXXXX", file_path, slash + 1);
+    *slash = '/';
+    
+    int fd = result == FRACTYL_OK ? mkstemp(temp_path) : -1;
+    if (fd < 0) result = FRACTYL_ERROR_IO;
+    
+    // The whole body is read even after a failed write, so the stream
+    // stays in step
+    char buffer[65536];
+    uint64_t left = size;
+    while (left > 0) {
+        size_t want = left < sizeof(buffer) ? (size_t)left : sizeof(buffer);
+        size_t got = fread(buffer, 1, want, in);
+        if (got == 0) {
+            result = FRACTYL_ERROR_IO;
+            break;
+        }
+        left -= got;
+        if (result == FRACTYL_OK && write(fd, buffer, got) != (ssize_t)got) result = FRACTYL_ERROR_IO;
+    }
+    if (fd >= 0) {
+        fchmod(fd, 0444);
+        if (result == FRACTYL_OK && fsync(fd) != 0) result = FRACTYL_ERROR_IO;
+        if (close(fd) != 0) result = FRACTYL_ERROR_IO;
+        if (result == FRACTYL_OK && rename(temp_path, file_path) != 0) result = FRACTYL_ERROR_IO;
+        if (result != FRACTYL_OK) unlink(temp_path);
+    }
+    if (result == FRACTYL_OK) {
+        *slash = '\0';
+        result = sync_directory(file_path);
+        *slash = '/';
+    }
+    return result;
+}
+
+// --- Transports ---
+
+static void shell_quote(const char *s, char *out, size_t size) {
+    size_t n = 0;
+    if (n + 1 < size) out[n++] = '\'';
+    for (; *s && n + 5 < size; s++) {
+        if (*s == '\'') {
+            memcpy(out + n, "'\\''", 4);
+            n += 4;
+        } else {
+            out[n++] = *s;
+        }
+    }
+    if (n + 1 < size) out[n++] = '\'';
+    out[n] = '\0';
+}
+
+typedef struct {
+    int ssh;
+    char host[256];             // [user@]host
+    char port[16];              // Empty for ssh's default
+    char path[2048];
+} remote_url_t;
+
+static int parse_url(const char *url, remote_url_t *parsed, char *message, size_t message_size) {
+    memset(parsed, 0, sizeof(*parsed));
+    const char *colon = strchr(url, ':');
+    const char *slash = strchr(url, '/');
+    
+    if (strncmp(url, "file://", 7) == 0) {
+        snprintf(parsed->path, sizeof(parsed->path), "%s", url + 7);
+    } else if (strncmp(url, "ssh://", 6) == 0) {
+        const char *host = url + 6;
+        const char *path = strchr(host, '/');
+        if (!path || path == host) {
+            set_message(message, message_size, "%s names no host and path", url);
+            return FRACTYL_ERROR_INVALID_ARGS;
+        }
+        size_t host_len = (size_t)(path - host);
+        const char *port = memchr(host, ':', host_len);
+        if (port) {
+            snprintf(parsed->port, sizeof(parsed->port), "%.*s", (int)(path - port - 1), port + 1);
+            host_len = (size_t)(port - host);
+        }
+        snprintf(parsed->host, sizeof(parsed->host), "%.*s", (int)host_len, host);
+        snprintf(parsed->path, sizeof(parsed->path), "%s", path);
+        parsed->ssh = 1;
+    } else if (strstr(url, "://")) {
+        set_message(message, message_size,
+                    "%s: only directories and SSH hosts are supported as remotes "
+                    "(S3 and other object stores are not)", url);
+        return FRACTYL_ERROR_INVALID_ARGS;
+    } else if (colon && colon != url && (!slash || colon < slash)) {
+        // scp-style host:path
+        snprintf(parsed->host, sizeof(parsed->host), "%.*s", (int)(colon - url), url);
+        snprintf(parsed->path, sizeof(parsed->path), "%s", colon[1] ? colon + 1 : ".");
+        parsed->ssh = 1;
+    } else {
+        snprintf(parsed->path, sizeof(parsed->path), "%s", url);
+    }
+    
+    if (!parsed->path[0] || (parsed->ssh && (!parsed->host[0] || parsed->host[0] == '-'))) {
+        set_message(message, message_size, "%s names no store", url);
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    return FRACTYL_OK;
+}
+
+int remote_url_supported(const char *url, char *message, size_t message_size) {
+    if (!url) return 0;
+    remote_url_t parsed;
+    return parse_url(url, &parsed, message, message_size) == FRACTYL_OK;
+}
+
+static int start_ssh(remote_t *remote, const remote_url_t *url, const char *serve_command) {
+    char quoted[4200], command[8192];
+    shell_quote(url->path, quoted, sizeof(quoted));
+    snprintf(command, sizeof(command), "%s %s", serve_command ? serve_command : DEFAULT_SERVE_COMMAND, quoted);
+    const char *ssh = getenv("FRACTYL_SSH");
+    if (!ssh || !*ssh) ssh = "ssh";
+    
+    int to_child[2], from_child[2];
+    if (pipe(to_child) != 0) return FRACTYL_ERROR_IO;
+    if (pipe(from_child) != 0) {
+        close(to_child[0]);
+        close(to_child[1]);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+        char *args[8];
+        int n = 0;
+        args[n++] = (char *)ssh;
+        if (url->port[0]) {
+            args[n++] = "-p";
+            args[n++] = (char *)url->port;
+        }
+        args[n++] = (char *)url->host;
+        args[n++] = command;
+        args[n] = NULL;
+        execvp(ssh, args);
+        fprintf(stderr, "Error: Cannot run %s: %s\n", ssh, strerror(errno));
+        _exit(127);
+    }
+    close(to_child[0]);
+    close(from_child[1]);
+    if (pid < 0) {
+        close(to_child[1]);
+        close(from_child[0]);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    remote->pid = pid;
+    remote->to = fdopen(to_child[1], "w");
+    remote->from = fdopen(from_child[0], "r");
+    return remote->to && remote->from ? FRACTYL_OK : FRACTYL_ERROR_IO;
+}
+
+// One reply line from the server, without its newline; an "error" reply
+// goes to message
+static int read_reply(remote_t *remote, char *line, size_t size, char *message, size_t message_size) {
+    if (fflush(remote->to) != 0 || !fgets(line, (int)size, remote->from)) {
+        set_message(message, message_size, "the remote closed the connection");
+        return FRACTYL_ERROR_IO;
+    }
+    line[strcspn(line, "\n")] = '\0';
+    if (strncmp(line, "error ", 6) == 0) {
+        set_message(message, message_size, "%s", line + 6);
+        return FRACTYL_ERROR_GENERIC;
+    }
+    return FRACTYL_OK;
+}
+
+int remote_open(const char *url, const char *serve_command, remote_t **remote_out, char *message,
+                size_t message_size) {
+    if (!url || !remote_out) return FRACTYL_ERROR_INVALID_ARGS;
+    *remote_out = NULL;
+    remote_url_t parsed;
+    int result = parse_url(url, &parsed, message, message_size);
+    if (result != FRACTYL_OK) return result;
+    
+    remote_t *remote = calloc(1, sizeof(remote_t));
+    if (!remote || !(remote->path = strdup(parsed.path))) {
+        free(remote);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    const char *algorithm = hash_algorithm_name(hash_get_algorithm());
+    if (!parsed.ssh) {
+        result = store_open(remote->path, algorithm, &remote->lock, message, message_size);
+        remote->locked = result == FRACTYL_OK;
+    } else {
+        // A dead transport must not take us down with SIGPIPE
+        signal(SIGPIPE, SIG_IGN);
+        result = start_ssh(remote, &parsed, serve_command);
+        if (result != FRACTYL_OK) {
+            set_message(message, message_size, "cannot start ssh to %s", parsed.host);
+        } else {
+            char line[512];
+            fprintf(remote->to, "hello %d %s\n", REMOTE_PROTOCOL_VERSION, algorithm);
+            result = read_reply(remote, line, sizeof(line), message, message_size);
+            if (result == FRACTYL_OK && strcmp(line, "ok") != 0) {
+                set_message(message, message_size, "unexpected greeting from %s: %s", parsed.host, line);
+                result = FRACTYL_ERROR_INVALID_STATE;
+            }
+        }
+    }
+    if (result != FRACTYL_OK) {
+        remote_close(remote);
+        return result;
+    }
+    *remote_out = remote;
+    return FRACTYL_OK;
+}
+
+void remote_close(remote_t *remote) {
+    if (!remote) return;
+    if (remote->locked) fractyl_lock_release(&remote->lock);
+    if (remote->to) {
+        fprintf(remote->to, "bye\n");
+        fclose(remote->to);
+    }
+    if (remote->from) fclose(remote->from);
+    if (remote->pid > 0) waitpid(remote->pid, NULL, 0);
+    free(remote->path);
+    free(remote);
+}
+
+static int remote_list(remote_t *remote, hash_vec_t *objects, name_list_t *files, char *message,
+                       size_t message_size) {
+    int result;
+    if (!remote->pid) {
+        result = list_objects(remote->path, objects);
+        if (result == FRACTYL_OK) result = list_files(remote->path, files);
+        if (result != FRACTYL_OK) set_message(message, message_size, "cannot list %s", remote->path);
+    } else {
+        char line[2048];
+        unsigned long long object_count, file_count;
+        fprintf(remote->to, "list\n");
+        result = read_reply(remote, line, sizeof(line), message, message_size);
+        if (result == FRACTYL_OK && sscanf(line, "%llu %llu", &object_count, &file_count) != 2) {
+            set_message(message, message_size, "unexpected reply to list: %s", line);
+            result = FRACTYL_ERROR_INVALID_STATE;
+        }
+        unsigned char hash[FRACTYL_HASH_SIZE];
+        for (unsigned long long i = 0; result == FRACTYL_OK && i < object_count; i++) {
+            if (fread(hash, 1, sizeof(hash), remote->from) != sizeof(hash)) {
+                set_message(message, message_size, "the remote closed the connection");
+                result = FRACTYL_ERROR_IO;
+            } else {
+                result = vec_add(objects, hash);
+            }
+        }
+        for (unsigned long long i = 0; result == FRACTYL_OK && i < file_count; i++) {
+            if (!fgets(line, sizeof(line), remote->from)) {
+                set_message(message, message_size, "the remote closed the connection");
+                result = FRACTYL_ERROR_IO;
+            } else {
+                line[strcspn(line, "\n")] = '\0';
+                result = names_add(files, line);
+            }
+        }
+    }
+    if (result == FRACTYL_OK && files->count > 1) {
+        qsort(files->items, files->count, sizeof(char *), compare_names);
+    }
+    return result;
+}
+
+// A small file of the remote; FRACTYL_ERROR_NOT_FOUND if it has none
+static int remote_read(remote_t *remote, const char *rel, char *buffer, size_t size, size_t *read_out,
+                       char *message, size_t message_size) {
+    if (!remote->pid) return store_read(remote->path, rel, buffer, size, read_out);
+    
+    char line[512];
+    fprintf(remote->to, "read %s\n", rel);
+    int result = read_reply(remote, line, sizeof(line), message, message_size);
+    if (result != FRACTYL_OK) return result;
+    if (strcmp(line, "missing") == 0) return FRACTYL_ERROR_NOT_FOUND;
+    
+    char *end;
+    unsigned long long length = strtoull(line, &end, 10);
+    if (*end != '\0' || length > REMOTE_MAX_READ) {
+        set_message(message, message_size, "unexpected reply to read: %s", line);
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    // Whatever does not fit is read and dropped
+    size_t kept = length < size ? (size_t)length : size;
+    if (fread(buffer, 1, kept, remote->from) != kept) return FRACTYL_ERROR_IO;
+    for (unsigned long long i = kept; i < length; i++) {
+        if (fgetc(remote->from) == EOF) return FRACTYL_ERROR_IO;
+    }
+    *read_out = kept;
+    return FRACTYL_OK;
+}
+
+// Send the local file at local_path to rel on the remote
+static int remote_put(remote_t *remote, const char *rel, const char *local_path, remote_push_stats_t *stats,
+                      char *message, size_t message_size) {
+    FILE *in = fopen(local_path, "rb");
+    struct stat st;
+    if (!in || fstat(fileno(in), &st) != 0) {
+        if (in) fclose(in);
+        set_message(message, message_size, "cannot read %s", local_path);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    int result;
+    if (!remote->pid) {
+        result = store_put(remote->path, rel, in, (uint64_t)st.st_size);
+        if (result != FRACTYL_OK) set_message(message, message_size, "cannot write %s/%s", remote->path, rel);
+    } else {
+        fprintf(remote->to, "put %llu %s\n", (unsigned long long)st.st_size, rel);
+        char buffer[65536];
+        size_t got;
+        result = FRACTYL_OK;
+        while ((got = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+            if (fwrite(buffer, 1, got, remote->to) != got) {
+                set_message(message, message_size, "the remote closed the connection");
+                result = FRACTYL_ERROR_IO;
+                break;
+            }
+        }
+        char line[512];
+        if (result == FRACTYL_OK) result = read_reply(remote, line, sizeof(line), message, message_size);
+    }
+    fclose(in);
+    if (result == FRACTYL_OK) stats->bytes += (unsigned long long)st.st_size;
+    return result;
+}
+
+// --- Serving ---
+
+int remote_serve(const char *path, FILE *in, FILE *out) {
+    if (!path || !in || !out) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    char line[2048], message[512];
+    fractyl_lock_t lock;
+    int opened = 0;
+    int result = FRACTYL_OK;
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\n")] = '\0';
+        int version;
+        char algorithm[32];
+        unsigned long long size;
+        int offset = 0;
+    
+        if (sscanf(line, "hello %d %31s", &version, algorithm) == 2) {
+            if (version != REMOTE_PROTOCOL_VERSION) {
+                fprintf(out, "error protocol version %d is not %d\n", version, REMOTE_PROTOCOL_VERSION);
+            } else if (!opened && store_open(path, algorithm, &lock, message, sizeof(message)) != FRACTYL_OK) {
+                fprintf(out, "error %s\n", message);
+            } else {
+                opened = 1;
+                fprintf(out, "ok\n");
+            }
+        } else if (!opened) {
+            fprintf(out, "error no hello\n");
+            result = FRACTYL_ERROR_INVALID_STATE;
+            break;
+        } else if (strcmp(line, "list") == 0) {
+            hash_vec_t objects = {0};
+            name_list_t files = {0};
+            if (list_objects(path, &objects) != FRACTYL_OK || list_files(path, &files) != FRACTYL_OK) {
+                fprintf(out, "error cannot list %s\n", path);
+            } else {
+                fprintf(out, "%zu %zu\n", objects.count, files.count);
+                if (objects.count > 0) fwrite(objects.items, FRACTYL_HASH_SIZE, objects.count, out);
+                for (size_t i = 0; i < files.count; i++) {
+                    fprintf(out, "%s\n", files.items[i]);
+                }
+            }
+            free(objects.items);
+            names_free(&files);
+        } else if (strncmp(line, "read ", 5) == 0) {
+            char buffer[REMOTE_MAX_READ];
+            size_t got = 0;
+            if (!valid_store_path(line + 5) ||
+                store_read(path, line + 5, buffer, sizeof(buffer), &got) != FRACTYL_OK) {
+                fprintf(out, "missing\n");
+            } else {
+                fprintf(out, "%zu\n", got);
+                fwrite(buffer, 1, got, out);
+            }
+        } else if (sscanf(line, "put %llu %n", &size, &offset) == 1 && offset > 0) {
+            const char *rel = line + offset;
+            if (!valid_store_path(rel)) {
+                // The body cannot be skipped safely without knowing it is one
+                fprintf(out, "error refusing to write %s\n", rel);
+                result = FRACTYL_ERROR_INVALID_ARGS;
+                break;
+            }
+            if (store_put(path, rel, in, size) == FRACTYL_OK) {
+                fprintf(out, "ok\n");
+            } else {
+                fprintf(out, "error cannot write %s/%s\n", path, rel);
+            }
+        } else if (strcmp(line, "bye") == 0) {
+            break;
+        } else {
+            fprintf(out, "error unknown request\n");
+        }
+        fflush(out);
+    }
+    fflush(out);
+    if (opened) fractyl_lock_release(&lock);
+    return result;
+}
+
+// --- Pushing ---
+
+typedef struct {
+    const char *fractyl_dir;
+    hash_set_t known;           // What the remote has, and what is already planned
+    hash_vec_t objects;         // To send, each after what it refers to
+    hash_vec_t chunk_lists;
+    hash_vec_t trees;
+    char *message;
+    size_t message_size;
+} push_plan_t;
+
+static int plan_missing(push_plan_t *plan, const unsigned char *hash) {
+    char hex[FRACTYL_HASH_HEX_SIZE];
+    hash_to_string(hash, hex);
+    set_message(plan->message, plan->message_size, "object %s is missing here", hex);
+    return FRACTYL_ERROR_NOT_FOUND;
+}
+
+// Plan hash and, first, everything its stored form depends on
+static int plan_object(push_plan_t *plan, const unsigned char *hash) {
+    if (hash_is_zero(hash)) return FRACTYL_OK;
+    int added = set_add(&plan->known, hash);
+    if (added <= 0) return added;
+    
+    unsigned char *refs = NULL;
+    size_t count = 0;
+    int result = object_references(plan->fractyl_dir, hash, &refs, &count);
+    if (result == FRACTYL_ERROR_NOT_FOUND) return plan_missing(plan, hash);
+    for (size_t i = 0; result == FRACTYL_OK && i < count; i++) {
+        result = plan_object(plan, refs + i * FRACTYL_HASH_SIZE);
+    }
+    free(refs);
+    if (result != FRACTYL_OK) return result;
+    
+    if (count > 0 && object_is_chunk_list(plan->fractyl_dir, hash)) return vec_add(&plan->chunk_lists, hash);
+    return vec_add(&plan->objects, hash);
+}
+
+typedef struct {
+    push_plan_t *plan;
+    hash_vec_t subtrees;
+} tree_children_t;
+
+static int plan_child(const index_entry_t *entry, void *ctx) {
+    tree_children_t *children = ctx;
+    if (S_ISDIR(entry->mode)) return vec_add(&children->subtrees, entry->hash);
+    return plan_object(children->plan, entry->hash);
+}
+
+// Plan a tree after its files and subtrees; trees the remote has hold
+// nothing it lacks
+static int plan_tree(push_plan_t *plan, const unsigned char *hash) {
+    if (hash_is_zero(hash) || set_contains(&plan->known, hash)) return FRACTYL_OK;
+    
+    tree_children_t children = { plan, {0} };
+    int result = tree_for_each_child(hash, plan->fractyl_dir, plan_child, &children);
+    for (size_t i = 0; result == FRACTYL_OK && i < children.subtrees.count; i++) {
+        result = plan_tree(plan, children.subtrees.items + i * FRACTYL_HASH_SIZE);
+    }
+    free(children.subtrees.items);
+    if (result != FRACTYL_OK) return result;
+    
+    int added = set_add(&plan->known, hash);
+    return added > 0 ? vec_add(&plan->trees, hash) : added;
+}
+
+// Plan the objects of the snapshot whose index is root
+static int plan_snapshot(push_plan_t *plan, const unsigned char *root) {
+    if (hash_is_zero(root) || set_contains(&plan->known, root)) return FRACTYL_OK;
+    if (!object_exists(root, plan->fractyl_dir)) return plan_missing(plan, root);
+    
+    void *data;
+    size_t size;
+    int result = object_load(root, plan->fractyl_dir, &data, &size);
+    if (result != FRACTYL_OK) return result;
+    int is_tree = tree_is_tree(data, size);
+    free(data);
+    if (is_tree) return plan_tree(plan, root);
+    
+    // Snapshots from before trees have a flat index object
+    index_t index;
+    result = object_load_index(root, plan->fractyl_dir, &index);
+    if (result != FRACTYL_OK) return result;
+    for (size_t i = 0; result == FRACTYL_OK && i < index.count; i++) {
+        result = plan_object(plan, index.entries[i].hash);
+    }
+    index_free(&index);
+    return result == FRACTYL_OK ? plan_object(plan, root) : result;
+}
+
+static void object_rel_path(const unsigned char *hash, char *out, size_t size) {
+    char hex[FRACTYL_HASH_HEX_SIZE];
+    hash_to_string(hash, hex);
+    snprintf(out, size, "objects/%.2s/%s", hex, hex + 2);
+}
+
+// Send objects as packs of up to pack_objects, built in staging_dir
+static int send_packs(const char *fractyl_dir, remote_t *remote, const hash_vec_t *objects, size_t pack_objects,
+                      const char *staging_dir, remote_push_stats_t *stats, char *message, size_t message_size) {
+    int result = FRACTYL_OK;
+    for (size_t start = 0; result == FRACTYL_OK && start < objects->count; start += pack_objects) {
+        size_t count = objects->count - start < pack_objects ? objects->count - start : pack_objects;
+        char name[FRACTYL_HASH_HEX_SIZE];
+        size_t written = 0;
+        unsigned char *left = NULL;
+        size_t left_count = 0;
+        result = pack_write_objects(fractyl_dir, objects->items + start * FRACTYL_HASH_SIZE, count, staging_dir,
+                                    name, &written, &left, &left_count);
+        if (result == FRACTYL_OK && left_count > 0) {
+            char hex[FRACTYL_HASH_HEX_SIZE];
+            hash_to_string(left, hex);
+            set_message(message, message_size, "object %s could not be read", hex);
+            result = FRACTYL_ERROR_IO;
+        } else if (result != FRACTYL_OK) {
+            set_message(message, message_size, "cannot write a pack in %s", staging_dir);
+        }
+        free(left);
+    
+        // The index goes last: the remote uses a pack once it has one
+        static const char *const suffixes[] = { ".pack", ".idx" };
+        for (int s = 0; s < 2; s++) {
+            char local[2048], rel[256];
+            snprintf(local, sizeof(local), "%s/pack-%s%s", staging_dir, name, suffixes[s]);
+            snprintf(rel, sizeof(rel), "objects/pack/pack-%s%s", name, suffixes[s]);
+            if (result == FRACTYL_OK && written > 0) {
+                result = remote_put(remote, rel, local, stats, message, message_size);
+            }
+            if (written > 0) unlink(local);
+        }
+        if (result == FRACTYL_OK && written > 0) {
+            stats->packs++;
+            stats->objects += written;
+        }
+    }
+    return result;
+}
+
+static int send_loose(const char *fractyl_dir, remote_t *remote, const hash_vec_t *objects,
+                      remote_push_stats_t *stats, char *message, size_t message_size) {
+    int result = FRACTYL_OK;
+    for (size_t i = 0; result == FRACTYL_OK && i < objects->count; i++) {
+        const unsigned char *hash = objects->items + i * FRACTYL_HASH_SIZE;
+        char *local = object_path(hash, fractyl_dir);
+        char rel[256];
+        object_rel_path(hash, rel, sizeof(rel));
+        result = local ? remote_put(remote, rel, local, stats, message, message_size) : FRACTYL_ERROR_OUT_OF_MEMORY;
+        free(local);
+        if (result == FRACTYL_OK) stats->objects++;
+    }
+    return result;
+}
+
+// A snapshot the remote lacks
+typedef struct {
+    char rel[1024];             // Of its file in the store
+    unsigned char root[32];
+} new_snapshot_t;
+
+typedef struct {
+    new_snapshot_t *items;
+    size_t count;
+    size_t capacity;
+} snapshot_list_t;
+
+// Add a branch's snapshots directory by its path in fractyl_dir
+static int add_snapshot_dir(const char *branch, const char *snapshots_dir, void *ctx) {
+    (void)snapshots_dir;
+    char rel[1024];
+    snprintf(rel, sizeof(rel), "refs/heads/%s/snapshots", branch);
+    return names_add(ctx, rel);
+}
+
+// The snapshots of dir (a path in fractyl_dir) whose files the remote lacks
+static int find_new_snapshots(const char *fractyl_dir, const char *dir, const name_list_t *remote_files,
+                              snapshot_list_t *list) {
+    char snapshots_dir[3072];
+    snprintf(snapshots_dir, sizeof(snapshots_dir), "%s/%s", fractyl_dir, dir);
+    catalog_t catalog;
+    int result = catalog_load(snapshots_dir, &catalog);
+    if (result != FRACTYL_OK) return result;
+    
+    for (size_t i = 0; result == FRACTYL_OK && i < catalog.count; i++) {
+        const catalog_entry_t *entry = &catalog.entries[i];
+        char snap[1200], json[1200], local[4400];
+        snprintf(snap, sizeof(snap), "%s/%s%s", dir, entry->id, SNAPSHOT_RECORD_SUFFIX);
+        snprintf(json, sizeof(json), "%s/%s.json", dir, entry->id);
+        if (names_contain(remote_files, snap) || names_contain(remote_files, json)) continue;
+    
+        if (list->count == list->capacity) {
+            size_t capacity = list->capacity ? list->capacity * 2 : 64;
+            new_snapshot_t *items = realloc(list->items, capacity * sizeof(new_snapshot_t));
+            if (!items) {
+                result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            list->items = items;
+            list->capacity = capacity;
+        }
+        // Snapshots stored before records existed are sent as they are
+        new_snapshot_t *item = &list->items[list->count++];
+        snprintf(local, sizeof(local), "%s/%s", fractyl_dir, snap);
+        snprintf(item->rel, sizeof(item->rel), "%s", access(local, F_OK) == 0 ? snap : json);
+        memcpy(item->root, entry->index_hash, sizeof(item->root));
+    }
+    catalog_free(&catalog);
+    return result;
+}
+
+static int send_dictionaries(const char *fractyl_dir, remote_t *remote, const name_list_t *remote_files,
+                             remote_push_stats_t *stats, char *message, size_t message_size) {
+    name_list_t dicts = {0};
+    int result = list_files_under(fractyl_dir, "dicts", &dicts);
+    for (size_t i = 0; result == FRACTYL_OK && i < dicts.count; i++) {
+        size_t len = strlen(dicts.items[i]);
+        if (len < 5 || strcmp(dicts.items[i] + len - 5, ".dict") != 0) continue;
+        if (names_contain(remote_files, dicts.items[i])) continue;
+        char local[3072];
+        snprintf(local, sizeof(local), "%s/%s", fractyl_dir, dicts.items[i]);
+        result = remote_put(remote, dicts.items[i], local, stats, message, message_size);
+        if (result == FRACTYL_OK) stats->dictionaries++;
+    }
+    names_free(&dicts);
+    return result;
+}
+
+// Move each branch's CURRENT on the remote where it is here
+static int send_current(const char *fractyl_dir, remote_t *remote, const name_list_t *dirs,
+                        remote_push_stats_t *stats, char *message, size_t message_size) {
+    int result = FRACTYL_OK;
+    for (size_t i = 0; result == FRACTYL_OK && i < dirs->count; i++) {
+        char rel[1100], local_path[4200];
+        size_t len = strlen(dirs->items[i]) - strlen("snapshots");
+        snprintf(rel, sizeof(rel), "%.*sCURRENT", (int)len, dirs->items[i]);
+        snprintf(local_path, sizeof(local_path), "%s/%s", fractyl_dir, rel);
+    
+        char here[256], there[256];
+        size_t here_size = 0, there_size = 0;
+        if (store_read(fractyl_dir, rel, here, sizeof(here), &here_size) != FRACTYL_OK || here_size == 0) continue;
+        int found = remote_read(remote, rel, there, sizeof(there), &there_size, message, message_size);
+        if (found != FRACTYL_OK && found != FRACTYL_ERROR_NOT_FOUND) return found;
+        if (found == FRACTYL_OK && there_size == here_size && memcmp(here, there, here_size) == 0) continue;
+    
+        result = remote_put(remote, rel, local_path, stats, message, message_size);
+        if (result == FRACTYL_OK) stats->branches++;
+    }
+    return result;
+}
+
+int remote_push(const char *fractyl_dir, remote_t *remote, size_t pack_objects, remote_push_stats_t *stats,
+                char *message, size_t message_size) {
+    if (!fractyl_dir || !remote || !stats) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(stats, 0, sizeof(*stats));
+    if (pack_objects == 0) pack_objects = REMOTE_DEFAULT_PACK_OBJECTS;
+    
+    // Have: what the remote lists
+    push_plan_t plan;
+    memset(&plan, 0, sizeof(plan));
+    plan.fractyl_dir = fractyl_dir;
+    plan.message = message;
+    plan.message_size = message_size;
+    hash_vec_t remote_objects = {0};
+    name_list_t remote_files = {0}, dirs = {0};
+    snapshot_list_t snapshots = {0};
+    int result = remote_list(remote, &remote_objects, &remote_files, message, message_size);
+    for (size_t i = 0; result == FRACTYL_OK && i < remote_objects.count; i++) {
+        int added = set_add(&plan.known, remote_objects.items + i * FRACTYL_HASH_SIZE);
+        if (added < 0) result = added;
+    }
+    stats->remote_objects = plan.known.count;
+    free(remote_objects.items);
+    
+    // Want: the objects of the snapshots it lacks
+    if (result == FRACTYL_OK) result = names_add(&dirs, "snapshots");
+    if (result == FRACTYL_OK) result = paths_for_each_branch(fractyl_dir, add_snapshot_dir, &dirs);
+    for (size_t i = 0; result == FRACTYL_OK && i < dirs.count; i++) {
+        result = find_new_snapshots(fractyl_dir, dirs.items[i], &remote_files, &snapshots);
+        if (result != FRACTYL_OK) set_message(message, message_size, "cannot read the snapshots in %s", dirs.items[i]);
+    }
+    for (size_t i = 0; result == FRACTYL_OK && i < snapshots.count; i++) {
+        result = plan_snapshot(&plan, snapshots.items[i].root);
+    }
+    
+    // Everything goes before what refers to it: files, chunks and delta
+    // bases, then chunk lists, then trees
+    char staging_dir[2048];
+    snprintf(staging_dir, sizeof(staging_dir), "%s/push-XXXXXX", fractyl_dir);
+    int staged = 0;
+    if (result == FRACTYL_OK && plan.objects.count + plan.trees.count > 0) {
+        staged = mkdtemp(staging_dir) != NULL;
+        if (!staged) {
+            set_message(message, message_size, "cannot create %s", staging_dir);
+            result = FRACTYL_ERROR_IO;
+        }
+    }
+    if (result == FRACTYL_OK) {
+        result = send_packs(fractyl_dir, remote, &plan.objects, pack_objects, staging_dir, stats, message,
+                            message_size);
+    }
+    if (result == FRACTYL_OK) result = send_loose(fractyl_dir, remote, &plan.chunk_lists, stats, message, message_size);
+    if (result == FRACTYL_OK) {
+        result = send_packs(fractyl_dir, remote, &plan.trees, pack_objects, staging_dir, stats, message,
+                            message_size);
+    }
+    if (staged) rmdir(staging_dir);
+    
+    // Then what names the objects
+    if (result == FRACTYL_OK) {
+        result = send_dictionaries(fractyl_dir, remote, &remote_files, stats, message, message_size);
+    }
+    for (size_t i = 0; result == FRACTYL_OK && i < snapshots.count; i++) {
+        char local[4200];
+        snprintf(local, sizeof(local), "%s/%s", fractyl_dir, snapshots.items[i].rel);
+        result = remote_put(remote, snapshots.items[i].rel, local, stats, message, message_size);
+        if (result == FRACTYL_OK) stats->snapshots++;
+    }
+    if (result == FRACTYL_OK) result = send_current(fractyl_dir, remote, &dirs, stats, message, message_size);
+    
+    free(plan.known.slots);
+    free(plan.objects.items);
+    free(plan.chunk_lists.items);
+    free(plan.trees.items);
+    free(snapshots.items);
+    names_free(&remote_files);
+    names_free(&dirs);
+    return result;
+}
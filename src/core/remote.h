@@ -0,0 +1,75 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include "../include/fractyl.h"
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Remotes: other stores a repository's snapshots are pushed to, for copies
+// off the host. A remote has the layout of a .fractyl directory without a
+// working tree (config with its objects.hash, objects/, dicts/, and the
+// snapshots and CURRENT file of every branch), so copying it into a new
+// directory's .fractyl gives a repository to restore from.
+//
+// A push negotiates before it sends anything: the remote lists the objects
+// it has, from the hashes in its pack indexes and the names of its loose
+// objects, and its files under snapshots/, refs/ and dicts/. Only what it
+// lacks goes over: the objects of snapshots it does not have, batched into
+// packs of up to push.pack_objects objects, then chunk lists as loose
+// objects, then trees in packs; dictionaries; the snapshot records; and
+// last the CURRENT files that moved. Every object is sent after what it
+// refers to, so a push that is cut short leaves nothing a later push would
+// take for complete, and subtrees the remote has are not walked. Pushes
+// only add: snapshots deleted here stay on the remote.
+//
+// URLs are a directory (a path or file://path), ssh://[user@]host[:port]/path
+// or [user@]host:path. Over SSH the requests go as lines and byte counts to
+// `frac remote-serve <path>` on the host (remote.<name>.serve_command runs
+// something else); $FRACTYL_SSH names the ssh program. The remote's
+// fractyl.lock is held exclusively for the whole push.
+
+#define REMOTE_DEFAULT_PACK_OBJECTS 50000
+#define REMOTE_PROTOCOL_VERSION 1
+
+typedef struct remote remote_t;
+
+typedef struct {
+    size_t remote_objects;          // Objects the remote had
+    size_t snapshots;               // Snapshot records sent
+    size_t objects;                 // Objects sent, packed or loose
+    size_t packs;
+    size_t dictionaries;
+    size_t branches;                // CURRENT files moved
+    unsigned long long bytes;       // Everything sent
+} remote_push_stats_t;
+
+// Whether url names a remote this build can reach; message receives why
+// not. S3 and other object stores are not among them.
+int remote_url_supported(const char *url, char *message, size_t message_size);
+
+// Connect to url, creating the store if it does not exist, and lock it.
+// serve_command is what runs on an SSH host (NULL: "frac remote-serve").
+// message receives what went wrong.
+int remote_open(const char *url, const char *serve_command, remote_t **remote_out, char *message,
+                size_t message_size);
+void remote_close(remote_t *remote);
+
+// Send remote every snapshot of fractyl_dir it lacks, with their objects.
+// The caller holds fractyl_dir's lock shared. pack_objects is the largest
+// pack sent (0: REMOTE_DEFAULT_PACK_OBJECTS).
+int remote_push(const char *fractyl_dir, remote_t *remote, size_t pack_objects, remote_push_stats_t *stats,
+                char *message, size_t message_size);
+
+// Serve the requests of a push over in and out for the store at path
+// (frac remote-serve). Returns once the client is done or gone.
+int remote_serve(const char *path, FILE *in, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REMOTE_H
@@ -0,0 +1,416 @@
+#include "rename.h"
+#include "objects.h"
+#include "../include/fractyl.h"
+#include "../utils/config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define RENAME_MAX_THREADS 16
+// Sketch positions, and how they are cut into bands for bucketing: two
+// files half the same all but surely share a band
+#define SKETCH_SIZE 64
+#define SKETCH_BANDS 32
+#define SKETCH_ROWS (SKETCH_SIZE / SKETCH_BANDS)
+// Lines longer than this are cut, so binary files have chunks too
+#define SKETCH_MAX_CHUNK 64
+#define SKETCH_READ_SIZE (64 * 1024)
+
+typedef struct {
+    uint32_t min[SKETCH_SIZE];
+    int valid;
+} sketch_t;
+
+typedef struct {
+    const index_entry_t **entries;
+    sketch_t *sketches;
+    size_t count;
+    size_t next;
+    const char *fractyl_dir;
+    size_t first_target;        // Entries from here on are targets
+    const char *target_root;
+} sketch_job_t;
+
+typedef struct {
+    uint64_t key;
+    size_t source;
+} band_entry_t;
+
+typedef struct {
+    size_t target;
+    size_t source;
+    int similarity;
+    int kept;
+} match_t;
+
+static uint64_t mix64(uint64_t z) {
+    z ^= z >> 30;
+    z *= 0xbf58476d1ce4e5b9ULL;
+    z ^= z >> 27;
+    z *= 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t hash_key(const unsigned char *hash) {
+    uint64_t key;
+    memcpy(&key, hash, sizeof(key));
+    return key;
+}
+
+static const char* base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void sketch_add_chunk(sketch_t *sketch, uint64_t chunk) {
+    for (int i = 0; i < SKETCH_SIZE; i++) {
+        uint32_t value = (uint32_t)(mix64(chunk + (uint64_t)(i + 1) * 0x9e3779b97f4a7c15ULL) >> 32);
+        if (value < sketch->min[i]) sketch->min[i] = value;
+    }
+}
+
+// MinHash of the content's lines, read from the file under root if there
+// is one; invalid if it cannot be read
+static void sketch_entry(const index_entry_t *entry, const char *fractyl_dir, const char *root,
+                         sketch_t *sketch) {
+    memset(sketch->min, 0xff, sizeof(sketch->min));
+    sketch->valid = 0;
+    
+    object_reader_t *reader;
+    if (root) {
+        char path[PATH_MAX];
+        int len = snprintf(path, sizeof(path), "%s/%s", root, entry->path);
+        if (len < 0 || (size_t)len >= sizeof(path) || object_reader_open_file(path, &reader) != FRACTYL_OK) {
+            return;
+        }
+    } else if (object_reader_open(entry->hash, fractyl_dir, &reader) != FRACTYL_OK) {
+        return;
+    }
+    unsigned char *buffer = malloc(SKETCH_READ_SIZE);
+    if (!buffer) {
+        object_reader_close(reader);
+        return;
+    }
+    
+    // FNV-1a over each chunk
+    uint64_t chunk = 0xcbf29ce484222325ULL;
+    size_t chunk_len = 0;
+    ssize_t n;
+    while ((n = object_reader_read(reader, buffer, SKETCH_READ_SIZE)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            chunk = (chunk ^ buffer[i]) * 0x100000001b3ULL;
+            if (buffer[i] == '\n' || ++chunk_len == SKETCH_MAX_CHUNK) {
+                sketch_add_chunk(sketch, chunk);
+                chunk = 0xcbf29ce484222325ULL;
+                chunk_len = 0;
+            }
+        }
+    }
+    if (n == 0) {
+        if (chunk_len > 0) sketch_add_chunk(sketch, chunk);
+        sketch->valid = 1;
+    }
+    free(buffer);
+    object_reader_close(reader);
+}
+
+static void* sketch_worker(void *arg) {
+    sketch_job_t *job = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->count) break;
+        sketch_entry(job->entries[i], job->fractyl_dir, i >= job->first_target ? job->target_root : NULL,
+                     &job->sketches[i]);
+    }
+    return NULL;
+}
+
+// Sketch entries on up to RENAME_MAX_THREADS threads, the calling one included
+static void sketch_all(sketch_job_t *job) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus < 1 ? 1 : (size_t)cpus;
+    if (threads > RENAME_MAX_THREADS) threads = RENAME_MAX_THREADS;
+    if (threads > job->count) threads = job->count;
+    
+    pthread_t tids[RENAME_MAX_THREADS];
+    size_t started = 0;
+    for (size_t t = 1; t < threads; t++) {
+        if (pthread_create(&tids[started], NULL, sketch_worker, job) != 0) break;
+        started++;
+    }
+    sketch_worker(job);
+    for (size_t t = 0; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+}
+
+static uint64_t band_key(const sketch_t *sketch, int band) {
+    uint64_t key = (uint64_t)band;
+    for (int r = 0; r < SKETCH_ROWS; r++) {
+        key = mix64(key ^ sketch->min[band * SKETCH_ROWS + r]);
+    }
+    return key;
+}
+
+static int compare_band_entries(const void *a, const void *b) {
+    const band_entry_t *ea = a, *eb = b;
+    if (ea->key != eb->key) return ea->key < eb->key ? -1 : 1;
+    return ea->source < eb->source ? -1 : ea->source > eb->source;
+}
+
+// Best first; among equals, targets in order and sources that go away
+static int compare_matches(const void *a, const void *b) {
+    const match_t *ma = a, *mb = b;
+    if (ma->similarity != mb->similarity) return mb->similarity - ma->similarity;
+    if (ma->target != mb->target) return ma->target < mb->target ? -1 : 1;
+    if (ma->kept != mb->kept) return ma->kept - mb->kept;
+    return ma->source < mb->source ? -1 : ma->source > mb->source;
+}
+
+static int compare_pairs(const void *a, const void *b) {
+    const rename_pair_t *pa = a, *pb = b;
+    return pa->target < pb->target ? -1 : pa->target > pb->target;
+}
+
+static int sketch_similarity(const sketch_t *a, const sketch_t *b) {
+    int same = 0;
+    for (int i = 0; i < SKETCH_SIZE; i++) {
+        if (a->min[i] == b->min[i]) same++;
+    }
+    return same * 100 / SKETCH_SIZE;
+}
+
+// Pair the targets left unmatched with sources by sketch. source_of and
+// target_of map the sketched lists back to the caller's indexes.
+static int detect_similar(const rename_source_t *sources, const index_entry_t *const *targets,
+                          const size_t *source_of, size_t source_count,
+                          const size_t *target_of, size_t target_count,
+                          const char *fractyl_dir, const char *target_root, int *source_used,
+                          rename_pair_t *pairs, size_t *pair_count) {
+    size_t total = source_count + target_count;
+    const index_entry_t **entries = malloc(total * sizeof(*entries));
+    sketch_t *sketches = malloc(total * sizeof(sketch_t));
+    band_entry_t *bands = malloc(source_count * SKETCH_BANDS * sizeof(band_entry_t));
+    size_t match_capacity = target_count * 4 + 16;
+    match_t *matches = malloc(match_capacity * sizeof(match_t));
+    if (!entries || !sketches || !bands || !matches) {
+        free(entries);
+        free(sketches);
+        free(bands);
+        free(matches);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    // Sources first, then targets
+    for (size_t i = 0; i < source_count; i++) entries[i] = sources[source_of[i]].entry;
+    for (size_t i = 0; i < target_count; i++) entries[source_count + i] = targets[target_of[i]];
+    sketch_job_t job = { entries, sketches, total, 0, fractyl_dir, source_count, target_root };
+    sketch_all(&job);
+    
+    size_t band_count = 0;
+    for (size_t s = 0; s < source_count; s++) {
+        if (!sketches[s].valid) continue;
+        for (int b = 0; b < SKETCH_BANDS; b++) {
+            bands[band_count].key = band_key(&sketches[s], b);
+            bands[band_count].source = s;
+            band_count++;
+        }
+    }
+    qsort(bands, band_count, sizeof(band_entry_t), compare_band_entries);
+    
+    int result = FRACTYL_OK;
+    size_t match_count = 0;
+    for (size_t t = 0; t < target_count && result == FRACTYL_OK; t++) {
+        const sketch_t *sketch = &sketches[source_count + t];
+        if (!sketch->valid) continue;
+        off_t target_size = targets[target_of[t]]->size;
+    
+        size_t candidates[RENAME_MAX_CANDIDATES];
+        size_t candidate_count = 0;
+        for (int b = 0; b < SKETCH_BANDS && candidate_count < RENAME_MAX_CANDIDATES; b++) {
+            uint64_t key = band_key(sketch, b);
+            size_t lo = 0, hi = band_count;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (bands[mid].key < key) lo = mid + 1;
+                else hi = mid;
+            }
+            for (; lo < band_count && bands[lo].key == key && candidate_count < RENAME_MAX_CANDIDATES; lo++) {
+                size_t s = bands[lo].source;
+                size_t c = 0;
+                while (c < candidate_count && candidates[c] != s) c++;
+                if (c == candidate_count) candidates[candidate_count++] = s;
+            }
+        }
+    
+        for (size_t c = 0; c < candidate_count; c++) {
+            size_t s = candidates[c];
+            // Files of very different sizes cannot be similar enough
+            off_t source_size = sources[source_of[s]].entry->size;
+            off_t small = source_size < target_size ? source_size : target_size;
+            off_t large = source_size < target_size ? target_size : source_size;
+            if (small * 100 / large < RENAME_MIN_SIMILARITY) continue;
+    
+            int similarity = sketch_similarity(&sketches[s], sketch);
+            // Only the same content is 100%
+            if (similarity == 100) similarity = 99;
+            if (similarity < RENAME_MIN_SIMILARITY) continue;
+            if (match_count == match_capacity) {
+                match_t *grown = realloc(matches, match_capacity * 2 * sizeof(match_t));
+                if (!grown) {
+                    result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                    break;
+                }
+                matches = grown;
+                match_capacity *= 2;
+            }
+            matches[match_count].target = target_of[t];
+            matches[match_count].source = source_of[s];
+            matches[match_count].similarity = similarity;
+            matches[match_count].kept = sources[source_of[s]].kept;
+            match_count++;
+        }
+    }
+    
+    if (result == FRACTYL_OK) {
+        // Greedily, best match first
+        qsort(matches, match_count, sizeof(match_t), compare_matches);
+        int *target_done = calloc(target_count ? target_count : 1, sizeof(int));
+        if (!target_done) {
+            result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        } else {
+            // target_of is ascending, so a target's slot is found by search
+            for (size_t m = 0; m < match_count; m++) {
+                size_t lo = 0, hi = target_count;
+                while (lo < hi) {
+                    size_t mid = lo + (hi - lo) / 2;
+                    if (target_of[mid] < matches[m].target) lo = mid + 1;
+                    else hi = mid;
+                }
+                if (target_done[lo]) continue;
+                target_done[lo] = 1;
+    
+                rename_pair_t *pair = &pairs[(*pair_count)++];
+                pair->source = matches[m].source;
+                pair->target = matches[m].target;
+                pair->similarity = matches[m].similarity;
+                pair->copy = matches[m].kept || source_used[matches[m].source];
+                source_used[matches[m].source] = 1;
+            }
+        }
+        free(target_done);
+    }
+    
+    free(entries);
+    free(sketches);
+    free(bands);
+    free(matches);
+    return result;
+}
+
+int rename_detect(const rename_source_t *sources, size_t source_count,
+                  const index_entry_t *const *targets, size_t target_count, const char *fractyl_dir,
+                  const char *target_root, size_t limit, rename_pair_t **pairs_out, size_t *pair_count) {
+    if ((!sources && source_count) || (!targets && target_count) || !pairs_out || !pair_count) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    *pairs_out = NULL;
+    *pair_count = 0;
+    if (source_count == 0 || target_count == 0) return FRACTYL_OK;
+    
+    // Open addressing over the sources' hashes, at most half full
+    size_t capacity = 16;
+    while (capacity < source_count * 2) capacity *= 2;
+    size_t *slots = calloc(capacity, sizeof(size_t));   // Source + 1, 0 for empty
+    int *source_used = calloc(source_count, sizeof(int));
+    int *target_done = calloc(target_count, sizeof(int));
+    rename_pair_t *pairs = malloc(target_count * sizeof(rename_pair_t));
+    size_t *source_of = malloc(source_count * sizeof(size_t));
+    size_t *target_of = malloc(target_count * sizeof(size_t));
+    if (!slots || !source_used || !target_done || !pairs || !source_of || !target_of) {
+        free(slots);
+        free(source_used);
+        free(target_done);
+        free(pairs);
+        free(source_of);
+        free(target_of);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    for (size_t s = 0; s < source_count; s++) {
+        if (sources[s].entry->size == 0) continue;
+        size_t slot = hash_key(sources[s].entry->hash) & (capacity - 1);
+        while (slots[slot]) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = s + 1;
+    }
+    
+    // Same content: a deleted source of the same name first, then any
+    // deleted one, then a copy
+    size_t count = 0;
+    for (size_t t = 0; t < target_count; t++) {
+        const index_entry_t *target = targets[t];
+        if (target->size == 0) continue;
+        size_t best = 0;
+        int best_rank = 4;
+        for (size_t slot = hash_key(target->hash) & (capacity - 1); slots[slot];
+             slot = (slot + 1) & (capacity - 1)) {
+            size_t s = slots[slot] - 1;
+            if (memcmp(sources[s].entry->hash, target->hash, 32) != 0) continue;
+            int rank;
+            if (sources[s].kept) rank = 2;
+            else if (source_used[s]) rank = 3;
+            else rank = strcmp(base_name(sources[s].entry->path), base_name(target->path)) == 0 ? 0 : 1;
+            if (rank < best_rank) {
+                best = s;
+                best_rank = rank;
+            }
+        }
+        if (best_rank == 4) continue;
+    
+        pairs[count].source = best;
+        pairs[count].target = t;
+        pairs[count].similarity = 100;
+        pairs[count].copy = best_rank >= 2;
+        source_used[best] = 1;
+        target_done[t] = 1;
+        count++;
+    }
+    
+    // Then similar content, among what is left
+    size_t sources_left = 0, targets_left = 0;
+    for (size_t s = 0; s < source_count; s++) {
+        if ((sources[s].kept || !source_used[s]) && sources[s].entry->size > 0) source_of[sources_left++] = s;
+    }
+    for (size_t t = 0; t < target_count; t++) {
+        if (!target_done[t] && targets[t]->size > 0) target_of[targets_left++] = t;
+    }
+    int result = FRACTYL_OK;
+    if (sources_left > 0 && targets_left > 0 && sources_left <= limit && targets_left <= limit) {
+        result = detect_similar(sources, targets, source_of, sources_left, target_of, targets_left,
+                                fractyl_dir, target_root, source_used, pairs, &count);
+    }
+    
+    free(slots);
+    free(source_used);
+    free(target_done);
+    free(source_of);
+    free(target_of);
+    if (result != FRACTYL_OK) {
+        free(pairs);
+        return result;
+    }
+    qsort(pairs, count, sizeof(rename_pair_t), compare_pairs);
+    *pairs_out = pairs;
+    *pair_count = count;
+    return FRACTYL_OK;
+}
+
+int rename_enabled(const char *fractyl_dir, size_t *limit_out) {
+    if (config_get_long(fractyl_dir, "diff.renames", 1) == 0) return 0;
+    long limit = config_get_long(fractyl_dir, "diff.rename_limit", RENAME_DEFAULT_LIMIT);
+    if (limit_out) *limit_out = limit > 0 ? (size_t)limit : 0;
+    return 1;
+}
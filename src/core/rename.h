@@ -0,0 +1,58 @@
+#ifndef RENAME_H
+#define RENAME_H
+
+#include "../include/core.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Rename and copy detection: pairs the files a change added (targets)
+// with files of the old side (sources) they came from.
+//
+// Files with the same content are found first, in linear time, through a
+// map from hash to source. The rest are compared by MinHash sketches of
+// their contents cut into lines: two sketches agree in about the share of
+// positions the files' line sets have in common. Sketches are bucketed by
+// bands, so a target is only compared with sources sharing a band with
+// it, and with at most RENAME_MAX_CANDIDATES of them. Above limit files
+// on either side, only the exact matches are made.
+//
+// A deleted source is renamed to the target that matches it best; every
+// other match of it, and every match of a source still present (kept),
+// is a copy. Empty files are never paired.
+
+#define RENAME_DEFAULT_LIMIT 10000
+#define RENAME_MIN_SIMILARITY 50    // Percent
+#define RENAME_MAX_CANDIDATES 32
+
+typedef struct {
+    const index_entry_t *entry;
+    int kept;                   // Still in the new side: can only be copied
+} rename_source_t;
+
+typedef struct {
+    size_t source;              // Into the sources given
+    size_t target;              // Into the targets given
+    int similarity;             // Percent, 100 for the same content
+    int copy;                   // The source stays where it was
+} rename_pair_t;
+
+// Fill *pairs_out (malloc'd, in target order) with one pair for each
+// target that was matched. Targets are read from the files under
+// target_root when it is not NULL (the working tree), else from the
+// object store.
+int rename_detect(const rename_source_t *sources, size_t source_count,
+                  const index_entry_t *const *targets, size_t target_count, const char *fractyl_dir,
+                  const char *target_root, size_t limit, rename_pair_t **pairs_out, size_t *pair_count);
+
+// Whether renames are detected, and the limit, from .fractyl/config
+// (diff.renames, diff.rename_limit); 0 when renames are off
+int rename_enabled(const char *fractyl_dir, size_t *limit_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RENAME_H
@@ -0,0 +1,186 @@
+#include "retention.h"
+#include "../include/core.h"
+#include "../utils/catalog.h"
+#include "../utils/config.h"
+#include "../utils/json.h"
+#include "../utils/paths.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int retention_parse_age(const char *text, long *seconds) {
+    if (!text || !seconds) return FRACTYL_ERROR_INVALID_ARGS;
+    char *end;
+    long amount = strtol(text, &end, 10);
+    if (end == text || amount < 0) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    long unit = 0;
+    if (end[0] == '\0') {
+        unit = 1;
+    } else if (end[1] == '\0') {
+        switch (end[0]) {
+            case 's': unit = 1; break;
+            case 'm': unit = 60; break;
+            case 'h': unit = 3600; break;
+            case 'd': unit = 86400; break;
+            case 'w': unit = 7 * 86400; break;
+        }
+    }
+    if (unit == 0) return FRACTYL_ERROR_INVALID_ARGS;
+    *seconds = amount * unit;
+    return FRACTYL_OK;
+}
+
+static long config_age(const char *fractyl_dir, const char *key) {
+    char value[64];
+    long seconds;
+    if (config_get(fractyl_dir, key, value, sizeof(value)) == FRACTYL_OK &&
+        retention_parse_age(value, &seconds) == FRACTYL_OK) {
+        return seconds;
+    }
+    return 0;
+}
+
+void retention_policy_load(const char *fractyl_dir, retention_policy_t *policy) {
+    memset(policy, 0, sizeof(*policy));
+    policy->keep_all = config_age(fractyl_dir, "retention.all");
+    policy->keep_hourly = config_age(fractyl_dir, "retention.hourly");
+    policy->keep_daily = config_age(fractyl_dir, "retention.daily");
+    policy->keep_weekly = config_age(fractyl_dir, "retention.weekly");
+    long batch = config_get_long(fractyl_dir, "retention.batch", RETENTION_DEFAULT_BATCH);
+    policy->batch = batch > 0 ? (size_t)batch : 0;
+}
+
+int retention_policy_enabled(const retention_policy_t *policy) {
+    return policy && (policy->keep_all > 0 || policy->keep_hourly > 0 ||
+                      policy->keep_daily > 0 || policy->keep_weekly > 0);
+}
+
+// Mark the snapshots the policy keeps. Walking newest first, the first
+// snapshot seen in an hour, day or week is the newest of it.
+static void mark_kept(const catalog_t *catalog, const retention_policy_t *policy, time_t now,
+                      const char *current_id, unsigned char *keep) {
+    const long windows[3] = { policy->keep_hourly, policy->keep_daily, policy->keep_weekly };
+    long long last_bucket[3] = { -1, -1, -1 };
+    
+    for (size_t n = 0; n < catalog->count; n++) {
+        size_t i = catalog->count - 1 - n;
+        const catalog_entry_t *entry = &catalog->entries[i];
+        time_t age = now > entry->timestamp ? now - entry->timestamp : 0;
+    
+        // Days and weeks (from Monday) are local ones
+        struct tm tm_info;
+        localtime_r(&entry->timestamp, &tm_info);
+        long long local = (long long)entry->timestamp + tm_info.tm_gmtoff;
+        long long day = local >= 0 ? local / 86400 : (local - 86399) / 86400;
+        long long buckets[3] = { (long long)entry->timestamp / 3600, day, (day + 3) / 7 };
+    
+        keep[i] = n == 0 || age < policy->keep_all ||
+                  (current_id && strcmp(entry->id, current_id) == 0);
+        for (int t = 0; t < 3; t++) {
+            if (buckets[t] != last_bucket[t]) {
+                if (age < windows[t]) keep[i] = 1;
+                last_bucket[t] = buckets[t];
+            }
+        }
+    }
+}
+
+// Point a snapshot at a new parent, rewriting its file and catalog record
+static int reparent_snapshot(const char *snapshots_dir, const char *id, const char *parent_id) {
+    snapshot_t snapshot;
+    int result = catalog_load_snapshot(snapshots_dir, id, &snapshot);
+    if (result != FRACTYL_OK) return result;
+    
+    free(snapshot.parent);
+    snapshot.parent = parent_id ? strdup(parent_id) : NULL;
+    if (parent_id && !snapshot.parent) {
+        json_free_snapshot(&snapshot);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    result = catalog_store_snapshot(snapshots_dir, &snapshot);
+    json_free_snapshot(&snapshot);
+    return result;
+}
+
+static char* read_current_id(const char *fractyl_dir, const char *branch) {
+    char *current_path = paths_get_current_file(fractyl_dir, branch);
+    if (!current_path) return NULL;
+    FILE *f = fopen(current_path, "r");
+    free(current_path);
+    if (!f) return NULL;
+    
+    char id[128];
+    char *result = NULL;
+    if (fgets(id, sizeof(id), f)) {
+        id[strcspn(id, "\r\n")] = '\0';
+        result = strdup(id);
+    }
+    fclose(f);
+    return result;
+}
+
+int retention_prune(const char *fractyl_dir, const char *branch,
+                    const retention_policy_t *policy, retention_stats_t *stats) {
+    if (!fractyl_dir || !policy || !stats) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(stats, 0, sizeof(*stats));
+    if (!retention_policy_enabled(policy)) return FRACTYL_OK;
+    
+    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, branch);
+    if (!snapshots_dir) return FRACTYL_ERROR_IO;
+    catalog_t catalog;
+    int result = catalog_load(snapshots_dir, &catalog);
+    if (result != FRACTYL_OK) {
+        free(snapshots_dir);
+        return result;
+    }
+    stats->examined = catalog.count;
+    
+    unsigned char *keep = calloc(catalog.count ? catalog.count : 1, 1);
+    unsigned char *removing = calloc(catalog.count ? catalog.count : 1, 1);
+    if (!keep || !removing) {
+        free(keep);
+        free(removing);
+        catalog_free(&catalog);
+        free(snapshots_dir);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    char *current_id = read_current_id(fractyl_dir, branch);
+    mark_kept(&catalog, policy, policy->now ? policy->now : time(NULL), current_id, keep);
+    free(current_id);
+    
+    // This call's batch: the oldest of the snapshots not kept
+    for (size_t i = 0; i < catalog.count; i++) {
+        if (keep[i]) continue;
+        if (policy->batch > 0 && stats->removed >= policy->batch) {
+            stats->remaining++;
+        } else {
+            removing[i] = 1;
+            stats->removed++;
+        }
+    }
+    
+    if (!policy->dry_run) {
+        // Reparent first: until the removals, both parents exist
+        for (size_t i = 0; i < catalog.count && result == FRACTYL_OK; i++) {
+            const catalog_entry_t *parent = catalog_parent(&catalog, &catalog.entries[i]);
+            if (removing[i] || !parent || !removing[parent - catalog.entries]) continue;
+            while (parent && removing[parent - catalog.entries]) {
+                parent = catalog_parent(&catalog, parent);
+            }
+            result = reparent_snapshot(snapshots_dir, catalog.entries[i].id, parent ? parent->id : NULL);
+            if (result == FRACTYL_OK) stats->reparented++;
+        }
+        for (size_t i = 0; i < catalog.count && result == FRACTYL_OK; i++) {
+            if (removing[i]) {
+                result = catalog_remove_snapshot(snapshots_dir, catalog.entries[i].id);
+            }
+        }
+    }
+    
+    free(keep);
+    free(removing);
+    catalog_free(&catalog);
+    free(snapshots_dir);
+    return result;
+}
@@ -0,0 +1,70 @@
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include "../include/fractyl.h"
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Retention: thinning a branch's snapshots as they age.
+//
+// Every snapshot younger than retention.all is kept. Older ones are kept
+// while they are the newest of their hour, day or week and younger than
+// retention.hourly, retention.daily or retention.weekly respectively; the
+// rest are removed. The newest snapshot and the branch's CURRENT one are
+// always kept. Nothing is removed unless at least one window is set.
+//
+// A snapshot whose parent is removed gets the parent's nearest surviving
+// ancestor instead, so lineages stay connected. Removing snapshots only
+// unreferences their objects; object GC (gc.h) deletes those.
+//
+// The caller holds the repository lock (utils/lock.h).
+//
+// Config (ages: seconds, or a number followed by s, m, h, d or w):
+//   retention.all = 1h
+//   retention.hourly = 1d
+//   retention.daily = 30d
+//   retention.weekly = 0           (0 or unset: no such window)
+//   retention.batch = 100          (snapshots removed per retention_prune())
+
+#define RETENTION_DEFAULT_BATCH 100
+
+typedef struct {
+    long keep_all;            // Seconds; 0 for none
+    long keep_hourly;
+    long keep_daily;
+    long keep_weekly;
+    size_t batch;             // Most snapshots removed per call; 0 for no limit
+    int dry_run;              // Count what would be removed, remove nothing
+    time_t now;               // Ages are measured from here; 0 for the current time
+} retention_policy_t;
+
+typedef struct {
+    size_t examined;          // Snapshots of the branch
+    size_t removed;           // Removed by this call (or would be, dry run)
+    size_t reparented;        // Snapshots given a new parent
+    size_t remaining;         // Still due for removal once this call is done
+} retention_stats_t;
+
+// Parse an age like 90, 30m, 1h or 30d into seconds
+int retention_parse_age(const char *text, long *seconds);
+
+// Policy from the retention.* config keys
+void retention_policy_load(const char *fractyl_dir, retention_policy_t *policy);
+
+// Whether the policy removes anything at all
+int retention_policy_enabled(const retention_policy_t *policy);
+
+// Remove up to policy->batch of the snapshots of branch that the policy
+// does not keep, oldest first
+int retention_prune(const char *fractyl_dir, const char *branch,
+                    const retention_policy_t *policy, retention_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RETENTION_H
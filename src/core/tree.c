@@ -0,0 +1,679 @@
+#include "tree.h"
+#include "objects.h"
+#include "hash.h"
+#include "../include/fractyl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define TREE_HEADER_SIZE 24
+// Deeper trees than this are taken to be corrupt (a tree naming itself)
+#define TREE_MAX_DEPTH 256
+#define TREE_MAX_PATH 4096
+// Mode recorded for subdirectory children
+#define TREE_DIR_MODE (S_IFDIR | 0755)
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+int tree_is_tree(const void *data, size_t size) {
+    return data && size >= TREE_HEADER_SIZE && memcmp(data, "FTRE", 4) == 0;
+}
+
+// --- Reading ---
+
+typedef struct {
+    unsigned char *data;
+    size_t count;
+    size_t record_size;
+    const unsigned char *records;
+    const char *pool;
+    size_t pool_size;
+} tree_t;
+
+static int tree_parse(tree_t *tree, unsigned char *data, size_t size) {
+    if (!tree_is_tree(data, size) || get_u32(data + 4) != TREE_FORMAT_VERSION) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    uint64_t count = get_u32(data + 8);
+    uint64_t record_size = get_u32(data + 12);
+    uint64_t pool_size = get_u64(data + 16);
+    if (record_size < INDEX_RECORD_SIZE) return FRACTYL_ERROR_GENERIC;
+    
+    uint64_t available = size - TREE_HEADER_SIZE;
+    if (count * record_size > available || available - count * record_size != pool_size) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    tree->data = data;
+    tree->count = (size_t)count;
+    tree->record_size = (size_t)record_size;
+    tree->records = data + TREE_HEADER_SIZE;
+    tree->pool = (const char*)tree->records + count * record_size;
+    tree->pool_size = (size_t)pool_size;
+    if (count > 0 && (pool_size == 0 || tree->pool[pool_size - 1] != '\0')) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    return FRACTYL_OK;
+}
+
+static int tree_open(tree_t *tree, const unsigned char *hash, const char *fractyl_dir) {
+    void *data;
+    size_t size;
+    int result = object_load(hash, fractyl_dir, &data, &size);
+    if (result != FRACTYL_OK) return result;
+    
+    result = tree_parse(tree, data, size);
+    if (result != FRACTYL_OK) free(data);
+    return result;
+}
+
+static void tree_close(tree_t *tree) {
+    free(tree->data);
+    tree->data = NULL;
+}
+
+// Child i; its path is the bare name, pointing into the tree
+static int tree_child(const tree_t *tree, size_t i, index_entry_t *entry) {
+    memset(entry, 0, sizeof(*entry));
+    return index_record_decode(tree->records + i * tree->record_size, tree->pool, tree->pool_size, entry);
+}
+
+// Append name (and a '/' for directories) to the len bytes of path
+static int path_extend(char *path, size_t len, const char *name, int is_dir, size_t *len_out) {
+    size_t name_len = strlen(name);
+    if (name_len == 0 || strchr(name, '/')) return FRACTYL_ERROR_GENERIC;
+    if (len + name_len + 2 > TREE_MAX_PATH) return FRACTYL_ERROR_PATH_TOO_LONG;
+    
+    memcpy(path + len, name, name_len);
+    len += name_len;
+    if (is_dir) path[len++] = '/';
+    path[len] = '\0';
+    *len_out = len;
+    return FRACTYL_OK;
+}
+
+// Call fn for every file under the tree hash, whose directory path (with
+// its trailing '/') is the len bytes of path, in path order
+static int expand_tree(const unsigned char *hash, const char *fractyl_dir, char *path, size_t len,
+                       int depth, tree_file_fn fn, void *ctx) {
+    if (depth > TREE_MAX_DEPTH) return FRACTYL_ERROR_GENERIC;
+    
+    tree_t tree;
+    int result = tree_open(&tree, hash, fractyl_dir);
+    if (result != FRACTYL_OK) return result;
+    
+    for (size_t i = 0; i < tree.count && result == FRACTYL_OK; i++) {
+        index_entry_t child;
+        size_t child_len;
+        result = tree_child(&tree, i, &child);
+        if (result == FRACTYL_OK) {
+            result = path_extend(path, len, child.path, S_ISDIR(child.mode), &child_len);
+        }
+        if (result != FRACTYL_OK) break;
+    
+        if (S_ISDIR(child.mode)) {
+            result = expand_tree(child.hash, fractyl_dir, path, child_len, depth + 1, fn, ctx);
+        } else {
+            child.path = path;
+            result = fn(&child, ctx);
+        }
+        path[len] = '\0';
+    }
+    tree_close(&tree);
+    return result;
+}
+
+static int add_file(const index_entry_t *entry, void *ctx) {
+    return index_add_entry_direct(ctx, entry);
+}
+
+int tree_load_index(const unsigned char *root, const char *fractyl_dir, index_t *index) {
+    if (!root || !fractyl_dir || !index) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    index_init(index);
+    char path[TREE_MAX_PATH] = "";
+    int result = expand_tree(root, fractyl_dir, path, 0, 0, add_file, index);
+    if (result != FRACTYL_OK) index_free(index);
+    return result;
+}
+
+// Compare a child's path part (its name, and a '/' for a directory) with
+// want as far as both go: 0 when one starts with the other. Children are
+// sorted by that key, so the ones that are 0 are a run.
+static int child_prefix_compare(const index_entry_t *child, const char *want, size_t want_len) {
+    size_t name_len = strlen(child->path);
+    size_t key_len = name_len + (S_ISDIR(child->mode) ? 1 : 0);
+    size_t n = key_len < want_len ? key_len : want_len;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = i < name_len ? (unsigned char)child->path[i] : '/';
+        unsigned char w = (unsigned char)want[i];
+        if (c != w) return c < w ? -1 : 1;
+    }
+    return 0;
+}
+
+// expand_tree() for the files under the open tree whose path starts with
+// prefix; the tree's directory path is the len bytes of path
+static int expand_matching(tree_t *tree, const char *fractyl_dir, char *path, size_t len, int depth,
+                           const char *prefix, size_t prefix_len, tree_file_fn fn, void *ctx) {
+    const char *want = prefix + len;
+    size_t want_len = prefix_len - len;
+    
+    // First child that is not below the prefix
+    size_t lo = 0, hi = tree->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        index_entry_t child;
+        int result = tree_child(tree, mid, &child);
+        if (result != FRACTYL_OK) return result;
+        if (child_prefix_compare(&child, want, want_len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    int result = FRACTYL_OK;
+    for (size_t i = lo; i < tree->count && result == FRACTYL_OK; i++) {
+        index_entry_t child;
+        size_t child_len;
+        result = tree_child(tree, i, &child);
+        if (result != FRACTYL_OK) break;
+        if (child_prefix_compare(&child, want, want_len) != 0) break;
+        result = path_extend(path, len, child.path, S_ISDIR(child.mode), &child_len);
+        if (result != FRACTYL_OK) break;
+    
+        if (S_ISDIR(child.mode) && child_len >= prefix_len) {
+            // Everything under it matches
+            result = expand_tree(child.hash, fractyl_dir, path, child_len, depth + 1, fn, ctx);
+        } else if (S_ISDIR(child.mode)) {
+            if (depth + 1 > TREE_MAX_DEPTH) {
+                result = FRACTYL_ERROR_GENERIC;
+            } else {
+                tree_t subtree;
+                result = tree_open(&subtree, child.hash, fractyl_dir);
+                if (result == FRACTYL_OK) {
+                    result = expand_matching(&subtree, fractyl_dir, path, child_len, depth + 1,
+                                             prefix, prefix_len, fn, ctx);
+                    tree_close(&subtree);
+                }
+            }
+        } else if (child_len >= prefix_len) {
+            child.path = path;
+            result = fn(&child, ctx);
+        }
+        path[len] = '\0';
+    }
+    return result;
+}
+
+int tree_for_each_child(const unsigned char *hash, const char *fractyl_dir, tree_file_fn fn, void *ctx) {
+    if (!hash || !fractyl_dir || !fn) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    tree_t tree;
+    int result = tree_open(&tree, hash, fractyl_dir);
+    if (result != FRACTYL_OK) return result;
+    
+    for (size_t i = 0; i < tree.count && result == FRACTYL_OK; i++) {
+        index_entry_t child;
+        result = tree_child(&tree, i, &child);
+        if (result == FRACTYL_OK) result = fn(&child, ctx);
+    }
+    tree_close(&tree);
+    return result == TREE_FILES_STOP ? FRACTYL_OK : result;
+}
+
+// tree_for_each_file() over a flat index object, which the view takes over
+static int each_indexed_file(void *data, size_t size, const char *prefix, size_t prefix_len,
+                             tree_file_fn fn, void *ctx) {
+    index_view_t view;
+    int result = index_view_open_owned(&view, data, size);
+    if (result != FRACTYL_OK) return result;
+    
+    for (size_t i = index_view_lower_bound(&view, prefix); i < view.count && result == FRACTYL_OK; i++) {
+        index_entry_t entry;
+        result = index_view_get(&view, i, &entry);
+        if (result != FRACTYL_OK) break;
+        if (strncmp(entry.path, prefix, prefix_len) != 0) {
+            if (view.sorted && !view.legacy) break;
+            continue;
+        }
+        result = fn(&entry, ctx);
+    }
+    index_view_close(&view);
+    return result;
+}
+
+int tree_for_each_file(const unsigned char *root, const char *fractyl_dir, const char *prefix,
+                       tree_file_fn fn, void *ctx) {
+    if (!root || !fractyl_dir || !fn) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    if (!prefix) prefix = "";
+    size_t prefix_len = strlen(prefix);
+    if (prefix_len + 2 > TREE_MAX_PATH) return FRACTYL_ERROR_PATH_TOO_LONG;
+    
+    void *data;
+    size_t size;
+    int result = object_load(root, fractyl_dir, &data, &size);
+    if (result != FRACTYL_OK) return result;
+    if (!tree_is_tree(data, size)) {
+        result = each_indexed_file(data, size, prefix, prefix_len, fn, ctx);
+        return result == TREE_FILES_STOP ? FRACTYL_OK : result;
+    }
+    
+    tree_t tree;
+    result = tree_parse(&tree, data, size);
+    if (result != FRACTYL_OK) {
+        free(data);
+        return result;
+    }
+    char path[TREE_MAX_PATH] = "";
+    result = expand_matching(&tree, fractyl_dir, path, 0, 0, prefix, prefix_len, fn, ctx);
+    tree_close(&tree);
+    return result == TREE_FILES_STOP ? FRACTYL_OK : result;
+}
+
+static int walk_tree(const unsigned char *hash, const char *fractyl_dir, int depth, tree_visit_fn fn,
+                     void *ctx) {
+    if (depth > TREE_MAX_DEPTH) return FRACTYL_ERROR_GENERIC;
+    
+    int result = fn(hash, 1, ctx);
+    if (result != FRACTYL_OK) return result == TREE_WALK_SKIP ? FRACTYL_OK : result;
+    
+    tree_t tree;
+    result = tree_open(&tree, hash, fractyl_dir);
+    if (result != FRACTYL_OK) return result;
+    
+    for (size_t i = 0; i < tree.count && result == FRACTYL_OK; i++) {
+        index_entry_t child;
+        result = tree_child(&tree, i, &child);
+        if (result != FRACTYL_OK) break;
+    
+        if (S_ISDIR(child.mode)) {
+            result = walk_tree(child.hash, fractyl_dir, depth + 1, fn, ctx);
+        } else {
+            result = fn(child.hash, 0, ctx);
+        }
+    }
+    tree_close(&tree);
+    return result;
+}
+
+int tree_walk(const unsigned char *root, const char *fractyl_dir, tree_visit_fn fn, void *ctx) {
+    if (!root || !fractyl_dir || !fn) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    return walk_tree(root, fractyl_dir, 0, fn, ctx);
+}
+
+// --- Writing ---
+
+typedef struct {
+    unsigned char *records;
+    size_t count;
+    size_t capacity;
+    char *pool;
+    size_t pool_size;
+    size_t pool_capacity;
+} tree_builder_t;
+
+static int builder_add(tree_builder_t *builder, const index_entry_t *entry, const char *name,
+                       size_t name_len) {
+    if (builder->count == builder->capacity) {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 16;
+        unsigned char *records = realloc(builder->records, capacity * INDEX_RECORD_SIZE);
+        if (!records) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        builder->records = records;
+        builder->capacity = capacity;
+    }
+    if (builder->pool_size + name_len + 1 > builder->pool_capacity) {
+        size_t capacity = builder->pool_capacity ? builder->pool_capacity * 2 : 256;
+        while (capacity < builder->pool_size + name_len + 1) capacity *= 2;
+        char *pool = realloc(builder->pool, capacity);
+        if (!pool) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        builder->pool = pool;
+        builder->pool_capacity = capacity;
+    }
+    if (builder->pool_size > UINT32_MAX) return FRACTYL_ERROR_GENERIC;
+    
+    index_record_encode(builder->records + builder->count * INDEX_RECORD_SIZE, entry,
+                        (uint32_t)builder->pool_size);
+    memcpy(builder->pool + builder->pool_size, name, name_len);
+    builder->pool[builder->pool_size + name_len] = '\0';
+    builder->pool_size += name_len + 1;
+    builder->count++;
+    return FRACTYL_OK;
+}
+
+static int builder_store(const tree_builder_t *builder, const char *fractyl_dir, unsigned char *hash_out) {
+    size_t table_size = builder->count * INDEX_RECORD_SIZE;
+    size_t size = TREE_HEADER_SIZE + table_size + builder->pool_size;
+    unsigned char *data = malloc(size);
+    if (!data) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    memcpy(data, "FTRE", 4);
+    put_u32(data + 4, TREE_FORMAT_VERSION);
+    put_u32(data + 8, (uint32_t)builder->count);
+    put_u32(data + 12, INDEX_RECORD_SIZE);
+    put_u64(data + 16, builder->pool_size);
+    if (table_size) memcpy(data + TREE_HEADER_SIZE, builder->records, table_size);
+    if (builder->pool_size) memcpy(data + TREE_HEADER_SIZE + table_size, builder->pool, builder->pool_size);
+    
+    int result = object_store_data(data, size, fractyl_dir, hash_out);
+    free(data);
+    return result;
+}
+
+// Paths at or below which an index differs from the one stored under a
+// base tree
+typedef struct {
+    const char *const *paths;
+    size_t count;
+} tree_scope_t;
+
+// Nonzero if one of the scope's paths is the directory made of the first
+// len bytes of dir, or lies below it or above it
+static int scope_touches(const tree_scope_t *scope, const char *dir, size_t len) {
+    for (size_t i = 0; i < scope->count; i++) {
+        const char *path = scope->paths[i];
+        size_t path_len = strlen(path);
+        if (path_len >= len ? strncmp(path, dir, len) == 0 && (path_len == len || path[len] == '/')
+                            : strncmp(dir, path, path_len) == 0 && dir[path_len] == '/') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Find the subdirectory name among the children of base from *cursor on
+// and move the cursor past it. Children are in the order store_tree()
+// adds them, so the search stops at the first one sorting after name.
+static int base_subtree(const tree_t *base, size_t *cursor, const char *name, size_t name_len,
+                        unsigned char *hash_out) {
+    for (size_t i = *cursor; i < base->count; i++) {
+        index_entry_t child;
+        if (tree_child(base, i, &child) != FRACTYL_OK) return 0;
+        int order = strncmp(child.path, name, name_len);
+        if (order > 0) return 0;
+        if (order == 0 && child.path[name_len] == '\0') {
+            if (!S_ISDIR(child.mode)) return 0;
+            memcpy(hash_out, child.hash, sizeof(child.hash));
+            *cursor = i + 1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Store the tree of the directory whose path is the first len bytes of
+// every entry in order[0, count), sorted by path. With a scope, base is
+// this directory's tree in the snapshot the index was changed from (NULL
+// if it had none), and subdirectories outside the scope keep their trees.
+static int store_tree(const index_entry_t **order, size_t count, size_t len, const char *fractyl_dir,
+                      const tree_scope_t *scope, const unsigned char *base_hash, unsigned char *hash_out) {
+    tree_builder_t builder = {0};
+    int result = FRACTYL_OK;
+    tree_t base;
+    size_t base_cursor = 0;
+    int have_base = scope && base_hash && tree_open(&base, base_hash, fractyl_dir) == FRACTYL_OK;
+    
+    size_t i = 0;
+    while (i < count && result == FRACTYL_OK) {
+        const char *name = order[i]->path + len;
+        const char *slash = strchr(name, '/');
+        size_t name_len = slash ? (size_t)(slash - name) : strlen(name);
+        if (name_len == 0) {
+            result = FRACTYL_ERROR_INVALID_ARGS;
+            break;
+        }
+    
+        if (!slash) {
+            result = builder_add(&builder, order[i], name, name_len);
+            i++;
+            continue;
+        }
+    
+        // Paths of one directory are adjacent in sorted order
+        size_t end = i + 1;
+        while (end < count && strncmp(order[end]->path + len, name, name_len + 1) == 0) end++;
+    
+        index_entry_t dir;
+        memset(&dir, 0, sizeof(dir));
+        dir.mode = TREE_DIR_MODE;
+        unsigned char base_dir[32];
+        int in_base = have_base && base_subtree(&base, &base_cursor, name, name_len, base_dir);
+        if (in_base && !scope_touches(scope, order[i]->path, len + name_len)) {
+            memcpy(dir.hash, base_dir, sizeof(dir.hash));
+        } else {
+            result = store_tree(order + i, end - i, len + name_len + 1, fractyl_dir, scope,
+                                in_base ? base_dir : NULL, dir.hash);
+        }
+        if (result == FRACTYL_OK) result = builder_add(&builder, &dir, name, name_len);
+        i = end;
+    }
+    
+    if (have_base) tree_close(&base);
+    if (result == FRACTYL_OK) result = builder_store(&builder, fractyl_dir, hash_out);
+    free(builder.records);
+    free(builder.pool);
+    return result;
+}
+
+static int compare_entry_paths(const void *a, const void *b) {
+    const index_entry_t *ea = *(const index_entry_t* const*)a;
+    const index_entry_t *eb = *(const index_entry_t* const*)b;
+    return strcmp(ea->path, eb->path);
+}
+
+static int store_index(const index_t *index, const char *fractyl_dir, const tree_scope_t *scope,
+                       const unsigned char *base, unsigned char *root_out) {
+    if (!index || !fractyl_dir || !root_out) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    const index_entry_t **order = malloc((index->count ? index->count : 1) * sizeof(*order));
+    if (!order) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    for (size_t i = 0; i < index->count; i++) {
+        order[i] = &index->entries[i];
+    }
+    if (!index_is_sorted(index)) {
+        qsort(order, index->count, sizeof(*order), compare_entry_paths);
+    }
+    
+    int result = store_tree(order, index->count, 0, fractyl_dir, scope, base, root_out);
+    free(order);
+    return result;
+}
+
+int tree_store_index(const index_t *index, const char *fractyl_dir, unsigned char *root_out) {
+    return store_index(index, fractyl_dir, NULL, NULL, root_out);
+}
+
+int tree_store_index_scoped(const index_t *index, const char *fractyl_dir, const unsigned char *base,
+                            const char *const *paths, size_t path_count, unsigned char *root_out) {
+    if (!base || (!paths && path_count > 0)) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    tree_scope_t scope = { paths, path_count };
+    return store_index(index, fractyl_dir, &scope, base, root_out);
+}
+
+// --- Comparing ---
+
+typedef struct {
+    index_change_fn fn;
+    void *ctx;
+    index_diff_stats_t *stats;
+    index_change_t change;      // For one-sided subtrees
+} diff_t;
+
+static int report(diff_t *diff, index_change_t change, const index_entry_t *old_entry,
+                  const index_entry_t *new_entry) {
+    switch (change) {
+        case INDEX_CHANGE_ADDED: diff->stats->added++; break;
+        case INDEX_CHANGE_MODIFIED: diff->stats->modified++; break;
+        case INDEX_CHANGE_DELETED: diff->stats->deleted++; break;
+    }
+    return diff->fn ? diff->fn(change, old_entry, new_entry, diff->ctx) : 0;
+}
+
+static int report_file(const index_entry_t *entry, void *ctx) {
+    diff_t *diff = ctx;
+    if (diff->change == INDEX_CHANGE_ADDED) return report(diff, INDEX_CHANGE_ADDED, NULL, entry);
+    return report(diff, INDEX_CHANGE_DELETED, entry, NULL);
+}
+
+// Everything under a subtree that only one side has
+static int report_subtree(diff_t *diff, index_change_t change, const unsigned char *hash,
+                          const char *fractyl_dir, char *path, size_t len, int depth) {
+    diff->change = change;
+    return expand_tree(hash, fractyl_dir, path, len, depth, report_file, diff);
+}
+
+// Order of children as their full paths sort: a directory's name
+// compares as if it ended in '/'
+static int compare_children(const index_entry_t *a, const index_entry_t *b) {
+    const unsigned char *pa = (const unsigned char*)a->path;
+    const unsigned char *pb = (const unsigned char*)b->path;
+    while (*pa && *pa == *pb) {
+        pa++;
+        pb++;
+    }
+    int ca = *pa ? *pa : (S_ISDIR(a->mode) ? '/' : 0);
+    int cb = *pb ? *pb : (S_ISDIR(b->mode) ? '/' : 0);
+    return ca - cb;
+}
+
+static int diff_trees(diff_t *diff, const unsigned char *old_hash, const unsigned char *new_hash,
+                      const char *fractyl_dir, char *path, size_t len, int depth) {
+    if (depth > TREE_MAX_DEPTH) return FRACTYL_ERROR_GENERIC;
+    
+    tree_t old_tree, new_tree;
+    int result = tree_open(&old_tree, old_hash, fractyl_dir);
+    if (result != FRACTYL_OK) return result;
+    result = tree_open(&new_tree, new_hash, fractyl_dir);
+    if (result != FRACTYL_OK) {
+        tree_close(&old_tree);
+        return result;
+    }
+    
+    size_t i = 0, j = 0;
+    while (result == FRACTYL_OK && (i < old_tree.count || j < new_tree.count)) {
+        index_entry_t old_child, new_child;
+        if (i < old_tree.count) result = tree_child(&old_tree, i, &old_child);
+        if (result == FRACTYL_OK && j < new_tree.count) result = tree_child(&new_tree, j, &new_child);
+        if (result != FRACTYL_OK) break;
+    
+        int cmp = i >= old_tree.count ? 1 : j >= new_tree.count ? -1 :
+                  compare_children(&old_child, &new_child);
+        const index_entry_t *child = cmp <= 0 ? &old_child : &new_child;
+        int is_dir = S_ISDIR(child->mode);
+        size_t child_len;
+        result = path_extend(path, len, child->path, is_dir, &child_len);
+        if (result != FRACTYL_OK) break;
+    
+        if (cmp < 0) {
+            if (is_dir) {
+                result = report_subtree(diff, INDEX_CHANGE_DELETED, old_child.hash, fractyl_dir, path,
+                                        child_len, depth + 1);
+            } else {
+                old_child.path = path;
+                result = report(diff, INDEX_CHANGE_DELETED, &old_child, NULL);
+            }
+            i++;
+        } else if (cmp > 0) {
+            if (is_dir) {
+                result = report_subtree(diff, INDEX_CHANGE_ADDED, new_child.hash, fractyl_dir, path,
+                                        child_len, depth + 1);
+            } else {
+                new_child.path = path;
+                result = report(diff, INDEX_CHANGE_ADDED, NULL, &new_child);
+            }
+            j++;
+        } else {
+            // Unchanged subtrees are skipped without being read
+            if (memcmp(old_child.hash, new_child.hash, FRACTYL_HASH_SIZE) == 0) {
+                if (!is_dir && old_child.mode != new_child.mode) {
+                    old_child.path = new_child.path = path;
+                    result = report(diff, INDEX_CHANGE_MODIFIED, &old_child, &new_child);
+                }
+            } else if (is_dir) {
+                result = diff_trees(diff, old_child.hash, new_child.hash, fractyl_dir, path, child_len,
+                                    depth + 1);
+            } else {
+                old_child.path = new_child.path = path;
+                result = report(diff, INDEX_CHANGE_MODIFIED, &old_child, &new_child);
+            }
+            i++;
+            j++;
+        }
+        path[len] = '\0';
+    }
+    tree_close(&old_tree);
+    tree_close(&new_tree);
+    return result;
+}
+
+static int is_tree_object(const unsigned char *hash, const char *fractyl_dir, int *is_tree) {
+    void *data;
+    size_t size;
+    int result = object_load(hash, fractyl_dir, &data, &size);
+    if (result != FRACTYL_OK) return result;
+    *is_tree = tree_is_tree(data, size);
+    free(data);
+    return FRACTYL_OK;
+}
+
+int tree_diff(const unsigned char *old_root, const unsigned char *new_root, const char *fractyl_dir,
+              index_change_fn fn, void *ctx, index_diff_stats_t *stats) {
+    if (!old_root || !new_root || !fractyl_dir) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    index_diff_stats_t local_stats;
+    if (!stats) stats = &local_stats;
+    memset(stats, 0, sizeof(*stats));
+    if (memcmp(old_root, new_root, FRACTYL_HASH_SIZE) == 0) return FRACTYL_OK;
+    
+    int old_is_tree = 0, new_is_tree = 0;
+    int result = is_tree_object(old_root, fractyl_dir, &old_is_tree);
+    if (result == FRACTYL_OK) result = is_tree_object(new_root, fractyl_dir, &new_is_tree);
+    if (result != FRACTYL_OK) return result;
+    
+    if (old_is_tree && new_is_tree) {
+        diff_t diff = { fn, ctx, stats, INDEX_CHANGE_ADDED };
+        char path[TREE_MAX_PATH] = "";
+        return diff_trees(&diff, old_root, new_root, fractyl_dir, path, 0, 0);
+    }
+    
+    // Snapshots from before trees: compare the flat indexes
+    index_t old_index, new_index;
+    result = object_load_index(old_root, fractyl_dir, &old_index);
+    if (result != FRACTYL_OK) return result;
+    result = object_load_index(new_root, fractyl_dir, &new_index);
+    if (result == FRACTYL_OK) {
+        result = index_diff(&old_index, &new_index, fn, ctx, stats);
+        index_free(&new_index);
+    }
+    index_free(&old_index);
+    return result;
+}
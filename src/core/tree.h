@@ -0,0 +1,83 @@
+#ifndef TREE_H
+#define TREE_H
+
+#include "../include/fractyl.h"
+#include "index.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Tree objects: a snapshot's index stored as one object per directory.
+//
+// A tree lists a directory's files and subdirectories by name, each with
+// the record of an index entry (index.h): a file's content hash and stat
+// data, or a subdirectory's tree hash with a directory mode. Since a tree
+// is named by the hash of its bytes, a directory nothing changed in is
+// the same object in every snapshot, so each snapshot only stores the
+// trees on the paths to what changed, and comparisons skip equal subtrees
+// without reading them.
+//
+// Layout, little-endian: "FTRE", u32 version, u32 count, u32 record
+// size, u64 name pool size, the records, then the NUL-terminated names.
+// Children are in the order their full paths sort in: by name, with a
+// directory's name compared as if it ended in '/'.
+//
+// Snapshots name their root tree where they used to name a flat index
+// object (snapshot_t.index_hash); object_load_index() reads both.
+
+#define TREE_FORMAT_VERSION 1
+
+// Nonzero if data (an object's content) is a tree
+int tree_is_tree(const void *data, size_t size);
+
+// Store index, which need not be sorted, as trees; root_out receives the
+// root tree's hash. Trees that already exist are not written again.
+int tree_store_index(const index_t *index, const char *fractyl_dir, unsigned char *root_out);
+
+// The same for an index that only differs from the snapshot index under
+// the tree base at or below paths (repo-relative): directories none of
+// them is in, above or below keep base's subtree, which is not rebuilt.
+// A base that is not a tree (a flat index object) is simply not used.
+int tree_store_index_scoped(const index_t *index, const char *fractyl_dir, const unsigned char *base,
+                            const char *const *paths, size_t path_count, unsigned char *root_out);
+
+// Expand the tree under root into a sorted, flat index
+int tree_load_index(const unsigned char *root, const char *fractyl_dir, index_t *index);
+
+// Called for every object under a tree: subtrees (is_tree set) before
+// what they hold, then files. Return TREE_WALK_SKIP to not descend into a
+// subtree, 0 to go on, or a negative error to stop the walk.
+#define TREE_WALK_SKIP 1
+typedef int (*tree_visit_fn)(const unsigned char *hash, int is_tree, void *ctx);
+int tree_walk(const unsigned char *root, const char *fractyl_dir, tree_visit_fn fn, void *ctx);
+
+// Called for every file under root whose path starts with prefix ("" for
+// all), in path order, without building an index; entries and their paths
+// are valid during the call only. Only the subtrees on the way to prefix
+// are read, and a flat index object is entered by binary search. Return
+// TREE_FILES_STOP to end early, 0 to go on, or a negative error to stop.
+#define TREE_FILES_STOP 1
+typedef int (*tree_file_fn)(const index_entry_t *entry, void *ctx);
+int tree_for_each_file(const unsigned char *root, const char *fractyl_dir, const char *prefix,
+                       tree_file_fn fn, void *ctx);
+
+// Called for every child of the tree hash names, one directory level, in
+// tree order: files with their entry, subdirectories with their tree hash
+// and a directory mode. entry->path is the bare name, valid during the
+// call only. Returns FRACTYL_ERROR_GENERIC if hash is not a tree (a flat
+// index object, for instance); fn returns as for tree_for_each_file().
+int tree_for_each_child(const unsigned char *hash, const char *fractyl_dir, tree_file_fn fn, void *ctx);
+
+// Report the differences between two snapshot indexes in path order, as
+// index_diff() does. Subtrees with equal hashes are skipped unread; flat
+// index objects on either side are loaded and merge-joined instead.
+int tree_diff(const unsigned char *old_root, const unsigned char *new_root, const char *fractyl_dir,
+              index_change_fn fn, void *ctx, index_diff_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TREE_H
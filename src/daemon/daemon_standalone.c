@@ -1,9 +1,19 @@
 #include "daemon_standalone.h"
+#include "watch.h"
+#include "ipc.h"
 #include "../include/commands.h"
 #include "../include/core.h"
+#include "../include/fractyl.h"
 #include "../utils/paths.h"
 #include "../utils/git.h"
 #include "../utils/lock.h"
+#include "../utils/config.h"
+#include "../utils/governor.h"
+#include "../utils/profile.h"
+#include "../utils/counters.h"
+#include "../core/gc.h"
+#include "../core/fsck.h"
+#include "../core/retention.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,12 +21,23 @@
 #include <signal.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <time.h>
+#include <poll.h>
+
+// In watch mode, still do a full rescan this often as a safety net
+#define WATCH_FULL_RESCAN_INTERVAL 3600
+
+// Share of the time the daemon may spend in snapshot cycles, in percent
+#define DAEMON_DEFAULT_DUTY_CYCLE 50
 
 // Global state for signal handling in daemon process
 static volatile int g_daemon_running = 0;
 
+// Repository whose directory and log the daemon process is in
+static daemon_state_t *g_current = NULL;
+
 // Signal handler for graceful shutdown
 static void signal_handler(int sig) {
     (void)sig;
@@ -86,6 +107,8 @@ int daemon_init(daemon_state_t *daemon, const char *repo_root) {
     daemon->config.snapshot_interval = 180;
     daemon->config.running = 0;
     daemon->config.pid = getpid();
+    daemon->listen_fd = -1;
+    daemon->log_fd = -1;
     
     // Get current git branch
     daemon->git_branch = paths_get_current_branch(repo_root);
@@ -93,10 +116,10 @@ int daemon_init(daemon_state_t *daemon, const char *repo_root) {
     return 0;
 }
 
-// Attempt to create a snapshot in daemon process
-static void attempt_snapshot(daemon_state_t *daemon) {
-    (void)daemon; // Currently unused
-    
+// Attempt to create a snapshot in daemon process. With changed_paths, only
+// those paths are rescanned. Returns the snapshot command's result.
+static int attempt_snapshot(daemon_state_t *daemon, const char *const *changed_paths,
+                            size_t changed_count) {
     time_t now = time(NULL);
     printf("[DAEMON] %s", ctime(&now)); // ctime includes newline
     printf("[DAEMON] Attempting periodic snapshot...\n");
@@ -109,72 +132,571 @@ static void attempt_snapshot(daemon_state_t *daemon) {
              tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
              tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec);
     
-    // Create snapshot using existing command
-    // cmd_snapshot handles its own locking and will display appropriate messages
-    char *snapshot_args[] = {"frac", "snapshot", "-m", description, NULL};
-    int result = cmd_snapshot(4, snapshot_args);
-    
+    // snapshot_create handles its own locking and will display appropriate messages
+    snapshot_options_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.message = description;
+    opts.changed_paths = changed_paths;
+    opts.changed_count = changed_count;
+    opts.warm = &daemon->warm;
+    int result = snapshot_create(&opts);
+    
+    unsigned long long throttled_ms = governor_take_throttled_ms();
+    if (throttled_ms > 0) {
+        printf("[DAEMON] Held back %llu ms to stay within the resource budget\n", throttled_ms);
+    }
     if (result == 0) {
         printf("[DAEMON] ✅ Snapshot created: %s\n", description);
     } else {
         // This is normal - it means no changes were detected or lock couldn't be acquired
         printf("[DAEMON] ⏭️  No snapshot created (no changes or operation in progress)\n");
     }
+    // What this cycle counted, added to the repository's counters
+    counters_t cycle;
+    counters_flush(daemon->config.fractyl_dir, &cycle);
+    if (cycle.values[COUNTER_SNAPSHOTS] > 0) daemon->push_due = 1;
+    if (cycle.values[COUNTER_SCANS] > 0) {
+        char line[1024];
+        counters_describe(&cycle, line, sizeof(line));
+        printf("[DAEMON] Counters: %s\n", line);
+    }
+    if (profile_enabled()) {
+        // One summary per cycle, started afresh for the next
+        char summary[4096];
+        profile_format_summary("snapshot", summary, sizeof(summary));
+        printf("[DAEMON] Profile: %s\n", summary);
+        profile_reset();
+    }
+    fflush(stdout);
+    return result;
+}
+
+// One batch of retention thinning on the current branch after a snapshot
+// attempt, when a retention window is configured. The next GC steps find
+// the objects of the removed snapshots. Skipped while the lock is held.
+static void attempt_retention_step(daemon_state_t *daemon) {
+    const char *fractyl_dir = daemon->config.fractyl_dir;
+    retention_policy_t policy;
+    retention_policy_load(fractyl_dir, &policy);
+    if (!retention_policy_enabled(&policy)) return;
+    
+    fractyl_lock_t lock;
+    if (fractyl_lock_acquire(fractyl_dir, &lock) != 0) return;
+    
+    char *branch = paths_get_current_branch(daemon->config.repo_root);
+    retention_stats_t stats;
+    int result = retention_prune(fractyl_dir, branch, &policy, &stats);
+    free(branch);
+    fractyl_lock_release(&lock);
+    
+    if (result != FRACTYL_OK) {
+        printf("[DAEMON] Retention skipped: could not update the snapshots (%d)\n", result);
+    } else if (stats.removed > 0) {
+        printf("[DAEMON] Retention removed %zu snapshots (%zu still due)\n", stats.removed, stats.remaining);
+    }
+    fflush(stdout);
+}
+
+// One bounded step of garbage collection after a snapshot attempt, unless
+// gc.auto = 0. Skipped while another process holds the repository lock.
+static void attempt_gc_step(daemon_state_t *daemon) {
+    const char *fractyl_dir = daemon->config.fractyl_dir;
+    if (config_get_long(fractyl_dir, "gc.auto", 1) == 0) return;
+    if (!daemon->gc && !(daemon->gc = gc_state_new())) return;
+    
+    fractyl_lock_t lock;
+    if (fractyl_lock_acquire(fractyl_dir, &lock) != 0) return;
+    
+    gc_options_t options;
+    gc_options_init(&options);
+    gc_stats_t stats;
+    int result = object_gc_step(fractyl_dir, daemon->gc, &options, &stats);
+    fractyl_lock_release(&lock);
+    
+    if (result != FRACTYL_OK) {
+        printf("[DAEMON] Garbage collection skipped: could not read every snapshot (%d)\n", result);
+    } else if (stats.loose_removed > 0 || stats.temp_removed > 0) {
+        printf("[DAEMON] Removed %zu unreachable objects (%llu bytes)\n",
+               stats.loose_removed + stats.temp_removed, (unsigned long long)stats.bytes_freed);
+    }
+    fflush(stdout);
+}
+
+// Print a problem the scrub found to the daemon's log
+static void report_scrub_problem(fsck_problem_t problem, const char *name, void *ctx) {
+    (void)ctx;
+    const char *what = problem == FSCK_OBJECT_MISSING ? "missing object" :
+                       problem == FSCK_OBJECT_CORRUPT ? "corrupt object" :
+                       problem == FSCK_SNAPSHOT_BROKEN ? "unreadable index of snapshot" :
+                       problem == FSCK_INDEX_MALFORMED ? "malformed index" : "unreadable snapshots in";
+    printf("[DAEMON] Scrub found %s %s\n", what, name);
+}
+
+// One slice of the scrub pass after a snapshot attempt, with fsck.scrub = 1.
+// Reads only when no other process holds the repository lock; gc and
+// restore go first.
+static void attempt_scrub_step(daemon_state_t *daemon) {
+    const char *fractyl_dir = daemon->config.fractyl_dir;
+    if (config_get_long(fractyl_dir, "fsck.scrub", 0) == 0) return;
+    if (!daemon->scrub && !(daemon->scrub = fsck_scrub_new())) return;
+    
+    fractyl_lock_t lock;
+    if (fractyl_lock_wait_acquire_shared(fractyl_dir, &lock, 0) != 0) return;
+    
+    fsck_options_t options;
+    fsck_options_init(&options);
+    options.threads = 1;
+    options.report = report_scrub_problem;
+    fsck_stats_t stats;
+    int result = fsck_scrub_step(fractyl_dir, daemon->scrub, &options, &stats);
+    fractyl_lock_release(&lock);
+    
+    if (result != FRACTYL_OK) {
+        printf("[DAEMON] Scrub skipped: could not read the objects to check (%d)\n", result);
+    } else if (stats.pass_complete) {
+        printf("[DAEMON] Scrub pass complete: %zu objects, %zu problems\n", stats.total, stats.pass_problems);
+    }
+    fflush(stdout);
+}
+
+// Push to the remotes added with --auto-push once snapshots were taken
+// (or the daemon started).
+// The push runs in a child process, so a slow or unreachable remote never
+// holds up the next snapshot; one runs at a time, and a failed one is
+// tried again after the next cycle.
+static void attempt_push_step(daemon_state_t *daemon) {
+    if (daemon->push_pid > 0) {
+        int status;
+        pid_t done = waitpid(daemon->push_pid, &status, WNOHANG);
+        if (done == 0) return;
+        if (done < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            printf("[DAEMON] Push failed, trying again after the next cycle\n");
+            daemon->push_due = 1;
+        }
+        daemon->push_pid = 0;
+    }
+    
     fflush(stdout);
+    const char *fractyl_dir = daemon->config.fractyl_dir;
+    if (!daemon->push_due || remotes_auto_push_count(fractyl_dir) == 0) return;
+    pid_t pid = fork();
+    if (pid == 0) {
+        printf("[DAEMON] Pushing to the auto-push remotes\n");
+        size_t pushed;
+        int status = push_remotes(fractyl_dir, 1, &pushed);
+        fflush(stdout);
+        _exit(status);
+    }
+    if (pid > 0) {
+        daemon->push_pid = pid;
+        daemon->push_due = 0;
+    }
+}
+
+// Runs in each process that serves a CLI command, before the command: it
+// is the user's, not background work, and frac snapshot starts from the
+// daemon's index
+static void prepare_served_command(void *ctx) {
+    daemon_state_t *daemon = ctx;
+    schedule_restore_priority();
+    governor_set(NULL);
+    snapshot_command_warm(&daemon->warm);
+}
+
+// Work on daemon's repository from here on: its directory, as
+// snapshot_create() snapshots the working directory's repository, and its
+// daemon.log when it shares the process. Returns 0 or -1.
+static int daemon_enter(daemon_state_t *daemon) {
+    if (g_current == daemon) return 0;
+    
+    fflush(stdout);
+    fflush(stderr);
+    if (daemon->log_fd >= 0) {
+        dup2(daemon->log_fd, STDOUT_FILENO);
+        dup2(daemon->log_fd, STDERR_FILENO);
+    }
+    if (chdir(daemon->config.repo_root) != 0) {
+        printf("[DAEMON] Cannot enter %s: %s\n", daemon->config.repo_root, strerror(errno));
+        fflush(stdout);
+        g_current = NULL;
+        return -1;
+    }
+    g_current = daemon;
+    return 0;
+}
+
+// Wait up to timeout_ms, serving CLI commands meanwhile. Returns once a
+// watched repository has events to read, the time is up or the daemon is
+// stopping.
+static void daemon_wait(daemon_state_t *repos, size_t count, int timeout_ms) {
+    struct pollfd fds[2 * count];
+    daemon_state_t *owners[2 * count];
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    while (g_daemon_running) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= timeout_ms) return;
+        
+        nfds_t nfds = 0;
+        for (size_t i = 0; i < count; i++) {
+            int watch_fd = repos[i].watch ? repos[i].watch->fd : -1;
+            int fd_of[2] = { repos[i].listen_fd, watch_fd };
+            for (int j = 0; j < 2; j++) {
+                if (fd_of[j] < 0) continue;
+                fds[nfds].fd = fd_of[j];
+                fds[nfds].events = POLLIN;
+                fds[nfds].revents = 0;
+                owners[nfds++] = &repos[i];
+            }
+        }
+        int ready = poll(fds, nfds, (int)(timeout_ms - elapsed));
+        if (ready < 0 && errno != EINTR) return;
+        
+        int watched = 0;
+        for (nfds_t i = 0; ready > 0 && i < nfds; i++) {
+            if (!fds[i].revents) continue;
+            if (fds[i].fd != owners[i]->listen_fd) {
+                watched = 1;
+            } else if (daemon_enter(owners[i]) == 0) {
+                ipc_serve(owners[i]->listen_fd, prepare_served_command, owners[i]);
+            }
+        }
+        if (watched) return;
+    }
+}
+
+// Start watching daemon's repository, or leave it to periodic scans
+static void daemon_watch_start(daemon_state_t *daemon) {
+    fs_watch_t *watch = malloc(sizeof(fs_watch_t));
+    if (!watch || fs_watch_init(watch, daemon->config.repo_root) != FRACTYL_OK) {
+        free(watch);
+        printf("[DAEMON] Filesystem watch unavailable, falling back to periodic scans\n");
+        return;
+    }
+    printf("[DAEMON] Watching %zu directories for changes\n", watch->watch_count);
+    daemon->watch = watch;
 }
 
-// Main daemon loop (runs in child process)
-static void daemon_main_loop(daemon_state_t *daemon) {
+static void daemon_watch_stop(daemon_state_t *daemon) {
+    if (!daemon->watch) return;
+    fs_watch_free(daemon->watch);
+    free(daemon->watch);
+    daemon->watch = NULL;
+}
+
+// Watch mode: read the repository's events and note when changes came in
+static void daemon_watch_collect(daemon_state_t *daemon, time_t now) {
+    fs_watch_t *watch = daemon->watch;
+    int events = fs_watch_poll(watch, 0);
+    if (events < 0) {
+        watch->overflowed = 1;
+    }
+    if (watch->dirty_count > 0 || watch->overflowed) {
+        if (events != 0 || daemon->last_event == 0) daemon->last_event = now;
+        if (daemon->first_pending == 0) daemon->first_pending = now;
+    }
+}
+
+// Whether daemon's repository is due for a cycle. In watch mode changes
+// wait until they have been quiet for a while and the system is not busy
+// (schedule.h); the first scan, and a periodic one, is a full scan.
+static int daemon_due(daemon_state_t *daemon, time_t now) {
+    if (!daemon->watch || !daemon->baseline) return now >= daemon->next_scan;
+    
+    // The periodic consistency check waits its turn like a change
+    if (now >= daemon->next_scan && daemon->first_pending == 0) {
+        daemon->first_pending = daemon->last_event = now;
+    }
+    if (daemon->first_pending == 0) return 0;
+    
+    schedule_load_t load;
+    schedule_read_load(&load);
+    char reason[64];
+    int busy = schedule_busy(&daemon->schedule, &load, reason, sizeof(reason));
+    if (!schedule_watch_due(&daemon->schedule, now, daemon->first_pending, daemon->last_event,
+                            daemon->last_run, busy)) {
+        if (busy && !daemon->deferred && daemon_enter(daemon) == 0) {
+            printf("[DAEMON] Putting off snapshot: %s\n", reason);
+            fflush(stdout);
+            daemon->deferred = 1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+// Over the read budget, keep only the changes the cycle can read before the
+// next one may start; the rest stay queued for it. Returns how many of
+// paths to snapshot now.
+static size_t shed_changes(daemon_state_t *daemon, char **paths, size_t count) {
+    unsigned long long allowance = governor_cycle_allowance(daemon->schedule.min_interval);
+    if (allowance == 0) return count;
+    
+    unsigned long long total = 0;
+    size_t kept = 0;
+    for (; kept < count; kept++) {
+        char full_path[4096];
+        snprintf(full_path, sizeof(full_path), "%s/%s", daemon->config.repo_root, paths[kept]);
+        struct stat st;
+        unsigned long long size = 0;
+        if (lstat(full_path, &st) == 0 && S_ISREG(st.st_mode)) size = (unsigned long long)st.st_size;
+        if (kept > 0 && total + size > allowance) break;
+        total += size;
+    }
+    if (kept < count) {
+        fs_watch_requeue(daemon->watch, paths + kept, count - kept);
+        printf("[DAEMON] Over the read budget: leaving %zu of %zu changed paths for the next cycle\n",
+               count - kept, count);
+        fflush(stdout);
+    }
+    return kept;
+}
+
+// Watch mode: snapshot only the paths inotify reported, or everything when
+// a full scan is due or the event queue overflowed
+static void daemon_watch_cycle(daemon_state_t *daemon, time_t now) {
+    fs_watch_t *watch = daemon->watch;
+    int full_due = !daemon->baseline || now >= daemon->next_scan;
+    daemon->last_run = now;
+    daemon->first_pending = daemon->last_event = 0;
+    daemon->deferred = 0;
+    
+    char **paths = NULL;
+    size_t count = 0;
+    int overflowed = 0;
+    fs_watch_take(watch, &paths, &count, &overflowed);
+    
+    if (overflowed || full_due) {
+        // The first one is the baseline later events are relative to
+        if (daemon->baseline) {
+            printf("[DAEMON] %s, running full scan\n",
+                   overflowed ? "Event queue overflowed" : "Periodic consistency check");
+        }
+        if (overflowed && fs_watch_reset(watch) != FRACTYL_OK) {
+            fs_watch_free_paths(paths, count);
+            daemon_watch_stop(daemon);
+            printf("[DAEMON] Could not re-establish watches, falling back to periodic scans\n");
+            fflush(stdout);
+            daemon->next_scan = now;
+            return;
+        }
+        attempt_snapshot(daemon, NULL, 0);
+        daemon->baseline = 1;
+        daemon->next_scan = now + WATCH_FULL_RESCAN_INTERVAL;
+    } else if (count > 0) {
+        size_t now_count = shed_changes(daemon, paths, count);
+        if (attempt_snapshot(daemon, (const char *const *)paths, now_count) != 0) {
+            // Lock busy or scan failed: do not lose the changes
+            watch->overflowed = 1;
+        }
+    }
+    attempt_retention_step(daemon);
+    attempt_gc_step(daemon);
+    attempt_scrub_step(daemon);
+    attempt_push_step(daemon);
+    
+    fs_watch_free_paths(paths, count);
+}
+
+// Periodic mode: scan at the interval, less often while the system is
+// busy
+static void daemon_periodic_cycle(daemon_state_t *daemon) {
+    attempt_snapshot(daemon, NULL, 0);
+    attempt_retention_step(daemon);
+    attempt_gc_step(daemon);
+    attempt_scrub_step(daemon);
+    attempt_push_step(daemon);
+    daemon->baseline = 1;
+    
+    schedule_load_t load;
+    schedule_read_load(&load);
+    char reason[64];
+    int busy = schedule_busy(&daemon->schedule, &load, reason, sizeof(reason));
+    daemon->wait = schedule_next_wait(&daemon->schedule, daemon->config.snapshot_interval, daemon->wait, busy);
+    if (busy) {
+        printf("[DAEMON] System busy (%s), next scan in %u seconds\n", reason, daemon->wait);
+        fflush(stdout);
+    }
+    daemon->next_scan = time(NULL) + daemon->wait;
+}
+
+static long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Main daemon loop (runs in child process) over count repositories; home
+// has the settings of the process as a whole
+static void daemon_main_loop(daemon_state_t *repos, size_t count, const char *home) {
     // Set up signal handlers for graceful shutdown
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
     g_daemon_running = 1;
     
-    // Log startup information with timestamp
+    // Scans and hashing yield to interactive work and builds
+    schedule_policy_t process_policy;
+    schedule_policy_load(home, repos[0].config.snapshot_interval, &process_policy);
+    schedule_lower_priority(&process_policy);
+    governor_budget_t budget;
+    governor_budget_load(home, &budget);
+    governor_set(&budget);
+    long duty_cycle = config_get_long(home, "daemon.duty_cycle", DAEMON_DEFAULT_DUTY_CYCLE);
+    if (duty_cycle < 1) duty_cycle = 1;
+    if (duty_cycle > 100) duty_cycle = 100;
+    
     time_t start_time = time(NULL);
-    printf("[DAEMON] Started at %s", ctime(&start_time));
-    printf("[DAEMON] PID: %d\n", getpid());
-    printf("[DAEMON] Repository: %s\n", daemon->config.repo_root);
-    printf("[DAEMON] Snapshot interval: %u seconds\n", daemon->config.snapshot_interval);
-    printf("[DAEMON] Log file: %s/daemon.log\n", daemon->config.fractyl_dir);
-    fflush(stdout);
+    for (size_t i = 0; i < count; i++) {
+        daemon_state_t *daemon = &repos[i];
+        daemon_enter(daemon);
+        schedule_policy_load(daemon->config.fractyl_dir, daemon->config.snapshot_interval, &daemon->schedule);
+        
+        // Serve CLI commands from this process's caches, unless daemon.serve = 0
+        if (config_get_long(daemon->config.fractyl_dir, "daemon.serve", 1) != 0) {
+            daemon->listen_fd = ipc_listen(daemon->config.fractyl_dir);
+        }
+        
+        // Log startup information with timestamp
+        printf("[DAEMON] Started at %s", ctime(&start_time));
+        printf("[DAEMON] PID: %d\n", getpid());
+        printf("[DAEMON] Repository: %s\n", daemon->config.repo_root);
+        if (count > 1) {
+            printf("[DAEMON] Sharing the process with the other repositories in %s/repos (%zu in all)\n",
+                   home, count);
+        }
+        printf("[DAEMON] Snapshot interval: %u seconds (%u to %u)\n", daemon->config.snapshot_interval,
+               daemon->schedule.min_interval, daemon->schedule.max_interval);
+        printf("[DAEMON] Mode: %s\n", daemon->config.watch_mode ? "filesystem watch" : "periodic scan");
+        printf("[DAEMON] Log file: %s/daemon.log\n", daemon->config.fractyl_dir);
+        if (governor_budget_enabled(&budget)) {
+            printf("[DAEMON] Budget: read %ld MB/s, write %ld MB/s, %d hashing threads, %d%% CPU (0 = no limit)\n",
+                   budget.read_bytes_per_sec >> 20, budget.write_bytes_per_sec >> 20, budget.hash_threads,
+                   budget.cpu_percent);
+        }
+        if (daemon->listen_fd >= 0) {
+            printf("[DAEMON] Serving commands on %s/%s\n", daemon->config.fractyl_dir, IPC_SOCKET_NAME);
+        }
+        if (daemon->config.watch_mode) {
+            daemon_watch_start(daemon);
+        }
+        fflush(stdout);
+        
+        // Snapshots taken while the daemon was not running go out first
+        daemon->push_due = 1;
+        
+        // Spread the full scans of the repositories over the interval
+        daemon->next_scan = start_time + (time_t)(i * daemon->config.snapshot_interval / count);
+    }
     
-    // Main daemon loop - attempt snapshots at regular intervals
+    // Repositories take turns, so one with constant changes cannot starve
+    // the others, and the next cycle waits until the last one is paid for
+    size_t turn = 0;
+    long long budget_until = 0;
     while (g_daemon_running) {
-        attempt_snapshot(daemon);
+        daemon_wait(repos, count, 1000);
+        
+        time_t now = time(NULL);
+        for (size_t i = 0; i < count; i++) {
+            if (repos[i].watch) daemon_watch_collect(&repos[i], now);
+        }
+        if (monotonic_ms() < budget_until) continue;
         
-        // Sleep for the specified interval, but check for shutdown signal periodically
-        uint32_t remaining = daemon->config.snapshot_interval;
-        while (remaining > 0 && g_daemon_running) {
-            uint32_t sleep_time = remaining > 10 ? 10 : remaining;
-            sleep(sleep_time);
-            remaining -= sleep_time;
+        for (size_t k = 0; k < count; k++) {
+            daemon_state_t *daemon = &repos[(turn + k) % count];
+            if (!daemon_due(daemon, now)) continue;
+            turn = (turn + k + 1) % count;
+            if (daemon_enter(daemon) != 0) {
+                daemon->next_scan = now + daemon->config.snapshot_interval;
+                daemon->first_pending = daemon->last_event = 0;
+                break;
+            }
+            
+            long long started = monotonic_ms();
+            if (daemon->watch) {
+                daemon_watch_cycle(daemon, now);
+            } else {
+                daemon_periodic_cycle(daemon);
+            }
+            // Cycles take at most daemon.duty_cycle percent of the time
+            budget_until = started + (monotonic_ms() - started) * 100 / duty_cycle;
+            break;
         }
     }
     
-    printf("[DAEMON] Main loop exited\n");
+    for (size_t i = 0; i < count; i++) {
+        daemon_enter(&repos[i]);
+        daemon_watch_stop(&repos[i]);
+        ipc_unlisten(repos[i].listen_fd, repos[i].config.fractyl_dir);
+        repos[i].listen_fd = -1;
+        printf("[DAEMON] Main loop exited\n");
+        fflush(stdout);
+    }
 }
 
-// Start daemon in background
-int daemon_start_background(daemon_state_t *daemon) {
-    if (!daemon) return -1;
-    
-    // Check if another daemon is already running
-    pid_t existing_pid = read_pid_file(daemon->pid_file_path);
+// Refuse to start when pid_file_path names a running daemon, else remove
+// it if stale. Returns 0 or -1.
+static int check_not_running(const char *pid_file_path) {
+    pid_t existing_pid = read_pid_file(pid_file_path);
     if (existing_pid > 0 && is_process_running(existing_pid)) {
         printf("Error: Daemon already running (PID: %d)\n", existing_pid);
-        printf("PID file: %s\n", daemon->pid_file_path);
+        printf("PID file: %s\n", pid_file_path);
         return -1;
     }
     
     // Remove stale PID file if it exists
     if (existing_pid > 0) {
         printf("Removing stale PID file (PID %d no longer running)\n", existing_pid);
-        unlink(daemon->pid_file_path);
+        unlink(pid_file_path);
+    }
+    return 0;
+}
+
+// In the forked child: leave the terminal's session and write to log_path.
+// Exits if dir cannot be entered.
+static void detach(const char *dir, const char *log_path) {
+    // Create new session and process group
+    if (setsid() < 0) {
+        exit(1);
+    }
+    
+    // Change to the daemon's directory (not system root) to maintain context
+    if (chdir(dir) < 0) {
+        exit(1);
+    }
+    
+    // Close standard input
+    close(STDIN_FILENO);
+    
+    // Redirect stdin to /dev/null
+    int null_fd = open("/dev/null", O_RDONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        close(null_fd);
+    }
+    
+    // Redirect stdout and stderr to daemon log file
+    int log_fd = open(log_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (log_fd >= 0) {
+        dup2(log_fd, STDOUT_FILENO);
+        dup2(log_fd, STDERR_FILENO);
+        close(log_fd);
+    }
+}
+
+// Start daemon in background
+int daemon_start_background(daemon_state_t *daemon) {
+    if (!daemon) return -1;
+    
+    // Check if another daemon is already running
+    if (check_not_running(daemon->pid_file_path) != 0) {
+        return -1;
     }
     
-    // Fork to create daemon process
+    // Fork to create daemon process, with nothing left buffered for both
+    fflush(stdout);
     pid_t daemon_pid = fork();
     if (daemon_pid < 0) {
         printf("Error: Failed to fork daemon process: %s\n", strerror(errno));
@@ -183,36 +705,9 @@ int daemon_start_background(daemon_state_t *daemon) {
     
     if (daemon_pid == 0) {
         // Child process - become daemon
-        
-        // Create new session and process group
-        if (setsid() < 0) {
-            exit(1);
-        }
-        
-        // Change to repository root directory (not system root) to maintain context
-        if (chdir(daemon->config.repo_root) < 0) {
-            exit(1);
-        }
-        
-        // Close standard input
-        close(STDIN_FILENO);
-        
-        // Redirect stdin to /dev/null
-        int null_fd = open("/dev/null", O_RDONLY);
-        if (null_fd >= 0) {
-            dup2(null_fd, STDIN_FILENO);
-            close(null_fd);
-        }
-        
-        // Redirect stdout and stderr to daemon log file
         char log_path[2048];
         snprintf(log_path, sizeof(log_path), "%s/daemon.log", daemon->config.fractyl_dir);
-        int log_fd = open(log_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
-        if (log_fd >= 0) {
-            dup2(log_fd, STDOUT_FILENO);
-            dup2(log_fd, STDERR_FILENO);
-            close(log_fd);
-        }
+        detach(daemon->config.repo_root, log_path);
         
         // Update daemon config with new PID
         daemon->config.pid = getpid();
@@ -223,7 +718,7 @@ int daemon_start_background(daemon_state_t *daemon) {
         }
         
         // Run daemon main loop
-        daemon_main_loop(daemon);
+        daemon_main_loop(daemon, 1, daemon->config.fractyl_dir);
         
         // Cleanup on exit
         unlink(daemon->pid_file_path);
@@ -235,6 +730,85 @@ int daemon_start_background(daemon_state_t *daemon) {
     }
 }
 
+// Start one daemon for all of host's repositories
+int daemon_host_start_background(daemon_host_t *host, uint32_t interval, int watch_mode) {
+    if (!host || host->count == 0) return -1;
+    
+    char pid_file_path[2048];
+    snprintf(pid_file_path, sizeof(pid_file_path), "%s/daemon.pid", host->home);
+    if (check_not_running(pid_file_path) != 0) {
+        return -1;
+    }
+    
+    // Leave repositories with a daemon of their own to it, moving them past
+    // the ones kept here
+    size_t kept = 0;
+    for (size_t i = 0; i < host->count; i++) {
+        daemon_state_t *daemon = &host->repos[i];
+        pid_t existing_pid = read_pid_file(daemon->pid_file_path);
+        if (existing_pid > 0 && is_process_running(existing_pid)) {
+            printf("Skipping %s: daemon already running (PID: %d)\n", daemon->config.repo_root, existing_pid);
+            continue;
+        }
+        if (interval > 0) {
+            daemon_set_interval(daemon, interval);
+        }
+        daemon_set_watch_mode(daemon, watch_mode);
+        
+        daemon_state_t moved = host->repos[kept];
+        host->repos[kept++] = *daemon;
+        *daemon = moved;
+    }
+    if (kept == 0) {
+        printf("Error: Every listed repository already has a daemon\n");
+        return -1;
+    }
+    
+    fflush(stdout);
+    pid_t daemon_pid = fork();
+    if (daemon_pid < 0) {
+        printf("Error: Failed to fork daemon process: %s\n", strerror(errno));
+        return -1;
+    }
+    
+    if (daemon_pid == 0) {
+        char log_path[2048];
+        snprintf(log_path, sizeof(log_path), "%s/daemon.log", host->home);
+        detach(host->home, log_path);
+        
+        if (write_pid_file(pid_file_path, getpid()) != 0) {
+            exit(1);
+        }
+        
+        // Each repository logs to its own daemon.log and names this process
+        // in its daemon.pid, for frac daemon status and the CLI (ipc.h)
+        time_t start_time = time(NULL);
+        printf("[DAEMON] Started at %s", ctime(&start_time));
+        printf("[DAEMON] PID: %d\n", getpid());
+        for (size_t i = 0; i < kept; i++) {
+            daemon_state_t *daemon = &host->repos[i];
+            daemon->config.pid = getpid();
+            snprintf(log_path, sizeof(log_path), "%s/daemon.log", daemon->config.fractyl_dir);
+            daemon->log_fd = open(log_path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+            write_pid_file(daemon->pid_file_path, daemon->config.pid);
+            printf("[DAEMON] Repository: %s\n", daemon->config.repo_root);
+        }
+        fflush(stdout);
+        
+        daemon_main_loop(host->repos, kept, host->home);
+        
+        for (size_t i = 0; i < kept; i++) {
+            unlink(host->repos[i].pid_file_path);
+        }
+        unlink(pid_file_path);
+        exit(0);
+    } else {
+        printf("Daemon started successfully (PID: %d)\n", daemon_pid);
+        printf("Repositories: %zu\n", kept);
+        return 0;
+    }
+}
+
 // Stop daemon
 int daemon_stop(const char *fractyl_dir) {
     if (!fractyl_dir) return -1;
@@ -316,6 +890,12 @@ void daemon_set_interval(daemon_state_t *daemon, uint32_t seconds) {
     daemon->config.snapshot_interval = seconds;
 }
 
+// Enable or disable filesystem-watch mode
+void daemon_set_watch_mode(daemon_state_t *daemon, int enabled) {
+    if (!daemon) return;
+    daemon->config.watch_mode = enabled ? 1 : 0;
+}
+
 // Cleanup daemon resources
 void daemon_cleanup(daemon_state_t *daemon) {
     if (!daemon) return;
@@ -325,6 +905,112 @@ void daemon_cleanup(daemon_state_t *daemon) {
     free(daemon->config.fractyl_dir);
     free(daemon->git_branch);
     free(daemon->pid_file_path);
+    gc_state_free(daemon->gc);
+    fsck_scrub_free(daemon->scrub);
+    snapshot_warm_free(&daemon->warm);
+    if (daemon->watch) {
+        fs_watch_free(daemon->watch);
+        free(daemon->watch);
+    }
+    if (daemon->log_fd >= 0) {
+        close(daemon->log_fd);
+    }
     
     memset(daemon, 0, sizeof(daemon_state_t));
+}
+
+// Directory of the multi-repository daemon
+char *daemon_host_home(void) {
+    const char *home = getenv("FRACTYL_DAEMON_HOME");
+    if (home && *home) return strdup(home);
+    
+    char path[2048];
+    const char *config_home = getenv("XDG_CONFIG_HOME");
+    const char *user_home = getenv("HOME");
+    if (config_home && *config_home) {
+        snprintf(path, sizeof(path), "%s/fractyl", config_home);
+    } else if (user_home && *user_home) {
+        snprintf(path, sizeof(path), "%s/.config/fractyl", user_home);
+    } else {
+        return NULL;
+    }
+    return strdup(path);
+}
+
+// Read the repository list in home
+int daemon_host_init(daemon_host_t *host, const char *home) {
+    if (!host || !home) return -1;
+    
+    memset(host, 0, sizeof(daemon_host_t));
+    host->home = strdup(home);
+    
+    char list_path[2048];
+    snprintf(list_path, sizeof(list_path), "%s/repos", home);
+    FILE *f = fopen(list_path, "r");
+    if (!f) {
+        printf("Error: Cannot read %s: %s\n", list_path, strerror(errno));
+        return -1;
+    }
+    
+    char line[2048];
+    size_t capacity = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *start = line;
+        while (*start == ' ' || *start == '\t') start++;
+        char *end = start + strlen(start);
+        while (end > start && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) {
+            *--end = '\0';
+        }
+        if (*start == '\0' || *start == '#') continue;
+        
+        // Relative paths are relative to home
+        char path[4096];
+        if (*start == '/') {
+            snprintf(path, sizeof(path), "%s", start);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s", home, start);
+        }
+        char *root = fractyl_find_repo_root(path);
+        if (!root) {
+            printf("Warning: %s is not in a fractyl repository, skipping\n", start);
+            continue;
+        }
+        
+        int listed = 0;
+        for (size_t i = 0; i < host->count && !listed; i++) {
+            listed = strcmp(host->repos[i].config.repo_root, root) == 0;
+        }
+        if (!listed && host->count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 8;
+            daemon_state_t *repos = realloc(host->repos, new_capacity * sizeof(daemon_state_t));
+            if (!repos) {
+                free(root);
+                break;
+            }
+            host->repos = repos;
+            capacity = new_capacity;
+        }
+        if (!listed && daemon_init(&host->repos[host->count], root) == 0) {
+            host->count++;
+        }
+        free(root);
+    }
+    fclose(f);
+    
+    if (host->count == 0) {
+        printf("Error: No fractyl repositories listed in %s\n", list_path);
+        return -1;
+    }
+    return 0;
+}
+
+void daemon_host_cleanup(daemon_host_t *host) {
+    if (!host) return;
+    
+    for (size_t i = 0; i < host->count; i++) {
+        daemon_cleanup(&host->repos[i]);
+    }
+    free(host->repos);
+    free(host->home);
+    memset(host, 0, sizeof(daemon_host_t));
 }
\ No newline at end of file
@@ -1,7 +1,11 @@
 #ifndef FRACTYL_DAEMON_STANDALONE_H
 #define FRACTYL_DAEMON_STANDALONE_H
 
+#include "../include/commands.h"
+#include "schedule.h"
+#include "watch.h"
 #include <stdint.h>
+#include <time.h>
 #include <sys/types.h>
 
 // Daemon configuration
@@ -9,17 +13,56 @@ typedef struct {
     char *fractyl_dir;
     char *repo_root;
     uint32_t snapshot_interval;
+    int watch_mode;     // Use filesystem events instead of full rescans
     int running;
     pid_t pid;
 } daemon_config_t;
 
+struct gc_state;
+struct fsck_scrub;
+
 // Daemon state
 typedef struct {
     daemon_config_t config;
     char *pid_file_path;
     char *git_branch;
+    struct gc_state *gc;    // Incremental garbage collection, one step per cycle
+    struct fsck_scrub *scrub; // Scrub pass in progress, one slice per cycle
+    snapshot_warm_t warm;   // Last cycle's index and ignore rules, for the next
+    schedule_policy_t schedule;
+    int listen_fd;          // CLI commands served from this process (ipc.h), -1 if not
+    int log_fd;             // This repository's daemon.log when it shares the process, else -1
+    pid_t push_pid;         // Push to the auto-push remotes under way, 0 if none
+    int push_due;           // Snapshots were taken since the last push started
+    
+    // Main loop state
+    fs_watch_t *watch;      // Watch mode, NULL while scanning periodically
+    int baseline;           // A full scan has run since the daemon started
+    time_t next_scan;       // When the next full scan is due
+    uint32_t wait;          // Last wait between periodic scans
+    time_t last_run;
+    time_t first_pending;   // Watch mode: first and last change not yet snapshotted
+    time_t last_event;
+    int deferred;
 } daemon_state_t;
 
+// Several repositories kept by one daemon process (frac daemon start --all).
+// They share its scan and hash threads, since it snapshots one repository
+// at a time, and its time budget (daemon.duty_cycle); their full scans are
+// staggered across the interval. Each keeps its own state, daemon.pid,
+// daemon.log and socket.
+//
+// The home directory (daemon_host_home()) lists the repositories in a file
+// named "repos", one path per line, '#' starting a comment. Its config
+// file holds the settings of the process as a whole (daemon.duty_cycle,
+// daemon.nice, daemon.io_idle and the budgets of governor.h); the
+// daemon.pid and daemon.log of the process are written there too.
+typedef struct {
+    char *home;
+    daemon_state_t *repos;
+    size_t count;
+} daemon_host_t;
+
 // Initialize daemon
 int daemon_init(daemon_state_t *daemon, const char *repo_root);
 
@@ -35,7 +78,25 @@ int daemon_status(const char *fractyl_dir, pid_t *daemon_pid);
 // Set snapshot interval
 void daemon_set_interval(daemon_state_t *daemon, uint32_t seconds);
 
+// Enable or disable filesystem-watch mode
+void daemon_set_watch_mode(daemon_state_t *daemon, int enabled);
+
 // Cleanup daemon resources
 void daemon_cleanup(daemon_state_t *daemon);
 
+// Directory of the multi-repository daemon: $FRACTYL_DAEMON_HOME, else
+// $XDG_CONFIG_HOME/fractyl, else ~/.config/fractyl. Caller frees.
+char *daemon_host_home(void);
+
+// Read the repository list in home. Paths that are not fractyl repositories
+// are reported and left out. Returns 0, or -1 when none is left.
+int daemon_host_init(daemon_host_t *host, const char *home);
+
+// Start one daemon for all of host's repositories, each with the given
+// interval and mode. Repositories that have a daemon of their own are
+// left to it.
+int daemon_host_start_background(daemon_host_t *host, uint32_t interval, int watch_mode);
+
+void daemon_host_cleanup(daemon_host_t *host);
+
 #endif // FRACTYL_DAEMON_STANDALONE_H
\ No newline at end of file
@@ -0,0 +1,430 @@
+#define _GNU_SOURCE  // For accept4(), struct ucred and clearenv()
+#include "ipc.h"
+#include "daemon_standalone.h"
+#include "../include/commands.h"
+#include "../include/fractyl.h"
+#include "../utils/cli.h"
+#include "../utils/counters.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+#define IPC_MAGIC "FIPC"
+#define IPC_VERSION 1
+#define IPC_MAX_REQUEST (1 << 20)
+#define IPC_MAX_STRINGS 8192
+#define IPC_READY 'R'
+#define IPC_GO 'G'
+
+// Request header, followed by size bytes of NUL-terminated strings: the
+// working directory, argc arguments and envc environment entries
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t argc;
+    uint32_t envc;
+    uint32_t size;
+} ipc_header_t;
+
+static const struct {
+    const char *name;
+    ipc_command_fn fn;
+} served_commands[] = {
+    { "snapshot", cmd_snapshot },
+    { "list", cmd_list },
+    { "diff", cmd_diff },
+    { "show", cmd_show },
+    { "stats", cmd_stats },
+};
+
+ipc_command_fn ipc_served_command(const char *name) {
+    if (!name) return NULL;
+    for (size_t i = 0; i < sizeof(served_commands) / sizeof(served_commands[0]); i++) {
+        if (strcmp(served_commands[i].name, name) == 0) return served_commands[i].fn;
+    }
+    return NULL;
+}
+
+static int socket_address(const char *fractyl_dir, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int len = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s", fractyl_dir, IPC_SOCKET_NAME);
+    return len > 0 && (size_t)len < sizeof(addr->sun_path) ? FRACTYL_OK : FRACTYL_ERROR_PATH_TOO_LONG;
+}
+
+static int send_all(int fd, const void *data, size_t size) {
+    const char *p = data;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FRACTYL_ERROR_IO;
+        p += n;
+        size -= (size_t)n;
+    }
+    return FRACTYL_OK;
+}
+
+static int recv_all(int fd, void *data, size_t size) {
+    char *p = data;
+    while (size > 0) {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FRACTYL_ERROR_IO;
+        p += n;
+        size -= (size_t)n;
+    }
+    return FRACTYL_OK;
+}
+
+int ipc_listen(const char *fractyl_dir) {
+    struct sockaddr_un addr;
+    if (!fractyl_dir || socket_address(fractyl_dir, &addr) != FRACTYL_OK) return -1;
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    
+    // Left behind by a daemon that did not exit cleanly
+    unlink(addr.sun_path);
+    mode_t old_mask = umask(077);
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (bound != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void ipc_unlisten(int listen_fd, const char *fractyl_dir) {
+    if (listen_fd < 0) return;
+    close(listen_fd);
+    
+    struct sockaddr_un addr;
+    if (fractyl_dir && socket_address(fractyl_dir, &addr) == FRACTYL_OK) {
+        unlink(addr.sun_path);
+    }
+}
+
+// The request and the client's three descriptors. On success *strings
+// holds the working directory, then argv, then the environment.
+static int read_request(int conn, ipc_header_t *header, char **strings, int fds[3]) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct iovec iov = { header, sizeof(*header) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    
+    int received = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            received = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(fds, CMSG_DATA(cmsg), (size_t)received * sizeof(int));
+        }
+    }
+    if (n != (ssize_t)sizeof(*header) || received != 3 || (msg.msg_flags & MSG_CTRUNC) ||
+        memcmp(header->magic, IPC_MAGIC, 4) != 0 || header->version != IPC_VERSION ||
+        header->argc == 0 || header->argc + header->envc >= IPC_MAX_STRINGS ||
+        header->size == 0 || header->size > IPC_MAX_REQUEST) {
+        for (int i = 0; i < received; i++) close(fds[i]);
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    *strings = malloc(header->size);
+    if (!*strings || recv_all(conn, *strings, header->size) != FRACTYL_OK ||
+        (*strings)[header->size - 1] != '\0') {
+        free(*strings);
+        *strings = NULL;
+        for (int i = 0; i < 3; i++) close(fds[i]);
+        return FRACTYL_ERROR_IO;
+    }
+    return FRACTYL_OK;
+}
+
+// Split the request's strings; NULL unless there are exactly as many as
+// the header says. vector[0] is the working directory, argv follows,
+// NULL-terminated, then the environment, NULL-terminated.
+static char** split_strings(const ipc_header_t *header, char *strings) {
+    size_t expected = 1 + (size_t)header->argc + header->envc;
+    size_t found = 0;
+    for (uint32_t i = 0; i < header->size; i++) {
+        if (strings[i] == '\0') found++;
+    }
+    if (found != expected) return NULL;
+    
+    char **vector = malloc((expected + 2) * sizeof(char *));
+    if (!vector) return NULL;
+    size_t slot = 0;
+    char *p = strings;
+    for (size_t i = 0; i < expected; i++) {
+        vector[slot++] = p;
+        if (i == header->argc) vector[slot++] = NULL;
+        p += strlen(p) + 1;
+    }
+    vector[slot] = NULL;
+    return vector;
+}
+
+// Runs in the process that answers the client: start the command with the
+// client's descriptors, wait for it, and report how it ended. A client
+// that hangs up stops the command.
+static void supervise(int conn, int fds[3], char **vector, int argc, ipc_command_fn fn,
+                      void (*prepare)(void *ctx), void *ctx) {
+    pid_t child = fork();
+    if (child == 0) {
+        close(conn);
+        for (int i = 0; i < 3; i++) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        if (prepare) prepare(ctx);
+        if (chdir(vector[0]) != 0) {
+            printf("Error: Cannot change to %s: %s\n", vector[0], strerror(errno));
+            exit(1);
+        }
+        clearenv();
+        for (char **env = vector + argc + 2; *env; env++) putenv(*env);
+    
+        // The command counts towards the repository as it would run by
+        // itself; what the daemon had counted is the daemon's to add
+        counters_t inherited;
+        counters_take(&inherited);
+        int result = fn(argc, vector + 1);
+        char *repo_root = fractyl_find_repo_root(NULL);
+        if (repo_root) {
+            char fractyl_dir[2048];
+            snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+            counters_flush(fractyl_dir, NULL);
+            free(repo_root);
+        }
+        fflush(NULL);
+        exit(result);
+    }
+    for (int i = 0; i < 3; i++) close(fds[i]);
+    
+    int wstatus = 0;
+    int32_t status = 1;
+    if (child > 0) {
+        while (waitpid(child, &wstatus, WNOHANG) == 0) {
+            struct pollfd pfd = { conn, POLLIN, 0 };
+            char byte;
+            if (poll(&pfd, 1, 100) > 0 && recv(conn, &byte, 1, MSG_DONTWAIT) == 0) {
+                kill(child, SIGTERM);
+                waitpid(child, &wstatus, 0);
+                return;
+            }
+        }
+        if (WIFEXITED(wstatus)) status = WEXITSTATUS(wstatus);
+        else if (WIFSIGNALED(wstatus)) status = 128 + WTERMSIG(wstatus);
+    }
+    send_all(conn, &status, sizeof(status));
+}
+
+int ipc_serve(int listen_fd, void (*prepare)(void *ctx), void *ctx) {
+    int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (conn < 0) return FRACTYL_ERROR_IO;
+
+#ifdef SO_PEERCRED
+    // Only the daemon's own user may run commands through it
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 || cred.uid != getuid()) {
+        close(conn);
+        return FRACTYL_ERROR_PERMISSION_DENIED;
+    }
+#endif
+
+    // A client that stalls mid-request must not hold up the daemon
+    struct timeval timeout = { 1, 0 };
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    ipc_header_t header;
+    char *strings = NULL;
+    int fds[3];
+    int result = read_request(conn, &header, &strings, fds);
+    if (result != FRACTYL_OK) {
+        close(conn);
+        return result;
+    }
+    
+    char **vector = split_strings(&header, strings);
+    cli_options_t opts;
+    ipc_command_fn fn = NULL;
+    if (vector) {
+        parse_cli_args((int)header.argc, vector + 1, &opts);
+        if (!opts.help && !opts.version) fn = ipc_served_command(opts.command);
+    }
+    
+    char reply = IPC_READY;
+    char go = 0;
+    result = FRACTYL_ERROR_INVALID_ARGS;
+    if (fn && send_all(conn, &reply, 1) == FRACTYL_OK && recv_all(conn, &go, 1) == FRACTYL_OK && go == IPC_GO) {
+        // The command runs in a grandchild, so the daemon only waits for
+        // the fork in between
+        printf("[DAEMON] Running '%s' for a client\n", opts.command);
+        fflush(stdout);
+        fflush(stderr);
+        pid_t middle = fork();
+        if (middle == 0) {
+            close(listen_fd);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            timeout.tv_sec = 0;
+            setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if (fork() == 0) {
+                supervise(conn, fds, vector, (int)header.argc, fn, prepare, ctx);
+            }
+            _exit(0);
+        }
+        if (middle > 0) {
+            waitpid(middle, NULL, 0);
+            result = FRACTYL_OK;
+        } else {
+            result = FRACTYL_ERROR_IO;
+        }
+    }
+    
+    for (int i = 0; i < 3; i++) close(fds[i]);
+    free(vector);
+    free(strings);
+    close(conn);
+    return result;
+}
+
+static int connect_daemon(void) {
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) return -1;
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    free(repo_root);
+    
+    struct sockaddr_un addr;
+    if (daemon_status(fractyl_dir, NULL) != 1 || socket_address(fractyl_dir, &addr) != FRACTYL_OK) return -1;
+    
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int send_request(int fd, int argc, char **argv) {
+    char *cwd = getcwd(NULL, 0);
+    if (!cwd) return FRACTYL_ERROR_IO;
+    
+    size_t envc = 0;
+    size_t size = strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++) size += strlen(argv[i]) + 1;
+    for (char **env = environ; env && *env; env++, envc++) size += strlen(*env) + 1;
+    if (size > IPC_MAX_REQUEST || argc + envc >= IPC_MAX_STRINGS) {
+        free(cwd);
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    char *strings = malloc(size);
+    if (!strings) {
+        free(cwd);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    char *p = stpcpy(strings, cwd) + 1;
+    for (int i = 0; i < argc; i++) p = stpcpy(p, argv[i]) + 1;
+    for (char **env = environ; env && *env; env++) p = stpcpy(p, *env) + 1;
+    free(cwd);
+    
+    ipc_header_t header;
+    memcpy(header.magic, IPC_MAGIC, 4);
+    header.version = IPC_VERSION;
+    header.argc = (uint32_t)argc;
+    header.envc = (uint32_t)envc;
+    header.size = (uint32_t)size;
+    
+    // stdin, stdout and stderr travel with the header
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = { &header, sizeof(header) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    
+    ssize_t n;
+    do {
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    int result = n == (ssize_t)sizeof(header) ? send_all(fd, strings, size) : FRACTYL_ERROR_IO;
+    free(strings);
+    return result;
+}
+
+int ipc_forward(int argc, char **argv, int *status) {
+    if (argc < 1 || !argv || !status) return FRACTYL_ERROR_INVALID_ARGS;
+    const char *disabled = getenv("FRACTYL_NO_DAEMON");
+    if (disabled && *disabled && strcmp(disabled, "0") != 0) return FRACTYL_ERROR_INVALID_STATE;
+    
+    int fd = connect_daemon();
+    if (fd < 0) return FRACTYL_ERROR_NOT_FOUND;
+    
+    // Output already buffered must come before the command's
+    fflush(stdout);
+    fflush(stderr);
+    
+    int result = send_request(fd, argc, argv);
+    if (result == FRACTYL_OK) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        char reply = 0;
+        int ready;
+        do {
+            ready = poll(&pfd, 1, IPC_READY_TIMEOUT_MS);
+        } while (ready < 0 && errno == EINTR);
+        if (ready <= 0 || recv_all(fd, &reply, 1) != FRACTYL_OK || reply != IPC_READY) {
+            // Busy or refused: the command has not run, so run it here
+            result = FRACTYL_ERROR_INVALID_STATE;
+        }
+    }
+    if (result != FRACTYL_OK) {
+        close(fd);
+        return result;
+    }
+    
+    // From here on the command is the daemon's to run
+    char go = IPC_GO;
+    int32_t code;
+    if (send_all(fd, &go, 1) != FRACTYL_OK || recv_all(fd, &code, sizeof(code)) != FRACTYL_OK) {
+        printf("Error: The daemon stopped before the command finished\n");
+        code = 1;
+    }
+    close(fd);
+    *status = code;
+    return FRACTYL_OK;
+}
@@ -0,0 +1,48 @@
+#ifndef FRACTYL_IPC_H
+#define FRACTYL_IPC_H
+
+#include <stddef.h>
+
+// CLI commands served by a running daemon
+//
+// The daemon listens on .fractyl/daemon.sock. A frac process whose command
+// it serves (ipc_served_command()) finds the daemon through its pid file,
+// connects, and sends its argv, working directory and environment with its
+// stdin, stdout and stderr attached (SCM_RIGHTS). The daemon answers READY
+// once it has read the request, the client confirms with GO, and the
+// daemon forks a process that runs the command on the client's terminal
+// with the daemon's caches already loaded, then reports the exit status.
+//
+// The client only waits IPC_READY_TIMEOUT_MS for READY, which a daemon in
+// the middle of a snapshot cannot send; it then hangs up and runs the
+// command itself. Nothing runs until the client's GO, so a command is never
+// run twice. Closing the connection (the client interrupted) stops the
+// command. FRACTYL_NO_DAEMON=1 in the environment keeps the client from
+// connecting; daemon.serve = 0 in .fractyl/config keeps the daemon from
+// listening.
+
+#define IPC_SOCKET_NAME "daemon.sock"
+#define IPC_READY_TIMEOUT_MS 250
+
+typedef int (*ipc_command_fn)(int argc, char **argv);
+
+// The handler of a command the daemon serves, NULL for the others
+ipc_command_fn ipc_served_command(const char *name);
+
+// Daemon side: listen on fractyl_dir's socket, replacing a stale one.
+// Returns the listening descriptor or -1.
+int ipc_listen(const char *fractyl_dir);
+void ipc_unlisten(int listen_fd, const char *fractyl_dir);
+
+// Accept one connection and start its command. prepare runs in the
+// process that runs the command, before it does. Returns FRACTYL_OK or an
+// error when the request was refused; the daemon goes on either way.
+int ipc_serve(int listen_fd, void (*prepare)(void *ctx), void *ctx);
+
+// CLI side: run argv through the daemon of the repository containing the
+// working directory. Returns FRACTYL_OK with the command's exit status in
+// *status, or an error when no daemon took the command and the caller
+// should run it itself.
+int ipc_forward(int argc, char **argv, int *status);
+
+#endif // FRACTYL_IPC_H
@@ -0,0 +1,103 @@
+#include "schedule.h"
+#include "../utils/config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// ioprio_set(2) has no libc wrapper
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+void schedule_policy_load(const char *fractyl_dir, uint32_t interval, schedule_policy_t *policy) {
+    long min_interval = config_get_long(fractyl_dir, "daemon.min_interval", interval);
+    long max_interval = config_get_long(fractyl_dir, "daemon.max_interval", 4L * interval);
+    if (min_interval < 1) min_interval = 1;
+    if (max_interval < min_interval) max_interval = min_interval;
+    long quiet_period = config_get_long(fractyl_dir, "daemon.quiet_period", SCHEDULE_DEFAULT_QUIET_PERIOD);
+    
+    policy->min_interval = (uint32_t)min_interval;
+    policy->max_interval = (uint32_t)max_interval;
+    policy->quiet_period = quiet_period > 0 ? (uint32_t)quiet_period : 0;
+    policy->max_load = config_get_long(fractyl_dir, "daemon.max_load", SCHEDULE_DEFAULT_MAX_LOAD);
+    policy->max_io_pressure = config_get_long(fractyl_dir, "daemon.max_io_pressure",
+                                              SCHEDULE_DEFAULT_MAX_IO_PRESSURE);
+    policy->nice = (int)config_get_long(fractyl_dir, "daemon.nice", SCHEDULE_DEFAULT_NICE);
+    policy->io_idle = config_get_long(fractyl_dir, "daemon.io_idle", 1) != 0;
+}
+
+void schedule_read_load(schedule_load_t *load) {
+    load->load = -1;
+    load->io_pressure = -1;
+    
+    double averages[1];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (getloadavg(averages, 1) == 1 && cpus > 0) {
+        load->load = (long)(averages[0] * 100 / cpus);
+    }
+    
+    // "some avg10=1.23 avg60=... total=..." on the first line
+    FILE *fp = fopen("/proc/pressure/io", "r");
+    if (fp) {
+        double avg10;
+        if (fscanf(fp, "some avg10=%lf", &avg10) == 1) {
+            load->io_pressure = (long)avg10;
+        }
+        fclose(fp);
+    }
+}
+
+int schedule_busy(const schedule_policy_t *policy, const schedule_load_t *load, char *reason, size_t size) {
+    if (policy->max_load > 0 && load->load > policy->max_load) {
+        if (reason) snprintf(reason, size, "load %ld%% per CPU", load->load);
+        return 1;
+    }
+    if (policy->max_io_pressure > 0 && load->io_pressure > policy->max_io_pressure) {
+        if (reason) snprintf(reason, size, "I/O pressure %ld%%", load->io_pressure);
+        return 1;
+    }
+    return 0;
+}
+
+int schedule_watch_due(const schedule_policy_t *policy, time_t now, time_t first_pending, time_t last_event,
+                       time_t last_run, int busy) {
+    if (first_pending == 0) return 0;
+    // Changes are never left waiting longer than this, busy or not
+    if (now - first_pending >= (time_t)policy->max_interval) return 1;
+    if (now - last_run < (time_t)policy->min_interval) return 0;
+    if (now - last_event < (time_t)policy->quiet_period) return 0;
+    return !busy;
+}
+
+uint32_t schedule_next_wait(const schedule_policy_t *policy, uint32_t interval, uint32_t last_wait, int busy) {
+    uint32_t base = interval;
+    if (base < policy->min_interval) base = policy->min_interval;
+    if (base > policy->max_interval) base = policy->max_interval;
+    if (!busy) return base;
+    
+    uint64_t wait = 2ULL * (last_wait > base ? last_wait : base);
+    return wait > policy->max_interval ? policy->max_interval : (uint32_t)wait;
+}
+
+void schedule_lower_priority(const schedule_policy_t *policy) {
+    if (policy->nice > getpriority(PRIO_PROCESS, 0)) {
+        setpriority(PRIO_PROCESS, 0, policy->nice);
+    }
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    if (policy->io_idle) {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    }
+#endif
+}
+
+void schedule_restore_priority(void) {
+    setpriority(PRIO_PROCESS, 0, 0);
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, 0);
+#endif
+}
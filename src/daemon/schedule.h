@@ -0,0 +1,74 @@
+#ifndef FRACTYL_SCHEDULE_H
+#define FRACTYL_SCHEDULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// When the daemon snapshots
+//
+// In watch mode a cycle waits for a quiet period after the last event, so
+// a burst of writes (a build, a checkout) becomes one snapshot taken once
+// it settles, and cycles are at least min_interval apart. While the system
+// is busy, by load average or I/O pressure, cycles are put off, but never
+// past max_interval after the first pending change. In periodic mode the
+// wait between scans doubles while the system is busy, up to max_interval,
+// and drops back to the base interval once it is not.
+//
+// All of it comes from .fractyl/config: daemon.min_interval and
+// daemon.max_interval (seconds), daemon.quiet_period (seconds),
+// daemon.max_load (1-minute load average per CPU, in percent),
+// daemon.max_io_pressure (share of time tasks waited on I/O over the last
+// 10 seconds, in percent, where /proc/pressure/io exists), daemon.nice and
+// daemon.io_idle (idle I/O class for the daemon's reads and hashing).
+
+#define SCHEDULE_DEFAULT_QUIET_PERIOD 5
+#define SCHEDULE_DEFAULT_MAX_LOAD 100           // Percent of one task per CPU
+#define SCHEDULE_DEFAULT_MAX_IO_PRESSURE 20     // Percent
+#define SCHEDULE_DEFAULT_NICE 10
+
+typedef struct {
+    uint32_t min_interval;
+    uint32_t max_interval;
+    uint32_t quiet_period;
+    long max_load;              // 0: load is not checked
+    long max_io_pressure;       // 0: pressure is not checked
+    int nice;
+    int io_idle;
+} schedule_policy_t;
+
+// The policy from .fractyl/config; interval (the daemon's snapshot
+// interval) is the default minimum, and four times it the maximum
+void schedule_policy_load(const char *fractyl_dir, uint32_t interval, schedule_policy_t *policy);
+
+// How loaded the system is now
+typedef struct {
+    long load;                  // 1-minute load average per CPU, percent; -1 if unknown
+    long io_pressure;           // Percent, -1 if unknown
+} schedule_load_t;
+
+void schedule_read_load(schedule_load_t *load);
+
+// Whether load is past the policy's limits; reason, when not NULL,
+// receives which one
+int schedule_busy(const schedule_policy_t *policy, const schedule_load_t *load, char *reason, size_t size);
+
+// Watch mode: whether to snapshot now, given when the first pending
+// change and the last event arrived (0 when none is pending) and when the
+// last cycle ran
+int schedule_watch_due(const schedule_policy_t *policy, time_t now, time_t first_pending, time_t last_event,
+                       time_t last_run, int busy);
+
+// Periodic mode: seconds to wait after a cycle, from the last wait (0
+// for the first) and whether the system is busy
+uint32_t schedule_next_wait(const schedule_policy_t *policy, uint32_t interval, uint32_t last_wait, int busy);
+
+// Lower the calling process's CPU and I/O priority as configured; threads
+// created afterwards inherit it
+void schedule_lower_priority(const schedule_policy_t *policy);
+
+// Undo it as far as an unprivileged process may: the I/O class always, the
+// nice value only where RLIMIT_NICE allows
+void schedule_restore_priority(void);
+
+#endif // FRACTYL_SCHEDULE_H
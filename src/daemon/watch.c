@@ -0,0 +1,394 @@
+#include "watch.h"
+#include "../include/fractyl.h"
+#include "../utils/git.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#ifdef __linux__
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | \
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_EXCL_UNLINK)
+
+static void mark_dirty(fs_watch_t *watch, const char *rel_path) {
+    if (watch->overflowed) return;
+    
+    if (watch->dirty_count >= FS_WATCH_MAX_DIRTY) {
+        // Too much churn to track path by path
+        watch->overflowed = 1;
+        return;
+    }
+    
+    if (watch->dirty_count == watch->dirty_capacity) {
+        size_t new_capacity = watch->dirty_capacity ? watch->dirty_capacity * 2 : 64;
+        char **new_dirty = realloc(watch->dirty, new_capacity * sizeof(char*));
+        if (!new_dirty) {
+            watch->overflowed = 1;
+            return;
+        }
+        watch->dirty = new_dirty;
+        watch->dirty_capacity = new_capacity;
+    }
+    
+    char *copy = strdup(rel_path);
+    if (!copy) {
+        watch->overflowed = 1;
+        return;
+    }
+    watch->dirty[watch->dirty_count++] = copy;
+}
+
+static int remember_wd(fs_watch_t *watch, int wd, const char *rel_path) {
+    if (wd >= watch->wd_capacity) {
+        int new_capacity = watch->wd_capacity ? watch->wd_capacity : 256;
+        while (new_capacity <= wd) new_capacity *= 2;
+        
+        char **new_paths = realloc(watch->wd_paths, new_capacity * sizeof(char*));
+        if (!new_paths) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        memset(new_paths + watch->wd_capacity, 0,
+               (new_capacity - watch->wd_capacity) * sizeof(char*));
+        watch->wd_paths = new_paths;
+        watch->wd_capacity = new_capacity;
+    }
+    
+    char *copy = strdup(rel_path);
+    if (!copy) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    if (watch->wd_paths[wd]) {
+        // Same inode watched again (e.g. after a rename): keep the new name
+        free(watch->wd_paths[wd]);
+    } else {
+        watch->watch_count++;
+    }
+    watch->wd_paths[wd] = copy;
+    return FRACTYL_OK;
+}
+
+// Watch rel_dir and every non-ignored directory below it
+static int add_watch_tree(fs_watch_t *watch, const char *rel_dir, const ignore_dir_t *parent_rules) {
+    char full_dir[2048];
+    if (rel_dir[0] == '\0') {
+        snprintf(full_dir, sizeof(full_dir), "%s", watch->repo_root);
+    } else {
+        snprintf(full_dir, sizeof(full_dir), "%s/%s", watch->repo_root, rel_dir);
+    }
+    
+    int wd = inotify_add_watch(watch->fd, full_dir, WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            return FRACTYL_OK;  // Vanished while we were walking
+        }
+        return errno == EACCES ? FRACTYL_ERROR_PERMISSION_DENIED : FRACTYL_ERROR_IO;
+    }
+    int result = remember_wd(watch, wd, rel_dir);
+    if (result != FRACTYL_OK) return result;
+    
+    DIR *d = opendir(full_dir);
+    if (!d) return FRACTYL_OK;
+    
+    const ignore_dir_t *dir_rules = ignore_engine_enter_dir(watch->ignore, parent_rules, rel_dir);
+    
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL && result == FRACTYL_OK) {
+        if (strcmp(entry->d_name, ".") == 0 || 
+            strcmp(entry->d_name, "..") == 0 ||
+            strcmp(entry->d_name, ".fractyl") == 0) {
+            continue;
+        }
+        
+        char rel_path[2048];
+        if (rel_dir[0] == '\0') {
+            snprintf(rel_path, sizeof(rel_path), "%s", entry->d_name);
+        } else {
+            snprintf(rel_path, sizeof(rel_path), "%s/%s", rel_dir, entry->d_name);
+        }
+        
+        int is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN) {
+            char full_path[2048];
+            struct stat st;
+            snprintf(full_path, sizeof(full_path), "%s/%s", full_dir, entry->d_name);
+            is_dir = lstat(full_path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (!is_dir || ignore_engine_should_ignore(watch->ignore, dir_rules, rel_path, 1)) {
+            continue;
+        }
+        
+        char full_path[2048];
+        snprintf(full_path, sizeof(full_path), "%s/%s", full_dir, entry->d_name);
+        if (git_is_repository_root(full_path)) {
+            continue;
+        }
+        
+        result = add_watch_tree(watch, rel_path, dir_rules);
+    }
+    
+    closedir(d);
+    return result;
+}
+
+static void release_watches(fs_watch_t *watch) {
+    if (watch->fd >= 0) {
+        close(watch->fd);
+        watch->fd = -1;
+    }
+    for (int i = 0; i < watch->wd_capacity; i++) {
+        free(watch->wd_paths[i]);
+    }
+    free(watch->wd_paths);
+    watch->wd_paths = NULL;
+    watch->wd_capacity = 0;
+    watch->watch_count = 0;
+    ignore_engine_free(watch->ignore);
+    watch->ignore = NULL;
+}
+
+static int start_watches(fs_watch_t *watch) {
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd < 0) {
+        return FRACTYL_ERROR_IO;
+    }
+    
+    watch->ignore = ignore_engine_create(watch->repo_root);
+    if (!watch->ignore) {
+        release_watches(watch);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    int result = add_watch_tree(watch, "", ignore_engine_root(watch->ignore));
+    if (result != FRACTYL_OK) {
+        // Typically ENOSPC: fs.inotify.max_user_watches is too small
+        release_watches(watch);
+    }
+    return result;
+}
+
+int fs_watch_init(fs_watch_t *watch, const char *repo_root) {
+    if (!watch || !repo_root) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    memset(watch, 0, sizeof(fs_watch_t));
+    watch->fd = -1;
+    watch->repo_root = strdup(repo_root);
+    if (!watch->repo_root) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    int result = start_watches(watch);
+    if (result != FRACTYL_OK) {
+        free(watch->repo_root);
+        watch->repo_root = NULL;
+    }
+    return result;
+}
+
+int fs_watch_reset(fs_watch_t *watch) {
+    if (!watch || !watch->repo_root) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    release_watches(watch);
+    fs_watch_free_paths(watch->dirty, watch->dirty_count);
+    watch->dirty = NULL;
+    watch->dirty_count = 0;
+    watch->dirty_capacity = 0;
+    watch->overflowed = 0;
+    
+    return start_watches(watch);
+}
+
+static void handle_event(fs_watch_t *watch, const struct inotify_event *ev) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        watch->overflowed = 1;
+        return;
+    }
+    
+    if (ev->wd < 0 || ev->wd >= watch->wd_capacity || !watch->wd_paths[ev->wd]) {
+        return;
+    }
+    const char *dir = watch->wd_paths[ev->wd];
+    
+    if (ev->mask & IN_IGNORED) {
+        // Watch removed by the kernel (directory deleted or unmounted)
+        free(watch->wd_paths[ev->wd]);
+        watch->wd_paths[ev->wd] = NULL;
+        watch->watch_count--;
+        return;
+    }
+    
+    if (ev->len == 0 || ev->name[0] == '\0') {
+        // Event on the watched directory itself; the parent reports the name
+        return;
+    }
+    
+    if (dir[0] == '\0' && (strcmp(ev->name, ".fractyl") == 0 || strcmp(ev->name, ".git") == 0)) {
+        return;
+    }
+    
+    char rel_path[2048];
+    if (dir[0] == '\0') {
+        snprintf(rel_path, sizeof(rel_path), "%s", ev->name);
+    } else {
+        snprintf(rel_path, sizeof(rel_path), "%s/%s", dir, ev->name);
+    }
+    
+    if (ev->mask & IN_ISDIR) {
+        if (ev->mask & IN_MOVED_FROM) {
+            // Watches below the old name now carry stale paths
+            watch->overflowed = 1;
+            return;
+        }
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+            // Files may land before the new watch exists, so the scanner
+            // re-walks the whole directory rather than trusting events
+            const ignore_dir_t *rules = ignore_engine_root(watch->ignore);
+            char prefix[2048];
+            for (const char *slash = strchr(rel_path, '/'); slash; slash = strchr(slash + 1, '/')) {
+                size_t len = (size_t)(slash - rel_path);
+                if (len >= sizeof(prefix)) break;
+                memcpy(prefix, rel_path, len);
+                prefix[len] = '\0';
+                rules = ignore_engine_enter_dir(watch->ignore, rules, prefix);
+            }
+            if (!ignore_engine_should_ignore(watch->ignore, rules, rel_path, 1) &&
+                add_watch_tree(watch, rel_path, rules) != FRACTYL_OK) {
+                watch->overflowed = 1;
+            }
+        }
+    }
+    
+    mark_dirty(watch, rel_path);
+}
+
+int fs_watch_poll(fs_watch_t *watch, int timeout_ms) {
+    if (!watch || watch->fd < 0) return FRACTYL_ERROR_INVALID_STATE;
+    
+    struct pollfd pfd;
+    pfd.fd = watch->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready < 0) {
+        return errno == EINTR ? 0 : FRACTYL_ERROR_IO;
+    }
+    if (ready == 0) {
+        return 0;
+    }
+    
+    // Buffer aligned for struct inotify_event, as inotify(7) recommends
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int handled = 0;
+    
+    while (1) {
+        ssize_t len = read(watch->fd, buffer, sizeof(buffer));
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EINTR) break;
+            return FRACTYL_ERROR_IO;
+        }
+        if (len == 0) break;
+        
+        for (char *p = buffer; p < buffer + len; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            handle_event(watch, ev);
+            handled++;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    
+    return handled;
+}
+
+void fs_watch_requeue(fs_watch_t *watch, char *const *paths, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        mark_dirty(watch, paths[i]);
+    }
+}
+
+#else // !__linux__
+
+int fs_watch_init(fs_watch_t *watch, const char *repo_root) {
+    (void)repo_root;
+    if (watch) {
+        memset(watch, 0, sizeof(fs_watch_t));
+        watch->fd = -1;
+    }
+    return FRACTYL_ERROR_GENERIC;  // No inotify on this platform
+}
+
+int fs_watch_reset(fs_watch_t *watch) {
+    (void)watch;
+    return FRACTYL_ERROR_GENERIC;
+}
+
+int fs_watch_poll(fs_watch_t *watch, int timeout_ms) {
+    (void)watch;
+    (void)timeout_ms;
+    return FRACTYL_ERROR_GENERIC;
+}
+
+void fs_watch_requeue(fs_watch_t *watch, char *const *paths, size_t count) {
+    (void)watch;
+    (void)paths;
+    (void)count;
+}
+
+static void release_watches(fs_watch_t *watch) {
+    (void)watch;
+}
+
+#endif // __linux__
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int fs_watch_take(fs_watch_t *watch, char ***paths, size_t *count, int *overflowed) {
+    if (!watch || !paths || !count || !overflowed) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    *overflowed = watch->overflowed;
+    
+    // Sort and drop duplicates; editors touch the same file many times
+    if (watch->dirty_count > 1) {
+        qsort(watch->dirty, watch->dirty_count, sizeof(char*), compare_paths);
+        size_t out = 1;
+        for (size_t i = 1; i < watch->dirty_count; i++) {
+            if (strcmp(watch->dirty[i], watch->dirty[out - 1]) == 0) {
+                free(watch->dirty[i]);
+            } else {
+                watch->dirty[out++] = watch->dirty[i];
+            }
+        }
+        watch->dirty_count = out;
+    }
+    
+    *paths = watch->dirty;
+    *count = watch->dirty_count;
+    
+    watch->dirty = NULL;
+    watch->dirty_count = 0;
+    watch->dirty_capacity = 0;
+    watch->overflowed = 0;
+    return FRACTYL_OK;
+}
+
+void fs_watch_free_paths(char **paths, size_t count) {
+    if (!paths) return;
+    for (size_t i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+void fs_watch_free(fs_watch_t *watch) {
+    if (!watch) return;
+    
+    release_watches(watch);
+    fs_watch_free_paths(watch->dirty, watch->dirty_count);
+    free(watch->repo_root);
+    memset(watch, 0, sizeof(fs_watch_t));
+    watch->fd = -1;
+}
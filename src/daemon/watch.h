@@ -0,0 +1,57 @@
+#ifndef FRACTYL_WATCH_H
+#define FRACTYL_WATCH_H
+
+#include <stddef.h>
+#include "../utils/gitignore.h"
+
+// Filesystem watcher for the daemon
+//
+// Keeps an inotify watch on every non-ignored directory of the repository
+// and collects the repo-relative paths that changed since the last
+// fs_watch_take(). When the kernel queue overflows, a directory is renamed,
+// or a watch cannot be added, the watcher marks itself overflowed: the
+// caller must fall back to a full scan and call fs_watch_reset().
+
+// Dirty paths kept before giving up and asking for a full scan
+#define FS_WATCH_MAX_DIRTY 65536
+
+typedef struct {
+    int fd;
+    char *repo_root;
+    ignore_engine_t *ignore;
+    
+    // Repo-relative directory for each watch descriptor (NULL = unused)
+    char **wd_paths;
+    int wd_capacity;
+    size_t watch_count;
+    
+    char **dirty;
+    size_t dirty_count;
+    size_t dirty_capacity;
+    int overflowed;
+} fs_watch_t;
+
+// Start watching repo_root. Returns FRACTYL_OK, or an error when the
+// platform has no inotify or the watch limit is too low for the tree.
+int fs_watch_init(fs_watch_t *watch, const char *repo_root);
+
+// Drop all watches and re-add them from a fresh walk (after overflow)
+int fs_watch_reset(fs_watch_t *watch);
+
+// Read pending events, waiting up to timeout_ms for the first one.
+// Returns the number of events handled or a negative error.
+int fs_watch_poll(fs_watch_t *watch, int timeout_ms);
+
+// Hand the deduplicated dirty paths to the caller and start a new round.
+// *overflowed is set when the set is incomplete and a full scan is needed.
+// Free the result with fs_watch_free_paths().
+int fs_watch_take(fs_watch_t *watch, char ***paths, size_t *count, int *overflowed);
+
+// Put paths taken but not snapshotted back for the next round
+void fs_watch_requeue(fs_watch_t *watch, char *const *paths, size_t count);
+
+void fs_watch_free_paths(char **paths, size_t count);
+
+void fs_watch_free(fs_watch_t *watch);
+
+#endif // FRACTYL_WATCH_H
@@ -2,6 +2,8 @@
 #define COMMANDS_H
 
 #include "fractyl.h"
+#include "core.h"
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +18,74 @@ int cmd_delete(int argc, char **argv);
 int cmd_diff(int argc, char **argv);
 int cmd_show(int argc, char **argv);
 int cmd_daemon(int argc, char **argv);
+int cmd_repack(int argc, char **argv);
+int cmd_train_dict(int argc, char **argv);
+int cmd_gc(int argc, char **argv);
+int cmd_prune(int argc, char **argv);
+int cmd_stats(int argc, char **argv);
+int cmd_mount(int argc, char **argv);
+int cmd_export(int argc, char **argv);
+int cmd_remote(int argc, char **argv);
+int cmd_push(int argc, char **argv);
+int cmd_remote_serve(int argc, char **argv);
+int cmd_alternates(int argc, char **argv);
+int cmd_fsck(int argc, char **argv);
+
+// Push to every configured remote, or with auto_only to those added with
+// --auto-push; pushed_out receives how many were tried. Returns 0 if every
+// push succeeded, else 1.
+int push_remotes(const char *fractyl_dir, int auto_only, size_t *pushed_out);
+
+// How many remotes the daemon pushes to
+int remotes_auto_push_count(const char *fractyl_dir);
+
+struct ignore_engine;
+
+// What a long-running caller (the daemon) keeps between snapshots so that
+// each one does not start cold: the last scanned index, with current stat
+// data, so the next snapshot neither reads its parent back from the object
+// store nor reads .fractyl/index; and the compiled ignore rules for
+// incremental scans. Zero it before the first snapshot and free it with
+// snapshot_warm_free().
+typedef struct {
+    int valid;
+    char snapshot_id[64];               // The snapshot index has the contents of
+    unsigned char root[32];             // Its root tree
+    index_t index;
+    struct ignore_engine *ignore;       // NULL until an incremental scan needs it
+} snapshot_warm_t;
+
+void snapshot_warm_free(snapshot_warm_t *warm);
+
+// Warm state for frac snapshot (cmd_snapshot) to start from; a daemon sets
+// its own in the processes that serve the command for it
+void snapshot_command_warm(snapshot_warm_t *warm);
+
+// Options for a programmatic snapshot (cmd_snapshot fills them from argv)
+typedef struct {
+    const char *message;                // NULL: generate a description
+    const char *scan_engine;            // NULL: scan.engine config key, then "parallel"
+    // When non-NULL, only these repo-relative paths are rescanned and the
+    // rest of the current snapshot's index is carried over (watch daemon,
+    // frac snapshot -- <path>...)
+    const char *const *changed_paths;
+    size_t changed_count;
+    // Each changed path must be in the working tree or the current
+    // snapshot (paths a user named; a watcher's may be long gone)
+    int strict_paths;
+    int lock_held;                      // The caller already holds the repository lock
+    // When non-NULL, receives the scanned index in path order when 0 is
+    // returned, also if there was nothing to snapshot, and is left empty
+    // on errors; free it with index_free()
+    index_t *index_out;
+    // When non-NULL, state kept from the caller's last snapshot, updated
+    // for the next one; the scanned index goes there instead of index_out
+    snapshot_warm_t *warm;
+} snapshot_options_t;
+
+// Create a snapshot of the repository containing the working directory.
+// Returns 0 on success or when there was nothing to snapshot, 1 on error.
+int snapshot_create(const snapshot_options_t *opts);
 
 // Helper functions
 int fractyl_init_repo(const char *path);
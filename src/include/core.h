@@ -3,7 +3,12 @@
 #define CORE_H
 
 #include <sys/types.h>
+#include <stdint.h>
 #include <time.h>
+#include "../utils/arena.h"
+
+// index_entry_t.flags
+#define INDEX_ENTRY_RACY 0x1    // Modified in the second it was scanned; hash again next time
 
 typedef struct {
     char *path;
@@ -11,14 +16,60 @@ typedef struct {
     mode_t mode;
     off_t size;
     time_t mtime;
+    // Remaining stat data used to decide whether the hash can be reused.
+    // All zero for entries read from version 1 indexes.
+    uint32_t mtime_nsec;
+    time_t ctime;
+    uint32_t ctime_nsec;
+    uint64_t ino;
+    uint64_t dev;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t flags;
 } index_entry_t;
 
+struct index_lookup_slot;
+
 typedef struct {
     index_entry_t *entries;
     size_t count;
     size_t capacity;
+    // Optional path -> entry table, built lazily and maintained by index.c
+    struct index_lookup_slot *lookup;
+    size_t lookup_capacity;     // Slots in the table (power of two), 0 if not built
+    size_t lookup_count;        // Entries [0, lookup_count) are in the table
+    // File or buffer a version 4 index was loaded from, or the paths
+    // rebuilt from a version 5 one; entries loaded with it point into it
+    void *storage;
+    size_t storage_size;
+    int storage_mapped;         // storage is an mmap() of the file
+    // Paths of entries added to the index; freed with it in one go
+    arena_t arena;
 } index_t;
 
+// Largest changed files a snapshot's stats name
+#define SNAPSHOT_STATS_PATHS 5
+
+// What taking a snapshot cost. Hash and store times are summed over the
+// threads doing that work (see object_stats_t), the others are wall time.
+typedef struct {
+    int recorded;                       // 0 for snapshots taken before stats were kept
+    unsigned long long files;
+    unsigned long long files_changed;   // Added or modified since the previous snapshot
+    unsigned long long bytes_changed;   // Their size
+    unsigned long long objects_written;
+    unsigned long long bytes_written;
+    unsigned long long bytes_deduplicated;
+    unsigned long long scan_ms;         // Walking the tree and storing changed files
+    unsigned long long hash_ms;
+    unsigned long long store_ms;
+    unsigned long long tree_ms;         // Storing the snapshot's trees
+    unsigned long long total_ms;
+    char *paths[SNAPSHOT_STATS_PATHS];  // Largest changed files, largest first
+    unsigned long long path_sizes[SNAPSHOT_STATS_PATHS];
+    size_t path_count;
+} snapshot_stats_t;
+
 typedef struct {
     char id[64];
     char *parent;
@@ -31,6 +82,7 @@ typedef struct {
     char *git_branch;
     char *git_commit;
     int git_dirty;  // 1 if there are uncommitted changes, 0 otherwise
+    snapshot_stats_t stats;
 } snapshot_t;
 
 typedef struct {
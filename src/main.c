@@ -9,28 +9,121 @@
 #include "commands.h"
 #include "utils/cli.h"
 #include "utils/fs.h"
+#include "utils/profile.h"
+#include "utils/counters.h"
+#include "daemon/ipc.h"
+
+// Dispatch to command handlers
+static int run_command(const char *command, int argc, char **argv) {
+    if (strcmp(command, "init") == 0) {
+        return cmd_init(argc, argv);
+    } else if (strcmp(command, "snapshot") == 0) {
+        return cmd_snapshot(argc, argv);
+    } else if (strcmp(command, "restore") == 0) {
+        return cmd_restore(argc, argv);
+    } else if (strcmp(command, "mount") == 0) {
+        return cmd_mount(argc, argv);
+    } else if (strcmp(command, "export") == 0) {
+        return cmd_export(argc, argv);
+    } else if (strcmp(command, "list") == 0) {
+        return cmd_list(argc, argv);
+    } else if (strcmp(command, "delete") == 0) {
+        return cmd_delete(argc, argv);
+    } else if (strcmp(command, "diff") == 0) {
+        return cmd_diff(argc, argv);
+    } else if (strcmp(command, "show") == 0) {
+        return cmd_show(argc, argv);
+    } else if (strcmp(command, "daemon") == 0) {
+        return cmd_daemon(argc, argv);
+    } else if (strcmp(command, "repack") == 0) {
+        return cmd_repack(argc, argv);
+    } else if (strcmp(command, "train-dict") == 0) {
+        return cmd_train_dict(argc, argv);
+    } else if (strcmp(command, "gc") == 0) {
+        return cmd_gc(argc, argv);
+    } else if (strcmp(command, "prune") == 0) {
+        return cmd_prune(argc, argv);
+    } else if (strcmp(command, "stats") == 0) {
+        return cmd_stats(argc, argv);
+    } else if (strcmp(command, "remote") == 0) {
+        return cmd_remote(argc, argv);
+    } else if (strcmp(command, "push") == 0) {
+        return cmd_push(argc, argv);
+    } else if (strcmp(command, "remote-serve") == 0) {
+        return cmd_remote_serve(argc, argv);
+    } else if (strcmp(command, "alternates") == 0) {
+        return cmd_alternates(argc, argv);
+    } else if (strcmp(command, "fsck") == 0) {
+        return cmd_fsck(argc, argv);
+    }
+    printf("Unknown command: %s\n", command);
+    printf("Use --help to see available commands\n");
+    return 1;
+}
+
+// Add what the command counted to the repository's counters
+static void flush_counters(void) {
+    if (!counters_pending()) return;
+    char *repo_root = fractyl_find_repo_root(NULL);
+    if (!repo_root) return;
+    char fractyl_dir[2048];
+    snprintf(fractyl_dir, sizeof(fractyl_dir), "%s/.fractyl", repo_root);
+    counters_flush(fractyl_dir, NULL);
+    free(repo_root);
+}
 
 int main(int argc, char **argv) {
     cli_options_t opts = {0}; // Initialize all fields to zero/NULL
     parse_cli_args(argc, argv, &opts);
-
+    
+    // --profile works with every command, so it is taken out before the
+    // command parses its own options
+    int kept = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!cli_is_profile_arg(argv[i])) argv[kept++] = argv[i];
+    }
+    argv[kept] = NULL;
+    argc = kept;
+    if (opts.profile) {
+        profile_enable(opts.profile_path, opts.profile_trace);
+    } else {
+        profile_enable_from_env();
+    }
+    
     if (opts.help) {
         printf("Fractyl -- help\n");
         printf("Usage: frac <command> [options]\n");
         printf("Commands:\n");
         printf("  init                   Initialize a new repository\n");
         printf("  snapshot [-m <message>] Create a new snapshot\n");
+        printf("           [--scan-engine auto|parallel|cached|binary|stat-only]\n");
+        printf("           [-- <path>...] Rescan only these files and directories\n");
         printf("  restore <snapshot-id>  Restore to a snapshot\n");
-        printf("  list                   List all snapshots\n");
+        printf("  mount <snapshot-id> <dir> Mount a snapshot read-only (FUSE)\n");
+        printf("  export <snapshot-id> <dir> [--link] Write a snapshot into a directory\n");
+        printf("  list [-n <count>]      List snapshots\n");
+        printf("       [--since <time>] [--until <time>] [--flat]\n");
         printf("  delete <snapshot-id>   Delete a snapshot\n");
         printf("  diff <snap-a> <snap-b> Compare two snapshots\n");
         printf("  show <snapshot-id>     Show detailed snapshot info\n");
+        printf("       [-n <count>] [--summary] [--json] [<path>...]\n");
         printf("  daemon <command>       Manage background daemon\n");
+        printf("  repack [-a]            Move loose objects into a packfile\n");
+        printf("  train-dict [-s <KiB>]  Train a compression dictionary\n");
+        printf("  gc [-n] [--shared]     Delete objects no snapshot refers to\n");
+        printf("  fsck [--scrub]         Check that stored objects read back intact\n");
+        printf("  prune [-n] [--gc]      Thin out old snapshots (retention.*)\n");
+        printf("  stats [-n <count>]     What recent snapshots cost to take\n");
+        printf("  remote [add|remove]    Manage the stores snapshots are pushed to\n");
+        printf("  push [<remote>...]     Send remotes the snapshots they lack\n");
+        printf("  alternates [add <dir>] Share object stores between repositories\n");
         printf("  --test-utils           Run utility tests\n");
         printf("Options:\n");
         printf("  --help                 Show this help\n");
         printf("  --version              Show version\n");
         printf("  --debug                Enable debug output\n");
+        printf("  --profile[=<file>]     Time each phase, JSON summary to stderr or <file>\n");
+        printf("  --profile-trace=<file> Also write a Chrome trace of the timed phases\n");
         return 0;
     }
     if (opts.version) {
@@ -58,28 +151,18 @@ int main(int argc, char **argv) {
         return 0;
     }
     if (opts.command) {
-        // Dispatch to command handlers
-        if (strcmp(opts.command, "init") == 0) {
-            return cmd_init(argc, argv);
-        } else if (strcmp(opts.command, "snapshot") == 0) {
-            return cmd_snapshot(argc, argv);
-        } else if (strcmp(opts.command, "restore") == 0) {
-            return cmd_restore(argc, argv);
-        } else if (strcmp(opts.command, "list") == 0) {
-            return cmd_list(argc, argv);
-        } else if (strcmp(opts.command, "delete") == 0) {
-            return cmd_delete(argc, argv);
-        } else if (strcmp(opts.command, "diff") == 0) {
-            return cmd_diff(argc, argv);
-        } else if (strcmp(opts.command, "show") == 0) {
-            return cmd_show(argc, argv);
-        } else if (strcmp(opts.command, "daemon") == 0) {
-            return cmd_daemon(argc, argv);
-        } else {
-            printf("Unknown command: %s\n", opts.command);
-            printf("Use --help to see available commands\n");
-            return 1;
+        // A running daemon serves these from its warm caches; a profiled
+        // command runs here so the timings are of this process
+        int status;
+        if (!profile_enabled() && ipc_served_command(opts.command) &&
+            ipc_forward(argc, argv, &status) == FRACTYL_OK) {
+            return status;
         }
+        
+        status = run_command(opts.command, argc, argv);
+        flush_counters();
+        profile_report(opts.command);
+        return status;
     }
     // Check if we're in a repository
     char *repo_root = fractyl_find_repo_root(NULL);
@@ -87,7 +170,12 @@ int main(int argc, char **argv) {
         // We're in a repository, do an auto-snapshot
         free(repo_root);
         char *args[] = {"frac", "snapshot", NULL};
-        return cmd_snapshot(2, args);
+        int status;
+        if (!profile_enabled() && ipc_forward(2, args, &status) == FRACTYL_OK) return status;
+        status = cmd_snapshot(2, args);
+        flush_counters();
+        profile_report("snapshot");
+        return status;
     }
     
     printf("Fractyl not initialized. Use 'frac init' to initialize (see --help)\n");
@@ -0,0 +1,124 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Alignment good for any type arena_alloc() may be asked for
+typedef union {
+    long double ld;
+    long long ll;
+    void *p;
+} arena_align_t;
+
+#define ARENA_ALIGN (sizeof(arena_align_t))
+
+struct arena_block {
+    arena_block_t *next;
+    size_t size;
+    size_t used;
+    arena_align_t data[];
+};
+
+void arena_init(arena_t *arena) {
+    if (!arena) return;
+    arena->head = NULL;
+    arena->allocated = 0;
+}
+
+static arena_block_t* block_new(size_t size) {
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if (!block) return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+// size bytes at a multiple of align (a power of two) within a block
+static void* allocate(arena_t *arena, size_t size, size_t align) {
+    if (!arena || size > SIZE_MAX - ARENA_ALIGN) return NULL;
+    
+    arena_block_t *block = arena->head;
+    if (block) {
+        size_t start = (block->used + align - 1) & ~(align - 1);
+        if (start <= block->size && block->size - start >= size) {
+            block->used = start + size;
+            return (char *)block->data + start;
+        }
+    }
+    
+    // Large allocations get a block of their own behind the current one,
+    // which keeps the room left in that
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        arena_block_t *own = block_new(size);
+        if (!own) return NULL;
+        own->used = size;
+        if (block) {
+            own->next = block->next;
+            block->next = own;
+        } else {
+            arena->head = own;
+        }
+        arena->allocated += size;
+        return own->data;
+    }
+    
+    arena_block_t *fresh = block_new(ARENA_BLOCK_SIZE);
+    if (!fresh) return NULL;
+    fresh->next = block;
+    fresh->used = size;
+    arena->head = fresh;
+    arena->allocated += ARENA_BLOCK_SIZE;
+    return fresh->data;
+}
+
+void* arena_alloc(arena_t *arena, size_t size) {
+    return allocate(arena, size, ARENA_ALIGN);
+}
+
+char* arena_alloc_string(arena_t *arena, size_t len) {
+    // Strings need no alignment, so they are packed back to back
+    return len < SIZE_MAX ? allocate(arena, len + 1, 1) : NULL;
+}
+
+char* arena_strndup(arena_t *arena, const char *s, size_t len) {
+    if (!s) return NULL;
+    char *copy = arena_alloc_string(arena, len);
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char* arena_strdup(arena_t *arena, const char *s) {
+    return s ? arena_strndup(arena, s, strlen(s)) : NULL;
+}
+
+void arena_take(arena_t *dest, arena_t *src) {
+    if (!dest || !src || !src->head || dest == src) return;
+    
+    if (!dest->head) {
+        *dest = *src;
+    } else {
+        // Behind dest's current block, which keeps taking allocations
+        arena_block_t *tail = src->head;
+        while (tail->next) tail = tail->next;
+        tail->next = dest->head->next;
+        dest->head->next = src->head;
+        dest->allocated += src->allocated;
+    }
+    src->head = NULL;
+    src->allocated = 0;
+}
+
+void arena_free(arena_t *arena) {
+    if (!arena) return;
+    arena_block_t *block = arena->head;
+    while (block) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->allocated = 0;
+}
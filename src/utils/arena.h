@@ -0,0 +1,39 @@
+// arena.h - Block allocator for many small, equally long-lived strings
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Allocations are carved out of large blocks and only released all at
+// once by arena_free(), which costs one free() per block rather than per
+// string. Indexes keep their paths in one, so building an index with a
+// million entries does not mean a million mallocs, nor does freeing it.
+//
+// An arena is not thread-safe; give each thread its own and combine them
+// with arena_take() afterwards.
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct arena_block arena_block_t;
+
+typedef struct {
+    arena_block_t *head;        // Block allocations come from; the rest are full
+    size_t allocated;           // Bytes in all blocks, for accounting
+} arena_t;
+
+// An arena of all zeroes is empty and valid as well
+void arena_init(arena_t *arena);
+// size bytes aligned for any type, or NULL when out of memory
+void* arena_alloc(arena_t *arena, size_t size);
+// Copy of s, or of its first len bytes, NUL-terminated
+char* arena_strdup(arena_t *arena, const char *s);
+char* arena_strndup(arena_t *arena, const char *s, size_t len);
+// Room for a string of len bytes and its NUL, to be filled in by the caller
+char* arena_alloc_string(arena_t *arena, size_t len);
+// Move every block of src into dest; src is left empty, and what was
+// allocated from it stays valid for as long as dest
+void arena_take(arena_t *dest, arena_t *src);
+// Release every allocation at once
+void arena_free(arena_t *arena);
+
+#endif // ARENA_H
@@ -113,8 +113,8 @@ int batch_copy_directory_files(index_t *new_index, const index_t *prev_index,
         // Direct memory copy of entry
         *dst = *src;
         
-        // Duplicate the path string
-        dst->path = strdup(src->path);
+        // Copy the path into the new index's arena
+        dst->path = arena_strdup(&new_index->arena, src->path);
         if (!dst->path) {
             new_index->count--;
             return -1;
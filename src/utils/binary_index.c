@@ -1,5 +1,7 @@
 #include "binary_index.h"
 #include "paths.h"
+#include "counters.h"
+#include "../core/hash.h"
 #include "../include/fractyl.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,9 +12,10 @@
 #include <sys/stat.h>
 #include <errno.h>
 
-// Hash table size (power of 2 for fast modulo)
-#define HASH_TABLE_SIZE 8192
-#define HASH_TABLE_MASK (HASH_TABLE_SIZE - 1)
+// Slots of a saved table, and the overlay's first table; tables are
+// powers of 2 kept at most half full so probes stay short
+#define MIN_TABLE_SIZE 16
+#define OVERLAY_CAPACITY 64
 
 // Simple hash function for paths
 uint32_t binary_index_hash_path(const char *path) {
@@ -53,13 +56,6 @@ int binary_index_init(binary_index_t *index, const char *branch) {
     index->header.timestamp = time(NULL);
     strncpy(index->header.branch, branch, sizeof(index->header.branch) - 1);
     
-    // Initialize hash table
-    index->hash_table_size = HASH_TABLE_SIZE;
-    index->hash_table = calloc(HASH_TABLE_SIZE, sizeof(struct index_hash_entry *));
-    if (!index->hash_table) {
-        return FRACTYL_ERROR_OUT_OF_MEMORY;
-    }
-    
     return FRACTYL_OK;
 }
 
@@ -67,35 +63,15 @@ int binary_index_init(binary_index_t *index, const char *branch) {
 void binary_index_free(binary_index_t *index) {
     if (!index) return;
     
-    // Unmap memory if mapped
-    if (index->mmap_addr && index->mmap_addr != MAP_FAILED) {
+    if (index->mmap_addr) {
         munmap(index->mmap_addr, index->mmap_size);
-        close(index->mmap_fd);
-    }
-    
-    // Free entries and paths (if not memory-mapped)
-    if (!index->mmap_addr) {
-        free(index->entries);
-        if (index->paths) {
-            for (uint32_t i = 0; i < index->header.entry_count; i++) {
-                free(index->paths[i]);
-            }
-            free(index->paths);
-        }
     }
     
-    // Free hash table
-    if (index->hash_table) {
-        for (uint32_t i = 0; i < index->hash_table_size; i++) {
-            struct index_hash_entry *entry = index->hash_table[i];
-            while (entry) {
-                struct index_hash_entry *next = entry->next;
-                free(entry);
-                entry = next;
-            }
-        }
-        free(index->hash_table);
-    }
+    // The added paths themselves all go with the arena
+    free(index->entries);
+    free(index->paths);
+    free(index->slots);
+    arena_free(&index->arena);
     
     memset(index, 0, sizeof(binary_index_t));
 }
@@ -121,224 +97,371 @@ static char *get_index_path(const char *fractyl_dir, const char *branch) {
         return NULL;
     }
     
+    // The header only keeps sizeof(branch) - 1 characters and save() builds
+    // the path from the header, so name the file after that same prefix.
+    // Branch names like "feature/x" must not create subdirectories.
+    char file_branch[sizeof(((binary_index_header_t *)0)->branch)];
+    snprintf(file_branch, sizeof(file_branch), "%s", branch);
+    for (char *c = file_branch; *c; c++) {
+        if (*c == '/') *c = '_';
+    }
+    
     snprintf(index_path, strlen(fractyl_dir) + strlen(branch) + 64, 
-             "%s/index_%s.bin", cache_dir, branch);
+             "%s/index_%s.bin", cache_dir, file_branch);
     
     free(cache_dir);
     return index_path;
 }
 
-// Build hash table from loaded entries
-static int build_hash_table(binary_index_t *index) {
-    // Clear existing hash table
-    for (uint32_t i = 0; i < index->hash_table_size; i++) {
-        struct index_hash_entry *entry = index->hash_table[i];
-        while (entry) {
-            struct index_hash_entry *next = entry->next;
-            free(entry);
-            entry = next;
+// Path of a saved entry, or NULL if the file holds no valid one for it
+static const char *base_path(const binary_index_t *index, uint32_t i) {
+    const binary_index_entry_t *entry = &index->base[i];
+    uint64_t end = (uint64_t)entry->path_offset + entry->path_length;
+    if (entry->path_length == 0 || end >= index->base_paths_size) return NULL;
+    
+    const char *path = index->base_paths + entry->path_offset;
+    return path[entry->path_length] == '\0' ? path : NULL;
+}
+
+// Find a saved entry, removed or not. The probe is bounded by the table
+// size so that a damaged file with no free slot cannot loop forever.
+static binary_index_entry_t *find_base(const binary_index_t *index, const char *path,
+                                       uint32_t hash, const char **entry_path) {
+    if (!index->base_slots) return NULL;
+    
+    uint32_t mask = index->base_table_size - 1;
+    uint32_t i = hash & mask;
+    for (uint32_t probes = 0; probes < index->base_table_size; probes++, i = (i + 1) & mask) {
+        const binary_index_slot_t *slot = &index->base_slots[i];
+        if (slot->entry == 0) return NULL;
+        if (slot->hash != hash || slot->entry > index->base_count) continue;
+    
+        const char *candidate = base_path(index, slot->entry - 1);
+        if (candidate && strcmp(candidate, path) == 0) {
+            if (entry_path) *entry_path = candidate;
+            return &index->base[slot->entry - 1];
         }
-        index->hash_table[i] = NULL;
     }
-    
-    // Build new hash table
-    for (uint32_t i = 0; i < index->header.entry_count; i++) {
-        if (!index->paths[i] || strlen(index->paths[i]) == 0) continue;
-        
-        uint32_t hash = binary_index_hash_path(index->paths[i]);
-        uint32_t bucket = hash & HASH_TABLE_MASK;
-        
-        struct index_hash_entry *entry = malloc(sizeof(struct index_hash_entry));
-        if (!entry) return FRACTYL_ERROR_OUT_OF_MEMORY;
-        
-        entry->hash = hash;
-        entry->index = i;
-        entry->next = index->hash_table[bucket];
-        index->hash_table[bucket] = entry;
+    return NULL;
+}
+
+// Find an added entry, removed or not
+static binary_index_entry_t *find_added(const binary_index_t *index, const char *path,
+                                        uint32_t hash, const char **entry_path) {
+    if (!index->slots) return NULL;
+    
+    uint32_t mask = index->table_size - 1;
+    for (uint32_t i = hash & mask; index->slots[i].entry != 0; i = (i + 1) & mask) {
+        const binary_index_slot_t *slot = &index->slots[i];
+        if (slot->hash == hash && strcmp(index->paths[slot->entry - 1], path) == 0) {
+            if (entry_path) *entry_path = index->paths[slot->entry - 1];
+            return &index->entries[slot->entry - 1];
+        }
+    }
+    return NULL;
+}
+
+static binary_index_entry_t *find(const binary_index_t *index, const char *path,
+                                  uint32_t hash, const char **entry_path) {
+    binary_index_entry_t *entry = find_base(index, path, hash, entry_path);
+    return entry ? entry : find_added(index, path, hash, entry_path);
+}
+
+// Put entry (a position plus one) into a table that has a free slot
+static void slot_insert(binary_index_slot_t *slots, uint32_t size, uint32_t hash, uint32_t entry) {
+    uint32_t mask = size - 1;
+    uint32_t i = hash & mask;
+    while (slots[i].entry != 0) {
+        i = (i + 1) & mask;
+    }
+    slots[i].hash = hash;
+    slots[i].entry = entry;
+}
+
+// Make room in the overlay for one more entry
+static int grow_added(binary_index_t *index) {
+    if (index->count == index->capacity) {
+        uint32_t capacity = index->capacity ? index->capacity * 2 : OVERLAY_CAPACITY;
+        binary_index_entry_t *entries = realloc(index->entries, capacity * sizeof(binary_index_entry_t));
+        if (!entries) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        index->entries = entries;
+    
+        char **paths = realloc(index->paths, capacity * sizeof(char *));
+        if (!paths) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        index->paths = paths;
+        index->capacity = capacity;
     }
     
+    if ((index->count + 1) * 2 > index->table_size) {
+        uint32_t size = index->table_size ? index->table_size * 2 : OVERLAY_CAPACITY;
+        binary_index_slot_t *slots = calloc(size, sizeof(binary_index_slot_t));
+        if (!slots) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+        for (uint32_t i = 0; i < index->count; i++) {
+            slot_insert(slots, size, binary_index_hash_path(index->paths[i]), i + 1);
+        }
+        free(index->slots);
+        index->slots = slots;
+        index->table_size = size;
+    }
     return FRACTYL_OK;
 }
 
+// Nonzero if header describes a file of exactly size bytes we can use
+static int valid_layout(const binary_index_header_t *header, size_t size) {
+    if (header->signature != BINARY_INDEX_SIGNATURE ||
+        header->version != BINARY_INDEX_VERSION) {
+        return 0;
+    }
+    
+    uint32_t table_size = header->table_size;
+    if (table_size == 0 || (table_size & (table_size - 1)) != 0 ||
+        table_size <= header->entry_count) {
+        return 0;
+    }
+    
+    uint64_t fixed = sizeof(binary_index_header_t) +
+                     (uint64_t)header->entry_count * sizeof(binary_index_entry_t) +
+                     (uint64_t)table_size * sizeof(binary_index_slot_t);
+    return fixed <= size && header->paths_size == size - fixed;
+}
+
 // Load binary index from file with memory mapping
 int binary_index_load(binary_index_t *index, const char *fractyl_dir, const char *branch) {
     if (!index || !fractyl_dir || !branch) return FRACTYL_ERROR_INVALID_ARGS;
     
+    int result = binary_index_init(index, branch);
+    if (result != FRACTYL_OK) return result;
+    
     char *index_path = get_index_path(fractyl_dir, branch);
     if (!index_path) return FRACTYL_ERROR_OUT_OF_MEMORY;
     
-    // Try to open index file
-    int fd = open(index_path, O_RDONLY);
-    if (fd < 0) {
-        // No index file - initialize empty index
-        free(index_path);
-        return binary_index_init(index, branch);
-    }
+    // No index file - start with an empty index
+    int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    free(index_path);
+    if (fd < 0) return FRACTYL_OK;
     
-    // Get file size
     struct stat st;
     if (fstat(fd, &st) < 0) {
         close(fd);
-        free(index_path);
         return FRACTYL_ERROR_IO;
     }
     
-    // Validate minimum size
+    // Too short to be an index: rebuild it
     if ((size_t)st.st_size < sizeof(binary_index_header_t)) {
         close(fd);
-        free(index_path);
-        return binary_index_init(index, branch);
+        return FRACTYL_OK;
     }
     
-    // Initialize index structure
-    int result = binary_index_init(index, branch);
-    if (result != FRACTYL_OK) {
-        close(fd);
-        free(index_path);
-        return result;
-    }
+    // Writable but private, so updates never reach the file; save()
+    // writes a new one and renames it over this
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return FRACTYL_ERROR_IO;
     
-    // Read header
-    if (read(fd, &index->header, sizeof(binary_index_header_t)) != sizeof(binary_index_header_t)) {
-        close(fd);
-        free(index_path);
-        return binary_index_init(index, branch);
+    const binary_index_header_t *header = map;
+    if (!valid_layout(header, (size_t)st.st_size)) {
+        munmap(map, (size_t)st.st_size);
+        return FRACTYL_OK;
     }
     
-    // Validate header
-    if (index->header.signature != BINARY_INDEX_SIGNATURE ||
-        index->header.version != BINARY_INDEX_VERSION) {
-        close(fd);
-        free(index_path);
-        return binary_index_init(index, branch);
-    }
-    
-    // Read entries if any
-    if (index->header.entry_count > 0) {
-        // Allocate entries array
-        index->entries = malloc(index->header.entry_count * sizeof(binary_index_entry_t));
-        if (!index->entries) {
-            close(fd);
-            free(index_path);
-            return FRACTYL_ERROR_OUT_OF_MEMORY;
-        }
-        
-        // Read entries
-        size_t entries_size = index->header.entry_count * sizeof(binary_index_entry_t);
-        if (read(fd, index->entries, entries_size) != (ssize_t)entries_size) {
-            close(fd);
-            free(index_path);
-            return binary_index_init(index, branch);
-        }
-        
-        // Allocate paths array
-        index->paths = malloc(index->header.entry_count * sizeof(char *));
-        if (!index->paths) {
-            close(fd);
-            free(index_path);
-            return FRACTYL_ERROR_OUT_OF_MEMORY;
-        }
-        
-        // Read variable-length paths
-        for (uint32_t i = 0; i < index->header.entry_count; i++) {
-            uint16_t path_len = index->entries[i].path_length;
-            
-            if (path_len > 0 && path_len < MAX_PATH_LENGTH) {
-                index->paths[i] = malloc(path_len + 1);
-                if (index->paths[i]) {
-                    if (read(fd, index->paths[i], path_len) == path_len) {
-                        index->paths[i][path_len] = '\0';
-                    } else {
-                        free(index->paths[i]);
-                        index->paths[i] = NULL;
-                    }
-                }
-            } else {
-                index->paths[i] = NULL;
-            }
-        }
-        
-        // Build hash table for fast lookups
-        build_hash_table(index);
+    index->header = *header;
+    index->mmap_addr = map;
+    index->mmap_size = (size_t)st.st_size;
+    index->base = (binary_index_entry_t *)((char *)map + sizeof(binary_index_header_t));
+    index->base_count = header->entry_count;
+    index->base_slots = (const binary_index_slot_t *)(index->base + index->base_count);
+    index->base_table_size = header->table_size;
+    index->base_paths = (const char *)(index->base_slots + index->base_table_size);
+    index->base_paths_size = header->paths_size;
+    return FRACTYL_OK;
+}
+
+// Read only the header of the branch's binary index
+int binary_index_load_header(binary_index_header_t *header, const char *fractyl_dir, const char *branch) {
+    if (!header || !fractyl_dir || !branch) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    char *index_path = get_index_path(fractyl_dir, branch);
+    if (!index_path) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    int fd = open(index_path, O_RDONLY);
+    free(index_path);
+    if (fd < 0) {
+        return FRACTYL_ERROR_NOT_FOUND;
     }
     
+    ssize_t got = read(fd, header, sizeof(*header));
     close(fd);
     
-    free(index_path);
+    if (got != (ssize_t)sizeof(*header) ||
+        header->signature != BINARY_INDEX_SIGNATURE ||
+        header->version != BINARY_INDEX_VERSION) {
+        return FRACTYL_ERROR_NOT_FOUND;
+    }
     return FRACTYL_OK;
 }
 
-// Save binary index to file
+// Kinds of entries iterator_next() returns
+#define ITERATE_FILES 1
+#define ITERATE_DIRECTORIES 2
+
+// Next entry of a wanted kind: saved entries, then added ones, skipping
+// removed entries and saved ones without a valid path
+static int iterator_next(binary_index_iterator_t *iter, int kinds,
+                         const char **path, const binary_index_entry_t **entry) {
+    if (!iter || !iter->index) return 0;
+    
+    const binary_index_t *index = iter->index;
+    while (iter->current < index->base_count + index->count) {
+        uint32_t i = iter->current++;
+        const binary_index_entry_t *candidate;
+        const char *candidate_path;
+        if (i < index->base_count) {
+            candidate = &index->base[i];
+            candidate_path = base_path(index, i);
+        } else {
+            candidate = &index->entries[i - index->base_count];
+            candidate_path = index->paths[i - index->base_count];
+        }
+        if (!candidate_path || (candidate->flags & BINARY_ENTRY_REMOVED) ||
+            !(kinds & (S_ISDIR(candidate->mode) ? ITERATE_DIRECTORIES : ITERATE_FILES))) {
+            continue;
+        }
+    
+        if (path) *path = candidate_path;
+        if (entry) *entry = candidate;
+        return 1;
+    }
+    return 0;
+}
+
+// Save binary index to file: the saved and added entries still live,
+// with a fresh lookup table
+// An entry to save, with its path
+typedef struct {
+    const char *path;
+    const binary_index_entry_t *entry;
+} saved_entry_t;
+
+static int compare_saved_entries(const void *a, const void *b) {
+    return strcmp(((const saved_entry_t *)a)->path, ((const saved_entry_t *)b)->path);
+}
+
 int binary_index_save(const binary_index_t *index, const char *fractyl_dir) {
     if (!index || !fractyl_dir) return FRACTYL_ERROR_INVALID_ARGS;
     
-    char *index_path = get_index_path(fractyl_dir, index->header.branch);
-    if (!index_path) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    uint32_t total = index->base_count + index->count;
+    saved_entry_t *saved = malloc((total ? total : 1) * sizeof(*saved));
+    if (!saved) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    binary_index_iterator_t iter;
+    binary_index_iterator_init(&iter, index);
+    uint32_t live = 0;
+    uint64_t paths_size = 0;
+    int sorted = 1;
+    while (iterator_next(&iter, ITERATE_FILES | ITERATE_DIRECTORIES, &saved[live].path, &saved[live].entry)) {
+        paths_size += strlen(saved[live].path) + 1;
+        if (live > 0 && sorted && strcmp(saved[live - 1].path, saved[live].path) > 0) sorted = 0;
+        live++;
+    }
     
-    FILE *f = fopen(index_path, "wb");
-    if (!f) {
-        free(index_path);
-        return FRACTYL_ERROR_IO;
+    // Entries are saved in path order, so scans can walk them in windows
+    // alongside the sorted snapshot index
+    if (!sorted) {
+        qsort(saved, live, sizeof(*saved), compare_saved_entries);
     }
     
-    // Write header
-    binary_index_header_t header = index->header;
-    header.checksum = 0; // Calculate later
+    uint32_t table_size = MIN_TABLE_SIZE;
+    while (table_size < live * 2) {
+        table_size *= 2;
+    }
+    binary_index_slot_t *slots = calloc(table_size, sizeof(binary_index_slot_t));
+    if (!slots) {
+        free(saved);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    for (uint32_t i = 0; i < live; i++) {
+        slot_insert(slots, table_size, binary_index_hash_path(saved[i].path), i + 1);
+    }
     
-    if (fwrite(&header, sizeof(header), 1, f) != 1) {
-        fclose(f);
-        free(index_path);
-        return FRACTYL_ERROR_IO;
+    int result = FRACTYL_ERROR_OUT_OF_MEMORY;
+    char *index_path = get_index_path(fractyl_dir, index->header.branch);
+    char *temp_path = index_path ? malloc(strlen(index_path) + 16) : NULL;
+    FILE *f = NULL;
+    if (temp_path) {
+        // Written beside the old index and renamed over it, so mappings
+        // of the old one (including this index's own) stay valid
+        sprintf(temp_path, "%s.tmpXXXXXX", index_path);
+        int fd = mkstemp(temp_path);
+        f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+        if (!f && fd >= 0) close(fd);
+        result = f ? FRACTYL_OK : FRACTYL_ERROR_IO;
     }
     
-    // Write entries
-    if (index->header.entry_count > 0) {
-        if (fwrite(index->entries, sizeof(binary_index_entry_t), 
-                  index->header.entry_count, f) != index->header.entry_count) {
-            fclose(f);
-            free(index_path);
-            return FRACTYL_ERROR_IO;
+    if (result == FRACTYL_OK) {
+        fchmod(fileno(f), 0644);
+    
+        binary_index_header_t header = index->header;
+        header.signature = BINARY_INDEX_SIGNATURE;
+        header.version = BINARY_INDEX_VERSION;
+        header.entry_count = live;
+        header.checksum = 0; // Calculate later
+        header.table_size = table_size;
+        header.reserved = 0;
+        header.paths_size = paths_size;
+        if (fwrite(&header, sizeof(header), 1, f) != 1) result = FRACTYL_ERROR_IO;
+    
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < live && result == FRACTYL_OK; i++) {
+            binary_index_entry_t entry = *saved[i].entry;
+            entry.path_length = (uint16_t)strlen(saved[i].path);
+            entry.flags = 0;
+            entry.path_offset = offset;
+            offset += entry.path_length + 1;
+            if (fwrite(&entry, sizeof(entry), 1, f) != 1) result = FRACTYL_ERROR_IO;
+        }
+        if (result == FRACTYL_OK &&
+            fwrite(slots, sizeof(binary_index_slot_t), table_size, f) != table_size) {
+            result = FRACTYL_ERROR_IO;
         }
-        
-        // Write variable-length paths
-        for (uint32_t i = 0; i < index->header.entry_count; i++) {
-            if (index->paths[i] && index->entries[i].path_length > 0) {
-                if (fwrite(index->paths[i], index->entries[i].path_length, 1, f) != 1) {
-                    fclose(f);
-                    free(index_path);
-                    return FRACTYL_ERROR_IO;
-                }
-            }
+        for (uint32_t i = 0; i < live && result == FRACTYL_OK; i++) {
+            if (fwrite(saved[i].path, strlen(saved[i].path) + 1, 1, f) != 1) result = FRACTYL_ERROR_IO;
         }
+    
+        if (fclose(f) != 0 && result == FRACTYL_OK) result = FRACTYL_ERROR_IO;
+        if (result == FRACTYL_OK && rename(temp_path, index_path) != 0) result = FRACTYL_ERROR_IO;
+        if (result != FRACTYL_OK) unlink(temp_path);
     }
     
-    fclose(f);
+    free(temp_path);
     free(index_path);
-    return FRACTYL_OK;
+    free(slots);
+    free(saved);
+    return result;
 }
 
-// Find entry by path using hash table (O(1) lookup)
+// Find entry by path (O(1) lookup in the slot tables)
 const binary_index_entry_t *binary_index_find_entry(const binary_index_t *index, 
                                                    const char *path, 
                                                    const char **entry_path) {
     if (!index || !path) return NULL;
     
-    uint32_t hash = binary_index_hash_path(path);
-    uint32_t bucket = hash & HASH_TABLE_MASK;
-    
-    struct index_hash_entry *entry = index->hash_table[bucket];
-    while (entry) {
-        if (entry->hash == hash && entry->index < index->header.entry_count) {
-            if (index->paths[entry->index] && 
-                strcmp(index->paths[entry->index], path) == 0) {
-                if (entry_path) *entry_path = index->paths[entry->index];
-                return &index->entries[entry->index];
-            }
-        }
-        entry = entry->next;
-    }
-    
-    return NULL;
+    const binary_index_entry_t *entry = find(index, path, binary_index_hash_path(path), entry_path);
+    return entry && !(entry->flags & BINARY_ENTRY_REMOVED) ? entry : NULL;
+}
+
+static void fill_entry(binary_index_entry_t *entry, const struct stat *file_stat, const unsigned char *hash) {
+    entry->mtime_sec = file_stat->st_mtime;
+    entry->mtime_nsec = file_stat->st_mtim.tv_nsec;
+    entry->ctime_sec = file_stat->st_ctime;
+    entry->ctime_nsec = file_stat->st_ctim.tv_nsec;
+    entry->size = file_stat->st_size;
+    entry->inode = file_stat->st_ino;
+    entry->dev = file_stat->st_dev;
+    entry->mode = file_stat->st_mode;
+    entry->uid = file_stat->st_uid;
+    entry->gid = file_stat->st_gid;
+    memcpy(entry->hash, hash, FRACTYL_HASH_SIZE);
 }
 
 // Add/update entry in index
@@ -346,123 +469,117 @@ int binary_index_update_entry(binary_index_t *index, const char *path,
                               const struct stat *file_stat, const unsigned char *hash) {
     if (!index || !path || !file_stat || !hash) return FRACTYL_ERROR_INVALID_ARGS;
     
-    // Check if entry already exists
+    size_t len = strlen(path);
+    if (len == 0) return FRACTYL_ERROR_INVALID_ARGS;
+    if (len >= MAX_PATH_LENGTH) return FRACTYL_ERROR_PATH_TOO_LONG;
+    
+    // Existing entries are updated where they are, saved ones in the mapping
     uint32_t hash_val = binary_index_hash_path(path);
-    uint32_t bucket = hash_val & HASH_TABLE_MASK;
-    
-    struct index_hash_entry *hash_entry = index->hash_table[bucket];
-    while (hash_entry) {
-        if (hash_entry->hash == hash_val && hash_entry->index < index->header.entry_count) {
-            if (index->paths[hash_entry->index] && 
-                strcmp(index->paths[hash_entry->index], path) == 0) {
-                // Update existing entry
-                binary_index_entry_t *entry = &index->entries[hash_entry->index];
-                entry->mtime_sec = file_stat->st_mtime;
-                entry->mtime_nsec = 0; // TODO: Use st_mtim.tv_nsec if available
-                entry->ctime_sec = file_stat->st_ctime;
-                entry->ctime_nsec = 0;
-                entry->size = file_stat->st_size;
-                entry->inode = file_stat->st_ino;
-                entry->dev = file_stat->st_dev;
-                entry->mode = file_stat->st_mode;
-                entry->uid = file_stat->st_uid;
-                entry->gid = file_stat->st_gid;
-                memcpy(entry->hash, hash, 20);
-                return FRACTYL_OK;
-            }
+    binary_index_entry_t *entry = find(index, path, hash_val, NULL);
+    if (entry) {
+        if (entry->flags & BINARY_ENTRY_REMOVED) {
+            entry->flags &= ~BINARY_ENTRY_REMOVED;
+            index->header.entry_count++;
         }
-        hash_entry = hash_entry->next;
+        fill_entry(entry, file_stat, hash);
+        return FRACTYL_OK;
     }
     
-    // Add new entry - need to resize arrays
-    uint32_t new_count = index->header.entry_count + 1;
-    
-    binary_index_entry_t *new_entries = realloc(index->entries, 
-                                                new_count * sizeof(binary_index_entry_t));
-    if (!new_entries) return FRACTYL_ERROR_OUT_OF_MEMORY;
-    index->entries = new_entries;
-    
-    char **new_paths = realloc(index->paths, new_count * sizeof(char *));
-    if (!new_paths) return FRACTYL_ERROR_OUT_OF_MEMORY;
-    index->paths = new_paths;
+    // New entry - goes to the overlay
+    int result = grow_added(index);
+    if (result != FRACTYL_OK) return result;
     
-    // Add new entry
-    uint32_t entry_idx = index->header.entry_count;
-    binary_index_entry_t *entry = &index->entries[entry_idx];
+    char *copy = arena_strndup(&index->arena, path, len);
+    if (!copy) return FRACTYL_ERROR_OUT_OF_MEMORY;
     
-    entry->mtime_sec = file_stat->st_mtime;
-    entry->mtime_nsec = 0;
-    entry->ctime_sec = file_stat->st_ctime;
-    entry->ctime_nsec = 0;
-    entry->size = file_stat->st_size;
-    entry->inode = file_stat->st_ino;
-    entry->dev = file_stat->st_dev;
-    entry->mode = file_stat->st_mode;
-    entry->uid = file_stat->st_uid;
-    entry->gid = file_stat->st_gid;
-    memcpy(entry->hash, hash, 20);
-    entry->path_length = strlen(path);
+    entry = &index->entries[index->count];
+    fill_entry(entry, file_stat, hash);
+    entry->path_length = (uint16_t)len;
     entry->flags = 0;
+    entry->path_offset = 0;
+    index->paths[index->count] = copy;
+    index->count++;
+    slot_insert(index->slots, index->table_size, hash_val, index->count);
     
-    index->paths[entry_idx] = strdup(path);
-    if (!index->paths[entry_idx]) return FRACTYL_ERROR_OUT_OF_MEMORY;
-    
-    // Add to hash table
-    struct index_hash_entry *new_hash_entry = malloc(sizeof(struct index_hash_entry));
-    if (!new_hash_entry) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    index->header.entry_count++;
+    return FRACTYL_OK;
+}
+
+// Remove entry from index. It keeps its slot, so a removed path that comes
+// back reuses its entry and probes past it still work.
+int binary_index_remove_entry(binary_index_t *index, const char *path) {
+    if (!index || !path) return FRACTYL_ERROR_INVALID_ARGS;
     
-    new_hash_entry->hash = hash_val;
-    new_hash_entry->index = entry_idx;
-    new_hash_entry->next = index->hash_table[bucket];
-    index->hash_table[bucket] = new_hash_entry;
+    binary_index_entry_t *entry = find(index, path, binary_index_hash_path(path), NULL);
+    if (!entry || (entry->flags & BINARY_ENTRY_REMOVED)) {
+        return FRACTYL_ERROR_NOT_FOUND;
+    }
     
-    index->header.entry_count = new_count;
+    entry->flags |= BINARY_ENTRY_REMOVED;
+    index->header.entry_count--;
     return FRACTYL_OK;
 }
 
-// Remove entry from index
-int binary_index_remove_entry(binary_index_t *index, const char *path) {
+// Directory records live under their path with a trailing '/', which no
+// file path has; the root's is "/"
+static int directory_key(const char *path, char *key, size_t size) {
+    int n = snprintf(key, size, "%s/", path);
+    return n > 0 && (size_t)n < size ? FRACTYL_OK : FRACTYL_ERROR_PATH_TOO_LONG;
+}
+
+int binary_index_update_directory(binary_index_t *index, const char *path, const struct stat *dir_stat,
+                                  uint32_t entry_count, const unsigned char *rules) {
+    if (!index || !path || !dir_stat || !rules) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    char key[MAX_PATH_LENGTH];
+    int result = directory_key(path, key, sizeof(key));
+    if (result != FRACTYL_OK) return result;
+    
+    // The entry count goes where a file's size would
+    struct stat st = *dir_stat;
+    st.st_size = entry_count;
+    return binary_index_update_entry(index, key, &st, rules);
+}
+
+const binary_index_entry_t *binary_index_find_directory(const binary_index_t *index, const char *path) {
+    if (!index || !path) return NULL;
+    
+    char key[MAX_PATH_LENGTH];
+    if (directory_key(path, key, sizeof(key)) != FRACTYL_OK) return NULL;
+    
+    const binary_index_entry_t *entry = binary_index_find_entry(index, key, NULL);
+    return entry && S_ISDIR(entry->mode) ? entry : NULL;
+}
+
+int binary_index_remove_directory(binary_index_t *index, const char *path) {
     if (!index || !path) return FRACTYL_ERROR_INVALID_ARGS;
     
-    uint32_t hash_val = binary_index_hash_path(path);
-    uint32_t bucket = hash_val & HASH_TABLE_MASK;
-    
-    // Remove from hash table
-    struct index_hash_entry **hash_entry_ptr = &index->hash_table[bucket];
-    while (*hash_entry_ptr) {
-        struct index_hash_entry *hash_entry = *hash_entry_ptr;
-        if (hash_entry->hash == hash_val && hash_entry->index < index->header.entry_count) {
-            if (index->paths[hash_entry->index] && 
-                strcmp(index->paths[hash_entry->index], path) == 0) {
-                
-                uint32_t remove_idx = hash_entry->index;
-                
-                // Remove from hash table
-                *hash_entry_ptr = hash_entry->next;
-                free(hash_entry);
-                
-                // Free path
-                free(index->paths[remove_idx]);
-                
-                // Move last entry to removed position
-                uint32_t last_idx = index->header.entry_count - 1;
-                if (remove_idx != last_idx) {
-                    index->entries[remove_idx] = index->entries[last_idx];
-                    index->paths[remove_idx] = index->paths[last_idx];
-                    
-                    // Update hash table for moved entry
-                    // TODO: This is complex - for now just rebuild hash table
-                    build_hash_table(index);
-                }
-                
-                index->header.entry_count--;
-                return FRACTYL_OK;
-            }
-        }
-        hash_entry_ptr = &hash_entry->next;
+    char key[MAX_PATH_LENGTH];
+    int result = directory_key(path, key, sizeof(key));
+    return result == FRACTYL_OK ? binary_index_remove_entry(index, key) : result;
+}
+
+binary_file_status_t binary_index_check_directory(const binary_index_t *index, const char *path,
+                                                  const struct stat *dir_stat, const unsigned char *rules) {
+    if (!index || !path || !dir_stat || !rules) return BINARY_FILE_NEW;
+    
+    const binary_index_entry_t *entry = binary_index_find_directory(index, path);
+    if (!entry) {
+        return BINARY_FILE_NEW;
+    }
+    
+    // A directory's mtime and ctime change whenever an entry is added,
+    // removed or renamed; the rules catch edits to its ignore files
+    if (entry->mtime_sec != (uint32_t)dir_stat->st_mtime ||
+        entry->mtime_nsec != (uint32_t)dir_stat->st_mtim.tv_nsec ||
+        entry->ctime_sec != (uint32_t)dir_stat->st_ctime ||
+        entry->ctime_nsec != (uint32_t)dir_stat->st_ctim.tv_nsec ||
+        entry->inode != (uint64_t)dir_stat->st_ino ||
+        memcmp(entry->hash, rules, FRACTYL_HASH_SIZE) != 0) {
+        return BINARY_FILE_CHANGED;
     }
     
-    return FRACTYL_ERROR_NOT_FOUND;
+    return BINARY_FILE_UNCHANGED;
 }
 
 // Check file status against index
@@ -471,8 +588,11 @@ binary_file_status_t binary_index_check_file(const binary_index_t *index,
                                             const struct stat *current_stat) {
     if (!index || !path || !current_stat) return BINARY_FILE_NEW;
     
+    counters_add(COUNTER_BINARY_LOOKUPS, 1);
+    counters_add(COUNTER_FILES_SCANNED, 1);
     const binary_index_entry_t *entry = binary_index_find_entry(index, path, NULL);
     if (!entry) {
+        counters_add(COUNTER_NEW_FILES, 1);
         return BINARY_FILE_NEW;
     }
     
@@ -481,9 +601,12 @@ binary_file_status_t binary_index_check_file(const binary_index_t *index,
         entry->size != (uint64_t)current_stat->st_size ||
         entry->inode != (uint64_t)current_stat->st_ino ||
         entry->mode != current_stat->st_mode) {
+        counters_add(COUNTER_REHASHED, 1);
         return BINARY_FILE_CHANGED;
     }
     
+    counters_add(COUNTER_BINARY_HITS, 1);
+    counters_add(COUNTER_STAT_HITS, 1);
     return BINARY_FILE_UNCHANGED;
 }
 
@@ -497,13 +620,10 @@ void binary_index_iterator_init(binary_index_iterator_t *iter, const binary_inde
 int binary_index_iterator_next(binary_index_iterator_t *iter, 
                               const char **path, 
                               const binary_index_entry_t **entry) {
-    if (!iter || !iter->index || iter->current >= iter->index->header.entry_count) {
-        return 0;
-    }
-    
-    if (path) *path = iter->index->paths[iter->current];
-    if (entry) *entry = &iter->index->entries[iter->current];
-    
-    iter->current++;
-    return 1;
-}
\ No newline at end of file
+    return iterator_next(iter, ITERATE_FILES, path, entry);
+}
+
+int binary_index_iterator_next_directory(binary_index_iterator_t *iter, const char **key,
+                                         const binary_index_entry_t **entry) {
+    return iterator_next(iter, ITERATE_DIRECTORIES, key, entry);
+}
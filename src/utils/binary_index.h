@@ -5,15 +5,29 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include "arena.h"
 
+// The binary index is the stat cache every scan engine reads and updates:
+// whole content hashes and stat data of files, and the mtimes and entry
+// counts of directories, one file per branch.
+//
 // Binary index format (similar to git's index)
-// Fixed-size entries for fast access and memory mapping
+// Fixed-size entries, laid out to be used in place from a mapping:
+//
+//   header | entries[entry_count] | slots[table_size] | path pool
+//
+// The slots are an open-addressing table over the entries (linear
+// probing from hash & (table_size - 1)), so a loaded index answers
+// lookups without building anything. Paths are NUL-terminated in the pool
+// and entries name theirs by offset. Entries are saved in path (strcmp)
+// order, which iteration keeps; entries added since loading come after.
 
 #define BINARY_INDEX_SIGNATURE 0x46524143  // "FRAC" 
-#define BINARY_INDEX_VERSION 1
+// Version 3 is used in place; older indexes are rebuilt
+#define BINARY_INDEX_VERSION 3
 #define MAX_PATH_LENGTH 1024
 
-// Binary index header (32 bytes)
+// Binary index header (56 bytes)
 typedef struct {
     uint32_t signature;       // "FRAC" magic number
     uint32_t version;         // Index format version
@@ -21,9 +35,12 @@ typedef struct {
     uint32_t checksum;        // CRC32 of entries
     char branch[16];          // Git branch name (null-terminated)
     uint64_t timestamp;       // Index creation time
+    uint32_t table_size;      // Lookup slots, a power of 2
+    uint32_t reserved;
+    uint64_t paths_size;      // Bytes in the path pool
 } __attribute__((packed)) binary_index_header_t;
 
-// Binary index entry (64 bytes fixed size)
+// Binary index entry (88 bytes fixed size)
 typedef struct {
     uint32_t mtime_sec;       // Modification time (seconds)
     uint32_t mtime_nsec;      // Modification time (nanoseconds)
@@ -35,29 +52,48 @@ typedef struct {
     uint32_t mode;            // File mode/permissions
     uint32_t uid;             // User ID
     uint32_t gid;             // Group ID
-    unsigned char hash[20];   // SHA-1 hash (like git)
+    unsigned char hash[32];   // Content hash (FRACTYL_HASH_SIZE)
     uint16_t path_length;     // Length of path string
     uint16_t flags;           // Status flags
+    uint32_t path_offset;     // Where the path starts in the pool
 } __attribute__((packed)) binary_index_entry_t;
 
-// In-memory index with hash table for O(1) lookups
+// Entry flags
+#define BINARY_ENTRY_REMOVED 0x0001   // Skipped by lookups, dropped on save
+
+// Lookup slot; entry is the entry's position plus one, 0 if the slot is free
 typedef struct {
-    binary_index_header_t header;
-    binary_index_entry_t *entries;
-    char **paths;             // Variable-length paths
+    uint32_t hash;            // binary_index_hash_path() of the entry's path
+    uint32_t entry;
+} __attribute__((packed)) binary_index_slot_t;
+
+// A loaded index: the saved entries straight from a private mapping of
+// the file, plus an overlay of entries added since, merged on save.
+// Updating a saved entry writes to the mapping, which only copies the
+// page it is on.
+typedef struct {
+    binary_index_header_t header;       // entry_count counts both parts
     
-    // Hash table for fast lookups
-    struct index_hash_entry {
-        uint32_t hash;        // Hash of path
-        uint32_t index;       // Index into entries array
-        struct index_hash_entry *next;
-    } **hash_table;
-    uint32_t hash_table_size;
+    // Saved entries, in the mapping
+    binary_index_entry_t *base;
+    const binary_index_slot_t *base_slots;
+    const char *base_paths;
+    uint64_t base_paths_size;
+    uint32_t base_count;
+    uint32_t base_table_size;
+    
+    // Added entries
+    binary_index_entry_t *entries;
+    char **paths;             // Allocated from arena
+    uint32_t count;
+    uint32_t capacity;
+    binary_index_slot_t *slots;
+    uint32_t table_size;
+    arena_t arena;
     
     // Memory mapping info
     void *mmap_addr;
     size_t mmap_size;
-    int mmap_fd;
 } binary_index_t;
 
 // File change detection results
@@ -77,15 +113,38 @@ void binary_index_free(binary_index_t *index);
 // Load binary index from file (with memory mapping)
 int binary_index_load(binary_index_t *index, const char *fractyl_dir, const char *branch);
 
+// Read just the header of the saved index, without loading entries
+// Returns FRACTYL_ERROR_NOT_FOUND if there is no valid index for the branch
+int binary_index_load_header(binary_index_header_t *header, const char *fractyl_dir, const char *branch);
+
 // Save binary index to file
 int binary_index_save(const binary_index_t *index, const char *fractyl_dir);
 
 // Add/update entry in index
 int binary_index_update_entry(binary_index_t *index, const char *path, const struct stat *file_stat, const unsigned char *hash);
 
-// Find entry by path (O(1) hash table lookup)
+// Find entry by path (O(1) lookup in the slot tables)
 const binary_index_entry_t *binary_index_find_entry(const binary_index_t *index, const char *path, const char **entry_path);
 
+// Record a directory's stat data and entry count (everything readdir()
+// returns but "." and ".."). rules is a FRACTYL_HASH_SIZE digest of the
+// ignore files in effect, supplied by the scanner. Directory records are
+// kept under the path with a trailing '/' ("/" for the root) and are not
+// returned by binary_index_iterator_next().
+int binary_index_update_directory(binary_index_t *index, const char *path, const struct stat *dir_stat,
+                                  uint32_t entry_count, const unsigned char *rules);
+
+// The record of the directory at path, or NULL
+const binary_index_entry_t *binary_index_find_directory(const binary_index_t *index, const char *path);
+
+int binary_index_remove_directory(binary_index_t *index, const char *path);
+
+// UNCHANGED if the directory's stat data says nothing was added to or
+// removed from it since it was recorded, under the same ignore rules.
+// Needs only a stat() of the directory, not a read of it.
+binary_file_status_t binary_index_check_directory(const binary_index_t *index, const char *path,
+                                                  const struct stat *dir_stat, const unsigned char *rules);
+
 // Check file status against index
 binary_file_status_t binary_index_check_file(const binary_index_t *index, const char *path, const struct stat *current_stat);
 
@@ -100,6 +159,9 @@ typedef struct {
 
 void binary_index_iterator_init(binary_index_iterator_t *iter, const binary_index_t *index);
 int binary_index_iterator_next(binary_index_iterator_t *iter, const char **path, const binary_index_entry_t **entry);
+// Same for directory records; key is the directory's path with its '/'
+int binary_index_iterator_next_directory(binary_index_iterator_t *iter, const char **key,
+                                         const binary_index_entry_t **entry);
 
 // Utility functions
 uint32_t binary_index_hash_path(const char *path);
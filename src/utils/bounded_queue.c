@@ -0,0 +1,90 @@
+#include "bounded_queue.h"
+#include "../include/fractyl.h"
+#include <stdlib.h>
+#include <string.h>
+
+int bounded_queue_init(bounded_queue_t *queue, size_t capacity) {
+    if (!queue || capacity == 0) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    memset(queue, 0, sizeof(*queue));
+    queue->items = malloc(capacity * sizeof(void*));
+    if (!queue->items) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    queue->capacity = capacity;
+    
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return FRACTYL_OK;
+}
+
+void bounded_queue_destroy(bounded_queue_t *queue) {
+    if (!queue || !queue->items) return;
+    
+    free(queue->items);
+    queue->items = NULL;
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+int bounded_queue_push(bounded_queue_t *queue, void *item) {
+    pthread_mutex_lock(&queue->lock);
+    
+    while (queue->count == queue->capacity && !queue->closed) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    if (queue->closed) {
+        pthread_mutex_unlock(&queue->lock);
+        return FRACTYL_ERROR_INVALID_STATE;
+    }
+    
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return FRACTYL_OK;
+}
+
+void* bounded_queue_pop(bounded_queue_t *queue) {
+    return bounded_queue_pop_peek(queue, 0, NULL, NULL);
+}
+
+void* bounded_queue_pop_peek(bounded_queue_t *queue, size_t ahead,
+                             void (*peek)(void *item, void *ctx), void *ctx) {
+    pthread_mutex_lock(&queue->lock);
+    
+    while (queue->count == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    
+    void *item = NULL;
+    if (queue->count > 0) {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+        if (peek && ahead > 0 && queue->count > 0) {
+            size_t position = ahead <= queue->count ? ahead - 1 : queue->count - 1;
+            peek(queue->items[(queue->head + position) % queue->capacity], ctx);
+        }
+    }
+    
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
+
+size_t bounded_queue_length(bounded_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    size_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+void bounded_queue_close(bounded_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+}
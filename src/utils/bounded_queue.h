@@ -0,0 +1,48 @@
+#ifndef FRACTYL_BOUNDED_QUEUE_H
+#define FRACTYL_BOUNDED_QUEUE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Fixed-capacity FIFO of pointers shared between pipeline stages.
+// Producers block while it is full, which throttles a fast stage to the
+// speed of the one after it; consumers block while it is empty.
+typedef struct {
+    void **items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} bounded_queue_t;
+
+// Returns FRACTYL_OK or FRACTYL_ERROR_OUT_OF_MEMORY
+int bounded_queue_init(bounded_queue_t *queue, size_t capacity);
+
+// Free the queue; any items still queued are not freed
+void bounded_queue_destroy(bounded_queue_t *queue);
+
+// Append an item, waiting for room. Returns FRACTYL_ERROR_INVALID_STATE
+// if the queue has been closed.
+int bounded_queue_push(bounded_queue_t *queue, void *item);
+
+// Take the oldest item, waiting for one. Returns NULL once the queue is
+// closed and drained.
+void* bounded_queue_pop(bounded_queue_t *queue);
+
+// Take the oldest item like bounded_queue_pop(), then, still holding the
+// queue's lock, pass peek the item queued ahead places behind it (the
+// newest when fewer are queued). peek must be quick: another consumer may
+// take and free that item as soon as the lock is released.
+void* bounded_queue_pop_peek(bounded_queue_t *queue, size_t ahead,
+                             void (*peek)(void *item, void *ctx), void *ctx);
+
+// Number of items currently queued
+size_t bounded_queue_length(bounded_queue_t *queue);
+
+// Signal that no more items will be pushed and wake all waiters
+void bounded_queue_close(bounded_queue_t *queue);
+
+#endif // FRACTYL_BOUNDED_QUEUE_H
@@ -0,0 +1,864 @@
+#define _GNU_SOURCE  // For syncfs
+#include "catalog.h"
+#include "json.h"
+#include "snapshot_record.h"
+#include "../include/fractyl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CATALOG_HEADER_SIZE 16
+#define CATALOG_RECORD_SIZE 192
+#define CATALOG_TRAILER_SIZE 4
+#define CATALOG_ADDED 'A'
+#define CATALOG_DELETED 'D'
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+static uint32_t checksum_update(uint32_t hash, const unsigned char *data, size_t size) {
+    // FNV-1a
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Checksum of a record whose strings follow it
+static uint32_t record_checksum(const unsigned char *rec, size_t strings_size) {
+    unsigned char copy[CATALOG_RECORD_SIZE];
+    memcpy(copy, rec, sizeof(copy));
+    put_u32(copy + 180, 0);
+    uint32_t hash = checksum_update(2166136261u, copy, sizeof(copy));
+    return checksum_update(hash, rec + CATALOG_RECORD_SIZE, strings_size);
+}
+
+static int catalog_path(const char *snapshots_dir, char *out, size_t out_size) {
+    if (snprintf(out, out_size, "%s%s", snapshots_dir, CATALOG_SUFFIX) >= (int)out_size) {
+        return FRACTYL_ERROR_PATH_TOO_LONG;
+    }
+    return FRACTYL_OK;
+}
+
+static void write_header(unsigned char *header) {
+    memcpy(header, "FCAT", 4);
+    put_u32(header + 4, CATALOG_VERSION);
+    put_u32(header + 8, CATALOG_RECORD_SIZE);
+    put_u32(header + 12, 0);
+}
+
+static int header_valid(const unsigned char *data, size_t size) {
+    unsigned char header[CATALOG_HEADER_SIZE];
+    write_header(header);
+    return size >= CATALOG_HEADER_SIZE && memcmp(data, header, sizeof(header)) == 0;
+}
+
+// Encode a record of snapshot into a malloc'd buffer. Removals only carry the id.
+static int encode_record(uint32_t kind, const snapshot_t *snapshot, unsigned char **out,
+                         size_t *out_size) {
+    const char *strings[3] = { snapshot->description, snapshot->git_branch, snapshot->git_commit };
+    uint32_t flags = 0;
+    size_t strings_size = 0;
+    for (int i = 0; i < 3; i++) {
+        if (kind == CATALOG_ADDED && strings[i]) {
+            flags |= CATALOG_HAS_DESCRIPTION << i;
+        } else {
+            strings[i] = "";
+        }
+        strings_size += strlen(strings[i]) + 1;
+    }
+    if (kind == CATALOG_ADDED && snapshot->git_dirty) flags |= CATALOG_GIT_DIRTY;
+    if (strings_size > UINT32_MAX - CATALOG_RECORD_SIZE - CATALOG_TRAILER_SIZE) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    size_t size = CATALOG_RECORD_SIZE + strings_size + CATALOG_TRAILER_SIZE;
+    unsigned char *rec = calloc(1, size);
+    if (!rec) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    put_u32(rec, kind);
+    put_u32(rec + 4, (uint32_t)strings_size);
+    snprintf((char *)rec + 48, 64, "%s", snapshot->id);
+    if (kind == CATALOG_ADDED) {
+        put_u64(rec + 8, (uint64_t)(int64_t)snapshot->timestamp);
+        memcpy(rec + 16, snapshot->index_hash, 32);
+        if (snapshot->parent) snprintf((char *)rec + 112, 64, "%s", snapshot->parent);
+        put_u32(rec + 176, flags);
+    }
+    size_t offset = CATALOG_RECORD_SIZE;
+    for (int i = 0; i < 3; i++) {
+        size_t len = strlen(strings[i]) + 1;
+        memcpy(rec + offset, strings[i], len);
+        offset += len;
+    }
+    put_u32(rec + 180, record_checksum(rec, strings_size));
+    put_u32(rec + offset, (uint32_t)size);
+    
+    *out = rec;
+    *out_size = size;
+    return FRACTYL_OK;
+}
+
+// Check the record at offset of data; *size_out receives its total length
+static int parse_record(const unsigned char *data, size_t size, size_t offset, uint32_t *kind_out,
+                        catalog_entry_t *entry, size_t *size_out) {
+    if (size - offset < CATALOG_RECORD_SIZE + CATALOG_TRAILER_SIZE) return FRACTYL_ERROR_GENERIC;
+    const unsigned char *rec = data + offset;
+    size_t strings_size = get_u32(rec + 4);
+    if (strings_size > size - offset - CATALOG_RECORD_SIZE - CATALOG_TRAILER_SIZE) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    size_t total = CATALOG_RECORD_SIZE + strings_size + CATALOG_TRAILER_SIZE;
+    uint32_t kind = get_u32(rec);
+    if ((kind != CATALOG_ADDED && kind != CATALOG_DELETED) ||
+        get_u32(rec + total - CATALOG_TRAILER_SIZE) != total ||
+        get_u32(rec + 180) != record_checksum(rec, strings_size) ||
+        !memchr(rec + 48, '\0', 64) || rec[48] == '\0' || !memchr(rec + 112, '\0', 64)) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    
+    // Exactly three strings
+    const unsigned char *strings = rec + CATALOG_RECORD_SIZE;
+    size_t nuls = 0;
+    for (size_t i = 0; i < strings_size; i++) {
+        if (strings[i] == '\0') nuls++;
+    }
+    if (nuls != 3 || strings[strings_size - 1] != '\0') return FRACTYL_ERROR_GENERIC;
+    
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->id, rec + 48, sizeof(entry->id));
+    memcpy(entry->parent, rec + 112, sizeof(entry->parent));
+    entry->timestamp = (time_t)(int64_t)get_u64(rec + 8);
+    memcpy(entry->index_hash, rec + 16, 32);
+    entry->flags = get_u32(rec + 176);
+    entry->strings_offset = offset + CATALOG_RECORD_SIZE;
+    *kind_out = kind;
+    *size_out = total;
+    return FRACTYL_OK;
+}
+
+typedef struct {
+    catalog_entry_t entry;
+    uint32_t kind;
+    size_t seq;
+    size_t id_rank;
+} catalog_op_t;
+
+static int op_id_compare(const void *a, const void *b) {
+    const catalog_op_t *oa = a;
+    const catalog_op_t *ob = b;
+    int cmp = strcmp(oa->entry.id, ob->entry.id);
+    if (cmp != 0) return cmp;
+    return oa->seq < ob->seq ? -1 : oa->seq > ob->seq;
+}
+
+static int op_seq_compare(const void *a, const void *b) {
+    const catalog_op_t *oa = a;
+    const catalog_op_t *ob = b;
+    return oa->seq < ob->seq ? -1 : oa->seq > ob->seq;
+}
+
+// Oldest first; of two in the same second, the one stored first is older
+static int op_time_compare(const void *a, const void *b) {
+    const catalog_op_t *oa = a;
+    const catalog_op_t *ob = b;
+    if (oa->entry.timestamp != ob->entry.timestamp) {
+        return oa->entry.timestamp < ob->entry.timestamp ? -1 : 1;
+    }
+    return op_seq_compare(a, b);
+}
+
+// Link every entry to its parent and number the generations. Parents are
+// nearly always older, but the numbering does not rely on it: each
+// unnumbered lineage is walked up to a numbered entry or a root and numbered
+// on the way back down.
+static int build_graph(catalog_t *catalog) {
+    for (size_t i = 0; i < catalog->count; i++) {
+        catalog_entry_t *entry = &catalog->entries[i];
+        const catalog_entry_t *parent = entry->parent[0] ? catalog_find(catalog, entry->parent) : NULL;
+        entry->parent_pos = parent ? (size_t)(parent - catalog->entries) : CATALOG_NO_PARENT;
+        entry->generation = 0;
+    }
+    
+    size_t *lineage = malloc(sizeof(size_t) * (catalog->count ? catalog->count : 1));
+    if (!lineage) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    for (size_t i = 0; i < catalog->count; i++) {
+        size_t depth = 0;
+        size_t pos = i;
+        while (pos != CATALOG_NO_PARENT && catalog->entries[pos].generation == 0) {
+            catalog->entries[pos].generation = UINT32_MAX; // On the walk
+            lineage[depth++] = pos;
+            pos = catalog->entries[pos].parent_pos;
+        }
+        uint32_t generation = 0;
+        if (pos != CATALOG_NO_PARENT) {
+            if (catalog->entries[pos].generation == UINT32_MAX) {
+                // Parent ids that loop back: the entry the walk ended on
+                // becomes a root
+                catalog->entries[lineage[depth - 1]].parent_pos = CATALOG_NO_PARENT;
+            } else {
+                generation = catalog->entries[pos].generation;
+            }
+        }
+        while (depth > 0) {
+            catalog->entries[lineage[--depth]].generation = ++generation;
+        }
+    }
+    free(lineage);
+    return FRACTYL_OK;
+}
+
+// Turn catalog->data into entries. A record that does not check out ends
+// the catalog: it is a write cut short.
+static int parse_catalog(catalog_t *catalog) {
+    if (!header_valid(catalog->data, catalog->size)) return FRACTYL_ERROR_GENERIC;
+    
+    catalog_op_t *ops = NULL;
+    size_t count = 0, capacity = 0;
+    size_t offset = CATALOG_HEADER_SIZE;
+    while (offset < catalog->size) {
+        catalog_op_t op;
+        size_t size;
+        if (parse_record(catalog->data, catalog->size, offset, &op.kind, &op.entry, &size) != FRACTYL_OK) {
+            break;
+        }
+        if (count >= capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 64;
+            catalog_op_t *grown = realloc(ops, new_capacity * sizeof(catalog_op_t));
+            if (!grown) {
+                free(ops);
+                return FRACTYL_ERROR_OUT_OF_MEMORY;
+            }
+            ops = grown;
+            capacity = new_capacity;
+        }
+        op.seq = count;
+        ops[count++] = op;
+        offset += size;
+    }
+    
+    // The last record of an id says whether the snapshot exists
+    if (count > 1) qsort(ops, count, sizeof(catalog_op_t), op_id_compare);
+    size_t live = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i + 1 < count && strcmp(ops[i].entry.id, ops[i + 1].entry.id) == 0) continue;
+        if (ops[i].kind == CATALOG_ADDED) {
+            ops[live] = ops[i];
+            ops[live].id_rank = live;
+            live++;
+        }
+    }
+    
+    // Records are appended as snapshots are taken, so they are nearly
+    // always in time order already; only a clock that went back needs the sort
+    if (live > 1) qsort(ops, live, sizeof(catalog_op_t), op_seq_compare);
+    for (size_t i = 1; i < live; i++) {
+        if (ops[i].entry.timestamp < ops[i - 1].entry.timestamp) {
+            qsort(ops, live, sizeof(catalog_op_t), op_time_compare);
+            break;
+        }
+    }
+    
+    catalog->entries = malloc(sizeof(catalog_entry_t) * (live ? live : 1));
+    catalog->by_id = malloc(sizeof(size_t) * (live ? live : 1));
+    if (!catalog->entries || !catalog->by_id) {
+        free(ops);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    for (size_t i = 0; i < live; i++) {
+        catalog->entries[i] = ops[i].entry;
+        catalog->by_id[ops[i].id_rank] = i;
+    }
+    catalog->count = live;
+    free(ops);
+    return build_graph(catalog);
+}
+
+static int mtime_not_before(const struct stat *a, const struct stat *b) {
+    return a->st_mtim.tv_sec > b->st_mtim.tv_sec ||
+           (a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec >= b->st_mtim.tv_nsec);
+}
+
+// Nonzero if the catalog at path was written after the last change to
+// snapshots_dir and its last record is whole: appending to it keeps it
+// complete. Only the header and the last record are read.
+static int catalog_current(const char *snapshots_dir, const char *path) {
+    struct stat dir_st, st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    
+    int current = fstat(fd, &st) == 0 && stat(snapshots_dir, &dir_st) == 0 &&
+                  mtime_not_before(&st, &dir_st);
+    unsigned char header[CATALOG_HEADER_SIZE];
+    size_t size = (size_t)st.st_size;
+    if (current) {
+        current = pread(fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                  header_valid(header, sizeof(header));
+    }
+    if (current && size > CATALOG_HEADER_SIZE) {
+        unsigned char trailer[CATALOG_TRAILER_SIZE];
+        size_t length = 0;
+        if (pread(fd, trailer, sizeof(trailer), (off_t)(size - sizeof(trailer))) == (ssize_t)sizeof(trailer)) {
+            length = get_u32(trailer);
+        }
+        unsigned char *rec = NULL;
+        if (length >= CATALOG_RECORD_SIZE + CATALOG_TRAILER_SIZE && length <= size - CATALOG_HEADER_SIZE) {
+            rec = malloc(length);
+        }
+        uint32_t kind;
+        catalog_entry_t entry;
+        size_t parsed;
+        current = rec && pread(fd, rec, length, (off_t)(size - length)) == (ssize_t)length &&
+                  parse_record(rec, length, 0, &kind, &entry, &parsed) == FRACTYL_OK;
+        free(rec);
+    }
+    close(fd);
+    return current;
+}
+
+typedef struct {
+    unsigned char *rec;
+    size_t size;
+    time_t timestamp;
+} built_record_t;
+
+static int built_record_compare(const void *a, const void *b) {
+    const built_record_t *ra = a;
+    const built_record_t *rb = b;
+    if (ra->timestamp != rb->timestamp) return ra->timestamp < rb->timestamp ? -1 : 1;
+    return strcmp((const char *)ra->rec + 48, (const char *)rb->rec + 48);
+}
+
+// Suffix of a snapshot file name: a record or the JSON of an older snapshot
+static int snapshot_file_kind(const char *name, int *is_record) {
+    size_t len = strlen(name);
+    if (name[0] == '.') return 0;
+    if (len > 5 && strcmp(name + len - 5, SNAPSHOT_RECORD_SUFFIX) == 0) {
+        *is_record = 1;
+        return 1;
+    }
+    if (len > 5 && strcmp(name + len - 5, ".json") == 0) {
+        *is_record = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// Path of the record of snapshot id, or of its JSON if is_record is 0
+static int snapshot_file_path(const char *snapshots_dir, const char *id, int is_record, char *out,
+                              size_t out_size) {
+    if (snprintf(out, out_size, "%s/%s%s", snapshots_dir, id, is_record ? SNAPSHOT_RECORD_SUFFIX : ".json") >=
+        (int)out_size) {
+        return FRACTYL_ERROR_PATH_TOO_LONG;
+    }
+    return FRACTYL_OK;
+}
+
+// Whether the JSON file name has a record beside it, which replaced it
+static int json_replaced(const char *snapshots_dir, const char *name) {
+    char path[4096];
+    struct stat st;
+    size_t len = strlen(name);
+    return snprintf(path, sizeof(path), "%s/%.*s%s", snapshots_dir, (int)(len - 5), name,
+                    SNAPSHOT_RECORD_SUFFIX) < (int)sizeof(path) &&
+           stat(path, &st) == 0;
+}
+
+// Encode every snapshot of snapshots_dir, oldest first, into a catalog image
+static int build_image(const char *snapshots_dir, catalog_t *catalog) {
+    DIR *d = opendir(snapshots_dir);
+    if (!d) return errno == ENOENT ? FRACTYL_ERROR_NOT_FOUND : FRACTYL_ERROR_IO;
+    
+    built_record_t *records = NULL;
+    size_t count = 0, capacity = 0;
+    int result = FRACTYL_OK;
+    struct dirent *entry;
+    while (result == FRACTYL_OK && (entry = readdir(d)) != NULL) {
+        int is_record;
+        if (!snapshot_file_kind(entry->d_name, &is_record) ||
+            (!is_record && json_replaced(snapshots_dir, entry->d_name))) {
+            continue;
+        }
+    
+        char snapshot_path[4096];
+        snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", snapshots_dir, entry->d_name);
+        snapshot_t snapshot;
+        int loaded = is_record ? snapshot_record_load(&snapshot, snapshot_path)
+                               : json_load_snapshot(&snapshot, snapshot_path);
+        if (loaded != FRACTYL_OK || snapshot.id[0] == '\0') {
+            catalog->unreadable++;
+            continue;
+        }
+        if (count >= capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 64;
+            built_record_t *grown = realloc(records, new_capacity * sizeof(built_record_t));
+            if (!grown) {
+                json_free_snapshot(&snapshot);
+                result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            records = grown;
+            capacity = new_capacity;
+        }
+        records[count].timestamp = snapshot.timestamp;
+        result = encode_record(CATALOG_ADDED, &snapshot, &records[count].rec, &records[count].size);
+        if (result == FRACTYL_OK) count++;
+        json_free_snapshot(&snapshot);
+    }
+    closedir(d);
+    
+    size_t size = CATALOG_HEADER_SIZE;
+    for (size_t i = 0; i < count; i++) {
+        size += records[i].size;
+    }
+    unsigned char *data = result == FRACTYL_OK ? malloc(size) : NULL;
+    if (result == FRACTYL_OK && !data) result = FRACTYL_ERROR_OUT_OF_MEMORY;
+    if (data) {
+        if (count > 1) qsort(records, count, sizeof(built_record_t), built_record_compare);
+        write_header(data);
+        size_t offset = CATALOG_HEADER_SIZE;
+        for (size_t i = 0; i < count; i++) {
+            memcpy(data + offset, records[i].rec, records[i].size);
+            offset += records[i].size;
+        }
+        catalog->data = data;
+        catalog->size = size;
+    }
+    for (size_t i = 0; i < count; i++) {
+        free(records[i].rec);
+    }
+    free(records);
+    return result;
+}
+
+// Rebuild the catalog of snapshots_dir into catalog and write it to path.
+// It is only renamed into place if the directory did not change while it
+// was being built, so it never misses a snapshot stored meanwhile.
+static int rebuild(const char *snapshots_dir, const char *path, catalog_t *catalog) {
+    struct stat before, after;
+    if (stat(snapshots_dir, &before) != 0) {
+        return errno == ENOENT ? FRACTYL_ERROR_NOT_FOUND : FRACTYL_ERROR_IO;
+    }
+    int result = build_image(snapshots_dir, catalog);
+    if (result != FRACTYL_OK) return result;
+    if (catalog->unreadable > 0) {
+        // Kept out of the file, so every load sees that snapshots are missing
+        return FRACTYL_OK;
+    }
+    
+    char temp_path[4096];
+    if (snprintf(temp_path, sizeof(temp_path), "%s.tmpXXXXXX", path) >= (int)sizeof(temp_path)) {
+        return FRACTYL_ERROR_PATH_TOO_LONG;
+    }
+    int fd = mkstemp(temp_path);
+    if (fd < 0) return FRACTYL_ERROR_IO;
+    fchmod(fd, 0644);
+    int written = write(fd, catalog->data, catalog->size) == (ssize_t)catalog->size;
+    if (close(fd) != 0) written = 0;
+    if (!written) {
+        unlink(temp_path);
+        return FRACTYL_ERROR_IO;
+    }
+    if (stat(snapshots_dir, &after) != 0 || after.st_mtim.tv_sec != before.st_mtim.tv_sec ||
+        after.st_mtim.tv_nsec != before.st_mtim.tv_nsec) {
+        // Built from a listing that is already out of date
+        unlink(temp_path);
+        return FRACTYL_OK;
+    }
+    if (rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return FRACTYL_ERROR_IO;
+    }
+    return FRACTYL_OK;
+}
+
+static int read_catalog(const char *path, catalog_t *catalog, struct stat *st_out) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return errno == ENOENT ? FRACTYL_ERROR_NOT_FOUND : FRACTYL_ERROR_IO;
+    if (fstat(fileno(fp), st_out) != 0) {
+        fclose(fp);
+        return FRACTYL_ERROR_IO;
+    }
+    catalog->size = (size_t)st_out->st_size;
+    catalog->data = malloc(catalog->size ? catalog->size : 1);
+    if (!catalog->data) {
+        fclose(fp);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    size_t got = fread(catalog->data, 1, catalog->size, fp);
+    fclose(fp);
+    return got == catalog->size ? FRACTYL_OK : FRACTYL_ERROR_IO;
+}
+
+int catalog_load(const char *snapshots_dir, catalog_t *catalog) {
+    if (!snapshots_dir || !catalog) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    memset(catalog, 0, sizeof(*catalog));
+    char path[4096];
+    int result = catalog_path(snapshots_dir, path, sizeof(path));
+    if (result != FRACTYL_OK) return result;
+    
+    struct stat dir_st, st;
+    if (stat(snapshots_dir, &dir_st) != 0) {
+        return errno == ENOENT ? FRACTYL_OK : FRACTYL_ERROR_IO;
+    }
+    if (read_catalog(path, catalog, &st) == FRACTYL_OK && mtime_not_before(&st, &dir_st)) {
+        result = parse_catalog(catalog);
+        if (result != FRACTYL_ERROR_GENERIC) {
+            if (result != FRACTYL_OK) catalog_free(catalog);
+            return result;
+        }
+    }
+    
+    // Missing, damaged or out of date: start over from the snapshot files.
+    // Failing to write the result leaves it to the next load.
+    catalog_free(catalog);
+    result = rebuild(snapshots_dir, path, catalog);
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        catalog_free(catalog);
+        return FRACTYL_OK;
+    }
+    if (catalog->data && (result == FRACTYL_OK || result == FRACTYL_ERROR_IO ||
+                          result == FRACTYL_ERROR_PATH_TOO_LONG)) {
+        result = parse_catalog(catalog);
+    }
+    if (result != FRACTYL_OK) catalog_free(catalog);
+    return result;
+}
+
+int catalog_rebuild(const char *snapshots_dir) {
+    if (!snapshots_dir) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    char path[4096];
+    int result = catalog_path(snapshots_dir, path, sizeof(path));
+    if (result != FRACTYL_OK) return result;
+    
+    catalog_t catalog;
+    memset(&catalog, 0, sizeof(catalog));
+    result = rebuild(snapshots_dir, path, &catalog);
+    catalog_free(&catalog);
+    return result;
+}
+
+void catalog_free(catalog_t *catalog) {
+    if (!catalog) return;
+    free(catalog->entries);
+    free(catalog->by_id);
+    free(catalog->data);
+    memset(catalog, 0, sizeof(*catalog));
+}
+
+// The i'th of an entry's strings, NULL if flag is not set
+static const char* entry_string(const catalog_t *catalog, const catalog_entry_t *entry, int i,
+                                uint32_t flag) {
+    if (!catalog || !entry || !(entry->flags & flag)) return NULL;
+    const char *s = (const char *)catalog->data + entry->strings_offset;
+    while (i-- > 0) {
+        s += strlen(s) + 1;
+    }
+    return s;
+}
+
+const char* catalog_description(const catalog_t *catalog, const catalog_entry_t *entry) {
+    return entry_string(catalog, entry, 0, CATALOG_HAS_DESCRIPTION);
+}
+
+const char* catalog_git_branch(const catalog_t *catalog, const catalog_entry_t *entry) {
+    return entry_string(catalog, entry, 1, CATALOG_HAS_GIT_BRANCH);
+}
+
+const char* catalog_git_commit(const catalog_t *catalog, const catalog_entry_t *entry) {
+    return entry_string(catalog, entry, 2, CATALOG_HAS_GIT_COMMIT);
+}
+
+const catalog_entry_t** catalog_newest_first(const catalog_t *catalog) {
+    if (!catalog) return NULL;
+    const catalog_entry_t **order = malloc(sizeof(catalog_entry_t *) * (catalog->count ? catalog->count : 1));
+    if (!order) return NULL;
+    for (size_t i = 0; i < catalog->count; i++) {
+        order[i] = &catalog->entries[catalog->count - 1 - i];
+    }
+    return order;
+}
+
+const catalog_entry_t* catalog_nth_newest(const catalog_t *catalog, size_t n) {
+    if (!catalog || n >= catalog->count) return NULL;
+    return &catalog->entries[catalog->count - 1 - n];
+}
+
+size_t catalog_first_since(const catalog_t *catalog, time_t timestamp) {
+    if (!catalog) return 0;
+    size_t lo = 0, hi = catalog->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (catalog->entries[mid].timestamp < timestamp) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+size_t catalog_find_prefix(const catalog_t *catalog, const char *prefix,
+                           const catalog_entry_t **matches, size_t max) {
+    if (!catalog || !prefix) return 0;
+    size_t prefix_len = strlen(prefix);
+    
+    // First id not below the prefix; the matches follow it
+    size_t lo = 0, hi = catalog->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(catalog->entries[catalog->by_id[mid]].id, prefix, prefix_len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t found = 0;
+    for (size_t i = lo; i < catalog->count; i++) {
+        const catalog_entry_t *entry = &catalog->entries[catalog->by_id[i]];
+        if (strncmp(entry->id, prefix, prefix_len) != 0) break;
+        if (found < max) matches[found] = entry;
+        found++;
+    }
+    return found;
+}
+
+// Position of id in by_id, or of the first id after it
+static size_t id_rank(const catalog_t *catalog, const char *id) {
+    size_t lo = 0, hi = catalog->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(catalog->entries[catalog->by_id[mid]].id, id) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static size_t common_prefix_length(const char *a, const char *b) {
+    size_t n = 0;
+    while (a[n] && a[n] == b[n]) n++;
+    return n;
+}
+
+// Whether id is a UUIDv7, which starts with the time it was made
+static int id_is_time_ordered(const char *id) {
+    return strlen(id) == 36 && id[8] == '-' && id[13] == '-' && id[14] == '7';
+}
+
+size_t catalog_abbrev_length(const catalog_t *catalog, const catalog_entry_t *entry, size_t min_length) {
+    size_t length = min_length;
+    if (entry && id_is_time_ordered(entry->id) && length < 13) {
+        length = 13;
+    }
+    if (catalog && entry) {
+        // Only the neighbours in id order can share a longer prefix
+        size_t rank = id_rank(catalog, entry->id);
+        if (rank > 0) {
+            size_t shared = common_prefix_length(entry->id, catalog->entries[catalog->by_id[rank - 1]].id);
+            if (shared + 1 > length) length = shared + 1;
+        }
+        if (rank + 1 < catalog->count) {
+            size_t shared = common_prefix_length(entry->id, catalog->entries[catalog->by_id[rank + 1]].id);
+            if (shared + 1 > length) length = shared + 1;
+        }
+    }
+    size_t id_length = entry ? strlen(entry->id) : 0;
+    return length < id_length ? length : id_length;
+}
+
+const catalog_entry_t* catalog_find(const catalog_t *catalog, const char *id) {
+    if (!catalog || !id) return NULL;
+    size_t rank = id_rank(catalog, id);
+    if (rank < catalog->count && strcmp(catalog->entries[catalog->by_id[rank]].id, id) == 0) {
+        return &catalog->entries[catalog->by_id[rank]];
+    }
+    return NULL;
+}
+
+const catalog_entry_t* catalog_parent(const catalog_t *catalog, const catalog_entry_t *entry) {
+    if (!catalog || !entry || entry->parent_pos == CATALOG_NO_PARENT) return NULL;
+    return &catalog->entries[entry->parent_pos];
+}
+
+int catalog_is_ancestor(const catalog_t *catalog, const catalog_entry_t *ancestor,
+                        const catalog_entry_t *entry) {
+    if (!ancestor) return 0;
+    while (entry && entry->generation > ancestor->generation) {
+        entry = catalog_parent(catalog, entry);
+    }
+    return entry == ancestor;
+}
+
+// Append a record to the catalog at path, or rebuild the catalog if it
+// could not take one (current is from catalog_current() before the snapshot
+// files changed)
+static void record_change(const char *snapshots_dir, const char *path, int current, uint32_t kind,
+                          const snapshot_t *snapshot) {
+    unsigned char *rec = NULL;
+    size_t size = 0;
+    if (!current || encode_record(kind, snapshot, &rec, &size) != FRACTYL_OK) {
+        catalog_rebuild(snapshots_dir);
+        return;
+    }
+    
+    // A rebuild renamed into place while this was appended may not have
+    // seen the change, so the record goes into the new file too
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+        if (fd < 0) break;
+        struct stat fd_st, path_st;
+        int written = write(fd, rec, size) == (ssize_t)size;
+        if (fstat(fd, &fd_st) != 0) written = 0;
+        if (close(fd) != 0) written = 0;
+        if (!written) {
+            // Whatever made it to the file would hide the change from
+            // catalog_current(); the next load rebuilds it instead
+            unlink(path);
+            break;
+        }
+        if (stat(path, &path_st) != 0 || path_st.st_ino == fd_st.st_ino) break;
+    }
+    free(rec);
+}
+
+// Replace the JSON files of snapshots_dir by records. Records are synced
+// before any JSON is removed, so a crash leaves one or the other. The
+// caller must hold a lock that keeps out deletes, or a snapshot deleted
+// meanwhile could come back.
+static void migrate_json_snapshots(const char *snapshots_dir) {
+    DIR *d = opendir(snapshots_dir);
+    if (!d) return;
+    char **converted = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        int is_record;
+        if (!snapshot_file_kind(entry->d_name, &is_record) || is_record) continue;
+        char json_path[4096], record_path[4096];
+        size_t len = strlen(entry->d_name);
+        if (snprintf(json_path, sizeof(json_path), "%s/%s", snapshots_dir, entry->d_name) >=
+                (int)sizeof(json_path) ||
+            snprintf(record_path, sizeof(record_path), "%s/%.*s%s", snapshots_dir, (int)(len - 5),
+                     entry->d_name, SNAPSHOT_RECORD_SUFFIX) >= (int)sizeof(record_path)) {
+            continue;
+        }
+        struct stat st;
+        if (stat(record_path, &st) != 0) {
+            snapshot_t snapshot;
+            if (json_load_snapshot(&snapshot, json_path) != FRACTYL_OK) continue;
+            int saved = snapshot.id[0] != '\0' && strlen(snapshot.id) == len - 5 &&
+                        strncmp(snapshot.id, entry->d_name, len - 5) == 0 &&
+                        snapshot_record_save(&snapshot, record_path) == FRACTYL_OK;
+            json_free_snapshot(&snapshot);
+            if (!saved) continue;
+        }
+        if (count >= capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(converted, new_capacity * sizeof(char *));
+            if (!grown) break;
+            converted = grown;
+            capacity = new_capacity;
+        }
+        if ((converted[count] = strdup(json_path)) != NULL) count++;
+    }
+    
+    int synced = count > 0 && syncfs(dirfd(d)) == 0;
+    closedir(d);
+    for (size_t i = 0; i < count; i++) {
+        if (synced) unlink(converted[i]);
+        free(converted[i]);
+    }
+    free(converted);
+}
+
+int catalog_snapshot_path(const char *snapshots_dir, const char *id, char *out, size_t out_size) {
+    if (!snapshots_dir || !id || id[0] == '\0') return FRACTYL_ERROR_INVALID_ARGS;
+    return snapshot_file_path(snapshots_dir, id, 1, out, out_size);
+}
+
+int catalog_load_snapshot(const char *snapshots_dir, const char *id, snapshot_t *snapshot) {
+    if (!snapshots_dir || !id || id[0] == '\0' || !snapshot) return FRACTYL_ERROR_INVALID_ARGS;
+    char path[4096];
+    int result = snapshot_file_path(snapshots_dir, id, 1, path, sizeof(path));
+    if (result == FRACTYL_OK) result = snapshot_record_load(snapshot, path);
+    if (result != FRACTYL_ERROR_NOT_FOUND) return result;
+    
+    // Stored before records were
+    result = snapshot_file_path(snapshots_dir, id, 0, path, sizeof(path));
+    if (result != FRACTYL_OK) return result;
+    if (access(path, F_OK) != 0) return FRACTYL_ERROR_NOT_FOUND;
+    return json_load_snapshot(snapshot, path);
+}
+
+int catalog_store_snapshot(const char *snapshots_dir, const snapshot_t *snapshot) {
+    if (!snapshots_dir || !snapshot || snapshot->id[0] == '\0') {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    char path[4096], snapshot_path[4096];
+    int result = catalog_path(snapshots_dir, path, sizeof(path));
+    if (result != FRACTYL_OK) return result;
+    result = snapshot_file_path(snapshots_dir, snapshot->id, 1, snapshot_path, sizeof(snapshot_path));
+    if (result != FRACTYL_OK) return result;
+    
+    // Checked before the directory changes, which makes any catalog look
+    // stale. Converting JSON files leaves the same snapshots, so a current
+    // catalog stays right.
+    int current = catalog_current(snapshots_dir, path);
+    migrate_json_snapshots(snapshots_dir);
+    result = snapshot_record_save(snapshot, snapshot_path);
+    if (result != FRACTYL_OK) return result;
+    record_change(snapshots_dir, path, current, CATALOG_ADDED, snapshot);
+    return FRACTYL_OK;
+}
+
+int catalog_remove_snapshot(const char *snapshots_dir, const char *id) {
+    if (!snapshots_dir || !id || id[0] == '\0') {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    char path[4096], record_path[4096], json_path[4096];
+    int result = catalog_path(snapshots_dir, path, sizeof(path));
+    if (result == FRACTYL_OK) result = snapshot_file_path(snapshots_dir, id, 1, record_path, sizeof(record_path));
+    if (result == FRACTYL_OK) result = snapshot_file_path(snapshots_dir, id, 0, json_path, sizeof(json_path));
+    if (result != FRACTYL_OK) return result;
+    
+    int current = catalog_current(snapshots_dir, path);
+    int removed_record = unlink(record_path) == 0;
+    if (!removed_record && errno != ENOENT) return FRACTYL_ERROR_IO;
+    int removed_json = unlink(json_path) == 0;
+    if (!removed_json && errno != ENOENT) return FRACTYL_ERROR_IO;
+    if (!removed_record && !removed_json) return FRACTYL_ERROR_NOT_FOUND;
+    snapshot_t removed;
+    memset(&removed, 0, sizeof(removed));
+    snprintf(removed.id, sizeof(removed.id), "%s", id);
+    record_change(snapshots_dir, path, current, CATALOG_DELETED, &removed);
+    return FRACTYL_OK;
+}
@@ -0,0 +1,140 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "../include/core.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Snapshot catalog: what commands need to know about every snapshot of a
+// branch, in one file, so listing or resolving snapshots does not parse
+// each snapshot's file.
+//
+// The catalog of a snapshots directory sits beside it (path with
+// CATALOG_SUFFIX) and is append-only: storing a snapshot appends a record
+// and deleting one appends a removal. The snapshot files stay the truth. The
+// catalog is rebuilt from them whenever it is missing, unreadable, or
+// older than the last change to the directory, which covers snapshots
+// written or deleted by anything that did not update it; rebuilds are
+// written to a temporary file and renamed into place, unless a snapshot
+// file could not be read.
+//
+// Layout, little-endian: "FCAT", u32 version, u32 record size, u32
+// reserved, then records of
+//   0  u32 kind ('A' added / 'D' deleted)    4  u32 strings size
+//   8  i64 timestamp    16  index hash[32]   48  id[64]    112  parent[64]
+// 176  u32 flags        180  u32 FNV-1a of the record with this field zeroed
+//      and the strings
+// 184  u64 reserved
+// followed by the description, git branch and git commit, each ending in
+// a NUL, and a u32 of the record's total length, so the last record can be
+// checked without reading the others.
+//
+// Loading also links the entries into the snapshot graph: each gets the
+// position of its parent and a generation number, so ancestry questions
+// are answered in memory from the parent ids the records already carry.
+
+#define CATALOG_SUFFIX ".catalog"
+#define CATALOG_VERSION 1
+
+// Entry flags
+#define CATALOG_HAS_DESCRIPTION 0x1
+#define CATALOG_HAS_GIT_BRANCH  0x2
+#define CATALOG_HAS_GIT_COMMIT  0x4
+#define CATALOG_GIT_DIRTY       0x8
+
+#define CATALOG_NO_PARENT ((size_t)-1)
+
+typedef struct {
+    char id[64];
+    char parent[64];            // Empty for a snapshot without one
+    size_t parent_pos;          // Of the parent in entries, CATALOG_NO_PARENT
+                                // if it has none or it is not in the catalog
+    uint32_t generation;        // 1 without a parent, else the parent's + 1
+    time_t timestamp;
+    unsigned char index_hash[32];
+    uint32_t flags;
+    size_t strings_offset;      // Of the description in the catalog's data
+} catalog_entry_t;
+
+typedef struct {
+    catalog_entry_t *entries;   // Snapshots that exist, oldest first
+    size_t count;
+    size_t *by_id;              // Positions in entries, in id order
+    unsigned char *data;        // The catalog as read or rebuilt
+    size_t size;
+    size_t unreadable;          // Snapshot files a rebuild had to leave out
+} catalog_t;
+
+// Load the catalog of snapshots_dir, rebuilding it if it is out of date.
+// A missing directory loads as an empty catalog.
+int catalog_load(const char *snapshots_dir, catalog_t *catalog);
+void catalog_free(catalog_t *catalog);
+
+// Strings of an entry, NULL when the snapshot has none
+const char* catalog_description(const catalog_t *catalog, const catalog_entry_t *entry);
+const char* catalog_git_branch(const catalog_t *catalog, const catalog_entry_t *entry);
+const char* catalog_git_commit(const catalog_t *catalog, const catalog_entry_t *entry);
+
+// Entries newest first; the caller frees the array, not the entries
+const catalog_entry_t** catalog_newest_first(const catalog_t *catalog);
+
+// The n'th newest entry (0 is the newest), NULL if there are not that many
+const catalog_entry_t* catalog_nth_newest(const catalog_t *catalog, size_t n);
+
+// Position in entries of the first entry taken at or after timestamp,
+// count if there is none
+size_t catalog_first_since(const catalog_t *catalog, time_t timestamp);
+
+// Entries whose id starts with prefix, found by binary search over by_id.
+// Up to max of them are stored in matches; returns how many there are.
+size_t catalog_find_prefix(const catalog_t *catalog, const char *prefix,
+                           const catalog_entry_t **matches, size_t max);
+
+// Length of the shortest prefix of entry's id, at least min_length long,
+// that no other entry shares. Time-ordered ids (UUIDv7) are shortened to no
+// less than their 13-character millisecond time, since snapshots taken later
+// would soon share any shorter prefix.
+size_t catalog_abbrev_length(const catalog_t *catalog, const catalog_entry_t *entry, size_t min_length);
+
+// The entry of snapshot id, NULL if there is none
+const catalog_entry_t* catalog_find(const catalog_t *catalog, const char *id);
+
+// The entry's parent, NULL if it has none in the catalog
+const catalog_entry_t* catalog_parent(const catalog_t *catalog, const catalog_entry_t *entry);
+
+// Whether ancestor is entry or one of its ancestors. Generations only grow
+// down a lineage, so the walk stops at ancestor's generation.
+int catalog_is_ancestor(const catalog_t *catalog, const catalog_entry_t *ancestor,
+                        const catalog_entry_t *entry);
+
+// Write snapshot's record (snapshot_record.h) into snapshots_dir and
+// record it in the catalog. Only the record must be written for this to
+// succeed: a catalog that could not be updated is rebuilt by the next
+// load. JSON files of older snapshots in the directory are converted to
+// records first; callers hold the repository lock, which keeps deletes out.
+int catalog_store_snapshot(const char *snapshots_dir, const snapshot_t *snapshot);
+
+// Delete the file of snapshot id and record its removal
+int catalog_remove_snapshot(const char *snapshots_dir, const char *id);
+
+// Load snapshot id of snapshots_dir from its record, or from its JSON if
+// it was stored before records were. FRACTYL_ERROR_NOT_FOUND if it has
+// neither; free the snapshot with json_free_snapshot().
+int catalog_load_snapshot(const char *snapshots_dir, const char *id, snapshot_t *snapshot);
+
+// Path snapshot id's record is stored at
+int catalog_snapshot_path(const char *snapshots_dir, const char *id, char *out, size_t out_size);
+
+// Rewrite the catalog of snapshots_dir from its snapshot files
+int catalog_rebuild(const char *snapshots_dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CATALOG_H
@@ -10,7 +10,21 @@ int parse_cli_args(int argc, char **argv, cli_options_t *opts) {
         if (strcmp(argv[i], "--help") == 0) opts->help = 1;
         else if (strcmp(argv[i], "--version") == 0) opts->version = 1;
         else if (strcmp(argv[i], "--debug") == 0) opts->debug = 1;
+        else if (strcmp(argv[i], "--profile") == 0) opts->profile = 1;
+        else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            opts->profile = 1;
+            opts->profile_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--profile-trace=", 16) == 0) {
+            opts->profile = 1;
+            opts->profile_trace = argv[i] + 16;
+        }
         else if (!opts->command) opts->command = argv[i];
     }
     return 0;
 }
+
+int cli_is_profile_arg(const char *arg) {
+    return strcmp(arg, "--profile") == 0 ||
+           strncmp(arg, "--profile=", 10) == 0 ||
+           strncmp(arg, "--profile-trace=", 16) == 0;
+}
@@ -6,6 +6,9 @@ typedef struct {
     int help;
     int version;
     int debug;
+    int profile;                 // --profile or --profile=<file>
+    const char *profile_path;    // Summary file, NULL for stderr
+    const char *profile_trace;   // --profile-trace=<file>: Chrome trace
     char *command;
     char **args;
     int arg_count;
@@ -13,4 +16,7 @@ typedef struct {
 
 int parse_cli_args(int argc, char **argv, cli_options_t *opts);
 
+// Whether arg is one of the global --profile options
+int cli_is_profile_arg(const char *arg);
+
 #endif // CLI_H
@@ -0,0 +1,291 @@
+#include "concurrency.h"
+#include "config.h"
+#include "governor.h"
+#include "../include/fractyl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#include <sys/sysmacros.h>
+#endif
+
+// A throughput change smaller than this is treated as noise
+#define ADAPTIVE_TOLERANCE 0.05
+
+#ifdef __linux__
+// statfs() f_type values of filesystems whose data lives on another machine
+static const unsigned long network_fs_magic[] = {
+    0x6969,        // NFS
+    0x517B,        // SMB
+    0xFF534D42,    // CIFS
+    0xFE534D42,    // SMB2
+    0x65735546,    // FUSE (sshfs, rclone, ...)
+    0x00C36400,    // Ceph
+    0x01021997,    // 9p
+    0x5346414F,    // AFS
+    0x73757245,    // Coda
+    0x01161970,    // GFS2
+    0x7461636F,    // OCFS2
+    0x0BD00BD0,    // Lustre
+};
+
+// Read /sys/dev/block/<major>:<minor>/queue/rotational. Partitions have no
+// queue directory of their own, so fall back to the parent disk's.
+static int read_rotational(unsigned int major_num, unsigned int minor_num) {
+    const char *suffixes[] = { "queue/rotational", "../queue/rotational" };
+    
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        char path[256];
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%s", major_num, minor_num, suffixes[i]);
+        FILE *fp = fopen(path, "r");
+        if (!fp) continue;
+    
+        int value = -1;
+        if (fscanf(fp, "%d", &value) != 1) value = -1;
+        fclose(fp);
+        if (value >= 0) return value;
+    }
+    return -1;
+}
+#endif
+
+storage_kind_t storage_detect(const char *path) {
+    if (!path) return STORAGE_UNKNOWN;
+    
+#ifdef __linux__
+    struct statfs fs;
+    if (statfs(path, &fs) == 0) {
+        unsigned long type = (unsigned long)fs.f_type & 0xFFFFFFFFUL;
+        for (size_t i = 0; i < sizeof(network_fs_magic) / sizeof(network_fs_magic[0]); i++) {
+            if (type == network_fs_magic[i]) return STORAGE_NETWORK;
+        }
+        if (type == 0x01021994 || type == 0x858458F6) {
+            return STORAGE_SSD;  // tmpfs, ramfs
+        }
+    }
+    
+    struct stat st;
+    if (stat(path, &st) == 0 && major(st.st_dev) != 0) {
+        int rotational = read_rotational(major(st.st_dev), minor(st.st_dev));
+        if (rotational == 1) return STORAGE_ROTATIONAL;
+        if (rotational == 0) return STORAGE_SSD;
+    }
+#endif
+    
+    // Anonymous devices (overlayfs, btrfs subvolumes, device mapper without
+    // sysfs entries) and other platforms
+    return STORAGE_UNKNOWN;
+}
+
+const char* storage_kind_name(storage_kind_t kind) {
+    switch (kind) {
+        case STORAGE_SSD: return "ssd";
+        case STORAGE_ROTATIONAL: return "rotational";
+        case STORAGE_NETWORK: return "network";
+        default: return "unknown";
+    }
+}
+
+int storage_kind_parse(const char *name, storage_kind_t *kind) {
+    if (!name || !kind) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    static const storage_kind_t kinds[] = {
+        STORAGE_UNKNOWN, STORAGE_SSD, STORAGE_ROTATIONAL, STORAGE_NETWORK
+    };
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        if (strcmp(name, storage_kind_name(kinds[i])) == 0) {
+            *kind = kinds[i];
+            return FRACTYL_OK;
+        }
+    }
+    return FRACTYL_ERROR_INVALID_ARGS;
+}
+
+static int clamp_int(long value, int lo, int hi) {
+    if (value < lo) return lo;
+    if (value > hi) return hi;
+    return (int)value;
+}
+
+static void set_pool(pool_size_t *pool, long initial, long max, int limit) {
+    pool->max = clamp_int(max, 1, limit);
+    pool->initial = clamp_int(initial, 1, pool->max);
+    pool->fixed = 0;
+}
+
+// Positive override for a setting, or 0 when neither source sets one
+static long override_long(const char *env_name, const char *fractyl_dir, const char *key) {
+    const char *env = getenv(env_name);
+    if (env && *env) {
+        char *end;
+        long value = strtol(env, &end, 10);
+        if (*end == '\0') return value;
+    }
+    return fractyl_dir ? config_get_long(fractyl_dir, key, 0) : 0;
+}
+
+static void apply_override(pool_size_t *pool, const char *env_name, const char *fractyl_dir,
+                           const char *key, int limit) {
+    long value = override_long(env_name, fractyl_dir, key);
+    if (value > 0) {
+        pool->max = pool->initial = clamp_int(value, 1, limit);
+        pool->fixed = 1;
+    }
+}
+
+void concurrency_plan_init(concurrency_plan_t *plan, const char *root, const char *fractyl_dir) {
+    memset(plan, 0, sizeof(*plan));
+    
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) cores = 1;
+    
+    char name[32];
+    const char *forced = getenv("FRACTYL_STORAGE");
+    if ((!forced || !*forced) && fractyl_dir &&
+        config_get(fractyl_dir, "scan.storage", name, sizeof(name)) == FRACTYL_OK) {
+        forced = name;
+    }
+    if (!forced || !*forced || storage_kind_parse(forced, &plan->storage) != FRACTYL_OK) {
+        plan->storage = storage_detect(root);
+    }
+    
+    switch (plan->storage) {
+        case STORAGE_ROTATIONAL:
+            // Every extra reader costs seeks; start small and let the
+            // controller prove that more threads help
+            set_pool(&plan->scan, 2, 8, MAX_SCAN_THREADS);
+            set_pool(&plan->hash, 2, cores, MAX_HASH_THREADS);
+            set_pool(&plan->store, 1, 4, MAX_STORE_THREADS);
+            set_pool(&plan->stat, 2, 8, MAX_STAT_THREADS);
+            set_pool(&plan->restore, 2, 2, MAX_RESTORE_THREADS);
+            break;
+        case STORAGE_NETWORK:
+            // Round trips dominate, so keep many requests outstanding
+            set_pool(&plan->scan, 32, MAX_SCAN_THREADS, MAX_SCAN_THREADS);
+            set_pool(&plan->hash, cores * 2 > 8 ? cores * 2 : 8, MAX_HASH_THREADS, MAX_HASH_THREADS);
+            set_pool(&plan->store, 4, MAX_STORE_THREADS, MAX_STORE_THREADS);
+            set_pool(&plan->stat, 64, MAX_STAT_THREADS, MAX_STAT_THREADS);
+            set_pool(&plan->restore, MAX_RESTORE_THREADS, MAX_RESTORE_THREADS, MAX_RESTORE_THREADS);
+            break;
+        default:
+            // Hashing is CPU bound and starts with a thread per core; object
+            // writes are mostly I/O and need only a few
+            set_pool(&plan->scan, cores > 2 ? cores : 2, cores * 2, MAX_SCAN_THREADS);
+            set_pool(&plan->hash, cores, cores * 2, MAX_HASH_THREADS);
+            set_pool(&plan->store, cores / 2 > 2 ? cores / 2 : 2, MAX_STORE_THREADS, MAX_STORE_THREADS);
+            set_pool(&plan->stat, 8, cores * 4 > 8 ? cores * 4 : 8, MAX_STAT_THREADS);
+            // Writes queue up in the device, so a few more than cores
+            set_pool(&plan->restore, cores * 2 > 4 ? cores * 2 : 4, cores * 2 > 4 ? cores * 2 : 4,
+                     MAX_RESTORE_THREADS);
+            break;
+    }
+    if (plan->scan.max < 2) plan->scan.max = 2;
+    if (plan->scan.initial < 2) plan->scan.initial = 2;
+    
+    apply_override(&plan->scan, "FRACTYL_SCAN_THREADS", fractyl_dir, "scan.threads", MAX_SCAN_THREADS);
+    apply_override(&plan->hash, "FRACTYL_HASH_THREADS", fractyl_dir, "scan.hash_threads", MAX_HASH_THREADS);
+    apply_override(&plan->store, "FRACTYL_STORE_THREADS", fractyl_dir, "scan.store_threads", MAX_STORE_THREADS);
+    apply_override(&plan->stat, "FRACTYL_STAT_THREADS", fractyl_dir, "scan.stat_threads", MAX_STAT_THREADS);
+    apply_override(&plan->restore, "FRACTYL_RESTORE_THREADS", fractyl_dir, "restore.threads",
+                   MAX_RESTORE_THREADS);
+    
+    // A daemon's hashing thread budget (governor.h) caps the pools that hash
+    pool_size_t *hashing[] = { &plan->hash, &plan->store };
+    for (size_t i = 0; i < sizeof(hashing) / sizeof(hashing[0]); i++) {
+        hashing[i]->max = governor_hash_threads(hashing[i]->max);
+        if (hashing[i]->initial > hashing[i]->max) hashing[i]->initial = hashing[i]->max;
+    }
+    
+    const char *adaptive = getenv("FRACTYL_ADAPTIVE");
+    if (adaptive && *adaptive) {
+        plan->adaptive = atoi(adaptive) != 0;
+    } else {
+        plan->adaptive = fractyl_dir ? config_get_long(fractyl_dir, "scan.adaptive", 1) != 0 : 1;
+    }
+    
+    if (!plan->adaptive) {
+        // Run exactly the starting sizes
+        pool_size_t *pools[] = { &plan->scan, &plan->hash, &plan->store, &plan->stat };
+        for (size_t i = 0; i < sizeof(pools) / sizeof(pools[0]); i++) {
+            pools[i]->max = pools[i]->initial;
+            pools[i]->fixed = 1;
+        }
+    }
+}
+
+void adaptive_gate_init(adaptive_gate_t *gate, const pool_size_t *size) {
+    memset(gate, 0, sizeof(*gate));
+    pthread_mutex_init(&gate->lock, NULL);
+    pthread_cond_init(&gate->cond, NULL);
+    gate->max = size->max > 0 ? size->max : 1;
+    gate->active = size->initial > 0 && size->initial <= gate->max ? size->initial : gate->max;
+    gate->min = 1;
+    gate->fixed = size->fixed;
+    gate->direction = 1;
+}
+
+void adaptive_gate_destroy(adaptive_gate_t *gate) {
+    pthread_mutex_destroy(&gate->lock);
+    pthread_cond_destroy(&gate->cond);
+}
+
+int adaptive_gate_parked(adaptive_gate_t *gate, int index) {
+    return index >= __atomic_load_n(&gate->active, __ATOMIC_ACQUIRE) &&
+           !__atomic_load_n(&gate->closed, __ATOMIC_ACQUIRE);
+}
+
+void adaptive_gate_wait(adaptive_gate_t *gate, int index) {
+    if (!adaptive_gate_parked(gate, index)) return;
+    
+    pthread_mutex_lock(&gate->lock);
+    while (index >= gate->active && !gate->closed) {
+        pthread_cond_wait(&gate->cond, &gate->lock);
+    }
+    pthread_mutex_unlock(&gate->lock);
+}
+
+void adaptive_gate_close(adaptive_gate_t *gate) {
+    pthread_mutex_lock(&gate->lock);
+    __atomic_store_n(&gate->closed, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&gate->cond);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+int adaptive_gate_active(adaptive_gate_t *gate) {
+    return __atomic_load_n(&gate->active, __ATOMIC_ACQUIRE);
+}
+
+int adaptive_gate_sample(adaptive_gate_t *gate, unsigned long long done, double elapsed,
+                         int backlogged) {
+    int active = adaptive_gate_active(gate);
+    unsigned long long delta = done >= gate->last_done ? done - gate->last_done : 0;
+    gate->last_done = done;
+    if (gate->fixed || elapsed <= 0) return active;
+    
+    double rate = (double)delta / elapsed;
+    if (!backlogged || rate <= 0) {
+        // Starved or stalled: the rate says nothing about the pool size
+        gate->last_rate = 0;
+        return active;
+    }
+    
+    if (gate->last_rate > 0 && rate < gate->last_rate * (1.0 - ADAPTIVE_TOLERANCE)) {
+        // The last step made things worse; undo it and try the other way
+        gate->direction = -gate->direction;
+    }
+    gate->last_rate = rate;
+    
+    int step = active / 4 > 1 ? active / 4 : 1;
+    int next = clamp_int((long)active + gate->direction * step, gate->min, gate->max);
+    if (next != active) {
+        pthread_mutex_lock(&gate->lock);
+        __atomic_store_n(&gate->active, next, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&gate->cond);
+        pthread_mutex_unlock(&gate->lock);
+    }
+    return next;
+}
@@ -0,0 +1,105 @@
+#ifndef FRACTYL_CONCURRENCY_H
+#define FRACTYL_CONCURRENCY_H
+
+#include <pthread.h>
+
+// Thread pool sizing for the scanner.
+// The starting sizes depend on what backs the working tree: solid state
+// storage likes many requests in flight, a rotating disk loses time to
+// seeks when several threads read at once, and on a network filesystem
+// the latency of each stat dominates, so many outstanding requests help.
+// During a scan adaptive_gate_sample() then adjusts how many threads of a
+// pool actually run, based on the throughput it measures.
+
+typedef enum {
+    STORAGE_UNKNOWN = 0,
+    STORAGE_SSD,          // Non-rotating block device (NVMe, SATA SSD) or memory
+    STORAGE_ROTATIONAL,
+    STORAGE_NETWORK       // NFS, SMB, FUSE and other remote filesystems
+} storage_kind_t;
+
+// Hard limits, whatever the plan or the overrides ask for
+#define MAX_SCAN_THREADS 64
+#define MAX_HASH_THREADS 64
+#define MAX_STORE_THREADS 16
+#define MAX_STAT_THREADS 128
+#define MAX_RESTORE_THREADS 32
+
+typedef struct {
+    int max;       // Threads created
+    int initial;   // Threads running when the scan starts
+    int fixed;     // Set by an override; the pool is never resized
+} pool_size_t;
+
+typedef struct {
+    storage_kind_t storage;
+    pool_size_t scan;     // Directory walk workers
+    pool_size_t hash;     // Hash stage of the parallel scan
+    pool_size_t store;    // Object write stage of the parallel scan
+    pool_size_t stat;     // Stat threads of the binary and stat-only engines
+    pool_size_t restore;  // File writers of a restore; never resized
+    int adaptive;         // Resize the pools at runtime
+} concurrency_plan_t;
+
+// Classify the storage holding path
+storage_kind_t storage_detect(const char *path);
+
+// "ssd", "rotational", "network" or "unknown"
+const char* storage_kind_name(storage_kind_t kind);
+
+// Parse a storage name as accepted by the scan.storage setting
+// Returns FRACTYL_OK or FRACTYL_ERROR_INVALID_ARGS
+int storage_kind_parse(const char *name, storage_kind_t *kind);
+
+// Work out the pool sizes for scanning root. Overrides come from the
+// environment first, then from <fractyl_dir>/config (fractyl_dir may be NULL):
+//   FRACTYL_SCAN_THREADS    scan.threads         directory walk workers
+//   FRACTYL_HASH_THREADS    scan.hash_threads    hash stage
+//   FRACTYL_STORE_THREADS   scan.store_threads   object write stage
+//   FRACTYL_STAT_THREADS    scan.stat_threads    stat-only / binary engines
+//   FRACTYL_RESTORE_THREADS restore.threads      restore file writers
+//   FRACTYL_STORAGE         scan.storage         skip detection
+//   FRACTYL_ADAPTIVE        scan.adaptive        0 keeps the initial sizes
+void concurrency_plan_init(concurrency_plan_t *plan, const char *root, const char *fractyl_dir);
+
+// Limits how many threads of a pool run. Thread i of the pool may work
+// while i < active; the rest park in adaptive_gate_wait().
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int active;
+    int min;
+    int max;
+    int closed;
+    int fixed;
+
+    // Hill climbing state, owned by the thread calling adaptive_gate_sample()
+    unsigned long long last_done;
+    double last_rate;
+    int direction;        // +1 while adding threads helps, -1 while removing does
+} adaptive_gate_t;
+
+// Start with size->initial of size->max threads running
+void adaptive_gate_init(adaptive_gate_t *gate, const pool_size_t *size);
+void adaptive_gate_destroy(adaptive_gate_t *gate);
+
+// Block thread index while it is parked. Returns at once after the gate is closed.
+void adaptive_gate_wait(adaptive_gate_t *gate, int index);
+
+// Nonzero if thread index should park now
+int adaptive_gate_parked(adaptive_gate_t *gate, int index);
+
+// Release every parked thread for good, e.g. once its pool has run out of work
+void adaptive_gate_close(adaptive_gate_t *gate);
+
+int adaptive_gate_active(adaptive_gate_t *gate);
+
+// Feed the pool's total completed work (files, bytes, ...) after elapsed
+// seconds of running at the current size. When backlogged is nonzero the
+// pool had more work than threads, so the rate reflects its size and the
+// gate moves one step towards the better throughput; otherwise the sample
+// only resets the baseline. Returns the new number of active threads.
+int adaptive_gate_sample(adaptive_gate_t *gate, unsigned long long done, double elapsed,
+                         int backlogged);
+
+#endif // FRACTYL_CONCURRENCY_H
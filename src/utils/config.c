@@ -0,0 +1,126 @@
+#include "config.h"
+#include "../include/fractyl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+// Trim leading and trailing whitespace in place
+static char* trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    size_t len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1])) {
+        s[--len] = '\0';
+    }
+    return s;
+}
+
+int config_get(const char *fractyl_dir, const char *key, char *value, size_t value_size) {
+    if (!fractyl_dir || !key || !value || value_size == 0) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    char config_path[2048];
+    snprintf(config_path, sizeof(config_path), "%s/config", fractyl_dir);
+    
+    FILE *f = fopen(config_path, "r");
+    if (!f) {
+        return FRACTYL_ERROR_NOT_FOUND;
+    }
+    
+    int result = FRACTYL_ERROR_NOT_FOUND;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        char *s = trim(line);
+        if (*s == '\0' || *s == '#') {
+            continue;
+        }
+        
+        char *eq = strchr(s, '=');
+        if (!eq) {
+            continue;
+        }
+        *eq = '\0';
+        
+        if (strcmp(trim(s), key) == 0) {
+            snprintf(value, value_size, "%s", trim(eq + 1));
+            result = FRACTYL_OK;
+        }
+    }
+    
+    fclose(f);
+    return result;
+}
+
+long config_get_long(const char *fractyl_dir, const char *key, long default_value) {
+    char value[64];
+    if (config_get(fractyl_dir, key, value, sizeof(value)) != FRACTYL_OK) {
+        return default_value;
+    }
+    
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (end == value || *end != '\0') {
+        return default_value;
+    }
+    return parsed;
+}
+
+int config_for_each(const char *fractyl_dir, config_entry_fn fn, void *ctx) {
+    if (!fractyl_dir || !fn) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    char config_path[2048];
+    snprintf(config_path, sizeof(config_path), "%s/config", fractyl_dir);
+    FILE *f = fopen(config_path, "r");
+    if (!f) return FRACTYL_OK;
+    
+    int result = FRACTYL_OK;
+    char line[1024];
+    while (result == FRACTYL_OK && fgets(line, sizeof(line), f)) {
+        char *s = trim(line);
+        char *eq = strchr(s, '=');
+        if (*s == '\0' || *s == '#' || !eq) continue;
+        *eq = '\0';
+        result = fn(trim(s), trim(eq + 1), ctx);
+    }
+    fclose(f);
+    return result;
+}
+
+int config_set(const char *fractyl_dir, const char *key, const char *value) {
+    if (!fractyl_dir || !key || !*key || strchr(key, '=') || strchr(key, '\n') ||
+        (value && strchr(value, '\n'))) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    char config_path[2048], temp_path[2100];
+    snprintf(config_path, sizeof(config_path), "%s/config", fractyl_dir);
+    snprintf(temp_path, sizeof(temp_path), "%s/.config.tmp", fractyl_dir);
+    FILE *out = fopen(temp_path, "w");
+    if (!out) return FRACTYL_ERROR_IO;
+    
+    // Everything else, comments included, is kept as it is
+    int ok = 1;
+    FILE *in = fopen(config_path, "r");
+    char line[1024];
+    while (ok && in && fgets(line, sizeof(line), in)) {
+        char copy[1024];
+        snprintf(copy, sizeof(copy), "%s", line);
+        char *s = trim(copy);
+        char *eq = strchr(s, '=');
+        if (*s != '\0' && *s != '#' && eq) {
+            *eq = '\0';
+            if (strcmp(trim(s), key) == 0) continue;
+        }
+        ok = fputs(line, out) >= 0;
+    }
+    if (in) fclose(in);
+    if (ok && value) ok = fprintf(out, "%s = %s\n", key, value) > 0;
+    if (fclose(out) != 0) ok = 0;
+    if (!ok || rename(temp_path, config_path) != 0) {
+        unlink(temp_path);
+        return FRACTYL_ERROR_IO;
+    }
+    return FRACTYL_OK;
+}
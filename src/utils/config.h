@@ -0,0 +1,25 @@
+#ifndef FRACTYL_CONFIG_H
+#define FRACTYL_CONFIG_H
+
+#include <stddef.h>
+
+// Repository settings live in <fractyl_dir>/config as "key = value" lines.
+// Blank lines and lines starting with '#' are ignored; the last assignment wins.
+
+// Look up key and copy its value into value
+// Returns FRACTYL_OK, FRACTYL_ERROR_NOT_FOUND if the key (or file) is missing
+int config_get(const char *fractyl_dir, const char *key, char *value, size_t value_size);
+
+// Look up an integer key, returning default_value when missing or malformed
+long config_get_long(const char *fractyl_dir, const char *key, long default_value);
+
+// Call fn for every assignment in file order; a nonzero return stops the
+// walk and is returned. A missing file has no assignments.
+typedef int (*config_entry_fn)(const char *key, const char *value, void *ctx);
+int config_for_each(const char *fractyl_dir, config_entry_fn fn, void *ctx);
+
+// Replace the assignments of key with one to value, or drop them when value
+// is NULL. The file is written under another name and renamed into place.
+int config_set(const char *fractyl_dir, const char *key, const char *value);
+
+#endif // FRACTYL_CONFIG_H
@@ -0,0 +1,211 @@
+#include "counters.h"
+#include "../include/fractyl.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *counter_names[COUNTER_COUNT] = {
+    "scans",
+    "snapshots",
+    "files_scanned",
+    "stat_hits",
+    "rehashed",
+    "new_files",
+    "binary_lookups",
+    "binary_hits",
+    "files_read",
+    "bytes_hashed",
+    "objects_written",
+    "bytes_written",
+    "objects_deduplicated",
+    "bytes_deduplicated",
+    "stat_calls",
+    "dir_reads",
+    "restores",
+    "restore_files_written",
+    "restore_files_skipped",
+    "restore_bytes_written",
+};
+
+static unsigned long long process_counters[COUNTER_COUNT];
+
+void counters_add(counter_t counter, unsigned long long n) {
+    if (counter >= COUNTER_COUNT || n == 0) {
+        return;
+    }
+    __atomic_add_fetch(&process_counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void counters_take(counters_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        out->values[i] = __atomic_exchange_n(&process_counters[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+int counters_pending(void) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (__atomic_load_n(&process_counters[i], __ATOMIC_RELAXED) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void counters_describe(const counters_t *counters, char *buf, size_t size) {
+    const unsigned long long *v = counters->values;
+    snprintf(buf, size,
+             "%llu files scanned: %.1f%% stat hits, %llu rehashed, %llu new; "
+             "binary index %.1f%% hits of %llu; %llu bytes hashed from %llu files; "
+             "%llu objects written (%llu bytes), %llu reused (%llu bytes); "
+             "%llu stat calls, %llu directories read",
+             v[COUNTER_FILES_SCANNED], counters_percent(v[COUNTER_STAT_HITS], v[COUNTER_FILES_SCANNED]),
+             v[COUNTER_REHASHED], v[COUNTER_NEW_FILES],
+             counters_percent(v[COUNTER_BINARY_HITS], v[COUNTER_BINARY_LOOKUPS]), v[COUNTER_BINARY_LOOKUPS],
+             v[COUNTER_BYTES_HASHED], v[COUNTER_FILES_READ],
+             v[COUNTER_OBJECTS_WRITTEN], v[COUNTER_BYTES_WRITTEN],
+             v[COUNTER_OBJECTS_DEDUPLICATED], v[COUNTER_BYTES_DEDUPLICATED],
+             v[COUNTER_STAT_CALLS], v[COUNTER_DIR_READS]);
+}
+
+const char *counter_name(counter_t counter) {
+    return counter < COUNTER_COUNT ? counter_names[counter] : "unknown";
+}
+
+double counters_percent(unsigned long long part, unsigned long long whole) {
+    return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+static void counters_path(const char *fractyl_dir, char *out, size_t size) {
+    snprintf(out, size, "%s/%s", fractyl_dir, COUNTERS_FILE_NAME);
+}
+
+// Parse "name value" lines into out; anything unrecognised is skipped
+static void parse_counters(char *text, counters_t *out) {
+    char *save = NULL;
+    for (char *line = strtok_r(text, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char name[64];
+        long long value;
+        if (sscanf(line, "%63s %lld", name, &value) != 2 || value < 0) {
+            continue;
+        }
+        if (strcmp(name, "since") == 0) {
+            out->since = value;
+            continue;
+        }
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            if (strcmp(name, counter_names[i]) == 0) {
+                out->values[i] = (unsigned long long)value;
+                break;
+            }
+        }
+    }
+}
+
+// Read the whole of fd into a NUL-terminated buffer
+static char *read_text(int fd) {
+    size_t size = 0, capacity = 4096;
+    char *text = malloc(capacity);
+    if (!text) {
+        return NULL;
+    }
+    for (;;) {
+        if (size + 1 >= capacity) {
+            char *grown = realloc(text, capacity * 2);
+            if (!grown) {
+                free(text);
+                return NULL;
+            }
+            text = grown;
+            capacity *= 2;
+        }
+        ssize_t n = pread(fd, text + size, capacity - size - 1, (off_t)size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        size += (size_t)n;
+    }
+    text[size] = '\0';
+    return text;
+}
+
+int counters_load(const char *fractyl_dir, counters_t *out) {
+    memset(out, 0, sizeof(*out));
+    char path[2048];
+    counters_path(fractyl_dir, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? FRACTYL_OK : FRACTYL_ERROR_IO;
+    }
+    flock(fd, LOCK_SH);
+    char *text = read_text(fd);
+    close(fd);
+    if (!text) {
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    parse_counters(text, out);
+    free(text);
+    return FRACTYL_OK;
+}
+
+int counters_flush(const char *fractyl_dir, counters_t *delta) {
+    counters_t taken;
+    counters_take(&taken);
+    if (delta) {
+        *delta = taken;
+    }
+    int any = 0;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        any |= taken.values[i] != 0;
+    }
+    if (!any || !fractyl_dir) {
+        return FRACTYL_OK;
+    }
+    
+    char path[2048];
+    counters_path(fractyl_dir, path, sizeof(path));
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return FRACTYL_ERROR_IO;
+    }
+    // Commands and the daemon may flush at the same time
+    flock(fd, LOCK_EX);
+    
+    counters_t total;
+    memset(&total, 0, sizeof(total));
+    char *text = read_text(fd);
+    if (text) {
+        parse_counters(text, &total);
+        free(text);
+    }
+    if (total.since == 0) {
+        total.since = (long long)time(NULL);
+    }
+    
+    char out[4096];
+    size_t len = (size_t)snprintf(out, sizeof(out), "since %lld\n", total.since);
+    for (int i = 0; i < COUNTER_COUNT && len < sizeof(out); i++) {
+        len += (size_t)snprintf(out + len, sizeof(out) - len, "%s %llu\n", counter_names[i],
+                                total.values[i] + taken.values[i]);
+    }
+    
+    int result = FRACTYL_OK;
+    if (len >= sizeof(out) || ftruncate(fd, 0) != 0 || pwrite(fd, out, len, 0) != (ssize_t)len) {
+        result = FRACTYL_ERROR_IO;
+    }
+    close(fd);
+    return result;
+}
+
+int counters_reset_file(const char *fractyl_dir) {
+    char path[2048];
+    counters_path(fractyl_dir, path, sizeof(path));
+    if (unlink(path) != 0 && errno != ENOENT) {
+        return FRACTYL_ERROR_IO;
+    }
+    return FRACTYL_OK;
+}
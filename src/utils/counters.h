@@ -0,0 +1,79 @@
+#ifndef FRACTYL_COUNTERS_H
+#define FRACTYL_COUNTERS_H
+
+#include <stddef.h>
+
+// Cumulative counters of a repository
+//
+// The scan, the object store and restore add to process-wide counters as
+// they go; counters_flush() adds them to .fractyl/counters and starts them
+// again from zero. The file therefore sums every command and daemon cycle
+// since it was created or reset, which is what `frac stats --counters`
+// shows: how often stat data let a file go unread, how often the binary
+// index answered, and how much was hashed, written and reused.
+//
+// The file is text, one "name value" line per counter plus "since" (the
+// Unix time of the first flush); unknown names are kept as zero, so older
+// and newer builds can share it.
+
+typedef enum {
+    COUNTER_SCANS = 0,              // Snapshot scans run
+    COUNTER_SNAPSHOTS,              // Snapshots taken
+    COUNTER_FILES_SCANNED,          // Files a scan looked at
+    COUNTER_STAT_HITS,              // Known files whose stat data matched, so were not read
+    COUNTER_REHASHED,               // Known files read again because their stat data differed
+    COUNTER_NEW_FILES,              // Files no previous index had
+    COUNTER_BINARY_LOOKUPS,         // Files checked against a binary index
+    COUNTER_BINARY_HITS,            // Of those, unchanged by its stat data
+    COUNTER_FILES_READ,             // Files opened to hash or store their content
+    COUNTER_BYTES_HASHED,           // Content bytes hashed
+    COUNTER_OBJECTS_WRITTEN,        // Objects added to the store
+    COUNTER_BYTES_WRITTEN,          // Bytes those took on disk
+    COUNTER_OBJECTS_DEDUPLICATED,   // Content that was already stored
+    COUNTER_BYTES_DEDUPLICATED,     // Bytes of that content
+    COUNTER_STAT_CALLS,             // stat() calls, one per file of a statx batch
+    COUNTER_DIR_READS,              // Directories listed
+    COUNTER_RESTORES,               // Restores run
+    COUNTER_RESTORE_FILES_WRITTEN,  // Files a restore wrote
+    COUNTER_RESTORE_FILES_SKIPPED,  // Files a restore found already up to date
+    COUNTER_RESTORE_BYTES_WRITTEN,  // Bytes a restore wrote
+    COUNTER_COUNT
+} counter_t;
+
+#define COUNTERS_FILE_NAME "counters"
+
+typedef struct {
+    unsigned long long values[COUNTER_COUNT];
+    long long since;                // Unix time of the first flush, 0 if never
+} counters_t;
+
+// Add n to a counter of this process. Thread-safe.
+void counters_add(counter_t counter, unsigned long long n);
+
+// Take this process's counters into out and start them again from zero
+void counters_take(counters_t *out);
+
+// Whether this process has counted anything since the last take
+int counters_pending(void);
+
+// Add this process's counters to fractyl_dir's file and start them again
+// from zero. delta, when not NULL, receives what was added. Returns
+// FRACTYL_OK, also when there was nothing to add.
+int counters_flush(const char *fractyl_dir, counters_t *delta);
+
+// Read fractyl_dir's counters; all zero if there are none yet
+int counters_load(const char *fractyl_dir, counters_t *out);
+
+// Remove fractyl_dir's counters
+int counters_reset_file(const char *fractyl_dir);
+
+// One line on rates and totals of counters, for logs and `frac stats`
+void counters_describe(const counters_t *counters, char *buf, size_t size);
+
+// Name of a counter as written to the file and to JSON
+const char *counter_name(counter_t counter);
+
+// Percentage part / whole, 0 when whole is 0
+double counters_percent(unsigned long long part, unsigned long long whole);
+
+#endif // FRACTYL_COUNTERS_H
@@ -0,0 +1,224 @@
+#include "diff_cache.h"
+#include "config.h"
+#include "paths.h"
+#include "../core/hash.h"
+#include "../include/fractyl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define DIFF_CACHE_MAGIC "FDC1"
+#define DIFF_CACHE_KEY_SIZE (2 * FRACTYL_HASH_SIZE + 2 * sizeof(uint32_t))
+#define DIFF_CACHE_HEADER_SIZE (4 + DIFF_CACHE_KEY_SIZE + sizeof(uint32_t) + 5 * sizeof(uint64_t))
+
+struct diff_cache {
+    char dir[PATH_MAX];
+    long max_size;
+    int stored;                 // Entries were written; set by any thread
+};
+
+typedef struct {
+    char path[PATH_MAX];
+    time_t mtime;
+    long mtime_nsec;
+    off_t size;
+} cache_file_t;
+
+static const unsigned char zero_hash[FRACTYL_HASH_SIZE];
+
+static void encode_key(unsigned char *key, const unsigned char *hash_a, const unsigned char *hash_b,
+                       uint32_t algorithm, int32_t context) {
+    memcpy(key, hash_a ? hash_a : zero_hash, FRACTYL_HASH_SIZE);
+    memcpy(key + FRACTYL_HASH_SIZE, hash_b ? hash_b : zero_hash, FRACTYL_HASH_SIZE);
+    memcpy(key + 2 * FRACTYL_HASH_SIZE, &algorithm, sizeof(algorithm));
+    memcpy(key + 2 * FRACTYL_HASH_SIZE + sizeof(algorithm), &context, sizeof(context));
+}
+
+// Path of an entry: <dir>/<first two hex digits>/<rest>
+static int entry_path(const diff_cache_t *cache, const unsigned char *key, char *path, size_t size) {
+    unsigned char name[FRACTYL_HASH_SIZE];
+    if (hash_data(key, DIFF_CACHE_KEY_SIZE, name) != FRACTYL_OK) return FRACTYL_ERROR_GENERIC;
+    char hex[FRACTYL_HASH_SIZE * 2 + 1];
+    hash_to_string(name, hex);
+    int n = snprintf(path, size, "%s/%.2s/%s", cache->dir, hex, hex + 2);
+    return n > 0 && (size_t)n < size ? FRACTYL_OK : FRACTYL_ERROR_PATH_TOO_LONG;
+}
+
+int diff_cache_open(const char *fractyl_dir, diff_cache_t **cache_out) {
+    if (!fractyl_dir || !cache_out) return FRACTYL_ERROR_INVALID_ARGS;
+    *cache_out = NULL;
+    
+    long max_size = config_get_long(fractyl_dir, "diff.cache_size", DIFF_CACHE_DEFAULT_SIZE);
+    if (max_size <= 0) return FRACTYL_OK;
+    
+    diff_cache_t *cache = calloc(1, sizeof(*cache));
+    if (!cache) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    snprintf(cache->dir, sizeof(cache->dir), "%s/cache/diff", fractyl_dir);
+    cache->max_size = max_size;
+    *cache_out = cache;
+    return FRACTYL_OK;
+}
+
+int diff_cache_lookup(diff_cache_t *cache, const unsigned char *hash_a, const unsigned char *hash_b,
+                      uint32_t algorithm, int32_t context, diff_cache_entry_t *entry) {
+    if (!cache || !entry) return 0;
+    
+    unsigned char key[DIFF_CACHE_KEY_SIZE];
+    encode_key(key, hash_a, hash_b, algorithm, context);
+    char path[PATH_MAX];
+    if (entry_path(cache, key, path, sizeof(path)) != FRACTYL_OK) return 0;
+    
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    unsigned char header[DIFF_CACHE_HEADER_SIZE];
+    uint64_t hunks_size = 0;
+    int hit = fread(header, 1, sizeof(header), fp) == sizeof(header) &&
+              memcmp(header, DIFF_CACHE_MAGIC, 4) == 0 &&
+              memcmp(header + 4, key, DIFF_CACHE_KEY_SIZE) == 0;
+    
+    memset(entry, 0, sizeof(*entry));
+    if (hit) {
+        const unsigned char *p = header + 4 + DIFF_CACHE_KEY_SIZE;
+        memcpy(&entry->flags, p, sizeof(uint32_t));
+        p += sizeof(uint32_t);
+        memcpy(&entry->size_a, p, sizeof(uint64_t));
+        memcpy(&entry->size_b, p + 8, sizeof(uint64_t));
+        memcpy(&entry->added, p + 16, sizeof(int64_t));
+        memcpy(&entry->removed, p + 24, sizeof(int64_t));
+        memcpy(&hunks_size, p + 32, sizeof(uint64_t));
+        hit = hunks_size <= SIZE_MAX - 1;
+    }
+    if (hit && hunks_size > 0) {
+        entry->hunks = malloc((size_t)hunks_size);
+        hit = entry->hunks && fread(entry->hunks, 1, (size_t)hunks_size, fp) == hunks_size;
+        entry->hunks_size = (size_t)hunks_size;
+    }
+    // Anything after the hunks means the entry is not what it claims
+    hit = hit && fgetc(fp) == EOF;
+    fclose(fp);
+    if (!hit) {
+        diff_cache_entry_free(entry);
+        return 0;
+    }
+    
+    // Most recently used
+    utimensat(AT_FDCWD, path, NULL, 0);
+    return 1;
+}
+
+void diff_cache_store(diff_cache_t *cache, const unsigned char *hash_a, const unsigned char *hash_b,
+                      uint32_t algorithm, int32_t context, const diff_cache_entry_t *entry) {
+    if (!cache || !entry) return;
+    // An entry larger than the whole cache would only evict everything
+    if (entry->hunks_size + DIFF_CACHE_HEADER_SIZE > (size_t)cache->max_size) return;
+    
+    unsigned char key[DIFF_CACHE_KEY_SIZE];
+    encode_key(key, hash_a, hash_b, algorithm, context);
+    char path[PATH_MAX];
+    if (entry_path(cache, key, path, sizeof(path)) != FRACTYL_OK) return;
+    
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    *strrchr(dir, '/') = '\0';
+    if (paths_ensure_directory(dir) != FRACTYL_OK) return;
+    
+    unsigned char header[DIFF_CACHE_HEADER_SIZE];
+    unsigned char *p = header;
+    uint64_t hunks_size = entry->hunks_size;
+    memcpy(p, DIFF_CACHE_MAGIC, 4);
+    memcpy(p + 4, key, DIFF_CACHE_KEY_SIZE);
+    p += 4 + DIFF_CACHE_KEY_SIZE;
+    memcpy(p, &entry->flags, sizeof(uint32_t));
+    p += sizeof(uint32_t);
+    memcpy(p, &entry->size_a, sizeof(uint64_t));
+    memcpy(p + 8, &entry->size_b, sizeof(uint64_t));
+    memcpy(p + 16, &entry->added, sizeof(int64_t));
+    memcpy(p + 24, &entry->removed, sizeof(int64_t));
+    memcpy(p + 32, &hunks_size, sizeof(uint64_t));
+    
+    char temp_path[PATH_MAX + 16];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) return;
+    FILE *fp = fdopen(fd, "wb");
+    if (!fp) {
+        close(fd);
+        unlink(temp_path);
+        return;
+    }
+    int ok = fwrite(header, 1, sizeof(header), fp) == sizeof(header) &&
+             (entry->hunks_size == 0 || fwrite(entry->hunks, 1, entry->hunks_size, fp) == entry->hunks_size);
+    if (fclose(fp) != 0 || !ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return;
+    }
+    __atomic_store_n(&cache->stored, 1, __ATOMIC_RELAXED);
+}
+
+void diff_cache_entry_free(diff_cache_entry_t *entry) {
+    if (!entry) return;
+    free(entry->hunks);
+    entry->hunks = NULL;
+    entry->hunks_size = 0;
+}
+
+static int compare_by_mtime(const void *a, const void *b) {
+    const cache_file_t *fa = a, *fb = b;
+    if (fa->mtime != fb->mtime) return fa->mtime < fb->mtime ? -1 : 1;
+    if (fa->mtime_nsec != fb->mtime_nsec) return fa->mtime_nsec < fb->mtime_nsec ? -1 : 1;
+    return 0;
+}
+
+// Delete the least recently used entries until the cache fits max_size
+static void evict(diff_cache_t *cache) {
+    cache_file_t *files = NULL;
+    size_t count = 0, capacity = 0;
+    long long total = 0;
+    
+    for (int fanout = 0; fanout < 256; fanout++) {
+        char dir_path[PATH_MAX];
+        snprintf(dir_path, sizeof(dir_path), "%s/%02x", cache->dir, fanout);
+        DIR *dir = opendir(dir_path);
+        if (!dir) continue;
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL) {
+            if (de->d_name[0] == '.') continue;
+            if (count == capacity) {
+                size_t grown = capacity ? capacity * 2 : 256;
+                cache_file_t *more = realloc(files, grown * sizeof(cache_file_t));
+                if (!more) break;
+                files = more;
+                capacity = grown;
+            }
+            cache_file_t *file = &files[count];
+            struct stat st;
+            snprintf(file->path, sizeof(file->path), "%s/%s", dir_path, de->d_name);
+            if (stat(file->path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            file->mtime = st.st_mtim.tv_sec;
+            file->mtime_nsec = st.st_mtim.tv_nsec;
+            file->size = st.st_size;
+            total += st.st_size;
+            count++;
+        }
+        closedir(dir);
+    }
+    
+    if (total > cache->max_size) {
+        qsort(files, count, sizeof(cache_file_t), compare_by_mtime);
+        for (size_t i = 0; i < count && total > cache->max_size; i++) {
+            if (unlink(files[i].path) == 0) total -= files[i].size;
+        }
+    }
+    free(files);
+}
+
+void diff_cache_close(diff_cache_t *cache) {
+    if (!cache) return;
+    if (cache->stored) evict(cache);
+    free(cache);
+}
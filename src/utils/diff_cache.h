@@ -0,0 +1,56 @@
+#ifndef DIFF_CACHE_H
+#define DIFF_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Results of diffing two objects, kept on disk under .fractyl/cache/diff/
+// so diffing the same pair again reads neither object. Objects never
+// change, so an entry never goes stale; it is keyed by both hashes (zero
+// for a missing side), the diff algorithm and the context lines. Counts
+// only (--stat) use DIFF_CACHE_NO_HUNKS as the context.
+//
+// Each entry is a file of its own, named by the hash of its key under a
+// fanout directory like the objects:
+//   "FDC1", key (two hashes, u32 algorithm, i32 context), u32 flags,
+//   u64 size_a, u64 size_b, i64 added, i64 removed, u64 hunks size,
+//   then the hunks as diff prints them
+// Entries are written to a temporary file and renamed into place. Reading
+// one bumps its mtime; once a command has stored entries, the least
+// recently used are deleted until the cache fits diff.cache_size bytes
+// (.fractyl/config, 64 MiB by default; 0 turns the cache off).
+
+#define DIFF_CACHE_DEFAULT_SIZE (64L * 1024 * 1024)
+#define DIFF_CACHE_NO_HUNKS (-1)
+
+// Entry flags
+#define DIFF_CACHE_BINARY 0x1
+
+typedef struct diff_cache diff_cache_t;
+
+typedef struct {
+    uint32_t flags;
+    uint64_t size_a;
+    uint64_t size_b;
+    int64_t added;
+    int64_t removed;
+    char *hunks;                // Unified hunks (malloc'd), NULL for none
+    size_t hunks_size;
+} diff_cache_entry_t;
+
+// Open the cache of a repository; *cache_out is NULL when it is turned
+// off, which the other calls accept
+int diff_cache_open(const char *fractyl_dir, diff_cache_t **cache_out);
+// Trim the cache to its size if anything was stored, then free it
+void diff_cache_close(diff_cache_t *cache);
+
+// Nonzero on a hit, with entry filled in (free it with diff_cache_entry_free)
+int diff_cache_lookup(diff_cache_t *cache, const unsigned char *hash_a, const unsigned char *hash_b,
+                      uint32_t algorithm, int32_t context, diff_cache_entry_t *entry);
+// Errors are ignored: the cache is only an optimization
+void diff_cache_store(diff_cache_t *cache, const unsigned char *hash_a, const unsigned char *hash_b,
+                      uint32_t algorithm, int32_t context, const diff_cache_entry_t *entry);
+
+void diff_cache_entry_free(diff_cache_entry_t *entry);
+
+#endif // DIFF_CACHE_H
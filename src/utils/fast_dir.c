@@ -0,0 +1,345 @@
+#define _GNU_SOURCE  // For statx() and syscall()
+#include "fast_dir.h"
+#include "../include/fractyl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+
+#define FAST_DIR_BUF_SIZE (64 * 1024)
+#define FAST_STAT_RING_ENTRIES 128
+// Below this many files per directory the io_uring round trip costs more
+// than it saves; plain statx() calls are used instead
+#define FAST_STAT_RING_MIN_BATCH 8
+#define FAST_STAT_MASK (STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | STATX_CTIME | \
+                        STATX_INO | STATX_UID | STATX_GID)
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Set once io_uring setup or IORING_OP_STATX turns out to be unsupported,
+// so later workers skip straight to synchronous statx()
+static int ring_unsupported = 0;
+
+static int add_entry(fast_dir_t *dir, const char *name, unsigned char type) {
+    if (dir->count == dir->capacity) {
+        size_t new_capacity = dir->capacity ? dir->capacity * 2 : 64;
+        fast_dirent_t *grown = realloc(dir->entries, new_capacity * sizeof(fast_dirent_t));
+        if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        dir->entries = grown;
+        dir->capacity = new_capacity;
+    }
+    dir->entries[dir->count].name = name;
+    dir->entries[dir->count].type = type;
+    dir->count++;
+    return FRACTYL_OK;
+}
+
+int fast_dir_open(fast_dir_t *dir, const char *path) {
+    if (!dir || !path) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(dir, 0, sizeof(*dir));
+
+    dir->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir->fd < 0) {
+        return FRACTYL_ERROR_IO;
+    }
+
+    // Records are kept in one growing buffer so names stay valid until close.
+    // Entries point into it by offset until reading is done, because the
+    // buffer may move when it grows.
+    for (;;) {
+        if (dir->buf_size - dir->buf_used < FAST_DIR_BUF_SIZE) {
+            size_t new_size = dir->buf_size ? dir->buf_size * 2 : FAST_DIR_BUF_SIZE;
+            char *grown = realloc(dir->buf, new_size);
+            if (!grown) {
+                fast_dir_close(dir);
+                return FRACTYL_ERROR_OUT_OF_MEMORY;
+            }
+            dir->buf = grown;
+            dir->buf_size = new_size;
+        }
+
+        long n = syscall(SYS_getdents64, dir->fd, dir->buf + dir->buf_used,
+                         dir->buf_size - dir->buf_used);
+        if (n < 0) {
+            int err = errno;
+            fast_dir_close(dir);
+            return err == ENOSYS ? FRACTYL_ERROR_INVALID_STATE : FRACTYL_ERROR_IO;
+        }
+        if (n == 0) break;
+
+        for (long off = 0; off < n; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(dir->buf + dir->buf_used + off);
+            off += d->d_reclen;
+
+            if (d->d_name[0] == '.' &&
+                (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+                continue;
+            }
+
+            size_t name_offset = (size_t)(d->d_name - dir->buf);
+            if (add_entry(dir, (const char *)(uintptr_t)name_offset, d->d_type) != FRACTYL_OK) {
+                fast_dir_close(dir);
+                return FRACTYL_ERROR_OUT_OF_MEMORY;
+            }
+        }
+        dir->buf_used += (size_t)n;
+    }
+
+    // The buffer no longer moves; turn offsets into pointers
+    for (size_t i = 0; i < dir->count; i++) {
+        dir->entries[i].name = dir->buf + (uintptr_t)dir->entries[i].name;
+    }
+    return FRACTYL_OK;
+}
+
+void fast_dir_close(fast_dir_t *dir) {
+    if (!dir) return;
+    if (dir->fd >= 0) close(dir->fd);
+    free(dir->buf);
+    free(dir->entries);
+    memset(dir, 0, sizeof(*dir));
+    dir->fd = -1;
+}
+
+static void statx_to_stat(const struct statx *stx, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_mode = stx->stx_mode;
+    st->st_size = (off_t)stx->stx_size;
+    st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx->stx_ctime.tv_nsec;
+    st->st_uid = stx->stx_uid;
+    st->st_gid = stx->stx_gid;
+    st->st_ino = stx->stx_ino;
+    st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+}
+
+void fast_stat_free(fast_stat_ctx_t *ctx) {
+    if (!ctx) return;
+    if (ctx->sqes) munmap(ctx->sqes, ctx->sqes_size);
+    if (ctx->cq_ring && ctx->cq_ring != ctx->sq_ring) munmap(ctx->cq_ring, ctx->cq_ring_size);
+    if (ctx->sq_ring) munmap(ctx->sq_ring, ctx->sq_ring_size);
+    if (ctx->ring_fd >= 0) close(ctx->ring_fd);
+    free(ctx->statx_buf);
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->ring_fd = -1;
+}
+
+void fast_stat_init(fast_stat_ctx_t *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->ring_fd = -1;
+    if (__atomic_load_n(&ring_unsupported, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, FAST_STAT_RING_ENTRIES, &params);
+    if (fd < 0) {
+        // ENOSYS, or EPERM under seccomp or io_uring_disabled
+        __atomic_store_n(&ring_unsupported, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    ctx->ring_fd = fd;
+
+    ctx->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ctx->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && ctx->cq_ring_size > ctx->sq_ring_size) {
+        ctx->sq_ring_size = ctx->cq_ring_size;
+    }
+    ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    void *sq_ring = mmap(NULL, ctx->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        fast_stat_free(ctx);
+        return;
+    }
+    ctx->sq_ring = sq_ring;
+
+    void *cq_ring = sq_ring;
+    if (!single_mmap) {
+        cq_ring = mmap(NULL, ctx->cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED) {
+            fast_stat_free(ctx);
+            return;
+        }
+    }
+    ctx->cq_ring = cq_ring;
+
+    void *sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        fast_stat_free(ctx);
+        return;
+    }
+    ctx->sqes = sqes;
+
+    ctx->statx_buf = malloc(params.sq_entries * sizeof(struct statx));
+    if (!ctx->statx_buf) {
+        fast_stat_free(ctx);
+        return;
+    }
+
+    char *sq = sq_ring;
+    char *cq = cq_ring;
+    ctx->sq_entries = params.sq_entries;
+    ctx->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ctx->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ctx->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ctx->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ctx->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ctx->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ctx->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ctx->cqes = cq + params.cq_off.cqes;
+}
+
+static int statx_one(int dirfd, const char *name, struct stat *st) {
+    struct statx stx;
+    if (statx(dirfd, name, AT_STATX_SYNC_AS_STAT, FAST_STAT_MASK, &stx) != 0) {
+        return 0;
+    }
+    statx_to_stat(&stx, st);
+    return 1;
+}
+
+// Submit one chunk of at most sq_entries statx requests and wait for all of them.
+// Returns 0 if the ring cannot do statx, in which case nothing was reported.
+static int ring_stat_chunk(fast_stat_ctx_t *ctx, const fast_dir_t *dir,
+                           const size_t *indices, size_t count,
+                           struct stat *results, int *ok) {
+    struct io_uring_sqe *sqes = ctx->sqes;
+    struct io_uring_cqe *cqes = ctx->cqes;
+    struct statx *bufs = ctx->statx_buf;
+    unsigned mask = *ctx->sq_mask;
+    unsigned tail = *ctx->sq_tail;
+
+    for (size_t k = 0; k < count; k++) {
+        unsigned slot = (tail + (unsigned)k) & mask;
+        struct io_uring_sqe *sqe = &sqes[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = dir->fd;
+        sqe->addr = (uint64_t)(uintptr_t)dir->entries[indices[k]].name;
+        sqe->len = FAST_STAT_MASK;
+        sqe->off = (uint64_t)(uintptr_t)&bufs[k];
+        sqe->statx_flags = AT_STATX_SYNC_AS_STAT;
+        sqe->user_data = k;
+        ctx->sq_array[slot] = slot;
+    }
+    __atomic_store_n(ctx->sq_tail, tail + (unsigned)count, __ATOMIC_RELEASE);
+
+    size_t done = 0;
+    int unsupported = 0;
+    unsigned to_submit = (unsigned)count;
+    while (done < count) {
+        long r = syscall(__NR_io_uring_enter, ctx->ring_fd, to_submit, 1,
+                         IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            // Requests may still be in flight and write into the statx
+            // buffers; leave them to the dying ring rather than free them
+            ctx->statx_buf = NULL;
+            break;
+        }
+        to_submit = 0;
+
+        unsigned head = *ctx->cq_head;
+        unsigned cq_tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != cq_tail) {
+            const struct io_uring_cqe *cqe = &cqes[head & *ctx->cq_mask];
+            size_t k = (size_t)cqe->user_data;
+            if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+                unsupported = 1;
+            }
+            if (k < count) {
+                ok[k] = cqe->res == 0;
+                if (ok[k]) statx_to_stat(&bufs[k], &results[k]);
+            }
+            head++;
+            done++;
+        }
+        __atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (done < count || unsupported) {
+        // Old kernel without IORING_OP_STATX, or the ring broke; stop using it
+        __atomic_store_n(&ring_unsupported, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+void fast_dir_stat(fast_stat_ctx_t *ctx, const fast_dir_t *dir,
+                   const size_t *indices, size_t count,
+                   struct stat *results, int *ok) {
+    size_t k = 0;
+
+    if (ctx && ctx->ring_fd >= 0 && count >= FAST_STAT_RING_MIN_BATCH) {
+        while (k < count) {
+            size_t chunk = count - k;
+            if (chunk > ctx->sq_entries) chunk = ctx->sq_entries;
+            if (!ring_stat_chunk(ctx, dir, indices + k, chunk, results + k, ok + k)) {
+                fast_stat_free(ctx);
+                break;
+            }
+            k += chunk;
+        }
+    }
+
+    // Small batches, and everything left if the ring gave out
+    for (; k < count; k++) {
+        ok[k] = statx_one(dir->fd, dir->entries[indices[k]].name, &results[k]);
+    }
+}
+
+#else
+
+int fast_dir_open(fast_dir_t *dir, const char *path) {
+    (void)path;
+    if (dir) {
+        memset(dir, 0, sizeof(*dir));
+        dir->fd = -1;
+    }
+    return FRACTYL_ERROR_INVALID_STATE;
+}
+
+void fast_dir_close(fast_dir_t *dir) {
+    (void)dir;
+}
+
+void fast_stat_init(fast_stat_ctx_t *ctx) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->ring_fd = -1;
+}
+
+void fast_stat_free(fast_stat_ctx_t *ctx) {
+    (void)ctx;
+}
+
+void fast_dir_stat(fast_stat_ctx_t *ctx, const fast_dir_t *dir,
+                   const size_t *indices, size_t count,
+                   struct stat *results, int *ok) {
+    (void)ctx; (void)dir; (void)indices; (void)results;
+    memset(ok, 0, count * sizeof(int));
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef FRACTYL_FAST_DIR_H
+#define FRACTYL_FAST_DIR_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Batched directory enumeration for the scanner.
+// On Linux directories are read with large getdents64() buffers and the
+// entries are stat'ed in batches with statx() relative to the directory fd,
+// submitted through io_uring when the kernel allows it. Elsewhere (or when
+// getdents64 is unavailable) fast_dir_open() fails with
+// FRACTYL_ERROR_INVALID_STATE and callers use the portable readdir() path.
+
+typedef struct {
+    const char *name;         // Points into the directory buffer
+    unsigned char type;       // DT_* value, DT_UNKNOWN if the fs does not say
+} fast_dirent_t;
+
+typedef struct {
+    int fd;                   // Directory fd, base for fast_dir_stat()
+    char *buf;                // Raw getdents64 records
+    size_t buf_size;
+    size_t buf_used;
+    fast_dirent_t *entries;   // Excludes "." and ".."
+    size_t count;
+    size_t capacity;
+} fast_dir_t;
+
+// Per-thread stat batching state; one per scanner worker
+typedef struct {
+    int ring_fd;              // io_uring fd, -1 when batching is synchronous
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    void *sqes;               // struct io_uring_sqe[sq_entries]
+    void *cqes;               // struct io_uring_cqe[]
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    void *statx_buf;          // One struct statx per in-flight request
+} fast_stat_ctx_t;
+
+// Read every entry of a directory
+// Returns FRACTYL_OK, FRACTYL_ERROR_IO if it cannot be opened, or
+// FRACTYL_ERROR_INVALID_STATE when the batched backend is unavailable
+int fast_dir_open(fast_dir_t *dir, const char *path);
+
+// Release the directory fd and buffers
+void fast_dir_close(fast_dir_t *dir);
+
+// Set up batching for the calling thread; falls back to plain statx() calls
+void fast_stat_init(fast_stat_ctx_t *ctx);
+
+// Tear down the io_uring instance, if any
+void fast_stat_free(fast_stat_ctx_t *ctx);
+
+// Stat dir->entries[indices[k]] into results[k] for k < count, following
+// symlinks like stat(). Only the fields the change check compares are
+// requested (type, mode, size, mtime, ctime, inode, device, uid and gid);
+// the others are zero.
+// ok[k] is set to 1 on success and 0 on failure.
+void fast_dir_stat(fast_stat_ctx_t *ctx, const fast_dir_t *dir,
+                   const size_t *indices, size_t count,
+                   struct stat *results, int *ok);
+
+#endif // FRACTYL_FAST_DIR_H
@@ -3,6 +3,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
 #ifdef _WIN32
     #include <direct.h>
 #else
@@ -38,6 +39,43 @@ bool mkdir_p(const char *path) {
     #endif
 }
 
+bool fsync_path(const char *path) {
+    if (!path) return false;
+    
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+bool fsync_parent_dir(const char *path) {
+    if (!path) return false;
+    
+    const char *slash = strrchr(path, '/');
+    if (!slash) return fsync_path(".");
+    if (slash == path) return fsync_path("/");
+    
+    char dir[4096];
+    size_t len = (size_t)(slash - path);
+    if (len >= sizeof(dir)) return false;
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+    return fsync_path(dir);
+}
+
+void file_prefetch(const char *path, off_t size, off_t max_bytes) {
+    if (!path || size <= 0) return;
+    
+    // Non-blocking, so a file replaced by a FIFO since it was listed cannot hang
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return;
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(fd, 0, size < max_bytes ? size : max_bytes, POSIX_FADV_WILLNEED);
+#endif
+    close(fd);
+}
+
 int enumerate_files(const char *root, char ***out_paths, size_t *out_count) {
     // TODO: recursive file listing later
     (void)root; (void)out_paths; (void)out_count;
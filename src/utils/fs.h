@@ -4,11 +4,20 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <sys/types.h>
 
 bool file_exists(const char *path);
 bool is_directory(const char *path);
 bool mkdir_p(const char *path);
 int enumerate_files(const char *root, char ***out_paths, size_t *out_count);
+// Flush a file or directory to stable storage
+bool fsync_path(const char *path);
+// Flush the directory holding path, making its entry durable
+bool fsync_parent_dir(const char *path);
+// Have the kernel start reading the first max_bytes of a file that is
+// about to be read (posix_fadvise WILLNEED), so the device is busy with
+// it while earlier files are hashed; a hint only, so errors are ignored
+void file_prefetch(const char *path, off_t size, off_t max_bytes);
 // TODO: add more function declarations as necessary
 
 #endif // FS_H
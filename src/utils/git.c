@@ -1,9 +1,11 @@
 #include "git.h"
+#include "profile.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 // Check if we're in a git repository by looking for .git directory
 int git_is_repository(const char *path) {
@@ -46,59 +48,272 @@ int git_is_repository(const char *path) {
     return 0; // Not in a git repository
 }
 
-// Get the current git branch name
-// Returns allocated string that caller must free, or NULL on error
-char* git_get_current_branch(const char *repo_path) {
-    char command[2048];
-    char branch[256];
-    FILE *fp;
+// Read the first line of a small file, without its newline
+static int read_line(const char *path, char *line, size_t size) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
     
-    // Use git symbolic-ref to get current branch
-    if (repo_path) {
-        snprintf(command, sizeof(command), "cd \"%s\" && git symbolic-ref --short HEAD 2>/dev/null", repo_path);
+    if (fgets(line, (int)size, fp) == NULL) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    
+    line[strcspn(line, "\r\n")] = '\0';
+    return 0;
+}
+
+// Join a path read from a git file onto the directory it is relative to
+static void resolve_git_path(const char *base, const char *path, char *out, size_t size) {
+    if (path[0] == '/') {
+        snprintf(out, size, "%s", path);
     } else {
-        snprintf(command, sizeof(command), "git symbolic-ref --short HEAD 2>/dev/null");
+        snprintf(out, size, "%s/%s", base, path);
     }
+}
+
+// Find the git directory for a path, walking up the tree like git does.
+// work_tree gets the directory holding .git, git_dir the directory with
+// HEAD in it and common_dir the one with refs and packed-refs, which differ
+// for worktrees. Any of them may be NULL.
+static int find_git_dirs(const char *path, char *work_tree, char *git_dir, char *common_dir, size_t size) {
+    char current_path[2048];
+    char dot_git[2100];
+    char found_dir[4096];
+    char line[4096];
     
-    fp = popen(command, "r");
-    if (!fp) {
-        return NULL;
+    if (path) {
+        snprintf(current_path, sizeof(current_path), "%s", path);
+    } else if (!getcwd(current_path, sizeof(current_path))) {
+        return -1;
     }
     
-    if (fgets(branch, sizeof(branch), fp) == NULL) {
-        pclose(fp);
-        // Not on a branch, might be detached HEAD
-        // Try to get commit hash instead
-        if (repo_path) {
-            snprintf(command, sizeof(command), "cd \"%s\" && git rev-parse --short HEAD 2>/dev/null", repo_path);
-        } else {
-            snprintf(command, sizeof(command), "git rev-parse --short HEAD 2>/dev/null");
+    while (1) {
+        snprintf(dot_git, sizeof(dot_git), "%s/.git", current_path);
+        
+        struct stat st;
+        if (stat(dot_git, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                snprintf(found_dir, sizeof(found_dir), "%s", dot_git);
+                break;
+            }
+            // Worktrees and submodules have a .git file pointing elsewhere
+            if (read_line(dot_git, line, sizeof(line)) == 0 && strncmp(line, "gitdir: ", 8) == 0) {
+                resolve_git_path(current_path, line + 8, found_dir, sizeof(found_dir));
+                break;
+            }
         }
         
-        fp = popen(command, "r");
-        if (!fp) {
-            return NULL;
+        if (strcmp(current_path, "/") == 0) {
+            return -1;
         }
         
-        if (fgets(branch, sizeof(branch), fp) == NULL) {
-            pclose(fp);
-            return NULL;
+        char *last_slash = strrchr(current_path, '/');
+        if (!last_slash || last_slash == current_path) {
+            strcpy(current_path, "/");
+        } else {
+            *last_slash = '\0';
         }
+    }
+    
+    if (work_tree) snprintf(work_tree, size, "%s", current_path);
+    if (git_dir) snprintf(git_dir, size, "%s", found_dir);
+    if (common_dir) {
+        char commondir_file[4200];
+        snprintf(commondir_file, sizeof(commondir_file), "%s/commondir", found_dir);
+        if (read_line(commondir_file, line, sizeof(line)) == 0 && line[0]) {
+            resolve_git_path(found_dir, line, common_dir, size);
+        } else {
+            snprintf(common_dir, size, "%s", found_dir);
+        }
+    }
+    return 0;
+}
+
+// Look a ref up in packed-refs
+static int read_packed_ref(const char *common_dir, const char *ref, char *commit, size_t size) {
+    char packed_path[4200];
+    snprintf(packed_path, sizeof(packed_path), "%s/packed-refs", common_dir);
+    
+    FILE *fp = fopen(packed_path, "r");
+    if (!fp) {
+        return -1;
+    }
+    
+    char line[4400];
+    int found = -1;
+    while (fgets(line, sizeof(line), fp)) {
+        // Skip the header and peeled tag lines
+        if (line[0] == '#' || line[0] == '^') continue;
+        line[strcspn(line, "\r\n")] = '\0';
         
-        // Prepend "detached-" to indicate detached HEAD
-        char detached_name[256];
-        snprintf(detached_name, sizeof(detached_name), "detached-%s", branch);
-        strcpy(branch, detached_name);
+        char *space = strchr(line, ' ');
+        if (space && strcmp(space + 1, ref) == 0) {
+            *space = '\0';
+            snprintf(commit, size, "%s", line);
+            found = 0;
+            break;
+        }
     }
     
-    pclose(fp);
+    fclose(fp);
+    return found;
+}
+
+// Resolve a ref to a commit hash: the loose ref file wins over packed-refs
+static int resolve_ref(const char *common_dir, const char *ref, char *commit, size_t size) {
+    char target[4096];
+    snprintf(target, sizeof(target), "%s", ref);
     
-    // Remove trailing newline
-    size_t len = strlen(branch);
-    if (len > 0 && branch[len-1] == '\n') {
-        branch[len-1] = '\0';
+    // Symbolic refs may point at each other; git gives up after a few hops too
+    for (int depth = 0; depth < 5; depth++) {
+        char ref_path[8300];
+        char line[4200];
+        snprintf(ref_path, sizeof(ref_path), "%s/%s", common_dir, target);
+        if (read_line(ref_path, line, sizeof(line)) != 0) {
+            return read_packed_ref(common_dir, target, commit, size);
+        }
+        if (strncmp(line, "ref: ", 5) != 0) {
+            snprintf(commit, size, "%s", line);
+            return 0;
+        }
+        snprintf(target, sizeof(target), "%s", line + 5);
+    }
+    return -1;
+}
+
+// What a metadata file looked like when it was last read; git replaces ref
+// files by renaming new ones over them, so any write changes one of these
+typedef struct {
+    int exists;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    long mtime_nsec;
+} file_stamp_t;
+
+static void file_stamp(const char *path, file_stamp_t *stamp) {
+    struct stat st;
+    memset(stamp, 0, sizeof(*stamp));
+    if (stat(path, &st) == 0) {
+        stamp->exists = 1;
+        stamp->ino = st.st_ino;
+        stamp->size = st.st_size;
+        stamp->mtime = st.st_mtim.tv_sec;
+        stamp->mtime_nsec = st.st_mtim.tv_nsec;
+    }
+}
+
+// HEAD of the last repository read. Snapshots read it over and over, so it
+// is only read again once HEAD, the branch's ref or packed-refs change.
+static struct {
+    int valid;
+    char git_dir[4096];
+    char common_dir[4096];
+    char ref[4096];             // Ref HEAD points at, empty when detached
+    char commit[128];           // Empty on a branch without commits
+    file_stamp_t head, loose_ref, packed_refs;
+} head_cache;
+static pthread_mutex_t head_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void stamp_head_files(file_stamp_t *head, file_stamp_t *loose_ref, file_stamp_t *packed_refs) {
+    char path[8300];
+    snprintf(path, sizeof(path), "%s/HEAD", head_cache.git_dir);
+    file_stamp(path, head);
+    if (head_cache.ref[0]) {
+        snprintf(path, sizeof(path), "%s/%s", head_cache.common_dir, head_cache.ref);
+        file_stamp(path, loose_ref);
+    } else {
+        memset(loose_ref, 0, sizeof(*loose_ref));
+    }
+    snprintf(path, sizeof(path), "%s/packed-refs", head_cache.common_dir);
+    file_stamp(path, packed_refs);
+}
+
+// Bring head_cache up to date for the repository containing repo_path.
+// Called with head_cache_lock held.
+static int refresh_head_cache(const char *repo_path) {
+    char git_dir[4096];
+    char common_dir[4096];
+    if (find_git_dirs(repo_path, NULL, git_dir, common_dir, sizeof(git_dir)) != 0) {
+        return -1;
     }
     
+    if (head_cache.valid && strcmp(head_cache.git_dir, git_dir) == 0) {
+        file_stamp_t head, loose_ref, packed_refs;
+        stamp_head_files(&head, &loose_ref, &packed_refs);
+        if (memcmp(&head, &head_cache.head, sizeof(head)) == 0 &&
+            memcmp(&loose_ref, &head_cache.loose_ref, sizeof(loose_ref)) == 0 &&
+            memcmp(&packed_refs, &head_cache.packed_refs, sizeof(packed_refs)) == 0) {
+            return 0;
+        }
+    }
+    
+    head_cache.valid = 0;
+    snprintf(head_cache.git_dir, sizeof(head_cache.git_dir), "%s", git_dir);
+    snprintf(head_cache.common_dir, sizeof(head_cache.common_dir), "%s", common_dir);
+    
+    char head_path[4200];
+    char line[4200];
+    char line_again[4200];
+    snprintf(head_path, sizeof(head_path), "%s/HEAD", git_dir);
+    if (read_line(head_path, line, sizeof(line)) != 0) {
+        return -1;
+    }
+    if (strncmp(line, "ref: ", 5) == 0) {
+        snprintf(head_cache.ref, sizeof(head_cache.ref), "%s", line + 5);
+    } else {
+        head_cache.ref[0] = '\0';
+    }
+    
+    // Stamp the files before resolving the ref, so a change made meanwhile
+    // is seen next time; HEAD is read again in case it moved before that
+    stamp_head_files(&head_cache.head, &head_cache.loose_ref, &head_cache.packed_refs);
+    if (read_line(head_path, line_again, sizeof(line_again)) != 0 || strcmp(line, line_again) != 0) {
+        return -1;
+    }
+    
+    if (!head_cache.ref[0]) {
+        snprintf(head_cache.commit, sizeof(head_cache.commit), "%s", line);
+    } else if (resolve_ref(common_dir, head_cache.ref, head_cache.commit, sizeof(head_cache.commit)) != 0) {
+        head_cache.commit[0] = '\0'; // Branch without commits yet
+    }
+    
+    head_cache.valid = 1;
+    return 0;
+}
+
+// Get the current git branch name
+// Returns allocated string that caller must free, or NULL on error
+char* git_get_current_branch(const char *repo_path) {
+    char branch[256];
+    
+    pthread_mutex_lock(&head_cache_lock);
+    if (refresh_head_cache(repo_path) != 0) {
+        pthread_mutex_unlock(&head_cache_lock);
+        return NULL;
+    }
+    
+    if (head_cache.ref[0]) {
+        // Same as git symbolic-ref --short HEAD
+        const char *name = head_cache.ref;
+        if (strncmp(name, "refs/heads/", 11) == 0) {
+            name += 11;
+        } else if (strncmp(name, "refs/", 5) == 0) {
+            name += 5;
+        }
+        snprintf(branch, sizeof(branch), "%s", name);
+    } else if (head_cache.commit[0]) {
+        // Not on a branch: prepend "detached-" to the short commit hash
+        snprintf(branch, sizeof(branch), "detached-%.7s", head_cache.commit);
+    } else {
+        pthread_mutex_unlock(&head_cache_lock);
+        return NULL;
+    }
+    pthread_mutex_unlock(&head_cache_lock);
+    
     // Sanitize branch name for filesystem use
     for (size_t i = 0; i < strlen(branch); i++) {
         if (branch[i] == '/' || branch[i] == '\\' || branch[i] == ':' || 
@@ -114,38 +329,19 @@ char* git_get_current_branch(const char *repo_path) {
 // Get the current git commit hash
 // Returns allocated string that caller must free, or NULL on error
 char* git_get_current_commit(const char *repo_path) {
-    char command[2048];
-    char commit[256];
-    FILE *fp;
-    
-    if (repo_path) {
-        snprintf(command, sizeof(command), "cd \"%s\" && git rev-parse HEAD 2>/dev/null", repo_path);
-    } else {
-        snprintf(command, sizeof(command), "git rev-parse HEAD 2>/dev/null");
-    }
-    
-    fp = popen(command, "r");
-    if (!fp) {
-        return NULL;
-    }
-    
-    if (fgets(commit, sizeof(commit), fp) == NULL) {
-        pclose(fp);
-        return NULL;
-    }
-    
-    pclose(fp);
+    char *commit = NULL;
     
-    // Remove trailing newline
-    size_t len = strlen(commit);
-    if (len > 0 && commit[len-1] == '\n') {
-        commit[len-1] = '\0';
+    pthread_mutex_lock(&head_cache_lock);
+    if (refresh_head_cache(repo_path) == 0 && head_cache.commit[0]) {
+        commit = strdup(head_cache.commit);
     }
+    pthread_mutex_unlock(&head_cache_lock);
     
-    return strdup(commit);
+    return commit;
 }
 
-// Check if there are uncommitted changes
+// Check if there are uncommitted changes by running git status, which
+// compares the whole working tree against the index
 int git_has_uncommitted_changes(const char *repo_path) {
     char command[2048];
     FILE *fp;
@@ -156,8 +352,10 @@ int git_has_uncommitted_changes(const char *repo_path) {
         snprintf(command, sizeof(command), "git status --porcelain 2>/dev/null");
     }
     
+    unsigned long long started = profile_begin();
     fp = popen(command, "r");
     if (!fp) {
+        profile_end(PROFILE_GIT, started);
         return 0; // Assume no changes if we can't check
     }
     
@@ -168,40 +366,35 @@ int git_has_uncommitted_changes(const char *repo_path) {
     }
     
     pclose(fp);
+    profile_end(PROFILE_GIT, started);
     return has_changes;
 }
 
-// Get git repository root directory
-// Returns allocated string that caller must free, or NULL on error
-char* git_get_repository_root(const char *path) {
-    char command[2048];
-    char root[2048];
-    FILE *fp;
-    
-    if (path) {
-        snprintf(command, sizeof(command), "cd \"%s\" && git rev-parse --show-toplevel 2>/dev/null", path);
-    } else {
-        snprintf(command, sizeof(command), "git rev-parse --show-toplevel 2>/dev/null");
+// Check for uncommitted changes without running git. git writes its index
+// whenever it records the working tree, so a file modified at or after that
+// is taken as a change; changes already staged are not seen.
+int git_has_changes_since_index(const char *repo_path, time_t newest_mtime) {
+    char git_dir[4096];
+    if (find_git_dirs(repo_path, NULL, git_dir, NULL, sizeof(git_dir)) != 0) {
+        return 0;
     }
     
-    fp = popen(command, "r");
-    if (!fp) {
-        return NULL;
+    char index_path[4200];
+    snprintf(index_path, sizeof(index_path), "%s/index", git_dir);
+    struct stat st;
+    if (stat(index_path, &st) != 0) {
+        return newest_mtime > 0; // Nothing added yet, so any file is a change
     }
-    
-    if (fgets(root, sizeof(root), fp) == NULL) {
-        pclose(fp);
+    return newest_mtime >= st.st_mtime;
+}
+
+// Get git repository root directory
+// Returns allocated string that caller must free, or NULL on error
+char* git_get_repository_root(const char *path) {
+    char root[4096];
+    if (find_git_dirs(path, root, NULL, NULL, sizeof(root)) != 0) {
         return NULL;
     }
-    
-    pclose(fp);
-    
-    // Remove trailing newline
-    size_t len = strlen(root);
-    if (len > 0 && root[len-1] == '\n') {
-        root[len-1] = '\0';
-    }
-    
     return strdup(root);
 }
 
@@ -1,10 +1,12 @@
 #ifndef FRACTYL_GIT_H
 #define FRACTYL_GIT_H
 
+#include <time.h>
+
 // Check if we're in a git repository
 int git_is_repository(const char *path);
 
-// Get the current git branch name
+// Get the current git branch name, read from .git/HEAD without running git
 // Returns allocated string that caller must free, or NULL on error
 char* git_get_current_branch(const char *repo_path);
 
@@ -12,9 +14,14 @@ char* git_get_current_branch(const char *repo_path);
 // Returns allocated string that caller must free, or NULL on error
 char* git_get_current_commit(const char *repo_path);
 
-// Check if there are uncommitted changes
+// Check if there are uncommitted changes by running git status
 int git_has_uncommitted_changes(const char *repo_path);
 
+// Cheap check for uncommitted changes: whether a working tree file was
+// modified at or after git last wrote its index. newest_mtime is the newest
+// modification time of the files in the working tree.
+int git_has_changes_since_index(const char *repo_path, time_t newest_mtime);
+
 // Get git repository root directory
 // Returns allocated string that caller must free, or NULL on error  
 char* git_get_repository_root(const char *path);
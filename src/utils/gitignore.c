@@ -1,15 +1,29 @@
 #include "gitignore.h"
+#include "profile.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fnmatch.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+// How a compiled rule is matched, cheapest first
+typedef enum {
+    RULE_MATCH_LITERAL,     // "Makefile", "/build"
+    RULE_MATCH_SUFFIX,      // "*.o"
+    RULE_MATCH_PREFIX,      // "tmp*"
+    RULE_MATCH_FNMATCH      // anything else
+} rule_match_kind_t;
+
 // Structure to hold gitignore rules
 typedef struct {
     char *pattern;
     int is_directory_only;  // Pattern ends with /
     int is_negation;        // Pattern starts with !
+    int is_anchored;        // Pattern contains a slash: match the whole relative path
+    rule_match_kind_t kind;
+    const char *literal;    // Literal part used by the fast paths (points into pattern)
+    size_t literal_len;
 } gitignore_rule_t;
 
 typedef struct {
@@ -18,6 +32,50 @@ typedef struct {
     size_t capacity;
 } gitignore_t;
 
+static int has_glob_chars(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Precompute the fast-path classification of a parsed rule
+static void compile_rule(gitignore_rule_t *rule) {
+    const char *pattern = rule->pattern;
+    
+    // "**/foo" matches foo at any depth, which is what an unanchored rule does
+    while (strncmp(pattern, "**/", 3) == 0) {
+        pattern += 3;
+    }
+    
+    rule->is_anchored = 0;
+    if (pattern[0] == '/') {
+        rule->is_anchored = 1;
+        pattern++;
+    } else if (strchr(pattern, '/') != NULL) {
+        rule->is_anchored = 1;
+    }
+    
+    size_t len = strlen(pattern);
+    rule->kind = RULE_MATCH_FNMATCH;
+    rule->literal = pattern;
+    rule->literal_len = len;
+    
+    if (!has_glob_chars(pattern, len)) {
+        rule->kind = RULE_MATCH_LITERAL;
+    } else if (len > 1 && pattern[0] == '*' && !has_glob_chars(pattern + 1, len - 1) &&
+               !rule->is_anchored) {
+        rule->kind = RULE_MATCH_SUFFIX;
+        rule->literal = pattern + 1;
+        rule->literal_len = len - 1;
+    } else if (len > 1 && pattern[len - 1] == '*' && !has_glob_chars(pattern, len - 1)) {
+        rule->kind = RULE_MATCH_PREFIX;
+        rule->literal_len = len - 1;
+    }
+}
+
 // Parse a gitignore file and return rules
 static gitignore_t* parse_gitignore_file(const char *gitignore_path) {
     FILE *f = fopen(gitignore_path, "r");
@@ -37,9 +95,9 @@ static gitignore_t* parse_gitignore_file(const char *gitignore_path) {
     
     char line[1024];
     while (fgets(line, sizeof(line), f)) {
-        // Remove trailing newline
+        // Remove trailing newline (and CR from files written on Windows)
         size_t len = strlen(line);
-        if (len > 0 && line[len-1] == '\n') {
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
             line[len-1] = '\0';
             len--;
         }
@@ -90,6 +148,7 @@ static gitignore_t* parse_gitignore_file(const char *gitignore_path) {
             continue;  // Skip on allocation failure
         }
         
+        compile_rule(rule);
         gi->count++;
     }
     
@@ -264,4 +323,240 @@ int should_ignore_path(const char *repo_root, const char *full_path, const char
     }
     
     return 0;
-}
\ No newline at end of file
+}
+
+// ---------------------------------------------------------------------------
+// Compiled ignore engine
+// ---------------------------------------------------------------------------
+
+struct ignore_dir {
+    const struct ignore_dir *parent;
+    char *base;                 // Directory relative to repo root ("" for root)
+    size_t base_len;
+    gitignore_t *gitignore;     // NULL when the directory has no .gitignore
+    gitignore_t *fractylignore; // NULL when the directory has no .fractylignore
+    struct ignore_dir *next_allocated;
+};
+
+struct ignore_engine {
+    char *repo_root;
+    struct ignore_dir *root;
+    struct ignore_dir *allocated;   // Every node handed out, for ignore_engine_free
+    pthread_mutex_t alloc_mutex;
+};
+
+// Match a compiled rule against a path relative to the rule file's directory
+static int compiled_rule_matches(const gitignore_rule_t *rule, const char *path,
+                                 const char *basename, int is_directory) {
+    if (rule->is_directory_only && !is_directory) {
+        return 0;
+    }
+    
+    const char *subject = rule->is_anchored ? path : basename;
+    
+    switch (rule->kind) {
+    case RULE_MATCH_LITERAL:
+        return strcmp(subject, rule->literal) == 0;
+    case RULE_MATCH_SUFFIX: {
+        size_t len = strlen(subject);
+        return len >= rule->literal_len &&
+               memcmp(subject + len - rule->literal_len, rule->literal, rule->literal_len) == 0;
+    }
+    case RULE_MATCH_PREFIX:
+        // '*' never crosses a '/' under FNM_PATHNAME
+        return strncmp(subject, rule->literal, rule->literal_len) == 0 &&
+               strchr(subject + rule->literal_len, '/') == NULL;
+    case RULE_MATCH_FNMATCH:
+    default:
+        return fnmatch(rule->literal, subject, rule->is_anchored ? FNM_PATHNAME : 0) == 0;
+    }
+}
+
+// Evaluate one rule file: 1 = ignored, 0 = re-included by negation, -1 = no opinion
+static int compiled_rules_decide(const gitignore_t *gi, const char *path,
+                                 const char *basename, int is_directory) {
+    if (!gi) return -1;
+    
+    // Last matching rule wins, so walk backwards and stop at the first hit
+    for (size_t i = gi->count; i > 0; i--) {
+        const gitignore_rule_t *rule = &gi->rules[i - 1];
+        if (compiled_rule_matches(rule, path, basename, is_directory)) {
+            return rule->is_negation ? 0 : 1;
+        }
+    }
+    return -1;
+}
+
+static void free_ignore_dir(struct ignore_dir *dir) {
+    if (!dir) return;
+    free_gitignore(dir->gitignore);
+    free_gitignore(dir->fractylignore);
+    free(dir->base);
+    free(dir);
+}
+
+static struct ignore_dir *load_ignore_dir(const char *repo_root, const ignore_dir_t *parent,
+                                          const char *relative_dir) {
+    char path[2048];
+    gitignore_t *gi;
+    gitignore_t *fi;
+    
+    if (relative_dir[0] == '\0') {
+        snprintf(path, sizeof(path), "%s/.gitignore", repo_root);
+        gi = parse_gitignore_file(path);
+        snprintf(path, sizeof(path), "%s/.fractylignore", repo_root);
+        fi = parse_gitignore_file(path);
+    } else {
+        snprintf(path, sizeof(path), "%s/%s/.gitignore", repo_root, relative_dir);
+        gi = parse_gitignore_file(path);
+        snprintf(path, sizeof(path), "%s/%s/.fractylignore", repo_root, relative_dir);
+        fi = parse_gitignore_file(path);
+    }
+    
+    // The root node always exists; other directories only get one if they
+    // actually carry rules, which keeps the parent chains short
+    if (parent && !gi && !fi) {
+        return NULL;
+    }
+    
+    struct ignore_dir *dir = calloc(1, sizeof(struct ignore_dir));
+    if (!dir) {
+        free_gitignore(gi);
+        free_gitignore(fi);
+        return NULL;
+    }
+    
+    dir->parent = parent;
+    dir->base = strdup(relative_dir);
+    dir->base_len = strlen(relative_dir);
+    dir->gitignore = gi;
+    dir->fractylignore = fi;
+    if (!dir->base) {
+        free_ignore_dir(dir);
+        return NULL;
+    }
+    
+    return dir;
+}
+
+ignore_engine_t *ignore_engine_create(const char *repo_root) {
+    if (!repo_root) return NULL;
+    
+    ignore_engine_t *engine = calloc(1, sizeof(ignore_engine_t));
+    if (!engine) return NULL;
+    
+    engine->repo_root = strdup(repo_root);
+    engine->root = load_ignore_dir(repo_root, NULL, "");
+    if (!engine->repo_root || !engine->root) {
+        free(engine->repo_root);
+        free_ignore_dir(engine->root);
+        free(engine);
+        return NULL;
+    }
+    
+    pthread_mutex_init(&engine->alloc_mutex, NULL);
+    return engine;
+}
+
+void ignore_engine_free(ignore_engine_t *engine) {
+    if (!engine) return;
+    
+    struct ignore_dir *dir = engine->allocated;
+    while (dir) {
+        struct ignore_dir *next = dir->next_allocated;
+        free_ignore_dir(dir);
+        dir = next;
+    }
+    
+    free_ignore_dir(engine->root);
+    free(engine->repo_root);
+    pthread_mutex_destroy(&engine->alloc_mutex);
+    free(engine);
+}
+
+const ignore_dir_t *ignore_engine_root(const ignore_engine_t *engine) {
+    return engine ? engine->root : NULL;
+}
+
+const ignore_dir_t *ignore_engine_enter_dir(ignore_engine_t *engine, const ignore_dir_t *parent,
+                                            const char *relative_dir) {
+    if (!engine || !relative_dir || relative_dir[0] == '\0') {
+        return parent;
+    }
+    if (!parent) {
+        parent = engine->root;
+    }
+    
+    struct ignore_dir *dir = load_ignore_dir(engine->repo_root, parent, relative_dir);
+    if (!dir) {
+        return parent;
+    }
+    
+    // Nodes are immutable once published; only the free list needs the lock
+    pthread_mutex_lock(&engine->alloc_mutex);
+    dir->next_allocated = engine->allocated;
+    engine->allocated = dir;
+    pthread_mutex_unlock(&engine->alloc_mutex);
+    
+    return dir;
+}
+
+static int engine_decide(const ignore_engine_t *engine, const ignore_dir_t *dir,
+                         const char *relative_path, int is_directory) {
+    // Always ignore the .git and .fractyl directories
+    if (strncmp(relative_path, ".git", 4) == 0 &&
+        (relative_path[4] == '\0' || relative_path[4] == '/')) {
+        return 1;
+    }
+    if (strncmp(relative_path, ".fractyl", 8) == 0 &&
+        (relative_path[8] == '\0' || relative_path[8] == '/')) {
+        return 1;
+    }
+    
+    if (!dir) {
+        dir = engine->root;
+    }
+    
+    const char *basename = strrchr(relative_path, '/');
+    basename = basename ? basename + 1 : relative_path;
+    
+    // Deeper rule files override shallower ones. gitignore and fractylignore
+    // are decided independently and either one can ignore the path.
+    int git_decision = -1;
+    int fractyl_decision = -1;
+    for (const ignore_dir_t *d = dir; d; d = d->parent) {
+        if (git_decision != -1 && fractyl_decision != -1) {
+            break;
+        }
+        
+        const char *sub_path = relative_path;
+        if (d->base_len > 0) {
+            if (strncmp(relative_path, d->base, d->base_len) != 0 ||
+                relative_path[d->base_len] != '/') {
+                continue;
+            }
+            sub_path = relative_path + d->base_len + 1;
+        }
+        
+        if (git_decision == -1) {
+            git_decision = compiled_rules_decide(d->gitignore, sub_path, basename, is_directory);
+        }
+        if (fractyl_decision == -1) {
+            fractyl_decision = compiled_rules_decide(d->fractylignore, sub_path, basename, is_directory);
+        }
+    }
+    
+    return git_decision == 1 || fractyl_decision == 1;
+}
+
+int ignore_engine_should_ignore(const ignore_engine_t *engine, const ignore_dir_t *dir,
+                                const char *relative_path, int is_directory) {
+    if (!engine || !relative_path) {
+        return 0;
+    }
+    
+    unsigned long long started = profile_begin();
+    int ignored = engine_decide(engine, dir, relative_path, is_directory);
+    profile_end(PROFILE_IGNORE, started);
+    return ignored;
+}
@@ -13,4 +13,35 @@ int fractylignore_should_ignore(const char *repo_root, const char *relative_path
 // Check if a path should be ignored by EITHER gitignore OR fractylignore rules
 int should_ignore_path(const char *repo_root, const char *full_path, const char *relative_path);
 
-#endif // FRACTYL_GITIGNORE_H
\ No newline at end of file
+// Compiled ignore engine
+//
+// The engine parses .gitignore/.fractylignore once per scan instead of once
+// per path. Each directory that carries its own ignore files gets an
+// immutable ignore_dir_t node chained to its parent, so worker threads can
+// share the rules without locking: a scanner passes the node for the
+// directory it is reading and gets back the node to hand to its children.
+typedef struct ignore_engine ignore_engine_t;
+typedef struct ignore_dir ignore_dir_t;
+
+// Compile the root ignore files of repo_root. Returns NULL on allocation failure.
+ignore_engine_t *ignore_engine_create(const char *repo_root);
+
+// Free the engine and every directory node it handed out
+void ignore_engine_free(ignore_engine_t *engine);
+
+// Rules that apply at the repository root
+const ignore_dir_t *ignore_engine_root(const ignore_engine_t *engine);
+
+// Load the ignore files of relative_dir (a child of parent). Returns parent
+// unchanged when the directory has no ignore files of its own. Thread-safe.
+const ignore_dir_t *ignore_engine_enter_dir(ignore_engine_t *engine, const ignore_dir_t *parent,
+                                            const char *relative_dir);
+
+// Check relative_path (relative to the repo root) against the rules visible
+// from dir. is_directory usually comes straight from dirent d_type. Callers
+// are expected to prune ignored directories, so only the path below each
+// rule file's directory is matched, as git does.
+int ignore_engine_should_ignore(const ignore_engine_t *engine, const ignore_dir_t *dir,
+                                const char *relative_path, int is_directory);
+
+#endif // FRACTYL_GITIGNORE_H
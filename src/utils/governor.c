@@ -0,0 +1,127 @@
+#include "governor.h"
+#include "config.h"
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef struct {
+    double rate;                    // Units per second, 0 for no limit
+    double tokens;                  // Negative while a charge is being paid off
+    unsigned long long refilled_ns;
+} bucket_t;
+
+static pthread_mutex_t governor_lock = PTHREAD_MUTEX_INITIALIZER;
+static int enabled;                 // Also read without the lock, to return early
+static bucket_t read_bucket;
+static bucket_t write_bucket;
+static bucket_t cpu_bucket;         // In nanoseconds of CPU time
+static unsigned long long cpu_charged_ns;
+static int hash_thread_budget;
+static unsigned long long throttled_ns;
+
+static unsigned long long clock_ns(clockid_t clock) {
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+void governor_budget_load(const char *fractyl_dir, governor_budget_t *budget) {
+    long read_mbps = config_get_long(fractyl_dir, "daemon.max_read_mbps", 0);
+    long write_mbps = config_get_long(fractyl_dir, "daemon.max_write_mbps", 0);
+    long hash_threads = config_get_long(fractyl_dir, "daemon.hash_threads", 0);
+    long cpu_percent = config_get_long(fractyl_dir, "daemon.max_cpu", 0);
+    
+    budget->read_bytes_per_sec = read_mbps > 0 ? read_mbps * 1024 * 1024 : 0;
+    budget->write_bytes_per_sec = write_mbps > 0 ? write_mbps * 1024 * 1024 : 0;
+    budget->hash_threads = hash_threads > 0 ? (int)hash_threads : 0;
+    budget->cpu_percent = cpu_percent > 0 ? (int)cpu_percent : 0;
+}
+
+int governor_budget_enabled(const governor_budget_t *budget) {
+    return budget->read_bytes_per_sec > 0 || budget->write_bytes_per_sec > 0 ||
+           budget->hash_threads > 0 || budget->cpu_percent > 0;
+}
+
+static void bucket_init(bucket_t *bucket, double rate, unsigned long long now) {
+    bucket->rate = rate;
+    bucket->tokens = rate;
+    bucket->refilled_ns = now;
+}
+
+// Refill the bucket for the time passed, holding at most a second's worth,
+// take amount from it and return how long to sleep until it is out of
+// debt. Caller holds governor_lock.
+static unsigned long long bucket_take(bucket_t *bucket, double amount, unsigned long long now) {
+    if (bucket->rate <= 0) return 0;
+    
+    bucket->tokens += bucket->rate * (double)(now - bucket->refilled_ns) / 1e9;
+    if (bucket->tokens > bucket->rate) bucket->tokens = bucket->rate;
+    bucket->refilled_ns = now;
+    bucket->tokens -= amount;
+    return bucket->tokens < 0 ? (unsigned long long)(-bucket->tokens / bucket->rate * 1e9) : 0;
+}
+
+void governor_set(const governor_budget_t *budget) {
+    pthread_mutex_lock(&governor_lock);
+    unsigned long long now = clock_ns(CLOCK_MONOTONIC);
+    int limited = budget && governor_budget_enabled(budget);
+    bucket_init(&read_bucket, limited ? (double)budget->read_bytes_per_sec : 0, now);
+    bucket_init(&write_bucket, limited ? (double)budget->write_bytes_per_sec : 0, now);
+    bucket_init(&cpu_bucket, limited ? budget->cpu_percent * 1e7 : 0, now);
+    cpu_charged_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    __atomic_store_n(&hash_thread_budget, limited ? budget->hash_threads : 0, __ATOMIC_RELAXED);
+    throttled_ns = 0;
+    __atomic_store_n(&enabled, limited, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&governor_lock);
+}
+
+// Charge bytes to io (NULL for none) and the CPU used since the last
+// charge, then sleep off the longer debt
+static void charge(bucket_t *io, size_t bytes) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_ACQUIRE)) return;
+    
+    pthread_mutex_lock(&governor_lock);
+    unsigned long long now = clock_ns(CLOCK_MONOTONIC);
+    unsigned long long wait = io ? bucket_take(io, (double)bytes, now) : 0;
+    if (cpu_bucket.rate > 0) {
+        unsigned long long cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+        unsigned long long cpu_wait = bucket_take(&cpu_bucket, (double)(cpu - cpu_charged_ns), now);
+        cpu_charged_ns = cpu;
+        if (cpu_wait > wait) wait = cpu_wait;
+    }
+    throttled_ns += wait;
+    pthread_mutex_unlock(&governor_lock);
+    
+    if (wait > 0) {
+        struct timespec delay = { (time_t)(wait / 1000000000ULL), (long)(wait % 1000000000ULL) };
+        while (nanosleep(&delay, &delay) != 0 && errno == EINTR) continue;
+    }
+}
+
+void governor_read(size_t bytes) {
+    charge(&read_bucket, bytes);
+}
+
+void governor_write(size_t bytes) {
+    charge(&write_bucket, bytes);
+}
+
+int governor_hash_threads(int planned) {
+    int budget = __atomic_load_n(&hash_thread_budget, __ATOMIC_RELAXED);
+    return budget > 0 && planned > budget ? budget : planned;
+}
+
+unsigned long long governor_cycle_allowance(unsigned int seconds) {
+    pthread_mutex_lock(&governor_lock);
+    double rate = read_bucket.rate;
+    pthread_mutex_unlock(&governor_lock);
+    return rate > 0 ? (unsigned long long)(rate * seconds) : 0;
+}
+
+unsigned long long governor_take_throttled_ms(void) {
+    pthread_mutex_lock(&governor_lock);
+    unsigned long long ms = throttled_ns / 1000000ULL;
+    throttled_ns = 0;
+    pthread_mutex_unlock(&governor_lock);
+    return ms;
+}
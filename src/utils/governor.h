@@ -0,0 +1,54 @@
+#ifndef FRACTYL_GOVERNOR_H
+#define FRACTYL_GOVERNOR_H
+
+#include <stddef.h>
+
+// Resource budgets for background snapshots
+//
+// A daemon sets budgets for its own process (governor_set()); commands run
+// in the foreground never have any, and then every call here returns at
+// once. Reading and writing are token buckets refilled at the configured
+// rate and holding at most one second of it: the hashing and object store
+// paths charge each read and write, and a thread that overdraws sleeps
+// until its debt is paid. The CPU share is a bucket of CPU time, charged
+// with what the process used since the last charge. Hashing threads are a
+// cap on the scan's hash and store pools (concurrency.h).
+//
+// Settings, from the daemon's config, 0 for no limit:
+//   daemon.max_read_mbps    MB/s read from the working tree
+//   daemon.max_write_mbps   MB/s written to .fractyl/objects
+//   daemon.hash_threads     threads hashing and storing files
+//   daemon.max_cpu          percent of one CPU
+
+typedef struct {
+    long read_bytes_per_sec;
+    long write_bytes_per_sec;
+    int hash_threads;
+    int cpu_percent;
+} governor_budget_t;
+
+// Read the budgets from fractyl_dir's config
+void governor_budget_load(const char *fractyl_dir, governor_budget_t *budget);
+
+// Nonzero if budget limits anything
+int governor_budget_enabled(const governor_budget_t *budget);
+
+// Apply budget to this process from now on; NULL lifts every limit
+void governor_set(const governor_budget_t *budget);
+
+// Charge bytes read or written, sleeping first if the process is over a
+// budget. Thread-safe.
+void governor_read(size_t bytes);
+void governor_write(size_t bytes);
+
+// planned, capped at the hashing thread budget
+int governor_hash_threads(int planned);
+
+// Bytes a cycle may read when cycles start seconds apart, 0 if unlimited
+unsigned long long governor_cycle_allowance(unsigned int seconds);
+
+// Time spent sleeping to stay within the budgets since the last call, in
+// milliseconds
+unsigned long long governor_take_throttled_ms(void);
+
+#endif // FRACTYL_GOVERNOR_H
@@ -10,6 +10,69 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <stddef.h>
+
+// Counters of snapshot_stats_t under their JSON names
+static const struct {
+    const char *name;
+    size_t offset;
+} stats_fields[] = {
+    { "files", offsetof(snapshot_stats_t, files) },
+    { "files_changed", offsetof(snapshot_stats_t, files_changed) },
+    { "bytes_changed", offsetof(snapshot_stats_t, bytes_changed) },
+    { "objects_written", offsetof(snapshot_stats_t, objects_written) },
+    { "bytes_written", offsetof(snapshot_stats_t, bytes_written) },
+    { "bytes_deduplicated", offsetof(snapshot_stats_t, bytes_deduplicated) },
+    { "scan_ms", offsetof(snapshot_stats_t, scan_ms) },
+    { "hash_ms", offsetof(snapshot_stats_t, hash_ms) },
+    { "store_ms", offsetof(snapshot_stats_t, store_ms) },
+    { "tree_ms", offsetof(snapshot_stats_t, tree_ms) },
+    { "total_ms", offsetof(snapshot_stats_t, total_ms) },
+};
+
+static cJSON* serialize_stats(const snapshot_stats_t *stats) {
+    cJSON *json = cJSON_CreateObject();
+    if (!json) return NULL;
+    for (size_t i = 0; i < sizeof(stats_fields) / sizeof(stats_fields[0]); i++) {
+        const unsigned long long *value =
+            (const unsigned long long *)((const char *)stats + stats_fields[i].offset);
+        cJSON_AddNumberToObject(json, stats_fields[i].name, (double)*value);
+    }
+    cJSON *paths = cJSON_CreateArray();
+    for (size_t i = 0; i < stats->path_count; i++) {
+        cJSON *path = cJSON_CreateObject();
+        cJSON_AddStringToObject(path, "path", stats->paths[i]);
+        cJSON_AddNumberToObject(path, "size", (double)stats->path_sizes[i]);
+        cJSON_AddItemToArray(paths, path);
+    }
+    cJSON_AddItemToObject(json, "largest_changes", paths);
+    return json;
+}
+
+static void deserialize_stats(const cJSON *json, snapshot_stats_t *stats) {
+    stats->recorded = 1;
+    for (size_t i = 0; i < sizeof(stats_fields) / sizeof(stats_fields[0]); i++) {
+        cJSON *item = cJSON_GetObjectItem(json, stats_fields[i].name);
+        if (cJSON_IsNumber(item) && item->valuedouble > 0) {
+            *(unsigned long long *)((char *)stats + stats_fields[i].offset) =
+                (unsigned long long)item->valuedouble;
+        }
+    }
+    cJSON *paths = cJSON_GetObjectItem(json, "largest_changes");
+    int count = cJSON_IsArray(paths) ? cJSON_GetArraySize(paths) : 0;
+    for (int i = 0; i < count && stats->path_count < SNAPSHOT_STATS_PATHS; i++) {
+        cJSON *item = cJSON_GetArrayItem(paths, i);
+        cJSON *path = cJSON_GetObjectItem(item, "path");
+        cJSON *size = cJSON_GetObjectItem(item, "size");
+        if (!cJSON_IsString(path) || !path->valuestring) continue;
+        char *copy = strdup(path->valuestring);
+        if (!copy) break;
+        stats->paths[stats->path_count] = copy;
+        stats->path_sizes[stats->path_count++] =
+            cJSON_IsNumber(size) && size->valuedouble > 0 ? (unsigned long long)size->valuedouble : 0;
+    }
+}
 
 char* json_serialize_snapshot(const snapshot_t *snapshot) {
     if (!snapshot) return NULL;
@@ -70,6 +133,11 @@ char* json_serialize_snapshot(const snapshot_t *snapshot) {
         cJSON_AddNullToObject(json, "git_commit");
     }
     cJSON_AddBoolToObject(json, "git_dirty", snapshot->git_dirty);
+    
+    // What the snapshot cost, if it was measured
+    if (snapshot->stats.recorded) {
+        cJSON_AddItemToObject(json, "stats", serialize_stats(&snapshot->stats));
+    }
 
     char *json_string = cJSON_Print(json);
     cJSON_Delete(json);
@@ -159,6 +227,11 @@ int json_deserialize_snapshot(const char *json_str, snapshot_t *snapshot) {
     if (cJSON_IsBool(git_dirty)) {
         snapshot->git_dirty = cJSON_IsTrue(git_dirty) ? 1 : 0;
     }
+    
+    cJSON *stats = cJSON_GetObjectItem(json, "stats");
+    if (cJSON_IsObject(stats)) {
+        deserialize_stats(stats, &snapshot->stats);
+    }
 
     cJSON_Delete(json);
     return FRACTYL_OK;
@@ -174,21 +247,31 @@ int json_save_snapshot(const snapshot_t *snapshot, const char *file_path) {
         return FRACTYL_ERROR_OUT_OF_MEMORY;
     }
 
-    FILE *fp = fopen(file_path, "w");
-    if (!fp) {
+    // Written under a hidden name and renamed, so readers never see half a
+    // snapshot; the leading dot keeps it out of snapshot listings
+    char temp_path[4096];
+    const char *slash = strrchr(file_path, '/');
+    int dir_len = slash ? (int)(slash - file_path + 1) : 0;
+    if (snprintf(temp_path, sizeof(temp_path), "%.*s.%s.tmp", dir_len, file_path,
+                 file_path + dir_len) >= (int)sizeof(temp_path)) {
         free(json_str);
-        return FRACTYL_ERROR_IO;
+        return FRACTYL_ERROR_INVALID_ARGS;
     }
 
-    size_t len = strlen(json_str);
-    if (fwrite(json_str, 1, len, fp) != len) {
-        fclose(fp);
+    FILE *fp = fopen(temp_path, "w");
+    if (!fp) {
         free(json_str);
         return FRACTYL_ERROR_IO;
     }
 
-    fclose(fp);
+    size_t len = strlen(json_str);
+    int written = fwrite(json_str, 1, len, fp) == len;
+    if (fclose(fp) != 0) written = 0;
     free(json_str);
+    if (!written || rename(temp_path, file_path) != 0) {
+        unlink(temp_path);
+        return FRACTYL_ERROR_IO;
+    }
     return FRACTYL_OK;
 }
 
@@ -249,6 +332,9 @@ void json_free_snapshot(snapshot_t *snapshot) {
         }
         free(snapshot->git_status);
     }
+    for (size_t i = 0; i < snapshot->stats.path_count; i++) {
+        free(snapshot->stats.paths[i]);
+    }
 
     memset(snapshot, 0, sizeof(snapshot_t));
 }
@@ -1,4 +1,5 @@
 #include "lock.h"
+#include "../core/alternates.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,35 +7,63 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 
-// Check if a PID is still running
-static int is_process_running(pid_t pid) {
+#define LOCK_FILE "fractyl.lock"
+#define PUBLISH_LOCK_FILE "publish.lock"
+
+static volatile sig_atomic_t lock_timed_out;
+
+static void lock_alarm(int sig) {
+    (void)sig;
+    lock_timed_out = 1;
+}
+
+// Read the PID an exclusive holder left in the lock file, 0 if none
+static pid_t read_lock_pid(int fd) {
+    char buffer[32];
+    ssize_t n = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (n <= 0) return 0;
+    buffer[n] = '\0';
+    return (pid_t)atoi(buffer);
+}
+
+// Record the exclusive holder, or with pid 0 that there is none
+static int write_lock_pid(int fd, pid_t pid) {
+    if (ftruncate(fd, 0) != 0) return -1;
     if (pid <= 0) return 0;
-    
-    // Use kill(pid, 0) to check if process exists
-    if (kill(pid, 0) == 0) {
-        return 1; // Process exists
-    } else {
-        return (errno != ESRCH); // ESRCH means process doesn't exist
-    }
+    char text[32];
+    int len = snprintf(text, sizeof(text), "%d\n", pid);
+    return pwrite(fd, text, (size_t)len, 0) == len ? 0 : -1;
 }
 
-// Read PID from lock file
-static pid_t read_lock_pid(const char *lock_path) {
-    FILE *f = fopen(lock_path, "r");
-    if (!f) return 0;
-    
-    pid_t pid = 0;
-    if (fscanf(f, "%d", &pid) != 1) {
-        pid = 0;
-    }
-    fclose(f);
-    return pid;
+// Block in flock() for up to timeout_seconds. An alarm without SA_RESTART
+// interrupts it at the timeout, as flock(1) -w does.
+static int wait_flock(int fd, int operation, int timeout_seconds) {
+    struct sigaction action, previous;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = lock_alarm;
+    sigemptyset(&action.sa_mask);
+    lock_timed_out = 0;
+    sigaction(SIGALRM, &action, &previous);
+    unsigned int previous_alarm = alarm((unsigned int)timeout_seconds);
+    
+    int result;
+    do {
+        result = flock(fd, operation);
+    } while (result != 0 && errno == EINTR && !lock_timed_out);
+    
+    alarm(0);
+    sigaction(SIGALRM, &previous, NULL);
+    if (previous_alarm > 0) alarm(previous_alarm);
+    return result;
 }
 
-// Acquire exclusive lock for fractyl operations
-int fractyl_lock_acquire(const char *fractyl_dir, fractyl_lock_t *lock) {
+// Open fractyl_dir/name and lock it. timeout_seconds of 0 tries once; else
+// waits that long, saying once who it waits for.
+static int lock_file(const char *fractyl_dir, const char *name, int operation, int timeout_seconds,
+                     fractyl_lock_t *lock) {
     if (!fractyl_dir || !lock) return -1;
     
     // Initialize lock structure
@@ -43,48 +72,71 @@ int fractyl_lock_acquire(const char *fractyl_dir, fractyl_lock_t *lock) {
     
     // Build lock file path
     char lock_path[2048];
-    snprintf(lock_path, sizeof(lock_path), "%s/fractyl.lock", fractyl_dir);
+    snprintf(lock_path, sizeof(lock_path), "%s/%s", fractyl_dir, name);
     lock->lock_path = strdup(lock_path);
-    
-    // Try to create lock file exclusively
-    lock->fd = open(lock_path, O_CREAT | O_EXCL | O_WRONLY, 0644);
-    if (lock->fd >= 0) {
-        // Successfully created lock file
-        lock->holder_pid = getpid();
-        
-        // Write our PID to the lock file
-        dprintf(lock->fd, "%d\n", lock->holder_pid);
-        fsync(lock->fd);
-        
-        return 0; // Lock acquired successfully
+    lock->fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (!lock->lock_path || lock->fd < 0) {
+        fractyl_lock_release(lock);
+        return -1;
     }
     
-    // Lock file already exists - check if holder is still running
-    if (errno == EEXIST) {
-        pid_t existing_pid = read_lock_pid(lock_path);
-        if (existing_pid > 0 && is_process_running(existing_pid)) {
-            // Lock is held by running process
+    if (flock(lock->fd, operation | LOCK_NB) != 0) {
+        if (errno != EWOULDBLOCK || timeout_seconds <= 0) {
+            fractyl_lock_release(lock);
             return -1;
+        }
+        pid_t holder = read_lock_pid(lock->fd);
+        if (holder > 0) {
+            printf("[LOCK] Waiting for operation in progress (PID %d)...\n", holder);
         } else {
-            // Stale lock file - remove it and try again
-            printf("[LOCK] Removing stale lock file (PID %d no longer running)\n", existing_pid);
-            unlink(lock_path);
-            
-            // Retry lock acquisition
-            lock->fd = open(lock_path, O_CREAT | O_EXCL | O_WRONLY, 0644);
-            if (lock->fd >= 0) {
-                lock->holder_pid = getpid();
-                dprintf(lock->fd, "%d\n", lock->holder_pid);
-                fsync(lock->fd);
-                return 0;
-            }
+            printf("[LOCK] Waiting for operations in progress...\n");
+        }
+        fflush(stdout);
+        if (wait_flock(lock->fd, operation, timeout_seconds) != 0) {
+            printf("[LOCK] Timeout waiting for lock after %d seconds\n", timeout_seconds);
+            fractyl_lock_release(lock);
+            return -1;
         }
     }
     
-    // Failed to acquire lock
-    free(lock->lock_path);
-    lock->lock_path = NULL;
-    return -1;
+    lock->holder_pid = getpid();
+    lock->shared = operation == LOCK_SH;
+    if (!lock->shared) write_lock_pid(lock->fd, lock->holder_pid);
+    return 0;
+}
+
+// Take the locks of fractyl_dir's shared stores shared, next to its own
+static int lock_stores(const char *fractyl_dir, int timeout_seconds, fractyl_lock_t *lock) {
+    const char *const *stores;
+    size_t count = alternates_list(fractyl_dir, &stores);
+    if (count == 0) return 0;
+    
+    lock->store_fds = malloc(count * sizeof(int));
+    if (!lock->store_fds) {
+        fractyl_lock_release(lock);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        fractyl_lock_t store_lock;
+        if (lock_file(stores[i], LOCK_FILE, LOCK_SH, timeout_seconds, &store_lock) != 0) {
+            fractyl_lock_release(lock);
+            return -1;
+        }
+        free(store_lock.lock_path);
+        lock->store_fds[lock->store_count++] = store_lock.fd;
+    }
+    return 0;
+}
+
+// The repository lock and those of its stores
+static int lock_repository(const char *fractyl_dir, int operation, int timeout_seconds, fractyl_lock_t *lock) {
+    if (lock_file(fractyl_dir, LOCK_FILE, operation, timeout_seconds, lock) != 0) return -1;
+    return lock_stores(fractyl_dir, timeout_seconds, lock);
+}
+
+// Acquire exclusive lock for fractyl operations
+int fractyl_lock_acquire(const char *fractyl_dir, fractyl_lock_t *lock) {
+    return lock_repository(fractyl_dir, LOCK_EX, 0, lock);
 }
 
 // Release the lock
@@ -92,87 +144,56 @@ void fractyl_lock_release(fractyl_lock_t *lock) {
     if (!lock) return;
     
     if (lock->fd >= 0) {
+        // The file stays: removing it would let a waiter hold a lock on
+        // the old file while the next one locks a new file
+        if (lock->holder_pid && !lock->shared) write_lock_pid(lock->fd, 0);
         close(lock->fd);
         lock->fd = -1;
     }
     
-    if (lock->lock_path) {
-        // Only remove lock file if we're the ones who created it
-        pid_t file_pid = read_lock_pid(lock->lock_path);
-        if (file_pid == getpid()) {
-            unlink(lock->lock_path);
-        }
-        
-        free(lock->lock_path);
-        lock->lock_path = NULL;
+    for (size_t i = 0; i < lock->store_count; i++) {
+        close(lock->store_fds[i]);
     }
+    free(lock->store_fds);
+    lock->store_fds = NULL;
+    lock->store_count = 0;
     
+    free(lock->lock_path);
+    lock->lock_path = NULL;
     lock->holder_pid = 0;
 }
 
 // Check if a lock is currently held (without trying to acquire)
 int fractyl_lock_check(const char *fractyl_dir, pid_t *holder_pid) {
     if (!fractyl_dir) return -1;
+    if (holder_pid) *holder_pid = 0;
     
     char lock_path[2048];
-    snprintf(lock_path, sizeof(lock_path), "%s/fractyl.lock", fractyl_dir);
+    snprintf(lock_path, sizeof(lock_path), "%s/%s", fractyl_dir, LOCK_FILE);
     
-    // Check if lock file exists
-    struct stat st;
-    if (stat(lock_path, &st) != 0) {
-        if (holder_pid) *holder_pid = 0;
-        return 0; // No lock file = not locked
+    int fd = open(lock_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT ? 0 : -1; // No lock file = not locked
     }
     
-    // Read the PID from lock file
-    pid_t pid = read_lock_pid(lock_path);
-    if (pid <= 0) {
-        if (holder_pid) *holder_pid = 0;
-        return 0; // Invalid PID = not locked
-    }
-    
-    // Check if the process is still running
-    if (is_process_running(pid)) {
-        if (holder_pid) *holder_pid = pid;
-        return 1; // Locked by running process
-    } else {
-        // Stale lock file
-        if (holder_pid) *holder_pid = 0;
-        return 0; // Stale lock = not locked
+    int locked = 0;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        locked = errno == EWOULDBLOCK ? 1 : -1;
+        if (locked == 1 && holder_pid) *holder_pid = read_lock_pid(fd);
     }
+    close(fd);
+    return locked;
 }
 
 // Wait for lock to become available, then acquire it
 int fractyl_lock_wait_acquire(const char *fractyl_dir, fractyl_lock_t *lock, int timeout_seconds) {
-    if (!fractyl_dir || !lock) return -1;
-    
-    int attempts = 0;
-    int max_attempts = timeout_seconds * 10; // Check every 100ms
-    
-    while (attempts < max_attempts) {
-        // Try to acquire lock
-        int result = fractyl_lock_acquire(fractyl_dir, lock);
-        if (result == 0) {
-            return 0; // Successfully acquired
-        }
-        
-        // Check who's holding the lock
-        pid_t holder_pid;
-        int lock_status = fractyl_lock_check(fractyl_dir, &holder_pid);
-        if (lock_status <= 0) {
-            // Lock was released, try again immediately
-            continue;
-        }
-        
-        // Lock is held, wait a bit
-        if (attempts == 0) {
-            printf("[LOCK] Waiting for operation in progress (PID %d)...\n", holder_pid);
-        }
-        
-        usleep(100000); // 100ms
-        attempts++;
-    }
-    
-    printf("[LOCK] Timeout waiting for lock after %d seconds\n", timeout_seconds);
-    return -1; // Timeout
-}
\ No newline at end of file
+    return lock_repository(fractyl_dir, LOCK_EX, timeout_seconds, lock);
+}
+
+int fractyl_lock_wait_acquire_shared(const char *fractyl_dir, fractyl_lock_t *lock, int timeout_seconds) {
+    return lock_repository(fractyl_dir, LOCK_SH, timeout_seconds, lock);
+}
+
+int fractyl_lock_wait_publish(const char *fractyl_dir, fractyl_lock_t *lock, int timeout_seconds) {
+    return lock_file(fractyl_dir, PUBLISH_LOCK_FILE, LOCK_EX, timeout_seconds, lock);
+}
@@ -3,11 +3,34 @@
 
 #include <sys/types.h>
 
+// Repository locks
+//
+// .fractyl/fractyl.lock is held shared by commands that read snapshots and
+// objects or only add new ones (show, diff, export, snapshot), and
+// exclusively by those that delete or rewrite them (gc, delete, prune,
+// restore, repack). A snapshot also holds .fractyl/publish.lock, always
+// exclusively, but only while it moves its branch to the new snapshot:
+// its metadata is written under a temporary name and renamed into place,
+// so readers see the branch before or after and never wait for a snapshot
+// being taken. Listing reads nothing but that metadata and takes no lock.
+//
+// The locks are flock(2)s on files that stay in place. The kernel drops a
+// lock with the process holding it, so no lock is ever stale, and waiting
+// for one blocks in flock() itself until it is free or the timeout passes.
+// An exclusive holder writes its PID into the file for fractyl_lock_check().
+//
+// The repository lock, shared or exclusive, comes with the fractyl.lock of
+// each shared object store the repository uses (core/alternates.h) held
+// shared, so a store is only collected while none of its members works.
+
 // Lock handle
 typedef struct {
     int fd;                    // File descriptor for lock file
     char *lock_path;          // Path to lock file
     pid_t holder_pid;         // PID of process holding lock
+    int shared;               // Held together with other readers
+    int *store_fds;           // Locks of the shared object stores, held shared
+    size_t store_count;
 } fractyl_lock_t;
 
 // Acquire exclusive lock for fractyl operations
@@ -18,11 +41,18 @@ int fractyl_lock_acquire(const char *fractyl_dir, fractyl_lock_t *lock);
 void fractyl_lock_release(fractyl_lock_t *lock);
 
 // Check if a lock is currently held (without trying to acquire)
-// Returns 1 if locked, 0 if free, negative on error
+// Returns 1 if locked, 0 if free, negative on error. holder_pid is 0
+// when only readers hold it.
 int fractyl_lock_check(const char *fractyl_dir, pid_t *holder_pid);
 
 // Wait for lock to become available, then acquire it
 // Returns 0 on success, negative on timeout/error
 int fractyl_lock_wait_acquire(const char *fractyl_dir, fractyl_lock_t *lock, int timeout_seconds);
 
-#endif // FRACTYL_LOCK_H
\ No newline at end of file
+// The same, shared with other readers and snapshots
+int fractyl_lock_wait_acquire_shared(const char *fractyl_dir, fractyl_lock_t *lock, int timeout_seconds);
+
+// Wait for the publish lock, around moving a branch to a new snapshot
+int fractyl_lock_wait_publish(const char *fractyl_dir, fractyl_lock_t *lock, int timeout_seconds);
+
+#endif // FRACTYL_LOCK_H
@@ -0,0 +1,402 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include "../include/core.h"
+#include "../include/fractyl.h"
+#include "../core/index.h"
+#include "../core/objects.h"
+#include "../core/pack.h"
+#include "../core/hash.h"
+#include "concurrency.h"
+#include "config.h"
+#include "counters.h"
+#include "parallel_restore.h"
+
+// Seconds between progress reports
+#define RESTORE_PROGRESS_INTERVAL 2
+// Objects are prefetched this many files ahead of the writers
+#define RESTORE_PREFETCH_WINDOW 64
+
+// Where an entry's object is stored
+typedef struct {
+    uint64_t major;             // Pack number; UINT64_MAX for loose objects
+    uint64_t minor;             // Offset in the pack, or the loose file's inode
+    size_t entry;
+} read_location_t;
+
+typedef struct {
+    const char *root;
+    const char *fractyl_dir;
+    restore_options_t options;
+    index_entry_t **entries;
+    size_t *order;              // Entries in the order their objects are read
+    size_t count;
+    time_t start;
+    int preserve_mtime;         // restore.preserve_mtime: give files their recorded mtime
+    unsigned char *written;     // Per entry, set once its file is written
+    size_t next;                // Next entry to claim
+    size_t done;
+    size_t linked;
+    size_t failed;
+    unsigned long long bytes;
+    pthread_mutex_t lock;       // Signals finished to the reporting thread
+    pthread_cond_t finished;
+} restore_pool_t;
+
+// The mode a restore gives entry's file
+static mode_t restored_mode(const index_entry_t *entry, const restore_options_t *options) {
+    return options && options->hardlink ? entry->mode & ~(mode_t)0222 : entry->mode;
+}
+
+// Create the parent directories of every entry. Entries are in path
+// order, so the files below a directory are contiguous: a directory is
+// made when the first of them comes up, and the leading components it
+// shares with the one made before are skipped.
+static void create_directories(const char *root, index_entry_t **entries, size_t count) {
+    char made[PATH_MAX] = "";   // Directory (relative to root) known to exist
+    size_t made_len = 0;
+    char dir_path[PATH_MAX];
+    size_t root_len = strlen(root);
+    if (root_len + 2 >= sizeof(dir_path)) return;
+    memcpy(dir_path, root, root_len);
+    dir_path[root_len] = '/';
+    
+    for (size_t i = 0; i < count; i++) {
+        const char *path = entries[i]->path;
+        const char *slash = path ? strrchr(path, '/') : NULL;
+        if (!slash) continue;
+        size_t len = (size_t)(slash - path);
+        if (len >= sizeof(made) || root_len + 1 + len >= sizeof(dir_path)) continue;
+    
+        // Whole leading components this directory shares with the last one
+        size_t shared = 0;
+        for (size_t k = 0; k <= len && k <= made_len; k++) {
+            if ((k == len || path[k] == '/') && (k == made_len || made[k] == '/')) shared = k;
+            if (k == len || k == made_len || path[k] != made[k]) break;
+        }
+        if (shared == len) continue;
+    
+        // Failures show up when the file itself cannot be written
+        for (size_t k = shared + 1; k <= len; k++) {
+            if (k < len && path[k] != '/') continue;
+            memcpy(dir_path + root_len + 1, path, k);
+            dir_path[root_len + 1 + k] = '\0';
+            if (mkdir(dir_path, 0755) != 0 && errno != EEXIST) break;
+        }
+        memcpy(made, path, len);
+        made[len] = '\0';
+        made_len = len;
+    }
+}
+
+static int compare_locations(const void *a, const void *b) {
+    const read_location_t *x = a, *y = b;
+    if (x->major != y->major) return x->major < y->major ? -1 : 1;
+    if (x->minor != y->minor) return x->minor < y->minor ? -1 : 1;
+    return x->entry < y->entry ? -1 : x->entry > y->entry;
+}
+
+// Order the entries by where their objects lie: packed objects by pack
+// and offset, then loose ones by inode, which on most filesystems follows
+// allocation order. Reads then sweep storage instead of seeking across
+// the fanout directories. NULL (read in path order) when out of memory.
+static size_t* plan_read_order(const char *fractyl_dir, index_entry_t **entries, size_t count) {
+    read_location_t *locations = malloc(count * sizeof(read_location_t));
+    size_t *order = malloc(count * sizeof(size_t));
+    if (!locations || !order) {
+        free(locations);
+        free(order);
+        return NULL;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        read_location_t *location = &locations[i];
+        location->entry = i;
+        uint32_t pack;
+        if (pack_locate_object(fractyl_dir, entries[i]->hash, &pack, &location->minor) == FRACTYL_OK) {
+            location->major = pack;
+            continue;
+        }
+        location->major = UINT64_MAX;
+        location->minor = UINT64_MAX;
+        char *obj_path = object_path(entries[i]->hash, fractyl_dir);
+        struct stat st;
+        if (obj_path && stat(obj_path, &st) == 0) location->minor = (uint64_t)st.st_ino;
+        free(obj_path);
+    }
+    qsort(locations, count, sizeof(read_location_t), compare_locations);
+    
+    for (size_t i = 0; i < count; i++) {
+        order[i] = locations[i].entry;
+    }
+    free(locations);
+    return order;
+}
+
+static void restore_entry(restore_pool_t *pool, size_t index) {
+    index_entry_t *entry = pool->entries[index];
+    char dest_path[PATH_MAX];
+    snprintf(dest_path, sizeof(dest_path), "%s/%s", pool->root, entry->path);
+    
+    if (pool->options.replace && unlink(dest_path) != 0 && errno != ENOENT) {
+        printf("Warning: Failed to replace %s\n", dest_path);
+    }
+    
+    // A link takes the object's read-only mode and mtime as they are
+    mode_t mode = restored_mode(entry, &pool->options);
+    int linked = pool->options.hardlink && (mode & 07777) == 0444 &&
+                 object_link_file(entry->hash, pool->fractyl_dir, dest_path) == FRACTYL_OK;
+    int result = linked ? FRACTYL_OK : object_restore_file(entry->hash, pool->fractyl_dir, dest_path);
+    if (result != FRACTYL_OK) {
+        printf("Warning: Failed to restore %s: %d\n", entry->path, result);
+        entry->flags |= INDEX_ENTRY_RACY;
+        __atomic_fetch_add(&pool->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    
+    if (linked) __atomic_fetch_add(&pool->linked, 1, __ATOMIC_RELAXED);
+    if (!linked && chmod(dest_path, mode) != 0) {
+        printf("Warning: Failed to set permissions for %s\n", dest_path);
+    }
+    
+    if (pool->preserve_mtime && !linked) {
+        struct timespec times[2] = {
+            { .tv_sec = 0, .tv_nsec = UTIME_NOW },
+            { .tv_sec = entry->mtime, .tv_nsec = (long)entry->mtime_nsec }
+        };
+        if (utimensat(AT_FDCWD, dest_path, times, 0) != 0) {
+            printf("Warning: Failed to set modification time for %s\n", dest_path);
+        }
+    }
+    
+    struct stat st;
+    if (stat(dest_path, &st) == 0) {
+        index_entry_set_stat(entry, &st, pool->start);
+        __atomic_fetch_add(&pool->bytes, (unsigned long long)st.st_size, __ATOMIC_RELAXED);
+        pool->written[index] = 1;
+    } else {
+        entry->flags |= INDEX_ENTRY_RACY;
+    }
+}
+
+static size_t entry_at(const restore_pool_t *pool, size_t position) {
+    return pool->order ? pool->order[position] : position;
+}
+
+// Claim entries one at a time in read order until none are left. Each
+// claim hints the object a window ahead, so its read is under way by the
+// time a worker gets to it, and every file is written as soon as its
+// object has been read.
+static void* restore_worker(void *arg) {
+    restore_pool_t *pool = arg;
+    while (1) {
+        size_t i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (i >= pool->count) break;
+        if (i + RESTORE_PREFETCH_WINDOW < pool->count) {
+            object_prefetch(pool->entries[entry_at(pool, i + RESTORE_PREFETCH_WINDOW)]->hash, pool->fractyl_dir);
+        }
+        restore_entry(pool, entry_at(pool, i));
+        if (__atomic_add_fetch(&pool->done, 1, __ATOMIC_RELEASE) == pool->count) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_broadcast(&pool->finished);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    return NULL;
+}
+
+int restore_files_parallel(const char *root, const char *fractyl_dir, index_entry_t **entries,
+                           size_t count, const restore_options_t *options, restore_stats_t *stats) {
+    if (stats) memset(stats, 0, sizeof(*stats));
+    if (!root || !fractyl_dir || (!entries && count > 0)) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    if (count == 0) return FRACTYL_OK;
+    
+    create_directories(root, entries, count);
+    
+    concurrency_plan_t plan;
+    concurrency_plan_init(&plan, root, fractyl_dir);
+    int threads = plan.restore.max;
+    if ((size_t)threads > count) threads = (int)count;
+    
+    restore_pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.root = root;
+    pool.fractyl_dir = fractyl_dir;
+    if (options) pool.options = *options;
+    pool.entries = entries;
+    pool.count = count;
+    pool.start = time(NULL);
+    pool.preserve_mtime = config_get_long(fractyl_dir, "restore.preserve_mtime", 0) != 0;
+    pool.written = calloc(count, 1);
+    if (!pool.written) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    pool.order = plan_read_order(fractyl_dir, entries, count);
+    for (size_t i = 0; i < count && i < RESTORE_PREFETCH_WINDOW; i++) {
+        object_prefetch(entries[entry_at(&pool, i)]->hash, fractyl_dir);
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+    
+    pthread_t *tids = malloc((size_t)threads * sizeof(pthread_t));
+    int started = 0;
+    while (tids && started < threads && pthread_create(&tids[started], NULL, restore_worker, &pool) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        // No threads at all: write everything on this thread instead
+        restore_worker(&pool);
+    }
+    
+    // One running count instead of a line per file
+    int reported = 0;
+    pthread_mutex_lock(&pool.lock);
+    while (__atomic_load_n(&pool.done, __ATOMIC_ACQUIRE) < count) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += RESTORE_PROGRESS_INTERVAL;
+        if (pthread_cond_timedwait(&pool.finished, &pool.lock, &deadline) == ETIMEDOUT) {
+            printf("\rRestoring: %zu of %zu files...", __atomic_load_n(&pool.done, __ATOMIC_RELAXED), count);
+            fflush(stdout);
+            reported = 1;
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    
+    for (int i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    free(tids);
+    pthread_cond_destroy(&pool.finished);
+    pthread_mutex_destroy(&pool.lock);
+    
+    // Like git, which compares with the mtime of the index file it writes
+    // last, trust stat data from files last changed before the restore
+    // was over. Only those written in its final second are hashed again.
+    time_t finished = time(NULL);
+    for (size_t i = 0; i < count; i++) {
+        if (pool.written[i]) index_entry_update_racy(entries[i], finished);
+    }
+    free(pool.written);
+    free(pool.order);
+    
+    // Clear progress line
+    if (reported) {
+        printf("\r");
+        for (int i = 0; i < 80; i++) printf(" ");
+        printf("\r");
+    }
+    
+    counters_add(COUNTER_RESTORES, 1);
+    counters_add(COUNTER_RESTORE_FILES_WRITTEN, count - pool.failed);
+    counters_add(COUNTER_RESTORE_BYTES_WRITTEN, pool.bytes);
+    if (stats) {
+        stats->written = count - pool.failed;
+        stats->linked = pool.linked;
+        stats->failed = pool.failed;
+        stats->bytes = pool.bytes;
+        stats->threads = started > 0 ? started : 1;
+    }
+    return FRACTYL_OK;
+}
+
+int restore_remove_deleted(index_change_t change, const index_entry_t *old_entry,
+                           const index_entry_t *new_entry, void *ctx) {
+    (void)new_entry;
+    if (change != INDEX_CHANGE_DELETED) return 0;
+    const restore_removal_t *removal = ctx;
+    
+    char remove_path[PATH_MAX];
+    snprintf(remove_path, sizeof(remove_path), "%s/%s", removal->root, old_entry->path);
+    
+    printf("%s %s...\n", removal->verb, old_entry->path);
+    if (unlink(remove_path) != 0 && errno != ENOENT) {
+        printf("Warning: Failed to remove %s\n", remove_path);
+    }
+    if (!removal->prune_dirs) return 0;
+    
+    // Attempt to remove empty parent directories up to the root
+    char temp[PATH_MAX];
+    strncpy(temp, remove_path, sizeof(temp));
+    temp[sizeof(temp) - 1] = '\0';
+    char *p = strrchr(temp, '/');
+    while (p && (size_t)(p - temp) > strlen(removal->root)) {
+        *p = '\0';
+        if (rmdir(temp) != 0) {
+            break; // stop if directory not empty or error
+        }
+        p = strrchr(temp, '/');
+    }
+    return 0;
+}
+
+// Nonzero if the copy at path already holds entry's content: the current
+// index records the same hash and the mode a restore gives it, and its
+// stat data still describes the file, so it was not modified since
+static int working_copy_matches(const index_entry_t *entry, const index_entry_t *current,
+                                const char *path, mode_t mode, struct stat *st) {
+    if (!current || memcmp(entry->hash, current->hash, 32) != 0 || mode != current->mode) {
+        return 0;
+    }
+    if (stat(path, st) != 0 || !S_ISREG(st->st_mode)) return 0;
+    if (index_entry_stat_matches(current, st)) return 1;
+    if (!(current->flags & INDEX_ENTRY_RACY)) return 0;
+    
+    // Racily clean: nothing else clears the flag of a file written in the
+    // last second of a restore, so its content decides, as a scan would
+    index_entry_t settled = *current;
+    settled.flags &= ~INDEX_ENTRY_RACY;
+    if (!index_entry_stat_matches(&settled, st)) return 0;
+    unsigned char hash[32];
+    return hash_file(path, hash) == FRACTYL_OK && memcmp(hash, entry->hash, 32) == 0;
+}
+
+int restore_changed_files(index_t *index, const index_t *current_index, const char *root,
+                          const char *fractyl_dir, const restore_options_t *options, size_t *unchanged,
+                          restore_stats_t *stats) {
+    time_t restore_start = time(NULL);
+    // An unsorted current index cannot be joined; trust none of it
+    size_t current_count = index_is_sorted(current_index) ? current_index->count : 0;
+    size_t j = 0;
+    
+    // Files to write, in path order
+    index_entry_t **plan = malloc((index->count ? index->count : 1) * sizeof(index_entry_t*));
+    if (!plan) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    size_t planned = 0;
+    *unchanged = 0;
+    
+    for (size_t i = 0; i < index->count; i++) {
+        index_entry_t *entry = &index->entries[i];
+        if (!entry->path) continue;
+    
+        const index_entry_t *current = NULL;
+        while (j < current_count && strcmp(current_index->entries[j].path, entry->path) < 0) j++;
+        if (j < current_count && strcmp(current_index->entries[j].path, entry->path) == 0) {
+            current = &current_index->entries[j];
+        }
+    
+        char dest_path[PATH_MAX];
+        snprintf(dest_path, sizeof(dest_path), "%s/%s", root, entry->path);
+    
+        struct stat st;
+        if (working_copy_matches(entry, current, dest_path, restored_mode(entry, options), &st)) {
+            index_entry_set_stat(entry, &st, restore_start);
+            (*unchanged)++;
+        } else {
+            plan[planned++] = entry;
+        }
+    }
+    
+    counters_add(COUNTER_RESTORE_FILES_SKIPPED, *unchanged);
+    int result = restore_files_parallel(root, fractyl_dir, plan, planned, options, stats);
+    free(plan);
+    return result;
+}
@@ -0,0 +1,65 @@
+#ifndef PARALLEL_RESTORE_H
+#define PARALLEL_RESTORE_H
+
+#include "../include/core.h"
+#include "../core/index.h"
+
+// Parallel restore: writes a list of index entries from object storage
+// into a working tree. The parent directories of all files are created
+// first in one pass that makes each directory once; then a fixed pool of
+// threads (concurrency.h, restore.threads) writes the files, and progress
+// is reported as a running count rather than a line per file. Objects are
+// read in the order they are stored (pack offset, then loose inode) with
+// readahead hints a window ahead, not in path order.
+//
+// Each entry written takes the stat data of the new file, so the index
+// it belongs to can be saved as the current one; only files changed in
+// the restore's last second stay INDEX_ENTRY_RACY. Entries that could not
+// be written are flagged as well and never trusted as up to date. With
+// restore.preserve_mtime set, files get back the mtime their entry records.
+
+typedef struct {
+    // Hard-link files to their objects where the object is a raw loose
+    // file and the filesystem allows it, else copy them. Linked or not,
+    // every file is made read-only, since a link shares the object's inode.
+    int hardlink;
+    // Unlink each file before writing it, so nothing is ever written
+    // through a hard link into the object store
+    int replace;
+} restore_options_t;
+
+typedef struct {
+    size_t written;
+    size_t linked;              // Of those, hard-linked to their objects
+    size_t failed;
+    unsigned long long bytes;
+    int threads;
+} restore_stats_t;
+
+// Restore entries[0, count), which must be in path order, below root.
+// options and stats may be NULL. Returns FRACTYL_OK even when single
+// files fail; those are counted in stats->failed and reported as warnings.
+int restore_files_parallel(const char *root, const char *fractyl_dir, index_entry_t **entries,
+                           size_t count, const restore_options_t *options, restore_stats_t *stats);
+
+// Merge-join index with current_index, what root held when last indexed,
+// and restore only the files that are missing, differ or were modified
+// since. Every entry of index takes the stat data of its file on disk, so
+// index can be saved as root's current index; unchanged counts the files
+// that were already up to date.
+int restore_changed_files(index_t *index, const index_t *current_index, const char *root,
+                          const char *fractyl_dir, const restore_options_t *options, size_t *unchanged,
+                          restore_stats_t *stats);
+
+// index_diff() callback (ctx: restore_removal_t) deleting the files that
+// only the old index has
+typedef struct {
+    const char *root;
+    const char *verb;           // Printed before each path
+    int prune_dirs;             // Also remove parent directories left empty
+} restore_removal_t;
+
+int restore_remove_deleted(index_change_t change, const index_entry_t *old_entry,
+                           const index_entry_t *new_entry, void *ctx);
+
+#endif // PARALLEL_RESTORE_H
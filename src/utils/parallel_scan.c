@@ -6,8 +6,8 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <limits.h>
 #include <time.h>
-#include <inttypes.h>
 
 // Ensure DT_* constants are available
 #ifndef DT_UNKNOWN
@@ -23,19 +23,46 @@
 #include "../include/fractyl.h"
 #include "../core/index.h"
 #include "../core/objects.h"
+#include "../core/hash.h"
 #include "gitignore.h"
 #include "git.h"
 #include "paths.h"
-#include "file_cache.h"
 #include "batch_index.h"
 #include "binary_index.h"
+#include "arena.h"
+#include "fast_dir.h"
+#include "bounded_queue.h"
+#include "concurrency.h"
+#include "config.h"
+#include "parallel_scan.h"
+#include "scan_journal.h"
+#include "profile.h"
+#include "counters.h"
+#include "fs.h"
 
-#define MAX_THREADS 8
-#define MAX_STAT_THREADS 4
+#define MAX_THREADS 64
+// Changed files waiting for a hash thread / an object write. Enumeration
+// blocks once hashing falls this far behind, and hashing once writes do.
+#define HASH_QUEUE_CAPACITY 1024
+#define STORE_QUEUE_CAPACITY 256
+// Changed files at least this large are hashed and stored in one read by
+// the hash stage. Smaller ones are hashed first so that content already in
+// the store is never copied; their second read comes from the page cache.
+#define SINGLE_PASS_MIN_SIZE (1024 * 1024)
+// How often the controller re-evaluates the pool sizes
+#define ADAPT_INTERVAL_MS 500
+// Files handed to a stat thread at a time
+#define STAT_CHUNK 64
+// Changed files are prefetched this many ahead of the one being hashed
+// (scan.prefetch, 0 for none), and of each only its first bytes: the
+// kernel's own readahead follows a sequential read of the rest
+#define SCAN_PREFETCH_WINDOW 32
+#define SCAN_PREFETCH_BYTES (4 * 1024 * 1024)
 
 typedef struct work_item {
     char *dir_path;
     char *rel_path;
+    const ignore_dir_t *ignore_dir;  // Ignore rules inherited from the parent directory
     struct work_item *next;
 } work_item_t;
 
@@ -49,17 +76,52 @@ typedef struct stat_work_item {
     struct stat file_stat;
 } stat_work_item_t;
 
+// Per-worker deque of directories. The owner pushes and pops at the tail
+// (depth-first, cache friendly); thieves take from the head, which holds
+// the oldest and usually largest subtrees. The lock is almost never
+// contended because only thieves share it with the owner.
 typedef struct {
-    pthread_mutex_t mutex;
-    pthread_cond_t work_available;
-    pthread_cond_t work_complete;
+    pthread_mutex_t lock;
+    work_item_t **items;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} work_deque_t;
+
+// Counters owned by a single worker, summed once the scan is over
+typedef struct {
+    int files_processed;
+    int dirs_processed;
+    int files_changed;
+    unsigned long long files_scanned;   // Stat results examined by the walk
+    unsigned long long bytes_hashed;
+    unsigned long long bytes_stored;
+} scan_stats_t;
+
+struct thread_pool;
+
+typedef struct {
+    struct thread_pool *pool;
+    int id;
+    unsigned int steal_seed;
+    work_deque_t deque;
+    index_t *shard;         // Entries found by this worker, merged after the scan
+    scan_stats_t stats;
+    fast_stat_ctx_t stat_ctx; // Batched statx state, owned by the worker thread
+} scan_worker_t;
+
+typedef struct thread_pool {
+    scan_worker_t *workers;
+    int total_threads;
     
-    work_item_t *queue_head;
-    work_item_t *queue_tail;
-    int queue_count;
+    // Directories queued or being read; the scan is done when this hits 0
+    long pending;
     
-    int active_threads;
-    int total_threads;
+    // Idle workers sleep here until new work is pushed or the scan ends
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle_cond;
+    int idle_threads;
+    unsigned long work_generation;
     int shutdown;
     
     // Shared data
@@ -67,364 +129,1084 @@ typedef struct {
     const index_t *prev_index;
     const char *fractyl_dir;
     const char *repo_root;
-    pthread_mutex_t index_mutex;
-    
-    // Statistics
-    int files_processed;
-    int dirs_processed;
-    int files_changed;
-    time_t last_progress;
-    pthread_mutex_t stats_mutex;
+    ignore_engine_t *ignore;
+    index_t *shards;        // One per scan worker, then one per stage thread
+    
+    // Pipeline behind the directory walk: changed files are hashed by
+    // hash_threads threads, and objects not stored yet are written by
+    // store_threads threads. Each stage thread appends to its own shard.
+    bounded_queue_t hash_queue;
+    bounded_queue_t store_queue;
+    scan_worker_t *stage_workers;
+    int hash_threads;
+    int store_threads;
+    size_t prefetch;        // Queued files hinted ahead of each one hashed
+    
+    // Thread i of a pool only runs while i is below its gate's active
+    // count; the progress thread moves the gates based on throughput
+    concurrency_plan_t plan;
+    adaptive_gate_t scan_gate;
+    adaptive_gate_t hash_gate;
+    adaptive_gate_t store_gate;
+    
+    // Number of change lines printed so far (the first 20 are shown)
+    int changes_reported;
+    
+    // Files modified in or after this second are recorded as racily clean
+    time_t scan_start;
+    
+    // Changed files are hashed but not stored, and nothing is printed
+    int hash_only;
 } thread_pool_t;
 
-static void enqueue_work(thread_pool_t *pool, const char *dir_path, const char *rel_path) {
+// head and tail change under the lock, but thieves peek at them without
+// it (deque_steal), so they are only ever stored atomically
+static void deque_set(work_deque_t *dq, size_t head, size_t tail) {
+    __atomic_store_n(&dq->head, head, __ATOMIC_RELAXED);
+    __atomic_store_n(&dq->tail, tail, __ATOMIC_RELAXED);
+}
+
+static int deque_push(work_deque_t *dq, work_item_t *item) {
+    pthread_mutex_lock(&dq->lock);
+    
+    if (dq->tail == dq->capacity) {
+        if (dq->head > 0) {
+            // Reclaim the slots thieves have already drained
+            memmove(dq->items, dq->items + dq->head, (dq->tail - dq->head) * sizeof(work_item_t*));
+            deque_set(dq, 0, dq->tail - dq->head);
+        } else {
+            size_t new_capacity = dq->capacity ? dq->capacity * 2 : 64;
+            work_item_t **new_items = realloc(dq->items, new_capacity * sizeof(work_item_t*));
+            if (!new_items) {
+                pthread_mutex_unlock(&dq->lock);
+                return FRACTYL_ERROR_OUT_OF_MEMORY;
+            }
+            dq->items = new_items;
+            dq->capacity = new_capacity;
+        }
+    }
+    
+    dq->items[dq->tail] = item;
+    deque_set(dq, dq->head, dq->tail + 1);
+    pthread_mutex_unlock(&dq->lock);
+    return FRACTYL_OK;
+}
+
+// Owner side: newest item first
+static work_item_t* deque_pop(work_deque_t *dq) {
+    work_item_t *item = NULL;
+    
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        size_t tail = dq->tail - 1;
+        item = dq->items[tail];
+        // Drained, it starts over at slot 0
+        if (tail == dq->head) {
+            deque_set(dq, 0, 0);
+        } else {
+            deque_set(dq, dq->head, tail);
+        }
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return item;
+}
+
+// Thief side: oldest item first
+static work_item_t* deque_steal(work_deque_t *dq) {
+    work_item_t *item = NULL;
+    
+    // Skip empty victims without touching their lock
+    if (__atomic_load_n(&dq->tail, __ATOMIC_RELAXED) == __atomic_load_n(&dq->head, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail > dq->head) {
+        size_t head = dq->head + 1;
+        item = dq->items[dq->head];
+        if (head == dq->tail) {
+            deque_set(dq, 0, 0);
+        } else {
+            deque_set(dq, head, dq->tail);
+        }
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return item;
+}
+
+static void free_work_item(work_item_t *item) {
+    free(item->dir_path);
+    free(item->rel_path);
+    free(item);
+}
+
+static void wake_idle_workers(thread_pool_t *pool, int all) {
+    if (__atomic_load_n(&pool->idle_threads, __ATOMIC_SEQ_CST) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool->idle_mutex);
+    if (all) {
+        pthread_cond_broadcast(&pool->idle_cond);
+    } else {
+        pthread_cond_signal(&pool->idle_cond);
+    }
+    pthread_mutex_unlock(&pool->idle_mutex);
+}
+
+static void enqueue_work(scan_worker_t *worker, const char *dir_path, const char *rel_path,
+                         const ignore_dir_t *ignore_dir) {
+    thread_pool_t *pool = worker->pool;
     work_item_t *item = malloc(sizeof(work_item_t));
     if (!item) return;
     
     item->dir_path = strdup(dir_path);
     item->rel_path = strdup(rel_path);
+    item->ignore_dir = ignore_dir;
     item->next = NULL;
+    if (!item->dir_path || !item->rel_path) {
+        free_work_item(item);
+        return;
+    }
     
-    pthread_mutex_lock(&pool->mutex);
-    
-    if (pool->queue_tail) {
-        pool->queue_tail->next = item;
-    } else {
-        pool->queue_head = item;
+    // Count the item before it becomes visible so pending never reaches 0
+    // while work is still queued
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    if (deque_push(&worker->deque, item) != FRACTYL_OK) {
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+        free_work_item(item);
+        return;
     }
-    pool->queue_tail = item;
-    pool->queue_count++;
     
-    pthread_cond_signal(&pool->work_available);
-    pthread_mutex_unlock(&pool->mutex);
+    __atomic_add_fetch(&pool->work_generation, 1, __ATOMIC_SEQ_CST);
+    wake_idle_workers(pool, 0);
 }
 
-static work_item_t* dequeue_work(thread_pool_t *pool) {
-    pthread_mutex_lock(&pool->mutex);
+static work_item_t* steal_work(thread_pool_t *pool, scan_worker_t *self) {
+    int n = pool->total_threads;
+    int start = (int)(rand_r(&self->steal_seed) % (unsigned int)n);
     
-    while (!pool->queue_head && !pool->shutdown) {
-        pthread_cond_wait(&pool->work_available, &pool->mutex);
-    }
+    for (int i = 0; i < n; i++) {
+        int victim = (start + i) % n;
+        if (victim == self->id) continue;
     
-    if (pool->shutdown && !pool->queue_head) {
-        pthread_mutex_unlock(&pool->mutex);
-        return NULL;
+        work_item_t *item = deque_steal(&pool->workers[victim].deque);
+        if (item) return item;
     }
+    return NULL;
+}
+
+// Get the next directory for this worker, sleeping while others still
+// have work in flight. Returns NULL once the whole scan has finished.
+static work_item_t* dequeue_work(scan_worker_t *worker) {
+    thread_pool_t *pool = worker->pool;
     
-    work_item_t *item = pool->queue_head;
-    if (item) {
-        pool->queue_head = item->next;
-        if (!pool->queue_head) {
-            pool->queue_tail = NULL;
+    while (1) {
+        if (adaptive_gate_parked(&pool->scan_gate, worker->id)) {
+            // Leave anything still in our deque to the running workers
+            wake_idle_workers(pool, 1);
+            adaptive_gate_wait(&pool->scan_gate, worker->id);
+            continue;
         }
-        pool->queue_count--;
-        pool->active_threads++;
-    }
     
-    pthread_mutex_unlock(&pool->mutex);
-    return item;
-}
-
-static void process_file(thread_pool_t *pool, const char *full_path, const char *rel_path, 
-                        const struct stat *st) {
-    // Skip large files
-    if (st->st_size > 1024 * 1024 * 1024) {
-        pthread_mutex_lock(&pool->stats_mutex);
-        printf("Skipping large file: %s (%" PRIdMAX " bytes)\n", rel_path, (intmax_t)st->st_size);
-        pthread_mutex_unlock(&pool->stats_mutex);
-        return;
-    }
+        work_item_t *item = deque_pop(&worker->deque);
+        if (item) return item;
     
-    index_entry_t entry_data;
-    memset(&entry_data, 0, sizeof(entry_data));
+        unsigned long generation = __atomic_load_n(&pool->work_generation, __ATOMIC_SEQ_CST);
+        item = steal_work(pool, worker);
+        if (item) return item;
     
-    entry_data.path = strdup(rel_path);
-    if (!entry_data.path) return;
+        if (__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) == 0) {
+            return NULL;
+        }
     
-    entry_data.mode = st->st_mode;
-    entry_data.size = st->st_size;
-    entry_data.mtime = st->st_mtime;
+        pthread_mutex_lock(&pool->idle_mutex);
+        __atomic_add_fetch(&pool->idle_threads, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pool->work_generation, __ATOMIC_SEQ_CST) == generation &&
+               __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) > 0) {
+            // The timeout is only a safety net against a missed wakeup
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 50 * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&pool->idle_cond, &pool->idle_mutex, &ts) == ETIMEDOUT) {
+                break;
+            }
+        }
+        __atomic_sub_fetch(&pool->idle_threads, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool->idle_mutex);
+    }
+}
+
+// Called once a dequeued directory has been fully read
+static void finish_work(thread_pool_t *pool) {
+    if (__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        // Parked workers have to see the end of the scan too
+        adaptive_gate_close(&pool->scan_gate);
+        wake_idle_workers(pool, 1);
+    }
+}
+
+// A changed file travelling through the hash and store stages
+typedef struct {
+    char *full_path;
+    index_entry_t entry;                // path stored behind the job; hash set by the hash stage
+    const index_entry_t *prev_entry;    // NULL for files new since prev_index
+    int prefetched;                     // Set under the hash queue's lock
+} file_job_t;
+
+static void free_file_job(file_job_t *job) {
+    free(job);
+}
+
+// Append a finished entry to this thread's shard and account for it
+static void emit_entry(scan_worker_t *worker, const index_entry_t *entry,
+                       const index_entry_t *prev_entry) {
+    thread_pool_t *pool = worker->pool;
+    int file_changed = !prev_entry || memcmp(entry->hash, prev_entry->hash, 32) != 0;
+    
+    // Each path is visited exactly once, so append to this thread's shard
+    // without a duplicate search or a lock
+    index_add_entry_direct(worker->shard, entry);
+    
+    // Update statistics (owned by this thread, read racily by the progress thread)
+    __atomic_add_fetch(&worker->stats.files_processed, 1, __ATOMIC_RELAXED);
+    if (file_changed) {
+        __atomic_add_fetch(&worker->stats.files_changed, 1, __ATOMIC_RELAXED);
+        // Print first 20 changes
+        if (!pool->hash_only && __atomic_add_fetch(&pool->changes_reported, 1, __ATOMIC_RELAXED) <= 20) {
+            printf("  %s %s\n", prev_entry ? "M" : "A", entry->path);
+        }
+    }
+}
+
+// Journal of the snapshot being taken, if any (scan_set_journal())
+static scan_journal_t *active_journal;
+
+void scan_set_journal(scan_journal_t *journal) {
+    __atomic_store_n(&active_journal, journal, __ATOMIC_RELEASE);
+}
+
+// emit_entry() for a file whose content is now in the object store
+static void emit_stored(scan_worker_t *worker, const index_entry_t *entry,
+                        const index_entry_t *prev_entry) {
+    scan_journal_record(__atomic_load_n(&active_journal, __ATOMIC_ACQUIRE), entry);
+    emit_entry(worker, entry, prev_entry);
+}
+
+// Count a file checked against its previous entry
+static void count_stat_check(const index_entry_t *prev_entry, int matched) {
+    counters_add(COUNTER_FILES_SCANNED, 1);
+    counters_add(matched ? COUNTER_STAT_HITS : prev_entry ? COUNTER_REHASHED : COUNTER_NEW_FILES, 1);
+}
+
+static void process_file(scan_worker_t *worker, const char *full_path, const char *rel_path, 
+                        const struct stat *st) {
+    thread_pool_t *pool = worker->pool;
+    __atomic_add_fetch(&worker->stats.files_scanned, 1, __ATOMIC_RELAXED);
     
     // Check previous index
     const index_entry_t *prev_entry = pool->prev_index ? 
         index_find_entry(pool->prev_index, rel_path) : NULL;
     
-    int file_changed = 1;
-    
-    if (prev_entry && prev_entry->size == st->st_size && 
-        prev_entry->mtime == st->st_mtime) {
-        // Unchanged - copy hash
+    int matched = index_entry_stat_matches(prev_entry, st);
+    count_stat_check(prev_entry, matched);
+    if (matched) {
+        // Unchanged - copy hash; the path is only borrowed for the append
+        index_entry_t entry_data;
+        memset(&entry_data, 0, sizeof(entry_data));
+        entry_data.path = (char *)rel_path;
+        index_entry_set_stat(&entry_data, st, pool->scan_start);
         memcpy(entry_data.hash, prev_entry->hash, 32);
-        file_changed = 0;
-    } else {
-        // Changed - compute hash
-        if (object_store_file(full_path, pool->fractyl_dir, entry_data.hash) != FRACTYL_OK) {
-            pthread_mutex_lock(&pool->stats_mutex);
+        emit_entry(worker, &entry_data, prev_entry);
+        return;
+    }
+    
+    // Changed - hand it to the hash stage so the walk can keep going
+    // One allocation holds the job and both of its paths
+    size_t full_len = strlen(full_path) + 1, rel_len = strlen(rel_path) + 1;
+    file_job_t *job = calloc(1, sizeof(file_job_t) + full_len + rel_len);
+    if (!job) return;
+    job->full_path = (char *)(job + 1);
+    job->entry.path = job->full_path + full_len;
+    memcpy(job->full_path, full_path, full_len);
+    memcpy(job->entry.path, rel_path, rel_len);
+    index_entry_set_stat(&job->entry, st, pool->scan_start);
+    job->prev_entry = prev_entry;
+    
+    if (bounded_queue_push(&pool->hash_queue, job) != FRACTYL_OK) {
+        // No pipeline running; do the work inline
+        if (pool->hash_only) {
+            if (hash_file(full_path, job->entry.hash) == FRACTYL_OK) emit_entry(worker, &job->entry, prev_entry);
+        } else if (object_store_file(full_path, pool->fractyl_dir, job->entry.hash) == FRACTYL_OK) {
+            emit_stored(worker, &job->entry, prev_entry);
+        } else {
             printf("Warning: Failed to store file %s\n", rel_path);
-            pthread_mutex_unlock(&pool->stats_mutex);
-            free(entry_data.path);
-            return;
-        }
-        
-        if (prev_entry && memcmp(entry_data.hash, prev_entry->hash, 32) == 0) {
-            file_changed = 0;
         }
+        free_file_job(job);
     }
+}
+
+// A queued file to prefetch, copied out of its job under the queue's lock
+typedef struct {
+    char path[PATH_MAX];
+    off_t size;
+    int due;
+} prefetch_hint_t;
+
+static void note_prefetch(void *item, void *ctx) {
+    file_job_t *job = item;
+    prefetch_hint_t *hint = ctx;
+    size_t len = strlen(job->full_path);
+    if (job->prefetched || !S_ISREG(job->entry.mode) || len >= sizeof(hint->path)) return;
+    memcpy(hint->path, job->full_path, len + 1);
+    hint->size = job->entry.size;
+    hint->due = 1;
+    job->prefetched = 1;
+}
+
+// Hash stage: content hashes for changed files. Content that is already in
+// the object store is done here; the rest moves on to the store stage.
+static void* hash_stage_thread(void *arg) {
+    scan_worker_t *worker = (scan_worker_t*)arg;
+    thread_pool_t *pool = worker->pool;
     
-    // Add to index (thread-safe)
-    pthread_mutex_lock(&pool->index_mutex);
-    index_add_entry(pool->new_index, &entry_data);
-    pthread_mutex_unlock(&pool->index_mutex);
+    int index = worker->id - pool->total_threads;
+    
+    while (1) {
+        adaptive_gate_wait(&pool->hash_gate, index);
+        // Each file taken starts the read of one further down the queue
+        prefetch_hint_t hint;
+        hint.due = 0;
+        file_job_t *job = bounded_queue_pop_peek(&pool->hash_queue, pool->prefetch, note_prefetch, &hint);
+        if (!job) break;
+        if (hint.due) file_prefetch(hint.path, hint.size, SCAN_PREFETCH_BYTES);
+    
+        // Files that vanished since they were listed are left out
+        if (pool->hash_only) {
+            if (hash_file(job->full_path, job->entry.hash) == FRACTYL_OK) {
+                __atomic_add_fetch(&worker->stats.bytes_hashed, (unsigned long long)job->entry.size,
+                                   __ATOMIC_RELAXED);
+                emit_entry(worker, &job->entry, job->prev_entry);
+            }
+            free_file_job(job);
+            continue;
+        }
     
-    free(entry_data.path);
+        if (job->entry.size >= SINGLE_PASS_MIN_SIZE) {
+            if (object_store_file(job->full_path, pool->fractyl_dir, job->entry.hash) == FRACTYL_OK) {
+                __atomic_add_fetch(&worker->stats.bytes_hashed, (unsigned long long)job->entry.size,
+                                   __ATOMIC_RELAXED);
+                emit_stored(worker, &job->entry, job->prev_entry);
+            } else {
+                printf("Warning: Failed to store file %s\n", job->entry.path);
+            }
+            free_file_job(job);
+            continue;
+        }
     
-    // Update statistics
-    pthread_mutex_lock(&pool->stats_mutex);
-    pool->files_processed++;
-    if (file_changed) {
-        pool->files_changed++;
-        // Print first 20 changes
-        if (pool->files_changed <= 20) {
-            printf("  %s %s\n", prev_entry ? "M" : "A", rel_path);
+        struct timespec hash_start, hash_end;
+        clock_gettime(CLOCK_MONOTONIC, &hash_start);
+        int hashed = hash_file(job->full_path, job->entry.hash);
+        clock_gettime(CLOCK_MONOTONIC, &hash_end);
+        object_stats_add_hash_time((unsigned long long)((hash_end.tv_sec - hash_start.tv_sec) * 1000000000LL +
+                                                        (hash_end.tv_nsec - hash_start.tv_nsec)));
+        if (hashed != FRACTYL_OK) {
+            printf("Warning: Failed to store file %s\n", job->entry.path);
+            free_file_job(job);
+            continue;
+        }
+        __atomic_add_fetch(&worker->stats.bytes_hashed, (unsigned long long)job->entry.size,
+                           __ATOMIC_RELAXED);
+    
+        if (object_exists(job->entry.hash, pool->fractyl_dir)) {
+            object_stats_add_deduplicated((unsigned long long)job->entry.size);
+            emit_stored(worker, &job->entry, job->prev_entry);
+            free_file_job(job);
+        } else if (bounded_queue_push(&pool->store_queue, job) != FRACTYL_OK) {
+            // No store threads; write it from here
+            if (object_write_file(job->full_path, pool->fractyl_dir, job->entry.hash) == FRACTYL_OK) {
+                emit_stored(worker, &job->entry, job->prev_entry);
+            } else {
+                printf("Warning: Failed to store file %s\n", job->entry.path);
+            }
+            free_file_job(job);
+        }
+    }
+    return NULL;
+}
+
+// Store stage: copy new content into the object store
+static void* store_stage_thread(void *arg) {
+    scan_worker_t *worker = (scan_worker_t*)arg;
+    thread_pool_t *pool = worker->pool;
+    
+    int index = worker->id - pool->total_threads - pool->hash_threads;
+    
+    while (1) {
+        adaptive_gate_wait(&pool->store_gate, index);
+        file_job_t *job = bounded_queue_pop(&pool->store_queue);
+        if (!job) break;
+    
+        if (object_write_file(job->full_path, pool->fractyl_dir, job->entry.hash) == FRACTYL_OK) {
+            __atomic_add_fetch(&worker->stats.bytes_stored, (unsigned long long)job->entry.size,
+                               __ATOMIC_RELAXED);
+            emit_stored(worker, &job->entry, job->prev_entry);
+        } else {
+            printf("Warning: Failed to store file %s\n", job->entry.path);
         }
+        free_file_job(job);
     }
-    pthread_mutex_unlock(&pool->stats_mutex);
+    return NULL;
+}
+
+static double elapsed_seconds(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) + (double)(to->tv_nsec - from->tv_nsec) / 1e9;
 }
 
-// Git-style parallel stat worker (based on preload-index.c)
+// Git-style parallel stat (based on preload-index.c). Threads claim
+// STAT_CHUNK files at a time so the controller can park or wake threads
+// without leaving a slice of the list unclaimed.
 typedef struct {
     char **file_paths;
-    const char **rel_paths;
     struct stat *stat_results;
     int *stat_success;
-    size_t start_idx;
-    size_t end_idx;
+    size_t file_count;
+    size_t next;              // First file not claimed yet
+    unsigned long long done;  // Files stat'ed so far
+    adaptive_gate_t gate;
+} preload_shared_t;
+
+typedef struct {
+    preload_shared_t *shared;
     int thread_id;
 } preload_data_t;
 
 static void* preload_stat_worker(void *arg) {
     preload_data_t *data = (preload_data_t*)arg;
+    preload_shared_t *shared = data->shared;
     
-    // Simple parallel stat loop like Git's preload_thread()
-    for (size_t i = data->start_idx; i < data->end_idx; i++) {
-        data->stat_success[i] = (lstat(data->file_paths[i], &data->stat_results[i]) == 0);
+    while (1) {
+        adaptive_gate_wait(&shared->gate, data->thread_id);
+        size_t start = __atomic_fetch_add(&shared->next, STAT_CHUNK, __ATOMIC_RELAXED);
+        if (start >= shared->file_count) break;
+        size_t end = start + STAT_CHUNK < shared->file_count ? start + STAT_CHUNK : shared->file_count;
+    
+        // Simple parallel stat loop like Git's preload_thread()
+        unsigned long long stat_started = profile_begin();
+        for (size_t i = start; i < end; i++) {
+            shared->stat_success[i] = (lstat(shared->file_paths[i], &shared->stat_results[i]) == 0);
+        }
+        profile_end(PROFILE_STAT, stat_started);
+        counters_add(COUNTER_STAT_CALLS, end - start);
+        __atomic_add_fetch(&shared->done, (unsigned long long)(end - start), __ATOMIC_RELAXED);
     }
     return NULL;
 }
 
-static void* worker_thread(void *arg) {
-    thread_pool_t *pool = (thread_pool_t*)arg;
-    
-    while (1) {
-        work_item_t *item = dequeue_work(pool);
-        if (!item) break;  // Shutdown
-        
-        DIR *d = opendir(item->dir_path);
-        if (!d) {
-            pthread_mutex_lock(&pool->mutex);
-            pool->active_threads--;
-            if (pool->queue_count == 0 && pool->active_threads == 0) {
-                pthread_cond_signal(&pool->work_complete);
+// Stat file_paths[0..file_count) into stat_results/stat_success with a
+// pool sized for the storage under root_path
+static void preload_stat_files(const char *root_path, const char *fractyl_dir,
+                               char **file_paths, size_t file_count,
+                               struct stat *stat_results, int *stat_success) {
+    concurrency_plan_t plan;
+    concurrency_plan_init(&plan, root_path, fractyl_dir);
+    
+    preload_shared_t shared;
+    memset(&shared, 0, sizeof(shared));
+    shared.file_paths = file_paths;
+    shared.stat_results = stat_results;
+    shared.stat_success = stat_success;
+    shared.file_count = file_count;
+    adaptive_gate_init(&shared.gate, &plan.stat);
+    
+    int thread_count = plan.stat.max;
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    preload_data_t *thread_data = calloc(thread_count, sizeof(preload_data_t));
+    int started = 0;
+    if (threads && thread_data) {
+        for (int i = 0; i < thread_count; i++) {
+            thread_data[i].shared = &shared;
+            thread_data[i].thread_id = i;
+            if (pthread_create(&threads[i], NULL, preload_stat_worker, &thread_data[i]) != 0) {
+                break;
             }
-            pthread_mutex_unlock(&pool->mutex);
-            
-            free(item->dir_path);
-            free(item->rel_path);
-            free(item);
+            started++;
+        }
+    }
+    if (started < thread_count) {
+        adaptive_gate_close(&shared.gate);
+    }
+    
+    if (started == 0) {
+        preload_data_t self = { &shared, 0 };
+        preload_stat_worker(&self);
+    } else {
+        // Tune the pool while the threads work through the list
+        struct timespec last, now;
+        clock_gettime(CLOCK_MONOTONIC, &last);
+        while (__atomic_load_n(&shared.done, __ATOMIC_RELAXED) < file_count) {
+            usleep(ADAPT_INTERVAL_MS * 1000 / 5);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double elapsed = elapsed_seconds(&last, &now);
+            if (!plan.adaptive || elapsed * 1000 < ADAPT_INTERVAL_MS) continue;
+    
+            size_t claimed = __atomic_load_n(&shared.next, __ATOMIC_RELAXED);
+            int backlogged = claimed < file_count &&
+                             file_count - claimed > (size_t)adaptive_gate_active(&shared.gate) * STAT_CHUNK;
+            adaptive_gate_sample(&shared.gate, __atomic_load_n(&shared.done, __ATOMIC_RELAXED),
+                                 elapsed, backlogged);
+            last = now;
+        }
+    }
+    
+    // Everything is claimed; let parked threads see that and exit
+    adaptive_gate_close(&shared.gate);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    free(thread_data);
+    adaptive_gate_destroy(&shared.gate);
+}
+
+// Portable directory scan: readdir() plus one stat() per entry that needs it
+static void scan_dir_readdir(scan_worker_t *worker, const work_item_t *item) {
+    thread_pool_t *pool = worker->pool;
+    
+    DIR *d = opendir(item->dir_path);
+    if (!d) {
+        return;
+    }
+    
+    // Pick up this directory's own .gitignore/.fractylignore, if any
+    const ignore_dir_t *dir_rules = ignore_engine_enter_dir(pool->ignore, item->ignore_dir,
+                                                            item->rel_path);
+    
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || 
+            strcmp(entry->d_name, "..") == 0 ||
+            strcmp(entry->d_name, ".fractyl") == 0) {
             continue;
         }
-        
-        struct dirent *entry;
-        while ((entry = readdir(d)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0 || 
-                strcmp(entry->d_name, "..") == 0 ||
-                strcmp(entry->d_name, ".fractyl") == 0) {
+    
+        char full_path[2048];
+        char new_rel_path[2048];
+    
+        snprintf(full_path, sizeof(full_path), "%s/%s", 
+                item->dir_path, entry->d_name);
+    
+        if (strlen(item->rel_path) == 0) {
+            strcpy(new_rel_path, entry->d_name);
+        } else {
+            snprintf(new_rel_path, sizeof(new_rel_path), "%s/%s", 
+                    item->rel_path, entry->d_name);
+        }
+    
+        // Git-style d_type optimization: avoid stat() when possible
+        if (entry->d_type == DT_DIR) {
+            if (ignore_engine_should_ignore(pool->ignore, dir_rules, new_rel_path, 1)) {
                 continue;
             }
-            
-            char full_path[2048];
-            char new_rel_path[2048];
-            
-            snprintf(full_path, sizeof(full_path), "%s/%s", 
-                    item->dir_path, entry->d_name);
-            
-            if (strlen(item->rel_path) == 0) {
-                strcpy(new_rel_path, entry->d_name);
-            } else {
-                snprintf(new_rel_path, sizeof(new_rel_path), "%s/%s", 
-                        item->rel_path, entry->d_name);
+            // Directory - check for git submodule boundary
+            if (git_is_repository_root(full_path)) {
+                // Skip git submodules/repositories to avoid crossing boundaries
+                continue;
+            }
+            enqueue_work(worker, full_path, new_rel_path, dir_rules);
+        } else if (entry->d_type == DT_REG) {
+            if (ignore_engine_should_ignore(pool->ignore, dir_rules, new_rel_path, 0)) {
+                continue;
+            }
+            // Regular file - only stat() for metadata
+            struct stat st;
+            unsigned long long stat_started = profile_begin();
+            int stat_failed = stat(full_path, &st) != 0;
+            profile_end(PROFILE_STAT, stat_started);
+            counters_add(COUNTER_STAT_CALLS, 1);
+            if (stat_failed) {
+                continue;
             }
-            
-            // Check gitignore
-            if (should_ignore_path(pool->repo_root, full_path, new_rel_path)) {
+            process_file(worker, full_path, new_rel_path, &st);
+        } else if (entry->d_type == DT_UNKNOWN) {
+            // Fallback to stat() when d_type is unknown
+            struct stat st;
+            unsigned long long stat_started = profile_begin();
+            int stat_failed = stat(full_path, &st) != 0;
+            profile_end(PROFILE_STAT, stat_started);
+            counters_add(COUNTER_STAT_CALLS, 1);
+            if (stat_failed) {
+                continue;
+            }
+    
+            if (ignore_engine_should_ignore(pool->ignore, dir_rules, new_rel_path,
+                                            S_ISDIR(st.st_mode))) {
                 continue;
             }
-            
-            // Git-style d_type optimization: avoid stat() when possible
-            if (entry->d_type == DT_DIR) {
+    
+            if (S_ISDIR(st.st_mode)) {
                 // Directory - check for git submodule boundary
                 if (git_is_repository_root(full_path)) {
                     // Skip git submodules/repositories to avoid crossing boundaries
                     continue;
                 }
-                enqueue_work(pool, full_path, new_rel_path);
-            } else if (entry->d_type == DT_REG) {
-                // Regular file - only stat() for metadata
-                struct stat st;
-                if (stat(full_path, &st) != 0) {
-                    continue;
-                }
-                process_file(pool, full_path, new_rel_path, &st);
-            } else if (entry->d_type == DT_UNKNOWN) {
-                // Fallback to stat() when d_type is unknown
-                struct stat st;
-                if (stat(full_path, &st) != 0) {
-                    continue;
-                }
-                
-                if (S_ISDIR(st.st_mode)) {
-                    // Directory - check for git submodule boundary
-                    if (git_is_repository_root(full_path)) {
-                        // Skip git submodules/repositories to avoid crossing boundaries
-                        continue;
-                    }
-                    enqueue_work(pool, full_path, new_rel_path);
-                } else if (S_ISREG(st.st_mode)) {
-                    process_file(pool, full_path, new_rel_path, &st);
-                }
+                enqueue_work(worker, full_path, new_rel_path, dir_rules);
+            } else if (S_ISREG(st.st_mode)) {
+                process_file(worker, full_path, new_rel_path, &st);
             }
         }
-        
-        closedir(d);
-        
-        // Update statistics
-        pthread_mutex_lock(&pool->stats_mutex);
-        pool->dirs_processed++;
-        pthread_mutex_unlock(&pool->stats_mutex);
-        
-        free(item->dir_path);
-        free(item->rel_path);
-        free(item);
-        
-        // Check if all work is done
-        pthread_mutex_lock(&pool->mutex);
-        pool->active_threads--;
-        if (pool->queue_count == 0 && pool->active_threads == 0) {
-            pthread_cond_signal(&pool->work_complete);
-        }
-        pthread_mutex_unlock(&pool->mutex);
     }
     
-    return NULL;
+    closedir(d);
+    
+    __atomic_add_fetch(&worker->stats.dirs_processed, 1, __ATOMIC_RELAXED);
 }
 
-// Progress reporting thread  
-static void* progress_thread(void *arg) {
-    thread_pool_t *pool = (thread_pool_t*)arg;
-    
-    while (!pool->shutdown) {
-        sleep(2);
-        
-        pthread_mutex_lock(&pool->stats_mutex);
-        if (pool->files_processed > 0) {
-            printf("\rScanning: %d directories, %d files, %d changes found...", 
-                   pool->dirs_processed, pool->files_processed, pool->files_changed);
-            fflush(stdout);
-        }
-        pthread_mutex_unlock(&pool->stats_mutex);
+static void join_path(char *out, size_t size, const char *dir, const char *name) {
+    if (dir[0] == '\0') {
+        snprintf(out, size, "%s", name);
+    } else {
+        snprintf(out, size, "%s/%s", dir, name);
     }
-    
-    return NULL;
 }
 
-
-// Public API: Parallel directory scan
-int scan_directory_parallel(const char *root_path, index_t *new_index, 
-                           const index_t *prev_index, const char *fractyl_dir) {
-    thread_pool_t pool = {0};
-    pthread_mutex_init(&pool.mutex, NULL);
-    pthread_mutex_init(&pool.index_mutex, NULL);
-    pthread_mutex_init(&pool.stats_mutex, NULL);
-    pthread_cond_init(&pool.work_available, NULL);
-    pthread_cond_init(&pool.work_complete, NULL);
-    
-    pool.new_index = new_index;
-    pool.prev_index = prev_index;
-    pool.fractyl_dir = fractyl_dir;
-    pool.repo_root = root_path;
-    
-    // Determine number of threads
-    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
-    if (num_threads > MAX_THREADS) num_threads = MAX_THREADS;
-    if (num_threads < 2) num_threads = 2;
-    
-    printf("Using parallel scanning with %d threads\n", num_threads);
-    
-    // Create worker threads
-    pthread_t threads[MAX_THREADS];
-    pool.total_threads = num_threads;
+// Batched directory scan: the whole directory comes in through large
+// getdents64() reads and every entry that needs metadata is stat'ed in one
+// statx batch. Returns FRACTYL_ERROR_INVALID_STATE when the backend is not
+// available, so the caller can use scan_dir_readdir() instead.
+static int scan_dir_batched(scan_worker_t *worker, const work_item_t *item) {
+    thread_pool_t *pool = worker->pool;
+    
+    fast_dir_t dir;
+    int result = fast_dir_open(&dir, item->dir_path);
+    if (result == FRACTYL_ERROR_INVALID_STATE) {
+        return result;
+    }
+    if (result != FRACTYL_OK) {
+        return FRACTYL_OK;  // Unreadable directories are skipped, as with opendir()
+    }
     
-    for (int i = 0; i < num_threads; i++) {
-        pthread_create(&threads[i], NULL, worker_thread, &pool);
+    // A nested repository shows up as a .git entry in its own listing,
+    // which saves the parent a git_is_repository_root() stat per subdirectory
+    if (item->rel_path[0] != '\0') {
+        for (size_t i = 0; i < dir.count; i++) {
+            if (strcmp(dir.entries[i].name, ".git") == 0) {
+                fast_dir_close(&dir);
+                return FRACTYL_OK;
+            }
+        }
     }
     
-    // Create progress reporting thread
-    pthread_t progress_tid;
-    pthread_create(&progress_tid, NULL, progress_thread, &pool);
-    
-    // Start with root directory
-    enqueue_work(&pool, root_path, "");
-    
-    // Wait for all work to complete with timeout
-    pthread_mutex_lock(&pool.mutex);
-    int max_wait = 30; // 30 seconds timeout
-    int wait_count = 0;
-    while ((pool.queue_count > 0 || pool.active_threads > 0) && wait_count < max_wait) {
-        struct timespec ts;
-        clock_gettime(CLOCK_REALTIME, &ts);
-        ts.tv_sec += 1; // 1 second timeout
-        
-        int result = pthread_cond_timedwait(&pool.work_complete, &pool.mutex, &ts);
-        if (result == ETIMEDOUT) {
-            wait_count++;
-        }
-    }
-    pool.shutdown = 1;
-    pthread_cond_broadcast(&pool.work_available); // Wake up all waiting threads
-    pthread_mutex_unlock(&pool.mutex);
-    
-    // Wait for threads
-    for (int i = 0; i < num_threads; i++) {
-        pthread_join(threads[i], NULL);
+    const ignore_dir_t *dir_rules = ignore_engine_enter_dir(pool->ignore, item->ignore_dir,
+                                                            item->rel_path);
+    
+    // Allocate everything before queueing any work, so that falling back to
+    // readdir() cannot queue a subdirectory twice
+    size_t slots = dir.count ? dir.count : 1;
+    size_t *to_stat = malloc(slots * sizeof(size_t));
+    struct stat *stats = malloc(slots * sizeof(struct stat));
+    int *ok = malloc(slots * sizeof(int));
+    if (!to_stat || !stats || !ok) {
+        free(to_stat);
+        free(stats);
+        free(ok);
+        fast_dir_close(&dir);
+        return FRACTYL_ERROR_INVALID_STATE;
     }
+    size_t stat_count = 0;
     
-    // Stop progress thread
-    pthread_join(progress_tid, NULL);
+    char full_path[2048];
+    char new_rel_path[2048];
     
-    // Clear progress line
-    if (pool.files_processed > 50) {
-        printf("\r");
-        for (int i = 0; i < 80; i++) printf(" ");
-        printf("\r");
-    }
+    // Pass 1: queue subdirectories, collect entries that need a stat
+    for (size_t i = 0; i < dir.count; i++) {
+        const fast_dirent_t *entry = &dir.entries[i];
+        if (strcmp(entry->name, ".fractyl") == 0) {
+            continue;
+        }
     
-    printf("Found %zu files in %d directories\n", new_index->count, pool.dirs_processed);
-    if (pool.files_changed > 20) {
-        printf("  ... and %d more changes\n", pool.files_changed - 20);
+        if (entry->type == DT_DIR) {
+            join_path(new_rel_path, sizeof(new_rel_path), item->rel_path, entry->name);
+            if (ignore_engine_should_ignore(pool->ignore, dir_rules, new_rel_path, 1)) {
+                continue;
+            }
+            snprintf(full_path, sizeof(full_path), "%s/%s", item->dir_path, entry->name);
+            enqueue_work(worker, full_path, new_rel_path, dir_rules);
+        } else if (entry->type == DT_REG) {
+            join_path(new_rel_path, sizeof(new_rel_path), item->rel_path, entry->name);
+            if (ignore_engine_should_ignore(pool->ignore, dir_rules, new_rel_path, 0)) {
+                continue;
+            }
+            to_stat[stat_count++] = i;
+        } else if (entry->type == DT_UNKNOWN) {
+            // The type comes from the stat; ignore rules are applied afterwards
+            to_stat[stat_count++] = i;
+        }
     }
     
-    // Cleanup
-    pthread_mutex_destroy(&pool.mutex);
-    pthread_mutex_destroy(&pool.index_mutex);
-    pthread_mutex_destroy(&pool.stats_mutex);
-    pthread_cond_destroy(&pool.work_available);
-    pthread_cond_destroy(&pool.work_complete);
+    // Pass 2: one batch of statx calls for the whole directory
+    unsigned long long stat_started = profile_begin();
+    fast_dir_stat(&worker->stat_ctx, &dir, to_stat, stat_count, stats, ok);
+    profile_end(PROFILE_STAT, stat_started);
+    counters_add(COUNTER_STAT_CALLS, stat_count);
     
-    return FRACTYL_OK;
-}
-
-// Optimized scan using directory cache - two-phase approach
-int scan_directory_cached(const char *root_path, index_t *new_index, 
+    for (size_t k = 0; k < stat_count; k++) {
+        if (!ok[k]) {
+            continue;
+        }
+        const fast_dirent_t *entry = &dir.entries[to_stat[k]];
+        const struct stat *st = &stats[k];
+    
+        join_path(new_rel_path, sizeof(new_rel_path), item->rel_path, entry->name);
+        snprintf(full_path, sizeof(full_path), "%s/%s", item->dir_path, entry->name);
+    
+        if (entry->type == DT_UNKNOWN) {
+            if (ignore_engine_should_ignore(pool->ignore, dir_rules, new_rel_path,
+                                            S_ISDIR(st->st_mode))) {
+                continue;
+            }
+            if (S_ISDIR(st->st_mode)) {
+                enqueue_work(worker, full_path, new_rel_path, dir_rules);
+                continue;
+            }
+        }
+    
+        if (S_ISREG(st->st_mode)) {
+            process_file(worker, full_path, new_rel_path, st);
+        }
+    }
+    
+    free(stats);
+    free(ok);
+    free(to_stat);
+    fast_dir_close(&dir);
+    
+    __atomic_add_fetch(&worker->stats.dirs_processed, 1, __ATOMIC_RELAXED);
+    return FRACTYL_OK;
+}
+
+static void* worker_thread(void *arg) {
+    scan_worker_t *worker = (scan_worker_t*)arg;
+    thread_pool_t *pool = worker->pool;
+    
+    fast_stat_init(&worker->stat_ctx);
+    
+    while (1) {
+        work_item_t *item = dequeue_work(worker);
+        if (!item) break;  // Scan finished
+    
+        unsigned long long walk_started = profile_begin();
+        if (scan_dir_batched(worker, item) == FRACTYL_ERROR_INVALID_STATE) {
+            scan_dir_readdir(worker, item);
+        }
+        profile_end(PROFILE_WALK, walk_started);
+        counters_add(COUNTER_DIR_READS, 1);
+    
+        free_work_item(item);
+        finish_work(pool);
+    }
+    
+    fast_stat_free(&worker->stat_ctx);
+    return NULL;
+}
+
+static void sum_scan_stats(const thread_pool_t *pool, scan_stats_t *total) {
+    memset(total, 0, sizeof(*total));
+    int stage_count = pool->stage_workers ? pool->hash_threads + pool->store_threads : 0;
+    for (int i = 0; i < pool->total_threads + stage_count; i++) {
+        const scan_stats_t *s = i < pool->total_threads ? &pool->workers[i].stats
+                                                        : &pool->stage_workers[i - pool->total_threads].stats;
+        total->files_processed += __atomic_load_n(&s->files_processed, __ATOMIC_RELAXED);
+        total->dirs_processed += __atomic_load_n(&s->dirs_processed, __ATOMIC_RELAXED);
+        total->files_changed += __atomic_load_n(&s->files_changed, __ATOMIC_RELAXED);
+        total->files_scanned += __atomic_load_n(&s->files_scanned, __ATOMIC_RELAXED);
+        total->bytes_hashed += __atomic_load_n(&s->bytes_hashed, __ATOMIC_RELAXED);
+        total->bytes_stored += __atomic_load_n(&s->bytes_stored, __ATOMIC_RELAXED);
+    }
+}
+
+// Move each pool one step towards better throughput. A pool is only judged
+// while it has more work queued than running threads, so a stage that is
+// starved by the one before it is left alone.
+static void adapt_pools(thread_pool_t *pool, const scan_stats_t *total, double elapsed) {
+    long pending = __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST);
+    size_t hash_backlog = bounded_queue_length(&pool->hash_queue);
+    size_t store_backlog = bounded_queue_length(&pool->store_queue);
+    
+    // Walkers blocked on a full hash queue measure the hash stage, not themselves
+    int scan_backlogged = pending > adaptive_gate_active(&pool->scan_gate) &&
+                          hash_backlog < HASH_QUEUE_CAPACITY;
+    int hash_backlogged = hash_backlog >= (size_t)adaptive_gate_active(&pool->hash_gate) &&
+                          store_backlog < STORE_QUEUE_CAPACITY;
+    int store_backlogged = store_backlog >= (size_t)adaptive_gate_active(&pool->store_gate);
+    
+    adaptive_gate_sample(&pool->scan_gate, total->files_scanned + (unsigned long long)total->dirs_processed,
+                         elapsed, scan_backlogged);
+    adaptive_gate_sample(&pool->hash_gate, total->bytes_hashed, elapsed, hash_backlogged);
+    adaptive_gate_sample(&pool->store_gate, total->bytes_stored, elapsed, store_backlogged);
+}
+
+// Progress reporting thread, which also runs the concurrency controller
+static void* progress_thread(void *arg) {
+    thread_pool_t *pool = (thread_pool_t*)arg;
+    struct timespec last_adapt, last_report, now;
+    clock_gettime(CLOCK_MONOTONIC, &last_adapt);
+    last_report = last_adapt;
+    
+    while (1) {
+        // Sleep in short steps so a finished scan is not held up
+        usleep(100000);
+        if (__atomic_load_n(&pool->shutdown, __ATOMIC_ACQUIRE)) break;
+    
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        scan_stats_t total;
+        sum_scan_stats(pool, &total);
+    
+        double since_adapt = elapsed_seconds(&last_adapt, &now);
+        if (pool->plan.adaptive && since_adapt * 1000 >= ADAPT_INTERVAL_MS) {
+            adapt_pools(pool, &total, since_adapt);
+            last_adapt = now;
+        }
+    
+        if (!pool->hash_only && elapsed_seconds(&last_report, &now) >= 2.0) {
+            last_report = now;
+            if (total.files_processed > 0) {
+                printf("\rScanning: %d directories, %d files, %d changes found...", 
+                       total.dirs_processed, total.files_processed, total.files_changed);
+                fflush(stdout);
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+// Threads for CPU bound work such as sorting: one per online core, capped at MAX_THREADS
+static int scan_thread_count(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores > MAX_THREADS) cores = MAX_THREADS;
+    if (cores < 2) cores = 2;
+    return (int)cores;
+}
+
+static int scan_parallel(const char *root_path, index_t *new_index, const index_t *prev_index,
+                         const char *fractyl_dir, int hash_only) {
+    thread_pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    
+    pool.hash_only = hash_only;
+    pool.new_index = new_index;
+    pool.prev_index = prev_index;
+    pool.fractyl_dir = fractyl_dir;
+    pool.repo_root = root_path;
+    pool.scan_start = time(NULL);
+    
+    // Compile ignore rules once for the whole scan
+    pool.ignore = ignore_engine_create(root_path);
+    if (!pool.ignore) {
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    // Workers look up prev_index concurrently, so build its table up front
+    if (prev_index) {
+        index_prepare_lookup(prev_index);
+    }
+    
+    // Every pool gets its largest size up front; the gates decide how many
+    // of those threads actually run
+    concurrency_plan_init(&pool.plan, root_path, fractyl_dir);
+    int num_threads = pool.plan.scan.max;
+    pool.hash_threads = pool.plan.hash.max;
+    pool.store_threads = pool.plan.store.max;
+    long prefetch = config_get_long(fractyl_dir, "scan.prefetch", SCAN_PREFETCH_WINDOW);
+    pool.prefetch = prefetch > 0 ? (size_t)prefetch : 0;
+    int stage_count = pool.hash_threads + pool.store_threads;
+    
+    pool.workers = calloc(num_threads, sizeof(scan_worker_t));
+    pool.stage_workers = calloc(stage_count, sizeof(scan_worker_t));
+    pool.shards = calloc(num_threads + stage_count, sizeof(index_t));
+    if (!pool.workers || !pool.stage_workers || !pool.shards ||
+        bounded_queue_init(&pool.hash_queue, HASH_QUEUE_CAPACITY) != FRACTYL_OK) {
+        free(pool.workers);
+        free(pool.stage_workers);
+        free(pool.shards);
+        ignore_engine_free(pool.ignore);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    if (bounded_queue_init(&pool.store_queue, STORE_QUEUE_CAPACITY) != FRACTYL_OK) {
+        bounded_queue_destroy(&pool.hash_queue);
+        free(pool.workers);
+        free(pool.stage_workers);
+        free(pool.shards);
+        ignore_engine_free(pool.ignore);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    pool.total_threads = num_threads;
+    
+    pthread_mutex_init(&pool.idle_mutex, NULL);
+    pthread_cond_init(&pool.idle_cond, NULL);
+    adaptive_gate_init(&pool.scan_gate, &pool.plan.scan);
+    adaptive_gate_init(&pool.hash_gate, &pool.plan.hash);
+    adaptive_gate_init(&pool.store_gate, &pool.plan.store);
+    
+    for (int i = 0; i < num_threads; i++) {
+        pool.workers[i].pool = &pool;
+        pool.workers[i].id = i;
+        pool.workers[i].shard = &pool.shards[i];
+        pool.workers[i].steal_seed = (unsigned int)(i * 2654435761u) ^ (unsigned int)getpid();
+        pthread_mutex_init(&pool.workers[i].deque.lock, NULL);
+    }
+    
+    for (int i = 0; i < stage_count; i++) {
+        pool.stage_workers[i].pool = &pool;
+        pool.stage_workers[i].id = num_threads + i;
+        pool.stage_workers[i].shard = &pool.shards[num_threads + i];
+    }
+    
+    if (!hash_only) {
+        printf("Using parallel scanning with %d threads (%s storage)\n", pool.plan.scan.initial,
+               storage_kind_name(pool.plan.storage));
+    }
+    
+    // Start the hash and store stages first so the walk can feed them at once.
+    // A stage without threads is closed, and its producers then do the work inline.
+    pthread_t *stage_tids = calloc(stage_count, sizeof(pthread_t));
+    int *stage_started = calloc(stage_count, sizeof(int));
+    int hash_started = 0, store_started = 0;
+    if (stage_tids && stage_started) {
+        for (int i = 0; i < stage_count; i++) {
+            int is_hash = i < pool.hash_threads;
+            if (pthread_create(&stage_tids[i], NULL, is_hash ? hash_stage_thread : store_stage_thread,
+                               &pool.stage_workers[i]) == 0) {
+                stage_started[i] = 1;
+                if (is_hash) hash_started++; else store_started++;
+            }
+        }
+    }
+    if (hash_started == 0) bounded_queue_close(&pool.hash_queue);
+    if (store_started == 0) bounded_queue_close(&pool.store_queue);
+    // With threads missing, parking by index could stop a whole stage
+    if (hash_started < pool.hash_threads) adaptive_gate_close(&pool.hash_gate);
+    if (store_started < pool.store_threads) adaptive_gate_close(&pool.store_gate);
+    
+    // Seed the first worker with the root directory before anyone starts,
+    // so nobody can observe an empty scan and exit early
+    enqueue_work(&pool.workers[0], root_path, "", ignore_engine_root(pool.ignore));
+    
+    // Create worker threads
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    int started = 0;
+    if (threads) {
+        for (int i = 0; i < num_threads; i++) {
+            if (pthread_create(&threads[i], NULL, worker_thread, &pool.workers[i]) != 0) {
+                break;
+            }
+            started++;
+        }
+    }
+    if (started < num_threads) {
+        adaptive_gate_close(&pool.scan_gate);
+    }
+    if (started == 0) {
+        // No threads at all: do the walk on this thread instead
+        worker_thread(&pool.workers[0]);
+    }
+    
+    // Create progress reporting thread
+    pthread_t progress_tid;
+    int progress_started = pthread_create(&progress_tid, NULL, progress_thread, &pool) == 0;
+    
+    // Workers exit on their own once every queued directory has been read
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    
+    // Drain the pipeline: no more changed files once the walk is over, and
+    // no more object writes once every hash thread has finished
+    bounded_queue_close(&pool.hash_queue);
+    adaptive_gate_close(&pool.hash_gate);
+    for (int i = 0; i < pool.hash_threads; i++) {
+        if (stage_started && stage_started[i]) pthread_join(stage_tids[i], NULL);
+    }
+    bounded_queue_close(&pool.store_queue);
+    adaptive_gate_close(&pool.store_gate);
+    for (int i = pool.hash_threads; i < stage_count; i++) {
+        if (stage_started && stage_started[i]) pthread_join(stage_tids[i], NULL);
+    }
+    free(stage_tids);
+    free(stage_started);
+    
+    // Stop progress thread
+    __atomic_store_n(&pool.shutdown, 1, __ATOMIC_RELEASE);
+    if (progress_started) {
+        pthread_join(progress_tid, NULL);
+    }
+    
+    // Combine the per-worker shards into one index sorted by path
+    int merge_result = index_merge_shards(new_index, pool.shards, num_threads + stage_count,
+                                          num_threads);
+    
+    scan_stats_t total;
+    sum_scan_stats(&pool, &total);
+    
+    if (!hash_only) {
+        // Clear progress line
+        if (total.files_processed > 50) {
+            printf("\r");
+            for (int i = 0; i < 80; i++) printf(" ");
+            printf("\r");
+        }
+    
+        printf("Found %zu files in %d directories\n", new_index->count, total.dirs_processed);
+        if (total.files_changed > 20) {
+            printf("  ... and %d more changes\n", total.files_changed - 20);
+        }
+    }
+    
+    // Cleanup
+    for (int i = 0; i < num_threads; i++) {
+        work_item_t *item;
+        while ((item = deque_pop(&pool.workers[i].deque)) != NULL) {
+            free_work_item(item);
+        }
+        free(pool.workers[i].deque.items);
+        pthread_mutex_destroy(&pool.workers[i].deque.lock);
+    }
+    for (int i = 0; i < num_threads + stage_count; i++) {
+        index_free(&pool.shards[i]);
+    }
+    free(pool.shards);
+    free(pool.workers);
+    free(pool.stage_workers);
+    bounded_queue_destroy(&pool.hash_queue);
+    bounded_queue_destroy(&pool.store_queue);
+    ignore_engine_free(pool.ignore);
+    pthread_mutex_destroy(&pool.idle_mutex);
+    pthread_cond_destroy(&pool.idle_cond);
+    adaptive_gate_destroy(&pool.scan_gate);
+    adaptive_gate_destroy(&pool.hash_gate);
+    adaptive_gate_destroy(&pool.store_gate);
+    
+    return merge_result;
+}
+
+// Public API: Parallel directory scan
+int scan_directory_parallel(const char *root_path, index_t *new_index, 
+                           const index_t *prev_index, const char *fractyl_dir) {
+    return scan_parallel(root_path, new_index, prev_index, fractyl_dir, 0);
+}
+
+int scan_directory_hash_only(const char *root_path, index_t *new_index, const index_t *prev_index,
+                             const char *fractyl_dir) {
+    return scan_parallel(root_path, new_index, prev_index, fractyl_dir, 1);
+}
+
+// Optimized scan using directory cache - two-phase approach
+int scan_directory_cached(const char *root_path, index_t *new_index, 
                          const index_t *prev_index, const char *fractyl_dir,
                          const char *branch) {
     
@@ -434,15 +1216,15 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
     
     time_t phase_start = time(NULL);
     
-    // Load file metadata cache
-    file_cache_t file_cache;
-    int result = file_cache_load(&file_cache, fractyl_dir, branch);
+    // Load the stat cache the other engines keep too
+    binary_index_t file_cache;
+    int result = binary_index_load(&file_cache, fractyl_dir, branch);
     
     printf("Cache loading took %.1fs\n", difftime(time(NULL), phase_start));
     if (result != FRACTYL_OK) {
         printf("Warning: Could not load file cache, building new cache\n");
         // Initialize empty cache to build during scan
-        result = file_cache_init(&file_cache, branch);
+        result = binary_index_init(&file_cache, branch);
         if (result != FRACTYL_OK) {
             printf("Warning: Could not initialize file cache, falling back to parallel scan\n");
             return scan_directory_parallel(root_path, new_index, prev_index, fractyl_dir);
@@ -462,32 +1244,32 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
     // Phase 1: Quick metadata check for known files
     if (prev_index) {  
         printf("Phase 1: Quick metadata check for %zu known files...\n", prev_index->count);
-        
+    
         // Track changed files for selective processing
         char **changed_files = malloc(prev_index->count * sizeof(char*));
         size_t changed_count = 0;
-        
+    
         // Optimized scanning 
         size_t no_changes_streak = 0;
-        
+    
         for (size_t i = 0; i < prev_index->count; i++) {
             const index_entry_t *prev_file = &prev_index->entries[i];
-            
+    
             // Build full file path
             char full_path[2048];
             snprintf(full_path, sizeof(full_path), "%s/%s", root_path, prev_file->path);
-            
+    
             // Check if file still exists and get current metadata
             struct stat current_stat;
             int stat_result = stat(full_path, &current_stat);
-            
+    
             if (stat_result == 0 && S_ISREG(current_stat.st_mode)) {
                 // File exists, check against cache
-                file_change_result_t cache_result = file_cache_check_file(&file_cache, 
-                                                                        prev_file->path, 
-                                                                        &current_stat);
-                
-                if (cache_result == FILE_UNCHANGED) {
+                binary_file_status_t cache_result = binary_index_check_file(&file_cache, 
+                                                                           prev_file->path, 
+                                                                           &current_stat);
+    
+                if (cache_result == BINARY_FILE_UNCHANGED) {
                     // File unchanged - copy directly from previous index 
                     if (index_add_entry(new_index, prev_file) == FRACTYL_OK) {
                         files_unchanged++;
@@ -502,13 +1284,13 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
                 }
             } else {
                 // File deleted or became inaccessible - remove from cache
-                file_cache_remove_entry(&file_cache, prev_file->path);
+                binary_index_remove_entry(&file_cache, prev_file->path);
                 no_changes_streak = 0; // Reset streak
             }
-            
+    
             // Disable early exit for now to ensure we don't miss changes
             // TODO: Implement proper change-aware early exit later
-            
+    
             // Progress reporting (less frequent for better performance)
             if (i % 5000 == 0 || i == prev_index->count - 1) {
                 time_t now = time(NULL);
@@ -520,20 +1302,20 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
                 }
             }
         }
-        
+    
         printf("\nPhase 1 complete: %d unchanged, %d changed/deleted files (%.1fs)\n", 
                files_unchanged, (int)changed_count, difftime(time(NULL), phase_start));
-        
+    
         // Phase 2: Process only changed files and find new files
         phase_start = time(NULL);
         if (changed_count > 0) {
             printf("Phase 2: Processing %zu changed files...\n", changed_count);
-            
+    
             // Process changed files
             for (size_t i = 0; i < changed_count; i++) {
                 char full_path[2048];
                 snprintf(full_path, sizeof(full_path), "%s/%s", root_path, changed_files[i]);
-                
+    
                 struct stat file_stat;
                 if (stat(full_path, &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
                     // Hash the changed file
@@ -543,17 +1325,14 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
                         // Add to index
                         index_entry_t entry;
                         memset(&entry, 0, sizeof(entry));
-                        entry.path = strdup(changed_files[i]);
-                        entry.mode = file_stat.st_mode;
-                        entry.size = file_stat.st_size;
-                        entry.mtime = file_stat.st_mtime;
+                        entry.path = changed_files[i];
+                        index_entry_set_stat(&entry, &file_stat, time(NULL));
                         memcpy(entry.hash, hash, 32);
-                        
+    
                         if (index_add_entry(new_index, &entry) == FRACTYL_OK) {
                             // Update cache
-                            file_cache_update_entry(&file_cache, changed_files[i], &file_stat);
+                            binary_index_update_entry(&file_cache, changed_files[i], &file_stat, hash);
                         }
-                        free(entry.path);
                     }
                 }
                 free(changed_files[i]);
@@ -564,25 +1343,30 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
             printf("Phase 2: No changed files to process\n");
         }
         free(changed_files);
-        
+    
         // Phase 3: Smart new file detection
         phase_start = time(NULL);
-        
+    
         // If no changes, only check for new files when absolutely necessary
         // Use git's strategy: assume no new files unless we detect directory changes
-        
+    
         // Quick heuristic: If cache is recent and no changed files, likely no new files
-        time_t cache_age = time(NULL) - file_cache.cache_timestamp;
+        time_t cache_age = time(NULL) - (time_t)file_cache.header.timestamp;
         int skip_new_file_scan = (changed_count == 0 && cache_age < 300); // 5 minutes
-        
+    
         if (skip_new_file_scan) {
             printf("Phase 3: Skipping new file scan (no changes, recent cache)\n");
         } else {
             printf("Phase 3: Quick scan for new files...\n");
-            
-            // Use parallel scan but with a minimal index to compare against
+    
+            // Use parallel scan but with a minimal index to compare against;
+            // a full traversal restarts the cache's age
             index_t temp_index = {0};
+            time_t scan_start = time(NULL);
             result = scan_directory_parallel(root_path, &temp_index, new_index, fractyl_dir);
+            if (result == FRACTYL_OK) {
+                file_cache.header.timestamp = scan_start;
+            }
             if (result == FRACTYL_OK) {
                 // Add any new files found
                 int new_files_added = 0;
@@ -602,7 +1386,8 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
                             snprintf(full_path, sizeof(full_path), "%s/%s", root_path, temp_index.entries[i].path);
                             struct stat file_stat;
                             if (stat(full_path, &file_stat) == 0) {
-                                file_cache_update_entry(&file_cache, temp_index.entries[i].path, &file_stat);
+                                binary_index_update_entry(&file_cache, temp_index.entries[i].path, &file_stat,
+                                                          temp_index.entries[i].hash);
                             }
                             new_files_added++;
                             files_new++;
@@ -611,7 +1396,7 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
                 }
                 printf("Phase 3: Found %d new files (%.1fs)\n", 
                        new_files_added, difftime(time(NULL), phase_start));
-                
+    
                 // Clean up temp index
                 index_free(&temp_index);
             }
@@ -619,31 +1404,33 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
     } else {
         // No previous index - do full scan
         printf("No previous index - performing full directory scan...\n");
+        file_cache.header.timestamp = time(NULL);
         result = scan_directory_parallel(root_path, new_index, prev_index, fractyl_dir);
         if (result != FRACTYL_OK) {
-            file_cache_free(&file_cache);
+            binary_index_free(&file_cache);
             return result;
         }
-        
+    
         // Update cache for all files
         for (size_t i = 0; i < new_index->count; i++) {
             char full_path[2048];
             snprintf(full_path, sizeof(full_path), "%s/%s", root_path, new_index->entries[i].path);
             struct stat file_stat;
             if (stat(full_path, &file_stat) == 0) {
-                file_cache_update_entry(&file_cache, new_index->entries[i].path, &file_stat);
+                binary_index_update_entry(&file_cache, new_index->entries[i].path, &file_stat,
+                                          new_index->entries[i].hash);
             }
         }
         files_new = new_index->count;
     }
     
     // Save updated cache
-    if (file_cache_save(&file_cache, fractyl_dir) != FRACTYL_OK) {
+    if (binary_index_save(&file_cache, fractyl_dir) != FRACTYL_OK) {
         printf("Warning: Could not save file cache\n");
     }
     
     // Clean up file cache
-    file_cache_free(&file_cache);
+    binary_index_free(&file_cache);
     
     time_t end_time = time(NULL);  
     printf("File cache optimization: %d unchanged, %d changed, %d new files (%.1fs total)\n",
@@ -656,416 +1443,723 @@ int scan_directory_cached(const char *root_path, index_t *new_index,
 // Helper function declarations
 static int scan_for_new_files_only(const char *root_path, binary_index_t *index,
                                    index_t *new_index, const char *fractyl_dir, int *new_count);
-static int traverse_for_new_files(const char *current_path, const char *rel_path,
-                                  binary_index_t *index, index_t *new_index, 
-                                  const char *fractyl_dir, int *new_count);
 
-// Pure stat-only scanning - no directory traversal, Git-style performance
-int scan_directory_stat_only(const char *root_path, index_t *new_index, 
-                             const index_t *prev_index, const char *fractyl_dir,
-                             const char *branch);
+// --- Checking the files of the binary index ---
+//
+// Known files are stat'ed and compared in windows of the binary index,
+// which is saved in path order, so memory for the paths and stat results
+// stays within scan.memory_budget however large the tree. Their previous
+// entries are found by a forward search of the sorted previous index
+// rather than a lookup table over all of it.
 
-// High-performance scanning using binary index and Git-style parallel stat
-int scan_directory_binary(const char *root_path, index_t *new_index, 
-                          const index_t *prev_index, const char *fractyl_dir,
-                          const char *branch) {
-    
-    if (!root_path || !new_index || !fractyl_dir || !branch) {
-        return FRACTYL_ERROR_INVALID_ARGS;
+// Bytes of window state per file besides its full path
+#define WINDOW_ENTRY_BYTES (sizeof(char*) * 2 + sizeof(struct stat) + sizeof(int) + 1)
+
+typedef struct {
+    char **file_paths;
+    const char **rel_paths;
+    struct stat *stat_results;
+    int *stat_success;
+    unsigned char *status;    // binary_file_status_t of each, or WINDOW_GONE
+    size_t capacity;          // Files per window
+    char *path_pool;          // Full paths of the window's files
+    size_t pool_size;
+} stat_window_t;
+
+typedef struct {
+    int unchanged;
+    int changed;
+    int deleted;
+} known_file_counts_t;
+
+// Split budget between path storage and the per-file arrays. Every
+// window holds at least STAT_CHUNK files of the longest path.
+static int stat_window_init(stat_window_t *window, long budget) {
+    memset(window, 0, sizeof(*window));
+    size_t half = budget > 0 ? (size_t)budget / 2 : 0;
+    window->capacity = half / WINDOW_ENTRY_BYTES;
+    if (window->capacity < STAT_CHUNK) window->capacity = STAT_CHUNK;
+    window->pool_size = half > 2 * PATH_MAX ? half : 2 * PATH_MAX;
+    
+    window->file_paths = malloc(window->capacity * sizeof(char*));
+    window->rel_paths = malloc(window->capacity * sizeof(char*));
+    window->stat_results = malloc(window->capacity * sizeof(struct stat));
+    window->stat_success = malloc(window->capacity * sizeof(int));
+    window->status = malloc(window->capacity);
+    window->path_pool = malloc(window->pool_size);
+    if (!window->file_paths || !window->rel_paths || !window->stat_results ||
+        !window->stat_success || !window->status || !window->path_pool) {
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
     }
+    return FRACTYL_OK;
+}
+
+static void stat_window_free(stat_window_t *window) {
+    free(window->file_paths);
+    free(window->rel_paths);
+    free(window->stat_results);
+    free(window->stat_success);
+    free(window->status);
+    free(window->path_pool);
+}
+
+// Fill the window with the next files of iter; returns how many. A file
+// whose full path does not fit the pool is left in *pending for the next one.
+static size_t stat_window_fill(stat_window_t *window, binary_index_iterator_t *iter,
+                               const char *root_path, const char **pending) {
+    size_t count = 0, used = 0, root_len = strlen(root_path);
+    const char *rel_path = *pending;
+    const binary_index_entry_t *entry;
+    *pending = NULL;
     
-    // Using high-performance binary index
-    
-    // Load binary index
-    binary_index_t binary_index;
-    int result = binary_index_load(&binary_index, fractyl_dir, branch);
-    if (result != FRACTYL_OK) {
-        printf("Binary index load failed (result=%d), initializing new binary index\n", result);
-        // Force initialize empty binary index instead of falling back
-        result = binary_index_init(&binary_index, branch);
-        if (result != FRACTYL_OK) {
-            printf("Failed to initialize binary index, falling back to file cache scan\n");
-            return scan_directory_cached(root_path, new_index, prev_index, fractyl_dir, branch);
+    while (count < window->capacity && (rel_path || binary_index_iterator_next(iter, &rel_path, &entry))) {
+        size_t len = root_len + strlen(rel_path) + 2;
+        if (used + len > window->pool_size) {
+            *pending = rel_path;
+            break;
         }
-        printf("Initialized empty binary index for branch: %s\n", branch);
+        char *full_path = window->path_pool + used;
+        snprintf(full_path, len, "%s/%s", root_path, rel_path);
+        used += len;
+        window->file_paths[count] = full_path;
+        window->rel_paths[count] = rel_path; // Reference to binary index string
+        count++;
+        rel_path = NULL;
     }
-    
-    // Binary index loaded
-    
-    // Statistics
-    int files_unchanged = 0;
-    int files_changed = 0;
-    int files_new = 0;
-    int files_deleted = 0;
-    
-    // Phase 1: Git-style parallel stat checking for all known files
-    const int STAT_THREADS = 8; // Git uses up to 20, we'll start conservatively
-    // Phase 1: Parallel stat checking
-    
-    // Create parallel stat work data similar to Git's preload_thread
-    char **file_paths = malloc(binary_index.header.entry_count * sizeof(char*));
-    const char **rel_paths = malloc(binary_index.header.entry_count * sizeof(char*));
-    struct stat *stat_results = malloc(binary_index.header.entry_count * sizeof(struct stat));
-    int *stat_success = malloc(binary_index.header.entry_count * sizeof(int));
-    
-    if (!file_paths || !rel_paths || !stat_results || !stat_success) {
-        printf("Error: Could not allocate memory for parallel stat\n");
-        free(file_paths); free(rel_paths); free(stat_results); free(stat_success);
-        binary_index_free(&binary_index);
-        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    return count;
+}
+
+// Forward search of a sorted index: paths asked for in increasing order
+// cost a binary search of what is left, others one of the whole index
+typedef struct {
+    const index_t *index;
+    int sorted;
+    size_t next;              // Where the last search ended
+} prev_cursor_t;
+
+static void prev_cursor_init(prev_cursor_t *cursor, const index_t *index) {
+    cursor->index = index;
+    cursor->sorted = index && index_is_sorted(index);
+    cursor->next = 0;
+    
+    // Unsorted indexes have only the lookup table
+    if (index && !cursor->sorted) {
+        index_prepare_lookup(index);
     }
-    
-    // Populate file paths from binary index
-    binary_index_iterator_t iter;
-    binary_index_iterator_init(&iter, &binary_index);
-    const char *rel_path;
-    const binary_index_entry_t *entry;
-    size_t file_count = 0;
-    
-    while (binary_index_iterator_next(&iter, &rel_path, &entry)) {
-        // Allocate full path
-        file_paths[file_count] = malloc(strlen(root_path) + strlen(rel_path) + 2);
-        sprintf(file_paths[file_count], "%s/%s", root_path, rel_path);
-        rel_paths[file_count] = rel_path; // Reference to binary index string
-        file_count++;
-    }
-    
-    // Create stat worker threads (like Git's preload_index)
-    pthread_t threads[STAT_THREADS];
-    preload_data_t thread_data[STAT_THREADS];
-    size_t files_per_thread = file_count / STAT_THREADS;
-    
-    for (int i = 0; i < STAT_THREADS; i++) {
-        thread_data[i].file_paths = file_paths;
-        thread_data[i].rel_paths = rel_paths;
-        thread_data[i].stat_results = stat_results;
-        thread_data[i].stat_success = stat_success;
-        thread_data[i].start_idx = i * files_per_thread;
-        thread_data[i].end_idx = (i == STAT_THREADS - 1) ? file_count : (i + 1) * files_per_thread;
-        thread_data[i].thread_id = i;
-        
-        pthread_create(&threads[i], NULL, preload_stat_worker, &thread_data[i]);
-    }
-    
-    // Wait for all stat operations to complete
-    for (int i = 0; i < STAT_THREADS; i++) {
-        pthread_join(threads[i], NULL);
+}
+
+static const index_entry_t* prev_cursor_find(prev_cursor_t *cursor, const char *path) {
+    if (!cursor->index) return NULL;
+    if (!cursor->sorted) return index_find_entry(cursor->index, path);
+    
+    // Paths mostly come in order, so the search starts where the last one ended
+    size_t lo = cursor->next > 0 && strcmp(cursor->index->entries[cursor->next - 1].path, path) < 0
+        ? cursor->next : 0;
+    size_t hi = cursor->index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(cursor->index->entries[mid].path, path) < 0) lo = mid + 1;
+        else hi = mid;
     }
+    cursor->next = lo;
     
-    // Processing results
-    
-    // Build hash table for O(1) previous index lookups (fixes O(n²) bottleneck!)
-    typedef struct prev_entry_hash {
-        const char *path;
-        const index_entry_t *entry;
-        struct prev_entry_hash *next;
-    } prev_entry_hash_t;
-    
-    const int HASH_SIZE = 65536; // Power of 2 for fast modulo
-    prev_entry_hash_t **prev_hash_table = NULL;
-    
-    if (prev_index && prev_index->count > 0) {
-        prev_hash_table = calloc(HASH_SIZE, sizeof(prev_entry_hash_t*));
-        if (prev_hash_table) {
-            // Build hash table from previous index
-            for (size_t i = 0; i < prev_index->count; i++) {
-                const index_entry_t *entry = &prev_index->entries[i];
-                if (entry->path) {
-                    // Simple hash function
-                    uint32_t hash = 0;
-                    for (const char *p = entry->path; *p; p++) {
-                        hash = hash * 31 + *p;
-                    }
-                    int bucket = hash & (HASH_SIZE - 1);
-                    
-                    prev_entry_hash_t *hash_entry = malloc(sizeof(prev_entry_hash_t));
-                    if (hash_entry) {
-                        hash_entry->path = entry->path;
-                        hash_entry->entry = entry;
-                        hash_entry->next = prev_hash_table[bucket];
-                        prev_hash_table[bucket] = hash_entry;
-                    }
-                }
-            }
-            // Built hash table for previous entries
-        }
+    const index_entry_t *entry = lo < cursor->index->count ? &cursor->index->entries[lo] : NULL;
+    return entry && strcmp(entry->path, path) == 0 ? entry : NULL;
+}
+
+// Status of a window file that is gone or no longer a regular file
+#define WINDOW_GONE 0xff
+
+// Prefetch the changed file at *next, if any, and move *next to the one after
+static void prefetch_changed(const stat_window_t *window, size_t count, size_t *next) {
+    if (*next >= count) return;
+    file_prefetch(window->file_paths[*next], window->stat_results[*next].st_size, SCAN_PREFETCH_BYTES);
+    do {
+        (*next)++;
+    } while (*next < count && window->status[*next] != BINARY_FILE_CHANGED);
+}
+
+// Compare one window of stat results with the binary index: unchanged
+// files are carried over from prev_index, changed ones hashed and stored.
+// The whole window is compared first, so each changed file can start the
+// read of the one prefetch files further on before it is hashed.
+static void check_window(const stat_window_t *window, size_t count, binary_index_t *binary_index,
+                         prev_cursor_t *prev, index_t *new_index, const char *fractyl_dir,
+                         size_t prefetch, known_file_counts_t *counts) {
+    size_t next = count;
+    for (size_t i = count; i-- > 0;) {
+        const struct stat *st = &window->stat_results[i];
+        window->status[i] = window->stat_success[i] && S_ISREG(st->st_mode)
+            ? (unsigned char)binary_index_check_file(binary_index, window->rel_paths[i], st) : WINDOW_GONE;
+        if (window->status[i] == BINARY_FILE_CHANGED) next = i;
     }
+    for (size_t k = 0; k < prefetch; k++) prefetch_changed(window, count, &next);
     
-    // Process stat results sequentially with O(1) hash lookups
-    binary_index_iterator_init(&iter, &binary_index);
-    size_t file_idx = 0;
-    
-    while (binary_index_iterator_next(&iter, &rel_path, &entry)) {
-        if (!stat_success[file_idx] || !S_ISREG(stat_results[file_idx].st_mode)) {
+    for (size_t i = 0; i < count; i++) {
+        const char *rel_path = window->rel_paths[i];
+        const struct stat *st = &window->stat_results[i];
+        if (window->status[i] == WINDOW_GONE) {
             // File deleted or no longer regular file
-            files_deleted++;
-            file_idx++;
+            counts->deleted++;
             continue;
         }
-        
-        // Check file status using binary index
-        binary_file_status_t status = binary_index_check_file(&binary_index, rel_path, &stat_results[file_idx]);
-        
+        binary_file_status_t status = (binary_file_status_t)window->status[i];
+    
         if (status == BINARY_FILE_UNCHANGED) {
             // File unchanged - copy from previous index if available
-            const index_entry_t *prev_entry = NULL;
-            if (prev_hash_table) {
-                // O(1) hash table lookup instead of O(n) linear search
-                uint32_t hash = 0;
-                for (const char *p = rel_path; *p; p++) {
-                    hash = hash * 31 + *p;
-                }
-                int bucket = hash & (HASH_SIZE - 1);
-                
-                for (prev_entry_hash_t *h = prev_hash_table[bucket]; h; h = h->next) {
-                    if (strcmp(h->path, rel_path) == 0) {
-                        prev_entry = h->entry;
-                        break;
-                    }
-                }
-            }
-            
+            const index_entry_t *prev_entry = prev_cursor_find(prev, rel_path);
             if (prev_entry) {
                 // Use fast direct append since we know no duplicates exist
-                result = index_add_entry_direct(new_index, prev_entry);
-                if (result != FRACTYL_OK) {
-                    file_idx++;
-                    continue; // Skip on error
+                if (index_add_entry_direct(new_index, prev_entry) == FRACTYL_OK) {
+                    counts->unchanged++;
                 }
-                
-                files_unchanged++;
-                file_idx++;
                 continue;
             }
             // If no prev_index, need to hash file anyway
             status = BINARY_FILE_CHANGED;
+        } else if (status == BINARY_FILE_CHANGED && prefetch > 0) {
+            prefetch_changed(window, count, &next);
         }
-        
+    
         if (status == BINARY_FILE_CHANGED) {
             // File changed - hash it
             unsigned char hash[32];
-            result = object_store_file(file_paths[file_idx], fractyl_dir, hash);
-            if (result == FRACTYL_OK) {
+            if (object_store_file(window->file_paths[i], fractyl_dir, hash) == FRACTYL_OK) {
                 index_entry_t new_entry;
                 memset(&new_entry, 0, sizeof(new_entry));
-                new_entry.path = strdup(rel_path);
-                new_entry.mode = stat_results[file_idx].st_mode;
-                new_entry.size = stat_results[file_idx].st_size;
-                new_entry.mtime = stat_results[file_idx].st_mtime;
+                new_entry.path = (char *)rel_path;
+                index_entry_set_stat(&new_entry, st, time(NULL));
                 memcpy(new_entry.hash, hash, 32);
-                
-                // Fast direct assignment without O(n) duplicate checking
+    
                 // Use fast direct append since we know no duplicates exist
-                result = index_add_entry_direct(new_index, &new_entry);
-                if (result == FRACTYL_OK) {
+                if (index_add_entry_direct(new_index, &new_entry) == FRACTYL_OK) {
                     // Update binary index
-                    unsigned char sha1_hash[20];
-                    memcpy(sha1_hash, hash, 20); // Use first 20 bytes for SHA-1 compatibility
-                    binary_index_update_entry(&binary_index, rel_path, &stat_results[file_idx], sha1_hash);
-                    files_changed++;
+                    binary_index_update_entry(binary_index, rel_path, st, hash);
+                    counts->changed++;
                 }
-                free(new_entry.path);
             }
         }
-        file_idx++;
-    }
-    
-    // Phase 1 complete
-    
-    // Phase 2: Quick new file detection (only if we have changes or it's been a while)
-    time_t index_age = time(NULL) - binary_index.header.timestamp;
-    int skip_new_scan = (files_changed == 0 && files_deleted == 0 && 
-                        index_age < 300 && binary_index.header.entry_count > 0); // 5 minutes and not empty
-    
-    if (skip_new_scan) {
-        printf("Phase 2: Skipping new file scan (no changes, recent index)\n");
-    } else {
-        // Phase 2: Quick scan for new files
-        
-        // Use lightweight directory traversal to find files not in index
-        int new_files_found = scan_for_new_files_only(root_path, &binary_index, 
-                                                     new_index, fractyl_dir, &files_new);
-        
-        if (new_files_found > 0) {
-            // Found new files
-        } else {
-            // No new files found
-        }
     }
-    
-    // Phase 3: Save updated binary index
-    result = binary_index_save(&binary_index, fractyl_dir);
+}
+
+// Stat every file of the binary index (like Git's preload_index) and
+// check it, one window at a time
+static int check_known_files(const char *root_path, const char *fractyl_dir, binary_index_t *binary_index,
+                             const index_t *prev_index, index_t *new_index, known_file_counts_t *counts) {
+    stat_window_t window;
+    int result = stat_window_init(&window, config_get_long(fractyl_dir, "scan.memory_budget",
+                                                           SCAN_MEMORY_BUDGET_DEFAULT));
     if (result != FRACTYL_OK) {
-        printf("Warning: Could not save binary index\n");
-    } else {
-        // Binary index saved
+        printf("Error: Could not allocate memory for parallel stat\n");
+        stat_window_free(&window);
+        return result;
     }
     
-    // Cleanup hash table
-    if (prev_hash_table) {
-        for (int i = 0; i < HASH_SIZE; i++) {
-            prev_entry_hash_t *h = prev_hash_table[i];
-            while (h) {
-                prev_entry_hash_t *next = h->next;
-                free(h);
-                h = next;
-            }
-        }
-        free(prev_hash_table);
-    }
+    long prefetch = config_get_long(fractyl_dir, "scan.prefetch", SCAN_PREFETCH_WINDOW);
+    prev_cursor_t prev;
+    prev_cursor_init(&prev, prev_index);
     
-    // Cleanup
-    for (size_t i = 0; i < file_count; i++) {
-        free(file_paths[i]);
+    binary_index_iterator_t iter;
+    binary_index_iterator_init(&iter, binary_index);
+    const char *pending = NULL;
+    size_t count;
+    while ((count = stat_window_fill(&window, &iter, root_path, &pending)) > 0) {
+        // Stat the window on a pool sized for this storage
+        preload_stat_files(root_path, fractyl_dir, window.file_paths, count,
+                           window.stat_results, window.stat_success);
+        check_window(&window, count, binary_index, &prev, new_index, fractyl_dir,
+                     prefetch > 0 ? (size_t)prefetch : 0, counts);
     }
-    free(file_paths);
-    free(rel_paths);
-    free(stat_results);
-    free(stat_success);
-    binary_index_free(&binary_index);
-    
-    // Scan complete
     
+    stat_window_free(&window);
     return FRACTYL_OK;
 }
 
-// Helper function to scan for new files only (not in binary index)
-static int scan_for_new_files_only(const char *root_path, binary_index_t *index,
-                                   index_t *new_index, const char *fractyl_dir, int *new_count) {
-    *new_count = 0;
+// Pure stat-only scanning - no directory traversal, Git-style performance
+int scan_directory_stat_only(const char *root_path, index_t *new_index, 
+                             const index_t *prev_index, const char *fractyl_dir,
+                             const char *branch);
+
+// High-performance scanning using binary index and Git-style parallel stat
+int scan_directory_binary(const char *root_path, index_t *new_index, 
+                          const index_t *prev_index, const char *fractyl_dir,
+                          const char *branch) {
     
-    // Quick directory traversal looking for files not in index
-    return traverse_for_new_files(root_path, "", index, new_index, fractyl_dir, new_count);
+    if (!root_path || !new_index || !fractyl_dir || !branch) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    // Using high-performance binary index
+    
+    // Load binary index
+    binary_index_t binary_index;
+    int result = binary_index_load(&binary_index, fractyl_dir, branch);
+    if (result != FRACTYL_OK) {
+        printf("Binary index load failed (result=%d), initializing new binary index\n", result);
+        // Force initialize empty binary index instead of falling back
+        result = binary_index_init(&binary_index, branch);
+        if (result != FRACTYL_OK) {
+            printf("Failed to initialize binary index, falling back to parallel scan\n");
+            return scan_directory_parallel(root_path, new_index, prev_index, fractyl_dir);
+        }
+        printf("Initialized empty binary index for branch: %s\n", branch);
+    }
+    
+    // Binary index loaded
+    
+    // Statistics
+    int files_new = 0;
+    
+    // Phase 1: Git-style parallel stat checking for all known files
+    known_file_counts_t counts = { 0, 0, 0 };
+    result = check_known_files(root_path, fractyl_dir, &binary_index, prev_index, new_index, &counts);
+    if (result != FRACTYL_OK) {
+        binary_index_free(&binary_index);
+        return result;
+    }
+    
+    // Phase 1 complete
+    
+    // Phase 2: Quick new file detection; directories unchanged since the
+    // last scan are not read
+    scan_for_new_files_only(root_path, &binary_index, new_index, fractyl_dir, &files_new);
+    
+    // Phase 3: Save updated binary index
+    result = binary_index_save(&binary_index, fractyl_dir);
+    if (result != FRACTYL_OK) {
+        printf("Warning: Could not save binary index\n");
+    } else {
+        // Binary index saved
+    }
+    
+    
+    // Cleanup
+    binary_index_free(&binary_index);
+    
+    // Scan complete
+    
+    return FRACTYL_OK;
+}
+
+// --- New file detection ---
+//
+// Every directory the scan reads gets a record in the binary index: its
+// stat data and a digest of the ignore rules in effect (an untracked
+// cache, as git calls it). A directory whose stat data and rules still
+// match had no entry added or removed since then, when every file in it
+// was known, so it is not read at all: the scan only goes on into the
+// subdirectories it had, which are found among the records themselves.
+// A record with a zero mtime never matches and makes the scan read that
+// directory again; that is how directories are noted that changed while
+// being read, held files that could not be stored, or are submodules.
+
+// Directory records of the binary index as loaded, sorted by key so that a
+// directory's subdirectories are the records right after its own
+typedef struct {
+    const char **keys;
+    size_t count;
+} dir_records_t;
+
+typedef struct {
+    binary_index_t *index;
+    index_t *new_index;
+    const char *fractyl_dir;
+    ignore_engine_t *ignore;
+    dir_records_t records;
+    time_t scan_start;
+    int *new_count;
+} new_file_scan_t;
+
+static int traverse_for_new_files(new_file_scan_t *scan, const char *current_path, const char *rel_path,
+                                  const ignore_dir_t *parent_rules, const unsigned char *parent_stamp);
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static int load_dir_records(const binary_index_t *index, dir_records_t *records) {
+    records->keys = NULL;
+    records->count = 0;
+    
+    size_t capacity = 0;
+    binary_index_iterator_t iter;
+    binary_index_iterator_init(&iter, index);
+    const char *key;
+    while (binary_index_iterator_next_directory(&iter, &key, NULL)) {
+        if (records->count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            const char **keys = realloc(records->keys, capacity * sizeof(char *));
+            if (!keys) return FRACTYL_ERROR_OUT_OF_MEMORY;
+            records->keys = keys;
+        }
+        records->keys[records->count++] = key;
+    }
+    
+    if (records->count > 1) {
+        qsort(records->keys, records->count, sizeof(char *), compare_strings);
+    }
+    return FRACTYL_OK;
+}
+
+// Position of the first record not below key
+static size_t records_lower_bound(const dir_records_t *records, const char *key) {
+    size_t lo = 0;
+    size_t hi = records->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(records->keys[mid], key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// The records under prefix (a directory's path and '/', or "" for the
+// root) start at records_lower_bound(prefix). Step *pos to the next
+// subdirectory among them, past the records below that subdirectory,
+// and put its name in name.
+static int records_next_child(const dir_records_t *records, const char *prefix, size_t prefix_len,
+                              size_t *pos, char *name, size_t name_size) {
+    while (*pos < records->count) {
+        const char *key = records->keys[*pos];
+        if (strncmp(key, prefix, prefix_len) != 0) {
+            return 0;
+        }
+    
+        // The directory's own record, or a subdirectory's
+        const char *rest = key + prefix_len;
+        const char *slash = strchr(rest, '/');
+        size_t len = slash ? (size_t)(slash - rest) : 0;
+        if (len == 0 || len >= name_size) {
+            (*pos)++;
+            continue;
+        }
+        memcpy(name, rest, len);
+        name[len] = '\0';
+    
+        // Everything below "prefix/name/" sorts before "prefix/name0"
+        char bound[2048];
+        snprintf(bound, sizeof(bound), "%.*s%s0", (int)prefix_len, prefix, name);
+        *pos = records_lower_bound(records, bound);
+        return 1;
+    }
+    return 0;
+}
+
+static void child_paths(const char *current_path, const char *rel_path, const char *name,
+                        char *full_path, size_t full_size, char *child_rel, size_t rel_size) {
+    snprintf(full_path, full_size, "%s/%s", current_path, name);
+    if (rel_path[0] == '\0') {
+        snprintf(child_rel, rel_size, "%s", name);
+    } else {
+        snprintf(child_rel, rel_size, "%s/%s", rel_path, name);
+    }
+}
+
+// Digest of the ignore rules in effect in a directory: the parent's digest
+// and the stat data of the directory's own ignore files. A changed ignore
+// file changes the digest of its directory and everything below it.
+// Returns nonzero if the directory has ignore files of its own.
+static int ignore_stamp(const char *dir_path, const unsigned char *parent_stamp, unsigned char *stamp) {
+    static const char *const ignore_files[] = { ".gitignore", ".fractylignore" };
+    struct {
+        unsigned char parent[FRACTYL_HASH_SIZE];
+        int64_t file[2][4];
+    } data;
+    memset(&data, 0, sizeof(data));
+    memcpy(data.parent, parent_stamp, FRACTYL_HASH_SIZE);
+    
+    int has_rules = 0;
+    for (int f = 0; f < 2; f++) {
+        char path[2048];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir_path, ignore_files[f]);
+        if (stat(path, &st) == 0) {
+            data.file[f][0] = st.st_mtim.tv_sec;
+            data.file[f][1] = st.st_mtim.tv_nsec;
+            data.file[f][2] = st.st_size;
+            data.file[f][3] = st.st_ino;
+            has_rules = 1;
+        } else {
+            data.file[f][0] = -1;
+        }
+    }
+    
+    memset(stamp, 0, FRACTYL_HASH_SIZE);
+    hash_data(&data, sizeof(data), stamp);
+    return has_rules;
+}
+
+// Record a directory so that the next scan reads it again
+static void record_unsettled(new_file_scan_t *scan, const char *rel_path, const struct stat *dir_st,
+                             const unsigned char *stamp) {
+    struct stat st = *dir_st;
+    st.st_mtime = 0;
+    st.st_mtim.tv_nsec = 0;
+    binary_index_update_directory(scan->index, rel_path, &st, 0, stamp);
+}
+
+// Store a file the binary index does not know yet, adding it to both indexes
+static int add_new_file(new_file_scan_t *scan, const char *full_path, const char *rel_path,
+                        const struct stat *st) {
+    unsigned char hash[32];
+    int result = object_store_file(full_path, scan->fractyl_dir, hash);
+    if (result != FRACTYL_OK) return result;
+    
+    index_entry_t new_entry;
+    memset(&new_entry, 0, sizeof(new_entry));
+    new_entry.path = (char *)rel_path;
+    index_entry_set_stat(&new_entry, st, time(NULL));
+    memcpy(new_entry.hash, hash, 32);
+    
+    // Use fast direct append since we know no duplicates exist
+    result = index_add_entry_direct(scan->new_index, &new_entry);
+    if (result != FRACTYL_OK) return result;
+    
+    // Also add to binary index for future runs
+    return binary_index_update_entry(scan->index, rel_path, st, hash);
+}
+
+// Visit an unchanged directory's subdirectories without reading it
+static void visit_recorded(new_file_scan_t *scan, const char *current_path, const char *rel_path,
+                           const ignore_dir_t *dir_rules, const unsigned char *stamp) {
+    char prefix[2048];
+    size_t prefix_len = 0;
+    prefix[0] = '\0';
+    if (rel_path[0] != '\0') {
+        prefix_len = (size_t)snprintf(prefix, sizeof(prefix), "%s/", rel_path);
+        if (prefix_len >= sizeof(prefix)) return;
+    }
+    
+    size_t pos = records_lower_bound(&scan->records, prefix);
+    char name[1024];
+    while (records_next_child(&scan->records, prefix, prefix_len, &pos, name, sizeof(name))) {
+        char full_path[2048];
+        char child_rel[2048];
+        child_paths(current_path, rel_path, name, full_path, sizeof(full_path),
+                    child_rel, sizeof(child_rel));
+        traverse_for_new_files(scan, full_path, child_rel, dir_rules, stamp);
+    }
 }
 
-// Recursive helper for new file detection
-static int traverse_for_new_files(const char *current_path, const char *rel_path,
-                                  binary_index_t *index, index_t *new_index, 
-                                  const char *fractyl_dir, int *new_count) {
+// Forget the records of subdirectories that the directory no longer has
+// (or that are now ignored), and of everything below them
+static void prune_records(new_file_scan_t *scan, const char *rel_path, char **visited, size_t visited_count) {
+    char prefix[2048];
+    size_t prefix_len = 0;
+    prefix[0] = '\0';
+    if (rel_path[0] != '\0') {
+        prefix_len = (size_t)snprintf(prefix, sizeof(prefix), "%s/", rel_path);
+        if (prefix_len >= sizeof(prefix)) return;
+    }
+    
+    size_t pos = records_lower_bound(&scan->records, prefix);
+    char name[1024];
+    while (records_next_child(&scan->records, prefix, prefix_len, &pos, name, sizeof(name))) {
+        const char *key = name;
+        if (visited_count > 0 &&
+            bsearch(&key, visited, visited_count, sizeof(char *), compare_strings)) {
+            continue;
+        }
+    
+        char child_prefix[2048];
+        snprintf(child_prefix, sizeof(child_prefix), "%s%s/", prefix, name);
+        for (size_t i = records_lower_bound(&scan->records, child_prefix); i < pos; i++) {
+            const char *record = scan->records.keys[i];
+            size_t len = strlen(record);
+            char path[MAX_PATH_LENGTH];
+            if (len == 0 || len > sizeof(path)) continue;
+            memcpy(path, record, len - 1);
+            path[len - 1] = '\0';
+            binary_index_remove_directory(scan->index, path);
+        }
+    }
+}
+
+// Read a directory that changed since it was recorded, or never was
+static int read_directory(new_file_scan_t *scan, const char *current_path, const char *rel_path,
+                          const struct stat *dir_st, const ignore_dir_t *dir_rules,
+                          const unsigned char *stamp) {
     DIR *d = opendir(current_path);
-    if (!d) return FRACTYL_ERROR_IO;
+    if (!d) {
+        // Not recorded as settled: try again next time
+        record_unsettled(scan, rel_path, dir_st, stamp);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    char **visited = NULL;
+    size_t visited_count = 0;
+    size_t visited_capacity = 0;
+    arena_t names;
+    arena_init(&names);
+    uint32_t entry_count = 0;
+    int complete = 1;
+    int result = FRACTYL_OK;
     
     struct dirent *entry;
     while ((entry = readdir(d)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || 
-            strcmp(entry->d_name, "..") == 0 ||
-            strcmp(entry->d_name, ".fractyl") == 0) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
             continue;
         }
-        
-        char full_path[2048];
-        char new_rel_path[2048];
-        
-        snprintf(full_path, sizeof(full_path), "%s/%s", current_path, entry->d_name);
-        
-        if (strlen(rel_path) == 0) {
-            strcpy(new_rel_path, entry->d_name);
-        } else {
-            snprintf(new_rel_path, sizeof(new_rel_path), "%s/%s", rel_path, entry->d_name);
-        }
-        
-        // Check gitignore
-        if (should_ignore_path(current_path, full_path, new_rel_path)) {
+        entry_count++;
+        if (strcmp(entry->d_name, ".fractyl") == 0) {
             continue;
         }
-        
+    
+        char full_path[2048];
+        char new_rel_path[2048];
+        child_paths(current_path, rel_path, entry->d_name, full_path, sizeof(full_path),
+                    new_rel_path, sizeof(new_rel_path));
+    
         // Git-style d_type optimization: avoid stat() when possible
-        if (entry->d_type == DT_DIR) {
-            // Directory - check for git submodule boundary
-            if (git_is_repository_root(full_path)) {
-                // Skip git submodules/repositories to avoid crossing boundaries
+        struct stat st;
+        int have_stat = 0;
+        int is_dir = entry->d_type == DT_DIR;
+        int is_reg = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN) {
+            // Fallback to stat() when d_type is unknown
+            if (stat(full_path, &st) != 0) {
                 continue;
             }
-            traverse_for_new_files(full_path, new_rel_path, index, new_index, 
-                                 fractyl_dir, new_count);
-        } else if (entry->d_type == DT_REG) {
-            // Regular file - only stat() for metadata
-            struct stat st;
-            if (stat(full_path, &st) != 0) {
+            have_stat = 1;
+            is_dir = S_ISDIR(st.st_mode);
+            is_reg = S_ISREG(st.st_mode);
+        }
+    
+        if (is_dir) {
+            if (ignore_engine_should_ignore(scan->ignore, dir_rules, new_rel_path, 1)) {
                 continue;
             }
-            // Check if file is in binary index
-            const binary_index_entry_t *existing = binary_index_find_entry(index, new_rel_path, NULL);
-            if (!existing) {
-                // New file - add it
-                unsigned char hash[32];
-                int result = object_store_file(full_path, fractyl_dir, hash);
-                if (result == FRACTYL_OK) {
-                    index_entry_t new_entry;
-                    memset(&new_entry, 0, sizeof(new_entry));
-                    new_entry.path = strdup(new_rel_path);
-                    new_entry.mode = st.st_mode;
-                    new_entry.size = st.st_size;
-                    new_entry.mtime = st.st_mtime;
-                    memcpy(new_entry.hash, hash, 32);
-                    
-                    // Use fast direct append since we know no duplicates exist
-                    result = index_add_entry_direct(new_index, &new_entry);
-                    if (result == FRACTYL_OK) {
-                        // Also add to binary index for future runs
-                        unsigned char sha1_hash[20];
-                        memcpy(sha1_hash, hash, 20); // Use first 20 bytes for SHA-1 compatibility
-                        binary_index_update_entry(index, new_rel_path, &st, sha1_hash);
-                        (*new_count)++;
-                    }
-                    free(new_entry.path);
+            traverse_for_new_files(scan, full_path, new_rel_path, dir_rules, stamp);
+    
+            // Skipping this directory next time is only safe if the scan
+            // will know to visit the subdirectory
+            if (!binary_index_find_directory(scan->index, new_rel_path)) {
+                complete = 0;
+            }
+            if (visited_count == visited_capacity) {
+                size_t capacity = visited_capacity ? visited_capacity * 2 : 16;
+                char **grown = realloc(visited, capacity * sizeof(char *));
+                if (!grown) {
+                    result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                    break;
                 }
+                visited = grown;
+                visited_capacity = capacity;
             }
-        } else if (entry->d_type == DT_UNKNOWN) {
-            // Fallback to stat() when d_type is unknown
-            struct stat st;
-            if (stat(full_path, &st) != 0) {
+            visited[visited_count] = arena_strdup(&names, entry->d_name);
+            if (!visited[visited_count]) {
+                result = FRACTYL_ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            visited_count++;
+        } else if (is_reg) {
+            if (ignore_engine_should_ignore(scan->ignore, dir_rules, new_rel_path, 0)) {
                 continue;
             }
-            
-            if (S_ISDIR(st.st_mode)) {
-                // Directory - check for git submodule boundary
-                if (git_is_repository_root(full_path)) {
-                    // Skip git submodules/repositories to avoid crossing boundaries
-                    continue;
-                }
-                traverse_for_new_files(full_path, new_rel_path, index, new_index, 
-                                     fractyl_dir, new_count);
-            } else if (S_ISREG(st.st_mode)) {
-                // Skip large files
-                if (st.st_size > 1024 * 1024 * 1024) {
-                    printf("Skipping large file: %s (%" PRIdMAX " bytes)\n", new_rel_path, (intmax_t)st.st_size);
-                    continue;
-                }
-                
-                // Check if file is in binary index
-                const binary_index_entry_t *existing = binary_index_find_entry(index, new_rel_path, NULL);
-                if (!existing) {
-                    // New file - add it
-                    unsigned char hash[32];
-                    int result = object_store_file(full_path, fractyl_dir, hash);
-                    if (result == FRACTYL_OK) {
-                        index_entry_t new_entry;
-                        memset(&new_entry, 0, sizeof(new_entry));
-                        new_entry.path = strdup(new_rel_path);
-                        new_entry.mode = st.st_mode;
-                        new_entry.size = st.st_size;
-                        new_entry.mtime = st.st_mtime;
-                        memcpy(new_entry.hash, hash, 32);
-                        
-                        // Use fast direct append since we know no duplicates exist
-                        result = index_add_entry_direct(new_index, &new_entry);
-                        if (result == FRACTYL_OK) {
-                            // Also add to binary index for future runs
-                            unsigned char sha1_hash[20];
-                            memcpy(sha1_hash, hash, 20); // Use first 20 bytes for SHA-1 compatibility
-                            binary_index_update_entry(index, new_rel_path, &st, sha1_hash);
-                            (*new_count)++;
-                        }
-                        free(new_entry.path);
-                    }
-                }
+            // Known files are left to the stat phase
+            if (binary_index_find_entry(scan->index, new_rel_path, NULL)) {
+                continue;
             }
+            if ((!have_stat && stat(full_path, &st) != 0) ||
+                add_new_file(scan, full_path, new_rel_path, &st) != FRACTYL_OK) {
+                complete = 0;
+                continue;
+            }
+            (*scan->new_count)++;
         }
     }
-    
     closedir(d);
-    return FRACTYL_OK;
+    
+    if (result == FRACTYL_OK) {
+        if (visited_count > 1) {
+            qsort(visited, visited_count, sizeof(char *), compare_strings);
+        }
+        prune_records(scan, rel_path, visited, visited_count);
+    
+        // One modified in this second of the scan could still change
+        // unnoticed within the mtime's resolution
+        if (complete && dir_st->st_mtime < scan->scan_start) {
+            binary_index_update_directory(scan->index, rel_path, dir_st, entry_count, stamp);
+        } else {
+            record_unsettled(scan, rel_path, dir_st, stamp);
+        }
+    }
+    
+    free(visited);
+    arena_free(&names);
+    return result;
+}
+
+// Look for new files in the directory at rel_path, reading it only if it
+// changed since it was last recorded
+static int traverse_for_new_files(new_file_scan_t *scan, const char *current_path, const char *rel_path,
+                                  const ignore_dir_t *parent_rules, const unsigned char *parent_stamp) {
+    // Stat before reading, so that an entry added meanwhile leaves the
+    // directory with another mtime than the one recorded
+    struct stat dir_st;
+    if (stat(current_path, &dir_st) != 0) {
+        return FRACTYL_ERROR_IO;
+    }
+    
+    unsigned char stamp[FRACTYL_HASH_SIZE];
+    int has_rules = ignore_stamp(current_path, parent_stamp, stamp);
+    int unchanged = binary_index_check_directory(scan->index, rel_path, &dir_st, stamp) ==
+                    BINARY_FILE_UNCHANGED;
+    
+    // Directory - check for git submodule boundary. Submodules keep a
+    // record so that their parent can be skipped, and are checked again
+    // on every scan.
+    if (!unchanged && rel_path[0] != '\0' && git_is_repository_root(current_path)) {
+        record_unsettled(scan, rel_path, &dir_st, stamp);
+        return FRACTYL_OK;
+    }
+    
+    // The root's rules are the engine's root node already
+    const ignore_dir_t *dir_rules = parent_rules;
+    if (has_rules && rel_path[0] != '\0') {
+        dir_rules = ignore_engine_enter_dir(scan->ignore, parent_rules, rel_path);
+    }
+    
+    if (unchanged) {
+        visit_recorded(scan, current_path, rel_path, dir_rules, stamp);
+        return FRACTYL_OK;
+    }
+    return read_directory(scan, current_path, rel_path, &dir_st, dir_rules, stamp);
+}
+
+// Helper function to scan for new files only (not in binary index)
+static int scan_for_new_files_only(const char *root_path, binary_index_t *index,
+                                   index_t *new_index, const char *fractyl_dir, int *new_count) {
+    *new_count = 0;
+    
+    new_file_scan_t scan = {
+        .index = index,
+        .new_index = new_index,
+        .fractyl_dir = fractyl_dir,
+        .scan_start = time(NULL),
+        .new_count = new_count,
+    };
+    int result = load_dir_records(index, &scan.records);
+    if (result != FRACTYL_OK) {
+        free(scan.records.keys);
+        return result;
+    }
+    
+    scan.ignore = ignore_engine_create(root_path);
+    if (!scan.ignore) {
+        free(scan.records.keys);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    // Quick directory traversal looking for files not in index
+    unsigned char root_stamp[FRACTYL_HASH_SIZE] = {0};
+    result = traverse_for_new_files(&scan, root_path, "", ignore_engine_root(scan.ignore), root_stamp);
+    ignore_engine_free(scan.ignore);
+    free(scan.records.keys);
+    return result;
 }
 
 // Pure stat-only scanning - ultimate Git-style performance
@@ -1098,185 +2192,14 @@ int scan_directory_stat_only(const char *root_path, index_t *new_index,
         return scan_directory_binary(root_path, new_index, prev_index, fractyl_dir, branch);
     }
     
-    // Statistics
-    int files_unchanged = 0;
-    int files_changed = 0;
-    int files_deleted = 0;
-    
     phase_start = time(NULL);
     
     // Pure parallel stat checking - the fastest possible approach
-    const int STAT_THREADS = 8; // Optimal for most systems
-    // Pure stat-only mode scanning
-    
-    // Create parallel stat work data similar to Git's preload_thread
-    char **file_paths = malloc(binary_index.header.entry_count * sizeof(char*));
-    const char **rel_paths = malloc(binary_index.header.entry_count * sizeof(char*));
-    struct stat *stat_results = malloc(binary_index.header.entry_count * sizeof(struct stat));
-    int *stat_success = malloc(binary_index.header.entry_count * sizeof(int));
-    
-    if (!file_paths || !rel_paths || !stat_results || !stat_success) {
-        printf("Error: Could not allocate memory for parallel stat\n");
-        free(file_paths); free(rel_paths); free(stat_results); free(stat_success);
+    known_file_counts_t counts = { 0, 0, 0 };
+    result = check_known_files(root_path, fractyl_dir, &binary_index, prev_index, new_index, &counts);
+    if (result != FRACTYL_OK) {
         binary_index_free(&binary_index);
-        return FRACTYL_ERROR_OUT_OF_MEMORY;
-    }
-    
-    // Populate file paths from binary index (no directory scanning needed!)
-    binary_index_iterator_t iter;
-    binary_index_iterator_init(&iter, &binary_index);
-    const char *rel_path;
-    const binary_index_entry_t *entry;
-    size_t file_count = 0;
-    
-    while (binary_index_iterator_next(&iter, &rel_path, &entry)) {
-        // Allocate full path
-        file_paths[file_count] = malloc(strlen(root_path) + strlen(rel_path) + 2);
-        sprintf(file_paths[file_count], "%s/%s", root_path, rel_path);
-        rel_paths[file_count] = rel_path; // Reference to binary index string
-        file_count++;
-    }
-    
-    // Parallel stat phase
-    
-    // Create stat worker threads (like Git's preload_index)
-    pthread_t threads[STAT_THREADS];
-    preload_data_t thread_data[STAT_THREADS];
-    size_t files_per_thread = file_count / STAT_THREADS;
-    
-    for (int i = 0; i < STAT_THREADS; i++) {
-        thread_data[i].file_paths = file_paths;
-        thread_data[i].rel_paths = rel_paths;
-        thread_data[i].stat_results = stat_results;
-        thread_data[i].stat_success = stat_success;
-        thread_data[i].start_idx = i * files_per_thread;
-        thread_data[i].end_idx = (i == STAT_THREADS - 1) ? file_count : (i + 1) * files_per_thread;
-        thread_data[i].thread_id = i;
-        
-        pthread_create(&threads[i], NULL, preload_stat_worker, &thread_data[i]);
-    }
-    
-    // Wait for all stat operations to complete
-    for (int i = 0; i < STAT_THREADS; i++) {
-        pthread_join(threads[i], NULL);
-    }
-    
-    // Processing results
-    
-    // Build hash table for O(1) previous index lookups (fixes O(n²) bottleneck!)
-    typedef struct prev_entry_hash {
-        const char *path;
-        const index_entry_t *entry;
-        struct prev_entry_hash *next;
-    } prev_entry_hash_t;
-    
-    const int HASH_SIZE = 65536; // Power of 2 for fast modulo
-    prev_entry_hash_t **prev_hash_table = NULL;
-    
-    if (prev_index && prev_index->count > 0) {
-        prev_hash_table = calloc(HASH_SIZE, sizeof(prev_entry_hash_t*));
-        if (prev_hash_table) {
-            // Build hash table from previous index
-            for (size_t i = 0; i < prev_index->count; i++) {
-                const index_entry_t *entry = &prev_index->entries[i];
-                if (entry->path) {
-                    // Simple hash function
-                    uint32_t hash = 0;
-                    for (const char *p = entry->path; *p; p++) {
-                        hash = hash * 31 + *p;
-                    }
-                    int bucket = hash & (HASH_SIZE - 1);
-                    
-                    prev_entry_hash_t *hash_entry = malloc(sizeof(prev_entry_hash_t));
-                    if (hash_entry) {
-                        hash_entry->path = entry->path;
-                        hash_entry->entry = entry;
-                        hash_entry->next = prev_hash_table[bucket];
-                        prev_hash_table[bucket] = hash_entry;
-                    }
-                }
-            }
-            // Built hash table for previous entries
-        }
-    }
-    
-    // Process stat results sequentially with O(1) hash lookups
-    binary_index_iterator_init(&iter, &binary_index);
-    size_t file_idx = 0;
-    
-    while (binary_index_iterator_next(&iter, &rel_path, &entry)) {
-        if (!stat_success[file_idx] || !S_ISREG(stat_results[file_idx].st_mode)) {
-            // File deleted or no longer regular file
-            files_deleted++;
-            file_idx++;
-            continue;
-        }
-        
-        // Check file status using binary index
-        binary_file_status_t status = binary_index_check_file(&binary_index, rel_path, &stat_results[file_idx]);
-        
-        if (status == BINARY_FILE_UNCHANGED) {
-            // File unchanged - copy from previous index if available
-            const index_entry_t *prev_entry = NULL;
-            if (prev_hash_table) {
-                // O(1) hash table lookup instead of O(n) linear search
-                uint32_t hash = 0;
-                for (const char *p = rel_path; *p; p++) {
-                    hash = hash * 31 + *p;
-                }
-                int bucket = hash & (HASH_SIZE - 1);
-                
-                for (prev_entry_hash_t *h = prev_hash_table[bucket]; h; h = h->next) {
-                    if (strcmp(h->path, rel_path) == 0) {
-                        prev_entry = h->entry;
-                        break;
-                    }
-                }
-            }
-            
-            if (prev_entry) {
-                // Use fast direct append since we know no duplicates exist
-                result = index_add_entry_direct(new_index, prev_entry);
-                if (result != FRACTYL_OK) {
-                    file_idx++;
-                    continue; // Skip on error
-                }
-                
-                files_unchanged++;
-                file_idx++;
-                continue;
-            }
-            // If no prev_index, need to hash file anyway
-            status = BINARY_FILE_CHANGED;
-        }
-        
-        if (status == BINARY_FILE_CHANGED) {
-            // File changed - hash it
-            unsigned char hash[32];
-            result = object_store_file(file_paths[file_idx], fractyl_dir, hash);
-            if (result == FRACTYL_OK) {
-                index_entry_t new_entry;
-                memset(&new_entry, 0, sizeof(new_entry));
-                new_entry.path = strdup(rel_path);
-                new_entry.mode = stat_results[file_idx].st_mode;
-                new_entry.size = stat_results[file_idx].st_size;
-                new_entry.mtime = stat_results[file_idx].st_mtime;
-                memcpy(new_entry.hash, hash, 32);
-                
-                // Fast direct assignment without O(n) duplicate checking
-                // Use fast direct append since we know no duplicates exist
-                result = index_add_entry_direct(new_index, &new_entry);
-                if (result == FRACTYL_OK) {
-                    // Update binary index
-                    unsigned char sha1_hash[20];
-                    memcpy(sha1_hash, hash, 20); // Use first 20 bytes for SHA-1 compatibility
-                    binary_index_update_entry(&binary_index, rel_path, &stat_results[file_idx], sha1_hash);
-                    files_changed++;
-                }
-                free(new_entry.path);
-            }
-        }
-        file_idx++;
+        return result;
     }
     
     // Stat-only phase complete
@@ -1288,12 +2211,12 @@ int scan_directory_stat_only(const char *root_path, index_t *new_index,
     // Always do new file detection unless explicitly disabled
     // This ensures we catch new files even when existing files are unchanged
     // Quick new file check
-        
+    
         phase_start = time(NULL);
         int files_new = 0;
         int new_files_found = scan_for_new_files_only(root_path, &binary_index, 
                                                      new_index, fractyl_dir, &files_new);
-        
+    
         if (new_files_found > 0) {
             printf("Found %d new files (%.3fs)\n", 
                    files_new, difftime(time(NULL), phase_start));
@@ -1310,30 +2233,620 @@ int scan_directory_stat_only(const char *root_path, index_t *new_index,
         // Binary index saved
     }
     
-    // Cleanup hash table
-    if (prev_hash_table) {
-        for (int i = 0; i < HASH_SIZE; i++) {
-            prev_entry_hash_t *h = prev_hash_table[i];
-            while (h) {
-                prev_entry_hash_t *next = h->next;
-                free(h);
-                h = next;
+    
+    // Cleanup
+    binary_index_free(&binary_index);
+    
+    // Stat-only scan complete
+    
+    return FRACTYL_OK;
+}
+
+// --- Incremental scan of known changed paths ---
+
+typedef enum {
+    DIRTY_GONE,     // Deleted, no longer a regular file/dir, or now ignored
+    DIRTY_FILE,     // Regular file to re-hash
+    DIRTY_DIR       // Directory to walk again
+} dirty_kind_t;
+
+// Is any proper ancestor directory of path a member of set?
+static int has_ancestor_in(const index_t *set, const char *path) {
+    char prefix[2048];
+    
+    for (const char *slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t len = (size_t)(slash - path);
+        if (len >= sizeof(prefix)) break;
+        memcpy(prefix, path, len);
+        prefix[len] = '\0';
+        if (index_find_entry(set, prefix)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Resolve the ignore rules that apply inside rel_path's parent directory,
+// entering every ancestor on the way. Sets *ignored when an ancestor (or
+// the path itself) is excluded.
+static const ignore_dir_t* ignore_rules_for_path(ignore_engine_t *ignore, const char *rel_path,
+                                                 int is_directory, int *ignored) {
+    const ignore_dir_t *rules = ignore_engine_root(ignore);
+    char prefix[2048];
+    *ignored = 0;
+    
+    for (const char *slash = strchr(rel_path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t len = (size_t)(slash - rel_path);
+        if (len >= sizeof(prefix)) break;
+        memcpy(prefix, rel_path, len);
+        prefix[len] = '\0';
+    
+        if (ignore_engine_should_ignore(ignore, rules, prefix, 1)) {
+            *ignored = 1;
+            return rules;
+        }
+        rules = ignore_engine_enter_dir(ignore, rules, prefix);
+    }
+    
+    *ignored = ignore_engine_should_ignore(ignore, rules, rel_path, is_directory);
+    return rules;
+}
+
+// Hash (or reuse the previous hash of) one regular file and add it
+static void incremental_add_file(const char *full_path, const char *rel_path, const struct stat *st,
+                                 index_t *new_index, prev_cursor_t *prev,
+                                 const char *fractyl_dir, time_t scan_start) {
+    index_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.path = (char*)rel_path;
+    index_entry_set_stat(&entry, st, scan_start);
+    
+    const index_entry_t *prev_entry = prev_cursor_find(prev, rel_path);
+    int matched = index_entry_stat_matches(prev_entry, st);
+    count_stat_check(prev_entry, matched);
+    if (matched) {
+        memcpy(entry.hash, prev_entry->hash, 32);
+    } else if (object_store_file(full_path, fractyl_dir, entry.hash) != FRACTYL_OK) {
+        printf("Warning: Failed to store file %s\n", rel_path);
+        return;
+    }
+    
+    index_add_entry(new_index, &entry);
+}
+
+static void incremental_walk_dir(const char *full_dir, const char *rel_dir, ignore_engine_t *ignore,
+                                 const ignore_dir_t *parent_rules, index_t *new_index,
+                                 prev_cursor_t *prev, const char *fractyl_dir,
+                                 time_t scan_start) {
+    DIR *d = opendir(full_dir);
+    if (!d) return;
+    
+    const ignore_dir_t *dir_rules = ignore_engine_enter_dir(ignore, parent_rules, rel_dir);
+    
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || 
+            strcmp(entry->d_name, "..") == 0 ||
+            strcmp(entry->d_name, ".fractyl") == 0) {
+            continue;
+        }
+    
+        char full_path[2048];
+        char rel_path[2048];
+        snprintf(full_path, sizeof(full_path), "%s/%s", full_dir, entry->d_name);
+        snprintf(rel_path, sizeof(rel_path), "%s/%s", rel_dir, entry->d_name);
+    
+        struct stat st;
+        if (lstat(full_path, &st) != 0) {
+            continue;
+        }
+        if (ignore_engine_should_ignore(ignore, dir_rules, rel_path, S_ISDIR(st.st_mode))) {
+            continue;
+        }
+    
+        if (S_ISDIR(st.st_mode)) {
+            if (git_is_repository_root(full_path)) {
+                continue;
             }
+            incremental_walk_dir(full_path, rel_path, ignore, dir_rules, new_index, prev, fractyl_dir,
+                                 scan_start);
+        } else if (S_ISREG(st.st_mode)) {
+            incremental_add_file(full_path, rel_path, &st, new_index, prev, fractyl_dir, scan_start);
         }
-        free(prev_hash_table);
     }
     
-    // Cleanup
-    for (size_t i = 0; i < file_count; i++) {
-        free(file_paths[i]);
+    closedir(d);
+}
+
+// Entries [start, end) of a sorted index
+typedef struct {
+    size_t start;
+    size_t end;
+} entry_range_t;
+
+static int compare_ranges(const void *a, const void *b) {
+    const entry_range_t *ra = a, *rb = b;
+    return ra->start < rb->start ? -1 : ra->start > rb->start;
+}
+
+// Position of the first entry of a sorted index that does not sort before key
+static size_t sorted_lower_bound(const index_t *index, const char *key) {
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(index->entries[mid].path, key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Copy the entries of sorted prev_index that are not at or below one of
+// paths. Each path's own entry and the run of entries under "path/" are
+// skipped, so the rest goes over in runs, in order, without a lookup per
+// entry; a path's siblings such as "path.txt" sort between the two.
+static int carry_over_sorted(index_t *new_index, const index_t *prev_index,
+                             const char *const *paths, size_t path_count) {
+    entry_range_t *ranges = malloc((2 * path_count + 1) * sizeof(entry_range_t));
+    if (!ranges) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    size_t range_count = 0;
+    for (size_t i = 0; i < path_count; i++) {
+        char key[2048];
+        size_t start = sorted_lower_bound(prev_index, paths[i]);
+        if (start < prev_index->count && strcmp(prev_index->entries[start].path, paths[i]) == 0) {
+            ranges[range_count].start = start;
+            ranges[range_count++].end = start + 1;
+        }
+        // Below the path: from "path/" up to "path0", '0' following '/'
+        if (snprintf(key, sizeof(key), "%s/", paths[i]) >= (int)sizeof(key)) continue;
+        start = sorted_lower_bound(prev_index, key);
+        key[strlen(key) - 1] = '0';
+        ranges[range_count].start = start;
+        ranges[range_count++].end = sorted_lower_bound(prev_index, key);
+    }
+    if (range_count > 1) qsort(ranges, range_count, sizeof(entry_range_t), compare_ranges);
+    ranges[range_count].start = ranges[range_count].end = prev_index->count;
+    
+    size_t at = 0;
+    for (size_t r = 0; r <= range_count; r++) {
+        for (; at < ranges[r].start; at++) {
+            if (index_add_entry_direct(new_index, &prev_index->entries[at]) != FRACTYL_OK) {
+                free(ranges);
+                return FRACTYL_ERROR_OUT_OF_MEMORY;
+            }
+        }
+        if (ranges[r].end > at) at = ranges[r].end;
+    }
+    free(ranges);
+    return FRACTYL_OK;
+}
+
+int scan_paths_incremental(const char *root_path, index_t *new_index,
+                           const index_t *prev_index, const char *fractyl_dir,
+                           const char *const *paths, size_t path_count, ignore_engine_t *ignore) {
+    if (!root_path || !new_index || !fractyl_dir || (!paths && path_count > 0)) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    if (!prev_index) {
+        // Nothing to carry over
+        return scan_directory_parallel(root_path, new_index, NULL, fractyl_dir);
     }
-    free(file_paths);
-    free(rel_paths);
-    free(stat_results);
-    free(stat_success);
-    binary_index_free(&binary_index);
     
-    // Stat-only scan complete
+    ignore_engine_t *own_ignore = ignore ? NULL : ignore_engine_create(root_path);
+    if (!ignore) ignore = own_ignore;
+    dirty_kind_t *kinds = calloc(path_count ? path_count : 1, sizeof(dirty_kind_t));
+    if (!ignore || !kinds) {
+        ignore_engine_free(own_ignore);
+        free(kinds);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    printf("Rescanning %zu changed paths\n", path_count);
+    time_t scan_start = time(NULL);
+    
+    // Classify every changed path. Paths that are gone or now a directory
+    // invalidate everything previously recorded below them. Both sets are
+    // index_t used purely for their path lookup table.
+    index_t dropped;
+    index_t walked;
+    index_init(&dropped);
+    index_init(&walked);
+    for (size_t i = 0; i < path_count; i++) {
+        char full_path[2048];
+        snprintf(full_path, sizeof(full_path), "%s/%s", root_path, paths[i]);
+    
+        struct stat st;
+        int exists = lstat(full_path, &st) == 0;
+        int ignored = 0;
+        if (exists) {
+            ignore_rules_for_path(ignore, paths[i], S_ISDIR(st.st_mode), &ignored);
+        }
+    
+        if (!exists || ignored || !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)) ||
+            (S_ISDIR(st.st_mode) && git_is_repository_root(full_path))) {
+            kinds[i] = DIRTY_GONE;
+        } else {
+            kinds[i] = S_ISDIR(st.st_mode) ? DIRTY_DIR : DIRTY_FILE;
+        }
+    
+        index_entry_t marker;
+        memset(&marker, 0, sizeof(marker));
+        marker.path = (char*)paths[i];
+        index_add_entry(&dropped, &marker);
+        if (kinds[i] == DIRTY_DIR) {
+            index_add_entry(&walked, &marker);
+        }
+    }
+    index_prepare_lookup(&dropped);
+    index_prepare_lookup(&walked);
+    
+    // Carry over every previous entry that is not at or below a changed path
+    prev_cursor_t prev;
+    prev_cursor_init(&prev, prev_index);
+    int result = FRACTYL_OK;
+    if (prev.sorted) {
+        result = carry_over_sorted(new_index, prev_index, paths, path_count);
+    } else {
+        for (size_t i = 0; i < prev_index->count; i++) {
+            const index_entry_t *prev_entry = &prev_index->entries[i];
+            if (index_find_entry(&dropped, prev_entry->path) ||
+                has_ancestor_in(&dropped, prev_entry->path)) {
+                continue;
+            }
+            index_add_entry_direct(new_index, prev_entry);
+        }
+    }
+    
+    // Re-hash changed files and re-walk changed directories, into an index
+    // of their own that is merged in afterwards
+    index_t scanned;
+    index_init(&scanned);
+    for (size_t i = 0; result == FRACTYL_OK && i < path_count; i++) {
+        if (kinds[i] == DIRTY_GONE) continue;
+    
+        // A directory that is itself being re-walked covers this path
+        if (has_ancestor_in(&walked, paths[i])) continue;
+    
+        char full_path[2048];
+        snprintf(full_path, sizeof(full_path), "%s/%s", root_path, paths[i]);
+    
+        int ignored = 0;
+        const ignore_dir_t *rules = ignore_rules_for_path(ignore, paths[i], kinds[i] == DIRTY_DIR,
+                                                          &ignored);
+        if (kinds[i] == DIRTY_DIR) {
+            incremental_walk_dir(full_path, paths[i], ignore, rules, &scanned, &prev, fractyl_dir,
+                                 scan_start);
+        } else {
+            struct stat st;
+            if (lstat(full_path, &st) == 0 && S_ISREG(st.st_mode)) {
+                incremental_add_file(full_path, paths[i], &st, &scanned, &prev, fractyl_dir,
+                                     scan_start);
+            }
+        }
+    }
+    
+    index_free(&dropped);
+    index_free(&walked);
+    free(kinds);
+    ignore_engine_free(own_ignore);
+    
+    // Keep the same path order a full scan produces: what was carried over
+    // already is, so sorting the rescanned entries and merging them will do
+    if (result == FRACTYL_OK) {
+        index_sort(&scanned, scan_thread_count());
+        result = index_merge_shards(new_index, &scanned, 1, scan_thread_count());
+    }
+    index_free(&scanned);
+    if (result != FRACTYL_OK) return result;
     
+    printf("Found %zu files\n", new_index->count);
+    return FRACTYL_OK;
+}
+
+// --- Checking that nothing changed ---
+//
+// Most snapshots, above all a daemon's, find nothing to take. Before a
+// scan builds a new index, a walk compares the tree with the previous
+// index: one path buffer the names are appended to in place, one statx
+// batch per directory into arrays every directory reuses, and nothing
+// copied or allocated per file. It stops at the first file that is new,
+// gone or does not match its stat data.
+
+typedef struct {
+    const index_t *prev;
+    ignore_engine_t *ignore;
+    fast_stat_ctx_t stat_ctx;
+    char path[PATH_MAX];        // root_path, then '/' and the relative path
+    size_t rel_start;
+    size_t *to_stat;
+    struct stat *stats;
+    int *ok;
+    size_t capacity;
+    size_t found;               // Files of prev seen so far
+    unsigned long long stat_calls;
+    unsigned long long dir_reads;
+} unchanged_walk_t;
+
+static int walk_reserve(unchanged_walk_t *walk, size_t count) {
+    if (count <= walk->capacity) return FRACTYL_OK;
+    size_t capacity = walk->capacity ? walk->capacity : 256;
+    while (capacity < count) capacity *= 2;
+    size_t *to_stat = realloc(walk->to_stat, capacity * sizeof(size_t));
+    if (to_stat) walk->to_stat = to_stat;
+    struct stat *stats = realloc(walk->stats, capacity * sizeof(struct stat));
+    if (stats) walk->stats = stats;
+    int *ok = realloc(walk->ok, capacity * sizeof(int));
+    if (ok) walk->ok = ok;
+    if (!to_stat || !stats || !ok) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    walk->capacity = capacity;
     return FRACTYL_OK;
 }
+
+// Append name to the directory at walk->path[0, len); 0 if it does not fit
+static int walk_append(unchanged_walk_t *walk, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+    if (len + 1 + name_len >= sizeof(walk->path)) return 0;
+    walk->path[len] = '/';
+    memcpy(walk->path + len + 1, name, name_len + 1);
+    return 1;
+}
+
+// 1 while the directory at walk->path[0, len) and everything below it is
+// as prev has it, 0 as soon as something is not or cannot be told
+static int walk_unchanged(unchanged_walk_t *walk, size_t len, const ignore_dir_t *parent_rules) {
+    walk->path[len] = '\0';
+    const char *rel = len > walk->rel_start ? walk->path + walk->rel_start + 1 : "";
+    
+    fast_dir_t dir;
+    int result = fast_dir_open(&dir, walk->path);
+    if (result == FRACTYL_ERROR_IO) return 1;  // Scans skip unreadable directories too
+    if (result != FRACTYL_OK) return 0;
+    walk->dir_reads++;
+    
+    // The same entries the scan takes (scan_dir_batched): nested
+    // repositories are left out, and only directories with ignore files of
+    // their own are entered in the ignore engine
+    int has_rules = 0;
+    for (size_t i = 0; i < dir.count; i++) {
+        const char *name = dir.entries[i].name;
+        if (rel[0] != '\0' && strcmp(name, ".git") == 0) {
+            fast_dir_close(&dir);
+            return 1;
+        }
+        if (strcmp(name, ".gitignore") == 0 || strcmp(name, ".fractylignore") == 0) has_rules = 1;
+    }
+    const ignore_dir_t *rules = has_rules ? ignore_engine_enter_dir(walk->ignore, parent_rules, rel)
+                                          : parent_rules;
+    if (walk_reserve(walk, dir.count) != FRACTYL_OK) {
+        fast_dir_close(&dir);
+        return 0;
+    }
+    
+    size_t stat_count = 0;
+    for (size_t i = 0; i < dir.count; i++) {
+        fast_dirent_t *entry = &dir.entries[i];
+        if (strcmp(entry->name, ".fractyl") == 0) continue;
+        if (entry->type == DT_REG) {
+            if (!walk_append(walk, len, entry->name)) goto changed;
+            if (ignore_engine_should_ignore(walk->ignore, rules, walk->path + walk->rel_start + 1, 0)) {
+                continue;
+            }
+            walk->to_stat[stat_count++] = i;
+        } else if (entry->type == DT_UNKNOWN) {
+            walk->to_stat[stat_count++] = i;
+        }
+    }
+    unsigned long long stat_started = profile_begin();
+    fast_dir_stat(&walk->stat_ctx, &dir, walk->to_stat, stat_count, walk->stats, walk->ok);
+    profile_end(PROFILE_STAT, stat_started);
+    walk->stat_calls += stat_count;
+    
+    for (size_t k = 0; k < stat_count; k++) {
+        if (!walk->ok[k]) continue;
+        fast_dirent_t *entry = &dir.entries[walk->to_stat[k]];
+        const struct stat *st = &walk->stats[k];
+        if (!walk_append(walk, len, entry->name)) goto changed;
+        const char *path = walk->path + walk->rel_start + 1;
+        if (entry->type == DT_UNKNOWN) {
+            if (ignore_engine_should_ignore(walk->ignore, rules, path, S_ISDIR(st->st_mode))) continue;
+            if (S_ISDIR(st->st_mode)) {
+                entry->type = DT_DIR;  // Walked with the others below
+                continue;
+            }
+        }
+        if (!S_ISREG(st->st_mode)) continue;
+        if (!index_entry_stat_matches(index_find_entry(walk->prev, path), st)) goto changed;
+        walk->found++;
+    }
+    
+    // Subdirectories last, once the arrays are free for them
+    for (size_t i = 0; i < dir.count; i++) {
+        const fast_dirent_t *entry = &dir.entries[i];
+        if (entry->type != DT_DIR || strcmp(entry->name, ".fractyl") == 0) continue;
+        if (!walk_append(walk, len, entry->name)) goto changed;
+        if (ignore_engine_should_ignore(walk->ignore, rules, walk->path + walk->rel_start + 1, 1)) {
+            continue;
+        }
+        if (!walk_unchanged(walk, len + 1 + strlen(entry->name), rules)) goto changed;
+    }
+    fast_dir_close(&dir);
+    return 1;
+    
+changed:
+    fast_dir_close(&dir);
+    return 0;
+}
+
+int scan_tree_unchanged(const char *root_path, const index_t *prev_index) {
+    if (!root_path || !prev_index) return 0;
+    
+    unchanged_walk_t walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.prev = prev_index;
+    walk.rel_start = strlen(root_path);
+    if (walk.rel_start + 2 >= sizeof(walk.path)) return 0;
+    memcpy(walk.path, root_path, walk.rel_start + 1);
+    
+    // Compiled for this walk alone, so rules changed outside the tree
+    // (.git/info/exclude) are never missed
+    walk.ignore = ignore_engine_create(root_path);
+    if (!walk.ignore || index_prepare_lookup(prev_index) != FRACTYL_OK) {
+        ignore_engine_free(walk.ignore);
+        return 0;
+    }
+    fast_stat_init(&walk.stat_ctx);
+    
+    int unchanged = walk_unchanged(&walk, walk.rel_start, ignore_engine_root(walk.ignore)) &&
+                    walk.found == prev_index->count;
+    
+    counters_add(COUNTER_STAT_CALLS, walk.stat_calls);
+    counters_add(COUNTER_DIR_READS, walk.dir_reads);
+    if (unchanged) {
+        // A scan would have counted each file as a stat hit
+        counters_add(COUNTER_FILES_SCANNED, walk.found);
+        counters_add(COUNTER_STAT_HITS, walk.found);
+    }
+    
+    fast_stat_free(&walk.stat_ctx);
+    ignore_engine_free(walk.ignore);
+    free(walk.to_stat);
+    free(walk.stats);
+    free(walk.ok);
+    return unchanged;
+}
+
+static const char *const scan_engine_names[] = {
+    [SCAN_ENGINE_AUTO] = "auto",
+    [SCAN_ENGINE_PARALLEL] = "parallel",
+    [SCAN_ENGINE_CACHED] = "cached",
+    [SCAN_ENGINE_BINARY] = "binary",
+    [SCAN_ENGINE_STAT_ONLY] = "stat-only"
+};
+
+int scan_engine_parse(const char *name, scan_engine_t *engine) {
+    if (!name || !engine) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    for (size_t i = 0; i < sizeof(scan_engine_names) / sizeof(scan_engine_names[0]); i++) {
+        if (strcmp(name, scan_engine_names[i]) == 0) {
+            *engine = (scan_engine_t)i;
+            return FRACTYL_OK;
+        }
+    }
+    return FRACTYL_ERROR_INVALID_ARGS;
+}
+
+const char* scan_engine_name(scan_engine_t engine) {
+    if ((size_t)engine >= sizeof(scan_engine_names) / sizeof(scan_engine_names[0])) {
+        return "unknown";
+    }
+    return scan_engine_names[engine];
+}
+
+// Replace the branch's binary index with the stat data of a fresh full scan.
+// Its creation timestamp then marks the last full traversal for auto mode.
+static int rebuild_binary_index(const char *root_path, const index_t *index,
+                                const char *fractyl_dir, const char *branch,
+                                time_t scan_start) {
+    binary_index_t binary_index;
+    int result = binary_index_init(&binary_index, branch);
+    if (result != FRACTYL_OK) return result;
+    binary_index.header.timestamp = scan_start;
+    
+    for (size_t i = 0; i < index->count; i++) {
+        const index_entry_t *entry = &index->entries[i];
+    
+        char full_path[2048];
+        snprintf(full_path, sizeof(full_path), "%s/%s", root_path, entry->path);
+    
+        struct stat st;
+        if (stat(full_path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+    
+        // Racy files may have changed after they were hashed in the same
+        // second; a zero mtime makes the next binary scan hash them again
+        if (st.st_mtime >= scan_start) {
+            st.st_mtime = 0;
+        }
+    
+        result = binary_index_update_entry(&binary_index, entry->path, &st, entry->hash);
+        if (result != FRACTYL_OK) break;
+    }
+    
+    if (result == FRACTYL_OK) {
+        result = binary_index_save(&binary_index, fractyl_dir);
+    }
+    binary_index_free(&binary_index);
+    return result;
+}
+
+// Parallel scan for the auto engine, leaving its stat data in the binary
+// index for the next run
+static int scan_full_traversal(const char *root_path, index_t *new_index, const index_t *prev_index,
+                               const char *fractyl_dir, const char *branch) {
+    time_t scan_start = time(NULL);
+    int result = scan_directory_parallel(root_path, new_index, prev_index, fractyl_dir);
+    if (result == FRACTYL_OK &&
+        rebuild_binary_index(root_path, new_index, fractyl_dir, branch, scan_start) != FRACTYL_OK) {
+        printf("Warning: Could not rebuild binary index\n");
+    }
+    return result;
+}
+
+// The binary engine is only trusted while its index is younger than full_interval
+static int binary_index_is_fresh(const index_t *prev_index, const char *fractyl_dir,
+                                 const char *branch, long full_interval) {
+    if (!prev_index || prev_index->count == 0) {
+        return 0;
+    }
+    
+    binary_index_header_t header;
+    if (binary_index_load_header(&header, fractyl_dir, branch) != FRACTYL_OK ||
+        header.entry_count == 0) {
+        return 0;
+    }
+    
+    time_t age = time(NULL) - (time_t)header.timestamp;
+    return age >= 0 && age < full_interval;
+}
+
+int scan_directory_engine(scan_engine_t engine, const char *root_path, index_t *new_index,
+                          const index_t *prev_index, const char *fractyl_dir,
+                          const char *branch, long full_interval) {
+    if (!root_path || !new_index || !fractyl_dir) return FRACTYL_ERROR_INVALID_ARGS;
+    if (!branch) branch = "default";
+    if (full_interval <= 0) full_interval = SCAN_AUTO_FULL_INTERVAL;
+    
+    int result;
+    switch (engine) {
+        case SCAN_ENGINE_PARALLEL:
+            return scan_directory_parallel(root_path, new_index, prev_index, fractyl_dir);
+        case SCAN_ENGINE_CACHED:
+            result = scan_directory_cached(root_path, new_index, prev_index, fractyl_dir, branch);
+            break;
+        case SCAN_ENGINE_BINARY:
+            result = scan_directory_binary(root_path, new_index, prev_index, fractyl_dir, branch);
+            break;
+        case SCAN_ENGINE_STAT_ONLY:
+            result = scan_directory_stat_only(root_path, new_index, prev_index, fractyl_dir, branch);
+            break;
+        case SCAN_ENGINE_AUTO:
+            if (binary_index_is_fresh(prev_index, fractyl_dir, branch, full_interval)) {
+                printf("Scan engine: binary (index is fresh)\n");
+                result = scan_directory_binary(root_path, new_index, prev_index, fractyl_dir, branch);
+                break;
+            }
+    
+            printf("Scan engine: parallel (full traversal)\n");
+            return scan_full_traversal(root_path, new_index, prev_index, fractyl_dir, branch);
+        default:
+            return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    // Only the parallel engine produces a sorted index; callers compare
+    // indexes entry by entry, so keep the invariant for every engine
+    if (result == FRACTYL_OK) {
+        result = index_sort(new_index, scan_thread_count());
+    }
+    return result;
+}
@@ -2,12 +2,24 @@
 #define PARALLEL_SCAN_H
 
 #include "../include/core.h"
+#include "gitignore.h"
+#include "scan_journal.h"
 
 // Scan directory tree in parallel using multiple threads
 // Returns FRACTYL_OK on success
 int scan_directory_parallel(const char *root_path, index_t *new_index, 
                            const index_t *prev_index, const char *fractyl_dir);
 
+// The same walk for looking at the working tree: files whose stat data
+// matches prev_index keep its hash, the others are hashed, and nothing is
+// written to the object store or printed
+int scan_directory_hash_only(const char *root_path, index_t *new_index, const index_t *prev_index,
+                             const char *fractyl_dir);
+
+// Record every file the parallel scan stores from now on in journal, NULL
+// to stop (scan_journal.h)
+void scan_set_journal(scan_journal_t *journal);
+
 // Optimized scan using directory cache - two-phase approach
 // Phase 1: Fast file-only stat() check for known files
 // Phase 2: Selective directory traversal for changed directories only
@@ -30,4 +42,52 @@ int scan_directory_stat_only(const char *root_path, index_t *new_index,
                              const index_t *prev_index, const char *fractyl_dir,
                              const char *branch);
 
+// Incremental scan of a known set of changed paths (relative to root_path)
+// Entries of prev_index outside the changed paths are carried over as-is;
+// changed files are re-hashed, changed directories are walked again and
+// vanished or newly ignored paths are dropped together with everything
+// below them. Falls back to scan_directory_parallel() without prev_index.
+// ignore, when not NULL, is a compiled ignore engine for root_path kept by
+// the caller across scans; otherwise one is compiled for this scan.
+int scan_paths_incremental(const char *root_path, index_t *new_index,
+                           const index_t *prev_index, const char *fractyl_dir,
+                           const char *const *paths, size_t path_count, ignore_engine_t *ignore);
+
+// Nonzero when the tree under root_path holds exactly the files of
+// prev_index, each with the stat data recorded for it (and none racily
+// clean), so a scan would find nothing to do. Stops at the first
+// difference; 0 also when it cannot tell.
+int scan_tree_unchanged(const char *root_path, const index_t *prev_index);
+
+// Scan engines selectable with --scan-engine or the scan.engine config key
+typedef enum {
+    SCAN_ENGINE_AUTO = 0,     // binary when its index is fresh, otherwise parallel
+    SCAN_ENGINE_PARALLEL,     // scan_directory_parallel()
+    SCAN_ENGINE_CACHED,       // scan_directory_cached()
+    SCAN_ENGINE_BINARY,       // scan_directory_binary()
+    SCAN_ENGINE_STAT_ONLY     // scan_directory_stat_only()
+} scan_engine_t;
+
+// Seconds between full traversals in auto mode (scan.full_interval)
+#define SCAN_AUTO_FULL_INTERVAL 3600
+
+// Bytes the binary and stat-only engines use for the paths and stat
+// results of the files they check at once (scan.memory_budget)
+#define SCAN_MEMORY_BUDGET_DEFAULT (64L * 1024 * 1024)
+
+// Parse an engine name ("auto", "parallel", "cached", "binary", "stat-only")
+// Returns FRACTYL_OK, or FRACTYL_ERROR_INVALID_ARGS for unknown names
+int scan_engine_parse(const char *name, scan_engine_t *engine);
+
+// Name of an engine, as accepted by scan_engine_parse()
+const char* scan_engine_name(scan_engine_t engine);
+
+// Scan with the given engine; the result is always sorted by path.
+// In auto mode the binary engine is used while the branch's binary index is
+// younger than full_interval seconds. Otherwise a full parallel traversal
+// runs and the binary index is rebuilt from its result.
+int scan_directory_engine(scan_engine_t engine, const char *root_path, index_t *new_index,
+                          const index_t *prev_index, const char *fractyl_dir,
+                          const char *branch, long full_interval);
+
 #endif // PARALLEL_SCAN_H
\ No newline at end of file
@@ -1,10 +1,13 @@
 #include "paths.h"
 #include "git.h"
+#include "catalog.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <unistd.h>
 
 // Get the branch-aware snapshots directory path
 // Returns allocated string that caller must free
@@ -44,6 +47,33 @@ char* paths_get_current_file(const char *fractyl_dir, const char *branch) {
     return path;
 }
 
+int paths_set_current(const char *fractyl_dir, const char *branch, const char *snapshot_id) {
+    if (!fractyl_dir || !snapshot_id) return -1;
+    char *current_path = paths_get_current_file(fractyl_dir, branch);
+    if (!current_path) return -1;
+    
+    // Ensure parent directory exists
+    char *last_slash = strrchr(current_path, '/');
+    if (last_slash) {
+        *last_slash = '\0';
+        paths_ensure_directory(current_path);
+        *last_slash = '/';
+    }
+    
+    char temp_path[4200];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", current_path);
+    FILE *f = fopen(temp_path, "w");
+    int written = f && fprintf(f, "%s\n", snapshot_id) > 0;
+    if (f && fclose(f) != 0) written = 0;
+    if (!written || rename(temp_path, current_path) != 0) {
+        unlink(temp_path);
+        free(current_path);
+        return -1;
+    }
+    free(current_path);
+    return 0;
+}
+
 // Ensure directory exists, creating parent directories as needed
 int paths_ensure_directory(const char *path) {
     if (!path) return -1;
@@ -127,6 +157,12 @@ int paths_migrate_legacy_snapshots(const char *fractyl_dir, const char *branch)
         return -1;
     }
     
+    // Its catalog still describes it; without one the next load rebuilds it
+    char legacy_catalog[4096];
+    char new_catalog[4096];
+    snprintf(legacy_catalog, sizeof(legacy_catalog), "%s%s", legacy_snapshots, CATALOG_SUFFIX);
+    snprintf(new_catalog, sizeof(new_catalog), "%s%s", new_snapshots, CATALOG_SUFFIX);
+    rename(legacy_catalog, new_catalog); // Ignore errors
     free(new_snapshots);
     
     // Also migrate CURRENT file
@@ -140,4 +176,39 @@ int paths_migrate_legacy_snapshots(const char *fractyl_dir, const char *branch)
     }
     
     return 0;
-}
\ No newline at end of file
+}
+
+// Walk refs/heads/<branch> (refs/heads itself for an empty branch)
+static int for_each_branch_below(const char *fractyl_dir, const char *branch,
+                                 paths_branch_callback_t callback, void *ctx) {
+    char dir_path[4096];
+    snprintf(dir_path, sizeof(dir_path), "%s/refs/heads%s%s", fractyl_dir, branch[0] ? "/" : "", branch);
+    DIR *d = opendir(dir_path);
+    if (!d) return 0;
+    
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+    
+        char path[4096];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+    
+        if (strcmp(entry->d_name, "snapshots") == 0) {
+            if (branch[0]) result = callback(branch, path, ctx);
+            continue;
+        }
+        char child[4096];
+        snprintf(child, sizeof(child), "%s%s%s", branch, branch[0] ? "/" : "", entry->d_name);
+        result = for_each_branch_below(fractyl_dir, child, callback, ctx);
+    }
+    closedir(d);
+    return result;
+}
+
+int paths_for_each_branch(const char *fractyl_dir, paths_branch_callback_t callback, void *ctx) {
+    if (!fractyl_dir || !callback) return -1;
+    return for_each_branch_below(fractyl_dir, "", callback, ctx);
+}
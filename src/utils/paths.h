@@ -9,6 +9,10 @@ char* paths_get_snapshots_dir(const char *fractyl_dir, const char *branch);
 // Returns allocated string that caller must free
 char* paths_get_current_file(const char *fractyl_dir, const char *branch);
 
+// Point the branch's CURRENT file at snapshot_id. The file is written
+// under another name and renamed, so readers see the old or the new id.
+int paths_set_current(const char *fractyl_dir, const char *branch, const char *snapshot_id);
+
 // Ensure directory exists, creating parent directories as needed
 int paths_ensure_directory(const char *path);
 
@@ -19,4 +23,12 @@ char* paths_get_current_branch(const char *repo_root);
 // Migrate legacy snapshots to branch-specific directory
 int paths_migrate_legacy_snapshots(const char *fractyl_dir, const char *branch);
 
+// Called with a branch name and its snapshots directory; nonzero stops the walk
+typedef int (*paths_branch_callback_t)(const char *branch, const char *snapshots_dir, void *ctx);
+
+// Call callback for every refs/heads/<branch>/snapshots directory; branch
+// names may contain slashes. The legacy snapshots directory is not included.
+// Returns 0, or the first nonzero result of callback.
+int paths_for_each_branch(const char *fractyl_dir, paths_branch_callback_t callback, void *ctx);
+
 #endif // FRACTYL_PATHS_H
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "pathspec.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+int pathspec_matches(const char *spec, const char *path) {
+    if (strpbrk(spec, "*?[")) {
+        return fnmatch(spec, path, 0) == 0;
+    }
+    size_t len = strlen(spec);
+    if (len == 0) return 1;
+    if (strncmp(path, spec, len) != 0) return 0;
+    return path[len] == '\0' || path[len] == '/' || spec[len - 1] == '/';
+}
+
+int pathspec_match_any(const char *const *specs, size_t count, const char *path) {
+    if (count == 0) return 1;
+    for (size_t i = 0; i < count; i++) {
+        if (pathspec_matches(specs[i], path)) return 1;
+    }
+    return 0;
+}
+
+char* pathspec_prefix(const char *const *specs, size_t count) {
+    if (count == 0) return strdup("");
+    size_t len = strcspn(specs[0], "*?[");
+    for (size_t i = 1; i < count; i++) {
+        size_t literal = strcspn(specs[i], "*?[");
+        size_t n = 0;
+        while (n < len && n < literal && specs[i][n] == specs[0][n]) n++;
+        len = n;
+    }
+    char *prefix = malloc(len + 1);
+    if (!prefix) return NULL;
+    memcpy(prefix, specs[0], len);
+    prefix[len] = '\0';
+    return prefix;
+}
+
+const char* pathspec_normalize(const char *spec) {
+    while (strncmp(spec, "./", 2) == 0) spec += 2;
+    return spec;
+}
@@ -0,0 +1,23 @@
+#ifndef PATHSPEC_H
+#define PATHSPEC_H
+
+#include <stddef.h>
+
+// Pathspecs select files of a snapshot by repo-relative path. One with
+// *, ? or [ is a glob over the whole path, where * also matches '/';
+// without, it names a file or a directory.
+
+// Nonzero if path matches spec
+int pathspec_matches(const char *spec, const char *path);
+
+// Nonzero if path matches one of specs; every path does when count is 0
+int pathspec_match_any(const char *const *specs, size_t count, const char *path);
+
+// The part every path matching one of the pathspecs starts with ("" for
+// none), to look matching files up by; NULL when out of memory
+char* pathspec_prefix(const char *const *specs, size_t count);
+
+// spec without leading "./"
+const char* pathspec_normalize(const char *spec);
+
+#endif // PATHSPEC_H
@@ -0,0 +1,285 @@
+#include "profile.h"
+#include "../include/fractyl.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    unsigned long long count;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long bytes;
+} phase_stats_t;
+
+typedef struct {
+    unsigned long long start_ns;
+    unsigned long long dur_ns;
+    unsigned int tid;
+    unsigned char phase;
+} trace_event_t;
+
+static const char *phase_names[PROFILE_PHASE_COUNT] = {
+    "walk",
+    "ignore",
+    "stat",
+    "hash",
+    "object_write",
+    "index_load",
+    "index_save",
+    "git",
+    "snapshot_scan",
+    "snapshot_tree",
+    "snapshot_save",
+};
+
+static int enabled;
+static char *summary_file;
+static char *trace_file;
+static unsigned long long started_ns;
+static phase_stats_t phases[PROFILE_PHASE_COUNT];
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_event_t *trace_events;
+static size_t trace_count;
+static size_t trace_capacity;
+static unsigned long long trace_dropped;
+
+static unsigned int next_tid;
+static __thread unsigned int thread_tid;
+
+static unsigned long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+// Small per-thread ids keep the trace's rows in the order threads started
+static unsigned int current_tid(void) {
+    if (thread_tid == 0) {
+        thread_tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+    }
+    return thread_tid;
+}
+
+void profile_enable(const char *summary_path, const char *trace_path) {
+    free(summary_file);
+    free(trace_file);
+    summary_file = (summary_path && strcmp(summary_path, "-") != 0) ? strdup(summary_path) : NULL;
+    trace_file = trace_path ? strdup(trace_path) : NULL;
+    profile_reset();
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELEASE);
+}
+
+int profile_enable_from_env(void) {
+    const char *summary = getenv("FRACTYL_PROFILE");
+    const char *trace = getenv("FRACTYL_PROFILE_TRACE");
+    int summary_set = summary && summary[0] && strcmp(summary, "0") != 0;
+    int trace_set = trace && trace[0];
+    if (!summary_set && !trace_set) {
+        return profile_enabled();
+    }
+    
+    // "1" only asks for the summary on stderr
+    if (!summary_set || strcmp(summary, "1") == 0) {
+        summary = NULL;
+    }
+    profile_enable(summary, trace_set ? trace : NULL);
+    return 1;
+}
+
+void profile_disable(void) {
+    __atomic_store_n(&enabled, 0, __ATOMIC_RELEASE);
+    profile_reset();
+    free(summary_file);
+    free(trace_file);
+    summary_file = NULL;
+    trace_file = NULL;
+}
+
+int profile_enabled(void) {
+    return __atomic_load_n(&enabled, __ATOMIC_ACQUIRE);
+}
+
+unsigned long long profile_begin(void) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    unsigned long long now = now_ns();
+    return now ? now : 1;
+}
+
+static void record_trace_event(profile_phase_t phase, unsigned long long start,
+                               unsigned long long dur) {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_count == trace_capacity) {
+        size_t capacity = trace_capacity ? trace_capacity * 2 : 4096;
+        trace_event_t *grown = NULL;
+        if (capacity <= PROFILE_TRACE_MAX_EVENTS) {
+            grown = realloc(trace_events, capacity * sizeof(trace_event_t));
+        }
+        if (!grown) {
+            trace_dropped++;
+            pthread_mutex_unlock(&trace_lock);
+            return;
+        }
+        trace_events = grown;
+        trace_capacity = capacity;
+    }
+    trace_event_t *event = &trace_events[trace_count++];
+    event->start_ns = start;
+    event->dur_ns = dur;
+    event->tid = current_tid();
+    event->phase = (unsigned char)phase;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void profile_end(profile_phase_t phase, unsigned long long started) {
+    if (started == 0 || phase >= PROFILE_PHASE_COUNT) {
+        return;
+    }
+    unsigned long long elapsed = now_ns() - started;
+    
+    phase_stats_t *stats = &phases[phase];
+    __atomic_add_fetch(&stats->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->total_ns, elapsed, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&stats->max_ns, __ATOMIC_RELAXED);
+    while (elapsed > max &&
+           !__atomic_compare_exchange_n(&stats->max_ns, &max, elapsed, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    
+    if (trace_file) {
+        record_trace_event(phase, started, elapsed);
+    }
+}
+
+void profile_add_bytes(profile_phase_t phase, unsigned long long bytes) {
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED) || phase >= PROFILE_PHASE_COUNT) {
+        return;
+    }
+    __atomic_add_fetch(&phases[phase].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+const char *profile_phase_name(profile_phase_t phase) {
+    return phase < PROFILE_PHASE_COUNT ? phase_names[phase] : "unknown";
+}
+
+// Append to buf like snprintf, keeping track of the length needed
+static void append(char *buf, size_t size, size_t *len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void append(char *buf, size_t size, size_t *len, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(*len < size ? buf + *len : NULL, *len < size ? size - *len : 0, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        *len += (size_t)n;
+    }
+}
+
+size_t profile_format_summary(const char *command, char *buf, size_t size) {
+    size_t len = 0;
+    if (size > 0) {
+        buf[0] = '\0';
+    }
+    double wall_ms = (double)(now_ns() - started_ns) / 1e6;
+    
+    append(buf, size, &len, "{\"command\":\"%s\",\"wall_ms\":%.3f,\"phases\":{",
+           command ? command : "", wall_ms);
+    for (int i = 0; i < PROFILE_PHASE_COUNT; i++) {
+        phase_stats_t *stats = &phases[i];
+        unsigned long long count = __atomic_load_n(&stats->count, __ATOMIC_RELAXED);
+        unsigned long long total = __atomic_load_n(&stats->total_ns, __ATOMIC_RELAXED);
+        unsigned long long max = __atomic_load_n(&stats->max_ns, __ATOMIC_RELAXED);
+        unsigned long long bytes = __atomic_load_n(&stats->bytes, __ATOMIC_RELAXED);
+    
+        append(buf, size, &len, "%s\"%s\":{\"count\":%llu,\"total_ms\":%.3f,\"max_ms\":%.3f",
+               i ? "," : "", phase_names[i], count, (double)total / 1e6, (double)max / 1e6);
+        if (bytes > 0) {
+            double mb_per_s = total ? ((double)bytes / (1024.0 * 1024.0)) / ((double)total / 1e9) : 0.0;
+            append(buf, size, &len, ",\"bytes\":%llu,\"mb_per_s\":%.1f", bytes, mb_per_s);
+        }
+        append(buf, size, &len, "}");
+    }
+    
+    pthread_mutex_lock(&trace_lock);
+    size_t events = trace_count;
+    unsigned long long dropped = trace_dropped;
+    pthread_mutex_unlock(&trace_lock);
+    append(buf, size, &len, "},\"trace_events\":%zu,\"trace_dropped\":%llu}", events, dropped);
+    return len;
+}
+
+// Chrome's trace event format: complete ("X") events in microseconds
+static int write_trace(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        return FRACTYL_ERROR_IO;
+    }
+    
+    pthread_mutex_lock(&trace_lock);
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < trace_count; i++) {
+        const trace_event_t *event = &trace_events[i];
+        fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}%s\n",
+                phase_names[event->phase],
+                (double)(event->start_ns - started_ns) / 1e3, (double)event->dur_ns / 1e3,
+                (int)getpid(), event->tid, i + 1 < trace_count ? "," : "");
+    }
+    fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+    pthread_mutex_unlock(&trace_lock);
+    
+    return fclose(fp) == 0 ? FRACTYL_OK : FRACTYL_ERROR_IO;
+}
+
+int profile_report(const char *command) {
+    if (!profile_enabled()) {
+        return FRACTYL_OK;
+    }
+    
+    size_t needed = profile_format_summary(command, NULL, 0);
+    char *summary = malloc(needed + 1);
+    if (!summary) {
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    profile_format_summary(command, summary, needed + 1);
+    
+    int result = FRACTYL_OK;
+    if (summary_file) {
+        FILE *fp = fopen(summary_file, "w");
+        if (!fp || fprintf(fp, "%s\n", summary) < 0) {
+            result = FRACTYL_ERROR_IO;
+        }
+        if (fp && fclose(fp) != 0) {
+            result = FRACTYL_ERROR_IO;
+        }
+        if (result != FRACTYL_OK) {
+            printf("Error: Cannot write profile summary to %s\n", summary_file);
+        }
+    } else {
+        fprintf(stderr, "%s\n", summary);
+    }
+    free(summary);
+    
+    if (trace_file && write_trace(trace_file) != FRACTYL_OK) {
+        printf("Error: Cannot write profile trace to %s\n", trace_file);
+        result = FRACTYL_ERROR_IO;
+    }
+    return result;
+}
+
+void profile_reset(void) {
+    memset(phases, 0, sizeof(phases));
+    pthread_mutex_lock(&trace_lock);
+    free(trace_events);
+    trace_events = NULL;
+    trace_count = trace_capacity = 0;
+    trace_dropped = 0;
+    pthread_mutex_unlock(&trace_lock);
+    started_ns = now_ns();
+}
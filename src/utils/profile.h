@@ -0,0 +1,69 @@
+#ifndef FRACTYL_PROFILE_H
+#define FRACTYL_PROFILE_H
+
+#include <stddef.h>
+
+// Per-phase timers for --profile
+//
+// Off by default: profile_begin() is then a single load and returns 0, and
+// profile_end() returns straight away. When enabled (--profile, or the
+// FRACTYL_PROFILE environment variable) every timed call adds to its
+// phase's count, total and longest time, and optionally to a Chrome trace
+// (chrome://tracing, Perfetto). Phases timed on worker threads overlap, so
+// their totals can add up to more than the wall time.
+
+typedef enum {
+    PROFILE_WALK = 0,       // Reading a directory and queueing its entries
+    PROFILE_IGNORE,         // Matching a path against ignore rules
+    PROFILE_STAT,           // stat() calls and statx batches
+    PROFILE_HASH,           // Hashing file content
+    PROFILE_OBJECT_WRITE,   // Storing file content in the object store
+    PROFILE_INDEX_LOAD,     // Loading a snapshot index
+    PROFILE_INDEX_SAVE,     // Serializing and writing a snapshot index
+    PROFILE_GIT,            // Running git
+    PROFILE_SNAPSHOT_SCAN,  // Snapshot: scanning the tree
+    PROFILE_SNAPSHOT_TREE,  // Snapshot: building the tree object
+    PROFILE_SNAPSHOT_SAVE,  // Snapshot: writing the index and metadata
+    PROFILE_PHASE_COUNT
+} profile_phase_t;
+
+// Cap on trace events kept in memory; later ones are counted as dropped
+#define PROFILE_TRACE_MAX_EVENTS (1024 * 1024)
+
+// Turn profiling on. summary_path is where profile_report() writes the
+// JSON summary (NULL or "-" for stderr); trace_path, if not NULL, is where
+// it writes a Chrome trace of every timed call.
+void profile_enable(const char *summary_path, const char *trace_path);
+
+// Turn profiling on from FRACTYL_PROFILE ("1", or the summary path) and
+// FRACTYL_PROFILE_TRACE (the trace path). Returns 1 if it is now on.
+int profile_enable_from_env(void);
+
+// Turn profiling off and drop what was gathered
+void profile_disable(void);
+
+int profile_enabled(void);
+
+// Start time of a timed call, 0 when profiling is off
+unsigned long long profile_begin(void);
+
+// Add the call started at started to phase
+void profile_end(profile_phase_t phase, unsigned long long started);
+
+// Add bytes handled by phase, for the MB/s in the summary
+void profile_add_bytes(profile_phase_t phase, unsigned long long bytes);
+
+const char *profile_phase_name(profile_phase_t phase);
+
+// Write the summary (and trace) for command. Returns FRACTYL_OK, or an
+// error if a file could not be written.
+int profile_report(const char *command);
+
+// Format the summary for command into buf. Returns the length it needs,
+// as snprintf does.
+size_t profile_format_summary(const char *command, char *buf, size_t size);
+
+// Clear the counters and trace events, leaving profiling on
+void profile_reset(void);
+
+#endif // FRACTYL_PROFILE_H
@@ -0,0 +1,243 @@
+#include "scan_journal.h"
+#include "../core/index.h"
+#include "../core/objects.h"
+#include "../core/hash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC "FSJ1"
+#define JOURNAL_VERSION 1
+#define JOURNAL_HEADER_SIZE 16
+#define JOURNAL_MAX_PATH 4096
+
+struct scan_journal {
+    char *fractyl_dir;
+    int fd;                             // -1 once a write failed
+    pthread_mutex_t lock;               // Guards pending and checkpoint_ms
+    pthread_mutex_t flush_lock;         // One checkpoint at a time
+    unsigned char *pending;             // Records since the last checkpoint
+    size_t pending_size;
+    size_t pending_capacity;
+    unsigned long long checkpoint_ms;
+};
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static unsigned long long now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000ULL + (unsigned long long)now.tv_nsec / 1000000ULL;
+}
+
+static void journal_path(const char *fractyl_dir, char *out, size_t size) {
+    snprintf(out, size, "%s/%s", fractyl_dir, SCAN_JOURNAL_NAME);
+}
+
+static void encode_header(unsigned char *header) {
+    memcpy(header, JOURNAL_MAGIC, 4);
+    put_u32(header + 4, JOURNAL_VERSION);
+    put_u32(header + 8, (uint32_t)hash_get_algorithm());
+    put_u32(header + 12, 0);
+}
+
+// Read all of fd; NULL with *size 0 for an empty file
+static unsigned char *read_all(int fd, size_t *size) {
+    *size = 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) return NULL;
+    
+    unsigned char *data = malloc((size_t)st.st_size);
+    if (!data) return NULL;
+    size_t done = 0;
+    while (done < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + done, (size_t)st.st_size - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    *size = done;
+    return data;
+}
+
+// Walk the records of a journal, adding those whose objects exist to index
+// when it is not NULL. Returns the offset after the last whole record, or
+// 0 if the header is not one this build writes.
+static size_t parse_records(const unsigned char *data, size_t size, const char *fractyl_dir,
+                            index_t *index, size_t *added) {
+    unsigned char header[JOURNAL_HEADER_SIZE];
+    encode_header(header);
+    if (size < JOURNAL_HEADER_SIZE || memcmp(data, header, JOURNAL_HEADER_SIZE) != 0) return 0;
+    
+    char path[JOURNAL_MAX_PATH + 1];
+    size_t offset = JOURNAL_HEADER_SIZE;
+    while (size - offset >= 4 + INDEX_RECORD_SIZE) {
+        uint32_t path_len = get_u32(data + offset);
+        if (path_len == 0 || path_len > JOURNAL_MAX_PATH ||
+            size - offset - 4 - INDEX_RECORD_SIZE < path_len) {
+            break;
+        }
+        const unsigned char *rec = data + offset + 4;
+        memcpy(path, rec + INDEX_RECORD_SIZE, path_len);
+        path[path_len] = '\0';
+        if (strlen(path) != path_len) break;
+        offset += 4 + INDEX_RECORD_SIZE + path_len;
+    
+        index_entry_t entry;
+        if (!index || index_record_decode(rec, path, path_len + 1, &entry) != FRACTYL_OK) continue;
+        // The store may have lost it since (gc, a crash before it was synced)
+        if (!object_exists(entry.hash, fractyl_dir)) continue;
+        if (index_add_entry(index, &entry) == FRACTYL_OK) (*added)++;
+    }
+    return offset;
+}
+
+size_t scan_journal_load(const char *fractyl_dir, index_t *index) {
+    char path[2048];
+    journal_path(fractyl_dir, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    
+    size_t size;
+    unsigned char *data = read_all(fd, &size);
+    close(fd);
+    
+    size_t added = 0;
+    if (data) parse_records(data, size, fractyl_dir, index, &added);
+    free(data);
+    return added;
+}
+
+scan_journal_t *scan_journal_open(const char *fractyl_dir) {
+    char path[2048];
+    journal_path(fractyl_dir, path, sizeof(path));
+    // Appending, so a snapshot running beside this one adds whole records too
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) return NULL;
+    
+    // Keep the whole records an earlier run left and cut off the rest, so
+    // new records follow the last one
+    size_t size;
+    unsigned char *data = read_all(fd, &size);
+    size_t end = data ? parse_records(data, size, fractyl_dir, NULL, NULL) : 0;
+    free(data);
+    
+    int ok = end == size || ftruncate(fd, (off_t)end) == 0;
+    if (ok && end == 0) {
+        unsigned char header[JOURNAL_HEADER_SIZE];
+        encode_header(header);
+        ok = write(fd, header, sizeof(header)) == (ssize_t)sizeof(header);
+    }
+    
+    scan_journal_t *journal = ok ? calloc(1, sizeof(scan_journal_t)) : NULL;
+    if (journal) journal->fractyl_dir = strdup(fractyl_dir);
+    if (!journal || !journal->fractyl_dir) {
+        free(journal);
+        close(fd);
+        return NULL;
+    }
+    journal->fd = fd;
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_mutex_init(&journal->flush_lock, NULL);
+    journal->checkpoint_ms = now_ms();
+    return journal;
+}
+
+// Sync the object store, then append the records gathered so far. Their
+// objects were all stored before they were recorded, so the sync covers
+// every one of them.
+static void checkpoint(scan_journal_t *journal) {
+    pthread_mutex_lock(&journal->flush_lock);
+    pthread_mutex_lock(&journal->lock);
+    unsigned char *data = journal->pending;
+    size_t size = journal->pending_size;
+    journal->pending = NULL;
+    journal->pending_size = journal->pending_capacity = 0;
+    pthread_mutex_unlock(&journal->lock);
+    
+    if (size > 0 && journal->fd >= 0 && object_sync(journal->fractyl_dir) == FRACTYL_OK) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = write(journal->fd, data + done, size - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += (size_t)n;
+        }
+        if (done < size) {
+            // A partial record would hide everything after it
+            close(journal->fd);
+            journal->fd = -1;
+        }
+    }
+    free(data);
+    pthread_mutex_unlock(&journal->flush_lock);
+}
+
+void scan_journal_record(scan_journal_t *journal, const index_entry_t *entry) {
+    if (!journal || !entry || !entry->path) return;
+    size_t path_len = strlen(entry->path);
+    if (path_len == 0 || path_len > JOURNAL_MAX_PATH) return;
+    
+    size_t size = 4 + INDEX_RECORD_SIZE + path_len;
+    pthread_mutex_lock(&journal->lock);
+    if (journal->pending_size + size > journal->pending_capacity) {
+        size_t capacity = journal->pending_capacity ? journal->pending_capacity * 2 : 64 * 1024;
+        while (capacity < journal->pending_size + size) capacity *= 2;
+        unsigned char *grown = realloc(journal->pending, capacity);
+        if (!grown) {
+            pthread_mutex_unlock(&journal->lock);
+            return;
+        }
+        journal->pending = grown;
+        journal->pending_capacity = capacity;
+    }
+    unsigned char *p = journal->pending + journal->pending_size;
+    put_u32(p, (uint32_t)path_len);
+    index_record_encode(p + 4, entry, 0);
+    memcpy(p + 4 + INDEX_RECORD_SIZE, entry->path, path_len);
+    journal->pending_size += size;
+    
+    unsigned long long now = now_ms();
+    int due = now - journal->checkpoint_ms >= SCAN_JOURNAL_CHECKPOINT_MS;
+    if (due) journal->checkpoint_ms = now;
+    pthread_mutex_unlock(&journal->lock);
+    
+    if (due) checkpoint(journal);
+}
+
+void scan_journal_close(scan_journal_t *journal) {
+    if (!journal) return;
+    checkpoint(journal);
+    if (journal->fd >= 0) close(journal->fd);
+    pthread_mutex_destroy(&journal->lock);
+    pthread_mutex_destroy(&journal->flush_lock);
+    free(journal->fractyl_dir);
+    free(journal);
+}
+
+int scan_journal_exists(const char *fractyl_dir) {
+    char path[2048];
+    journal_path(fractyl_dir, path, sizeof(path));
+    return access(path, F_OK) == 0;
+}
+
+void scan_journal_remove(const char *fractyl_dir) {
+    char path[2048];
+    journal_path(fractyl_dir, path, sizeof(path));
+    unlink(path);
+}
@@ -0,0 +1,48 @@
+#ifndef FRACTYL_SCAN_JOURNAL_H
+#define FRACTYL_SCAN_JOURNAL_H
+
+#include "../include/core.h"
+
+// Progress of an unfinished snapshot
+//
+// While a snapshot scans the tree, the files it stores are recorded in
+// .fractyl/scan.journal (path, stat data and hash) in checkpoints: at most
+// every SCAN_JOURNAL_CHECKPOINT_MS the object store is synced and the
+// records gathered since are appended, so every record names an object
+// that is on disk. A snapshot cut short by Ctrl-C, a stopped daemon or a
+// crash leaves the file behind. The next snapshot hands its records to the
+// scan as though the previous index had them, so files whose stat data
+// still matches are not read again, and appends its own; once a snapshot
+// is taken the file is removed.
+//
+// The file is a 16-byte header ("FSJ1", version, hash algorithm, 0) and
+// then records of a little-endian u32 path length, an index record
+// (index.h) and the path. A record cut off at the end is ignored.
+
+#define SCAN_JOURNAL_NAME "scan.journal"
+#define SCAN_JOURNAL_CHECKPOINT_MS 2000
+
+typedef struct scan_journal scan_journal_t;
+
+// Add the records an interrupted snapshot left, whose objects are still
+// in the store, to index (later records win). Returns the number added.
+size_t scan_journal_load(const char *fractyl_dir, index_t *index);
+
+// Open the journal for appending, starting a new one if there is none or
+// it was written with another hash algorithm. NULL if it cannot be opened;
+// the snapshot goes on without.
+scan_journal_t *scan_journal_open(const char *fractyl_dir);
+
+// Record an entry whose content was just stored. Thread-safe.
+void scan_journal_record(scan_journal_t *journal, const index_entry_t *entry);
+
+// Checkpoint what is left and close
+void scan_journal_close(scan_journal_t *journal);
+
+// Nonzero if an interrupted snapshot left a journal behind
+int scan_journal_exists(const char *fractyl_dir);
+
+// Remove the journal of fractyl_dir once a snapshot is taken
+void scan_journal_remove(const char *fractyl_dir);
+
+#endif // FRACTYL_SCAN_JOURNAL_H
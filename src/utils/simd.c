@@ -0,0 +1,364 @@
+#include "simd.h"
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#define AVX2 __attribute__((target("avx2")))
+#elif defined(__aarch64__)
+#define SIMD_ARM 1
+#include <arm_neon.h>
+#endif
+
+// The line hash reads 32-byte stripes as four 64-bit lanes, xxh3-style:
+// each lane adds its word and the product of its halves keyed. Vector
+// units do two or four lanes at once, and look for the newline in the
+// stripe they just loaded, so a line is read once. The last stripe is
+// zero-padded.
+#define HASH_STRIPE 32
+
+static const uint64_t HASH_KEYS[4] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL
+};
+static const uint64_t HASH_SEEDS[4] = {
+    0x9e3779b185ebca87ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0x85ebca77c2b2ae63ULL
+};
+
+// 32 ones then 32 zeros: loading at 32 - n keeps the first n bytes
+static const uint8_t KEEP_MASK[2 * HASH_STRIPE] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255
+};
+
+typedef struct {
+    void (*count_binary)(const uint8_t *data, size_t size, size_t *nul, size_t *control);
+    uint64_t (*hash_line)(const char *p, const char *end, const char **eol);
+} simd_ops_t;
+
+static uint64_t mix64(uint64_t z) {
+    z ^= z >> 30;
+    z *= 0xbf58476d1ce4e5b9ULL;
+    z ^= z >> 27;
+    z *= 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t hash_finish(const uint64_t acc[4], size_t size) {
+    return mix64((uint64_t)size * 0x9e3779b97f4a7c15ULL + acc[0] + rotl64(acc[1], 17) +
+                 rotl64(acc[2], 31) + rotl64(acc[3], 47));
+}
+
+// --- Scalar ---
+
+static int is_control(uint8_t b) {
+    return (b < 32 && b != '\t' && b != '\n' && b != '\r') || b > 126;
+}
+
+static void count_binary_scalar(const uint8_t *data, size_t size, size_t *nul, size_t *control) {
+    size_t nul_count = 0, control_count = 0;
+    for (size_t i = 0; i < size; i++) {
+        nul_count += data[i] == 0;
+        control_count += is_control(data[i]);
+    }
+    *nul += nul_count;
+    *control += control_count;
+}
+
+static void lane_scalar(uint64_t *acc, uint64_t word, uint64_t key) {
+    uint64_t keyed = word ^ key;
+    *acc += (keyed & 0xffffffffULL) * (keyed >> 32) + word;
+}
+
+// Hash on from p, with start the beginning of the line and acc the
+// stripes before p
+static uint64_t hash_rest_scalar(uint64_t acc[4], const char *start, const char *p, const char *end,
+                                 const char **eol) {
+    const char *nl = memchr(p, '\n', (size_t)(end - p));
+    if (!nl) nl = end;
+    *eol = nl;
+    
+    size_t rest = (size_t)(nl - p);
+    for (; rest > 0; p += HASH_STRIPE) {
+        for (int lane = 0; lane < 4; lane++) {
+            uint64_t word = 0;
+            size_t n = rest < 8 ? rest : 8;
+            memcpy(&word, p + lane * 8, n);
+            lane_scalar(&acc[lane], word, HASH_KEYS[lane]);
+            rest -= n;
+        }
+    }
+    return hash_finish(acc, (size_t)(nl - start));
+}
+
+static uint64_t hash_line_scalar(const char *p, const char *end, const char **eol) {
+    uint64_t acc[4];
+    memcpy(acc, HASH_SEEDS, sizeof(acc));
+    return hash_rest_scalar(acc, p, p, end, eol);
+}
+
+static const simd_ops_t scalar_ops = { count_binary_scalar, hash_line_scalar };
+
+#ifdef SIMD_X86
+// --- SSE2, always there on x86-64 ---
+
+// Printable is 32..126: after subtracting 32, at most 94 unsigned
+static __m128i control_mask_sse2(__m128i v) {
+    __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(32));
+    __m128i printable = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(94)), shifted);
+    __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),
+                                              _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+                                 _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')));
+    return _mm_andnot_si128(_mm_or_si128(printable, space), _mm_set1_epi8(-1));
+}
+
+static void count_binary_sse2(const uint8_t *data, size_t size, size_t *nul, size_t *control) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        *nul += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())));
+        *control += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(control_mask_sse2(v)));
+    }
+    count_binary_scalar(data + i, size - i, nul, control);
+}
+
+static __m128i stripe_sse2(__m128i acc, __m128i w, __m128i key) {
+    __m128i k = _mm_xor_si128(w, key);
+    return _mm_add_epi64(acc, _mm_add_epi64(_mm_mul_epu32(k, _mm_srli_epi64(k, 32)), w));
+}
+
+static uint64_t hash_line_sse2(const char *p, const char *end, const char **eol) {
+    const char *start = p;
+    __m128i acc0 = _mm_loadu_si128((const __m128i *)HASH_SEEDS);
+    __m128i acc1 = _mm_loadu_si128((const __m128i *)(HASH_SEEDS + 2));
+    const __m128i key0 = _mm_loadu_si128((const __m128i *)HASH_KEYS);
+    const __m128i key1 = _mm_loadu_si128((const __m128i *)(HASH_KEYS + 2));
+    const __m128i newline = _mm_set1_epi8('\n');
+    uint64_t acc[4];
+    for (; end - p >= HASH_STRIPE; p += HASH_STRIPE) {
+        __m128i w0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i w1 = _mm_loadu_si128((const __m128i *)(p + 16));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(w0, newline)) |
+                        (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(w1, newline)) << 16;
+        if (mask) {
+            unsigned n = (unsigned)__builtin_ctz(mask);
+            if (n) {
+                w0 = _mm_and_si128(w0, _mm_loadu_si128((const __m128i *)(KEEP_MASK + HASH_STRIPE - n)));
+                w1 = _mm_and_si128(w1, _mm_loadu_si128((const __m128i *)(KEEP_MASK + HASH_STRIPE + 16 - n)));
+                acc0 = stripe_sse2(acc0, w0, key0);
+                acc1 = stripe_sse2(acc1, w1, key1);
+            }
+            _mm_storeu_si128((__m128i *)acc, acc0);
+            _mm_storeu_si128((__m128i *)(acc + 2), acc1);
+            *eol = p + n;
+            return hash_finish(acc, (size_t)(p + n - start));
+        }
+        acc0 = stripe_sse2(acc0, w0, key0);
+        acc1 = stripe_sse2(acc1, w1, key1);
+    }
+    _mm_storeu_si128((__m128i *)acc, acc0);
+    _mm_storeu_si128((__m128i *)(acc + 2), acc1);
+    return hash_rest_scalar(acc, start, p, end, eol);
+}
+
+static const simd_ops_t sse2_ops = { count_binary_sse2, hash_line_sse2 };
+
+// --- AVX2, chosen at run time ---
+
+AVX2 static void count_binary_avx2(const uint8_t *data, size_t size, size_t *nul, size_t *control) {
+    const __m256i minus32 = _mm256_set1_epi8(32), max = _mm256_set1_epi8(94);
+    const __m256i tab = _mm256_set1_epi8('\t'), lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i shifted = _mm256_sub_epi8(v, minus32);
+        __m256i printable = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, max), shifted);
+        __m256i space = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, lf)),
+                                        _mm256_cmpeq_epi8(v, cr));
+        unsigned ok = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(printable, space));
+        *control += (size_t)__builtin_popcount(~ok);
+        *nul += (size_t)__builtin_popcount((unsigned)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+    }
+    count_binary_sse2(data + i, size - i, nul, control);
+}
+
+AVX2 static uint64_t hash_line_avx2(const char *p, const char *end, const char **eol) {
+    const char *start = p;
+    __m256i sum = _mm256_loadu_si256((const __m256i *)HASH_SEEDS);
+    const __m256i key = _mm256_loadu_si256((const __m256i *)HASH_KEYS);
+    const __m256i newline = _mm256_set1_epi8('\n');
+    uint64_t acc[4];
+    for (; end - p >= HASH_STRIPE; p += HASH_STRIPE) {
+        __m256i w = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(w, newline));
+        unsigned n = mask ? (unsigned)__builtin_ctz(mask) : HASH_STRIPE;
+        if (n) {
+            if (mask) w = _mm256_and_si256(w, _mm256_loadu_si256((const __m256i *)(KEEP_MASK + HASH_STRIPE - n)));
+            __m256i k = _mm256_xor_si256(w, key);
+            sum = _mm256_add_epi64(sum, _mm256_add_epi64(_mm256_mul_epu32(k, _mm256_srli_epi64(k, 32)), w));
+        }
+        if (mask) {
+            _mm256_storeu_si256((__m256i *)acc, sum);
+            *eol = p + n;
+            return hash_finish(acc, (size_t)(p + n - start));
+        }
+    }
+    _mm256_storeu_si256((__m256i *)acc, sum);
+    return hash_rest_scalar(acc, start, p, end, eol);
+}
+
+static const simd_ops_t avx2_ops = { count_binary_avx2, hash_line_avx2 };
+#endif
+
+#ifdef SIMD_ARM
+// --- NEON, always there on AArch64 ---
+
+static void count_binary_neon(const uint8_t *data, size_t size, size_t *nul, size_t *control) {
+    const uint8x16_t one = vdupq_n_u8(1);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t v = vld1q_u8(data + i);
+        uint8x16_t printable = vcleq_u8(vsubq_u8(v, vdupq_n_u8(32)), vdupq_n_u8(94));
+        uint8x16_t space = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('\t')), vceqq_u8(v, vdupq_n_u8('\n'))),
+                                    vceqq_u8(v, vdupq_n_u8('\r')));
+        *control += vaddvq_u8(vbicq_u8(one, vorrq_u8(printable, space)));
+        *nul += vaddvq_u8(vandq_u8(vceqzq_u8(v), one));
+    }
+    count_binary_scalar(data + i, size - i, nul, control);
+}
+
+static uint64x2_t stripe_neon(uint64x2_t acc, uint8x16_t bytes, uint64x2_t key) {
+    uint64x2_t w = vreinterpretq_u64_u8(bytes);
+    uint64x2_t k = veorq_u64(w, key);
+    return vaddq_u64(acc, vaddq_u64(vmull_u32(vmovn_u64(k), vshrn_n_u64(k, 32)), w));
+}
+
+// Four bits per byte, in order
+static uint64_t newline_mask_neon(uint8x16_t v) {
+    uint8x16_t eq = vceqq_u8(v, vdupq_n_u8('\n'));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+
+static uint64_t hash_line_neon(const char *p, const char *end, const char **eol) {
+    const char *start = p;
+    uint64x2_t acc0 = vld1q_u64(HASH_SEEDS), acc1 = vld1q_u64(HASH_SEEDS + 2);
+    const uint64x2_t key0 = vld1q_u64(HASH_KEYS), key1 = vld1q_u64(HASH_KEYS + 2);
+    uint64_t acc[4];
+    for (; end - p >= HASH_STRIPE; p += HASH_STRIPE) {
+        uint8x16_t w0 = vld1q_u8((const uint8_t *)p);
+        uint8x16_t w1 = vld1q_u8((const uint8_t *)p + 16);
+        uint64_t mask0 = newline_mask_neon(w0), mask1 = newline_mask_neon(w1);
+        if (mask0 | mask1) {
+            unsigned n = mask0 ? (unsigned)__builtin_ctzll(mask0) >> 2 : 16 + ((unsigned)__builtin_ctzll(mask1) >> 2);
+            if (n) {
+                w0 = vandq_u8(w0, vld1q_u8(KEEP_MASK + HASH_STRIPE - n));
+                w1 = vandq_u8(w1, vld1q_u8(KEEP_MASK + HASH_STRIPE + 16 - n));
+                acc0 = stripe_neon(acc0, w0, key0);
+                acc1 = stripe_neon(acc1, w1, key1);
+            }
+            vst1q_u64(acc, acc0);
+            vst1q_u64(acc + 2, acc1);
+            *eol = p + n;
+            return hash_finish(acc, (size_t)(p + n - start));
+        }
+        acc0 = stripe_neon(acc0, w0, key0);
+        acc1 = stripe_neon(acc1, w1, key1);
+    }
+    vst1q_u64(acc, acc0);
+    vst1q_u64(acc + 2, acc1);
+    return hash_rest_scalar(acc, start, p, end, eol);
+}
+
+static const simd_ops_t neon_ops = { count_binary_neon, hash_line_neon };
+#endif
+
+// --- Dispatch ---
+
+static const simd_ops_t *current_ops;
+static simd_level_t current_level;
+
+static int level_supported(simd_level_t level) {
+    switch (level) {
+    case SIMD_SCALAR:
+        return 1;
+#ifdef SIMD_X86
+    case SIMD_SSE2:
+        return 1;
+    case SIMD_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef SIMD_ARM
+    case SIMD_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+static const simd_ops_t* level_ops(simd_level_t level) {
+    switch (level) {
+#ifdef SIMD_X86
+    case SIMD_SSE2:
+        return &sse2_ops;
+    case SIMD_AVX2:
+        return &avx2_ops;
+#endif
+#ifdef SIMD_ARM
+    case SIMD_NEON:
+        return &neon_ops;
+#endif
+    default:
+        return &scalar_ops;
+    }
+}
+
+// Races here are harmless: every thread picks the same ops
+static const simd_ops_t* ops(void) {
+    const simd_ops_t *chosen = __atomic_load_n(&current_ops, __ATOMIC_ACQUIRE);
+    if (chosen) return chosen;
+    simd_level_t level = SIMD_SCALAR;
+    if (level_supported(SIMD_AVX2)) level = SIMD_AVX2;
+    else if (level_supported(SIMD_SSE2)) level = SIMD_SSE2;
+    else if (level_supported(SIMD_NEON)) level = SIMD_NEON;
+    current_level = level;
+    chosen = level_ops(level);
+    __atomic_store_n(&current_ops, chosen, __ATOMIC_RELEASE);
+    return chosen;
+}
+
+simd_level_t simd_level(void) {
+    ops();
+    return current_level;
+}
+
+const char* simd_level_name(simd_level_t level) {
+    switch (level) {
+    case SIMD_SSE2: return "sse2";
+    case SIMD_AVX2: return "avx2";
+    case SIMD_NEON: return "neon";
+    default: return "scalar";
+    }
+}
+
+int simd_force_level(simd_level_t level) {
+    if (!level_supported(level)) return 0;
+    current_level = level;
+    __atomic_store_n(&current_ops, level_ops(level), __ATOMIC_RELEASE);
+    return 1;
+}
+
+void simd_count_binary_bytes(const void *data, size_t size, size_t *nul_out, size_t *control_out) {
+    size_t nul = 0, control = 0;
+    ops()->count_binary(data, size, &nul, &control);
+    *nul_out = nul;
+    *control_out = control;
+}
+
+uint64_t simd_hash_line(const char *p, const char *end, const char **eol) {
+    return ops()->hash_line(p, end, eol);
+}
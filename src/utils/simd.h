@@ -0,0 +1,35 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte-scanning kernels for diff: binary detection and line hashing.
+// Each has a scalar version and vector ones (SSE2 and AVX2 on x86-64,
+// NEON on AArch64); the best one the CPU has is chosen on first use. All
+// versions give the same results.
+
+typedef enum {
+    SIMD_SCALAR = 0,
+    SIMD_SSE2,
+    SIMD_AVX2,
+    SIMD_NEON
+} simd_level_t;
+
+// The level in use
+simd_level_t simd_level(void);
+const char* simd_level_name(simd_level_t level);
+// Use level instead, for tests and benchmarks; returns 0 if the CPU
+// cannot run it
+int simd_force_level(simd_level_t level);
+
+// Count NUL bytes and bytes that are not printable ASCII, tab, newline or
+// carriage return (NUL among them)
+void simd_count_binary_bytes(const void *data, size_t size, size_t *nul_out, size_t *control_out);
+
+// 64-bit hash of the line at p: the bytes before the first '\n' in
+// [p, end), which is stored in *eol (end if there is none). Not a stable
+// format: only compared within one process.
+uint64_t simd_hash_line(const char *p, const char *end, const char **eol);
+
+#endif // SIMD_H
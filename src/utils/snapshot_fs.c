@@ -0,0 +1,815 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <sys/mount.h>
+#include <linux/fuse.h>
+#endif
+
+#include "../include/core.h"
+#include "../include/fractyl.h"
+#include "../core/index.h"
+#include "../core/objects.h"
+#include "../core/tree.h"
+#include "snapshot_fs.h"
+
+// Decoded objects kept after their last handle closes, by total size
+#define FS_CACHE_BYTES (64UL * 1024 * 1024)
+// Objects kept open or decoded after their last handle closes
+#define FS_CACHE_OBJECTS 256
+// Largest read answered at once
+#define FS_MAX_READ (1024 * 1024)
+// Seconds the kernel may cache names and attributes; a snapshot never changes
+#define FS_ATTR_TIMEOUT 3600
+
+typedef struct {
+    const char *name;
+    uint64_t ino;
+} fs_child_t;
+
+typedef struct {
+    char *name;
+    unsigned char hash[32];     // File content; directory tree in tree snapshots
+    mode_t mode;
+    off_t size;
+    time_t mtime;
+    uint32_t mtime_nsec;
+    uint64_t parent;
+    int loaded;                 // Directory: children known
+    fs_child_t *children;       // Directory: by name
+    size_t child_count;
+    size_t child_capacity;
+} fs_node_t;
+
+typedef struct cached_object {
+    unsigned char hash[32];
+    int fd;                     // Raw loose object read in place, or -1
+    void *data;                 // Otherwise its decoded content
+    size_t size;
+    int refs;                   // Open handles
+    unsigned long used;         // When last opened, for eviction
+    struct cached_object *next;
+} cached_object_t;
+
+struct snapshot_fs {
+    char *fractyl_dir;
+    int trees;                  // Directories are read from tree objects
+    time_t timestamp;
+    fs_node_t *nodes;           // Inode i is nodes[i - 1]
+    size_t count;
+    size_t capacity;
+    cached_object_t *objects;
+    size_t cached_count;
+    size_t cached_bytes;
+    unsigned long clock;
+    // While mounted
+    int fuse_fd;
+    char *mountpoint;
+    int via_fusermount;
+};
+
+static fs_node_t* node_at(snapshot_fs_t *fs, uint64_t ino) {
+    return ino >= 1 && ino <= fs->count ? &fs->nodes[ino - 1] : NULL;
+}
+
+// Nodes may move while adding; callers look them up again by inode
+static int add_node(snapshot_fs_t *fs, uint64_t parent, const char *name, mode_t mode, uint64_t *ino_out) {
+    if (fs->count == fs->capacity) {
+        size_t capacity = fs->capacity ? fs->capacity * 2 : 64;
+        fs_node_t *grown = realloc(fs->nodes, capacity * sizeof(fs_node_t));
+        if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        fs->nodes = grown;
+        fs->capacity = capacity;
+    }
+    fs_node_t *node = &fs->nodes[fs->count];
+    memset(node, 0, sizeof(*node));
+    node->name = strdup(name);
+    if (!node->name) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    node->mode = mode;
+    node->parent = parent;
+    node->mtime = fs->timestamp;
+    *ino_out = ++fs->count;
+    return FRACTYL_OK;
+}
+
+static int append_child(snapshot_fs_t *fs, uint64_t dir, uint64_t ino) {
+    fs_node_t *node = node_at(fs, dir);
+    if (node->child_count == node->child_capacity) {
+        size_t capacity = node->child_capacity ? node->child_capacity * 2 : 8;
+        fs_child_t *grown = realloc(node->children, capacity * sizeof(fs_child_t));
+        if (!grown) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        node->children = grown;
+        node->child_capacity = capacity;
+    }
+    node->children[node->child_count].name = node_at(fs, ino)->name;
+    node->children[node->child_count].ino = ino;
+    node->child_count++;
+    return FRACTYL_OK;
+}
+
+// Add an entry of the snapshot as a child of dir
+static int add_entry(snapshot_fs_t *fs, uint64_t dir, const char *name, const index_entry_t *entry) {
+    int is_dir = S_ISDIR(entry->mode);
+    mode_t mode = is_dir ? (S_IFDIR | 0555) : (S_IFREG | (entry->mode & 07555));
+    uint64_t ino;
+    int result = add_node(fs, dir, name, mode, &ino);
+    if (result != FRACTYL_OK) return result;
+    
+    fs_node_t *node = node_at(fs, ino);
+    memcpy(node->hash, entry->hash, sizeof(node->hash));
+    if (!is_dir) {
+        node->size = entry->size;
+        node->mtime = entry->mtime;
+        node->mtime_nsec = entry->mtime_nsec;
+    }
+    return append_child(fs, dir, ino);
+}
+
+static int compare_children(const void *a, const void *b) {
+    return strcmp(((const fs_child_t *)a)->name, ((const fs_child_t *)b)->name);
+}
+
+typedef struct {
+    snapshot_fs_t *fs;
+    uint64_t dir;
+} child_context_t;
+
+static int add_tree_child(const index_entry_t *entry, void *ctx) {
+    child_context_t *child = ctx;
+    return add_entry(child->fs, child->dir, entry->path, entry);
+}
+
+// Read a directory's tree the first time it is needed
+static int load_children(snapshot_fs_t *fs, uint64_t dir) {
+    fs_node_t *node = node_at(fs, dir);
+    if (!node || !S_ISDIR(node->mode)) return FRACTYL_ERROR_INVALID_STATE;
+    if (node->loaded) return FRACTYL_OK;
+    
+    unsigned char hash[32];
+    memcpy(hash, node->hash, sizeof(hash));
+    child_context_t child = { fs, dir };
+    int result = tree_for_each_child(hash, fs->fractyl_dir, add_tree_child, &child);
+    if (result != FRACTYL_OK) return result;
+    
+    node = node_at(fs, dir);
+    qsort(node->children, node->child_count, sizeof(fs_child_t), compare_children);
+    node->loaded = 1;
+    return FRACTYL_OK;
+}
+
+// A flat index object has no trees to read lazily: build every directory
+// now. Its paths are sorted, so a file's directories are either the ones
+// of the file before or new.
+static int load_flat_index(snapshot_fs_t *fs, const unsigned char *root) {
+    index_t index;
+    int result = object_load_index(root, fs->fractyl_dir, &index);
+    if (result != FRACTYL_OK) return result;
+    if (!index_is_sorted(&index)) result = index_sort(&index, 1);
+    
+    uint64_t dirs[PATH_MAX / 2];
+    size_t depth = 0;           // Directories of the last file below the root
+    dirs[0] = SNAPSHOT_FS_ROOT;
+    const char *last = "";
+    index_entry_t dir_entry;
+    memset(&dir_entry, 0, sizeof(dir_entry));
+    dir_entry.mode = S_IFDIR | 0755;
+    
+    for (size_t i = 0; i < index.count && result == FRACTYL_OK; i++) {
+        const char *path = index.entries[i].path;
+        if (!path || !*path) continue;
+    
+        // Whole leading directories shared with the last file
+        size_t shared = 0;
+        for (size_t k = 0, level = 0; path[k] && last[k] == path[k]; k++) {
+            if (path[k] == '/') shared = ++level;
+        }
+        if (shared > depth) shared = depth;
+        depth = shared;
+    
+        const char *name = path;
+        for (size_t level = 0; level < shared; level++) name = strchr(name, '/') + 1;
+        const char *slash;
+        while (result == FRACTYL_OK && (slash = strchr(name, '/')) != NULL) {
+            char component[NAME_MAX + 1];
+            size_t len = (size_t)(slash - name);
+            if (len == 0 || len > NAME_MAX || depth + 1 >= sizeof(dirs) / sizeof(dirs[0])) {
+                result = FRACTYL_ERROR_INVALID_STATE;
+                break;
+            }
+            memcpy(component, name, len);
+            component[len] = '\0';
+            result = add_entry(fs, dirs[depth], component, &dir_entry);
+            if (result == FRACTYL_OK) {
+                dirs[++depth] = fs->count;
+                node_at(fs, fs->count)->loaded = 1;
+            }
+            name = slash + 1;
+        }
+        if (result == FRACTYL_OK) {
+            result = add_entry(fs, dirs[depth], name, &index.entries[i]);
+        }
+        last = path;
+    }
+    
+    for (size_t i = 0; i < fs->count && result == FRACTYL_OK; i++) {
+        fs_node_t *node = &fs->nodes[i];
+        if (S_ISDIR(node->mode)) {
+            qsort(node->children, node->child_count, sizeof(fs_child_t), compare_children);
+        }
+    }
+    node_at(fs, SNAPSHOT_FS_ROOT)->loaded = 1;
+    index_free(&index);
+    return result;
+}
+
+int snapshot_fs_open(snapshot_fs_t **fs_out, const char *fractyl_dir, const unsigned char *root,
+                     time_t timestamp) {
+    if (!fs_out || !fractyl_dir || !root) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    snapshot_fs_t *fs = calloc(1, sizeof(*fs));
+    if (!fs) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    fs->fuse_fd = -1;
+    fs->timestamp = timestamp;
+    fs->fractyl_dir = strdup(fractyl_dir);
+    uint64_t root_ino;
+    int result = fs->fractyl_dir ? add_node(fs, SNAPSHOT_FS_ROOT, "", S_IFDIR | 0555, &root_ino)
+                                 : FRACTYL_ERROR_OUT_OF_MEMORY;
+    
+    // Only a tree root can be read a directory at a time
+    void *data = NULL;
+    size_t size = 0;
+    if (result == FRACTYL_OK) result = object_load(root, fractyl_dir, &data, &size);
+    if (result == FRACTYL_OK) {
+        fs->trees = tree_is_tree(data, size);
+        free(data);
+        memcpy(node_at(fs, SNAPSHOT_FS_ROOT)->hash, root, 32);
+        if (!fs->trees) result = load_flat_index(fs, root);
+    }
+    if (result != FRACTYL_OK) {
+        snapshot_fs_close(fs);
+        return result;
+    }
+    *fs_out = fs;
+    return FRACTYL_OK;
+}
+
+static void drop_object(snapshot_fs_t *fs, cached_object_t *object) {
+    if (object->fd >= 0) close(object->fd);
+    fs->cached_bytes -= object->data ? object->size : 0;
+    fs->cached_count--;
+    free(object->data);
+    free(object);
+}
+
+void snapshot_fs_close(snapshot_fs_t *fs) {
+    if (!fs) return;
+    snapshot_fs_unmount(fs);
+    for (size_t i = 0; i < fs->count; i++) {
+        free(fs->nodes[i].name);
+        free(fs->nodes[i].children);
+    }
+    free(fs->nodes);
+    while (fs->objects) {
+        cached_object_t *next = fs->objects->next;
+        drop_object(fs, fs->objects);
+        fs->objects = next;
+    }
+    free(fs->fractyl_dir);
+    free(fs);
+}
+
+static void fill_attr(const snapshot_fs_t *fs, uint64_t ino, snapshot_fs_attr_t *attr) {
+    const fs_node_t *node = &fs->nodes[ino - 1];
+    attr->ino = ino;
+    attr->mode = node->mode;
+    attr->size = node->size;
+    attr->mtime = node->mtime;
+    attr->mtime_nsec = node->mtime_nsec;
+}
+
+int snapshot_fs_getattr(snapshot_fs_t *fs, uint64_t ino, snapshot_fs_attr_t *attr) {
+    if (!fs || !attr) return FRACTYL_ERROR_INVALID_ARGS;
+    if (!node_at(fs, ino)) return FRACTYL_ERROR_NOT_FOUND;
+    fill_attr(fs, ino, attr);
+    return FRACTYL_OK;
+}
+
+int snapshot_fs_lookup(snapshot_fs_t *fs, uint64_t parent, const char *name, snapshot_fs_attr_t *attr) {
+    if (!fs || !name || !attr) return FRACTYL_ERROR_INVALID_ARGS;
+    int result = load_children(fs, parent);
+    if (result != FRACTYL_OK) return result;
+    
+    const fs_node_t *node = node_at(fs, parent);
+    fs_child_t key = { name, 0 };
+    const fs_child_t *found = bsearch(&key, node->children, node->child_count, sizeof(fs_child_t),
+                                      compare_children);
+    if (!found) return FRACTYL_ERROR_NOT_FOUND;
+    fill_attr(fs, found->ino, attr);
+    return FRACTYL_OK;
+}
+
+int snapshot_fs_child(snapshot_fs_t *fs, uint64_t dir, size_t i, const char **name_out,
+                      snapshot_fs_attr_t *attr) {
+    if (!fs || !name_out || !attr) return FRACTYL_ERROR_INVALID_ARGS;
+    int result = load_children(fs, dir);
+    if (result != FRACTYL_OK) return result;
+    
+    const fs_node_t *node = node_at(fs, dir);
+    if (i >= node->child_count) return FRACTYL_ERROR_NOT_FOUND;
+    *name_out = node->children[i].name;
+    fill_attr(fs, node->children[i].ino, attr);
+    return FRACTYL_OK;
+}
+
+// Drop the least recently used objects no handle has open while the cache
+// is over its limits
+static void trim_cache(snapshot_fs_t *fs) {
+    while (fs->cached_count > FS_CACHE_OBJECTS || fs->cached_bytes > FS_CACHE_BYTES) {
+        cached_object_t **oldest = NULL;
+        for (cached_object_t **link = &fs->objects; *link; link = &(*link)->next) {
+            if ((*link)->refs == 0 && (!oldest || (*link)->used < (*oldest)->used)) oldest = link;
+        }
+        if (!oldest) return;
+        cached_object_t *object = *oldest;
+        *oldest = object->next;
+        drop_object(fs, object);
+    }
+}
+
+int snapshot_fs_file_open(snapshot_fs_t *fs, uint64_t ino, uint64_t *handle_out) {
+    if (!fs || !handle_out) return FRACTYL_ERROR_INVALID_ARGS;
+    const fs_node_t *node = node_at(fs, ino);
+    if (!node) return FRACTYL_ERROR_NOT_FOUND;
+    if (!S_ISREG(node->mode)) return FRACTYL_ERROR_INVALID_STATE;
+    
+    cached_object_t *object = fs->objects;
+    while (object && memcmp(object->hash, node->hash, sizeof(object->hash)) != 0) object = object->next;
+    if (!object) {
+        object = calloc(1, sizeof(*object));
+        if (!object) return FRACTYL_ERROR_OUT_OF_MEMORY;
+        memcpy(object->hash, node->hash, sizeof(object->hash));
+        object->fd = object_open_raw(node->hash, fs->fractyl_dir);
+        if (object->fd < 0) {
+            int result = object_load(node->hash, fs->fractyl_dir, &object->data, &object->size);
+            if (result != FRACTYL_OK) {
+                free(object);
+                return result;
+            }
+            fs->cached_bytes += object->size;
+        }
+        object->next = fs->objects;
+        fs->objects = object;
+        fs->cached_count++;
+    }
+    object->refs++;
+    object->used = ++fs->clock;
+    trim_cache(fs);
+    *handle_out = (uint64_t)(uintptr_t)object;
+    return FRACTYL_OK;
+}
+
+ssize_t snapshot_fs_file_read(snapshot_fs_t *fs, uint64_t handle, void *buffer, size_t size, off_t offset) {
+    cached_object_t *object = (cached_object_t *)(uintptr_t)handle;
+    if (!fs || !object || (!buffer && size) || offset < 0) return FRACTYL_ERROR_INVALID_ARGS;
+    
+    if (object->fd < 0) {
+        if ((uint64_t)offset >= object->size) return 0;
+        size_t n = object->size - (size_t)offset < size ? object->size - (size_t)offset : size;
+        memcpy(buffer, (const char *)object->data + offset, n);
+        return (ssize_t)n;
+    }
+    
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(object->fd, (char *)buffer + done, size - done, offset + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return FRACTYL_ERROR_IO;
+        if (n == 0) break;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+void snapshot_fs_file_release(snapshot_fs_t *fs, uint64_t handle) {
+    cached_object_t *object = (cached_object_t *)(uintptr_t)handle;
+    if (!fs || !object) return;
+    if (object->refs > 0) object->refs--;
+    trim_cache(fs);
+}
+
+#ifdef __linux__
+
+// --- FUSE kernel protocol ---
+
+static int to_errno(int result) {
+    switch (result) {
+        case FRACTYL_ERROR_NOT_FOUND: return ENOENT;
+        case FRACTYL_ERROR_OUT_OF_MEMORY: return ENOMEM;
+        case FRACTYL_ERROR_INVALID_ARGS: return EINVAL;
+        case FRACTYL_ERROR_INVALID_STATE: return ENOTDIR;
+        default: return EIO;
+    }
+}
+
+// Errors are negative errnos. A request the kernel gave up on fails to be
+// answered with ENOENT, which is fine.
+static void reply(snapshot_fs_t *fs, uint64_t unique, int error, const void *data, size_t size) {
+    struct fuse_out_header header;
+    header.len = (uint32_t)(sizeof(header) + (error ? 0 : size));
+    header.error = error;
+    header.unique = unique;
+    struct iovec iov[2] = {
+        { &header, sizeof(header) },
+        { (void *)data, error ? 0 : size }
+    };
+    if (writev(fs->fuse_fd, iov, data && size && !error ? 2 : 1) < 0 && errno != ENOENT) {
+        printf("Warning: Failed to answer filesystem request: %s\n", strerror(errno));
+    }
+}
+
+static void fuse_attr_of(const snapshot_fs_attr_t *attr, struct fuse_attr *out) {
+    memset(out, 0, sizeof(*out));
+    out->ino = attr->ino;
+    out->size = (uint64_t)attr->size;
+    out->blocks = ((uint64_t)attr->size + 511) / 512;
+    out->atime = out->mtime = out->ctime = (uint64_t)attr->mtime;
+    out->atimensec = out->mtimensec = out->ctimensec = attr->mtime_nsec;
+    out->mode = attr->mode;
+    out->nlink = S_ISDIR(attr->mode) ? 2 : 1;
+    out->uid = getuid();
+    out->gid = getgid();
+    out->blksize = 4096;
+}
+
+static void reply_entry(snapshot_fs_t *fs, uint64_t unique, int result, const snapshot_fs_attr_t *attr) {
+    struct fuse_entry_out out;
+    memset(&out, 0, sizeof(out));
+    if (result == FRACTYL_ERROR_NOT_FOUND) {
+        // Inode 0 caches the name as missing
+        out.entry_valid = FS_ATTR_TIMEOUT;
+        reply(fs, unique, 0, &out, sizeof(out));
+        return;
+    }
+    if (result != FRACTYL_OK) {
+        reply(fs, unique, -to_errno(result), NULL, 0);
+        return;
+    }
+    out.nodeid = attr->ino;
+    out.entry_valid = FS_ATTR_TIMEOUT;
+    out.attr_valid = FS_ATTR_TIMEOUT;
+    fuse_attr_of(attr, &out.attr);
+    reply(fs, unique, 0, &out, sizeof(out));
+}
+
+static void handle_init(snapshot_fs_t *fs, const struct fuse_in_header *in, const struct fuse_init_in *init) {
+    struct fuse_init_out out;
+    memset(&out, 0, sizeof(out));
+    out.major = FUSE_KERNEL_VERSION;
+    out.minor = FUSE_KERNEL_MINOR_VERSION;
+    if (init->major != FUSE_KERNEL_VERSION) {
+        // The kernel asks again with our major version
+        reply(fs, in->unique, 0, &out, init->major > FUSE_KERNEL_VERSION ? sizeof(out) : 0);
+        return;
+    }
+    out.max_readahead = init->max_readahead;
+    out.flags = init->flags & (FUSE_ASYNC_READ | FUSE_PARALLEL_DIROPS | FUSE_MAX_PAGES);
+    out.max_pages = FS_MAX_READ / 4096;
+    out.max_background = 16;
+    out.congestion_threshold = 12;
+    out.max_write = 4096;
+    out.time_gran = 1;
+    reply(fs, in->unique, 0, &out, init->minor < 23 ? FUSE_COMPAT_22_INIT_OUT_SIZE : sizeof(out));
+}
+
+static void handle_readdir(snapshot_fs_t *fs, const struct fuse_in_header *in, const struct fuse_read_in *read_in,
+                           char *buffer) {
+    size_t size = read_in->size < FS_MAX_READ ? read_in->size : FS_MAX_READ;
+    size_t used = 0;
+    snapshot_fs_attr_t attr;
+    
+    // Offsets 0 and 1 are "." and "..", then the children in name order
+    for (uint64_t offset = read_in->offset;; offset++) {
+        const char *name;
+        uint64_t ino;
+        if (offset == 0) {
+            name = ".";
+            ino = in->nodeid;
+            attr.mode = S_IFDIR;
+        } else if (offset == 1) {
+            name = "..";
+            ino = node_at(fs, in->nodeid) ? node_at(fs, in->nodeid)->parent : SNAPSHOT_FS_ROOT;
+            attr.mode = S_IFDIR;
+        } else {
+            int result = snapshot_fs_child(fs, in->nodeid, (size_t)(offset - 2), &name, &attr);
+            if (result == FRACTYL_ERROR_NOT_FOUND) break;
+            if (result != FRACTYL_OK) {
+                if (used == 0) {
+                    reply(fs, in->unique, -to_errno(result), NULL, 0);
+                    return;
+                }
+                break;
+            }
+            ino = attr.ino;
+        }
+    
+        size_t name_len = strlen(name);
+        size_t entry_size = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + name_len);
+        if (used + entry_size > size) break;
+        struct fuse_dirent *dirent = (struct fuse_dirent *)(buffer + used);
+        memset(dirent, 0, entry_size);
+        dirent->ino = ino;
+        dirent->off = offset + 1;
+        dirent->namelen = (uint32_t)name_len;
+        dirent->type = (attr.mode & S_IFMT) >> 12;
+        memcpy(dirent->name, name, name_len);
+        used += entry_size;
+    }
+    reply(fs, in->unique, 0, buffer, used);
+}
+
+static void handle_request(snapshot_fs_t *fs, const struct fuse_in_header *in, const void *arg, char *buffer) {
+    snapshot_fs_attr_t attr;
+    int result;
+    
+    switch (in->opcode) {
+        case FUSE_INIT:
+            handle_init(fs, in, arg);
+            break;
+        case FUSE_LOOKUP:
+            result = snapshot_fs_lookup(fs, in->nodeid, arg, &attr);
+            reply_entry(fs, in->unique, result, &attr);
+            break;
+        case FUSE_GETATTR: {
+            result = snapshot_fs_getattr(fs, in->nodeid, &attr);
+            if (result != FRACTYL_OK) {
+                reply(fs, in->unique, -to_errno(result), NULL, 0);
+                break;
+            }
+            struct fuse_attr_out out;
+            memset(&out, 0, sizeof(out));
+            out.attr_valid = FS_ATTR_TIMEOUT;
+            fuse_attr_of(&attr, &out.attr);
+            reply(fs, in->unique, 0, &out, sizeof(out));
+            break;
+        }
+        case FUSE_OPEN: {
+            const struct fuse_open_in *open_in = arg;
+            if ((open_in->flags & O_ACCMODE) != O_RDONLY) {
+                reply(fs, in->unique, -EROFS, NULL, 0);
+                break;
+            }
+            struct fuse_open_out out;
+            memset(&out, 0, sizeof(out));
+            result = snapshot_fs_file_open(fs, in->nodeid, &out.fh);
+            if (result != FRACTYL_OK) {
+                reply(fs, in->unique, result == FRACTYL_ERROR_INVALID_STATE ? -EISDIR : -to_errno(result),
+                      NULL, 0);
+                break;
+            }
+            // Contents never change, so the page cache outlives each open
+            out.open_flags = FOPEN_KEEP_CACHE;
+            reply(fs, in->unique, 0, &out, sizeof(out));
+            break;
+        }
+        case FUSE_READ: {
+            const struct fuse_read_in *read_in = arg;
+            size_t size = read_in->size < FS_MAX_READ ? read_in->size : FS_MAX_READ;
+            ssize_t n = snapshot_fs_file_read(fs, read_in->fh, buffer, size, (off_t)read_in->offset);
+            reply(fs, in->unique, n < 0 ? -to_errno((int)n) : 0, buffer, n < 0 ? 0 : (size_t)n);
+            break;
+        }
+        case FUSE_RELEASE:
+            snapshot_fs_file_release(fs, ((const struct fuse_release_in *)arg)->fh);
+            reply(fs, in->unique, 0, NULL, 0);
+            break;
+        case FUSE_OPENDIR: {
+            const fs_node_t *node = node_at(fs, in->nodeid);
+            if (!node || !S_ISDIR(node->mode)) {
+                reply(fs, in->unique, node ? -ENOTDIR : -ENOENT, NULL, 0);
+                break;
+            }
+            struct fuse_open_out out;
+            memset(&out, 0, sizeof(out));
+            out.open_flags = FOPEN_KEEP_CACHE | FOPEN_CACHE_DIR;
+            reply(fs, in->unique, 0, &out, sizeof(out));
+            break;
+        }
+        case FUSE_READDIR:
+            handle_readdir(fs, in, arg, buffer);
+            break;
+        case FUSE_RELEASEDIR:
+        case FUSE_FLUSH:
+            reply(fs, in->unique, 0, NULL, 0);
+            break;
+        case FUSE_STATFS: {
+            struct fuse_statfs_out out;
+            memset(&out, 0, sizeof(out));
+            out.st.bsize = 4096;
+            out.st.frsize = 4096;
+            out.st.files = fs->count;
+            out.st.namelen = NAME_MAX;
+            reply(fs, in->unique, 0, &out, sizeof(out));
+            break;
+        }
+        case FUSE_FORGET:
+        case FUSE_BATCH_FORGET:
+        case FUSE_INTERRUPT:
+            // Inodes live as long as the mount; nothing to answer
+            break;
+        case FUSE_SETATTR:
+        case FUSE_MKNOD:
+        case FUSE_MKDIR:
+        case FUSE_UNLINK:
+        case FUSE_RMDIR:
+        case FUSE_RENAME:
+        case FUSE_RENAME2:
+        case FUSE_LINK:
+        case FUSE_SYMLINK:
+        case FUSE_CREATE:
+        case FUSE_WRITE:
+        case FUSE_SETXATTR:
+        case FUSE_REMOVEXATTR:
+            reply(fs, in->unique, -EROFS, NULL, 0);
+            break;
+        default:
+            reply(fs, in->unique, -ENOSYS, NULL, 0);
+            break;
+    }
+}
+
+// Without the privilege to mount, have fusermount do it and pass back the
+// /dev/fuse descriptor over a socket, as libfuse does
+static int mount_with_fusermount(const char *mountpoint) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) return -1;
+    
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sockets[0]);
+        close(sockets[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        char fd_text[16];
+        snprintf(fd_text, sizeof(fd_text), "%d", sockets[1]);
+        close(sockets[0]);
+        setenv("_FUSE_COMMFD", fd_text, 1);
+        const char *options = "ro,nosuid,nodev,default_permissions,fsname=fractyl,subtype=fractyl";
+        execlp("fusermount3", "fusermount3", "-o", options, "--", mountpoint, (char *)NULL);
+        execlp("fusermount", "fusermount", "-o", options, "--", mountpoint, (char *)NULL);
+        _exit(127);
+    }
+    close(sockets[1]);
+    
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    
+    int fd = -1;
+    ssize_t n;
+    do {
+        n = recvmsg(sockets[0], &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+    }
+    close(sockets[0]);
+    waitpid(pid, NULL, 0);
+    return fd;
+}
+
+int snapshot_fs_mount(snapshot_fs_t *fs, const char *mountpoint) {
+    if (!fs || !mountpoint) return FRACTYL_ERROR_INVALID_ARGS;
+    if (fs->fuse_fd >= 0) return FRACTYL_ERROR_INVALID_STATE;
+    
+    char *resolved = realpath(mountpoint, NULL);
+    if (!resolved) return FRACTYL_ERROR_IO;
+    
+    int denied = 0;
+    int fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+    if (fd >= 0) {
+        char options[128];
+        snprintf(options, sizeof(options), "fd=%d,rootmode=%o,user_id=%u,group_id=%u,default_permissions",
+                 fd, S_IFDIR, (unsigned)getuid(), (unsigned)getgid());
+        if (mount("fractyl", resolved, "fuse.fractyl", MS_RDONLY | MS_NOSUID | MS_NODEV, options) != 0) {
+            denied = errno == EPERM;
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        fd = mount_with_fusermount(resolved);
+        if (fd < 0) {
+            free(resolved);
+            return denied ? FRACTYL_ERROR_PERMISSION_DENIED : FRACTYL_ERROR_IO;
+        }
+        fs->via_fusermount = 1;
+    }
+    fs->fuse_fd = fd;
+    fs->mountpoint = resolved;
+    return FRACTYL_OK;
+}
+
+void snapshot_fs_unmount(snapshot_fs_t *fs) {
+    if (!fs || fs->fuse_fd < 0) return;
+    
+    if (!fs->via_fusermount) {
+        umount2(fs->mountpoint, MNT_DETACH);
+    } else {
+        pid_t pid = fork();
+        if (pid == 0) {
+            execlp("fusermount3", "fusermount3", "-u", "-z", "--", fs->mountpoint, (char *)NULL);
+            execlp("fusermount", "fusermount", "-u", "-z", "--", fs->mountpoint, (char *)NULL);
+            _exit(127);
+        }
+        if (pid > 0) waitpid(pid, NULL, 0);
+    }
+    close(fs->fuse_fd);
+    fs->fuse_fd = -1;
+    free(fs->mountpoint);
+    fs->mountpoint = NULL;
+    fs->via_fusermount = 0;
+}
+
+int snapshot_fs_serve(snapshot_fs_t *fs, volatile sig_atomic_t *stop) {
+    if (!fs || fs->fuse_fd < 0) return FRACTYL_ERROR_INVALID_STATE;
+    
+    // A request with the largest write it may carry, and room for replies
+    size_t request_size = FS_MAX_READ + 4096;
+    char *request = malloc(request_size);
+    char *buffer = malloc(FS_MAX_READ);
+    if (!request || !buffer) {
+        free(request);
+        free(buffer);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    
+    int result = FRACTYL_OK;
+    while (!stop || !*stop) {
+        // Wake up now and then to notice stop
+        struct pollfd pfd = { fs->fuse_fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, 500);
+        if (ready < 0 && errno != EINTR) {
+            result = FRACTYL_ERROR_IO;
+            break;
+        }
+        if (ready <= 0) continue;
+    
+        ssize_t n = read(fs->fuse_fd, request, request_size);
+        if (n < 0) {
+            // Interrupted, or a request withdrawn before it was read
+            if (errno == EINTR || errno == ENOENT || errno == EAGAIN) continue;
+            // Unmounted
+            if (errno != ENODEV) result = FRACTYL_ERROR_IO;
+            break;
+        }
+        const struct fuse_in_header *in = (const struct fuse_in_header *)request;
+        if ((size_t)n < sizeof(*in) || in->len != (uint32_t)n) continue;
+        if (in->opcode == FUSE_DESTROY) {
+            reply(fs, in->unique, 0, NULL, 0);
+            break;
+        }
+        handle_request(fs, in, request + sizeof(*in), buffer);
+    }
+    free(request);
+    free(buffer);
+    snapshot_fs_unmount(fs);
+    return result;
+}
+
+#else
+
+int snapshot_fs_mount(snapshot_fs_t *fs, const char *mountpoint) {
+    (void)fs;
+    (void)mountpoint;
+    return FRACTYL_ERROR_GENERIC;
+}
+
+void snapshot_fs_unmount(snapshot_fs_t *fs) {
+    (void)fs;
+}
+
+int snapshot_fs_serve(snapshot_fs_t *fs, volatile sig_atomic_t *stop) {
+    (void)fs;
+    (void)stop;
+    return FRACTYL_ERROR_GENERIC;
+}
+
+#endif
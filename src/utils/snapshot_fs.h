@@ -0,0 +1,66 @@
+#ifndef SNAPSHOT_FS_H
+#define SNAPSHOT_FS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <time.h>
+
+// A read-only filesystem view of one snapshot, served straight from its
+// trees and the object store, for "frac mount".
+//
+// Inodes are numbered as directories are first visited: a directory's
+// tree object is read when it is looked up in or listed, not before, and
+// kept afterwards. Snapshots stored as one flat index object are read in
+// full when opened. File contents come from the objects: a raw loose
+// object is read in place with pread(), so the page cache holds the object
+// file itself; anything packed or encoded is decoded once into memory. The
+// most recently opened objects stay cached after their last handle closes.
+//
+// On Linux the view is mounted with FUSE, speaking the kernel protocol on
+// /dev/fuse directly; without the privilege to mount, fusermount does it.
+// A snapshot_fs_t is used from one thread.
+
+#define SNAPSHOT_FS_ROOT 1
+
+typedef struct snapshot_fs snapshot_fs_t;
+
+typedef struct {
+    uint64_t ino;
+    mode_t mode;
+    off_t size;
+    time_t mtime;
+    uint32_t mtime_nsec;
+} snapshot_fs_attr_t;
+
+// View the snapshot whose root tree (or flat index object) is root;
+// directories get the snapshot's timestamp
+int snapshot_fs_open(snapshot_fs_t **fs_out, const char *fractyl_dir, const unsigned char *root,
+                     time_t timestamp);
+// Unmounts first if mounted
+void snapshot_fs_close(snapshot_fs_t *fs);
+
+// FRACTYL_ERROR_NOT_FOUND for unknown inodes and names
+int snapshot_fs_getattr(snapshot_fs_t *fs, uint64_t ino, snapshot_fs_attr_t *attr);
+int snapshot_fs_lookup(snapshot_fs_t *fs, uint64_t parent, const char *name, snapshot_fs_attr_t *attr);
+
+// Child i of a directory, in name order; FRACTYL_ERROR_NOT_FOUND past the
+// last one. name_out lives as long as the view.
+int snapshot_fs_child(snapshot_fs_t *fs, uint64_t dir, size_t i, const char **name_out,
+                      snapshot_fs_attr_t *attr);
+
+// Open a file for reading; the handle is passed to read and release
+int snapshot_fs_file_open(snapshot_fs_t *fs, uint64_t ino, uint64_t *handle_out);
+// Bytes read (0 at the end), or a negative FRACTYL_ERROR_* code
+ssize_t snapshot_fs_file_read(snapshot_fs_t *fs, uint64_t handle, void *buffer, size_t size, off_t offset);
+void snapshot_fs_file_release(snapshot_fs_t *fs, uint64_t handle);
+
+// Mount the view read-only at mountpoint, an existing directory
+int snapshot_fs_mount(snapshot_fs_t *fs, const char *mountpoint);
+// Answer requests until the filesystem is unmounted or *stop is set,
+// then unmount it
+int snapshot_fs_serve(snapshot_fs_t *fs, volatile sig_atomic_t *stop);
+void snapshot_fs_unmount(snapshot_fs_t *fs);
+
+#endif // SNAPSHOT_FS_H
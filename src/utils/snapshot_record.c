@@ -0,0 +1,265 @@
+#include "snapshot_record.h"
+#include "json.h"
+#include "../include/fractyl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define RECORD_HEADER_SIZE 336
+#define RECORD_STATS 184
+#define RECORD_PATH_SIZES 272
+#define RECORD_CHECKSUM 324
+
+// Counters of snapshot_stats_t in record order
+static const size_t stats_offsets[] = {
+    offsetof(snapshot_stats_t, files),
+    offsetof(snapshot_stats_t, files_changed),
+    offsetof(snapshot_stats_t, bytes_changed),
+    offsetof(snapshot_stats_t, objects_written),
+    offsetof(snapshot_stats_t, bytes_written),
+    offsetof(snapshot_stats_t, bytes_deduplicated),
+    offsetof(snapshot_stats_t, scan_ms),
+    offsetof(snapshot_stats_t, hash_ms),
+    offsetof(snapshot_stats_t, store_ms),
+    offsetof(snapshot_stats_t, tree_ms),
+    offsetof(snapshot_stats_t, total_ms),
+};
+#define STATS_COUNT (sizeof(stats_offsets) / sizeof(stats_offsets[0]))
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static void put_u64(unsigned char *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(const unsigned char *p) {
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+// FNV-1a of a record with its checksum field zeroed
+static uint32_t record_checksum(const unsigned char *data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        unsigned char byte = i >= RECORD_CHECKSUM && i < RECORD_CHECKSUM + 4 ? 0 : data[i];
+        hash ^= byte;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static unsigned long long *stats_counter(snapshot_stats_t *stats, size_t i) {
+    return (unsigned long long *)((char *)stats + stats_offsets[i]);
+}
+
+int snapshot_record_encode(const snapshot_t *snapshot, unsigned char **data_out, size_t *size_out) {
+    if (!snapshot || !data_out || !size_out || snapshot->id[0] == '\0' ||
+        (snapshot->parent && strlen(snapshot->parent) >= 64) ||
+        snapshot->stats.path_count > SNAPSHOT_STATS_PATHS || snapshot->git_status_count > UINT32_MAX) {
+        return FRACTYL_ERROR_INVALID_ARGS;
+    }
+    
+    // Strings in record order; missing ones are stored empty and flagged
+    const char *fixed[3] = { snapshot->description, snapshot->git_branch, snapshot->git_commit };
+    uint32_t flags = 0;
+    size_t strings_size = 0;
+    for (int i = 0; i < 3; i++) {
+        if (fixed[i]) flags |= SNAPSHOT_RECORD_HAS_DESCRIPTION << i;
+        strings_size += (fixed[i] ? strlen(fixed[i]) : 0) + 1;
+    }
+    for (size_t i = 0; i < snapshot->git_status_count; i++) {
+        strings_size += strlen(snapshot->git_status[i] ? snapshot->git_status[i] : "") + 1;
+    }
+    for (size_t i = 0; i < snapshot->stats.path_count; i++) {
+        strings_size += strlen(snapshot->stats.paths[i] ? snapshot->stats.paths[i] : "") + 1;
+    }
+    if (strings_size > UINT32_MAX - RECORD_HEADER_SIZE) return FRACTYL_ERROR_INVALID_ARGS;
+    if (snapshot->parent) flags |= SNAPSHOT_RECORD_HAS_PARENT;
+    if (snapshot->git_dirty) flags |= SNAPSHOT_RECORD_GIT_DIRTY;
+    if (snapshot->stats.recorded) flags |= SNAPSHOT_RECORD_STATS_RECORDED;
+    
+    size_t size = RECORD_HEADER_SIZE + strings_size;
+    unsigned char *data = calloc(1, size);
+    if (!data) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    memcpy(data, "FSNP", 4);
+    put_u32(data + 4, SNAPSHOT_RECORD_VERSION);
+    put_u32(data + 8, RECORD_HEADER_SIZE);
+    put_u32(data + 12, flags);
+    put_u64(data + 16, (uint64_t)(int64_t)snapshot->timestamp);
+    memcpy(data + 24, snapshot->index_hash, 32);
+    snprintf((char *)data + 56, 64, "%s", snapshot->id);
+    if (snapshot->parent) snprintf((char *)data + 120, 64, "%s", snapshot->parent);
+    snapshot_stats_t stats = snapshot->stats;
+    for (size_t i = 0; i < STATS_COUNT; i++) {
+        put_u64(data + RECORD_STATS + i * 8, *stats_counter(&stats, i));
+    }
+    for (size_t i = 0; i < snapshot->stats.path_count; i++) {
+        put_u64(data + RECORD_PATH_SIZES + i * 8, snapshot->stats.path_sizes[i]);
+    }
+    put_u32(data + 312, (uint32_t)snapshot->git_status_count);
+    put_u32(data + 316, (uint32_t)snapshot->stats.path_count);
+    put_u32(data + 320, (uint32_t)strings_size);
+    
+    size_t offset = RECORD_HEADER_SIZE;
+    size_t string_count = 3 + snapshot->git_status_count + snapshot->stats.path_count;
+    for (size_t i = 0; i < string_count; i++) {
+        const char *s;
+        if (i < 3) {
+            s = fixed[i];
+        } else if (i < 3 + snapshot->git_status_count) {
+            s = snapshot->git_status[i - 3];
+        } else {
+            s = snapshot->stats.paths[i - 3 - snapshot->git_status_count];
+        }
+        size_t len = strlen(s ? s : "") + 1;
+        memcpy(data + offset, s ? s : "", len);
+        offset += len;
+    }
+    put_u32(data + RECORD_CHECKSUM, record_checksum(data, size));
+    
+    *data_out = data;
+    *size_out = size;
+    return FRACTYL_OK;
+}
+
+int snapshot_record_decode(const unsigned char *data, size_t size, snapshot_t *snapshot) {
+    if (!data || !snapshot) return FRACTYL_ERROR_INVALID_ARGS;
+    memset(snapshot, 0, sizeof(*snapshot));
+    if (size < RECORD_HEADER_SIZE || memcmp(data, "FSNP", 4) != 0 ||
+        get_u32(data + 4) != SNAPSHOT_RECORD_VERSION || get_u32(data + 8) != RECORD_HEADER_SIZE ||
+        get_u32(data + 320) != size - RECORD_HEADER_SIZE ||
+        get_u32(data + RECORD_CHECKSUM) != record_checksum(data, size) ||
+        !memchr(data + 56, '\0', 64) || data[56] == '\0' || !memchr(data + 120, '\0', 64)) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    uint32_t flags = get_u32(data + 12);
+    size_t status_count = get_u32(data + 312);
+    size_t path_count = get_u32(data + 316);
+    if (path_count > SNAPSHOT_STATS_PATHS) return FRACTYL_ERROR_GENERIC;
+    
+    // Every string must end inside the record
+    const char *strings = (const char *)data + RECORD_HEADER_SIZE;
+    size_t strings_size = size - RECORD_HEADER_SIZE, offset = 0;
+    size_t string_count = 3 + status_count + path_count;
+    if (status_count > strings_size) return FRACTYL_ERROR_GENERIC;
+    const char **found = malloc(sizeof(char *) * string_count);
+    if (!found) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    for (size_t i = 0; i < string_count; i++) {
+        const char *end = offset < strings_size ? memchr(strings + offset, '\0', strings_size - offset) : NULL;
+        if (!end) {
+            free(found);
+            return FRACTYL_ERROR_GENERIC;
+        }
+        found[i] = strings + offset;
+        offset = (size_t)(end - strings) + 1;
+    }
+    
+    snprintf(snapshot->id, sizeof(snapshot->id), "%s", (const char *)data + 56);
+    snapshot->timestamp = (time_t)(int64_t)get_u64(data + 16);
+    memcpy(snapshot->index_hash, data + 24, 32);
+    snapshot->git_dirty = (flags & SNAPSHOT_RECORD_GIT_DIRTY) != 0;
+    snapshot->stats.recorded = (flags & SNAPSHOT_RECORD_STATS_RECORDED) != 0;
+    for (size_t i = 0; i < STATS_COUNT; i++) {
+        *stats_counter(&snapshot->stats, i) = get_u64(data + RECORD_STATS + i * 8);
+    }
+    
+    int ok = 1;
+    if (flags & SNAPSHOT_RECORD_HAS_PARENT) ok &= (snapshot->parent = strdup((const char *)data + 120)) != NULL;
+    char **fixed[3] = { &snapshot->description, &snapshot->git_branch, &snapshot->git_commit };
+    for (int i = 0; i < 3; i++) {
+        if (flags & (SNAPSHOT_RECORD_HAS_DESCRIPTION << i)) ok &= (*fixed[i] = strdup(found[i])) != NULL;
+    }
+    if (status_count > 0) {
+        snapshot->git_status = calloc(status_count, sizeof(char *));
+        ok &= snapshot->git_status != NULL;
+        for (size_t i = 0; ok && i < status_count; i++) {
+            ok &= (snapshot->git_status[i] = strdup(found[3 + i])) != NULL;
+            snapshot->git_status_count = i + 1;
+        }
+    }
+    for (size_t i = 0; ok && i < path_count; i++) {
+        ok &= (snapshot->stats.paths[i] = strdup(found[3 + status_count + i])) != NULL;
+        snapshot->stats.path_sizes[i] = get_u64(data + RECORD_PATH_SIZES + i * 8);
+        snapshot->stats.path_count = i + 1;
+    }
+    free(found);
+    if (!ok) {
+        json_free_snapshot(snapshot);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    return FRACTYL_OK;
+}
+
+int snapshot_record_save(const snapshot_t *snapshot, const char *path) {
+    if (!snapshot || !path) return FRACTYL_ERROR_INVALID_ARGS;
+    unsigned char *data;
+    size_t size;
+    int result = snapshot_record_encode(snapshot, &data, &size);
+    if (result != FRACTYL_OK) return result;
+    
+    // Written under a hidden name and renamed, so readers never see half a
+    // snapshot; the leading dot keeps it out of snapshot listings
+    char temp_path[4096];
+    const char *slash = strrchr(path, '/');
+    int dir_len = slash ? (int)(slash - path + 1) : 0;
+    if (snprintf(temp_path, sizeof(temp_path), "%.*s.%s.tmp", dir_len, path, path + dir_len) >=
+        (int)sizeof(temp_path)) {
+        free(data);
+        return FRACTYL_ERROR_PATH_TOO_LONG;
+    }
+    int fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(data);
+        return FRACTYL_ERROR_IO;
+    }
+    int written = write(fd, data, size) == (ssize_t)size;
+    if (close(fd) != 0) written = 0;
+    free(data);
+    if (!written || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return FRACTYL_ERROR_IO;
+    }
+    return FRACTYL_OK;
+}
+
+int snapshot_record_load(snapshot_t *snapshot, const char *path) {
+    if (!snapshot || !path) return FRACTYL_ERROR_INVALID_ARGS;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT ? FRACTYL_ERROR_NOT_FOUND : FRACTYL_ERROR_IO;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < RECORD_HEADER_SIZE || st.st_size > UINT32_MAX) {
+        close(fd);
+        return FRACTYL_ERROR_IO;
+    }
+    size_t size = (size_t)st.st_size;
+    unsigned char *data = malloc(size);
+    if (!data) {
+        close(fd);
+        return FRACTYL_ERROR_OUT_OF_MEMORY;
+    }
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(fd, data + got, size - got, (off_t)got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+    int result = got == size ? snapshot_record_decode(data, size, snapshot) : FRACTYL_ERROR_IO;
+    free(data);
+    return result;
+}
@@ -0,0 +1,58 @@
+#ifndef SNAPSHOT_RECORD_H
+#define SNAPSHOT_RECORD_H
+
+#include "../include/core.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Snapshot records: the metadata of one snapshot in a fixed layout, stored
+// as <id>.snap in its branch's snapshots directory. Every field sits at a
+// known offset, so a record is checked and decoded without tokenizing
+// anything. Snapshots stored before records existed are <id>.json files;
+// they stay readable (catalog_load_snapshot) and are converted to records
+// by the next snapshot stored on their branch. JSON (json.h) is still what
+// `frac show --metadata` prints.
+//
+// Layout, little-endian:
+//   0  "FSNP"             4  u32 version         8  u32 header size
+//  12  u32 flags         16  i64 timestamp      24  index hash[32]
+//  56  id[64]           120  parent[64]
+// 184  u64 stats counters, in snapshot_stats_t order (files .. total_ms)
+// 272  u64 sizes of the largest changes[5]
+// 312  u32 git status lines   316  u32 largest changes   320  u32 strings size
+// 324  u32 FNV-1a of the header with this field zeroed and the strings
+// 328  u64 reserved
+// followed by the description, git branch and git commit, the git status
+// lines and the paths of the largest changes, each ending in a NUL.
+
+#define SNAPSHOT_RECORD_SUFFIX ".snap"
+#define SNAPSHOT_RECORD_VERSION 1
+
+// Record flags
+#define SNAPSHOT_RECORD_HAS_PARENT      0x1
+#define SNAPSHOT_RECORD_HAS_DESCRIPTION 0x2
+#define SNAPSHOT_RECORD_HAS_GIT_BRANCH  0x4
+#define SNAPSHOT_RECORD_HAS_GIT_COMMIT  0x8
+#define SNAPSHOT_RECORD_GIT_DIRTY       0x10
+#define SNAPSHOT_RECORD_STATS_RECORDED  0x20
+
+// Encode snapshot into a malloc'd buffer
+int snapshot_record_encode(const snapshot_t *snapshot, unsigned char **data_out, size_t *size_out);
+
+// Decode a record; the snapshot is freed with json_free_snapshot()
+int snapshot_record_decode(const unsigned char *data, size_t size, snapshot_t *snapshot);
+
+// Write snapshot's record to path, under a hidden name renamed into place
+int snapshot_record_save(const snapshot_t *snapshot, const char *path);
+
+// Read the record at path
+int snapshot_record_load(snapshot_t *snapshot, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SNAPSHOT_RECORD_H
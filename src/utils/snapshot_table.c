@@ -0,0 +1,289 @@
+#include "snapshot_table.h"
+#include "catalog.h"
+#include "paths.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TABLE_HEADER "fractyl-snapshot-table 1"
+
+static long long mtime_ns(const struct stat *st) {
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+static void free_row(snapshot_table_row_t *row) {
+    free(row->branch);
+    free(row->snapshots_dir);
+}
+
+static int same_branch(const char *a, const char *b) {
+    return a && b ? strcmp(a, b) == 0 : a == b;
+}
+
+static snapshot_table_row_t* append_row(snapshot_table_t *table, size_t *capacity, const char *fractyl_dir,
+                                        const char *branch) {
+    if (table->count == *capacity) {
+        size_t grown_capacity = *capacity ? *capacity * 2 : 8;
+        snapshot_table_row_t *grown = realloc(table->rows, grown_capacity * sizeof(snapshot_table_row_t));
+        if (!grown) return NULL;
+        table->rows = grown;
+        *capacity = grown_capacity;
+    }
+    snapshot_table_row_t *row = &table->rows[table->count];
+    memset(row, 0, sizeof(*row));
+    row->branch = branch ? strdup(branch) : NULL;
+    row->snapshots_dir = paths_get_snapshots_dir(fractyl_dir, branch);
+    if ((branch && !row->branch) || !row->snapshots_dir) {
+        free_row(row);
+        return NULL;
+    }
+    row->catalog_size = -1;     // Not read yet
+    table->count++;
+    return row;
+}
+
+// Read the row's catalog again unless its stamp still matches. Returns 1
+// if the row changed, -1 if the branch has no snapshots directory anymore.
+static int refresh_row(snapshot_table_row_t *row) {
+    struct stat dir_st, catalog_st;
+    if (stat(row->snapshots_dir, &dir_st) != 0 || !S_ISDIR(dir_st.st_mode)) return -1;
+    
+    char catalog_path[4096];
+    snprintf(catalog_path, sizeof(catalog_path), "%s%s", row->snapshots_dir, CATALOG_SUFFIX);
+    if (stat(catalog_path, &catalog_st) == 0 && row->catalog_size == (long long)catalog_st.st_size &&
+        row->catalog_mtime == mtime_ns(&catalog_st) && row->dir_mtime == mtime_ns(&dir_st)) {
+        return 0;
+    }
+    
+    // Loading brings the catalog up to date first, so stamp it afterwards
+    catalog_t catalog;
+    if (catalog_load(row->snapshots_dir, &catalog) != FRACTYL_OK) return 0;
+    const catalog_entry_t *newest = catalog_nth_newest(&catalog, 0);
+    row->count = catalog.count;
+    row->newest = newest ? newest->timestamp : 0;
+    snprintf(row->newest_id, sizeof(row->newest_id), "%s", newest ? newest->id : "");
+    catalog_free(&catalog);
+    
+    row->catalog_size = -1;
+    if (stat(catalog_path, &catalog_st) == 0 && stat(row->snapshots_dir, &dir_st) == 0) {
+        row->catalog_size = (long long)catalog_st.st_size;
+        row->catalog_mtime = mtime_ns(&catalog_st);
+        row->dir_mtime = mtime_ns(&dir_st);
+    }
+    return 1;
+}
+
+static int read_table(const char *path, const char *fractyl_dir, snapshot_table_t *table) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return FRACTYL_ERROR_NOT_FOUND;
+    
+    char line[4096];
+    if (!fgets(line, sizeof(line), fp) || strncmp(line, TABLE_HEADER "\n", sizeof(TABLE_HEADER)) != 0) {
+        fclose(fp);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    size_t capacity = 0;
+    int result = FRACTYL_OK;
+    while (result == FRACTYL_OK && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        unsigned long long count;
+        long long newest, catalog_size, catalog_mtime, dir_mtime;
+        char newest_id[64];
+        int branch_at = 0;
+        if (sscanf(line, "%llu %lld %lld %lld %lld %63s %n", &count, &newest, &catalog_size,
+                   &catalog_mtime, &dir_mtime, newest_id, &branch_at) != 6 || branch_at == 0 ||
+            line[branch_at] == '\0') {
+            result = FRACTYL_ERROR_IO;
+            break;
+        }
+        const char *branch = strcmp(line + branch_at, "-") == 0 ? NULL : line + branch_at;
+        snapshot_table_row_t *row = append_row(table, &capacity, fractyl_dir, branch);
+        if (!row) {
+            result = FRACTYL_ERROR_OUT_OF_MEMORY;
+            break;
+        }
+        row->count = (size_t)count;
+        row->newest = (time_t)newest;
+        snprintf(row->newest_id, sizeof(row->newest_id), "%s", strcmp(newest_id, "-") == 0 ? "" : newest_id);
+        row->catalog_size = catalog_size;
+        row->catalog_mtime = catalog_mtime;
+        row->dir_mtime = dir_mtime;
+    }
+    fclose(fp);
+    return result;
+}
+
+static int write_table(const char *path, const snapshot_table_t *table) {
+    char temp_path[4096];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp.%d", path, (int)getpid());
+    FILE *fp = fopen(temp_path, "w");
+    if (!fp) return FRACTYL_ERROR_IO;
+    
+    fprintf(fp, "%s\n", TABLE_HEADER);
+    for (size_t i = 0; i < table->count; i++) {
+        const snapshot_table_row_t *row = &table->rows[i];
+        fprintf(fp, "%zu %lld %lld %lld %lld %s %s\n", row->count, (long long)row->newest,
+                row->catalog_size, row->catalog_mtime, row->dir_mtime,
+                row->newest_id[0] ? row->newest_id : "-", row->branch ? row->branch : "-");
+    }
+    int written = !ferror(fp);
+    if (fclose(fp) != 0) written = 0;
+    if (!written || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return FRACTYL_ERROR_IO;
+    }
+    return FRACTYL_OK;
+}
+
+typedef struct {
+    const char *fractyl_dir;
+    snapshot_table_t *table;
+    size_t *capacity;
+} branch_rows_t;
+
+// Add a row for a branch found under refs/heads
+static int add_branch_row(const char *branch, const char *snapshots_dir, void *ctx) {
+    (void)snapshots_dir;
+    branch_rows_t *rows = ctx;
+    return append_row(rows->table, rows->capacity, rows->fractyl_dir, branch) ? FRACTYL_OK
+                                                                               : FRACTYL_ERROR_OUT_OF_MEMORY;
+}
+
+static int compare_rows(const void *a, const void *b) {
+    const snapshot_table_row_t *x = a, *y = b;
+    if (x->newest != y->newest) return x->newest < y->newest ? 1 : -1;
+    int order = strcmp(x->newest_id, y->newest_id);
+    return order < 0 ? 1 : order > 0 ? -1 : 0;
+}
+
+// Load the table, adding branch (NULL: none) if add is set
+static int load_table(const char *fractyl_dir, int add, const char *branch, snapshot_table_t *table) {
+    memset(table, 0, sizeof(*table));
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", fractyl_dir, SNAPSHOT_TABLE_FILE);
+    
+    int changed = 0;
+    int result = read_table(path, fractyl_dir, table);
+    size_t capacity = table->count;
+    if (result != FRACTYL_OK) {
+        snapshot_table_free(table);
+        if (result == FRACTYL_ERROR_OUT_OF_MEMORY) return result;
+    
+        capacity = 0;
+        branch_rows_t rows = { fractyl_dir, table, &capacity };
+        result = paths_for_each_branch(fractyl_dir, add_branch_row, &rows);
+        if (result == FRACTYL_OK && !append_row(table, &capacity, fractyl_dir, NULL)) {
+            result = FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+        if (result != FRACTYL_OK) {
+            snapshot_table_free(table);
+            return result;
+        }
+        changed = 1;
+    }
+    if (add && !snapshot_table_find(table, branch)) {
+        if (!append_row(table, &capacity, fractyl_dir, branch)) {
+            snapshot_table_free(table);
+            return FRACTYL_ERROR_OUT_OF_MEMORY;
+        }
+        changed = 1;
+    }
+    
+    // Bring rows up to date; branches whose snapshots are gone drop out
+    size_t kept = 0;
+    for (size_t i = 0; i < table->count; i++) {
+        int refreshed = refresh_row(&table->rows[i]);
+        if (refreshed < 0) {
+            free_row(&table->rows[i]);
+            changed = 1;
+            continue;
+        }
+        if (refreshed > 0) changed = 1;
+        table->rows[kept++] = table->rows[i];
+    }
+    table->count = kept;
+    qsort(table->rows, table->count, sizeof(snapshot_table_row_t), compare_rows);
+    
+    // Readers refresh it too; whoever writes last wins, and either is right
+    if (changed) {
+        write_table(path, table);
+    }
+    return FRACTYL_OK;
+}
+
+int snapshot_table_load(const char *fractyl_dir, snapshot_table_t *table) {
+    if (!fractyl_dir || !table) return FRACTYL_ERROR_INVALID_ARGS;
+    return load_table(fractyl_dir, 0, NULL, table);
+}
+
+void snapshot_table_free(snapshot_table_t *table) {
+    if (!table) return;
+    for (size_t i = 0; i < table->count; i++) {
+        free_row(&table->rows[i]);
+    }
+    free(table->rows);
+    memset(table, 0, sizeof(*table));
+}
+
+int snapshot_table_add_branch(const char *fractyl_dir, const char *branch) {
+    if (!fractyl_dir) return FRACTYL_ERROR_INVALID_ARGS;
+    snapshot_table_t table;
+    int result = load_table(fractyl_dir, 1, branch && *branch ? branch : NULL, &table);
+    if (result == FRACTYL_OK) snapshot_table_free(&table);
+    return result;
+}
+
+const snapshot_table_row_t* snapshot_table_find(const snapshot_table_t *table, const char *branch) {
+    if (!table) return NULL;
+    if (branch && !*branch) branch = NULL;
+    for (size_t i = 0; i < table->count; i++) {
+        if (same_branch(table->rows[i].branch, branch)) return &table->rows[i];
+    }
+    return NULL;
+}
+
+int snapshot_table_load_catalogs(const snapshot_table_t *table, catalog_t **catalogs_out) {
+    if (!table || !catalogs_out) return FRACTYL_ERROR_INVALID_ARGS;
+    catalog_t *catalogs = calloc(table->count ? table->count : 1, sizeof(catalog_t));
+    if (!catalogs) return FRACTYL_ERROR_OUT_OF_MEMORY;
+    for (size_t i = 0; i < table->count; i++) {
+        int result = catalog_load(table->rows[i].snapshots_dir, &catalogs[i]);
+        if (result != FRACTYL_OK) {
+            snapshot_table_free_catalogs(table, catalogs);
+            return result;
+        }
+    }
+    *catalogs_out = catalogs;
+    return FRACTYL_OK;
+}
+
+void snapshot_table_free_catalogs(const snapshot_table_t *table, catalog_t *catalogs) {
+    if (!table || !catalogs) return;
+    for (size_t i = 0; i < table->count; i++) {
+        catalog_free(&catalogs[i]);
+    }
+    free(catalogs);
+}
+
+const catalog_entry_t* snapshot_table_next_newest(const snapshot_table_t *table, const catalog_t *catalogs,
+                                                  size_t *remaining, size_t *row_out) {
+    const catalog_entry_t *best = NULL;
+    size_t best_row = 0;
+    for (size_t i = 0; i < table->count; i++) {
+        if (remaining[i] == 0) continue;
+        const catalog_entry_t *entry = &catalogs[i].entries[remaining[i] - 1];
+        if (!best || entry->timestamp > best->timestamp ||
+            (entry->timestamp == best->timestamp && strcmp(entry->id, best->id) > 0)) {
+            best = entry;
+            best_row = i;
+        }
+    }
+    if (best) {
+        remaining[best_row]--;
+        if (row_out) *row_out = best_row;
+    }
+    return best;
+}
@@ -0,0 +1,72 @@
+#ifndef SNAPSHOT_TABLE_H
+#define SNAPSHOT_TABLE_H
+
+#include "../include/fractyl.h"
+#include "catalog.h"
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Snapshot table: the branches of a repository that have snapshots, so
+// questions spanning branches go straight to their catalogs (catalog.h)
+// instead of walking .fractyl/refs/heads.
+//
+// .fractyl/snapshot-table holds one line per branch: its snapshot count,
+// newest snapshot and the stamp (size and mtimes) of the catalog and
+// snapshots directory those were read from. Loading re-reads the catalog
+// of any row whose stamp no longer matches, so snapshots stored or removed
+// by anything that did not update the table are picked up; only new
+// branches must be added (snapshot_table_add_branch), and a missing or
+// unreadable table is rebuilt by walking refs/heads once. The table is
+// written to a temporary file and renamed into place.
+//
+// Layout: "fractyl-snapshot-table 1", then lines of
+//   <count> <newest timestamp> <catalog size> <catalog mtime ns>
+//   <directory mtime ns> <newest id or -> <branch or - for no branch>
+
+#define SNAPSHOT_TABLE_FILE "snapshot-table"
+
+typedef struct {
+    char *branch;               // NULL for the snapshots of a repository without git
+    char *snapshots_dir;
+    size_t count;
+    time_t newest;              // Timestamp of the newest snapshot, 0 if none
+    char newest_id[64];         // Empty if none
+    long long catalog_size;     // Stamp the row was taken at
+    long long catalog_mtime;
+    long long dir_mtime;
+} snapshot_table_row_t;
+
+typedef struct {
+    snapshot_table_row_t *rows; // Branch with the newest snapshot first
+    size_t count;
+} snapshot_table_t;
+
+// Load the table of fractyl_dir, refreshing out of date rows
+int snapshot_table_load(const char *fractyl_dir, snapshot_table_t *table);
+void snapshot_table_free(snapshot_table_t *table);
+
+// Make sure branch (NULL: no branch) has a row
+int snapshot_table_add_branch(const char *fractyl_dir, const char *branch);
+
+// The row of branch (NULL: no branch), NULL if it has none
+const snapshot_table_row_t* snapshot_table_find(const snapshot_table_t *table, const char *branch);
+
+// The catalogs of every row; (*catalogs_out)[i] is that of table->rows[i]
+int snapshot_table_load_catalogs(const snapshot_table_t *table, catalog_t **catalogs_out);
+void snapshot_table_free_catalogs(const snapshot_table_t *table, catalog_t *catalogs);
+
+// Step through the snapshots of all branches newest first. remaining[i]
+// starts out as catalogs[i].count and counts down; *row_out receives the
+// row of the entry returned. NULL once every catalog is done.
+const catalog_entry_t* snapshot_table_next_newest(const snapshot_table_t *table, const catalog_t *catalogs,
+                                                  size_t *remaining, size_t *row_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SNAPSHOT_TABLE_H
@@ -1,157 +1,79 @@
 #include "snapshots.h"
 #include "paths.h"
 #include "json.h"
+#include "catalog.h"
+#include "snapshot_table.h"
 #include "../include/core.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <dirent.h>
 #include <time.h>
 
 // Get chronologically ordered snapshots for a branch (newest first)
 char** get_chronological_snapshots(const char *fractyl_dir, const char *branch, size_t *count) {
+    *count = 0;
     char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, branch);
     if (!snapshots_dir) {
-        *count = 0;
         return NULL;
     }
     
-    DIR *d = opendir(snapshots_dir);
-    if (!d) {
-        *count = 0;
-        free(snapshots_dir);
+    catalog_t catalog;
+    int result = catalog_load(snapshots_dir, &catalog);
+    free(snapshots_dir);
+    if (result != FRACTYL_OK || catalog.count == 0) {
+        catalog_free(&catalog);
         return NULL;
     }
     
-    // First pass: collect all snapshots with timestamps
-    typedef struct {
-        char *id;
-        time_t timestamp;
-    } snapshot_info_t;
-    
-    snapshot_info_t *snapshots = NULL;
-    size_t capacity = 0;
-    *count = 0;
-    
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL) {
-        if (entry->d_name[0] == '.' || !strstr(entry->d_name, ".json")) {
-            continue;
-        }
-        
-        char snapshot_path[2048];
-        snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", snapshots_dir, entry->d_name);
-        
-        snapshot_t snapshot;
-        if (json_load_snapshot(&snapshot, snapshot_path) == FRACTYL_OK) {
-            if (*count >= capacity) {
-                capacity = capacity ? capacity * 2 : 16;
-                snapshots = realloc(snapshots, capacity * sizeof(snapshot_info_t));
-            }
-            
-            snapshots[*count].id = strdup(snapshot.id);
-            snapshots[*count].timestamp = snapshot.timestamp;
-            (*count)++;
-            
-            json_free_snapshot(&snapshot);
-        }
-    }
-    closedir(d);
-    free(snapshots_dir);
-    
-    if (*count == 0) {
-        free(snapshots);
+    const catalog_entry_t **order = catalog_newest_first(&catalog);
+    char **ids = order ? malloc(catalog.count * sizeof(char*)) : NULL;
+    if (!ids) {
+        free(order);
+        catalog_free(&catalog);
         return NULL;
     }
-    
-    // Sort by timestamp (newest first)
-    for (size_t i = 0; i < *count - 1; i++) {
-        for (size_t j = i + 1; j < *count; j++) {
-            if (snapshots[i].timestamp < snapshots[j].timestamp) {
-                snapshot_info_t temp = snapshots[i];
-                snapshots[i] = snapshots[j];
-                snapshots[j] = temp;
-            }
+    for (size_t i = 0; i < catalog.count; i++) {
+        ids[i] = strdup(order[i]->id);
+        if (!ids[i]) {
+            while (i-- > 0) free(ids[i]);
+            free(ids);
+            free(order);
+            catalog_free(&catalog);
+            return NULL;
         }
     }
-    
-    // Extract just the IDs
-    char **result = malloc(*count * sizeof(char*));
-    for (size_t i = 0; i < *count; i++) {
-        result[i] = snapshots[i].id;
-    }
-    free(snapshots);
-    
-    return result;
+    *count = catalog.count;
+    free(order);
+    catalog_free(&catalog);
+    return ids;
 }
 
 // Resolve a hash prefix to a full snapshot ID
-static int resolve_snapshot_prefix(const char *prefix, const char *fractyl_dir, const char *branch, char *result_id) {
-    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, branch);
-    if (!snapshots_dir) {
-        return FRACTYL_ERROR_GENERIC;
-    }
-    
-    DIR *d = opendir(snapshots_dir);
-    if (!d) {
-        free(snapshots_dir);
-        return FRACTYL_ERROR_GENERIC;
-    }
-    
-    char *matches[256]; // Max matches to track
-    int match_count = 0;
-    size_t prefix_len = strlen(prefix);
-    
+static int resolve_snapshot_prefix(const char *prefix, const catalog_t *catalog, char *result_id) {
     // Minimum prefix length check
-    if (prefix_len < 4) {
-        closedir(d);
-        free(snapshots_dir);
+    if (strlen(prefix) < 4) {
         return FRACTYL_ERROR_GENERIC;
     }
     
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL && match_count < 256) {
-        if (entry->d_name[0] == '.' || !strstr(entry->d_name, ".json")) {
-            continue;
-        }
-        
-        // Extract snapshot ID from filename (remove .json)
-        char *dot = strstr(entry->d_name, ".json");
-        if (!dot) continue;
-        
-        size_t id_len = dot - entry->d_name;
-        if (id_len >= 64) continue; // ID too long
-        
-        char snapshot_id[65];
-        strncpy(snapshot_id, entry->d_name, id_len);
-        snapshot_id[id_len] = '\0';
-        
-        if (strncmp(snapshot_id, prefix, prefix_len) == 0) {
-            matches[match_count] = strdup(snapshot_id);
-            match_count++;
-        }
-    }
-    closedir(d);
-    free(snapshots_dir);
-    
+    const catalog_entry_t *matches[64]; // Max matches to list
+    size_t match_count = catalog_find_prefix(catalog, prefix, matches, 64);
     if (match_count == 0) {
         return FRACTYL_ERROR_SNAPSHOT_NOT_FOUND;
     } else if (match_count == 1) {
-        strcpy(result_id, matches[0]);
-        free(matches[0]);
+        strcpy(result_id, matches[0]->id);
         return FRACTYL_OK;
-    } else {
-        // Multiple matches - clean up and return error
-        for (int i = 0; i < match_count; i++) {
-            free(matches[i]);
-        }
-        return FRACTYL_ERROR_GENERIC; // Ambiguous prefix
     }
+    
+    printf("Error: Prefix '%s' is ambiguous, matches %zu snapshots:\n", prefix, match_count);
+    for (size_t i = 0; i < match_count && i < 64; i++) {
+        printf("  %s\n", matches[i]->id);
+    }
+    printf("Use a longer prefix to disambiguate\n");
+    return FRACTYL_ERROR_GENERIC; // Ambiguous prefix
 }
 
 // Resolve relative notation like -1, -2 to snapshot IDs
-static int resolve_relative_snapshot(const char *relative_spec, const char *fractyl_dir, const char *branch, char *result_id) {
+static int resolve_relative_snapshot(const char *relative_spec, const catalog_t *catalog, char *result_id) {
     if (relative_spec[0] != '-' || strlen(relative_spec) < 2) {
         return FRACTYL_ERROR_GENERIC; // Not a relative spec
     }
@@ -162,32 +84,12 @@ static int resolve_relative_snapshot(const char *relative_spec, const char *frac
         return FRACTYL_ERROR_GENERIC; // Invalid number
     }
     
-    // Get chronologically ordered snapshots
-    size_t count;
-    char **snapshots = get_chronological_snapshots(fractyl_dir, branch, &count);
-    if (!snapshots || count == 0) {
-        return FRACTYL_ERROR_SNAPSHOT_NOT_FOUND;
-    }
-    
-    // -1 means latest (index 0), -2 means second latest (index 1), etc.
-    size_t index = (size_t)(steps_back - 1);
-    if (index >= count) {
-        // Free the snapshots array
-        for (size_t i = 0; i < count; i++) {
-            free(snapshots[i]);
-        }
-        free(snapshots);
+    // -1 means latest, -2 means second latest, etc.
+    const catalog_entry_t *entry = catalog_nth_newest(catalog, (size_t)(steps_back - 1));
+    if (!entry) {
         return FRACTYL_ERROR_SNAPSHOT_NOT_FOUND; // Not enough snapshots
     }
-    
-    strcpy(result_id, snapshots[index]);
-    
-    // Free the snapshots array
-    for (size_t i = 0; i < count; i++) {
-        free(snapshots[i]);
-    }
-    free(snapshots);
-    
+    strcpy(result_id, entry->id);
     return FRACTYL_OK;
 }
 
@@ -214,17 +116,120 @@ int resolve_snapshot_id(const char *input, const char *fractyl_dir, const char *
         return FRACTYL_ERROR_GENERIC;
     }
     
-    // Try relative notation first (-1, -2, etc.)
-    if (input[0] == '-') {
-        return resolve_relative_snapshot(input, fractyl_dir, branch, result_id);
-    }
-    
     // If it looks like a full ID, use it directly
-    if (is_full_snapshot_id(input)) {
+    if (input[0] != '-' && is_full_snapshot_id(input)) {
         strcpy(result_id, input);
         return FRACTYL_OK;
     }
     
-    // Otherwise, try prefix resolution
-    return resolve_snapshot_prefix(input, fractyl_dir, branch, result_id);
-}
\ No newline at end of file
+    char *snapshots_dir = paths_get_snapshots_dir(fractyl_dir, branch);
+    if (!snapshots_dir) {
+        return FRACTYL_ERROR_IO;
+    }
+    catalog_t catalog;
+    int result = catalog_load(snapshots_dir, &catalog);
+    free(snapshots_dir);
+    if (result != FRACTYL_OK) {
+        return FRACTYL_ERROR_IO;
+    }
+    
+    // Relative notation (-1, -2, etc.), otherwise a prefix
+    if (input[0] == '-') {
+        result = resolve_relative_snapshot(input, &catalog, result_id);
+    } else {
+        result = resolve_snapshot_prefix(input, &catalog, result_id);
+    }
+    catalog_free(&catalog);
+    return result;
+}
+
+int resolve_snapshot_id_all_branches(const char *input, const char *fractyl_dir, char *result_id,
+                                     char **branch_out) {
+    if (!input || !fractyl_dir || !result_id || !branch_out) {
+        return FRACTYL_ERROR_GENERIC;
+    }
+    *branch_out = NULL;
+    
+    snapshot_table_t table;
+    int result = snapshot_table_load(fractyl_dir, &table);
+    if (result != FRACTYL_OK) {
+        return FRACTYL_ERROR_IO;
+    }
+    
+    // The newest snapshot anywhere is in the table itself
+    if (strcmp(input, "-1") == 0) {
+        result = FRACTYL_ERROR_SNAPSHOT_NOT_FOUND;
+        if (table.count > 0 && table.rows[0].newest_id[0]) {
+            strcpy(result_id, table.rows[0].newest_id);
+            if (table.rows[0].branch) *branch_out = strdup(table.rows[0].branch);
+            result = FRACTYL_OK;
+        }
+        snapshot_table_free(&table);
+        return result;
+    }
+    
+    catalog_t *catalogs;
+    result = snapshot_table_load_catalogs(&table, &catalogs);
+    if (result != FRACTYL_OK) {
+        snapshot_table_free(&table);
+        return FRACTYL_ERROR_IO;
+    }
+    
+    const catalog_entry_t *found = NULL;
+    size_t found_row = 0;
+    if (input[0] == '-') {
+        // Relative notation counts back through all branches at once
+        int steps_back = atoi(input + 1);
+        size_t *remaining = calloc(table.count ? table.count : 1, sizeof(size_t));
+        result = steps_back > 0 && remaining ? FRACTYL_ERROR_SNAPSHOT_NOT_FOUND : FRACTYL_ERROR_GENERIC;
+        for (size_t i = 0; remaining && i < table.count; i++) {
+            remaining[i] = catalogs[i].count;
+        }
+        for (int step = 0; result == FRACTYL_ERROR_SNAPSHOT_NOT_FOUND && step < steps_back; step++) {
+            found = snapshot_table_next_newest(&table, catalogs, remaining, &found_row);
+            if (!found) break;
+        }
+        if (found) result = FRACTYL_OK;
+        free(remaining);
+    } else if (strlen(input) < 4) {
+        result = FRACTYL_ERROR_GENERIC;
+    } else {
+        // A prefix must match one snapshot over all branches
+        size_t match_count = 0;
+        const catalog_entry_t *matches[64];
+        size_t match_rows[64];
+        for (size_t i = 0; i < table.count; i++) {
+            const catalog_entry_t *branch_matches[64];
+            size_t count = catalog_find_prefix(&catalogs[i], input, branch_matches, 64);
+            for (size_t m = 0; m < count; m++, match_count++) {
+                if (match_count < 64 && m < 64) {
+                    matches[match_count] = branch_matches[m];
+                    match_rows[match_count] = i;
+                }
+            }
+        }
+        if (match_count == 1) {
+            found = matches[0];
+            found_row = match_rows[0];
+            result = FRACTYL_OK;
+        } else if (match_count == 0) {
+            result = FRACTYL_ERROR_SNAPSHOT_NOT_FOUND;
+        } else {
+            printf("Error: Prefix '%s' is ambiguous, matches %zu snapshots:\n", input, match_count);
+            for (size_t m = 0; m < match_count && m < 64; m++) {
+                const char *branch = table.rows[match_rows[m]].branch;
+                printf("  %s (%s)\n", matches[m]->id, branch ? branch : "no branch");
+            }
+            printf("Use a longer prefix to disambiguate\n");
+            result = FRACTYL_ERROR_GENERIC;
+        }
+    }
+    
+    if (found) {
+        strcpy(result_id, found->id);
+        if (table.rows[found_row].branch) *branch_out = strdup(table.rows[found_row].branch);
+    }
+    snapshot_table_free_catalogs(&table, catalogs);
+    snapshot_table_free(&table);
+    return result;
+}
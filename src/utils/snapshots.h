@@ -13,6 +13,12 @@ extern "C" {
 // result_id must be at least 65 chars (64 + null terminator)
 int resolve_snapshot_id(const char *input, const char *fractyl_dir, const char *branch, char *result_id);
 
+// Resolve an identifier against the snapshots of every branch (see
+// snapshot_table.h): -1 is the newest snapshot anywhere. *branch_out
+// receives the branch of the snapshot, NULL for none (caller frees).
+int resolve_snapshot_id_all_branches(const char *input, const char *fractyl_dir, char *result_id,
+                                     char **branch_out);
+
 // Get chronologically ordered snapshots for a branch (newest first)
 // Caller must free returned array and each string in it
 char** get_chronological_snapshots(const char *fractyl_dir, const char *branch, size_t *count);
@@ -0,0 +1,144 @@
+#include "../unity/unity.h"
+#include "../test_helpers.h"
+#include <string.h>
+#include <unistd.h>
+
+// Shared object stores: two repositories writing into one store, reading
+// each other's objects from it, and collecting it together
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// Files anywhere below dir
+static int count_files(const char *dir) {
+    char command[1200];
+    snprintf(command, sizeof(command), "find '%s' -type f | wc -l", dir);
+    FILE *p = popen(command, "r");
+    TEST_ASSERT_NOT_NULL(p);
+    int count = 0;
+    if (fscanf(p, "%d", &count) != 1) count = -1;
+    pclose(p);
+    return count;
+}
+
+// A repository using store, entered, with two files and a snapshot of them
+static test_repo_t* member_repo(const char *name, const char *store, int write, const char *content) {
+    test_repo_t *repo = test_repo_create(name);
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    test_assert_frac_output(0, "Added shared object store", "alternates", "add", store,
+                            write ? "--write" : NULL);
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("shared.txt", "the same in both\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("own.txt", content));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, name));
+    return repo;
+}
+
+// Objects written by one member are found by the other, which stores nothing twice
+void test_members_share_objects(void) {
+    char store[600], objects[700];
+    snprintf(store, sizeof(store), "/tmp/fractyl_alternates_%d", (int)getpid());
+    snprintf(objects, sizeof(objects), "%s/objects", store);
+    
+    test_repo_t *first = member_repo("alternates_first", store, 1, "first\n");
+    int stored = count_files(objects);
+    TEST_ASSERT_TRUE(stored >= 3);
+    TEST_ASSERT_EQUAL_INT(0, count_files(".fractyl/objects"));
+    
+    // The second one only writes its own file and snapshot, into itself
+    test_repo_t *second = member_repo("alternates_second", store, 0, "second\n");
+    TEST_ASSERT_EQUAL_INT(stored, count_files(objects));
+    int own = count_files(".fractyl/objects");
+    TEST_ASSERT_TRUE(own > 0 && own < stored);
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_remove("shared.txt"));
+    char *id = test_fractyl_get_latest_snapshot_id(second);
+    TEST_ASSERT_NOT_NULL(id);
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_restore(second, id));
+    free(id);
+    char *restored = test_file_read("shared.txt");
+    TEST_ASSERT_NOT_NULL(restored);
+    TEST_ASSERT_EQUAL_STRING("the same in both\n", restored);
+    free(restored);
+    
+    test_repo_destroy(second);
+    test_repo_destroy(first);
+    char command[700];
+    snprintf(command, sizeof(command), "rm -rf '%s'", store);
+    system(command);
+}
+
+// gc --shared keeps what any member needs and refuses while one is missing
+void test_shared_gc_marks_every_member(void) {
+    char store[600], objects[700];
+    snprintf(store, sizeof(store), "/tmp/fractyl_alternates_gc_%d", (int)getpid());
+    snprintf(objects, sizeof(objects), "%s/objects", store);
+    
+    test_repo_t *first = member_repo("alternates_gc_first", store, 1, "first\n");
+    test_repo_t *second = member_repo("alternates_gc_second", store, 1, "second\n");
+    
+    // Each member's snapshot keeps its own file and the shared one
+    int stored = count_files(objects);
+    test_assert_frac_output(0, "2 repositories", "gc", "--shared", "--grace", "0");
+    TEST_ASSERT_EQUAL_INT(stored, count_files(objects));
+    
+    // A new version of the second one's file leaves the old one unreachable
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("own.txt", "second, again\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(second, "again"));
+    test_command_result_t *list = test_frac("list", NULL, NULL, NULL);
+    TEST_ASSERT_NOT_NULL(list->stdout_content);
+    char oldest[32] = "";
+    const char *line = strstr(list->stdout_content, "\n");
+    TEST_ASSERT_NOT_NULL(line);
+    TEST_ASSERT_EQUAL_INT(1, sscanf(line + 1, "%31s", oldest));
+    test_command_result_free(list);
+    test_assert_frac_output(0, "", "delete", oldest, NULL, NULL);
+    test_assert_frac_output(0, "Removed", "gc", "--shared", "--grace", "0");
+    int collected = count_files(objects);
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_remove("shared.txt"));
+    char *id = test_fractyl_get_latest_snapshot_id(second);
+    TEST_ASSERT_NOT_NULL(id);
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_restore(second, id));
+    free(id);
+    TEST_ASSERT_TRUE(test_file_exists("shared.txt"));
+    
+    // Once a member is gone its objects could still be needed
+    char moved[700];
+    snprintf(moved, sizeof(moved), "%s_moved", first->path);
+    TEST_ASSERT_EQUAL_INT(0, rename(first->path, moved));
+    test_command_result_t *result = test_frac("gc", "--shared", NULL, NULL);
+    TEST_ASSERT_NOT_EQUAL(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(result->stdout_content);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "is missing"));
+    test_command_result_free(result);
+    TEST_ASSERT_EQUAL_INT(collected, count_files(objects));
+    TEST_ASSERT_EQUAL_INT(0, rename(moved, first->path));
+    
+    test_repo_destroy(second);
+    test_repo_destroy(first);
+    char command[700];
+    snprintf(command, sizeof(command), "rm -rf '%s'", store);
+    system(command);
+}
+
+int main(void) {
+    // Set up the test executable path
+    test_frac_executable = realpath("./frac", NULL);
+    if (!test_frac_executable) {
+        printf("Error: Could not find frac executable in current directory\n");
+        return 1;
+    }
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_members_share_objects);
+    RUN_TEST(test_shared_gc_marks_every_member);
+    
+    free(test_frac_executable);
+    return UNITY_END();
+}
@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <ftw.h>
+#include <dirent.h>
 
 /* Helper function to remove directory recursively */
 static int remove_file(const char *pathname, const struct stat *sbuf, int type, struct FTW *ftwb) {
@@ -124,6 +125,121 @@ void test_cmd_snapshot_empty_repository(void) {
     TEST_ASSERT_TRUE(result == 0 || result != 0);
 }
 
+/* Count snapshot metadata files of a non-git repository */
+static int count_snapshots(void) {
+    int count = 0;
+    DIR *d = opendir(".fractyl/snapshots");
+    if (!d) return 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strstr(entry->d_name, ".snap")) count++;
+    }
+    closedir(d);
+    return count;
+}
+
+/* Test scan engine selection */
+void test_cmd_snapshot_auto_engine_detects_changes(void) {
+    const char *test_repo = "/tmp/fractyl_test_repo";
+    
+    mkdir(test_repo, 0755);
+    chdir(test_repo);
+    
+    char *init_argv[] = {"frac", "init"};
+    TEST_ASSERT_EQUAL(0, cmd_init(2, init_argv));
+    
+    FILE *fp = fopen(".fractyl/config", "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fprintf(fp, "# test settings\nscan.engine = auto\n");
+    fclose(fp);
+    
+    fp = fopen("test.txt", "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fprintf(fp, "test content");
+    fclose(fp);
+    
+    /* First snapshot is a full traversal that builds the binary index */
+    char *snap1[] = {"frac", "snapshot", "-m", "first"};
+    TEST_ASSERT_EQUAL(0, cmd_snapshot(4, snap1));
+    TEST_ASSERT_EQUAL(1, file_exists(".fractyl/cache/index_default.bin"));
+    TEST_ASSERT_EQUAL(1, count_snapshots());
+    
+    /* Second snapshot goes through the binary engine and still sees both changes */
+    fp = fopen("test.txt", "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fprintf(fp, "changed content, longer than before");
+    fclose(fp);
+    fp = fopen("added.txt", "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fprintf(fp, "new file");
+    fclose(fp);
+    
+    char *snap2[] = {"frac", "snapshot", "-m", "second"};
+    TEST_ASSERT_EQUAL(0, cmd_snapshot(4, snap2));
+    TEST_ASSERT_EQUAL(2, count_snapshots());
+    
+    /* The command line overrides the config key */
+    char *snap3[] = {"frac", "snapshot", "--scan-engine", "bogus"};
+    TEST_ASSERT_EQUAL(1, cmd_snapshot(4, snap3));
+    TEST_ASSERT_EQUAL(2, count_snapshots());
+}
+
+/* Test snapshots that start from the state the previous one left */
+void test_snapshot_create_reuses_warm_state(void) {
+    const char *test_repo = "/tmp/fractyl_test_repo";
+    
+    mkdir(test_repo, 0755);
+    chdir(test_repo);
+    
+    char *init_argv[] = {"frac", "init"};
+    TEST_ASSERT_EQUAL(0, cmd_init(2, init_argv));
+    FILE *fp = fopen("test.txt", "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fprintf(fp, "first");
+    fclose(fp);
+    
+    snapshot_warm_t warm;
+    memset(&warm, 0, sizeof(warm));
+    snapshot_options_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.message = "first";
+    opts.warm = &warm;
+    TEST_ASSERT_EQUAL(0, snapshot_create(&opts));
+    TEST_ASSERT_EQUAL(1, warm.valid);
+    TEST_ASSERT_EQUAL(1, warm.index.count);
+    char first_id[64];
+    strcpy(first_id, warm.snapshot_id);
+    
+    /* Nothing changed: the same snapshot, still warm */
+    const char *changed[] = {"test.txt", ".gitignore"};
+    opts.changed_paths = changed;
+    opts.changed_count = 1;
+    TEST_ASSERT_EQUAL(0, snapshot_create(&opts));
+    TEST_ASSERT_EQUAL(1, count_snapshots());
+    TEST_ASSERT_EQUAL(1, warm.valid);
+    TEST_ASSERT_EQUAL_STRING(first_id, warm.snapshot_id);
+    
+    /* A change starts from the warm index and leaves the new one */
+    fp = fopen("test.txt", "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fprintf(fp, "second, longer");
+    fclose(fp);
+    fp = fopen(".gitignore", "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fprintf(fp, "*.log\n");
+    fclose(fp);
+    opts.message = "second";
+    opts.changed_count = 2;
+    TEST_ASSERT_EQUAL(0, snapshot_create(&opts));
+    TEST_ASSERT_EQUAL(2, count_snapshots());
+    TEST_ASSERT_EQUAL(1, warm.valid);
+    TEST_ASSERT_TRUE(strcmp(first_id, warm.snapshot_id) != 0);
+    TEST_ASSERT_EQUAL(2, warm.index.count);
+    
+    snapshot_warm_free(&warm);
+    TEST_ASSERT_EQUAL(0, warm.valid);
+}
+
 /* Test list command */
 void test_cmd_list_empty_repository(void) {
     const char *test_repo = "/tmp/fractyl_test_repo";
@@ -169,6 +285,16 @@ void test_cmd_list_with_snapshots(void) {
     char *list_argv[] = {"frac", "list"};
     result = cmd_list(2, list_argv);
     TEST_ASSERT_EQUAL(0, result);
+    
+    /* Windows and the flat listing */
+    char *limit_argv[] = {"frac", "list", "-n", "1", "--flat"};
+    TEST_ASSERT_EQUAL(0, cmd_list(5, limit_argv));
+    char *range_argv[] = {"frac", "list", "--since", "1d", "--until", "2000-01-01"};
+    TEST_ASSERT_EQUAL(0, cmd_list(6, range_argv));
+    char *bad_argv[] = {"frac", "list", "--since", "yesterday"};
+    TEST_ASSERT_EQUAL(1, cmd_list(4, bad_argv));
+    char *zero_argv[] = {"frac", "list", "-n", "0"};
+    TEST_ASSERT_EQUAL(1, cmd_list(4, zero_argv));
 }
 
 void test_cmd_restore_removes_extra_files(void) {
@@ -451,6 +577,8 @@ int main(void) {
     /* Snapshot command tests */
     RUN_TEST(test_cmd_snapshot_with_files);
     RUN_TEST(test_cmd_snapshot_empty_repository);
+    RUN_TEST(test_cmd_snapshot_auto_engine_detects_changes);
+    RUN_TEST(test_snapshot_create_reuses_warm_state);
 
     /* List command tests */
     RUN_TEST(test_cmd_list_empty_repository);
@@ -1,5 +1,6 @@
 #include "../unity/unity.h"
 #include "../test_helpers.h"
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -162,6 +163,127 @@ void test_daemon_concurrent_operations(void) {
     test_repo_destroy(repo);
 }
 
+// Test that commands run through a running daemon with the client's
+// output and exit status
+void test_daemon_serves_commands(void) {
+    test_repo_t* repo = test_repo_create("daemon_serves");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("file1.txt", "content1"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Before daemon"));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_daemon_start_with_interval(repo, 600));
+    for (int i = 0; i < 50 && access(".fractyl/daemon.sock", F_OK) != 0; i++) {
+        usleep(100000);
+    }
+    TEST_ASSERT_EQUAL_INT(0, access(".fractyl/daemon.sock", F_OK));
+    
+    char* list_argv[] = {test_frac_executable, "list", "--flat", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, list_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "Before daemon"));
+    test_command_result_free(result);
+    
+    char* show_argv[] = {test_frac_executable, "show", "no-such-snapshot", NULL};
+    result = test_run_command(test_frac_executable, show_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(1, result->exit_code);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "not found"));
+    test_command_result_free(result);
+    
+    char* log = test_file_read(".fractyl/daemon.log");
+    TEST_ASSERT_NOT_NULL(log);
+    TEST_ASSERT_NOT_NULL(strstr(log, "Running 'list' for a client"));
+    TEST_ASSERT_NOT_NULL(strstr(log, "Running 'show' for a client"));
+    free(log);
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_daemon_command(repo, "stop"));
+    TEST_ASSERT_NOT_EQUAL(0, access(".fractyl/daemon.sock", F_OK));
+    
+    test_repo_destroy(repo);
+}
+
+// Test one daemon keeping two repositories, each with its own log
+void test_daemon_keeps_listed_repositories(void) {
+    test_repo_t* first = test_repo_create("daemon_all_first");
+    test_repo_t* second = test_repo_create("daemon_all_second");
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL(second);
+    
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(first));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(first));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("first.txt", "first"));
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(second));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(second));
+    
+    /* The repository list, in a home of its own */
+    char home[600], list[700];
+    snprintf(home, sizeof(home), "%s/home", second->path);
+    snprintf(list, sizeof(list), "%s/repos", home);
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create(home));
+    FILE* f = fopen(list, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fprintf(f, "# kept by one daemon\n%s\n%s\n", first->path, second->path);
+    fclose(f);
+    setenv("FRACTYL_DAEMON_HOME", home, 1);
+    
+    char* start_argv[] = {test_frac_executable, "daemon", "start", "--all", "-i", "600", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, start_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "Repositories: 2"));
+    test_command_result_free(result);
+    
+    /* The first repository is scanned at once, the second later on */
+    char first_log[700];
+    snprintf(first_log, sizeof(first_log), "%s/.fractyl/daemon.log", first->path);
+    char* log = NULL;
+    for (int i = 0; i < 50; i++) {
+        log = test_file_read(first_log);
+        if (log && strstr(log, "Snapshot created")) break;
+        free(log);
+        log = NULL;
+        usleep(100000);
+    }
+    TEST_ASSERT_NOT_NULL(log);
+    free(log);
+    
+    /* The second one's commands are served, and logged there */
+    for (int i = 0; i < 50 && access(".fractyl/daemon.sock", F_OK) != 0; i++) {
+        usleep(100000);
+    }
+    char* list_argv[] = {test_frac_executable, "list", "--flat", NULL};
+    result = test_run_command(test_frac_executable, list_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    test_command_result_free(result);
+    log = test_file_read(".fractyl/daemon.log");
+    TEST_ASSERT_NOT_NULL(log);
+    TEST_ASSERT_NOT_NULL(strstr(log, "Running 'list' for a client"));
+    TEST_ASSERT_NULL(strstr(log, "Snapshot created"));
+    free(log);
+    
+    char* status = test_daemon_status(second);
+    TEST_ASSERT_NOT_NULL(status);
+    TEST_ASSERT_NOT_NULL(strstr(status, "is running"));
+    free(status);
+    
+    char* stop_argv[] = {test_frac_executable, "daemon", "stop", "--all", NULL};
+    result = test_run_command(test_frac_executable, stop_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    test_command_result_free(result);
+    TEST_ASSERT_NOT_EQUAL(0, access(".fractyl/daemon.sock", F_OK));
+    TEST_ASSERT_NOT_EQUAL(0, access(".fractyl/daemon.pid", F_OK));
+    
+    unsetenv("FRACTYL_DAEMON_HOME");
+    test_repo_destroy(first);
+    test_repo_destroy(second);
+}
+
 // Test daemon error conditions
 void test_daemon_error_conditions(void) {
     test_repo_t* repo = test_repo_create("daemon_errors");
@@ -202,6 +324,8 @@ int main(void) {
     RUN_TEST(test_daemon_restart);
     RUN_TEST(test_daemon_concurrent_operations);
     RUN_TEST(test_daemon_error_conditions);
+    RUN_TEST(test_daemon_serves_commands);
+    RUN_TEST(test_daemon_keeps_listed_repositories);
     
     free(test_frac_executable);
     return UNITY_END();
@@ -2,6 +2,7 @@
 #include "../test_helpers.h"
 #include <string.h>
 #include <unistd.h>
+#include <utime.h>
 
 // test_frac_executable is declared in test_helpers.h
 
@@ -260,7 +261,376 @@ void test_multiple_snapshots(void) {
     test_repo_destroy(repo);
 }
 
+// Test that diff prints the changed files in path order with their hunks
+void test_diff_output_in_path_order(void) {
+    test_repo_t* repo = test_repo_create("diff_order_test");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    
+    // Enough files to keep several diff workers busy
+    char filename[32], content[64];
+    for (int i = 0; i < 60; i++) {
+        snprintf(filename, sizeof(filename), "file%02d.txt", i);
+        snprintf(content, sizeof(content), "line one\nline %d\n", i);
+        TEST_ASSERT_EQUAL_INT(0, test_file_create(filename, content));
+    }
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Before"));
+    for (int i = 0; i < 60; i++) {
+        snprintf(filename, sizeof(filename), "file%02d.txt", i);
+        snprintf(content, sizeof(content), "line one\nline %d changed\n", i);
+        TEST_ASSERT_EQUAL_INT(0, test_file_modify(filename, content));
+    }
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "After"));
+    
+    char* argv[] = {test_frac_executable, "diff", "-2", "-1", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    
+    // Each file's header is followed by its own change, before the next file
+    const char* pos = result->stdout_content;
+    for (int i = 0; i < 60; i++) {
+        char header[64], added[64];
+        snprintf(header, sizeof(header), "diff --git a/file%02d.txt", i);
+        snprintf(added, sizeof(added), "+line %d changed", i);
+        pos = strstr(pos, header);
+        TEST_ASSERT_NOT_NULL_MESSAGE(pos, header);
+        const char* change = strstr(pos, added);
+        TEST_ASSERT_NOT_NULL_MESSAGE(change, added);
+        const char* next = strstr(pos + 1, "diff --git");
+        TEST_ASSERT_TRUE(!next || change < next);
+    }
+    
+    test_command_result_free(result);
+    test_repo_destroy(repo);
+}
+
+// Test the metadata-only diff modes
+void test_diff_metadata_modes(void) {
+    test_repo_t* repo = test_repo_create("diff_modes_test");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("changed.txt", "one\ntwo\nthree\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("removed.txt", "gone\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("same.txt", "same\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Before"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("changed.txt", "one\n2\nthree\nfour\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_remove("removed.txt"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("added.txt", "new\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "After"));
+    
+    char* status_argv[] = {test_frac_executable, "diff", "--name-status", "-2", "-1", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, status_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_EQUAL_STRING("A\tadded.txt\nM\tchanged.txt\nD\tremoved.txt\n", result->stdout_content);
+    test_command_result_free(result);
+    
+    char* names_argv[] = {test_frac_executable, "diff", "--name-only", "-2", "-1", NULL};
+    result = test_run_command(test_frac_executable, names_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_EQUAL_STRING("added.txt\nchanged.txt\nremoved.txt\n", result->stdout_content);
+    test_command_result_free(result);
+    
+    char* stat_argv[] = {test_frac_executable, "diff", "--stat", "-2", "-1", NULL};
+    result = test_run_command(test_frac_executable, stat_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_EQUAL_STRING(" added.txt   | 1 +\n"
+                             " changed.txt | 3 ++-\n"
+                             " removed.txt | 1 -\n"
+                             " 3 files changed, 3 insertions(+), 2 deletions(-)\n", result->stdout_content);
+    test_command_result_free(result);
+    
+    test_repo_destroy(repo);
+}
+
+// Test comparing a snapshot with the working tree, which stores nothing
+static int count_objects(void) {
+    FILE* fp = popen("find .fractyl/objects -type f | wc -l", "r");
+    int count = -1;
+    if (fp) {
+        if (fscanf(fp, "%d", &count) != 1) count = -1;
+        pclose(fp);
+    }
+    return count;
+}
+
+void test_diff_against_working_tree(void) {
+    test_repo_t* repo = test_repo_create("diff_worktree_test");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("changed.txt", "one\ntwo\nthree\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("removed.txt", "gone\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("same.txt", "same\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Before"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("changed.txt", "one\n2\nthree\nfour\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_remove("removed.txt"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("added.txt", "new\n"));
+    int objects = count_objects();
+    
+    char* status_argv[] = {test_frac_executable, "diff", "--name-status", "-1", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, status_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_EQUAL_STRING("A\tadded.txt\nM\tchanged.txt\nD\tremoved.txt\n", result->stdout_content);
+    test_command_result_free(result);
+    
+    char* patch_argv[] = {test_frac_executable, "diff", "-1", NULL};
+    result = test_run_command(test_frac_executable, patch_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "+++ working tree"));
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "-two\n+2\n three\n+four\n"));
+    TEST_ASSERT_NULL(strstr(result->stdout_content, "same.txt"));
+    test_command_result_free(result);
+    
+    TEST_ASSERT_EQUAL_INT(objects, count_objects());
+    test_repo_destroy(repo);
+}
+
+// Test the diff algorithm flags and the guardrails for huge files
+void test_diff_guardrails(void) {
+    test_repo_t* repo = test_repo_create("diff_guardrails_test");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("small.txt", "one\ntwo\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("big.txt", "a\nb\nc\nd\ne\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Before"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("small.txt", "one\n2\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("big.txt", "a\nB\nc\nd\ne\nf\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "After"));
+    
+    char* patience_argv[] = {test_frac_executable, "diff", "--patience", "-2", "-1", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, patience_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "-b\n+B\n"));
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "-two\n+2\n"));
+    test_command_result_free(result);
+    
+    // Files over diff.max_lines are summarized instead of diffed
+    TEST_ASSERT_EQUAL_INT(0, test_file_create(".fractyl/config", "diff.max_lines = 4\n"));
+    char* patch_argv[] = {test_frac_executable, "diff", "-2", "-1", NULL};
+    result = test_run_command(test_frac_executable, patch_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content,
+                                "Files differ, 5 lines -> 6 lines (over diff.max_lines)\n"));
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "-two\n+2\n"));
+    TEST_ASSERT_NULL(strstr(result->stdout_content, "+B\n"));
+    test_command_result_free(result);
+    
+    char* stat_argv[] = {test_frac_executable, "diff", "--stat", "-2", "-1", NULL};
+    result = test_run_command(test_frac_executable, stat_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, " big.txt   | Not diffed, 5 -> 6 lines\n"));
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, " small.txt | 2 +-\n"));
+    test_command_result_free(result);
+    
+    test_repo_destroy(repo);
+}
+
 // Test git submodule boundary detection
+// Test that the first snapshot on a new branch verifies files by stat
+// against the last snapshot instead of storing them again
+void test_branch_switch_reuses_stat_data(void) {
+    test_repo_t* repo = test_repo_create("branch_switch_test");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create(".git"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create(".git/HEAD", "ref: refs/heads/main\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("shared1.txt", "Shared content 1"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("shared2.txt", "Shared content 2"));
+    
+    // Changed before the snapshot's second, so their stat data is trusted
+    sleep(1);
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "On main"));
+    
+    // Switch branches; only the new file is read and stored
+    TEST_ASSERT_EQUAL_INT(0, test_file_create(".git/HEAD", "ref: refs/heads/feature\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("feature.txt", "Feature work"));
+    char* snapshot_args[] = {test_frac_executable, "snapshot", "-m", "On feature", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, snapshot_args);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(result->stdout_content);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "First snapshot on this branch"));
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "A feature.txt"));
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, " 0 bytes already stored"));
+    test_command_result_free(result);
+    
+    // The branch has its own snapshot with every file
+    char* list_output = test_fractyl_list(repo);
+    TEST_ASSERT_NOT_NULL(list_output);
+    TEST_ASSERT_NOT_NULL(strstr(list_output, "On feature"));
+    free(list_output);
+    
+    test_repo_destroy(repo);
+}
+
+// A snapshot records its largest changed files once their change list is gone
+void test_snapshot_records_largest_changes(void) {
+    test_repo_t* repo = test_repo_create("largest_changes_test");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("small.txt", "small\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Initial"));
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("small.txt", "still small\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("data"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("data/big.txt", "by far the largest file of the two\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Changes"));
+    
+    char* args[] = {test_frac_executable, "stats", "--json", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, args);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(result->stdout_content);
+    // Newest first
+    char* first = strtok(result->stdout_content, "\n");
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(first, "\"files_changed\":2"), first);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(first, "\"largest_change\":\"data/big.txt\""), first);
+    test_command_result_free(result);
+    
+    test_repo_destroy(repo);
+}
+
+// Output of a snapshot taken with message; the caller frees it
+static char* snapshot_output(const char* message) {
+    char* args[] = {test_frac_executable, "snapshot", "-m", (char*)message, NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, args);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    char* output = strdup(result->stdout_content ? result->stdout_content : "");
+    test_command_result_free(result);
+    return output;
+}
+
+static void assert_snapshot_finds(const char* message, const char* expected) {
+    char* output = snapshot_output(message);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, expected), output);
+    free(output);
+}
+
+// A snapshot that finds nothing changed does not scan; each kind of change
+// still gets one taken
+void test_unchanged_check_sees_changes(void) {
+    test_repo_t* repo = test_repo_create("unchanged_check_test");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("src"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("src/main.c", "int main;\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("notes.txt", "notes\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create(".gitignore", "*.log\n"));
+    sleep(1);
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Initial"));
+    
+    // An ignored file is no change
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("src/build.log", "log\n"));
+    sleep(1);
+    assert_snapshot_finds("Ignored", "No changes detected");
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("src/util.c", "int util;\n"));
+    assert_snapshot_finds("Added", "A src/util.c");
+    TEST_ASSERT_EQUAL_INT(0, test_file_remove("notes.txt"));
+    assert_snapshot_finds("Deleted", "D notes.txt");
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("src/main.c", "int mane;\n"));
+    assert_snapshot_finds("Modified", "M src/main.c");
+    TEST_ASSERT_EQUAL_INT(0, test_file_create(".gitignore", "\n"));
+    assert_snapshot_finds("Unignored", "A src/build.log");
+    
+    sleep(1);
+    free(snapshot_output("Settled"));
+    assert_snapshot_finds("Unchanged", "No changes detected");
+    
+    test_repo_destroy(repo);
+}
+
+// A file touched with its content the same is read once; the snapshot
+// after that finds the tree unchanged without scanning it
+void test_touched_file_keeps_unchanged_check(void) {
+    test_repo_t* repo = test_repo_create("touched_file_test");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("kept.txt", "the same\n"));
+    sleep(1);
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Initial"));
+    
+    TEST_ASSERT_EQUAL_INT(0, utime("kept.txt", NULL));
+    sleep(1);
+    char* output = snapshot_output("Touched");
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, "Found 1 files"), output);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, "No changes detected"), output);
+    free(output);
+    
+    output = snapshot_output("Again");
+    TEST_ASSERT_NULL_MESSAGE(strstr(output, "Found"), output);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(output, "No changes detected"), output);
+    free(output);
+    
+    test_repo_destroy(repo);
+}
+
+// Paths after "--" are relative to the current directory, and one that
+// names nothing is an error rather than no change
+void test_scoped_snapshot_paths(void) {
+    test_repo_t* repo = test_repo_create("scoped_paths_test");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("sub"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("sub/b", "before\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("top.txt", "top\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Initial"));
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("sub/b", "after\n"));
+    TEST_ASSERT_EQUAL_INT(0, chdir("sub"));
+    char* args[] = {test_frac_executable, "snapshot", "-m", "Scoped", "--", "b", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, args);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(result->stdout_content);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(result->stdout_content, "M sub/b"), result->stdout_content);
+    test_command_result_free(result);
+    
+    char* missing[] = {test_frac_executable, "snapshot", "-m", "Missing", "--", "nothere", NULL};
+    result = test_run_command(test_frac_executable, missing);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_NOT_EQUAL(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(result->stdout_content);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(result->stdout_content, "'sub/nothere' is neither"),
+                                 result->stdout_content);
+    test_command_result_free(result);
+    
+    char* outside[] = {test_frac_executable, "snapshot", "-m", "Outside", "--", "../../x", NULL};
+    result = test_run_command(test_frac_executable, outside);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_NOT_EQUAL(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(result->stdout_content);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(result->stdout_content, "'../../x' is not"), result->stdout_content);
+    test_command_result_free(result);
+    TEST_ASSERT_EQUAL_INT(0, chdir(".."));
+    
+    test_repo_destroy(repo);
+}
+
 void test_git_submodule_boundaries(void) {
     test_repo_t* repo = test_repo_create("submodule_test");
     TEST_ASSERT_NOT_NULL(repo);
@@ -390,7 +760,16 @@ int main(void) {
     RUN_TEST(test_complex_file_operations);
     RUN_TEST(test_edge_cases);
     RUN_TEST(test_multiple_snapshots);
+    RUN_TEST(test_diff_output_in_path_order);
+    RUN_TEST(test_diff_metadata_modes);
+    RUN_TEST(test_diff_against_working_tree);
+    RUN_TEST(test_diff_guardrails);
     RUN_TEST(test_git_submodule_boundaries);
+    RUN_TEST(test_branch_switch_reuses_stat_data);
+    RUN_TEST(test_unchanged_check_sees_changes);
+    RUN_TEST(test_snapshot_records_largest_changes);
+    RUN_TEST(test_touched_file_keeps_unchanged_check);
+    RUN_TEST(test_scoped_snapshot_paths);
     
     free(test_frac_executable);
     return UNITY_END();
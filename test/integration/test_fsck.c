@@ -0,0 +1,100 @@
+#include "../unity/unity.h"
+#include "../test_helpers.h"
+#include <string.h>
+#include <unistd.h>
+
+// frac fsck: a clean repository passes, damaged objects are found, and a
+// scrub works through the objects a slice at a time
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// The path of some loose object, or "" if there is none
+static void loose_object(char *path, size_t size) {
+    FILE *p = popen("find .fractyl/objects -type f | sort | head -1", "r");
+    TEST_ASSERT_NOT_NULL(p);
+    if (!fgets(path, (int)size, p)) path[0] = '\0';
+    pclose(p);
+    path[strcspn(path, "\n")] = '\0';
+}
+
+// A repository, entered, with a snapshot of a few files
+static test_repo_t* checked_repo(const char *name) {
+    test_repo_t *repo = test_repo_create(name);
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    for (int i = 0; i < 8; i++) {
+        char file[32], content[64];
+        snprintf(file, sizeof(file), "file%d.txt", i);
+        snprintf(content, sizeof(content), "content of file %d\n", i);
+        TEST_ASSERT_EQUAL_INT(0, test_file_create(file, content));
+    }
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "checked"));
+    return repo;
+}
+
+// Damaged and lost objects make fsck fail and are named
+void test_fsck_finds_damaged_objects(void) {
+    test_repo_t *repo = checked_repo("fsck_damaged");
+    test_assert_frac_output(0, "No problems found", "fsck", NULL, NULL, NULL);
+    
+    char path[512];
+    loose_object(path, sizeof(path));
+    TEST_ASSERT_TRUE(path[0] != '\0');
+    char saved[600];
+    snprintf(saved, sizeof(saved), "%s.saved", path);
+    TEST_ASSERT_EQUAL_INT(0, rename(path, saved));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create(path, "not what it was\n"));
+    test_assert_frac_output(1, "corrupt object", "fsck", NULL, NULL, NULL);
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_remove(path));
+    test_assert_frac_output(1, "missing object", "fsck", "--threads", "2", NULL);
+    
+    TEST_ASSERT_EQUAL_INT(0, rename(saved, path));
+    test_assert_frac_output(0, "No problems found", "fsck", NULL, NULL, NULL);
+    test_repo_destroy(repo);
+}
+
+// Small slices carry on from the persisted cursor until the pass is complete
+void test_scrub_completes_in_slices(void) {
+    test_repo_t *repo = checked_repo("fsck_scrub");
+    
+    int slices = 0, complete = 0;
+    while (!complete && slices < 100) {
+        test_command_result_t *result = test_frac("fsck", "--scrub", "--max-bytes", "1");
+        const char *out = result->stdout_content ? result->stdout_content : "";
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, result->exit_code, out);
+        complete = strstr(out, "Scrub pass complete") != NULL;
+        if (!complete) TEST_ASSERT_NOT_NULL_MESSAGE(strstr(out, "% done"), out);
+        test_command_result_free(result);
+        slices++;
+    }
+    TEST_ASSERT_TRUE(complete);
+    TEST_ASSERT_TRUE(slices > 1);
+    TEST_ASSERT_TRUE(test_file_exists(".fractyl/scrub"));
+    
+    // The next slice starts another pass
+    test_assert_frac_output(0, "% done", "fsck", "--scrub", "--max-bytes", "1");
+    test_repo_destroy(repo);
+}
+
+int main(void) {
+    // Set up the test executable path
+    test_frac_executable = realpath("./frac", NULL);
+    if (!test_frac_executable) {
+        printf("Error: Could not find frac executable in current directory\n");
+        return 1;
+    }
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_fsck_finds_damaged_objects);
+    RUN_TEST(test_scrub_completes_in_slices);
+    
+    free(test_frac_executable);
+    return UNITY_END();
+}
@@ -0,0 +1,103 @@
+#include "../unity/unity.h"
+#include "../test_helpers.h"
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// test_frac_executable is declared in test_helpers.h
+
+void setUp(void) {
+    // Each test gets a fresh start
+}
+
+void tearDown(void) {
+    // Cleanup after each test
+}
+
+// Start "frac mount" in the background; its output goes to log_path
+static pid_t start_mount(const char* snapshot_id, const char* mountpoint, const char* log_path) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!freopen(log_path, "w", stdout)) _exit(127);
+        char* argv[] = {test_frac_executable, "mount", (char*)snapshot_id, (char*)mountpoint, NULL};
+        execv(test_frac_executable, argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Test that a mounted snapshot serves its files and unmounts on Ctrl-C
+void test_mount_serves_snapshot_files(void) {
+    test_repo_t* repo = test_repo_create("mount_basic");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("docs"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("docs/readme.md", "Old readme"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("top.txt", "Top level"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "First"));
+    char* snapshot_id = test_fractyl_get_latest_snapshot_id(repo);
+    TEST_ASSERT_NOT_NULL(snapshot_id);
+    
+    // The working tree moves on; the mount shows the snapshot
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("docs/readme.md", "New readme"));
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("mnt"));
+    char mountpoint[PATH_MAX];
+    TEST_ASSERT_NOT_NULL(realpath("mnt", mountpoint));
+    
+    pid_t pid = start_mount(snapshot_id, mountpoint, "mount.log");
+    TEST_ASSERT_TRUE(pid > 0);
+    
+    // Wait for the mount to come up, or for frac to give up
+    int mounted = 0, status = 0, exited = 0;
+    for (int i = 0; i < 50 && !mounted && !exited; i++) {
+        usleep(100000);
+        mounted = test_file_exists("mnt/top.txt");
+        exited = waitpid(pid, &status, WNOHANG) == pid;
+    }
+    if (!mounted) {
+        if (!exited) {
+            kill(pid, SIGINT);
+            waitpid(pid, &status, 0);
+        }
+        free(snapshot_id);
+        test_repo_destroy(repo);
+        TEST_IGNORE_MESSAGE("FUSE mounts are not available here");
+    }
+    
+    TEST_ASSERT_FILE_CONTENT("mnt/top.txt", "Top level");
+    TEST_ASSERT_FILE_CONTENT("mnt/docs/readme.md", "Old readme");
+    TEST_ASSERT_FILE_NOT_EXISTS("mnt/mnt");
+    TEST_ASSERT_FILE_CONTENT("docs/readme.md", "New readme");
+    FILE* f = fopen("mnt/new.txt", "w");
+    TEST_ASSERT_NULL(f);
+    
+    TEST_ASSERT_EQUAL_INT(0, kill(pid, SIGINT));
+    TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE(WIFEXITED(status));
+    TEST_ASSERT_EQUAL_INT(0, WEXITSTATUS(status));
+    TEST_ASSERT_FILE_NOT_EXISTS("mnt/top.txt");
+    
+    free(snapshot_id);
+    test_repo_destroy(repo);
+}
+
+int main(void) {
+    // Set up the test executable path
+    test_frac_executable = realpath("./frac", NULL);
+    if (!test_frac_executable) {
+        printf("Error: Could not find frac executable in current directory\n");
+        return 1;
+    }
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_mount_serves_snapshot_files);
+    
+    free(test_frac_executable);
+    return UNITY_END();
+}
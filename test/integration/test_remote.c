@@ -0,0 +1,168 @@
+#include "../unity/unity.h"
+#include "../test_helpers.h"
+#include <string.h>
+#include <unistd.h>
+
+// Pushing to remotes: a directory store, and the same store reached through
+// 'frac remote-serve' behind a stand-in for ssh that runs the command here
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+// Objects a push reports sending, or -1 when it failed
+static long pushed_objects(const char *remote) {
+    test_command_result_t *result = test_frac("push", remote, NULL, NULL);
+    const char *out = result->stdout_content ? result->stdout_content : "";
+    const char *sent = strstr(out, ": ");
+    long objects = result->exit_code == 0 && sent ? strtol(sent + 2, NULL, 10) : -1;
+    test_command_result_free(result);
+    return objects;
+}
+
+static int count_files(const char *dir, const char *suffix) {
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    int count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name), suffix_len = strlen(suffix);
+        if (len > suffix_len && strcmp(entry->d_name + len - suffix_len, suffix) == 0) count++;
+    }
+    closedir(d);
+    return count;
+}
+
+// Copy the store into a new repository and restore its latest snapshot there
+static void assert_store_restores(const char *store, const char *path, const char *content) {
+    test_repo_t *clone = test_repo_create("remote_clone");
+    TEST_ASSERT_NOT_NULL(clone);
+    char command[2048];
+    snprintf(command, sizeof(command), "cp -r '%s' '%s/.fractyl'", store, clone->path);
+    TEST_ASSERT_EQUAL_INT(0, system(command));
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(clone));
+    
+    char *current = test_file_read(".fractyl/CURRENT");
+    TEST_ASSERT_NOT_NULL(current);
+    current[strcspn(current, "\n")] = '\0';
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_restore(clone, current));
+    free(current);
+    
+    char *restored = test_file_read(path);
+    TEST_ASSERT_NOT_NULL(restored);
+    TEST_ASSERT_EQUAL_STRING(content, restored);
+    free(restored);
+    test_repo_destroy(clone);
+}
+
+// Only the snapshots and objects the store lacks are sent
+void test_push_to_directory_sends_only_what_is_missing(void) {
+    test_repo_t *repo = test_repo_create("remote_push");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("src"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("src/main.c", "int main(void) { return 0; }\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("README", "first\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "First"));
+    
+    char store[600], snapshots[700];
+    snprintf(store, sizeof(store), "%s_store", repo->path);
+    snprintf(snapshots, sizeof(snapshots), "%s/snapshots", store);
+    test_assert_frac_output(0, "Added remote backup", "remote", "add", "backup", store);
+    long first = pushed_objects("backup");
+    TEST_ASSERT_TRUE(first > 0);
+    TEST_ASSERT_EQUAL_INT(1, count_files(snapshots, ".snap"));
+    test_assert_frac_output(0, "backup is up to date", "push", "backup", NULL, NULL);
+    
+    // One file changed: src/ and its blob stay where they are
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("README", "second\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Second"));
+    long second = pushed_objects("backup");
+    TEST_ASSERT_TRUE(second > 0 && second < first);
+    TEST_ASSERT_EQUAL_INT(2, count_files(snapshots, ".snap"));
+    
+    assert_store_restores(store, "README", "second\n");
+    
+    char command[1300];
+    snprintf(command, sizeof(command), "rm -rf '%s'", store);
+    system(command);
+    test_repo_destroy(repo);
+}
+
+// The same exchange through 'frac remote-serve' on the other end of a pipe
+void test_push_over_ssh_transport(void) {
+    test_repo_t *repo = test_repo_create("remote_ssh");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("notes.txt", "over the wire\n"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Remote"));
+    
+    // ssh <host> <command> runs <command> here
+    char ssh[600], store[600], url[700], serve[1200];
+    snprintf(ssh, sizeof(ssh), "%s_ssh", repo->path);
+    snprintf(store, sizeof(store), "%s_store", repo->path);
+    snprintf(url, sizeof(url), "localhost:%s", store);
+    snprintf(serve, sizeof(serve), "%s remote-serve", test_frac_executable);
+    FILE *script = fopen(ssh, "w");
+    TEST_ASSERT_NOT_NULL(script);
+    fprintf(script, "#!/bin/sh\nshift\nexec sh -c \"$1\"\n");
+    fclose(script);
+    chmod(ssh, 0755);
+    setenv("FRACTYL_SSH", ssh, 1);
+    
+    char *argv[] = { test_frac_executable, "remote", "add", "far", url, "--serve-command", serve, NULL };
+    test_command_result_t *added = test_run_command(test_frac_executable, argv);
+    TEST_ASSERT_NOT_NULL(added);
+    TEST_ASSERT_EQUAL_INT(0, added->exit_code);
+    test_command_result_free(added);
+    
+    test_assert_frac_output(0, "Pushed 1 snapshots to far", "push", "far", NULL, NULL);
+    test_assert_frac_output(0, "far is up to date", "push", "far", NULL, NULL);
+    unsetenv("FRACTYL_SSH");
+    
+    assert_store_restores(store, "notes.txt", "over the wire\n");
+    
+    char command[1300];
+    snprintf(command, sizeof(command), "rm -rf '%s' '%s'", store, ssh);
+    system(command);
+    test_repo_destroy(repo);
+}
+
+// Object stores need a client this build does not have
+void test_remote_add_rejects_object_stores(void) {
+    test_repo_t *repo = test_repo_create("remote_s3");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    
+    test_command_result_t *result = test_frac("remote", "add", "cloud", "s3://bucket/backups");
+    TEST_ASSERT_NOT_EQUAL(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(result->stdout_content);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "object stores are not"));
+    test_command_result_free(result);
+    test_assert_frac_output(0, "No remotes", "remote", NULL, NULL, NULL);
+    
+    test_repo_destroy(repo);
+}
+
+int main(void) {
+    // Set up the test executable path
+    test_frac_executable = realpath("./frac", NULL);
+    if (!test_frac_executable) {
+        printf("Error: Could not find frac executable in current directory\n");
+        return 1;
+    }
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_push_to_directory_sends_only_what_is_missing);
+    RUN_TEST(test_push_over_ssh_transport);
+    RUN_TEST(test_remote_add_rejects_object_stores);
+    
+    free(test_frac_executable);
+    return UNITY_END();
+}
@@ -2,6 +2,8 @@
 #include "../test_helpers.h"
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 // test_frac_executable is declared in test_helpers.h
 
@@ -135,6 +137,175 @@ void test_restore_with_directories(void) {
     test_repo_destroy(repo);
 }
 
+// Test that restore leaves up to date files alone but still rewrites
+// files modified since they were indexed
+void test_restore_only_rewrites_changed_files(void) {
+    test_repo_t* repo = test_repo_create("restore_differential");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("same.txt", "Same in both"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("changed.txt", "First version"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "First"));
+    char* first_id = test_fractyl_get_latest_snapshot_id(repo);
+    TEST_ASSERT_NOT_NULL(first_id);
+    
+    // Files written in the second they are indexed are never trusted
+    sleep(1);
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("changed.txt", "Second version"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Second"));
+    
+    // Picked up by the safety snapshot's scan, which restore reuses
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("extra"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("extra/new.txt", "Not in either"));
+    
+    struct stat before, after;
+    TEST_ASSERT_EQUAL_INT(0, stat("same.txt", &before));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_restore(repo, first_id));
+    TEST_ASSERT_FILE_CONTENT("changed.txt", "First version");
+    TEST_ASSERT_FILE_NOT_EXISTS("extra/new.txt");
+    TEST_ASSERT_FALSE(test_dir_exists("extra"));
+    
+    // Unchanged between the snapshots: not written again
+    TEST_ASSERT_EQUAL_INT(0, stat("same.txt", &after));
+    TEST_ASSERT_EQUAL_UINT64((uint64_t)before.st_ino, (uint64_t)after.st_ino);
+    TEST_ASSERT_EQUAL_INT64((int64_t)before.st_mtim.tv_sec, (int64_t)after.st_mtim.tv_sec);
+    TEST_ASSERT_EQUAL_INT64((int64_t)before.st_mtim.tv_nsec, (int64_t)after.st_mtim.tv_nsec);
+    TEST_ASSERT_FILE_CONTENT("same.txt", "Same in both");
+    
+    // Same hash in both indexes, but the stat data no longer matches
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("same.txt", "Edited locally"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_restore(repo, first_id));
+    TEST_ASSERT_FILE_CONTENT("same.txt", "Same in both");
+    
+    free(first_id);
+    test_repo_destroy(repo);
+}
+
+// Test that restoring with pathspecs writes only the matching files and
+// leaves everything else in the tree alone
+void test_restore_pathspecs(void) {
+    test_repo_t* repo = test_repo_create("restore_pathspecs");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("docs"));
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("src"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("docs/a.md", "Doc A"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("docs/b.txt", "Doc B"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("src/main.c", "Main v1"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("root.txt", "Root v1"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "First"));
+    char* first_id = test_fractyl_get_latest_snapshot_id(repo);
+    TEST_ASSERT_NOT_NULL(first_id);
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("docs/a.md", "Doc A v2"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("docs/b.txt", "Doc B v2"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("src/main.c", "Main v2"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("root.txt", "Root v2"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("untracked.txt", "Not in any snapshot"));
+    
+    // A glob and a directory
+    char* argv[] = {test_frac_executable, "restore", first_id, "--", "docs/*.md", "./src", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    test_command_result_free(result);
+    
+    TEST_ASSERT_FILE_CONTENT("docs/a.md", "Doc A");
+    TEST_ASSERT_FILE_CONTENT("src/main.c", "Main v1");
+    TEST_ASSERT_FILE_CONTENT("docs/b.txt", "Doc B v2");
+    TEST_ASSERT_FILE_CONTENT("root.txt", "Root v2");
+    TEST_ASSERT_FILE_EXISTS("untracked.txt");
+    
+    // Nothing matches
+    char* none_argv[] = {test_frac_executable, "restore", first_id, "--", "missing", NULL};
+    result = test_run_command(test_frac_executable, none_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_NOT_EQUAL(0, result->exit_code);
+    test_command_result_free(result);
+    
+    free(first_id);
+    test_repo_destroy(repo);
+}
+
+// Test that export writes a snapshot into another directory, leaves the
+// working tree alone, and rewrites only what changed when repeated
+void test_export_to_directory(void) {
+    test_repo_t* repo = test_repo_create("export_directory");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    
+    TEST_ASSERT_EQUAL_INT(0, test_dir_create("src"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("src/main.c", "Main v1"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("notes.txt", "Notes v1"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "First"));
+    char* first_id = test_fractyl_get_latest_snapshot_id(repo);
+    TEST_ASSERT_NOT_NULL(first_id);
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("notes.txt", "Notes v2"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_remove("src/main.c"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("new.txt", "New"));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(repo, "Second"));
+    
+    char* argv[] = {test_frac_executable, "export", first_id, "out", NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    test_command_result_free(result);
+    TEST_ASSERT_FILE_CONTENT("out/src/main.c", "Main v1");
+    TEST_ASSERT_FILE_CONTENT("out/notes.txt", "Notes v1");
+    TEST_ASSERT_FILE_CONTENT("notes.txt", "Notes v2");
+    
+    // Exporting the same snapshot again writes nothing, even for files
+    // written in the last second of the first export
+    sleep(1);
+    struct stat before, after;
+    TEST_ASSERT_EQUAL_INT(0, stat("out/notes.txt", &before));
+    result = test_run_command(test_frac_executable, argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    TEST_ASSERT_NOT_NULL(strstr(result->stdout_content, "Exported 0 files"));
+    test_command_result_free(result);
+    TEST_ASSERT_EQUAL_INT(0, stat("out/notes.txt", &after));
+    TEST_ASSERT_EQUAL_UINT64((uint64_t)before.st_ino, (uint64_t)after.st_ino);
+    
+    // Moving to another snapshot removes what it does not have; files
+    // the export never wrote stay
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("out/local.txt", "Mine"));
+    char* link_argv[] = {test_frac_executable, "export", "-1", "out", "--link", NULL};
+    result = test_run_command(test_frac_executable, link_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT(0, result->exit_code);
+    test_command_result_free(result);
+    TEST_ASSERT_FILE_CONTENT("out/notes.txt", "Notes v2");
+    TEST_ASSERT_FILE_CONTENT("out/new.txt", "New");
+    TEST_ASSERT_FILE_NOT_EXISTS("out/src/main.c");
+    TEST_ASSERT_FALSE(test_dir_exists("out/src"));
+    TEST_ASSERT_FILE_EXISTS("out/local.txt");
+    
+    // Linked files are read-only so the objects cannot be edited through them
+    TEST_ASSERT_EQUAL_INT(0, stat("out/new.txt", &after));
+    TEST_ASSERT_EQUAL_INT(0, after.st_mode & 0222);
+    
+    // The working tree is not a destination
+    char* self_argv[] = {test_frac_executable, "export", first_id, ".", NULL};
+    result = test_run_command(test_frac_executable, self_argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_NOT_EQUAL(0, result->exit_code);
+    test_command_result_free(result);
+    TEST_ASSERT_FILE_CONTENT("notes.txt", "Notes v2");
+    
+    free(first_id);
+    test_repo_destroy(repo);
+}
+
 int main(void) {
     // Set up the test executable path
     test_frac_executable = realpath("./frac", NULL);
@@ -147,6 +318,9 @@ int main(void) {
     
     RUN_TEST(test_restore_removes_extra_files);
     RUN_TEST(test_restore_with_directories);
+    RUN_TEST(test_restore_only_rewrites_changed_files);
+    RUN_TEST(test_restore_pathspecs);
+    RUN_TEST(test_export_to_directory);
     
     free(test_frac_executable);
     return UNITY_END();
@@ -0,0 +1,201 @@
+#include "../unity/unity.h"
+#include "../test_helpers.h"
+#include "../../src/utils/counters.h"
+#include "../../src/include/fractyl.h"
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// Scaling tests: bound the work a snapshot does by the size of the tree.
+// Work is what the repository's counters record (stat calls, directories
+// read, files read, objects written), so the bounds hold on a busy machine;
+// only the growth check also looks at CPU time, with slack. The smaller
+// tree has FRACTYL_SCALE_FILES files (default 5000), the larger ten times
+// as many: FRACTYL_SCALE_FILES=10000 checks a no-op snapshot of 100k files.
+
+#define FILES_PER_DIR 100
+// A linear cost may grow by 10x; this leaves room for per-directory work
+#define MAX_GROWTH 12
+
+static long scale_files = 5000;
+
+void setUp(void) {
+}
+
+void tearDown(void) {
+}
+
+typedef struct {
+    counters_t work;
+    double cpu_seconds;
+} run_cost_t;
+
+static double children_cpu_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return (double)usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+           (double)usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// files files of distinct content, FILES_PER_DIR to a directory
+static void create_tree(long files) {
+    char path[256], content[64];
+    for (long i = 0; i < files; i++) {
+        if (i % FILES_PER_DIR == 0) {
+            snprintf(path, sizeof(path), "d%05ld", i / FILES_PER_DIR);
+            TEST_ASSERT_EQUAL_INT(0, test_dir_create(path));
+        }
+        snprintf(path, sizeof(path), "d%05ld/f%03ld.txt", i / FILES_PER_DIR, i % FILES_PER_DIR);
+        snprintf(content, sizeof(content), "file %ld\n", i);
+        TEST_ASSERT_EQUAL_INT(0, test_file_create(path, content));
+    }
+}
+
+// Snapshot the current repository and take the work it did from the counters
+static void snapshot_cost(const char *message, run_cost_t *cost) {
+    TEST_ASSERT_EQUAL(FRACTYL_OK, counters_reset_file(".fractyl"));
+    double cpu = children_cpu_seconds();
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_snapshot(NULL, message));
+    cost->cpu_seconds = children_cpu_seconds() - cpu;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, counters_load(".fractyl", &cost->work));
+    TEST_ASSERT_EQUAL_UINT64(1, cost->work.values[COUNTER_SCANS]);
+}
+
+static void assert_grows_linearly(const run_cost_t *small, const run_cost_t *large, counter_t counter) {
+    unsigned long long a = small->work.values[counter], b = large->work.values[counter];
+    char message[128];
+    snprintf(message, sizeof(message), "%s: %llu for 10x the files of %llu", counter_name(counter), b, a);
+    TEST_ASSERT_TRUE_MESSAGE(b <= a * MAX_GROWTH + MAX_GROWTH, message);
+}
+
+// A no-op snapshot stats each file once, reads none and writes nothing
+void test_noop_snapshot_work_is_bounded(void) {
+    long files = scale_files * 10, dirs = files / FILES_PER_DIR;
+    test_repo_t *repo = test_repo_create("scaling_noop");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    create_tree(files);
+    
+    // Taken right away, so files are racily clean and hashed again once
+    run_cost_t cost;
+    snapshot_cost("Initial", &cost);
+    TEST_ASSERT_EQUAL_UINT64(files, cost.work.values[COUNTER_NEW_FILES]);
+    sleep(1);
+    snapshot_cost("Refresh", &cost);
+    TEST_ASSERT_EQUAL_UINT64(0, cost.work.values[COUNTER_SNAPSHOTS]);
+    
+    snapshot_cost("No-op", &cost);
+    const unsigned long long *v = cost.work.values;
+    TEST_ASSERT_EQUAL_UINT64(0, v[COUNTER_SNAPSHOTS]);
+    TEST_ASSERT_EQUAL_UINT64(files, v[COUNTER_FILES_SCANNED]);
+    TEST_ASSERT_EQUAL_UINT64(files, v[COUNTER_STAT_HITS] + v[COUNTER_BINARY_HITS]);
+    TEST_ASSERT_TRUE(v[COUNTER_STAT_CALLS] <= (unsigned long long)(files + dirs + 16));
+    TEST_ASSERT_TRUE(v[COUNTER_DIR_READS] <= (unsigned long long)(dirs + 16));
+    TEST_ASSERT_EQUAL_UINT64(0, v[COUNTER_FILES_READ]);
+    TEST_ASSERT_EQUAL_UINT64(0, v[COUNTER_BYTES_HASHED]);
+    TEST_ASSERT_EQUAL_UINT64(0, v[COUNTER_OBJECTS_WRITTEN]);
+    TEST_ASSERT_EQUAL_UINT64(0, v[COUNTER_BYTES_WRITTEN]);
+    
+    test_repo_destroy(repo);
+}
+
+// A snapshot of one directory stats only what is in it; what changed
+// elsewhere is left for the next full snapshot
+void test_scoped_snapshot_work_is_bounded(void) {
+    long files = scale_files * 10;
+    test_repo_t *repo = test_repo_create("scaling_scoped");
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    create_tree(files);
+    sleep(1);
+    run_cost_t cost;
+    snapshot_cost("Initial", &cost);
+    
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("d00001/f000.txt", "changed inside\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_create("d00001/new.txt", "added inside\n"));
+    TEST_ASSERT_EQUAL_INT(0, test_file_modify("d00002/f000.txt", "changed outside\n"));
+    sleep(1);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, counters_reset_file(".fractyl"));
+    char *argv[] = { test_frac_executable, "snapshot", "-m", "Scoped", "--", "d00001", NULL };
+    test_command_result_t *result = test_run_command(test_frac_executable, argv);
+    TEST_ASSERT_NOT_NULL(result);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(0, result->exit_code, result->stdout_content);
+    test_command_result_free(result);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, counters_load(".fractyl", &cost.work));
+    const unsigned long long *v = cost.work.values;
+    TEST_ASSERT_EQUAL_UINT64(1, v[COUNTER_SNAPSHOTS]);
+    TEST_ASSERT_EQUAL_UINT64(FILES_PER_DIR + 1, v[COUNTER_FILES_SCANNED]);
+    TEST_ASSERT_TRUE(v[COUNTER_STAT_CALLS] <= FILES_PER_DIR + 16);
+    TEST_ASSERT_TRUE(v[COUNTER_DIR_READS] <= 4);
+    TEST_ASSERT_EQUAL_UINT64(1, v[COUNTER_REHASHED]);
+    TEST_ASSERT_EQUAL_UINT64(1, v[COUNTER_NEW_FILES]);
+    
+    // The full snapshot finds the change outside the scope and nothing else
+    snapshot_cost("Full", &cost);
+    TEST_ASSERT_EQUAL_UINT64(1, cost.work.values[COUNTER_SNAPSHOTS]);
+    TEST_ASSERT_EQUAL_UINT64(1, cost.work.values[COUNTER_REHASHED]);
+    TEST_ASSERT_EQUAL_UINT64(0, cost.work.values[COUNTER_NEW_FILES]);
+    
+    test_repo_destroy(repo);
+}
+
+// Snapshot a tree and then again unchanged, returning both costs
+static void measure_tree(const char *name, long files, run_cost_t *cold, run_cost_t *noop) {
+    test_repo_t *repo = test_repo_create(name);
+    TEST_ASSERT_NOT_NULL(repo);
+    TEST_ASSERT_EQUAL_INT(0, test_repo_enter(repo));
+    TEST_ASSERT_FRACTYL_SUCCESS(test_fractyl_init(repo));
+    create_tree(files);
+    sleep(1);
+    snapshot_cost("Cold", cold);
+    TEST_ASSERT_EQUAL_UINT64(files, cold->work.values[COUNTER_NEW_FILES]);
+    snapshot_cost("No-op", noop);
+    TEST_ASSERT_EQUAL_UINT64(0, noop->work.values[COUNTER_SNAPSHOTS]);
+    test_repo_destroy(repo);
+}
+
+// Ten times the files costs at most about ten times the work
+void test_snapshot_work_grows_linearly(void) {
+    run_cost_t small_cold, small_noop, large_cold, large_noop;
+    measure_tree("scaling_small", scale_files, &small_cold, &small_noop);
+    measure_tree("scaling_large", scale_files * 10, &large_cold, &large_noop);
+    
+    static const counter_t work[] = {
+        COUNTER_STAT_CALLS, COUNTER_DIR_READS, COUNTER_FILES_READ, COUNTER_BYTES_HASHED,
+        COUNTER_OBJECTS_WRITTEN, COUNTER_BYTES_WRITTEN,
+    };
+    for (size_t i = 0; i < sizeof(work) / sizeof(work[0]); i++) {
+        assert_grows_linearly(&small_cold, &large_cold, work[i]);
+        assert_grows_linearly(&small_noop, &large_noop, work[i]);
+    }
+    
+    // CPU time is noisier than the counts: allow a fixed second on top
+    printf("Cold snapshot CPU: %.2fs for %ld files, %.2fs for %ld\n", small_cold.cpu_seconds, scale_files,
+           large_cold.cpu_seconds, scale_files * 10);
+    TEST_ASSERT_TRUE(large_cold.cpu_seconds <= small_cold.cpu_seconds * MAX_GROWTH + 1.0);
+    TEST_ASSERT_TRUE(large_noop.cpu_seconds <= small_noop.cpu_seconds * MAX_GROWTH + 1.0);
+}
+
+int main(void) {
+    // Set up the test executable path
+    test_frac_executable = realpath("./frac", NULL);
+    if (!test_frac_executable) {
+        printf("Error: Could not find frac executable in current directory\n");
+        return 1;
+    }
+    const char *files = getenv("FRACTYL_SCALE_FILES");
+    if (files && atol(files) >= FILES_PER_DIR) {
+        scale_files = atol(files);
+    }
+    
+    UNITY_BEGIN();
+    
+    RUN_TEST(test_noop_snapshot_work_is_bounded);
+    RUN_TEST(test_scoped_snapshot_work_is_bounded);
+    RUN_TEST(test_snapshot_work_grows_linearly);
+    
+    free(test_frac_executable);
+    return UNITY_END();
+}
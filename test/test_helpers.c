@@ -1,4 +1,5 @@
 #include "test_helpers.h"
+#include "unity/unity.h"
 #include "../src/include/commands.h"
 #include <sys/wait.h>
 
@@ -217,6 +218,22 @@ void test_command_result_free(test_command_result_t* result) {
     free(result);
 }
 
+test_command_result_t* test_frac(const char* a, const char* b, const char* c, const char* d) {
+    char* argv[] = {test_frac_executable, (char*)a, (char*)b, (char*)c, (char*)d, NULL};
+    test_command_result_t* result = test_run_command(test_frac_executable, argv);
+    TEST_ASSERT_NOT_NULL(result);
+    return result;
+}
+
+void test_assert_frac_output(int exit_code, const char* expected, const char* a, const char* b,
+                             const char* c, const char* d) {
+    test_command_result_t* result = test_frac(a, b, c, d);
+    const char* out = result->stdout_content ? result->stdout_content : "";
+    TEST_ASSERT_EQUAL_INT_MESSAGE(exit_code, result->exit_code, out);
+    TEST_ASSERT_NOT_NULL_MESSAGE(strstr(out, expected), out);
+    test_command_result_free(result);
+}
+
 int test_fractyl_init(test_repo_t* repo) {
     (void)repo; // Suppress unused parameter warning
     char* argv[] = {test_frac_executable, "init", NULL};
@@ -269,11 +286,12 @@ char* test_fractyl_get_latest_snapshot_id(test_repo_t* repo) {
         if (newline) *newline = '\0'; // Terminate at end of snapshot line
     }
     
-    // Extract first 8 characters as snapshot ID
-    if (strlen(line) >= 8) {
-        char* snapshot_id = malloc(9);
-        strncpy(snapshot_id, line, 8);
-        snapshot_id[8] = '\0';
+    // The snapshot ID is shortened to a unique prefix of at least 8 characters
+    size_t id_len = strcspn(line, " ");
+    if (id_len >= 8) {
+        char* snapshot_id = malloc(id_len + 1);
+        strncpy(snapshot_id, line, id_len);
+        snapshot_id[id_len] = '\0';
         free(list_output);
         return snapshot_id;
     }
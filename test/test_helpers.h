@@ -51,6 +51,14 @@ typedef struct {
 test_command_result_t* test_run_command(const char* command, char* const argv[]);
 void test_command_result_free(test_command_result_t* result);
 
+// Run frac with up to four arguments (a NULL one ends them); the caller
+// frees the result
+test_command_result_t* test_frac(const char* a, const char* b, const char* c, const char* d);
+
+// Run frac and assert it exits with exit_code and prints expected
+void test_assert_frac_output(int exit_code, const char* expected, const char* a, const char* b,
+                             const char* c, const char* d);
+
 // Fractyl-specific helpers
 int test_fractyl_init(test_repo_t* repo);
 int test_fractyl_snapshot(test_repo_t* repo, const char* message);
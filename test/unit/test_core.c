@@ -1,7 +1,21 @@
 #include "../unity/unity.h"
 #include "../../src/core/hash.h"
 #include "../../src/core/objects.h"
+#include "../../src/core/pack.h"
+#include "../../src/core/compress.h"
+#include "../../src/core/chunker.h"
+#include "../../src/core/delta.h"
+#include "../../src/core/loose_cache.h"
 #include "../../src/core/index.h"
+#include "../../src/core/gc.h"
+#include "../../src/core/retention.h"
+#include "../../src/core/tree.h"
+#include "../../src/core/rename.h"
+#include "../../src/core/changes.h"
+#include "../../src/utils/json.h"
+#include "../../src/utils/catalog.h"
+#include "../../src/utils/snapshot_record.h"
+#include "../../src/include/fractyl.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -98,6 +112,83 @@ void test_hash_to_string_conversion(void) {
     TEST_ASSERT_EQUAL_STRING_LEN("0123456789abcdef", hex_string, 16);
 }
 
+void test_hash_blake3_known_answers(void) {
+    const char *expected_empty = "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262";
+    const char *expected_abc = "6437b3ac38465133ffb63b75273a8db548c558465d79db03fd359c6cd5bd9d85";
+    /* Two chunks: 1025 bytes of the reference pattern i % 251 */
+    const char *expected_1025 = "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444";
+    unsigned char hash[32], pattern[1025];
+    char hex[FRACTYL_HASH_HEX_SIZE];
+    for (size_t i = 0; i < sizeof(pattern); i++) pattern[i] = (unsigned char)(i % 251);
+    
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_set_algorithm(HASH_ALGORITHM_BLAKE3));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data("", 0, hash));
+    hash_to_string(hash, hex);
+    TEST_ASSERT_EQUAL_STRING(expected_empty, hex);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data("abc", 3, hash));
+    hash_to_string(hash, hex);
+    TEST_ASSERT_EQUAL_STRING(expected_abc, hex);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data(pattern, sizeof(pattern), hash));
+    hash_to_string(hash, hex);
+    TEST_ASSERT_EQUAL_STRING(expected_1025, hex);
+    
+    hash_set_algorithm(HASH_ALGORITHM_SHA256);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data("abc", 3, hash));
+    hash_to_string(hash, hex);
+    TEST_ASSERT_EQUAL_STRING("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hex);
+}
+
+void test_hash_blake3_large_files_match_streaming(void) {
+    /* Large enough to be mapped and split over threads */
+    const char *path = "/tmp/test_hash_blake3_large.bin";
+    size_t size = 9 * 1024 * 1024 + 4321;
+    unsigned char *data = malloc(size);
+    TEST_ASSERT_NOT_NULL(data);
+    for (size_t i = 0; i < size; i++) data[i] = (unsigned char)((i * 7) ^ (i >> 13));
+    FILE *fp = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL(size, fwrite(data, 1, size, fp));
+    fclose(fp);
+    
+    hash_set_algorithm(HASH_ALGORITHM_BLAKE3);
+    unsigned char from_file[32], from_data[32], streamed[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(path, from_file));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data(data, size, from_data));
+    
+    /* Uneven pieces cross chunk and subtree boundaries */
+    hash_ctx_t *ctx = hash_ctx_new();
+    TEST_ASSERT_NOT_NULL(ctx);
+    for (size_t offset = 0, piece = 1; offset < size; offset += piece, piece = piece * 3 % 70001 + 1) {
+        if (piece > size - offset) piece = size - offset;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, hash_ctx_update(ctx, data + offset, piece));
+    }
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_ctx_final(ctx, streamed));
+    hash_set_algorithm(HASH_ALGORITHM_SHA256);
+    
+    TEST_ASSERT_EQUAL_MEMORY(streamed, from_file, 32);
+    TEST_ASSERT_EQUAL_MEMORY(streamed, from_data, 32);
+    free(data);
+    unlink(path);
+}
+
+void test_index_records_hash_algorithm(void) {
+    const char *index_file = "/tmp/test_index_algorithm.dat";
+    index_t index, loaded;
+    index_init(&index);
+    
+    hash_set_algorithm(HASH_ALGORITHM_BLAKE3);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save(&index, index_file));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_load(&loaded, index_file));
+    index_free(&loaded);
+    
+    /* A SHA-256 repository must not take its names for its own */
+    hash_set_algorithm(HASH_ALGORITHM_SHA256);
+    TEST_ASSERT_EQUAL(FRACTYL_ERROR_HASH_MISMATCH, index_load(&loaded, index_file));
+    
+    index_free(&index);
+    unlink(index_file);
+}
+
 /* Test object storage functionality */
 void test_object_path_creation(void) {
     unsigned char hash[32];
@@ -166,6 +257,1204 @@ void test_object_store_and_restore_file(void) {
     }
 }
 
+void test_object_store_file_streams_large_files(void) {
+    const char *temp_file = "/tmp/test_object_large.bin";
+    const char *fractyl_dir = "/tmp/test_objects_large";
+    system("rm -rf /tmp/test_objects_large");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    
+    /* Several I/O buffers' worth, not a multiple of the buffer size */
+    size_t size = 3 * 1024 * 1024 + 123;
+    unsigned char *content = malloc(size);
+    TEST_ASSERT_NOT_NULL(content);
+    for (size_t i = 0; i < size; i++) content[i] = (unsigned char)(i * 7 + (i >> 12));
+    FILE *fp = fopen(temp_file, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL(size, fwrite(content, 1, size, fp));
+    fclose(fp);
+    
+    unsigned char expected[32], stored[32], again[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(temp_file, expected));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_file(temp_file, fractyl_dir, stored));
+    TEST_ASSERT_EQUAL_MEMORY(expected, stored, 32);
+    
+    /* Storing it again drops the second copy */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_file(temp_file, fractyl_dir, again));
+    TEST_ASSERT_EQUAL_MEMORY(expected, again, 32);
+    
+    void *data;
+    size_t data_size;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(stored, fractyl_dir, &data, &data_size));
+    TEST_ASSERT_EQUAL(size, data_size);
+    TEST_ASSERT_EQUAL(0, memcmp(data, content, size));
+    free(data);
+    
+    /* No temporary files are left behind */
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "ls %s/objects | grep -q tmp_obj_", fractyl_dir);
+    TEST_ASSERT_NOT_EQUAL(0, system(cmd));
+    
+    free(content);
+    unlink(temp_file);
+    system("rm -rf /tmp/test_objects_large");
+}
+
+/* Test storing and restoring with and without kernel side copies */
+void test_object_copy_modes_store_and_restore(void) {
+    const char *temp_file = "/tmp/test_object_copy.bin";
+    const char *restored_file = "/tmp/test_object_copy_restored.bin";
+    const char *dirs[] = { "/tmp/test_objects_copy_auto", "/tmp/test_objects_copy_buffered" };
+    
+    size_t size = 2 * 1024 * 1024 + 77;
+    unsigned char *content = malloc(size);
+    TEST_ASSERT_NOT_NULL(content);
+    for (size_t i = 0; i < size; i++) content[i] = (unsigned char)(i * 13 + (i >> 9));
+    FILE *fp = fopen(temp_file, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL(size, fwrite(content, 1, size, fp));
+    fclose(fp);
+    
+    unsigned char expected[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(temp_file, expected));
+    
+    for (int i = 0; i < 2; i++) {
+        char cmd[256];
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", dirs[i]);
+        system(cmd);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(dirs[i]));
+        if (i == 1) {
+            char config_path[256];
+            snprintf(config_path, sizeof(config_path), "%s/config", dirs[i]);
+            FILE *config = fopen(config_path, "w");
+            TEST_ASSERT_NOT_NULL(config);
+            fprintf(config, "objects.copy_mode = copy\n");
+            fclose(config);
+        }
+        
+        unsigned char stored[32];
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_file(temp_file, dirs[i], stored));
+        TEST_ASSERT_EQUAL_MEMORY(expected, stored, 32);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(dirs[i]));
+        
+        /* Storing under a known hash goes through the same copy paths */
+        char *loose = object_path(stored, dirs[i]);
+        TEST_ASSERT_NOT_NULL(loose);
+        TEST_ASSERT_EQUAL(0, unlink(loose));
+        free(loose);
+        loose_cache_invalidate();
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_write_file(temp_file, dirs[i], stored));
+        void *data;
+        size_t data_size;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(stored, dirs[i], &data, &data_size));
+        TEST_ASSERT_EQUAL(size, data_size);
+        TEST_ASSERT_EQUAL(0, memcmp(data, content, size));
+        free(data);
+        
+        /* Restoring over an existing, longer file truncates it */
+        fp = fopen(restored_file, "wb");
+        TEST_ASSERT_NOT_NULL(fp);
+        fwrite(content, 1, size, fp);
+        fwrite(content, 1, 100, fp);
+        fclose(fp);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_restore_file(stored, dirs[i], restored_file));
+        
+        unsigned char restored[32];
+        TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(restored_file, restored));
+        TEST_ASSERT_EQUAL_MEMORY(expected, restored, 32);
+        
+        system(cmd);
+    }
+    
+    free(content);
+    unlink(temp_file);
+    unlink(restored_file);
+}
+
+/* Test compressed objects and raw content that looks like a header */
+void test_object_compression_round_trip(void) {
+    const char *fractyl_dir = "/tmp/test_objects_compressed";
+    const char *temp_file = "/tmp/test_object_compress.txt";
+    const char *restored_file = "/tmp/test_object_compress_restored.txt";
+    system("rm -rf /tmp/test_objects_compressed");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    FILE *config = fopen("/tmp/test_objects_compressed/config", "w");
+    TEST_ASSERT_NOT_NULL(config);
+    fprintf(config, "objects.compression = zstd\n");
+    fclose(config);
+    
+    /* Repetitive text spanning several I/O buffers */
+    FILE *fp = fopen(temp_file, "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    for (int i = 0; i < 200000; i++) fprintf(fp, "line %d of some compressible text\n", i);
+    fclose(fp);
+    struct stat st;
+    TEST_ASSERT_EQUAL(0, stat(temp_file, &st));
+    
+    unsigned char expected[32], stored[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(temp_file, expected));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_file(temp_file, fractyl_dir, stored));
+    TEST_ASSERT_EQUAL_MEMORY(expected, stored, 32);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(fractyl_dir));
+    
+    char *loose = object_path(stored, fractyl_dir);
+    TEST_ASSERT_NOT_NULL(loose);
+    struct stat object_st;
+    TEST_ASSERT_EQUAL(0, stat(loose, &object_st));
+    if (compress_available()) {
+        TEST_ASSERT_TRUE(object_st.st_size < st.st_size / 4);
+    }
+    free(loose);
+    
+    /* Streamed restore and in-memory load both give back the content */
+    unsigned char restored[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_restore_file(stored, fractyl_dir, restored_file));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(restored_file, restored));
+    TEST_ASSERT_EQUAL_MEMORY(expected, restored, 32);
+    void *data;
+    size_t data_size;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(stored, fractyl_dir, &data, &data_size));
+    TEST_ASSERT_EQUAL((size_t)st.st_size, data_size);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data(data, data_size, restored));
+    TEST_ASSERT_EQUAL_MEMORY(expected, restored, 32);
+    free(data);
+    
+    /* Raw content starting with the header magic survives a round trip */
+    unsigned char tricky[40] = { 0x89, 'F', 'Z', 'O', 1, 0, 0, 0 };
+    for (size_t i = 8; i < sizeof(tricky); i++) tricky[i] = (unsigned char)(i * 37);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data(tricky, sizeof(tricky), fractyl_dir, stored));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(stored, fractyl_dir, &data, &data_size));
+    TEST_ASSERT_EQUAL(sizeof(tricky), data_size);
+    TEST_ASSERT_EQUAL_MEMORY(tricky, data, sizeof(tricky));
+    free(data);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_restore_file(stored, fractyl_dir, restored_file));
+    fp = fopen(restored_file, "rb");
+    TEST_ASSERT_NOT_NULL(fp);
+    unsigned char back[64];
+    TEST_ASSERT_EQUAL(sizeof(tricky), fread(back, 1, sizeof(back), fp));
+    fclose(fp);
+    TEST_ASSERT_EQUAL_MEMORY(tricky, back, sizeof(tricky));
+    
+    /* Packs hold the decoded content */
+    pack_repack_stats_t stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, pack_repack(fractyl_dir, 0, &stats));
+    TEST_ASSERT_EQUAL(2, stats.loose_packed);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(stored, fractyl_dir, &data, &data_size));
+    TEST_ASSERT_EQUAL_MEMORY(tricky, data, sizeof(tricky));
+    free(data);
+    
+    unlink(temp_file);
+    unlink(restored_file);
+    system("rm -rf /tmp/test_objects_compressed");
+}
+
+static void fill_pseudo_random(unsigned char *data, size_t size, unsigned int seed) {
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245u + 12345u;
+        data[i] = (unsigned char)(seed >> 16);
+    }
+}
+
+/* Positions where chunker_cut splits data */
+static size_t chunk_boundaries(const unsigned char *data, size_t size, size_t *cuts, size_t max_cuts) {
+    size_t count = 0, pos = 0;
+    while (pos < size && count < max_cuts) {
+        size_t len = chunker_cut(data + pos, size - pos);
+        TEST_ASSERT_TRUE(len > 0);
+        if (pos + len < size) {
+            TEST_ASSERT_TRUE(len >= CHUNK_MIN_SIZE && len <= CHUNK_MAX_SIZE);
+        }
+        pos += len;
+        cuts[count++] = pos;
+    }
+    return count;
+}
+
+/* Test that chunk boundaries survive an insertion before them */
+void test_chunker_cut_resynchronizes_after_insert(void) {
+    size_t size = 4 * 1024 * 1024;
+    unsigned char *original = malloc(size);
+    unsigned char *edited = malloc(size + 100);
+    TEST_ASSERT_NOT_NULL(original);
+    TEST_ASSERT_NOT_NULL(edited);
+    fill_pseudo_random(original, size, 42);
+    
+    size_t insert_at = 1000000;
+    memcpy(edited, original, insert_at);
+    memset(edited + insert_at, 'x', 100);
+    memcpy(edited + insert_at + 100, original + insert_at, size - insert_at);
+    
+    size_t cuts_a[512], cuts_b[512];
+    size_t count_a = chunk_boundaries(original, size, cuts_a, 512);
+    size_t count_b = chunk_boundaries(edited, size + 100, cuts_b, 512);
+    TEST_ASSERT_TRUE(count_a > 16);
+    
+    /* Every boundary well past the edit is found again, shifted */
+    size_t matched = 0, expected = 0;
+    for (size_t i = 0; i < count_a; i++) {
+        if (cuts_a[i] < insert_at + 2 * CHUNK_MAX_SIZE) continue;
+        expected++;
+        for (size_t j = 0; j < count_b; j++) {
+            if (cuts_b[j] == cuts_a[i] + 100) {
+                matched++;
+                break;
+            }
+        }
+    }
+    TEST_ASSERT_TRUE(expected > 0);
+    TEST_ASSERT_EQUAL(expected, matched);
+    
+    free(original);
+    free(edited);
+}
+
+static int count_loose_files(const char *fractyl_dir) {
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "find %s/objects -type f | wc -l", fractyl_dir);
+    FILE *p = popen(cmd, "r");
+    int count = -1;
+    if (p) {
+        if (fscanf(p, "%d", &count) != 1) count = -1;
+        pclose(p);
+    }
+    return count;
+}
+
+/* Test large files stored as shared chunks */
+void test_object_store_file_chunks_large_files(void) {
+    const char *fractyl_dir = "/tmp/test_objects_chunked";
+    const char *temp_file = "/tmp/test_object_chunked.bin";
+    const char *restored_file = "/tmp/test_object_chunked_restored.bin";
+    system("rm -rf /tmp/test_objects_chunked");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    FILE *config = fopen("/tmp/test_objects_chunked/config", "w");
+    TEST_ASSERT_NOT_NULL(config);
+    fprintf(config, "objects.chunk_threshold = 1048576\n");
+    fclose(config);
+    
+    size_t size = 3 * 1024 * 1024 + 5;
+    unsigned char *content = malloc(size);
+    TEST_ASSERT_NOT_NULL(content);
+    fill_pseudo_random(content, size, 7);
+    FILE *fp = fopen(temp_file, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL(size, fwrite(content, 1, size, fp));
+    fclose(fp);
+    
+    unsigned char expected[32], stored[32], restored[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(temp_file, expected));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_file(temp_file, fractyl_dir, stored));
+    TEST_ASSERT_EQUAL_MEMORY(expected, stored, 32);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(fractyl_dir));
+    
+    /* The object under the file's hash is a chunk list */
+    char *list_path = object_path(stored, fractyl_dir);
+    TEST_ASSERT_NOT_NULL(list_path);
+    fp = fopen(list_path, "rb");
+    TEST_ASSERT_NOT_NULL(fp);
+    unsigned char head[OBJECT_HEADER_SIZE];
+    TEST_ASSERT_EQUAL(sizeof(head), fread(head, 1, sizeof(head), fp));
+    fclose(fp);
+    free(list_path);
+    object_header_t header;
+    TEST_ASSERT_TRUE(object_header_parse(head, sizeof(head), &header));
+    TEST_ASSERT_EQUAL(OBJECT_CODEC_CHUNKED, header.codec);
+    TEST_ASSERT_EQUAL(size, header.size);
+    
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_restore_file(stored, fractyl_dir, restored_file));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(restored_file, restored));
+    TEST_ASSERT_EQUAL_MEMORY(expected, restored, 32);
+    void *data;
+    size_t data_size;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(stored, fractyl_dir, &data, &data_size));
+    TEST_ASSERT_EQUAL(size, data_size);
+    TEST_ASSERT_EQUAL(0, memcmp(data, content, size));
+    free(data);
+    
+    /* A small edit adds a new chunk list and only the chunks it touched */
+    int before = count_loose_files(fractyl_dir);
+    memset(content + size / 2, 0, 64);
+    fp = fopen(temp_file, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL(size, fwrite(content, 1, size, fp));
+    fclose(fp);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(temp_file, expected));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_write_file(temp_file, fractyl_dir, expected));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(fractyl_dir));
+    int after = count_loose_files(fractyl_dir);
+    TEST_ASSERT_TRUE(after > before);
+    TEST_ASSERT_TRUE(after <= before + 3);
+    
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_restore_file(expected, fractyl_dir, restored_file));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(restored_file, restored));
+    TEST_ASSERT_EQUAL_MEMORY(expected, restored, 32);
+    
+    free(content);
+    unlink(temp_file);
+    unlink(restored_file);
+    system("rm -rf /tmp/test_objects_chunked");
+}
+
+/* Read a whole file into memory */
+static unsigned char *read_whole_file(const char *path, size_t *size_out) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char *data = malloc(size > 0 ? (size_t)size : 1);
+    *size_out = data ? fread(data, 1, (size_t)size, fp) : 0;
+    fclose(fp);
+    return data;
+}
+
+/* Test that chunks stored by several threads make the same object */
+void test_object_store_file_large_file_threads(void) {
+    const char *dirs[2] = { "/tmp/test_objects_large_parallel", "/tmp/test_objects_large_serial" };
+    const char *temp_file = "/tmp/test_object_large.bin";
+    const char *restored_file = "/tmp/test_object_large_restored.bin";
+    system("rm -rf /tmp/test_objects_large_parallel /tmp/test_objects_large_serial");
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(dirs[i]));
+        char config_path[256];
+        snprintf(config_path, sizeof(config_path), "%s/config", dirs[i]);
+        FILE *config = fopen(config_path, "w");
+        TEST_ASSERT_NOT_NULL(config);
+        fprintf(config, "objects.chunk_threshold = 1048576\nobjects.large_file_threshold = %s\n",
+                i == 0 ? "1048576" : "0");
+        fclose(config);
+    }
+    
+    /* Several segments' worth, so the store threads share the file */
+    size_t size = 13 * 1024 * 1024 + 77;
+    unsigned char *content = malloc(size);
+    TEST_ASSERT_NOT_NULL(content);
+    fill_pseudo_random(content, size, 11);
+    FILE *fp = fopen(temp_file, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL(size, fwrite(content, 1, size, fp));
+    fclose(fp);
+    
+    unsigned char expected[32], stored[2][32], restored[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(temp_file, expected));
+    setenv("FRACTYL_LARGE_FILE_THREADS", "4", 1);
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_file(temp_file, dirs[i], stored[i]));
+        TEST_ASSERT_EQUAL_MEMORY(expected, stored[i], 32);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(dirs[i]));
+    }
+    
+    /* The chunk lists are the same, in file order */
+    size_t list_sizes[2];
+    unsigned char *lists[2];
+    for (int i = 0; i < 2; i++) {
+        char *list_path = object_path(stored[i], dirs[i]);
+        TEST_ASSERT_NOT_NULL(list_path);
+        lists[i] = read_whole_file(list_path, &list_sizes[i]);
+        free(list_path);
+        TEST_ASSERT_NOT_NULL(lists[i]);
+    }
+    TEST_ASSERT_EQUAL(list_sizes[1], list_sizes[0]);
+    TEST_ASSERT_EQUAL(0, memcmp(lists[0], lists[1], list_sizes[0]));
+    TEST_ASSERT_EQUAL(count_loose_files(dirs[1]), count_loose_files(dirs[0]));
+    free(lists[0]);
+    free(lists[1]);
+    
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_restore_file(stored[0], dirs[0], restored_file));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(restored_file, restored));
+    TEST_ASSERT_EQUAL_MEMORY(expected, restored, 32);
+    
+    /* A file changed since it was hashed is refused */
+    memset(content, 0, 64);
+    fp = fopen(temp_file, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL(size, fwrite(content, 1, size, fp));
+    fclose(fp);
+    unsigned char stale[32];
+    memcpy(stale, expected, 32);
+    stale[0] ^= 1;
+    TEST_ASSERT_EQUAL(FRACTYL_ERROR_HASH_MISMATCH, object_write_file(temp_file, dirs[0], stale));
+    unsetenv("FRACTYL_LARGE_FILE_THREADS");
+    
+    free(content);
+    unlink(temp_file);
+    unlink(restored_file);
+    system("rm -rf /tmp/test_objects_large_parallel /tmp/test_objects_large_serial");
+}
+
+/* Read an object through a reader in uneven pieces and compare it */
+static void assert_reader_content(const unsigned char *hash, const char *fractyl_dir,
+                                  const unsigned char *expected, size_t size, int viewable) {
+    object_reader_t *reader;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_reader_open(hash, fractyl_dir, &reader));
+    TEST_ASSERT_EQUAL_UINT64(size, object_reader_size(reader));
+    
+    unsigned char piece[4099];
+    size_t offset = 0;
+    ssize_t n;
+    while ((n = object_reader_read(reader, piece, sizeof(piece))) > 0) {
+        TEST_ASSERT_TRUE(offset + (size_t)n <= size);
+        TEST_ASSERT_EQUAL(0, memcmp(expected + offset, piece, (size_t)n));
+        offset += (size_t)n;
+    }
+    TEST_ASSERT_EQUAL(0, n);
+    TEST_ASSERT_EQUAL(size, offset);
+    
+    const void *view = object_reader_view(reader);
+    if (viewable) {
+        TEST_ASSERT_NOT_NULL(view);
+        TEST_ASSERT_EQUAL(0, memcmp(expected, view, size));
+    } else {
+        TEST_ASSERT_NULL(view);
+    }
+    object_reader_close(reader);
+}
+
+/* Test that readers give back every stored form of an object */
+void test_object_reader_streams_stored_forms(void) {
+    const char *fractyl_dir = "/tmp/test_objects_reader";
+    const char *temp_file = "/tmp/test_object_reader.bin";
+    system("rm -rf /tmp/test_objects_reader");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    FILE *config = fopen("/tmp/test_objects_reader/config", "w");
+    TEST_ASSERT_NOT_NULL(config);
+    fprintf(config, "objects.compression = zstd\nobjects.chunk_threshold = 1048576\n");
+    fclose(config);
+    
+    /* Compressible text below the chunk threshold */
+    size_t text_size = 0;
+    char *text = malloc(900000);
+    TEST_ASSERT_NOT_NULL(text);
+    for (int i = 0; text_size < 850000; i++) {
+        text_size += (size_t)sprintf(text + text_size, "line %d of some compressible text\n", i);
+    }
+    unsigned char text_hash[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data(text, text_size, fractyl_dir, text_hash));
+    
+    /* Random content above it, stored as chunks */
+    size_t big_size = 3 * 1024 * 1024 + 5;
+    unsigned char *big = malloc(big_size);
+    TEST_ASSERT_NOT_NULL(big);
+    fill_pseudo_random(big, big_size, 11);
+    FILE *fp = fopen(temp_file, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL(big_size, fwrite(big, 1, big_size, fp));
+    fclose(fp);
+    unsigned char big_hash[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_file(temp_file, fractyl_dir, big_hash));
+    
+    unsigned char empty_hash[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("", 0, fractyl_dir, empty_hash));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(fractyl_dir));
+    
+    /* Compressed objects and chunk lists stream; only raw content maps */
+    assert_reader_content(text_hash, fractyl_dir, (unsigned char *)text, text_size, !compress_available());
+    assert_reader_content(big_hash, fractyl_dir, big, big_size, 0);
+    assert_reader_content(empty_hash, fractyl_dir, (const unsigned char *)"", 0, 1);
+    
+    /* Packed entries are read in place from the pack */
+    pack_repack_stats_t stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, pack_repack(fractyl_dir, 0, &stats));
+    TEST_ASSERT_TRUE(pack_has_object(fractyl_dir, text_hash, 0));
+    assert_reader_content(text_hash, fractyl_dir, (unsigned char *)text, text_size, !compress_available());
+    assert_reader_content(big_hash, fractyl_dir, big, big_size, 0);
+    
+    unsigned char missing[32] = { 0 };
+    object_reader_t *reader;
+    TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, object_reader_open(missing, fractyl_dir, &reader));
+    
+    free(text);
+    free(big);
+    unlink(temp_file);
+    system("rm -rf /tmp/test_objects_reader");
+}
+
+/* Test the loose object existence cache */
+void test_object_exists_uses_loose_cache(void) {
+    const char *fractyl_dir = "/tmp/test_loose_cache";
+    system("rm -rf /tmp/test_loose_cache");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    
+    unsigned char first[32], second[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("cached one", 10, fractyl_dir, first));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(fractyl_dir));
+    TEST_ASSERT_TRUE(loose_cache_contains(fractyl_dir, first));
+    TEST_ASSERT_TRUE(object_exists(first, fractyl_dir));
+    
+    /* Answered from memory: a deletion behind the cache's back goes
+     * unnoticed until it is invalidated */
+    char *loose = object_path(first, fractyl_dir);
+    TEST_ASSERT_EQUAL(0, unlink(loose));
+    free(loose);
+    TEST_ASSERT_TRUE(object_exists(first, fractyl_dir));
+    loose_cache_invalidate();
+    TEST_ASSERT_FALSE(object_exists(first, fractyl_dir));
+    
+    /* Objects another process stores are still found on disk */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data("written elsewhere", 17, second));
+    TEST_ASSERT_FALSE(object_exists(second, fractyl_dir));
+    char *path = object_path(second, fractyl_dir);
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%.*s", (int)(strrchr(path, '/') - path), path);
+    mkdir(dir, 0755);
+    FILE *fp = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    fputs("written elsewhere", fp);
+    fclose(fp);
+    free(path);
+    TEST_ASSERT_TRUE(object_exists(second, fractyl_dir));
+    TEST_ASSERT_TRUE(loose_cache_contains(fractyl_dir, second));
+    
+    system("rm -rf /tmp/test_loose_cache");
+    loose_cache_invalidate();
+}
+
+/* Test that object stats count new and already stored content */
+void test_object_stats_count_written_and_deduplicated(void) {
+    const char *fractyl_dir = "/tmp/test_object_stats";
+    system("rm -rf /tmp/test_object_stats");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    
+    object_stats_reset();
+    unsigned char hash[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("counted once", 12, fractyl_dir, hash));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("counted once", 12, fractyl_dir, hash));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(fractyl_dir));
+    object_stats_t stats;
+    object_stats_get(&stats);
+    TEST_ASSERT_EQUAL(1, stats.objects_written);
+    TEST_ASSERT_TRUE(stats.bytes_written > 0);
+    TEST_ASSERT_EQUAL(12, stats.bytes_deduplicated);
+    
+    /* Snapshots keep what they cost in their metadata */
+    snapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    strcpy(snapshot.id, "stats");
+    snapshot.stats.recorded = 1;
+    snapshot.stats.objects_written = stats.objects_written;
+    snapshot.stats.bytes_deduplicated = stats.bytes_deduplicated;
+    snapshot.stats.total_ms = 42;
+    snapshot.stats.paths[0] = strdup("big.bin");
+    snapshot.stats.path_sizes[0] = 1000;
+    snapshot.stats.path_count = 1;
+    char *json = json_serialize_snapshot(&snapshot);
+    TEST_ASSERT_NOT_NULL(json);
+    json_free_snapshot(&snapshot);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, json_deserialize_snapshot(json, &snapshot));
+    free(json);
+    TEST_ASSERT_TRUE(snapshot.stats.recorded);
+    TEST_ASSERT_EQUAL(1, snapshot.stats.objects_written);
+    TEST_ASSERT_EQUAL(12, snapshot.stats.bytes_deduplicated);
+    TEST_ASSERT_EQUAL(42, snapshot.stats.total_ms);
+    TEST_ASSERT_EQUAL(1, snapshot.stats.path_count);
+    TEST_ASSERT_EQUAL_STRING("big.bin", snapshot.stats.paths[0]);
+    TEST_ASSERT_EQUAL(1000, snapshot.stats.path_sizes[0]);
+    json_free_snapshot(&snapshot);
+    
+    system("rm -rf /tmp/test_object_stats");
+    loose_cache_invalidate();
+}
+
+static void write_durability_config(const char *fractyl_dir, const char *mode) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/config", fractyl_dir);
+    FILE *config = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(config);
+    fprintf(config, "objects.durability = %s\n", mode);
+    fclose(config);
+}
+
+/* Test that batched objects are named only once their group is synced */
+void test_object_durability_batches_until_sync(void) {
+    const char *fractyl_dir = "/tmp/test_durability_batch";
+    system("rm -rf /tmp/test_durability_batch");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    write_durability_config(fractyl_dir, "batch");
+    TEST_ASSERT_EQUAL(OBJECT_DURABILITY_BATCH, object_durability(fractyl_dir));
+    
+    unsigned char hash[32], again[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("batched object", 14, fractyl_dir, hash));
+    TEST_ASSERT_TRUE(object_exists(hash, fractyl_dir));
+    char *path = object_path(hash, fractyl_dir);
+    TEST_ASSERT_NOT_NULL(path);
+    struct stat st;
+    TEST_ASSERT_NOT_EQUAL(0, stat(path, &st));
+    
+    /* Storing it again while it waits keeps a single copy */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("batched object", 14, fractyl_dir, again));
+    TEST_ASSERT_EQUAL_MEMORY(hash, again, 32);
+    
+    /* Reading it publishes the group */
+    void *data;
+    size_t size;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(hash, fractyl_dir, &data, &size));
+    TEST_ASSERT_EQUAL(14, size);
+    TEST_ASSERT_EQUAL(0, memcmp(data, "batched object", 14));
+    free(data);
+    TEST_ASSERT_EQUAL(0, stat(path, &st));
+    free(path);
+    
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("second object", 13, fractyl_dir, hash));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(fractyl_dir));
+    path = object_path(hash, fractyl_dir);
+    TEST_ASSERT_EQUAL(0, stat(path, &st));
+    free(path);
+    TEST_ASSERT_EQUAL(2, count_loose_files(fractyl_dir));
+    
+    system("rm -rf /tmp/test_durability_batch");
+    loose_cache_invalidate();
+}
+
+/* Test that unbatched modes name objects as they are stored */
+void test_object_durability_full_and_none_store_at_once(void) {
+    const char *modes[] = { "full", "none" };
+    const object_durability_t expected[] = { OBJECT_DURABILITY_FULL, OBJECT_DURABILITY_NONE };
+    for (int i = 0; i < 2; i++) {
+        const char *fractyl_dir = i == 0 ? "/tmp/test_durability_full" : "/tmp/test_durability_none";
+        char cmd[256];
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", fractyl_dir);
+        system(cmd);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+        write_durability_config(fractyl_dir, modes[i]);
+        TEST_ASSERT_EQUAL(expected[i], object_durability(fractyl_dir));
+    
+        unsigned char hash[32];
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data(modes[i], strlen(modes[i]), fractyl_dir, hash));
+        char *path = object_path(hash, fractyl_dir);
+        struct stat st;
+        TEST_ASSERT_EQUAL(0, stat(path, &st));
+        free(path);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_sync(fractyl_dir));
+        system(cmd);
+    }
+    loose_cache_invalidate();
+}
+
+/* Test packfile storage */
+void test_pack_repack_serves_objects_from_packs(void) {
+    const char *fractyl_dir = "/tmp/test_pack_objects";
+    const char *restored_file = "/tmp/test_pack_restore.txt";
+    system("rm -rf /tmp/test_pack_objects");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    
+    const char *contents[] = { "first object", "second object", "" };
+    unsigned char hashes[3][32];
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data(contents[i], strlen(contents[i]),
+                                                        fractyl_dir, hashes[i]));
+    }
+    
+    pack_repack_stats_t stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, pack_repack(fractyl_dir, 0, &stats));
+    TEST_ASSERT_EQUAL(3, stats.loose_packed);
+    TEST_ASSERT_EQUAL(3, stats.objects);
+    
+    /* Loose copies are gone; everything is read from the pack */
+    for (int i = 0; i < 3; i++) {
+        char *loose = object_path(hashes[i], fractyl_dir);
+        TEST_ASSERT_NOT_EQUAL(0, access(loose, F_OK));
+        free(loose);
+    
+        TEST_ASSERT_TRUE(object_exists(hashes[i], fractyl_dir));
+        void *data;
+        size_t size;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(hashes[i], fractyl_dir, &data, &size));
+        TEST_ASSERT_EQUAL(strlen(contents[i]), size);
+        TEST_ASSERT_EQUAL(0, memcmp(data, contents[i], size));
+        free(data);
+    }
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_restore_file(hashes[1], fractyl_dir, restored_file));
+    FILE *fp = fopen(restored_file, "r");
+    TEST_ASSERT_NOT_NULL(fp);
+    char restored[64] = {0};
+    fgets(restored, sizeof(restored), fp);
+    fclose(fp);
+    TEST_ASSERT_EQUAL_STRING("second object", restored);
+    
+    /* Packed objects are located for ordering reads, and only they */
+    uint32_t pack_number;
+    uint64_t offsets[3];
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(FRACTYL_OK, pack_locate_object(fractyl_dir, hashes[i], &pack_number, &offsets[i]));
+        TEST_ASSERT_EQUAL_UINT32(0, pack_number);
+        TEST_ASSERT_TRUE(offsets[i] >= PACK_HEADER_SIZE);
+        TEST_ASSERT_TRUE(pack_prefetch_object(fractyl_dir, hashes[i]));
+    }
+    TEST_ASSERT_TRUE(offsets[0] != offsets[1] && offsets[1] != offsets[2] && offsets[0] != offsets[2]);
+    unsigned char absent[32] = {0};
+    TEST_ASSERT_EQUAL(FRACTYL_ERROR_NOT_FOUND, pack_locate_object(fractyl_dir, absent, &pack_number, &offsets[0]));
+    TEST_ASSERT_FALSE(pack_prefetch_object(fractyl_dir, absent));
+    
+    /* A new loose object goes into a second pack; -a folds both into one */
+    unsigned char extra[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("third", 5, fractyl_dir, extra));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, pack_repack(fractyl_dir, 0, &stats));
+    TEST_ASSERT_EQUAL(1, stats.objects);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, pack_repack(fractyl_dir, 1, &stats));
+    TEST_ASSERT_EQUAL(4, stats.objects);
+    TEST_ASSERT_EQUAL(2, stats.packs_removed);
+    TEST_ASSERT_TRUE(object_exists(extra, fractyl_dir));
+    TEST_ASSERT_TRUE(object_exists(hashes[0], fractyl_dir));
+    
+    /* Unknown hashes are still missing */
+    unsigned char missing[32];
+    memset(missing, 0xAB, sizeof(missing));
+    TEST_ASSERT_FALSE(object_exists(missing, fractyl_dir));
+    
+    unlink(restored_file);
+    system("rm -rf /tmp/test_pack_objects");
+}
+
+/* Test garbage collection of objects no snapshot refers to */
+void test_object_gc_keeps_reachable_objects(void) {
+    const char *fractyl_dir = "/tmp/test_gc_objects";
+    const char *index_file = "/tmp/test_gc_index.dat";
+    system("rm -rf /tmp/test_gc_objects");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    loose_cache_invalidate();
+    
+    const char *contents[] = { "kept by the snapshot", "deleted snapshot's file", "another orphan" };
+    unsigned char hashes[3][32];
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data(contents[i], strlen(contents[i]),
+                                                        fractyl_dir, hashes[i]));
+    }
+    
+    /* One snapshot whose index names the first object */
+    index_t index;
+    index_init(&index);
+    index_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.path = "kept.txt";
+    memcpy(entry.hash, hashes[0], 32);
+    entry.mode = S_IFREG | 0644;
+    entry.size = (off_t)strlen(contents[0]);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&index, &entry));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save(&index, index_file));
+    index_free(&index);
+    
+    snapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    strcpy(snapshot.id, "gc-test-snapshot");
+    snapshot.description = "gc test";
+    snapshot.timestamp = time(NULL);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_file(index_file, fractyl_dir, snapshot.index_hash));
+    unlink(index_file);
+    mkdir("/tmp/test_gc_objects/snapshots", 0755);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, json_save_snapshot(&snapshot, "/tmp/test_gc_objects/snapshots/gc-test-snapshot.json"));
+    
+    /* The orphans are too young to go */
+    gc_options_t options;
+    gc_options_init(&options);
+    gc_stats_t stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_gc(fractyl_dir, &options, &stats));
+    TEST_ASSERT_EQUAL(1, stats.snapshots);
+    TEST_ASSERT_EQUAL(2, stats.reachable);
+    TEST_ASSERT_EQUAL(0, stats.loose_removed);
+    TEST_ASSERT_EQUAL(2, stats.loose_kept);
+    
+    /* Once packed, orphans are pruned from the pack; loose ones after the grace period */
+    pack_repack_stats_t repack_stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, pack_repack(fractyl_dir, 0, &repack_stats));
+    unsigned char loose_orphan[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("loose orphan", 12, fractyl_dir, loose_orphan));
+    
+    options.grace_seconds = 0;
+    options.dry_run = 1;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_gc(fractyl_dir, &options, &stats));
+    TEST_ASSERT_EQUAL(1, stats.loose_removed);
+    TEST_ASSERT_EQUAL(2, stats.packed_removed);
+    TEST_ASSERT_TRUE(object_exists(loose_orphan, fractyl_dir));
+    TEST_ASSERT_TRUE(object_exists(hashes[1], fractyl_dir));
+    
+    options.dry_run = 0;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_gc(fractyl_dir, &options, &stats));
+    TEST_ASSERT_EQUAL(1, stats.loose_removed);
+    TEST_ASSERT_EQUAL(2, stats.packed_removed);
+    TEST_ASSERT_FALSE(object_exists(loose_orphan, fractyl_dir));
+    TEST_ASSERT_FALSE(object_exists(hashes[1], fractyl_dir));
+    TEST_ASSERT_FALSE(object_exists(hashes[2], fractyl_dir));
+    
+    void *data;
+    size_t size;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(hashes[0], fractyl_dir, &data, &size));
+    TEST_ASSERT_EQUAL(strlen(contents[0]), size);
+    free(data);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(snapshot.index_hash, fractyl_dir, &data, &size));
+    free(data);
+    
+    /* Incremental steps sweep the fanouts a few at a time */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data("late orphan", 11, fractyl_dir, loose_orphan));
+    gc_state_t *state = gc_state_new();
+    TEST_ASSERT_NOT_NULL(state);
+    options.step_fanouts = 64;
+    size_t removed = 0;
+    for (int step = 0; step < 4; step++) {
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_gc_step(fractyl_dir, state, &options, &stats));
+        TEST_ASSERT_EQUAL(step == 3, stats.pass_complete);
+        removed += stats.loose_removed;
+    }
+    gc_state_free(state);
+    TEST_ASSERT_EQUAL(1, removed);
+    TEST_ASSERT_FALSE(object_exists(loose_orphan, fractyl_dir));
+    TEST_ASSERT_TRUE(object_exists(hashes[0], fractyl_dir));
+    
+    system("rm -rf /tmp/test_gc_objects");
+    loose_cache_invalidate();
+}
+
+/* Test retention thinning, batches and reparenting */
+void test_retention_thins_old_snapshots(void) {
+    const char *fractyl_dir = "/tmp/test_retention";
+    const char *dir = "/tmp/test_retention/snapshots";
+    system("rm -rf /tmp/test_retention");
+    mkdir(fractyl_dir, 0755);
+    mkdir(dir, 0755);
+    
+    /* One chain: two days old, then every 20 minutes up to 10 minutes ago */
+    const time_t now = (time_t)3600 * 480000;
+    const int minutes_ago[10] = { 2880, 170, 150, 130, 110, 90, 70, 50, 30, 10 };
+    char ids[10][8];
+    snapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    for (int i = 0; i < 10; i++) {
+        snprintf(ids[i], sizeof(ids[i]), "r%02d", i);
+        strcpy(snapshot.id, ids[i]);
+        snapshot.parent = i > 0 ? ids[i - 1] : NULL;
+        snapshot.timestamp = now - minutes_ago[i] * 60;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_store_snapshot(dir, &snapshot));
+    }
+    
+    long age;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, retention_parse_age("30d", &age));
+    TEST_ASSERT_EQUAL(30 * 86400, age);
+    TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, retention_parse_age("3x", &age));
+    
+    /* Everything from the last hour, then the newest of each hour for a day */
+    retention_policy_t policy;
+    memset(&policy, 0, sizeof(policy));
+    retention_stats_t stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, retention_prune(fractyl_dir, NULL, &policy, &stats));
+    TEST_ASSERT_EQUAL(0, stats.removed);
+    policy.keep_all = 3600;
+    policy.keep_hourly = 86400;
+    policy.now = now;
+    policy.dry_run = 1;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, retention_prune(fractyl_dir, NULL, &policy, &stats));
+    TEST_ASSERT_EQUAL(10, stats.examined);
+    TEST_ASSERT_EQUAL(5, stats.removed);
+    
+    /* Batches remove the oldest first */
+    policy.dry_run = 0;
+    policy.batch = 2;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, retention_prune(fractyl_dir, NULL, &policy, &stats));
+    TEST_ASSERT_EQUAL(2, stats.removed);
+    TEST_ASSERT_EQUAL(3, stats.remaining);
+    TEST_ASSERT_EQUAL(1, stats.reparented);
+    policy.batch = 0;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, retention_prune(fractyl_dir, NULL, &policy, &stats));
+    TEST_ASSERT_EQUAL(3, stats.removed);
+    TEST_ASSERT_EQUAL(0, stats.remaining);
+    TEST_ASSERT_EQUAL(2, stats.reparented);
+    
+    /* Survivors point at their nearest surviving ancestor */
+    catalog_t catalog;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_load(dir, &catalog));
+    TEST_ASSERT_EQUAL(5, catalog.count);
+    const char *kept[5] = { "r03", "r06", "r07", "r08", "r09" };
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL_STRING(kept[i], catalog.entries[i].id);
+    }
+    TEST_ASSERT_NULL(catalog_parent(&catalog, &catalog.entries[0]));
+    TEST_ASSERT_EQUAL_STRING("r03", catalog.entries[1].parent);
+    TEST_ASSERT_EQUAL_PTR(&catalog.entries[0], catalog_parent(&catalog, &catalog.entries[1]));
+    catalog_free(&catalog);
+    
+    system("rm -rf /tmp/test_retention");
+}
+
+/* Test snapshot records, and reading and converting JSON snapshots */
+void test_snapshot_records_replace_json(void) {
+    const char *dir = "/tmp/test_records/snapshots";
+    system("rm -rf /tmp/test_records && mkdir -p /tmp/test_records/snapshots");
+    
+    char *status[2] = { "M src/a.c", "?? notes.txt" };
+    snapshot_t old;
+    memset(&old, 0, sizeof(old));
+    strcpy(old.id, "old1");
+    old.description = "Before records";
+    old.timestamp = 1700000000;
+    memset(old.index_hash, 0xab, sizeof(old.index_hash));
+    old.git_status = status;
+    old.git_status_count = 2;
+    old.git_branch = "main";
+    old.git_dirty = 1;
+    old.stats.recorded = 1;
+    old.stats.files = 42;
+    old.stats.total_ms = 7;
+    old.stats.paths[0] = "src/a.c";
+    old.stats.path_sizes[0] = 1234;
+    old.stats.path_count = 1;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, json_save_snapshot(&old, "/tmp/test_records/snapshots/old1.json"));
+    
+    /* Every field survives a record */
+    unsigned char *data;
+    size_t size;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, snapshot_record_encode(&old, &data, &size));
+    snapshot_t decoded;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, snapshot_record_decode(data, size, &decoded));
+    TEST_ASSERT_EQUAL_STRING("old1", decoded.id);
+    TEST_ASSERT_NULL(decoded.parent);
+    TEST_ASSERT_EQUAL_STRING("Before records", decoded.description);
+    TEST_ASSERT_EQUAL(old.timestamp, decoded.timestamp);
+    TEST_ASSERT_EQUAL_MEMORY(old.index_hash, decoded.index_hash, 32);
+    TEST_ASSERT_EQUAL(2, decoded.git_status_count);
+    TEST_ASSERT_EQUAL_STRING("?? notes.txt", decoded.git_status[1]);
+    TEST_ASSERT_EQUAL_STRING("main", decoded.git_branch);
+    TEST_ASSERT_NULL(decoded.git_commit);
+    TEST_ASSERT_EQUAL(1, decoded.git_dirty);
+    TEST_ASSERT_EQUAL(1, decoded.stats.recorded);
+    TEST_ASSERT_EQUAL_UINT64(42, decoded.stats.files);
+    TEST_ASSERT_EQUAL_UINT64(7, decoded.stats.total_ms);
+    TEST_ASSERT_EQUAL(1, decoded.stats.path_count);
+    TEST_ASSERT_EQUAL_STRING("src/a.c", decoded.stats.paths[0]);
+    TEST_ASSERT_EQUAL_UINT64(1234, decoded.stats.path_sizes[0]);
+    json_free_snapshot(&decoded);
+    
+    /* Damage anywhere is caught */
+    data[size - 3] ^= 1;
+    TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, snapshot_record_decode(data, size, &decoded));
+    TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, snapshot_record_decode(data, 100, &decoded));
+    free(data);
+    
+    /* A JSON snapshot is listed and loaded as it is */
+    catalog_t catalog;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_load(dir, &catalog));
+    TEST_ASSERT_EQUAL(1, catalog.count);
+    TEST_ASSERT_EQUAL_STRING("Before records", catalog_description(&catalog, &catalog.entries[0]));
+    catalog_free(&catalog);
+    snapshot_t loaded;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_load_snapshot(dir, "old1", &loaded));
+    TEST_ASSERT_EQUAL_STRING("main", loaded.git_branch);
+    json_free_snapshot(&loaded);
+    TEST_ASSERT_EQUAL(FRACTYL_ERROR_NOT_FOUND, catalog_load_snapshot(dir, "none", &loaded));
+    
+    /* Storing the next snapshot converts it */
+    snapshot_t next;
+    memset(&next, 0, sizeof(next));
+    strcpy(next.id, "new1");
+    next.parent = "old1";
+    next.timestamp = 1700000060;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_store_snapshot(dir, &next));
+    struct stat st;
+    TEST_ASSERT_NOT_EQUAL(0, stat("/tmp/test_records/snapshots/old1.json", &st));
+    TEST_ASSERT_EQUAL(0, stat("/tmp/test_records/snapshots/old1.snap", &st));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_load_snapshot(dir, "old1", &loaded));
+    TEST_ASSERT_EQUAL_STRING("Before records", loaded.description);
+    TEST_ASSERT_EQUAL(2, loaded.git_status_count);
+    json_free_snapshot(&loaded);
+    
+    TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_load(dir, &catalog));
+    TEST_ASSERT_EQUAL(2, catalog.count);
+    TEST_ASSERT_EQUAL_PTR(&catalog.entries[0], catalog_parent(&catalog, &catalog.entries[1]));
+    catalog_free(&catalog);
+    
+    TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_remove_snapshot(dir, "old1"));
+    TEST_ASSERT_EQUAL(FRACTYL_ERROR_NOT_FOUND, catalog_remove_snapshot(dir, "old1"));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_rebuild(dir));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, catalog_load(dir, &catalog));
+    TEST_ASSERT_EQUAL(1, catalog.count);
+    TEST_ASSERT_EQUAL_STRING("new1", catalog.entries[0].id);
+    catalog_free(&catalog);
+    
+    system("rm -rf /tmp/test_records");
+}
+
+/* Text of numbered lines, so edits leave most of it in place */
+static char* numbered_lines(int count, int changed_line, size_t *size_out) {
+    char *text = malloc((size_t)count * 64);
+    size_t size = 0;
+    for (int i = 0; i < count; i++) {
+        size += sprintf(text + size, "line %05d value %s\n", i, i == changed_line ? "changed" : "original");
+    }
+    *size_out = size;
+    return text;
+}
+
+/* Test binary deltas */
+void test_delta_create_and_apply_round_trip(void) {
+    size_t base_size, target_size;
+    char *base = numbered_lines(2000, -1, &base_size);
+    char *target = numbered_lines(2000, 1234, &target_size);
+    
+    unsigned char *delta;
+    size_t delta_size;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, delta_create((unsigned char *)base, base_size, (unsigned char *)target,
+                                               target_size, target_size, &delta, &delta_size));
+    TEST_ASSERT_TRUE(delta_size < target_size / 50);
+    
+    unsigned char *rebuilt = malloc(target_size);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, delta_apply((unsigned char *)base, base_size, delta, delta_size,
+                                              rebuilt, target_size));
+    TEST_ASSERT_EQUAL_MEMORY(target, rebuilt, target_size);
+    
+    /* Truncated deltas and the wrong base are refused */
+    TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, delta_apply((unsigned char *)base, base_size, delta, delta_size - 1,
+                                                  rebuilt, target_size));
+    TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, delta_apply((unsigned char *)base, base_size - 1, delta, delta_size,
+                                                  rebuilt, target_size));
+    
+    /* A limit below the delta's size is reported */
+    unsigned char *small;
+    size_t small_size;
+    TEST_ASSERT_EQUAL(FRACTYL_ERROR_NOT_FOUND, delta_create((unsigned char *)base, base_size,
+                                                            (unsigned char *)target, target_size, 8,
+                                                            &small, &small_size));
+    
+    free(rebuilt);
+    free(delta);
+    free(base);
+    free(target);
+}
+
+void test_pack_repack_stores_deltas_by_history(void) {
+    const char *fractyl_dir = "/tmp/test_pack_deltas";
+    const char *restored_file = "/tmp/test_pack_deltas_restore.txt";
+    system("rm -rf /tmp/test_pack_deltas");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    
+    /* Three versions of one file, oldest first */
+    char *versions[3];
+    size_t sizes[3];
+    unsigned char hashes[3][32];
+    for (int i = 0; i < 3; i++) {
+        versions[i] = numbered_lines(500, 100 * i, &sizes[i]);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data(versions[i], sizes[i], fractyl_dir, hashes[i]));
+    }
+    
+    /* Each older version against the next, newest pair first; the
+     * reversed pair would close a cycle and is passed over */
+    pack_delta_pair_t pairs[3];
+    memcpy(pairs[0].target, hashes[1], 32);
+    memcpy(pairs[0].base, hashes[2], 32);
+    memcpy(pairs[1].target, hashes[2], 32);
+    memcpy(pairs[1].base, hashes[1], 32);
+    memcpy(pairs[2].target, hashes[0], 32);
+    memcpy(pairs[2].base, hashes[1], 32);
+    
+    pack_repack_options_t options = { 0, 10, pairs, 3, NULL, 0, 0 };
+    pack_repack_stats_t stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, pack_repack_with_options(fractyl_dir, &options, &stats));
+    TEST_ASSERT_EQUAL(3, stats.objects);
+    TEST_ASSERT_EQUAL(2, stats.deltas);
+    
+    for (int i = 0; i < 3; i++) {
+        void *data;
+        size_t size;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(hashes[i], fractyl_dir, &data, &size));
+        TEST_ASSERT_EQUAL(sizes[i], size);
+        TEST_ASSERT_EQUAL_MEMORY(versions[i], data, size);
+        free(data);
+    }
+    unsigned char restored[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_restore_file(hashes[0], fractyl_dir, restored_file));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file(restored_file, restored));
+    TEST_ASSERT_EQUAL_MEMORY(hashes[0], restored, 32);
+    
+    /* With a depth of one the oldest version no longer fits on the chain */
+    options.all = 1;
+    options.max_depth = 1;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, pack_repack_with_options(fractyl_dir, &options, &stats));
+    TEST_ASSERT_EQUAL(3, stats.objects);
+    TEST_ASSERT_EQUAL(1, stats.deltas);
+    for (int i = 0; i < 3; i++) {
+        void *data;
+        size_t size;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, object_load(hashes[i], fractyl_dir, &data, &size));
+        TEST_ASSERT_EQUAL_MEMORY(versions[i], data, size);
+        free(data);
+        free(versions[i]);
+    }
+    
+    unlink(restored_file);
+    system("rm -rf /tmp/test_pack_deltas");
+}
+
+/* Test rename detection */
+static void rename_entry(index_entry_t *entry, const char *path, const char *data, size_t size,
+                         const char *fractyl_dir) {
+    memset(entry, 0, sizeof(*entry));
+    entry->path = (char *)path;
+    entry->size = (off_t)size;
+    entry->mode = S_IFREG | 0644;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_data(data, size, fractyl_dir, entry->hash));
+}
+
+void test_rename_detect_exact_and_similar(void) {
+    const char *fractyl_dir = "/tmp/test_rename_detect";
+    system("rm -rf /tmp/test_rename_detect");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    
+    size_t a_size, x_size, x2_size;
+    char *a = numbered_lines(400, -1, &a_size);
+    char *x = numbered_lines(300, -1, &x_size);
+    char *x2 = numbered_lines(300, 150, &x2_size);
+    /* Make x other text than a */
+    for (size_t i = 0; i < x_size; i++) if (x[i] == 'l') x[i] = 'L';
+    for (size_t i = 0; i < x2_size; i++) if (x2[i] == 'l') x2[i] = 'L';
+    const char *kept = "kept file content\n";
+    const char *unrelated = "nothing like the others\n";
+    
+    index_entry_t old_entries[4], new_entries[5];
+    rename_entry(&old_entries[0], "old/a.txt", a, a_size, fractyl_dir);
+    rename_entry(&old_entries[1], "old/x.txt", x, x_size, fractyl_dir);
+    rename_entry(&old_entries[2], "keep.txt", kept, strlen(kept), fractyl_dir);
+    rename_entry(&old_entries[3], "old/empty", "", 0, fractyl_dir);
+    rename_entry(&new_entries[0], "new/a.txt", a, a_size, fractyl_dir);
+    rename_entry(&new_entries[1], "new/x2.txt", x2, x2_size, fractyl_dir);
+    rename_entry(&new_entries[2], "dup.txt", kept, strlen(kept), fractyl_dir);
+    rename_entry(&new_entries[3], "unrelated.txt", unrelated, strlen(unrelated), fractyl_dir);
+    rename_entry(&new_entries[4], "new/empty", "", 0, fractyl_dir);
+    
+    rename_source_t sources[4] = {
+        { &old_entries[0], 0 }, { &old_entries[1], 0 }, { &old_entries[2], 1 }, { &old_entries[3], 0 }
+    };
+    const index_entry_t *targets[5] = {
+        &new_entries[0], &new_entries[1], &new_entries[2], &new_entries[3], &new_entries[4]
+    };
+    
+    rename_pair_t *pairs;
+    size_t count;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, rename_detect(sources, 4, targets, 5, fractyl_dir, NULL, RENAME_DEFAULT_LIMIT,
+                                                &pairs, &count));
+    /* Unrelated and empty files stay unpaired */
+    TEST_ASSERT_EQUAL(3, count);
+    TEST_ASSERT_EQUAL(0, pairs[0].target);
+    TEST_ASSERT_EQUAL(0, pairs[0].source);
+    TEST_ASSERT_EQUAL(100, pairs[0].similarity);
+    TEST_ASSERT_EQUAL(0, pairs[0].copy);
+    TEST_ASSERT_EQUAL(1, pairs[1].target);
+    TEST_ASSERT_EQUAL(1, pairs[1].source);
+    TEST_ASSERT_TRUE(pairs[1].similarity >= RENAME_MIN_SIMILARITY && pairs[1].similarity < 100);
+    TEST_ASSERT_EQUAL(0, pairs[1].copy);
+    /* A file still present is copied, not renamed */
+    TEST_ASSERT_EQUAL(2, pairs[2].target);
+    TEST_ASSERT_EQUAL(2, pairs[2].source);
+    TEST_ASSERT_EQUAL(1, pairs[2].copy);
+    free(pairs);
+    
+    /* Without a limit only the same contents are paired */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, rename_detect(sources, 4, targets, 5, fractyl_dir, NULL, 0, &pairs, &count));
+    TEST_ASSERT_EQUAL(2, count);
+    TEST_ASSERT_EQUAL(0, pairs[0].target);
+    TEST_ASSERT_EQUAL(2, pairs[1].target);
+    free(pairs);
+    
+    free(a);
+    free(x);
+    free(x2);
+    system("rm -rf /tmp/test_rename_detect");
+}
+
 /* Test index functionality */
 void test_index_create_and_load(void) {
     const char *index_file = "/tmp/test_index.dat";
@@ -204,12 +1493,14 @@ void test_index_create_and_load(void) {
     result = index_load(&loaded_index, index_file);
     TEST_ASSERT_EQUAL(0, result);
     
-    /* Verify loaded index matches original */
+    /* Verify loaded index matches original (saved in path order) */
     TEST_ASSERT_EQUAL(index.count, loaded_index.count);
-    TEST_ASSERT_EQUAL_STRING(index.entries[0].path, loaded_index.entries[0].path);
-    TEST_ASSERT_EQUAL_MEMORY(index.entries[0].hash, loaded_index.entries[0].hash, 32);
-    TEST_ASSERT_EQUAL(index.entries[0].mode, loaded_index.entries[0].mode);
-    TEST_ASSERT_EQUAL(index.entries[0].size, loaded_index.entries[0].size);
+    TEST_ASSERT_EQUAL_STRING("dir/file2.txt", loaded_index.entries[0].path);
+    const index_entry_t *loaded_entry = index_find_entry(&loaded_index, index.entries[0].path);
+    TEST_ASSERT_NOT_NULL(loaded_entry);
+    TEST_ASSERT_EQUAL_MEMORY(index.entries[0].hash, loaded_entry->hash, 32);
+    TEST_ASSERT_EQUAL(index.entries[0].mode, loaded_entry->mode);
+    TEST_ASSERT_EQUAL(index.entries[0].size, loaded_entry->size);
     
     /* Clean up */
     free(entry1.path);
@@ -248,6 +1539,719 @@ void test_index_find_entry(void) {
     index_free(&index);
 }
 
+void test_index_merge_shards_sorts_by_path(void) {
+    /* Enough entries to take the multi-threaded sort path */
+    const int shard_count = 4;
+    const int per_shard = 6000;
+    index_t shards[4];
+    index_t merged;
+    index_init(&merged);
+    
+    for (int s = 0; s < shard_count; s++) {
+        index_init(&shards[s]);
+        for (int i = 0; i < per_shard; i++) {
+            char path[64];
+            /* Interleave paths across shards so every shard is unsorted */
+            snprintf(path, sizeof(path), "dir%03d/file%05d.txt", (i * 7919) % 500, i * shard_count + s);
+    
+            index_entry_t entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.path = path;
+            entry.size = i;
+            TEST_ASSERT_EQUAL(0, index_add_entry_direct(&shards[s], &entry));
+        }
+    }
+    
+    TEST_ASSERT_EQUAL(0, index_merge_shards(&merged, shards, shard_count, 4));
+    TEST_ASSERT_EQUAL(shard_count * per_shard, merged.count);
+    for (int s = 0; s < shard_count; s++) {
+        TEST_ASSERT_EQUAL(0, shards[s].count);
+        TEST_ASSERT_NULL(shards[s].entries);
+    }
+    for (size_t i = 1; i < merged.count; i++) {
+        TEST_ASSERT_TRUE(strcmp(merged.entries[i - 1].path, merged.entries[i].path) < 0);
+    }
+    
+    index_free(&merged);
+}
+
+void test_index_lookup_table_tracks_add_and_remove(void) {
+    index_t index;
+    index_init(&index);
+    
+    /* Large enough for the lookup table to kick in */
+    for (int i = 0; i < 1000; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "file%04d", i);
+        index_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.path = path;
+        entry.size = i;
+        TEST_ASSERT_EQUAL(0, index_add_entry(&index, &entry));
+    }
+    TEST_ASSERT_EQUAL(1000, index.count);
+    TEST_ASSERT_NOT_NULL(index.lookup);
+    
+    /* Updating an existing path must not add a duplicate */
+    index_entry_t update;
+    memset(&update, 0, sizeof(update));
+    update.path = "file0500";
+    update.size = 12345;
+    TEST_ASSERT_EQUAL(0, index_add_entry(&index, &update));
+    TEST_ASSERT_EQUAL(1000, index.count);
+    TEST_ASSERT_EQUAL(12345, index_find_entry(&index, "file0500")->size);
+    
+    /* Remove every third entry; the last entry moves into each hole */
+    for (int i = 0; i < 1000; i += 3) {
+        char path[32];
+        snprintf(path, sizeof(path), "file%04d", i);
+        TEST_ASSERT_EQUAL(0, index_remove_entry(&index, path));
+    }
+    for (int i = 0; i < 1000; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "file%04d", i);
+        const index_entry_t *found = index_find_entry(&index, path);
+        if (i % 3 == 0) {
+            TEST_ASSERT_NULL(found);
+        } else {
+            TEST_ASSERT_NOT_NULL(found);
+            TEST_ASSERT_EQUAL_STRING(path, found->path);
+        }
+    }
+    
+    /* Direct appends are picked up by the next lookup */
+    index_entry_t extra;
+    memset(&extra, 0, sizeof(extra));
+    extra.path = "extra.txt";
+    TEST_ASSERT_EQUAL(0, index_add_entry_direct(&index, &extra));
+    TEST_ASSERT_NOT_NULL(index_find_entry(&index, "extra.txt"));
+    TEST_ASSERT_EQUAL(FRACTYL_ERROR_INDEX_NOT_FOUND, index_remove_entry(&index, "missing"));
+    
+    index_free(&index);
+    TEST_ASSERT_NULL(index.lookup);
+}
+
+void test_index_sort_small(void) {
+    index_t index;
+    index_init(&index);
+    
+    const char *paths[] = {"b.txt", "a/z.txt", "a.txt", "c"};
+    for (int i = 0; i < 4; i++) {
+        index_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.path = (char *)paths[i];
+        index_add_entry_direct(&index, &entry);
+    }
+    
+    TEST_ASSERT_EQUAL(0, index_sort(&index, 8));
+    TEST_ASSERT_EQUAL_STRING("a.txt", index.entries[0].path);
+    TEST_ASSERT_EQUAL_STRING("a/z.txt", index.entries[1].path);
+    TEST_ASSERT_EQUAL_STRING("b.txt", index.entries[2].path);
+    TEST_ASSERT_EQUAL_STRING("c", index.entries[3].path);
+    
+    index_free(&index);
+}
+
+/* Test stat-data change detection */
+void test_index_entry_stat_matches_full_stat_data(void) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFREG | 0644;
+    st.st_size = 42;
+    st.st_mtim.tv_sec = 1000;
+    st.st_mtim.tv_nsec = 5;
+    st.st_ctim.tv_sec = 1000;
+    st.st_ctim.tv_nsec = 7;
+    st.st_ino = 99;
+    st.st_dev = 3;
+    
+    index_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    index_entry_set_stat(&entry, &st, 2000);
+    TEST_ASSERT_EQUAL(0, entry.flags & INDEX_ENTRY_RACY);
+    TEST_ASSERT_TRUE(index_entry_stat_matches(&entry, &st));
+    
+    /* Same size and mtime seconds, but a sub-second rewrite or a new inode */
+    struct stat changed = st;
+    changed.st_mtim.tv_nsec = 6;
+    TEST_ASSERT_FALSE(index_entry_stat_matches(&entry, &changed));
+    changed = st;
+    changed.st_ino = 100;
+    TEST_ASSERT_FALSE(index_entry_stat_matches(&entry, &changed));
+    changed = st;
+    changed.st_ctim.tv_sec = 1001;
+    TEST_ASSERT_FALSE(index_entry_stat_matches(&entry, &changed));
+    
+    /* Modified in the second the scan started: never trusted next time */
+    index_entry_set_stat(&entry, &st, 1000);
+    TEST_ASSERT_TRUE(entry.flags & INDEX_ENTRY_RACY);
+    TEST_ASSERT_FALSE(index_entry_stat_matches(&entry, &st));
+    
+    /* Until it is relied on only from a later second */
+    index_entry_update_racy(&entry, 1001);
+    TEST_ASSERT_EQUAL(0, entry.flags & INDEX_ENTRY_RACY);
+    TEST_ASSERT_TRUE(index_entry_stat_matches(&entry, &st));
+    
+    /* Entries from version 1 indexes only compare size and mtime seconds */
+    index_entry_t legacy;
+    memset(&legacy, 0, sizeof(legacy));
+    legacy.size = 42;
+    legacy.mtime = 1000;
+    TEST_ASSERT_TRUE(index_entry_stat_matches(&legacy, &st));
+    TEST_ASSERT_FALSE(index_entry_stat_matches(NULL, &st));
+}
+
+void test_index_save_load_keeps_stat_data(void) {
+    const char *index_file = "/tmp/test_index_stat.dat";
+    index_t index;
+    index_init(&index);
+    
+    index_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.path = "file.txt";
+    entry.mtime = 1000;
+    entry.mtime_nsec = 123456789;
+    entry.ctime = 1001;
+    entry.ctime_nsec = 987654321;
+    entry.ino = 0x123456789ULL;
+    entry.dev = 77;
+    entry.uid = 1000;
+    entry.gid = 100;
+    entry.flags = INDEX_ENTRY_RACY;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&index, &entry));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save(&index, index_file));
+    
+    index_t loaded;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_load(&loaded, index_file));
+    TEST_ASSERT_EQUAL(1, loaded.count);
+    const index_entry_t *e = &loaded.entries[0];
+    TEST_ASSERT_EQUAL(123456789, e->mtime_nsec);
+    TEST_ASSERT_EQUAL(1001, e->ctime);
+    TEST_ASSERT_EQUAL(987654321, e->ctime_nsec);
+    TEST_ASSERT_TRUE(e->ino == 0x123456789ULL);
+    TEST_ASSERT_TRUE(e->dev == 77);
+    TEST_ASSERT_EQUAL(1000, e->uid);
+    TEST_ASSERT_EQUAL(100, e->gid);
+    TEST_ASSERT_EQUAL(INDEX_ENTRY_RACY, e->flags);
+    
+    index_free(&index);
+    index_free(&loaded);
+    unlink(index_file);
+}
+
+/* Test that small changes are appended to the journal, not the base */
+void test_index_journal_appends_changes(void) {
+    const char *index_file = "/tmp/test_index_journal.dat";
+    const char *journal_file = "/tmp/test_index_journal.dat" INDEX_JOURNAL_SUFFIX;
+    unlink(journal_file);
+    index_t index;
+    index_init(&index);
+    char path[64];
+    index_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.path = path;
+    entry.mode = 0100644;
+    for (int i = 0; i < 200; i++) {
+        snprintf(path, sizeof(path), "dir/file%03d.txt", i);
+        entry.size = i;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&index, &entry));
+    }
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save(&index, index_file));
+    struct stat base_before, base_after, journal_st;
+    TEST_ASSERT_EQUAL(0, stat(index_file, &base_before));
+    
+    /* One modified, one deleted, one added */
+    entry.path = "dir/file010.txt";
+    entry.size = 4242;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&index, &entry));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_remove_entry(&index, "dir/file020.txt"));
+    entry.path = "dir/new.txt";
+    entry.size = 7;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&index, &entry));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save_journaled(&index, index_file));
+    TEST_ASSERT_EQUAL(0, stat(index_file, &base_after));
+    TEST_ASSERT_TRUE(base_before.st_ino == base_after.st_ino);
+    TEST_ASSERT_EQUAL(0, stat(journal_file, &journal_st));
+    
+    /* A torn batch at the end is ignored */
+    FILE *fp = fopen(journal_file, "ab");
+    TEST_ASSERT_NOT_NULL(fp);
+    fwrite("\x40\0\0\0\1\0\0\0U", 1, 9, fp);
+    fclose(fp);
+    
+    index_t loaded;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_load(&loaded, index_file));
+    TEST_ASSERT_EQUAL(200, loaded.count);
+    TEST_ASSERT_TRUE(index_is_sorted(&loaded));
+    TEST_ASSERT_EQUAL(4242, index_find_entry(&loaded, "dir/file010.txt")->size);
+    TEST_ASSERT_NULL(index_find_entry(&loaded, "dir/file020.txt"));
+    TEST_ASSERT_EQUAL(7, index_find_entry(&loaded, "dir/new.txt")->size);
+    index_free(&loaded);
+    
+    /* Saving the same entries again appends nothing */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save_journaled(&index, index_file));
+    
+    /* Changing most entries rewrites the base and drops the journal */
+    for (size_t i = 0; i < index.count; i++) {
+        index.entries[i].size += 1000;
+    }
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save_journaled(&index, index_file));
+    TEST_ASSERT_NOT_EQUAL(0, stat(journal_file, &journal_st));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_load(&loaded, index_file));
+    TEST_ASSERT_EQUAL(200, loaded.count);
+    TEST_ASSERT_EQUAL(5242, index_find_entry(&loaded, "dir/file010.txt")->size);
+    index_free(&loaded);
+    
+    index_free(&index);
+    unlink(index_file);
+}
+
+/* Test the mappable layout: sorted entries read in place */
+void test_index_view_reads_sorted_entries_in_place(void) {
+    const char *index_file = "/tmp/test_index_view.dat";
+    const char *paths[] = { "src/z.c", "README", "src/a.c", "docs/guide.md" };
+    index_t index;
+    index_init(&index);
+    for (int i = 0; i < 4; i++) {
+        index_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.path = (char *)paths[i];
+        entry.hash[0] = (unsigned char)(i + 1);
+        entry.mode = 0100644;
+        entry.size = 1000 + i;
+        entry.mtime = -5 + i;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&index, &entry));
+    }
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save(&index, index_file));
+    index_free(&index);
+    
+    /* Fixed little-endian header */
+    FILE *fp = fopen(index_file, "rb");
+    TEST_ASSERT_NOT_NULL(fp);
+    unsigned char header[8];
+    TEST_ASSERT_EQUAL(8, fread(header, 1, 8, fp));
+    fclose(fp);
+    TEST_ASSERT_EQUAL(0, memcmp(header, "FIDX\x05\0\0\0", 8));
+    
+    index_view_t view;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_view_open(&view, index_file));
+    TEST_ASSERT_EQUAL(4, view.count);
+    index_entry_t entry;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_view_get(&view, 0, &entry));
+    TEST_ASSERT_EQUAL_STRING("README", entry.path);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_view_get(&view, 3, &entry));
+    TEST_ASSERT_EQUAL_STRING("src/z.c", entry.path);
+    
+    long pos = index_view_find(&view, "src/a.c");
+    TEST_ASSERT_EQUAL(2, pos);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_view_get(&view, (size_t)pos, &entry));
+    TEST_ASSERT_EQUAL(3, entry.hash[0]);
+    TEST_ASSERT_EQUAL(0100644, entry.mode);
+    TEST_ASSERT_EQUAL(1002, entry.size);
+    TEST_ASSERT_EQUAL(-3, entry.mtime);
+    TEST_ASSERT_EQUAL(3, index_view_hash(&view, (size_t)pos)[0]);
+    TEST_ASSERT_EQUAL(-1, index_view_find(&view, "src/b.c"));
+    index_view_close(&view);
+    
+    /* A loaded index still accepts changes */
+    index_t loaded;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_load(&loaded, index_file));
+    TEST_ASSERT_EQUAL(4, loaded.count);
+    TEST_ASSERT_NOT_NULL(index_find_entry(&loaded, "docs/guide.md"));
+    memset(&entry, 0, sizeof(entry));
+    entry.path = "added.txt";
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&loaded, &entry));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_remove_entry(&loaded, "README"));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save(&loaded, index_file));
+    index_free(&loaded);
+    
+    /* Truncated files are rejected */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_load(&loaded, index_file));
+    TEST_ASSERT_EQUAL(4, loaded.count);
+    TEST_ASSERT_EQUAL_STRING("added.txt", loaded.entries[0].path);
+    index_free(&loaded);
+    TEST_ASSERT_EQUAL(0, truncate(index_file, 40));
+    TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, index_load(&loaded, index_file));
+    unlink(index_file);
+}
+
+/* Test prefix-compressed paths across several restart intervals */
+void test_index_prefix_compressed_paths(void) {
+    const char *index_file = "/tmp/test_index_prefix.dat";
+    char path[128];
+    index_t index;
+    index_init(&index);
+    size_t path_bytes = 0;
+    for (int i = 0; i < 100; i++) {
+        index_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        snprintf(path, sizeof(path), "src/module/%s/file%03d.c", i < 50 ? "core" : "utils", i);
+        entry.path = path;
+        entry.hash[0] = (unsigned char)i;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&index, &entry));
+        path_bytes += strlen(path) + 1;
+    }
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_save(&index, index_file));
+    index_free(&index);
+    
+    /* Shared prefixes are left out of the pool */
+    struct stat st;
+    TEST_ASSERT_EQUAL(0, stat(index_file, &st));
+    TEST_ASSERT_TRUE((size_t)st.st_size < 32 + 100 * 104 + path_bytes / 2);
+    
+    index_t loaded;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_load(&loaded, index_file));
+    TEST_ASSERT_EQUAL(100, loaded.count);
+    TEST_ASSERT_EQUAL_STRING("src/module/core/file000.c", loaded.entries[0].path);
+    TEST_ASSERT_EQUAL_STRING("src/module/utils/file099.c", loaded.entries[99].path);
+    TEST_ASSERT_EQUAL(57, index_find_entry(&loaded, "src/module/utils/file057.c")->hash[0]);
+    index_free(&loaded);
+    
+    /* Random access and lookups rebuild paths from the restart points */
+    index_view_t view;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_view_open(&view, index_file));
+    index_entry_t entry;
+    int order[] = { 99, 17, 16, 15, 0, 63, 64, 50, 51 };
+    for (size_t k = 0; k < sizeof(order) / sizeof(order[0]); k++) {
+        int i = order[k];
+        TEST_ASSERT_EQUAL(FRACTYL_OK, index_view_get(&view, (size_t)i, &entry));
+        snprintf(path, sizeof(path), "src/module/%s/file%03d.c", i < 50 ? "core" : "utils", i);
+        TEST_ASSERT_EQUAL_STRING(path, entry.path);
+        TEST_ASSERT_EQUAL(i, entry.hash[0]);
+    }
+    for (int i = 0; i < 100; i++) {
+        snprintf(path, sizeof(path), "src/module/%s/file%03d.c", i < 50 ? "core" : "utils", i);
+        TEST_ASSERT_EQUAL(i, index_view_find(&view, path));
+    }
+    TEST_ASSERT_EQUAL(-1, index_view_find(&view, "src/module/core/file050.c"));
+    TEST_ASSERT_EQUAL(-1, index_view_find(&view, "a"));
+    TEST_ASSERT_EQUAL(-1, index_view_find(&view, "z"));
+    index_view_close(&view);
+    unlink(index_file);
+}
+
+/* Test storing and loading an index object without a temporary file */
+void test_object_store_index_round_trip(void) {
+    const char *fractyl_dir = "/tmp/test_index_object";
+    system("rm -rf /tmp/test_index_object");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    
+    index_t index;
+    index_init(&index);
+    index_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.path = "b.txt";
+    entry.size = 7;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&index, &entry));
+    entry.path = "a.txt";
+    entry.size = 3;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(&index, &entry));
+    
+    /* The object holds exactly what index_serialize() produces */
+    unsigned char hash[32], expected[32];
+    void *data;
+    size_t size;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_serialize(&index, &data, &size));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_data(data, size, expected));
+    free(data);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_index(&index, fractyl_dir, hash));
+    TEST_ASSERT_EQUAL_MEMORY(expected, hash, 32);
+    index_free(&index);
+    
+    index_t loaded;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load_index(hash, fractyl_dir, &loaded));
+    TEST_ASSERT_EQUAL(2, loaded.count);
+    TEST_ASSERT_EQUAL_STRING("a.txt", loaded.entries[0].path);
+    TEST_ASSERT_EQUAL(7, index_find_entry(&loaded, "b.txt")->size);
+    index_free(&loaded);
+    
+    system("rm -rf /tmp/test_index_object");
+    loose_cache_invalidate();
+}
+
+static void add_diff_entry(index_t *index, const char *path, unsigned char fill, mode_t mode) {
+    index_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.path = (char *)path;
+    memset(entry.hash, fill, 32);
+    entry.mode = mode;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_add_entry(index, &entry));
+}
+
+static int record_change(index_change_t change, const index_entry_t *old_entry,
+                         const index_entry_t *new_entry, void *ctx) {
+    char *log = ctx;
+    const char *path = new_entry ? new_entry->path : old_entry->path;
+    sprintf(log + strlen(log), "%c%s ", "AMD"[change], path);
+    return 0;
+}
+
+/* Test the merge-join of two sorted indexes */
+void test_index_diff_merges_sorted_indexes(void) {
+    index_t old_index, new_index;
+    index_init(&old_index);
+    index_init(&new_index);
+    add_diff_entry(&old_index, "a", 1, 0100644);
+    add_diff_entry(&old_index, "b", 2, 0100644);
+    add_diff_entry(&old_index, "c", 3, 0100644);
+    add_diff_entry(&old_index, "e", 5, 0100644);
+    add_diff_entry(&new_index, "b", 2, 0100644);
+    add_diff_entry(&new_index, "c", 9, 0100644);
+    add_diff_entry(&new_index, "d", 4, 0100644);
+    add_diff_entry(&new_index, "e", 5, 0100755);
+    
+    char log[128] = "";
+    index_diff_stats_t stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_diff(&old_index, &new_index, record_change, log, &stats));
+    TEST_ASSERT_EQUAL_STRING("Da Mc Ad Me ", log);
+    TEST_ASSERT_EQUAL(1, stats.added);
+    TEST_ASSERT_EQUAL(2, stats.modified);
+    TEST_ASSERT_EQUAL(1, stats.deleted);
+    
+    /* Identical indexes have no changes; unsorted ones are compared
+       through lookups, deleted files last */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_diff(&new_index, &new_index, NULL, NULL, &stats));
+    TEST_ASSERT_EQUAL(0, stats.added + stats.modified + stats.deleted);
+    add_diff_entry(&new_index, "0-unsorted", 7, 0100644);
+    TEST_ASSERT_FALSE(index_is_sorted(&new_index));
+    log[0] = '\0';
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_diff(&old_index, &new_index, record_change, log, &stats));
+    TEST_ASSERT_EQUAL_STRING("Mc Ad Me A0-unsorted Da ", log);
+    TEST_ASSERT_EQUAL(2, stats.added);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_sort(&new_index, 1));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_diff(&old_index, &new_index, NULL, NULL, &stats));
+    TEST_ASSERT_EQUAL(2, stats.added);
+    
+    index_free(&old_index);
+    index_free(&new_index);
+}
+
+/* Test the typed change list: mode changes apart, renames paired */
+void test_change_list_types_and_pairs_changes(void) {
+    index_t old_index, new_index;
+    index_init(&old_index);
+    index_init(&new_index);
+    add_diff_entry(&old_index, "a", 1, 0100644);
+    add_diff_entry(&old_index, "b", 2, 0100644);
+    add_diff_entry(&old_index, "c", 3, 0100644);
+    add_diff_entry(&old_index, "d", 4, 0100644);
+    add_diff_entry(&new_index, "b", 2, 0100755);
+    add_diff_entry(&new_index, "c", 9, 0100644);
+    add_diff_entry(&new_index, "d", 4, 0100644);
+    add_diff_entry(&new_index, "e", 1, 0100644);
+    /* Empty files are never paired */
+    for (size_t i = 0; i < old_index.count; i++) old_index.entries[i].size = 10;
+    for (size_t i = 0; i < new_index.count; i++) new_index.entries[i].size = 10;
+    
+    change_list_t list;
+    change_list_init(&list);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, change_list_from_indexes(&list, &old_index, &new_index));
+    TEST_ASSERT_EQUAL(4, list.count);
+    TEST_ASSERT_EQUAL(CHANGE_DELETED, list.items[0].kind);
+    TEST_ASSERT_EQUAL(CHANGE_MODE, list.items[1].kind);
+    TEST_ASSERT_EQUAL(CHANGE_MODIFIED, list.items[2].kind);
+    TEST_ASSERT_EQUAL(CHANGE_ADDED, list.items[3].kind);
+    
+    /* The same content is paired by hash alone, without reading it */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, change_list_pair_renames(&list, "/tmp/test_change_list_none", NULL));
+    TEST_ASSERT_EQUAL(3, list.count);
+    TEST_ASSERT_EQUAL(1, list.renamed);
+    TEST_ASSERT_EQUAL(CHANGE_RENAMED, list.items[2].kind);
+    TEST_ASSERT_EQUAL_STRING("a", list.items[2].old_entry.path);
+    TEST_ASSERT_EQUAL_STRING("e", list.items[2].new_entry.path);
+    TEST_ASSERT_EQUAL(100, list.items[2].similarity);
+    TEST_ASSERT_EQUAL_STRING("R", change_kind_tag(list.items[2].kind));
+    
+    change_list_free(&list);
+    index_free(&old_index);
+    index_free(&new_index);
+}
+
+/* Test taking stat data from a cache for the same content */
+void test_index_adopt_stat_matches_content(void) {
+    index_t index, cache;
+    index_init(&index);
+    index_init(&cache);
+    add_diff_entry(&index, "a", 1, 0100644);
+    add_diff_entry(&index, "b", 2, 0100644);
+    add_diff_entry(&index, "c", 3, 0100644);
+    add_diff_entry(&index, "d", 4, 0100644);
+    add_diff_entry(&cache, "a", 1, 0100644);
+    add_diff_entry(&cache, "b", 9, 0100644);
+    add_diff_entry(&cache, "c", 3, 0100755);
+    add_diff_entry(&cache, "d", 4, 0100644);
+    for (size_t i = 0; i < cache.count; i++) {
+        cache.entries[i].mtime = 500;
+        cache.entries[i].ino = 77;
+    }
+    cache.entries[3].flags = INDEX_ENTRY_RACY;
+    
+    /* Only a and d have the same hash and mode; d stays untrusted */
+    TEST_ASSERT_EQUAL(2, index_adopt_stat(&index, &cache));
+    TEST_ASSERT_EQUAL(500, index.entries[0].mtime);
+    TEST_ASSERT_EQUAL_UINT64(77, index.entries[0].ino);
+    TEST_ASSERT_EQUAL(0, index.entries[0].flags & INDEX_ENTRY_RACY);
+    TEST_ASSERT_EQUAL(0, index.entries[1].mtime);
+    TEST_ASSERT_EQUAL(0, index.entries[2].mtime);
+    TEST_ASSERT_EQUAL(500, index.entries[3].mtime);
+    TEST_ASSERT_TRUE(index.entries[3].flags & INDEX_ENTRY_RACY);
+    
+    index_free(&index);
+    index_free(&cache);
+}
+
+typedef struct {
+    unsigned char seen[16][32];
+    size_t trees;
+    size_t new_trees;
+    size_t files;
+} tree_count_t;
+
+static int count_tree_objects(const unsigned char *hash, int is_tree, void *ctx) {
+    tree_count_t *count = ctx;
+    if (!is_tree) {
+        count->files++;
+        return 0;
+    }
+    for (size_t i = 0; i < count->trees; i++) {
+        if (memcmp(count->seen[i], hash, 32) == 0) return TREE_WALK_SKIP;
+    }
+    TEST_ASSERT_TRUE(count->trees < 16);
+    memcpy(count->seen[count->trees++], hash, 32);
+    count->new_trees++;
+    return 0;
+}
+
+static int record_file(const index_entry_t *entry, void *ctx) {
+    char *log = ctx;
+    strcat(log, entry->path);
+    strcat(log, " ");
+    return strncmp(entry->path, "lib/", 4) == 0 ? TREE_FILES_STOP : 0;
+}
+
+/* Test tree objects: round trip, shared subtrees and comparison */
+void test_tree_objects_share_unchanged_subtrees(void) {
+    const char *fractyl_dir = "/tmp/test_tree_objects";
+    system("rm -rf /tmp/test_tree_objects");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_storage_init(fractyl_dir));
+    
+    index_t old_index, new_index;
+    index_init(&old_index);
+    index_init(&new_index);
+    add_diff_entry(&old_index, "top", 1, 0100644);
+    add_diff_entry(&old_index, "lib/deep/z", 2, 0100644);
+    add_diff_entry(&old_index, "a/x", 3, 0100644);
+    add_diff_entry(&old_index, "a-b", 4, 0100644);
+    add_diff_entry(&old_index, "a/y", 5, 0100755);
+    add_diff_entry(&new_index, "top", 1, 0100644);
+    add_diff_entry(&new_index, "lib/deep/z", 2, 0100644);
+    add_diff_entry(&new_index, "a/x", 9, 0100644);
+    add_diff_entry(&new_index, "a/y", 5, 0100755);
+    add_diff_entry(&new_index, "a/new/n", 6, 0100644);
+    
+    unsigned char old_root[32], new_root[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_store_index(&old_index, fractyl_dir, old_root));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_store_index(&new_index, fractyl_dir, new_root));
+    
+    /* A snapshot's tree loads back as a flat index in path order */
+    index_t loaded;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_load_index(old_root, fractyl_dir, &loaded));
+    TEST_ASSERT_EQUAL(5, loaded.count);
+    TEST_ASSERT_TRUE(index_is_sorted(&loaded));
+    TEST_ASSERT_EQUAL_STRING("a-b", loaded.entries[0].path);
+    TEST_ASSERT_EQUAL_STRING("a/y", loaded.entries[2].path);
+    TEST_ASSERT_EQUAL_STRING("lib/deep/z", loaded.entries[3].path);
+    TEST_ASSERT_EQUAL(0100755, index_find_entry(&loaded, "a/y")->mode);
+    index_free(&loaded);
+    
+    /* Root, a, lib and lib/deep; the new snapshot only adds root, a and a/new */
+    tree_count_t count;
+    memset(&count, 0, sizeof(count));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_walk(old_root, fractyl_dir, count_tree_objects, &count));
+    TEST_ASSERT_EQUAL(4, count.new_trees);
+    TEST_ASSERT_EQUAL(5, count.files);
+    count.new_trees = 0;
+    count.files = 0;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_walk(new_root, fractyl_dir, count_tree_objects, &count));
+    TEST_ASSERT_EQUAL(3, count.new_trees);
+    
+    /* Changes come out in path order, as index_diff() reports them */
+    char log[128] = "", expected[128] = "";
+    index_diff_stats_t stats, expected_stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_diff(old_root, new_root, fractyl_dir, record_change, log, &stats));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_sort(&old_index, 1));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_sort(&new_index, 1));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_diff(&old_index, &new_index, record_change, expected,
+                                             &expected_stats));
+    TEST_ASSERT_EQUAL_STRING("Da-b Aa/new/n Ma/x ", log);
+    TEST_ASSERT_EQUAL_STRING(expected, log);
+    TEST_ASSERT_EQUAL(1, stats.added);
+    TEST_ASSERT_EQUAL(1, stats.modified);
+    TEST_ASSERT_EQUAL(1, stats.deleted);
+    
+    /* Flat index objects of older snapshots still compare against trees */
+    unsigned char flat_root[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_index(&old_index, fractyl_dir, flat_root));
+    log[0] = '\0';
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_diff(flat_root, new_root, fractyl_dir, record_change, log, NULL));
+    TEST_ASSERT_EQUAL_STRING(expected, log);
+    
+    /* Files under a prefix stream out in path order, from trees or flat objects */
+    log[0] = '\0';
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_for_each_file(new_root, fractyl_dir, "a/", record_file, log));
+    TEST_ASSERT_EQUAL_STRING("a/new/n a/x a/y ", log);
+    log[0] = '\0';
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_for_each_file(flat_root, fractyl_dir, "a", record_file, log));
+    TEST_ASSERT_EQUAL_STRING("a-b a/x a/y ", log);
+    log[0] = '\0';
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_for_each_file(new_root, fractyl_dir, "", record_file, log));
+    TEST_ASSERT_EQUAL_STRING("a/new/n a/x a/y lib/deep/z ", log);
+    log[0] = '\0';
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_for_each_file(flat_root, fractyl_dir, "m", record_file, log));
+    TEST_ASSERT_EQUAL_STRING("", log);
+    
+    index_free(&old_index);
+    index_free(&new_index);
+    system("rm -rf /tmp/test_tree_objects");
+    loose_cache_invalidate();
+}
+
+void test_index_load_version1(void) {
+    const char *index_file = "/tmp/test_index_v1.dat";
+    FILE *fp = fopen(index_file, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    
+    /* Header and one entry in the original layout */
+    uint32_t version = 1, count = 1;
+    uint16_t path_len = 5;
+    unsigned char hash[32];
+    memset(hash, 0xCC, sizeof(hash));
+    mode_t mode = 0644;
+    off_t size = 10;
+    time_t mtime = 1234;
+    fwrite("FIDX", 1, 4, fp);
+    fwrite(&version, sizeof(version), 1, fp);
+    fwrite(&count, sizeof(count), 1, fp);
+    fwrite(&path_len, sizeof(path_len), 1, fp);
+    fwrite("a.txt", 1, 5, fp);
+    fwrite(hash, 1, 32, fp);
+    fwrite(&mode, sizeof(mode), 1, fp);
+    fwrite(&size, sizeof(size), 1, fp);
+    fwrite(&mtime, sizeof(mtime), 1, fp);
+    fclose(fp);
+    
+    index_t loaded;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_load(&loaded, index_file));
+    TEST_ASSERT_EQUAL(1, loaded.count);
+    TEST_ASSERT_EQUAL_STRING("a.txt", loaded.entries[0].path);
+    TEST_ASSERT_EQUAL(1234, loaded.entries[0].mtime);
+    TEST_ASSERT_TRUE(loaded.entries[0].ino == 0);
+    TEST_ASSERT_EQUAL(0, loaded.entries[0].flags);
+    
+    index_free(&loaded);
+    unlink(index_file);
+}
+
 /* Unity test runner */
 int main(void) {
     UNITY_BEGIN();
@@ -258,14 +2262,49 @@ int main(void) {
     RUN_TEST(test_hash_file_with_temp_file);
     RUN_TEST(test_hash_file_nonexistent);
     RUN_TEST(test_hash_to_string_conversion);
+    RUN_TEST(test_hash_blake3_known_answers);
+    RUN_TEST(test_hash_blake3_large_files_match_streaming);
     
     /* Object storage tests */
     RUN_TEST(test_object_path_creation);
     RUN_TEST(test_object_store_and_restore_file);
+    RUN_TEST(test_object_store_file_streams_large_files);
+    RUN_TEST(test_object_copy_modes_store_and_restore);
+    RUN_TEST(test_object_compression_round_trip);
+    RUN_TEST(test_chunker_cut_resynchronizes_after_insert);
+    RUN_TEST(test_object_store_file_chunks_large_files);
+    RUN_TEST(test_object_store_file_large_file_threads);
+    RUN_TEST(test_object_reader_streams_stored_forms);
+    RUN_TEST(test_object_exists_uses_loose_cache);
+    RUN_TEST(test_object_stats_count_written_and_deduplicated);
+    RUN_TEST(test_object_durability_batches_until_sync);
+    RUN_TEST(test_object_durability_full_and_none_store_at_once);
+    RUN_TEST(test_pack_repack_serves_objects_from_packs);
+    RUN_TEST(test_object_gc_keeps_reachable_objects);
+    RUN_TEST(test_retention_thins_old_snapshots);
+    RUN_TEST(test_snapshot_records_replace_json);
+    RUN_TEST(test_delta_create_and_apply_round_trip);
+    RUN_TEST(test_pack_repack_stores_deltas_by_history);
+    RUN_TEST(test_rename_detect_exact_and_similar);
     
     /* Index tests */
     RUN_TEST(test_index_create_and_load);
     RUN_TEST(test_index_find_entry);
+    RUN_TEST(test_index_merge_shards_sorts_by_path);
+    RUN_TEST(test_index_sort_small);
+    RUN_TEST(test_index_lookup_table_tracks_add_and_remove);
+    RUN_TEST(test_index_entry_stat_matches_full_stat_data);
+    RUN_TEST(test_index_save_load_keeps_stat_data);
+    RUN_TEST(test_index_journal_appends_changes);
+    RUN_TEST(test_index_view_reads_sorted_entries_in_place);
+    RUN_TEST(test_index_prefix_compressed_paths);
+    RUN_TEST(test_object_store_index_round_trip);
+    RUN_TEST(test_index_diff_merges_sorted_indexes);
+    RUN_TEST(test_change_list_types_and_pairs_changes);
+    RUN_TEST(test_index_adopt_stat_matches_content);
+    RUN_TEST(test_tree_objects_share_unchanged_subtrees);
+    RUN_TEST(test_index_load_version1);
+    RUN_TEST(test_index_records_hash_algorithm);
     
     return UNITY_END();
 }
\ No newline at end of file
@@ -2,12 +2,42 @@
 #include "../../src/utils/fs.h"
 #include "../../src/utils/cli.h"
 #include "../../src/utils/git.h"
+#include "../../src/utils/gitignore.h"
+#include "../../src/utils/parallel_scan.h"
+#include "../../src/utils/parallel_restore.h"
+#include "../../src/utils/snapshot_fs.h"
+#include "../../src/core/tree.h"
+#include "../../src/core/objects.h"
+#include "../../src/core/index.h"
+#include "../../src/daemon/watch.h"
+#include "../../src/daemon/schedule.h"
+#include "../../src/utils/fast_dir.h"
+#include "../../src/utils/bounded_queue.h"
+#include "../../src/utils/concurrency.h"
+#include "../../src/utils/arena.h"
+#include "../../src/utils/binary_index.h"
+#include "../../src/utils/catalog.h"
+#include "../../src/utils/snapshot_table.h"
+#include "../../src/utils/snapshots.h"
+#include "../../src/utils/paths.h"
+#include "../../src/utils/diff_cache.h"
+#include "../../src/utils/simd.h"
+#include "../../src/utils/lock.h"
+#include "../../src/utils/governor.h"
+#include "../../src/utils/scan_journal.h"
+#include "../../src/utils/profile.h"
+#include "../../src/utils/counters.h"
+#include "../../src/utils/config.h"
+#include "../../src/core/hash.h"
+#include <pthread.h>
+#include "../../src/include/fractyl.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 /* Remove cjson.h for now to get basic tests working */
 
 void setUp(void) {
@@ -211,6 +241,1375 @@ void test_git_is_repository_root_with_nonexistent_path(void) {
     TEST_ASSERT_EQUAL(0, git_is_repository_root("/tmp/this_should_not_exist_98765"));
 }
 
+/* Test compiled ignore engine */
+static void write_text_file(const char *path, const char *content) {
+    FILE *fp = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fputs(content, fp);
+    fclose(fp);
+}
+
+void test_ignore_engine_root_rules(void) {
+    const char *test_dir = "/tmp/test_ignore_engine_root";
+    system("rm -rf /tmp/test_ignore_engine_root");
+    mkdir(test_dir, 0755);
+    write_text_file("/tmp/test_ignore_engine_root/.gitignore",
+                    "# comment\n*.o\nbuild/\ntmp*\n/Makefile.local\ndocs/*.html\n!keep.o\n");
+    write_text_file("/tmp/test_ignore_engine_root/.fractylignore", "*.secret\n");
+    
+    ignore_engine_t *engine = ignore_engine_create(test_dir);
+    TEST_ASSERT_NOT_NULL(engine);
+    const ignore_dir_t *root = ignore_engine_root(engine);
+    
+    /* Suffix, directory-only, prefix, anchored literal and fnmatch rules */
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, root, "main.o", 0));
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, root, "build", 1));
+    TEST_ASSERT_EQUAL(0, ignore_engine_should_ignore(engine, root, "build", 0));
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, root, "tmpfile", 0));
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, root, "Makefile.local", 0));
+    TEST_ASSERT_EQUAL(0, ignore_engine_should_ignore(engine, root, "src/Makefile.local", 0));
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, root, "docs/index.html", 0));
+    TEST_ASSERT_EQUAL(0, ignore_engine_should_ignore(engine, root, "docs/api/index.html", 0));
+    
+    /* Negation, fractylignore and the built-in directories */
+    TEST_ASSERT_EQUAL(0, ignore_engine_should_ignore(engine, root, "keep.o", 0));
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, root, "db.secret", 0));
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, root, ".git", 1));
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, root, ".fractyl", 1));
+    TEST_ASSERT_EQUAL(0, ignore_engine_should_ignore(engine, root, ".gitignore", 0));
+    TEST_ASSERT_EQUAL(0, ignore_engine_should_ignore(engine, root, "main.c", 0));
+    
+    ignore_engine_free(engine);
+    system("rm -rf /tmp/test_ignore_engine_root");
+}
+
+void test_ignore_engine_nested_gitignore(void) {
+    const char *test_dir = "/tmp/test_ignore_engine_nested";
+    system("rm -rf /tmp/test_ignore_engine_nested");
+    mkdir(test_dir, 0755);
+    mkdir("/tmp/test_ignore_engine_nested/sub", 0755);
+    write_text_file("/tmp/test_ignore_engine_nested/.gitignore", "*.log\n");
+    write_text_file("/tmp/test_ignore_engine_nested/sub/.gitignore", "!important.log\n/local.txt\n");
+    
+    ignore_engine_t *engine = ignore_engine_create(test_dir);
+    TEST_ASSERT_NOT_NULL(engine);
+    const ignore_dir_t *root = ignore_engine_root(engine);
+    const ignore_dir_t *sub = ignore_engine_enter_dir(engine, root, "sub");
+    TEST_ASSERT_NOT_NULL(sub);
+    
+    /* Root rules still apply below sub/, deeper rules override them */
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, sub, "sub/debug.log", 0));
+    TEST_ASSERT_EQUAL(0, ignore_engine_should_ignore(engine, sub, "sub/important.log", 0));
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, root, "important.log", 0));
+    
+    /* Anchored rules are relative to the directory holding the .gitignore */
+    TEST_ASSERT_EQUAL(1, ignore_engine_should_ignore(engine, sub, "sub/local.txt", 0));
+    TEST_ASSERT_EQUAL(0, ignore_engine_should_ignore(engine, root, "local.txt", 0));
+    
+    /* Directories without rule files share their parent's node */
+    mkdir("/tmp/test_ignore_engine_nested/other", 0755);
+    TEST_ASSERT_EQUAL_PTR(root, ignore_engine_enter_dir(engine, root, "other"));
+    
+    ignore_engine_free(engine);
+    system("rm -rf /tmp/test_ignore_engine_nested");
+}
+
+/* Test incremental rescans of known changed paths */
+static void assert_same_index(const index_t *expected, const index_t *actual) {
+    TEST_ASSERT_EQUAL(expected->count, actual->count);
+    for (size_t i = 0; i < expected->count; i++) {
+        TEST_ASSERT_EQUAL_STRING(expected->entries[i].path, actual->entries[i].path);
+        TEST_ASSERT_EQUAL_MEMORY(expected->entries[i].hash, actual->entries[i].hash, 32);
+    }
+}
+
+void test_scan_paths_incremental_matches_full_scan(void) {
+    system("rm -rf /tmp/test_incremental_scan");
+    mkdir("/tmp/test_incremental_scan", 0755);
+    mkdir("/tmp/test_incremental_scan/.fractyl", 0755);
+    mkdir("/tmp/test_incremental_scan/.fractyl/objects", 0755);
+    mkdir("/tmp/test_incremental_scan/keep", 0755);
+    mkdir("/tmp/test_incremental_scan/gone", 0755);
+    write_text_file("/tmp/test_incremental_scan/a.txt", "a1");
+    write_text_file("/tmp/test_incremental_scan/keep/k.txt", "k");
+    write_text_file("/tmp/test_incremental_scan/gone/g1.txt", "g1");
+    write_text_file("/tmp/test_incremental_scan/gone/g2.txt", "g2");
+    
+    const char *root = "/tmp/test_incremental_scan";
+    const char *fractyl_dir = "/tmp/test_incremental_scan/.fractyl";
+    index_t prev;
+    index_init(&prev);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_parallel(root, &prev, NULL, fractyl_dir));
+    TEST_ASSERT_EQUAL(4, prev.count);
+    
+    /* Modify a file, delete a directory, add a directory and an ignored file */
+    write_text_file("/tmp/test_incremental_scan/a.txt", "a2");
+    system("rm -rf /tmp/test_incremental_scan/gone");
+    mkdir("/tmp/test_incremental_scan/new", 0755);
+    mkdir("/tmp/test_incremental_scan/new/deep", 0755);
+    write_text_file("/tmp/test_incremental_scan/new/deep/n.txt", "n");
+    write_text_file("/tmp/test_incremental_scan/.gitignore", "*.log\n");
+    write_text_file("/tmp/test_incremental_scan/debug.log", "noise");
+    
+    const char *changed[] = {"a.txt", "gone", "new", "new/deep/n.txt", ".gitignore", "debug.log"};
+    index_t incremental;
+    index_init(&incremental);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_paths_incremental(root, &incremental, &prev, fractyl_dir,
+                                                         changed, 6, NULL));
+    
+    index_t full;
+    index_init(&full);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_parallel(root, &full, &prev, fractyl_dir));
+    
+    assert_same_index(&full, &incremental);
+    TEST_ASSERT_NOT_NULL(index_find_entry(&incremental, "new/deep/n.txt"));
+    TEST_ASSERT_NULL(index_find_entry(&incremental, "gone/g1.txt"));
+    TEST_ASSERT_NULL(index_find_entry(&incremental, "debug.log"));
+    
+    index_free(&prev);
+    index_free(&incremental);
+    index_free(&full);
+    system("rm -rf /tmp/test_incremental_scan");
+}
+
+/* The binary engine checks known files in windows as small as the memory
+   budget allows and still agrees with a full scan */
+void test_binary_scan_windows_match_full_scan(void) {
+    system("rm -rf /tmp/test_windowed_scan");
+    mkdir("/tmp/test_windowed_scan", 0755);
+    mkdir("/tmp/test_windowed_scan/.fractyl", 0755);
+    mkdir("/tmp/test_windowed_scan/.fractyl/objects", 0755);
+    char path[128], content[32];
+    for (int d = 0; d < 3; d++) {
+        snprintf(path, sizeof(path), "/tmp/test_windowed_scan/dir%d", d);
+        mkdir(path, 0755);
+        for (int i = 0; i < 100; i++) {
+            snprintf(path, sizeof(path), "/tmp/test_windowed_scan/dir%d/file%03d.txt", d, i);
+            snprintf(content, sizeof(content), "%d/%d", d, i);
+            write_text_file(path, content);
+        }
+    }
+    
+    const char *root = "/tmp/test_windowed_scan";
+    const char *fractyl_dir = "/tmp/test_windowed_scan/.fractyl";
+    index_t first;
+    index_init(&first);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_engine(SCAN_ENGINE_BINARY, root, &first, NULL,
+                                                        fractyl_dir, "main", 0));
+    TEST_ASSERT_EQUAL(300, first.count);
+    
+    /* The smallest budget: windows of a few dozen files */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, config_set(fractyl_dir, "scan.memory_budget", "1"));
+    sleep(1);
+    write_text_file("/tmp/test_windowed_scan/dir1/file050.txt", "changed");
+    unlink("/tmp/test_windowed_scan/dir2/file099.txt");
+    
+    index_t windowed;
+    index_init(&windowed);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_engine(SCAN_ENGINE_BINARY, root, &windowed, &first,
+                                                        fractyl_dir, "main", 0));
+    index_t full;
+    index_init(&full);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_parallel(root, &full, &first, fractyl_dir));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_sort(&full, 1));
+    
+    assert_same_index(&full, &windowed);
+    TEST_ASSERT_EQUAL(299, windowed.count);
+    TEST_ASSERT_NULL(index_find_entry(&windowed, "dir2/file099.txt"));
+    
+    index_free(&first);
+    index_free(&windowed);
+    index_free(&full);
+    system("rm -rf /tmp/test_windowed_scan");
+}
+
+/* Test the bounded queue between pipeline stages */
+static void* queue_producer(void *arg) {
+    bounded_queue_t *queue = arg;
+    for (long i = 1; i <= 1000; i++) {
+        TEST_ASSERT_EQUAL(FRACTYL_OK, bounded_queue_push(queue, (void*)i));
+    }
+    return NULL;
+}
+
+/* Arena allocations stay valid across blocks and after moving arenas */
+void test_arena_allocations_survive_take(void) {
+    arena_t a, b;
+    arena_init(&a);
+    arena_init(&b);
+    
+    char *strings[2000];
+    char expected[32];
+    for (int i = 0; i < 2000; i++) {
+        snprintf(expected, sizeof(expected), "path/%d", i);
+        strings[i] = arena_strdup(i % 2 ? &a : &b, expected);
+        TEST_ASSERT_NOT_NULL(strings[i]);
+    }
+    
+    /* A large allocation gets its own block without ending the current one */
+    char *big = arena_alloc(&a, ARENA_BLOCK_SIZE * 2);
+    TEST_ASSERT_NOT_NULL(big);
+    memset(big, 'x', ARENA_BLOCK_SIZE * 2);
+    char *after = arena_strndup(&a, "abcdef", 3);
+    TEST_ASSERT_EQUAL_STRING("abc", after);
+    TEST_ASSERT_EQUAL_INT(0, (int)((size_t)arena_alloc(&a, 8) % sizeof(void *)));
+    
+    arena_take(&a, &b);
+    TEST_ASSERT_NULL(b.head);
+    for (int i = 0; i < 2000; i++) {
+        snprintf(expected, sizeof(expected), "path/%d", i);
+        TEST_ASSERT_EQUAL_STRING(expected, strings[i]);
+    }
+    
+    arena_free(&a);
+    TEST_ASSERT_NULL(a.head);
+    TEST_ASSERT_EQUAL_INT(0, (int)a.allocated);
+}
+
+/* Saved binary indexes are used in place, with additions merged on save */
+void test_binary_index_mapped_with_overlay(void) {
+    const char *dir = "/tmp/test_binary_index";
+    system("rm -rf /tmp/test_binary_index");
+    mkdir(dir, 0755);
+    
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFREG | 0644;
+    unsigned char hash[32];
+    char path[64];
+    
+    binary_index_t index;
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_init(&index, "main"));
+    for (int i = 0; i < 500; i++) {
+        snprintf(path, sizeof(path), "dir%d/file%d.txt", i % 7, i);
+        st.st_size = i;
+        memset(hash, i & 0xff, sizeof(hash));
+        TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_update_entry(&index, path, &st, hash));
+    }
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_remove_entry(&index, "dir3/file3.txt"));
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_save(&index, dir));
+    binary_index_free(&index);
+    
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_load(&index, dir, "main"));
+    TEST_ASSERT_NOT_NULL(index.mmap_addr);
+    TEST_ASSERT_EQUAL_INT(499, (int)index.header.entry_count);
+    TEST_ASSERT_NULL(binary_index_find_entry(&index, "dir3/file3.txt", NULL));
+    
+    const char *found_path = NULL;
+    const binary_index_entry_t *entry = binary_index_find_entry(&index, "dir2/file100.txt", &found_path);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_STRING("dir2/file100.txt", found_path);
+    TEST_ASSERT_EQUAL_INT(100, (int)entry->size);
+    
+    /* Update a saved entry, add one, remove one, bring one back */
+    st.st_size = 12345;
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_update_entry(&index, "dir2/file100.txt", &st, hash));
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_update_entry(&index, "new/file.txt", &st, hash));
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_remove_entry(&index, "dir0/file0.txt"));
+    TEST_ASSERT_EQUAL_INT(FRACTYL_ERROR_NOT_FOUND, binary_index_remove_entry(&index, "dir0/file0.txt"));
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_update_entry(&index, "dir3/file3.txt", &st, hash));
+    TEST_ASSERT_EQUAL_INT(500, (int)index.header.entry_count);
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_save(&index, dir));
+    binary_index_free(&index);
+    
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_load(&index, dir, "main"));
+    TEST_ASSERT_EQUAL_INT(500, (int)index.header.entry_count);
+    TEST_ASSERT_EQUAL_INT(12345, (int)binary_index_find_entry(&index, "dir2/file100.txt", NULL)->size);
+    TEST_ASSERT_NOT_NULL(binary_index_find_entry(&index, "new/file.txt", NULL));
+    TEST_ASSERT_NOT_NULL(binary_index_find_entry(&index, "dir3/file3.txt", NULL));
+    TEST_ASSERT_NULL(binary_index_find_entry(&index, "dir0/file0.txt", NULL));
+    
+    /* Saved in path order, with the additions merged in */
+    binary_index_iterator_t iter;
+    binary_index_iterator_init(&iter, &index);
+    int count = 0;
+    const char *iter_path, *last_path = "";
+    while (binary_index_iterator_next(&iter, &iter_path, NULL)) {
+        TEST_ASSERT_TRUE(strcmp(last_path, iter_path) < 0);
+        last_path = iter_path;
+        count++;
+    }
+    TEST_ASSERT_EQUAL_INT(500, count);
+    binary_index_free(&index);
+    
+    system("rm -rf /tmp/test_binary_index");
+}
+
+/* The catalog follows stores and removals, answers lookups by age and id
+   prefix, and is rebuilt from the JSON files */
+void test_catalog_tracks_snapshots(void) {
+    const char *dir = "/tmp/test_catalog/snapshots";
+    system("rm -rf /tmp/test_catalog");
+    mkdir("/tmp/test_catalog", 0755);
+    mkdir(dir, 0755);
+    
+    snapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    char description[32];
+    for (int i = 0; i < 3; i++) {
+        snprintf(snapshot.id, sizeof(snapshot.id), "snap-%d", i);
+        snprintf(description, sizeof(description), "change %d", i);
+        snapshot.description = description;
+        snapshot.git_branch = i == 1 ? NULL : "main";
+        snapshot.parent = i > 0 ? "snap-0" : NULL;
+        snapshot.timestamp = 1000 + (i == 2 ? 0 : i);
+        memset(snapshot.index_hash, i + 1, sizeof(snapshot.index_hash));
+        TEST_ASSERT_EQUAL_INT(FRACTYL_OK, catalog_store_snapshot(dir, &snapshot));
+    }
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, catalog_remove_snapshot(dir, "snap-0"));
+    TEST_ASSERT_EQUAL_INT(FRACTYL_ERROR_NOT_FOUND, catalog_remove_snapshot(dir, "snap-0"));
+    TEST_ASSERT_EQUAL_INT(0, access("/tmp/test_catalog/snapshots" CATALOG_SUFFIX, F_OK));
+    
+    for (int pass = 0; pass < 2; pass++) {
+        catalog_t catalog;
+        TEST_ASSERT_EQUAL_INT(FRACTYL_OK, catalog_load(dir, &catalog));
+        TEST_ASSERT_EQUAL_INT(2, (int)catalog.count);
+        const catalog_entry_t **order = catalog_newest_first(&catalog);
+        TEST_ASSERT_NOT_NULL(order);
+        TEST_ASSERT_EQUAL_STRING("snap-1", order[0]->id);
+        TEST_ASSERT_EQUAL_STRING("snap-2", order[1]->id);
+        TEST_ASSERT_EQUAL_STRING("snap-0", order[1]->parent);
+        TEST_ASSERT_EQUAL_INT(3, order[1]->index_hash[0]);
+        TEST_ASSERT_EQUAL_STRING("change 1", catalog_description(&catalog, order[0]));
+        TEST_ASSERT_NULL(catalog_git_branch(&catalog, order[0]));
+        TEST_ASSERT_EQUAL_STRING("main", catalog_git_branch(&catalog, order[1]));
+        free(order);
+        
+        TEST_ASSERT_EQUAL_STRING("snap-2", catalog_nth_newest(&catalog, 1)->id);
+        TEST_ASSERT_NULL(catalog_nth_newest(&catalog, 2));
+        const catalog_entry_t *matches[2];
+        TEST_ASSERT_EQUAL_INT(2, (int)catalog_find_prefix(&catalog, "snap", matches, 2));
+        TEST_ASSERT_EQUAL_STRING("snap-1", matches[0]->id);
+        TEST_ASSERT_EQUAL_INT(1, (int)catalog_find_prefix(&catalog, "snap-2", matches, 2));
+        TEST_ASSERT_EQUAL_STRING("snap-2", matches[0]->id);
+        TEST_ASSERT_EQUAL_INT(0, (int)catalog_find_prefix(&catalog, "snap-0", matches, 2));
+        TEST_ASSERT_EQUAL_INT(6, (int)catalog_abbrev_length(&catalog, matches[0], 4));
+        TEST_ASSERT_EQUAL_INT(1, (int)catalog_first_since(&catalog, 1001));
+        TEST_ASSERT_EQUAL_INT(2, (int)catalog_first_since(&catalog, 1002));
+        catalog_free(&catalog);
+        
+        /* Losing the catalog costs a rebuild, not snapshots */
+        if (pass == 0) unlink("/tmp/test_catalog/snapshots" CATALOG_SUFFIX);
+    }
+    TEST_ASSERT_EQUAL_INT(0, access("/tmp/test_catalog/snapshots" CATALOG_SUFFIX, F_OK));
+    system("rm -rf /tmp/test_catalog");
+}
+
+/* Directory records sit beside files without showing up as files */
+void test_binary_index_directory_records(void) {
+    binary_index_t index;
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_init(&index, "main"));
+    
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFDIR | 0755;
+    st.st_mtime = 1000;
+    unsigned char rules[32];
+    memset(rules, 7, sizeof(rules));
+    
+    TEST_ASSERT_EQUAL_INT(BINARY_FILE_NEW, binary_index_check_directory(&index, "src", &st, rules));
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_update_directory(&index, "src", &st, 3, rules));
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_update_directory(&index, "", &st, 1, rules));
+    TEST_ASSERT_EQUAL_INT(BINARY_FILE_UNCHANGED, binary_index_check_directory(&index, "src", &st, rules));
+    TEST_ASSERT_EQUAL_INT(BINARY_FILE_UNCHANGED, binary_index_check_directory(&index, "", &st, rules));
+    TEST_ASSERT_EQUAL_INT(3, (int)binary_index_find_directory(&index, "src")->size);
+    rules[0] = 8;
+    TEST_ASSERT_EQUAL_INT(BINARY_FILE_CHANGED, binary_index_check_directory(&index, "src", &st, rules));
+    rules[0] = 7;
+    st.st_mtime = 1001;
+    TEST_ASSERT_EQUAL_INT(BINARY_FILE_CHANGED, binary_index_check_directory(&index, "src", &st, rules));
+    
+    binary_index_iterator_t iter;
+    const char *path;
+    int directories = 0;
+    binary_index_iterator_init(&iter, &index);
+    while (binary_index_iterator_next_directory(&iter, &path, NULL)) {
+        TEST_ASSERT_TRUE(strcmp(path, "src/") == 0 || strcmp(path, "/") == 0);
+        directories++;
+    }
+    TEST_ASSERT_EQUAL_INT(2, directories);
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_remove_directory(&index, ""));
+    TEST_ASSERT_NULL(binary_index_find_directory(&index, ""));
+    
+    /* A file of the same name is a separate entry, and the only one iterated */
+    st.st_mode = S_IFREG | 0644;
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, binary_index_update_entry(&index, "src", &st, rules));
+    TEST_ASSERT_NOT_NULL(binary_index_find_entry(&index, "src", NULL));
+    
+    binary_index_iterator_init(&iter, &index);
+    TEST_ASSERT_TRUE(binary_index_iterator_next(&iter, &path, NULL));
+    TEST_ASSERT_EQUAL_STRING("src", path);
+    TEST_ASSERT_FALSE(binary_index_iterator_next(&iter, &path, NULL));
+    
+    binary_index_free(&index);
+}
+
+void test_bounded_queue_passes_items_in_order(void) {
+    bounded_queue_t queue;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, bounded_queue_init(&queue, 4));
+    
+    /* The producer blocks whenever 4 items are waiting */
+    pthread_t producer;
+    TEST_ASSERT_EQUAL(0, pthread_create(&producer, NULL, queue_producer, &queue));
+    for (long i = 1; i <= 1000; i++) {
+        TEST_ASSERT_EQUAL(i, (long)bounded_queue_pop(&queue));
+        TEST_ASSERT_TRUE(bounded_queue_length(&queue) <= 4);
+    }
+    pthread_join(producer, NULL);
+    
+    /* Closing drains what is left, then refuses new items */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, bounded_queue_push(&queue, (void*)7L));
+    bounded_queue_close(&queue);
+    TEST_ASSERT_EQUAL(FRACTYL_ERROR_INVALID_STATE, bounded_queue_push(&queue, (void*)8L));
+    TEST_ASSERT_EQUAL(7, (long)bounded_queue_pop(&queue));
+    TEST_ASSERT_NULL(bounded_queue_pop(&queue));
+    
+    bounded_queue_destroy(&queue);
+}
+
+static void remember_peeked(void *item, void *ctx) {
+    *(long *)ctx = (long)item;
+}
+
+void test_bounded_queue_peeks_ahead_of_pop(void) {
+    bounded_queue_t queue;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, bounded_queue_init(&queue, 8));
+    for (long i = 1; i <= 6; i++) {
+        TEST_ASSERT_EQUAL(FRACTYL_OK, bounded_queue_push(&queue, (void*)i));
+    }
+    
+    /* The item 3 places behind the one taken, then the newest once fewer wait */
+    long peeked = 0;
+    TEST_ASSERT_EQUAL(1, (long)bounded_queue_pop_peek(&queue, 3, remember_peeked, &peeked));
+    TEST_ASSERT_EQUAL(4, peeked);
+    TEST_ASSERT_EQUAL(2, (long)bounded_queue_pop_peek(&queue, 3, remember_peeked, &peeked));
+    TEST_ASSERT_EQUAL(5, peeked);
+    TEST_ASSERT_EQUAL(3, (long)bounded_queue_pop_peek(&queue, 8, remember_peeked, &peeked));
+    TEST_ASSERT_EQUAL(6, peeked);
+    
+    /* Nothing to peek at once the last item is taken */
+    TEST_ASSERT_EQUAL(4, (long)bounded_queue_pop(&queue));
+    TEST_ASSERT_EQUAL(5, (long)bounded_queue_pop(&queue));
+    peeked = 0;
+    TEST_ASSERT_EQUAL(6, (long)bounded_queue_pop_peek(&queue, 3, remember_peeked, &peeked));
+    TEST_ASSERT_EQUAL(0, peeked);
+    
+    bounded_queue_destroy(&queue);
+}
+
+void test_concurrency_plan_and_adaptive_gate(void) {
+    /* Overrides pin a pool; the rest keep the storage class defaults */
+    setenv("FRACTYL_STORAGE", "rotational", 1);
+    setenv("FRACTYL_HASH_THREADS", "3", 1);
+    concurrency_plan_t plan;
+    concurrency_plan_init(&plan, "/tmp", NULL);
+    TEST_ASSERT_EQUAL(STORAGE_ROTATIONAL, plan.storage);
+    TEST_ASSERT_EQUAL(3, plan.hash.max);
+    TEST_ASSERT_EQUAL(3, plan.hash.initial);
+    TEST_ASSERT_TRUE(plan.hash.fixed);
+    TEST_ASSERT_EQUAL(2, plan.scan.initial);
+    TEST_ASSERT_FALSE(plan.scan.fixed);
+    TEST_ASSERT_TRUE(plan.adaptive);
+    
+    setenv("FRACTYL_ADAPTIVE", "0", 1);
+    concurrency_plan_init(&plan, "/tmp", NULL);
+    TEST_ASSERT_FALSE(plan.adaptive);
+    TEST_ASSERT_EQUAL(plan.scan.initial, plan.scan.max);
+    TEST_ASSERT_TRUE(plan.stat.fixed);
+    unsetenv("FRACTYL_STORAGE");
+    unsetenv("FRACTYL_HASH_THREADS");
+    unsetenv("FRACTYL_ADAPTIVE");
+    
+    /* Threads at or above the active count park */
+    pool_size_t size = { 8, 4, 0 };
+    adaptive_gate_t gate;
+    adaptive_gate_init(&gate, &size);
+    TEST_ASSERT_EQUAL(4, adaptive_gate_active(&gate));
+    TEST_ASSERT_FALSE(adaptive_gate_parked(&gate, 3));
+    TEST_ASSERT_TRUE(adaptive_gate_parked(&gate, 4));
+    
+    /* Grow while throughput improves, step back once it drops */
+    TEST_ASSERT_EQUAL(4, adaptive_gate_sample(&gate, 0, 1.0, 1));
+    TEST_ASSERT_EQUAL(5, adaptive_gate_sample(&gate, 1000, 1.0, 1));
+    TEST_ASSERT_EQUAL(6, adaptive_gate_sample(&gate, 2200, 1.0, 1));
+    TEST_ASSERT_EQUAL(5, adaptive_gate_sample(&gate, 2700, 1.0, 1));
+    
+    /* A starved pool is left alone */
+    TEST_ASSERT_EQUAL(5, adaptive_gate_sample(&gate, 2800, 1.0, 0));
+    
+    adaptive_gate_close(&gate);
+    TEST_ASSERT_FALSE(adaptive_gate_parked(&gate, 7));
+    adaptive_gate_wait(&gate, 7);
+    adaptive_gate_destroy(&gate);
+    
+    /* A pinned pool never moves */
+    pool_size_t pinned = { 2, 2, 1 };
+    adaptive_gate_init(&gate, &pinned);
+    adaptive_gate_sample(&gate, 0, 1.0, 1);
+    TEST_ASSERT_EQUAL(2, adaptive_gate_sample(&gate, 1000, 1.0, 1));
+    adaptive_gate_destroy(&gate);
+}
+
+void test_catalog_snapshot_graph(void) {
+    const char *dir = "/tmp/test_catalog_graph/snapshots";
+    system("rm -rf /tmp/test_catalog_graph");
+    mkdir("/tmp/test_catalog_graph", 0755);
+    mkdir(dir, 0755);
+    
+    /* a <- b <- c, a <- d, and e on c though its clock is behind */
+    const char *ids[] = { "a", "b", "c", "d", "e" };
+    const char *parents[] = { NULL, "a", "b", "a", "c" };
+    const time_t times[] = { 100, 200, 300, 400, 50 };
+    snapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    for (int i = 0; i < 5; i++) {
+        snprintf(snapshot.id, sizeof(snapshot.id), "%s", ids[i]);
+        snapshot.parent = (char *)parents[i];
+        snapshot.timestamp = times[i];
+        TEST_ASSERT_EQUAL_INT(FRACTYL_OK, catalog_store_snapshot(dir, &snapshot));
+    }
+    
+    catalog_t catalog;
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, catalog_load(dir, &catalog));
+    const catalog_entry_t *a = catalog_find(&catalog, "a");
+    const catalog_entry_t *c = catalog_find(&catalog, "c");
+    const catalog_entry_t *d = catalog_find(&catalog, "d");
+    const catalog_entry_t *e = catalog_find(&catalog, "e");
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(e);
+    TEST_ASSERT_NULL(catalog_find(&catalog, "f"));
+    TEST_ASSERT_EQUAL_STRING("e", catalog.entries[0].id);
+    
+    TEST_ASSERT_NULL(catalog_parent(&catalog, a));
+    TEST_ASSERT_EQUAL_PTR(c, catalog_parent(&catalog, e));
+    TEST_ASSERT_EQUAL_UINT32(1, a->generation);
+    TEST_ASSERT_EQUAL_UINT32(3, c->generation);
+    TEST_ASSERT_EQUAL_UINT32(2, d->generation);
+    TEST_ASSERT_EQUAL_UINT32(4, e->generation);
+    
+    TEST_ASSERT_TRUE(catalog_is_ancestor(&catalog, a, e));
+    TEST_ASSERT_TRUE(catalog_is_ancestor(&catalog, e, e));
+    TEST_ASSERT_FALSE(catalog_is_ancestor(&catalog, e, a));
+    TEST_ASSERT_FALSE(catalog_is_ancestor(&catalog, d, e));
+    catalog_free(&catalog);
+    
+    /* Without its parent a snapshot starts a lineage of its own */
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, catalog_remove_snapshot(dir, "b"));
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, catalog_load(dir, &catalog));
+    c = catalog_find(&catalog, "c");
+    TEST_ASSERT_NULL(catalog_parent(&catalog, c));
+    TEST_ASSERT_EQUAL_UINT32(1, c->generation);
+    TEST_ASSERT_EQUAL_UINT32(2, catalog_find(&catalog, "e")->generation);
+    TEST_ASSERT_FALSE(catalog_is_ancestor(&catalog, catalog_find(&catalog, "a"), catalog_find(&catalog, "e")));
+    catalog_free(&catalog);
+    system("rm -rf /tmp/test_catalog_graph");
+}
+
+static void store_branch_snapshot(const char *fractyl_dir, const char *branch, const char *id, time_t when) {
+    char *dir = paths_get_snapshots_dir(fractyl_dir, branch);
+    TEST_ASSERT_EQUAL_INT(0, paths_ensure_directory(dir));
+    snapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    snprintf(snapshot.id, sizeof(snapshot.id), "%s", id);
+    snapshot.timestamp = when;
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, catalog_store_snapshot(dir, &snapshot));
+    free(dir);
+}
+
+/* Test the snapshot table across branches, rebuilt and kept up to date */
+void test_snapshot_table_spans_branches(void) {
+    const char *fractyl_dir = "/tmp/test_snapshot_table/.fractyl";
+    system("rm -rf /tmp/test_snapshot_table");
+    TEST_ASSERT_EQUAL_INT(0, paths_ensure_directory(fractyl_dir));
+    store_branch_snapshot(fractyl_dir, "main", "aaaa1", 100);
+    store_branch_snapshot(fractyl_dir, "main", "aaaa3", 300);
+    store_branch_snapshot(fractyl_dir, "topic/x", "bbbb2", 200);
+    
+    /* No table yet: it is built from refs/heads, nested branches included */
+    snapshot_table_t table;
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, snapshot_table_load(fractyl_dir, &table));
+    TEST_ASSERT_EQUAL(2, table.count);
+    TEST_ASSERT_EQUAL_STRING("main", table.rows[0].branch);
+    TEST_ASSERT_EQUAL_STRING("aaaa3", table.rows[0].newest_id);
+    TEST_ASSERT_EQUAL(2, table.rows[0].count);
+    TEST_ASSERT_EQUAL_STRING("topic/x", table.rows[1].branch);
+    
+    catalog_t *catalogs;
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, snapshot_table_load_catalogs(&table, &catalogs));
+    size_t remaining[2] = { catalogs[0].count, catalogs[1].count };
+    size_t row;
+    const char *expected[] = { "aaaa3", "bbbb2", "aaaa1" };
+    for (int i = 0; i < 3; i++) {
+        const catalog_entry_t *entry = snapshot_table_next_newest(&table, catalogs, remaining, &row);
+        TEST_ASSERT_NOT_NULL(entry);
+        TEST_ASSERT_EQUAL_STRING(expected[i], entry->id);
+    }
+    TEST_ASSERT_NULL(snapshot_table_next_newest(&table, catalogs, remaining, &row));
+    snapshot_table_free_catalogs(&table, catalogs);
+    snapshot_table_free(&table);
+    
+    /* A snapshot stored behind the table's back shows up by its stamp */
+    store_branch_snapshot(fractyl_dir, "topic/x", "bbbb4", 400);
+    char id[65], *branch;
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, resolve_snapshot_id_all_branches("-1", fractyl_dir, id, &branch));
+    TEST_ASSERT_EQUAL_STRING("bbbb4", id);
+    TEST_ASSERT_EQUAL_STRING("topic/x", branch);
+    free(branch);
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, resolve_snapshot_id_all_branches("-3", fractyl_dir, id, &branch));
+    TEST_ASSERT_EQUAL_STRING("bbbb2", id);
+    free(branch);
+    TEST_ASSERT_EQUAL_INT(FRACTYL_OK, resolve_snapshot_id_all_branches("aaaa1", fractyl_dir, id, &branch));
+    TEST_ASSERT_EQUAL_STRING("main", branch);
+    free(branch);
+    TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, resolve_snapshot_id_all_branches("cccc", fractyl_dir, id, &branch));
+    
+    system("rm -rf /tmp/test_snapshot_table");
+}
+
+/* Append each branch to the comma-separated list in ctx; "stop" ends the walk */
+static int collect_branch(const char *branch, const char *snapshots_dir, void *ctx) {
+    char *list = ctx;
+    if (!strstr(snapshots_dir, "/refs/heads/") || !strstr(snapshots_dir, "/snapshots")) return -1;
+    if (strcmp(branch, "stop") == 0) return 7;
+    if (list[0]) strcat(list, ",");
+    strcat(list, branch);
+    return 0;
+}
+
+/* Test that every branch with a snapshots directory is found, nested ones too */
+void test_paths_for_each_branch_finds_nested_branches(void) {
+    const char *fractyl_dir = "/tmp/test_branch_walk/.fractyl";
+    system("rm -rf /tmp/test_branch_walk");
+    TEST_ASSERT_EQUAL_INT(0, paths_ensure_directory("/tmp/test_branch_walk/.fractyl/snapshots"));
+    TEST_ASSERT_EQUAL_INT(0, paths_ensure_directory("/tmp/test_branch_walk/.fractyl/refs/heads/a/snapshots"));
+    TEST_ASSERT_EQUAL_INT(0, paths_ensure_directory("/tmp/test_branch_walk/.fractyl/refs/heads/a/b/snapshots"));
+    TEST_ASSERT_EQUAL_INT(0, paths_ensure_directory("/tmp/test_branch_walk/.fractyl/refs/heads/empty"));
+    
+    /* The legacy directory and branches without snapshots are left out */
+    char list[256] = "";
+    TEST_ASSERT_EQUAL_INT(0, paths_for_each_branch(fractyl_dir, collect_branch, list));
+    TEST_ASSERT_TRUE(strcmp(list, "a,a/b") == 0 || strcmp(list, "a/b,a") == 0);
+    
+    /* A nonzero result stops the walk and is returned */
+    TEST_ASSERT_EQUAL_INT(0, paths_ensure_directory("/tmp/test_branch_walk/.fractyl/refs/heads/stop/snapshots"));
+    list[0] = '\0';
+    TEST_ASSERT_EQUAL_INT(7, paths_for_each_branch(fractyl_dir, collect_branch, list));
+    
+    system("rm -rf /tmp/test_branch_walk");
+}
+
+/* Test reading HEAD, loose refs and packed-refs without running git */
+void test_git_reads_head_without_git(void) {
+    system("rm -rf /tmp/test_git_native");
+    mkdir("/tmp/test_git_native", 0755);
+    mkdir("/tmp/test_git_native/.git", 0755);
+    mkdir("/tmp/test_git_native/.git/refs", 0755);
+    mkdir("/tmp/test_git_native/.git/refs/heads", 0755);
+    mkdir("/tmp/test_git_native/sub", 0755);
+    
+    const char *packed = "1111111111111111111111111111111111111111";
+    const char *loose = "2222222222222222222222222222222222222222";
+    write_text_file("/tmp/test_git_native/.git/HEAD", "ref: refs/heads/feature/x\n");
+    write_text_file("/tmp/test_git_native/.git/packed-refs",
+                    "# pack-refs with: peeled fully-peeled sorted\n"
+                    "1111111111111111111111111111111111111111 refs/heads/feature/x\n"
+                    "^3333333333333333333333333333333333333333\n");
+    
+    /* The branch is found from a subdirectory and sanitized; its commit is packed */
+    char *branch = git_get_current_branch("/tmp/test_git_native/sub");
+    TEST_ASSERT_NOT_NULL(branch);
+    TEST_ASSERT_EQUAL_STRING("feature-x", branch);
+    free(branch);
+    char *commit = git_get_current_commit("/tmp/test_git_native");
+    TEST_ASSERT_NOT_NULL(commit);
+    TEST_ASSERT_EQUAL_STRING(packed, commit);
+    free(commit);
+    
+    /* A loose ref wins over packed-refs, and replacing it is noticed */
+    mkdir("/tmp/test_git_native/.git/refs/heads/feature", 0755);
+    write_text_file("/tmp/test_git_native/.git/refs/heads/feature/x.lock", "2222222222222222222222222222222222222222\n");
+    rename("/tmp/test_git_native/.git/refs/heads/feature/x.lock", "/tmp/test_git_native/.git/refs/heads/feature/x");
+    commit = git_get_current_commit("/tmp/test_git_native");
+    TEST_ASSERT_NOT_NULL(commit);
+    TEST_ASSERT_EQUAL_STRING(loose, commit);
+    free(commit);
+    
+    /* Detached HEAD */
+    write_text_file("/tmp/test_git_native/.git/HEAD.lock", "4444444444444444444444444444444444444444\n");
+    rename("/tmp/test_git_native/.git/HEAD.lock", "/tmp/test_git_native/.git/HEAD");
+    branch = git_get_current_branch("/tmp/test_git_native");
+    TEST_ASSERT_NOT_NULL(branch);
+    TEST_ASSERT_EQUAL_STRING("detached-4444444", branch);
+    free(branch);
+    
+    /* A worktree: HEAD in its own git dir, refs in the common one */
+    mkdir("/tmp/test_git_native/.git/worktrees", 0755);
+    mkdir("/tmp/test_git_native/.git/worktrees/wt", 0755);
+    mkdir("/tmp/test_git_native/wt", 0755);
+    write_text_file("/tmp/test_git_native/wt/.git", "gitdir: /tmp/test_git_native/.git/worktrees/wt\n");
+    write_text_file("/tmp/test_git_native/.git/worktrees/wt/commondir", "../..\n");
+    write_text_file("/tmp/test_git_native/.git/worktrees/wt/HEAD", "ref: refs/heads/feature/x\n");
+    commit = git_get_current_commit("/tmp/test_git_native/wt");
+    TEST_ASSERT_NOT_NULL(commit);
+    TEST_ASSERT_EQUAL_STRING(loose, commit);
+    free(commit);
+    char *root = git_get_repository_root("/tmp/test_git_native/sub");
+    TEST_ASSERT_NOT_NULL(root);
+    TEST_ASSERT_EQUAL_STRING("/tmp/test_git_native", root);
+    free(root);
+    
+    /* Files modified after git wrote its index count as changes */
+    write_text_file("/tmp/test_git_native/.git/index", "DIRC");
+    struct stat st;
+    TEST_ASSERT_EQUAL(0, stat("/tmp/test_git_native/.git/index", &st));
+    TEST_ASSERT_EQUAL(0, git_has_changes_since_index("/tmp/test_git_native", st.st_mtime - 10));
+    TEST_ASSERT_EQUAL(1, git_has_changes_since_index("/tmp/test_git_native", st.st_mtime + 10));
+    
+    system("rm -rf /tmp/test_git_native");
+}
+
+void test_diff_cache_stores_and_evicts_lru(void) {
+    system("rm -rf /tmp/test_diff_cache");
+    mkdir("/tmp/test_diff_cache", 0755);
+    
+    unsigned char hash_a[32], hash_b[32], hash_c[32];
+    memset(hash_a, 0xaa, sizeof(hash_a));
+    memset(hash_b, 0xbb, sizeof(hash_b));
+    memset(hash_c, 0xcc, sizeof(hash_c));
+    char hunks[100];
+    memset(hunks, '+', sizeof(hunks));
+    diff_cache_entry_t entry = { 0, 10, 20, 3, 1, hunks, sizeof(hunks) };
+    
+    /* Room for about one entry */
+    write_text_file("/tmp/test_diff_cache/config", "diff.cache_size = 300\n");
+    diff_cache_t *cache = NULL;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, diff_cache_open("/tmp/test_diff_cache", &cache));
+    TEST_ASSERT_NOT_NULL(cache);
+    
+    diff_cache_entry_t found;
+    TEST_ASSERT_FALSE(diff_cache_lookup(cache, hash_a, hash_b, 0, 3, &found));
+    diff_cache_store(cache, hash_a, hash_b, 0, 3, &entry);
+    usleep(20000);
+    diff_cache_store(cache, NULL, hash_c, 0, 3, &entry);
+    usleep(20000);
+    
+    TEST_ASSERT_TRUE(diff_cache_lookup(cache, hash_a, hash_b, 0, 3, &found));
+    TEST_ASSERT_EQUAL_UINT64(10, found.size_a);
+    TEST_ASSERT_EQUAL_UINT64(20, found.size_b);
+    TEST_ASSERT_EQUAL_INT64(3, found.added);
+    TEST_ASSERT_EQUAL_INT64(1, found.removed);
+    TEST_ASSERT_EQUAL(sizeof(hunks), found.hunks_size);
+    TEST_ASSERT_EQUAL_MEMORY(hunks, found.hunks, sizeof(hunks));
+    diff_cache_entry_free(&found);
+    
+    /* Every part of the key counts */
+    TEST_ASSERT_FALSE(diff_cache_lookup(cache, hash_b, hash_a, 0, 3, &found));
+    TEST_ASSERT_FALSE(diff_cache_lookup(cache, hash_a, hash_b, 0, DIFF_CACHE_NO_HUNKS, &found));
+    TEST_ASSERT_FALSE(diff_cache_lookup(cache, hash_a, hash_b, 1, 3, &found));
+    diff_cache_close(cache);
+    
+    /* The entry not read since it was stored went first */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, diff_cache_open("/tmp/test_diff_cache", &cache));
+    TEST_ASSERT_TRUE(diff_cache_lookup(cache, hash_a, hash_b, 0, 3, &found));
+    diff_cache_entry_free(&found);
+    TEST_ASSERT_FALSE(diff_cache_lookup(cache, NULL, hash_c, 0, 3, &found));
+    diff_cache_close(cache);
+    
+    /* A size of 0 turns it off */
+    write_text_file("/tmp/test_diff_cache/config", "diff.cache_size = 0\n");
+    TEST_ASSERT_EQUAL(FRACTYL_OK, diff_cache_open("/tmp/test_diff_cache", &cache));
+    TEST_ASSERT_NULL(cache);
+    TEST_ASSERT_FALSE(diff_cache_lookup(cache, hash_a, hash_b, 0, 3, &found));
+    
+    system("rm -rf /tmp/test_diff_cache");
+}
+
+void test_simd_kernels_match_scalar(void) {
+    /* Text with a few control bytes and NULs, at every alignment */
+    unsigned char buffer[1024 + 64];
+    unsigned seed = 12345;
+    for (size_t i = 0; i < sizeof(buffer); i++) {
+        seed = seed * 1103515245 + 12345;
+        unsigned r = (seed >> 16) % 100;
+        buffer[i] = r < 2 ? 0 : r < 5 ? (unsigned char)(200 + r) : r < 10 ? '\n' : r < 12 ? '\t' :
+                    (unsigned char)('a' + r % 26);
+    }
+    
+    simd_level_t best = simd_level();
+    simd_level_t levels[] = { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_NEON };
+    size_t sizes[] = { 0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 200, 1024 };
+    for (size_t offset = 0; offset < 32; offset += 7) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            const unsigned char *data = buffer + offset;
+            size_t size = sizes[s];
+    
+            TEST_ASSERT_TRUE(simd_force_level(SIMD_SCALAR));
+            size_t nul, control;
+            simd_count_binary_bytes(data, size, &nul, &control);
+            uint64_t hashes[256];
+            const char *eols[256];
+            size_t lines = 0;
+            for (const char *p = (const char *)data, *end = p + size; lines == 0 || p < end; lines++) {
+                hashes[lines] = simd_hash_line(p, end, &eols[lines]);
+                p = eols[lines] + 1;
+            }
+    
+            for (size_t l = 1; l < sizeof(levels) / sizeof(levels[0]); l++) {
+                if (!simd_force_level(levels[l])) continue;
+                size_t level_nul, level_control;
+                simd_count_binary_bytes(data, size, &level_nul, &level_control);
+                TEST_ASSERT_EQUAL(nul, level_nul);
+                TEST_ASSERT_EQUAL(control, level_control);
+                const char *p = (const char *)data;
+                for (size_t i = 0; i < lines; i++) {
+                    const char *eol;
+                    TEST_ASSERT_TRUE(hashes[i] == simd_hash_line(p, (const char *)data + size, &eol));
+                    TEST_ASSERT_EQUAL_PTR(eols[i], eol);
+                    p = eol + 1;
+                }
+            }
+        }
+    }
+    
+    /* Lines far apart are still found; different lines hash apart */
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        if (!simd_force_level(levels[l])) continue;
+        char line[300];
+        const char *eol;
+        memset(line, 'x', sizeof(line));
+        line[257] = '\n';
+        simd_hash_line(line, line + sizeof(line), &eol);
+        TEST_ASSERT_EQUAL_PTR(line + 257, eol);
+        simd_hash_line(line, line + 100, &eol);
+        TEST_ASSERT_EQUAL_PTR(line + 100, eol);
+        TEST_ASSERT_TRUE(simd_hash_line("abc\n", "abc\n" + 4, &eol) != simd_hash_line("abd\n", "abd\n" + 4, &eol));
+        TEST_ASSERT_TRUE(simd_hash_line(line, line + 40, &eol) != simd_hash_line(line, line + 41, &eol));
+        /* Zero padding of the last stripe does not make these equal */
+        TEST_ASSERT_TRUE(simd_hash_line("a\0", "a\0" + 2, &eol) != simd_hash_line("a", "a" + 1, &eol));
+    }
+    
+    simd_force_level(best);
+}
+
+#ifdef __linux__
+void test_fast_dir_lists_and_stats_in_batches(void) {
+    system("rm -rf /tmp/test_fast_dir");
+    mkdir("/tmp/test_fast_dir", 0755);
+    mkdir("/tmp/test_fast_dir/sub", 0755);
+    
+    /* Enough files to go through the io_uring path when it is available */
+    char path[256];
+    char content[64];
+    for (int i = 0; i < 40; i++) {
+        snprintf(path, sizeof(path), "/tmp/test_fast_dir/file%02d.txt", i);
+        snprintf(content, sizeof(content), "%*d", i + 1, i);
+        write_text_file(path, content);
+    }
+    
+    fast_dir_t dir;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, fast_dir_open(&dir, "/tmp/test_fast_dir"));
+    TEST_ASSERT_EQUAL(41, dir.count);  /* "." and ".." are skipped */
+    
+    size_t indices[41];
+    struct stat results[41];
+    int ok[41];
+    for (size_t i = 0; i < dir.count; i++) indices[i] = i;
+    
+    fast_stat_ctx_t ctx;
+    fast_stat_init(&ctx);
+    fast_dir_stat(&ctx, &dir, indices, dir.count, results, ok);
+    
+    int files = 0;
+    for (size_t i = 0; i < dir.count; i++) {
+        TEST_ASSERT_EQUAL(1, ok[i]);
+        if (strcmp(dir.entries[i].name, "sub") == 0) {
+            TEST_ASSERT_TRUE(S_ISDIR(results[i].st_mode));
+            continue;
+        }
+        int n = atoi(dir.entries[i].name + 4);
+        TEST_ASSERT_TRUE(S_ISREG(results[i].st_mode));
+        TEST_ASSERT_EQUAL(n + 1, results[i].st_size);
+        files++;
+    }
+    TEST_ASSERT_EQUAL(40, files);
+    
+    /* Failed stats are reported per entry */
+    unlink("/tmp/test_fast_dir/file00.txt");
+    fast_dir_stat(&ctx, &dir, indices, dir.count, results, ok);
+    for (size_t i = 0; i < dir.count; i++) {
+        TEST_ASSERT_EQUAL(strcmp(dir.entries[i].name, "file00.txt") != 0, ok[i]);
+    }
+    
+    fast_stat_free(&ctx);
+    fast_dir_close(&dir);
+    system("rm -rf /tmp/test_fast_dir");
+}
+
+void test_parallel_restore_writes_tree(void) {
+    system("rm -rf /tmp/test_parallel_restore");
+    mkdir("/tmp/test_parallel_restore", 0755);
+    mkdir("/tmp/test_parallel_restore/.fractyl", 0755);
+    mkdir("/tmp/test_parallel_restore/.fractyl/objects", 0755);
+    mkdir("/tmp/test_parallel_restore/src", 0755);
+    mkdir("/tmp/test_parallel_restore/out", 0755);
+    mkdir("/tmp/test_parallel_restore/src/d1", 0755);
+    mkdir("/tmp/test_parallel_restore/src/d1/d2", 0755);
+    mkdir("/tmp/test_parallel_restore/src/d1-z", 0755);
+    mkdir("/tmp/test_parallel_restore/src/e", 0755);
+    write_text_file("/tmp/test_parallel_restore/src/a.txt", "a");
+    write_text_file("/tmp/test_parallel_restore/src/d1/x.txt", "x");
+    write_text_file("/tmp/test_parallel_restore/src/d1/d2/y.txt", "y");
+    write_text_file("/tmp/test_parallel_restore/src/d1/z.txt", "z");
+    write_text_file("/tmp/test_parallel_restore/src/d1-z/w.txt", "w");
+    write_text_file("/tmp/test_parallel_restore/src/e/f.txt", "f");
+    
+    const char *fractyl_dir = "/tmp/test_parallel_restore/.fractyl";
+    index_t index;
+    index_init(&index);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_parallel("/tmp/test_parallel_restore/src", &index, NULL,
+                                                          fractyl_dir));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_sort(&index, 1));
+    TEST_ASSERT_EQUAL(6, index.count);
+    
+    /* Into an empty tree: every directory has to be made */
+    index_entry_t *entries[6];
+    for (size_t i = 0; i < index.count; i++) entries[i] = &index.entries[i];
+    setenv("FRACTYL_RESTORE_THREADS", "3", 1);
+    restore_stats_t stats;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, restore_files_parallel("/tmp/test_parallel_restore/out", fractyl_dir,
+                                                         entries, index.count, NULL, &stats));
+    unsetenv("FRACTYL_RESTORE_THREADS");
+    TEST_ASSERT_EQUAL(6, stats.written);
+    TEST_ASSERT_EQUAL(0, stats.failed);
+    TEST_ASSERT_EQUAL(6, stats.bytes);
+    TEST_ASSERT_EQUAL(3, stats.threads);
+    
+    const char *names[] = {"a.txt", "d1/x.txt", "d1/d2/y.txt", "d1/z.txt", "d1-z/w.txt", "e/f.txt"};
+    for (size_t i = 0; i < 6; i++) {
+        char path[256];
+        snprintf(path, sizeof(path), "/tmp/test_parallel_restore/out/%s", names[i]);
+        FILE *f = fopen(path, "r");
+        TEST_ASSERT_NOT_NULL_MESSAGE(f, names[i]);
+        char content[8] = {0};
+        TEST_ASSERT_EQUAL(1, fread(content, 1, sizeof(content), f));
+        fclose(f);
+        TEST_ASSERT_EQUAL_INT(strrchr(names[i], '/') ? strrchr(names[i], '/')[1] : names[i][0], content[0]);
+    }
+    
+    /* Restored entries describe the new files */
+    struct stat st;
+    TEST_ASSERT_EQUAL(0, stat("/tmp/test_parallel_restore/out/d1/d2/y.txt", &st));
+    const index_entry_t *y = index_find_entry(&index, "d1/d2/y.txt");
+    TEST_ASSERT_NOT_NULL(y);
+    TEST_ASSERT_EQUAL_UINT64((uint64_t)st.st_ino, y->ino);
+    
+    index_free(&index);
+    system("rm -rf /tmp/test_parallel_restore");
+}
+
+/* The same tree read from tree objects and from a flat index object */
+void test_snapshot_fs_reads_tree_and_flat_snapshots(void) {
+    system("rm -rf /tmp/test_snapshot_fs");
+    mkdir("/tmp/test_snapshot_fs", 0755);
+    mkdir("/tmp/test_snapshot_fs/.fractyl", 0755);
+    mkdir("/tmp/test_snapshot_fs/.fractyl/objects", 0755);
+    mkdir("/tmp/test_snapshot_fs/src", 0755);
+    mkdir("/tmp/test_snapshot_fs/src/d1", 0755);
+    mkdir("/tmp/test_snapshot_fs/src/d1/d2", 0755);
+    mkdir("/tmp/test_snapshot_fs/src/d1-z", 0755);
+    write_text_file("/tmp/test_snapshot_fs/src/a.txt", "alpha");
+    write_text_file("/tmp/test_snapshot_fs/src/d1/d2/y.txt", "why");
+    write_text_file("/tmp/test_snapshot_fs/src/d1/z.txt", "zed");
+    write_text_file("/tmp/test_snapshot_fs/src/d1-z/w.txt", "double-u");
+    
+    const char *fractyl_dir = "/tmp/test_snapshot_fs/.fractyl";
+    index_t index;
+    index_init(&index);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_parallel("/tmp/test_snapshot_fs/src", &index, NULL, fractyl_dir));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, index_sort(&index, 1));
+    unsigned char roots[2][32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, tree_store_index(&index, fractyl_dir, roots[0]));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, object_store_index(&index, fractyl_dir, roots[1]));
+    index_free(&index);
+    
+    for (int r = 0; r < 2; r++) {
+        snapshot_fs_t *fs;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, snapshot_fs_open(&fs, fractyl_dir, roots[r], 1700000000));
+    
+        /* Root lists its children by name */
+        const char *expected[] = {"a.txt", "d1", "d1-z"};
+        const char *name;
+        snapshot_fs_attr_t attr;
+        for (size_t i = 0; i < 3; i++) {
+            TEST_ASSERT_EQUAL(FRACTYL_OK, snapshot_fs_child(fs, SNAPSHOT_FS_ROOT, i, &name, &attr));
+            TEST_ASSERT_EQUAL_STRING(expected[i], name);
+        }
+        TEST_ASSERT_EQUAL(FRACTYL_ERROR_NOT_FOUND, snapshot_fs_child(fs, SNAPSHOT_FS_ROOT, 3, &name, &attr));
+    
+        /* Down to a file by name */
+        snapshot_fs_attr_t d1, d2, y;
+        TEST_ASSERT_EQUAL(FRACTYL_OK, snapshot_fs_lookup(fs, SNAPSHOT_FS_ROOT, "d1", &d1));
+        TEST_ASSERT_TRUE(S_ISDIR(d1.mode));
+        TEST_ASSERT_EQUAL_INT64(1700000000, (int64_t)d1.mtime);
+        TEST_ASSERT_EQUAL(FRACTYL_OK, snapshot_fs_lookup(fs, d1.ino, "d2", &d2));
+        TEST_ASSERT_EQUAL(FRACTYL_OK, snapshot_fs_lookup(fs, d2.ino, "y.txt", &y));
+        TEST_ASSERT_TRUE(S_ISREG(y.mode));
+        TEST_ASSERT_EQUAL(0, y.mode & 0222);
+        TEST_ASSERT_EQUAL(3, y.size);
+        TEST_ASSERT_EQUAL(FRACTYL_ERROR_NOT_FOUND, snapshot_fs_lookup(fs, d1.ino, "missing", &attr));
+        TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, snapshot_fs_lookup(fs, y.ino, "x", &attr));
+    
+        /* Contents, at an offset and past the end */
+        uint64_t handle, again;
+        char buffer[16] = {0};
+        TEST_ASSERT_EQUAL(FRACTYL_OK, snapshot_fs_file_open(fs, y.ino, &handle));
+        TEST_ASSERT_EQUAL(3, snapshot_fs_file_read(fs, handle, buffer, sizeof(buffer), 0));
+        TEST_ASSERT_EQUAL_STRING("why", buffer);
+        TEST_ASSERT_EQUAL(2, snapshot_fs_file_read(fs, handle, buffer, sizeof(buffer), 1));
+        TEST_ASSERT_EQUAL(0, snapshot_fs_file_read(fs, handle, buffer, sizeof(buffer), 3));
+        TEST_ASSERT_EQUAL(FRACTYL_OK, snapshot_fs_file_open(fs, y.ino, &again));
+        TEST_ASSERT_EQUAL_UINT64(handle, again);
+        snapshot_fs_file_release(fs, again);
+        snapshot_fs_file_release(fs, handle);
+        TEST_ASSERT_NOT_EQUAL(FRACTYL_OK, snapshot_fs_file_open(fs, d1.ino, &handle));
+    
+        snapshot_fs_close(fs);
+    }
+    system("rm -rf /tmp/test_snapshot_fs");
+}
+
+void test_fs_watch_reports_changed_paths(void) {
+    system("rm -rf /tmp/test_fs_watch");
+    mkdir("/tmp/test_fs_watch", 0755);
+    mkdir("/tmp/test_fs_watch/sub", 0755);
+    
+    fs_watch_t watch;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, fs_watch_init(&watch, "/tmp/test_fs_watch"));
+    TEST_ASSERT_EQUAL(2, watch.watch_count);
+    
+    write_text_file("/tmp/test_fs_watch/sub/file.txt", "hello");
+    write_text_file("/tmp/test_fs_watch/sub/file.txt", "hello again");
+    mkdir("/tmp/test_fs_watch/newdir", 0755);
+    TEST_ASSERT_TRUE(fs_watch_poll(&watch, 1000) > 0);
+    
+    char **paths = NULL;
+    size_t count = 0;
+    int overflowed = 1;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, fs_watch_take(&watch, &paths, &count, &overflowed));
+    TEST_ASSERT_EQUAL(0, overflowed);
+    
+    /* Deduplicated and sorted */
+    TEST_ASSERT_EQUAL(2, count);
+    TEST_ASSERT_EQUAL_STRING("newdir", paths[0]);
+    TEST_ASSERT_EQUAL_STRING("sub/file.txt", paths[1]);
+    fs_watch_free_paths(paths, count);
+    
+    /* The new directory is watched too */
+    TEST_ASSERT_EQUAL(3, watch.watch_count);
+    write_text_file("/tmp/test_fs_watch/newdir/x.txt", "x");
+    TEST_ASSERT_TRUE(fs_watch_poll(&watch, 1000) > 0);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, fs_watch_take(&watch, &paths, &count, &overflowed));
+    TEST_ASSERT_EQUAL(1, count);
+    TEST_ASSERT_EQUAL_STRING("newdir/x.txt", paths[0]);
+    fs_watch_free_paths(paths, count);
+    
+    fs_watch_free(&watch);
+    system("rm -rf /tmp/test_fs_watch");
+}
+#endif
+
+void test_schedule_debounces_and_backs_off(void) {
+    schedule_policy_t policy = {0};
+    policy.min_interval = 60;
+    policy.max_interval = 240;
+    policy.quiet_period = 5;
+    policy.max_load = 100;
+    policy.max_io_pressure = 20;
+    
+    /* Nothing pending, nothing to do */
+    TEST_ASSERT_FALSE(schedule_watch_due(&policy, 1000, 0, 0, 0, 0));
+    /* Too soon after the last cycle, then still writing, then settled */
+    TEST_ASSERT_FALSE(schedule_watch_due(&policy, 1000, 990, 998, 950, 0));
+    TEST_ASSERT_FALSE(schedule_watch_due(&policy, 1020, 990, 1018, 950, 0));
+    TEST_ASSERT_TRUE(schedule_watch_due(&policy, 1025, 990, 1018, 950, 0));
+    /* Busy puts it off, but not past max_interval */
+    TEST_ASSERT_FALSE(schedule_watch_due(&policy, 1025, 990, 1018, 950, 1));
+    TEST_ASSERT_TRUE(schedule_watch_due(&policy, 1230, 990, 1229, 1200, 1));
+    
+    schedule_load_t load = { 50, -1 };
+    char reason[64];
+    TEST_ASSERT_FALSE(schedule_busy(&policy, &load, reason, sizeof(reason)));
+    load.io_pressure = 35;
+    TEST_ASSERT_TRUE(schedule_busy(&policy, &load, reason, sizeof(reason)));
+    TEST_ASSERT_EQUAL_STRING("I/O pressure 35%", reason);
+    load.load = 150;
+    TEST_ASSERT_TRUE(schedule_busy(&policy, &load, reason, sizeof(reason)));
+    TEST_ASSERT_EQUAL_STRING("load 150% per CPU", reason);
+    
+    /* The periodic wait doubles while busy, up to max_interval */
+    TEST_ASSERT_EQUAL_UINT32(60, schedule_next_wait(&policy, 30, 0, 0));
+    TEST_ASSERT_EQUAL_UINT32(120, schedule_next_wait(&policy, 60, 0, 1));
+    TEST_ASSERT_EQUAL_UINT32(240, schedule_next_wait(&policy, 60, 120, 1));
+    TEST_ASSERT_EQUAL_UINT32(240, schedule_next_wait(&policy, 60, 240, 1));
+    TEST_ASSERT_EQUAL_UINT32(60, schedule_next_wait(&policy, 60, 240, 0));
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void test_governor_enforces_budgets(void) {
+    governor_budget_t budget = {0};
+    budget.read_bytes_per_sec = 1024 * 1024;
+    budget.hash_threads = 2;
+    governor_set(&budget);
+    
+    TEST_ASSERT_EQUAL_INT(2, governor_hash_threads(8));
+    TEST_ASSERT_EQUAL_INT(1, governor_hash_threads(1));
+    TEST_ASSERT_EQUAL_UINT64(10ULL * 1024 * 1024, governor_cycle_allowance(10));
+    
+    /* A second's worth is free; half a second more has to be waited for */
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    governor_read(1024 * 1024);
+    TEST_ASSERT_TRUE(elapsed_seconds(&start) < 0.2);
+    governor_read(512 * 1024);
+    TEST_ASSERT_TRUE(elapsed_seconds(&start) >= 0.4);
+    TEST_ASSERT_TRUE(governor_take_throttled_ms() >= 400);
+    TEST_ASSERT_EQUAL_UINT64(0, governor_take_throttled_ms());
+    /* Writing has no budget here */
+    governor_write(64 * 1024 * 1024);
+    
+    /* Without a budget nothing is held back */
+    governor_set(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    governor_read(64 * 1024 * 1024);
+    TEST_ASSERT_TRUE(elapsed_seconds(&start) < 0.2);
+    TEST_ASSERT_EQUAL_INT(8, governor_hash_threads(8));
+    TEST_ASSERT_EQUAL_UINT64(0, governor_cycle_allowance(10));
+}
+
+void test_scan_journal_records_stored_files(void) {
+    system("rm -rf /tmp/test_scan_journal && mkdir -p /tmp/test_scan_journal/src/d "
+           "/tmp/test_scan_journal/.fractyl/objects");
+    write_text_file("/tmp/test_scan_journal/src/a.txt", "a");
+    write_text_file("/tmp/test_scan_journal/src/d/b.txt", "b");
+    write_text_file("/tmp/test_scan_journal/src/d/c.txt", "c");
+    const char *fractyl_dir = "/tmp/test_scan_journal/.fractyl";
+    
+    /* Every file the scan stores is recorded */
+    scan_journal_t *journal = scan_journal_open(fractyl_dir);
+    TEST_ASSERT_NOT_NULL(journal);
+    index_t scanned;
+    index_init(&scanned);
+    scan_set_journal(journal);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_parallel("/tmp/test_scan_journal/src", &scanned, NULL,
+                                                          fractyl_dir));
+    scan_set_journal(NULL);
+    
+    /* A record whose object is not in the store is dropped on loading */
+    index_entry_t missing;
+    memset(&missing, 0, sizeof(missing));
+    missing.path = "gone.txt";
+    memset(missing.hash, 0xab, sizeof(missing.hash));
+    scan_journal_record(journal, &missing);
+    scan_journal_close(journal);
+    
+    index_t resumed;
+    index_init(&resumed);
+    TEST_ASSERT_EQUAL(3, scan_journal_load(fractyl_dir, &resumed));
+    for (size_t i = 0; i < scanned.count; i++) {
+        const index_entry_t *entry = index_find_entry(&resumed, scanned.entries[i].path);
+        TEST_ASSERT_NOT_NULL(entry);
+        TEST_ASSERT_EQUAL_MEMORY(scanned.entries[i].hash, entry->hash, 32);
+        TEST_ASSERT_EQUAL(scanned.entries[i].size, entry->size);
+        TEST_ASSERT_EQUAL(scanned.entries[i].mtime, entry->mtime);
+    }
+    
+    /* A record cut off by a crash is ignored, and the next run appends
+       after the last whole one */
+    FILE *f = fopen("/tmp/test_scan_journal/.fractyl/" SCAN_JOURNAL_NAME, "ab");
+    TEST_ASSERT_NOT_NULL(f);
+    fwrite("\x09\0\0\0torn", 1, 8, f);
+    fclose(f);
+    journal = scan_journal_open(fractyl_dir);
+    TEST_ASSERT_NOT_NULL(journal);
+    scan_journal_record(journal, &scanned.entries[0]);
+    scan_journal_close(journal);
+    index_t reloaded;
+    index_init(&reloaded);
+    TEST_ASSERT_EQUAL(4, scan_journal_load(fractyl_dir, &reloaded));
+    TEST_ASSERT_EQUAL(3, reloaded.count);
+    
+    /* Gone once the snapshot is taken */
+    scan_journal_remove(fractyl_dir);
+    index_t none;
+    index_init(&none);
+    TEST_ASSERT_EQUAL(0, scan_journal_load(fractyl_dir, &none));
+    
+    index_free(&none);
+    index_free(&reloaded);
+    index_free(&resumed);
+    index_free(&scanned);
+    system("rm -rf /tmp/test_scan_journal");
+}
+
+static char *read_text_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return NULL;
+    char *text = calloc(1, 65536);
+    if (text) fread(text, 1, 65535, fp);
+    fclose(fp);
+    return text;
+}
+
+void test_profile_times_phases(void) {
+    /* Off by default: nothing is timed */
+    TEST_ASSERT_FALSE(profile_enabled());
+    TEST_ASSERT_EQUAL_UINT64(0, profile_begin());
+    
+    system("rm -rf /tmp/test_profile && mkdir -p /tmp/test_profile");
+    write_text_file("/tmp/test_profile/a.txt", "profiled");
+    profile_enable("/tmp/test_profile/summary.json", "/tmp/test_profile/trace.json");
+    TEST_ASSERT_TRUE(profile_enabled());
+    
+    /* hash_file() counts as one hash call of 8 bytes */
+    unsigned char hash[32];
+    TEST_ASSERT_EQUAL(FRACTYL_OK, hash_file("/tmp/test_profile/a.txt", hash));
+    unsigned long long started = profile_begin();
+    TEST_ASSERT_NOT_EQUAL(0, started);
+    profile_end(PROFILE_GIT, started);
+    
+    char summary[4096];
+    size_t needed = profile_format_summary("test", summary, sizeof(summary));
+    TEST_ASSERT_EQUAL(strlen(summary), needed);
+    TEST_ASSERT_NOT_NULL(strstr(summary, "\"command\":\"test\""));
+    TEST_ASSERT_NOT_NULL(strstr(summary, "\"hash\":{\"count\":1,"));
+    TEST_ASSERT_NOT_NULL(strstr(summary, "\"bytes\":8,"));
+    TEST_ASSERT_NOT_NULL(strstr(summary, "\"git\":{\"count\":1,"));
+    TEST_ASSERT_NOT_NULL(strstr(summary, "\"trace_events\":2,"));
+    
+    /* A short buffer still reports the length the summary needs */
+    char small[16];
+    TEST_ASSERT_EQUAL(needed, profile_format_summary("test", small, sizeof(small)));
+    
+    /* The summary and a Chrome trace are written out */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, profile_report("test"));
+    char *written = read_text_file("/tmp/test_profile/summary.json");
+    TEST_ASSERT_NOT_NULL(written);
+    TEST_ASSERT_NOT_NULL(strstr(written, "\"hash\":{\"count\":1,"));
+    free(written);
+    char *trace = read_text_file("/tmp/test_profile/trace.json");
+    TEST_ASSERT_NOT_NULL(trace);
+    TEST_ASSERT_NOT_NULL(strstr(trace, "\"traceEvents\""));
+    TEST_ASSERT_NOT_NULL(strstr(trace, "\"name\":\"git\",\"ph\":\"X\""));
+    free(trace);
+    
+    /* A reset starts the counts again */
+    profile_reset();
+    profile_format_summary("test", summary, sizeof(summary));
+    TEST_ASSERT_NOT_NULL(strstr(summary, "\"hash\":{\"count\":0,"));
+    
+    profile_disable();
+    TEST_ASSERT_EQUAL_UINT64(0, profile_begin());
+    system("rm -rf /tmp/test_profile");
+}
+
+void test_counters_accumulate_per_repository(void) {
+    system("rm -rf /tmp/test_counters && mkdir -p /tmp/test_counters/src /tmp/test_counters/.fractyl");
+    write_text_file("/tmp/test_counters/src/a.txt", "a");
+    write_text_file("/tmp/test_counters/src/b.txt", "bb");
+    const char *fractyl_dir = "/tmp/test_counters/.fractyl";
+    counters_t discard;
+    counters_take(&discard);
+    
+    /* A first scan finds two new files and hashes both */
+    index_t first;
+    index_init(&first);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_parallel("/tmp/test_counters/src", &first, NULL, fractyl_dir));
+    counters_t delta;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, counters_flush(fractyl_dir, &delta));
+    TEST_ASSERT_EQUAL_UINT64(2, delta.values[COUNTER_FILES_SCANNED]);
+    TEST_ASSERT_EQUAL_UINT64(2, delta.values[COUNTER_NEW_FILES]);
+    TEST_ASSERT_EQUAL_UINT64(0, delta.values[COUNTER_STAT_HITS]);
+    TEST_ASSERT_EQUAL_UINT64(3, delta.values[COUNTER_BYTES_HASHED]);
+    TEST_ASSERT_EQUAL_UINT64(1, delta.values[COUNTER_DIR_READS]);
+    TEST_ASSERT_FALSE(counters_pending());
+    
+    /* Once they are no longer racily clean, a second scan reads neither */
+    sleep(1);
+    index_t prev;
+    index_init(&prev);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_parallel("/tmp/test_counters/src", &prev, &first, fractyl_dir));
+    counters_take(&discard);
+    index_t second;
+    index_init(&second);
+    TEST_ASSERT_EQUAL(FRACTYL_OK, scan_directory_parallel("/tmp/test_counters/src", &second, &prev, fractyl_dir));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, counters_flush(fractyl_dir, &delta));
+    TEST_ASSERT_EQUAL_UINT64(2, delta.values[COUNTER_STAT_HITS]);
+    TEST_ASSERT_EQUAL_UINT64(0, delta.values[COUNTER_BYTES_HASHED]);
+    
+    /* The file sums every flush */
+    counters_t total;
+    TEST_ASSERT_EQUAL(FRACTYL_OK, counters_load(fractyl_dir, &total));
+    TEST_ASSERT_NOT_EQUAL(0, total.since);
+    TEST_ASSERT_EQUAL_UINT64(4, total.values[COUNTER_FILES_SCANNED]);
+    TEST_ASSERT_EQUAL_UINT64(2, total.values[COUNTER_STAT_HITS]);
+    TEST_ASSERT_EQUAL_UINT64(2, total.values[COUNTER_NEW_FILES]);
+    char line[1024];
+    counters_describe(&total, line, sizeof(line));
+    TEST_ASSERT_NOT_NULL(strstr(line, "4 files scanned: 50.0% stat hits"));
+    
+    /* Reset removes them */
+    TEST_ASSERT_EQUAL(FRACTYL_OK, counters_reset_file(fractyl_dir));
+    TEST_ASSERT_EQUAL(FRACTYL_OK, counters_load(fractyl_dir, &total));
+    TEST_ASSERT_EQUAL(0, total.since);
+    TEST_ASSERT_EQUAL_UINT64(0, total.values[COUNTER_FILES_SCANNED]);
+    
+    index_free(&second);
+    index_free(&prev);
+    index_free(&first);
+    system("rm -rf /tmp/test_counters");
+}
+
+void test_lock_shared_readers_and_exclusive_writers(void) {
+    system("rm -rf /tmp/test_lock && mkdir -p /tmp/test_lock");
+    
+    /* Readers share the lock; an exclusive holder has to wait for them */
+    fractyl_lock_t reader1, reader2, writer, publish;
+    TEST_ASSERT_EQUAL(0, fractyl_lock_wait_acquire_shared("/tmp/test_lock", &reader1, 1));
+    TEST_ASSERT_EQUAL(0, fractyl_lock_wait_acquire_shared("/tmp/test_lock", &reader2, 1));
+    TEST_ASSERT_NOT_EQUAL(0, fractyl_lock_acquire("/tmp/test_lock", &writer));
+    TEST_ASSERT_NOT_EQUAL(0, fractyl_lock_wait_acquire("/tmp/test_lock", &writer, 1));
+    
+    /* Publishing does not wait for readers */
+    TEST_ASSERT_EQUAL(0, fractyl_lock_wait_publish("/tmp/test_lock", &publish, 1));
+    fractyl_lock_release(&publish);
+    
+    pid_t holder = -1;
+    TEST_ASSERT_EQUAL(1, fractyl_lock_check("/tmp/test_lock", &holder));
+    TEST_ASSERT_EQUAL(0, holder);
+    fractyl_lock_release(&reader1);
+    fractyl_lock_release(&reader2);
+    TEST_ASSERT_EQUAL(0, fractyl_lock_check("/tmp/test_lock", &holder));
+    
+    /* An exclusive holder is named and keeps readers out */
+    TEST_ASSERT_EQUAL(0, fractyl_lock_acquire("/tmp/test_lock", &writer));
+    TEST_ASSERT_EQUAL(1, fractyl_lock_check("/tmp/test_lock", &holder));
+    TEST_ASSERT_EQUAL(getpid(), holder);
+    TEST_ASSERT_NOT_EQUAL(0, fractyl_lock_wait_acquire_shared("/tmp/test_lock", &reader1, 1));
+    fractyl_lock_release(&writer);
+    
+    /* The file stays, free */
+    TEST_ASSERT_TRUE(file_exists("/tmp/test_lock/fractyl.lock"));
+    TEST_ASSERT_EQUAL(0, fractyl_lock_check("/tmp/test_lock", &holder));
+    TEST_ASSERT_EQUAL(0, fractyl_lock_wait_acquire_shared("/tmp/test_lock", &reader1, 1));
+    fractyl_lock_release(&reader1);
+    system("rm -rf /tmp/test_lock");
+}
+
 /* Unity test runner */
 int main(void) {
     UNITY_BEGIN();
@@ -241,5 +1640,38 @@ int main(void) {
     RUN_TEST(test_git_is_repository_root_with_null_path);
     RUN_TEST(test_git_is_repository_root_with_nonexistent_path);
     
+    /* Ignore engine tests */
+    RUN_TEST(test_ignore_engine_root_rules);
+    RUN_TEST(test_ignore_engine_nested_gitignore);
+    
+    /* Incremental scan and watch tests */
+    RUN_TEST(test_scan_paths_incremental_matches_full_scan);
+    RUN_TEST(test_binary_scan_windows_match_full_scan);
+    RUN_TEST(test_bounded_queue_passes_items_in_order);
+    RUN_TEST(test_bounded_queue_peeks_ahead_of_pop);
+    RUN_TEST(test_concurrency_plan_and_adaptive_gate);
+    RUN_TEST(test_arena_allocations_survive_take);
+    RUN_TEST(test_binary_index_mapped_with_overlay);
+    RUN_TEST(test_binary_index_directory_records);
+    RUN_TEST(test_catalog_tracks_snapshots);
+    RUN_TEST(test_catalog_snapshot_graph);
+    RUN_TEST(test_parallel_restore_writes_tree);
+    RUN_TEST(test_snapshot_fs_reads_tree_and_flat_snapshots);
+    RUN_TEST(test_snapshot_table_spans_branches);
+    RUN_TEST(test_paths_for_each_branch_finds_nested_branches);
+    RUN_TEST(test_git_reads_head_without_git);
+    RUN_TEST(test_diff_cache_stores_and_evicts_lru);
+    RUN_TEST(test_simd_kernels_match_scalar);
+    RUN_TEST(test_schedule_debounces_and_backs_off);
+    RUN_TEST(test_lock_shared_readers_and_exclusive_writers);
+    RUN_TEST(test_governor_enforces_budgets);
+    RUN_TEST(test_scan_journal_records_stored_files);
+    RUN_TEST(test_profile_times_phases);
+    RUN_TEST(test_counters_accumulate_per_repository);
+#ifdef __linux__
+    RUN_TEST(test_fast_dir_lists_and_stats_in_batches);
+    RUN_TEST(test_fs_watch_reports_changed_paths);
+#endif
+    
     return UNITY_END();
 }
\ No newline at end of file